@@ -0,0 +1,29 @@
+#ifndef _CKSUM_H_INCLUDED_
+#define _CKSUM_H_INCLUDED_
+
+/*
+ * チェックサム・CRCのライブラリ（cksum.c）
+ * どれも前回の戻り値を渡して続きを計算できる（分割したバッファや、
+ * 受信しながらの計算に使える）。最初の値と最後の処理は以下の通り。
+ *   cksum_sum8():  0 から。XMODEMのチェックサム
+ *   cksum_crc16(): 0 から。XMODEMのCRC-16(CCITT, 多項式 0x1021)
+ *   cksum_crc32(): CKSUM_CRC32_INIT から、最後に CKSUM_CRC32_XOR とXORする。
+ *                  イメージのCRC32(多項式 0xedb88320, crc32.c)
+ *   cksum_inet():  0 から、最後に cksum_inet_fold() する。
+ *                  インターネットチェックサム(16ビットのビッグエンディアンの和)
+ * cksum_inet() は奇数長のバッファを渡すと最後のバイトを上位に置くので、
+ * 続きを計算するときは偶数長に区切ること。
+ * ブートローダはCRCの表を256エントリ(ROM上)、OSは16エントリ(RAM上)にする。
+ * OSを make ROMLIB=1 でビルドしたときは、ブートローダのものを使う(service.h)。
+ * os/cksum.h と同じ内容にすること。
+ */
+#define CKSUM_CRC32_INIT 0xffffffff
+#define CKSUM_CRC32_XOR  0xffffffff
+
+uint8 cksum_sum8(uint8 sum, const void *buf, long size);
+uint16 cksum_crc16(uint16 crc, const void *buf, long size);
+uint32 cksum_crc32(uint32 crc, const void *buf, long size);
+uint32 cksum_inet(uint32 sum, const void *buf, long size);
+uint16 cksum_inet_fold(uint32 sum);
+
+#endif
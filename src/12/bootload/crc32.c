@@ -0,0 +1,88 @@
+#include "defines.h"
+#include "cksum.h"
+#include "crc32.h"
+
+/*
+ * イメージのCRC32(多項式 0xedb88320, 初期値・最終XOR 0xffffffff)
+ * XMODEMで受信したブロックを順に crc32_update() に渡して、受信しながら計算する。
+ * イメージの末尾には、ツール(tools/kzpack)が以下のフッタを付ける。
+ *   CRC32(4バイト, ビッグエンディアン) + "KZCR"
+ * XMODEMは最後のブロックの余りを 0x1a(ctrl+z)で埋めるので、末尾の 0x1a は
+ * 保留しておき、続けて他のバイトが来たときにデータとして扱う。
+ * また最後の CRC32_FOOTER_SIZE バイトはフッタの可能性があるので、
+ * 遅らせて計算に入れる。
+ */
+
+static struct {
+  uint32 crc;
+  long pad;  /* 保留している 0x1a の数 */
+  int len;   /* footer に入っているバイト数 */
+  int head;  /* footer の最も古いバイトの位置（リングバッファ） */
+  unsigned char footer[CRC32_FOOTER_SIZE]; /* 最後のバイト（遅延させている分） */
+} crc32;
+
+int crc32_init(void)
+{
+  crc32.crc = CKSUM_CRC32_INIT;
+  crc32.pad = 0;
+  crc32.len = 0;
+  crc32.head = 0;
+  return 0;
+}
+
+/* 1バイトを遅延させる部分に入れ、押し出されたバイトをCRCに入れる */
+static void crc32_push(unsigned char c)
+{
+  if (crc32.len < CRC32_FOOTER_SIZE) {
+    crc32.footer[crc32.len++] = c;
+    return;
+  }
+  crc32.crc = cksum_crc32(crc32.crc, &crc32.footer[crc32.head], 1);
+  crc32.footer[crc32.head] = c;
+  crc32.head = (crc32.head + 1) & (CRC32_FOOTER_SIZE - 1);
+}
+
+/* フッタの i バイト目 */
+#define CRC32_FOOTER(i) \
+  (crc32.footer[(crc32.head + (i)) & (CRC32_FOOTER_SIZE - 1)])
+
+int crc32_update(char *buf, int size)
+{
+  unsigned char c;
+
+  for (; size > 0; size--) {
+    c = *(buf++);
+    if (c == 0x1a) {
+      crc32.pad++;
+      continue;
+    }
+    for (; crc32.pad > 0; crc32.pad--)
+      crc32_push(0x1a);
+    crc32_push(c);
+  }
+  return 0;
+}
+
+/*
+ * 受信したイメージの検査
+ * フッタがCRCと一致すれば1, フッタがなければ0, 一致しなければ-1を返す
+ */
+int crc32_check(void)
+{
+  uint32 crc;
+
+  if ((crc32.len < CRC32_FOOTER_SIZE)
+      || (CRC32_FOOTER(4) != 'K') || (CRC32_FOOTER(5) != 'Z')
+      || (CRC32_FOOTER(6) != 'C') || (CRC32_FOOTER(7) != 'R'))
+    return 0;
+
+  crc = ((uint32)CRC32_FOOTER(0) << 24) | ((uint32)CRC32_FOOTER(1) << 16)
+    | ((uint32)CRC32_FOOTER(2) << 8) | CRC32_FOOTER(3);
+  return (crc == (crc32.crc ^ CKSUM_CRC32_XOR)) ? 1 : -1;
+}
+
+/* メモリ上の領域のCRC32（差分イメージで、ロード済みのセグメントの確認に使う） */
+uint32 crc32_calc(char *buf, long size)
+{
+  return cksum_crc32(CKSUM_CRC32_INIT, buf, size) ^ CKSUM_CRC32_XOR;
+}
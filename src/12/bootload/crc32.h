@@ -0,0 +1,11 @@
+#ifndef _CRC32_H_INCLUDED_
+#define _CRC32_H_INCLUDED_
+
+#define CRC32_FOOTER_SIZE 8 /* CRC32(4バイト) + "KZCR" (2のべき乗に合わせてある) */
+
+int crc32_init(void);
+int crc32_update(char *buf, int size);
+int crc32_check(void);
+uint32 crc32_calc(char *buf, long size);
+
+#endif
@@ -0,0 +1,70 @@
+#include "defines.h"
+#include "dram.h"
+
+/*
+ * 外部DRAMの初期化(AKI-H8/3069F)
+ * 2MB(1M×16ビット)のDRAMがエリア2(0x400000～0x5fffff)に接続されている。
+ * DRAMコントローラはバスコントローラに内蔵されていて、
+ * RAS はCS2端子、UCAS/LCAS はバスコントローラが自動的に出力する。
+ */
+
+#define H8_3069F_P1DDR  ((volatile uint8 *)0xfee000)
+#define H8_3069F_P2DDR  ((volatile uint8 *)0xfee001)
+#define H8_3069F_P8DDR  ((volatile uint8 *)0xfee007)
+#define H8_3069F_ABWCR  ((volatile uint8 *)0xfee020)
+#define H8_3069F_ASTCR  ((volatile uint8 *)0xfee021)
+#define H8_3069F_DRCRA  ((volatile uint8 *)0xfee026)
+#define H8_3069F_DRCRB  ((volatile uint8 *)0xfee027)
+#define H8_3069F_RTMCSR ((volatile uint8 *)0xfee028)
+#define H8_3069F_RTCOR  ((volatile uint8 *)0xfee02a)
+
+#define H8_3069F_AREA2 (1<<2)
+
+#define H8_3069F_DRCRA_DRAS_AREA2 (1<<5) /* エリア2をDRAM空間にする */
+#define H8_3069F_DRCRA_BE         (1<<4) /* 高速ページモード */
+
+#define H8_3069F_DRCRB_MXC_10BIT  (2<<6) /* カラムアドレス10ビット */
+#define H8_3069F_DRCRB_RCYCE      (1<<4) /* リフレッシュサイクル有効 */
+
+#define H8_3069F_RTMCSR_CKS_32    (3<<3) /* リフレッシュタイマはφ/32 */
+#define H8_3069F_RTMCSR_RESERVED  0x07   /* 予約ビット(1を書く) */
+
+/*
+ * リフレッシュ間隔: (RTCOR+1)×32/20MHz = 12.8us
+ * (1024行を16msでリフレッシュするには15.6us以下にすればよい)
+ */
+#define DRAM_RTCOR 7
+
+int dram_init(void)
+{
+    volatile int i;
+
+    /* アドレスバス A0～A10 を出力にする(行・列アドレスを多重化して出力) */
+    *H8_3069F_P1DDR = 0xff;
+    *H8_3069F_P2DDR = 0x07;
+
+    /*
+     * CS2 を出力にする(RAS として使う)。P8DDR は書き込み専用で読み出せないので、
+     * 他の端子は入力のままにして書き込む（OSの interrupt.c の PORT8_DDR_BOOT）
+     */
+    *H8_3069F_P8DDR = H8_3069F_AREA2;
+
+    /* エリア2は16ビットバス・3ステートアクセス */
+    *H8_3069F_ABWCR &= ~H8_3069F_AREA2;
+    *H8_3069F_ASTCR |= H8_3069F_AREA2;
+
+    /* DRAMコントローラの設定 */
+    *H8_3069F_DRCRB = H8_3069F_DRCRB_MXC_10BIT | H8_3069F_DRCRB_RCYCE;
+    *H8_3069F_RTCOR = DRAM_RTCOR;
+    *H8_3069F_RTMCSR = H8_3069F_RTMCSR_CKS_32 | H8_3069F_RTMCSR_RESERVED;
+    *H8_3069F_DRCRA = H8_3069F_DRCRA_DRAS_AREA2 | H8_3069F_DRCRA_BE;
+
+    /*
+     * 電源投入後は、アクセスする前に200us以上待って
+     * リフレッシュサイクルを8回以上実行する必要がある
+     */
+    for (i = 0; i < 1000; i++)
+        ;
+
+    return 0;
+}
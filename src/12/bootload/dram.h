@@ -0,0 +1,6 @@
+#ifndef _DRAM_H_INCLUDED_
+#define _DRAM_H_INCLUDED_
+
+int dram_init(void);
+
+#endif
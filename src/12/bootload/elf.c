@@ -1,5 +1,8 @@
 #include "defines.h"
 #include "elf.h"
+#include "lzss.h"
+#include "flash.h"
+#include "crc32.h"
 #include "lib.h"
 
 struct elf_header {
@@ -38,6 +41,27 @@ struct elf_program_header {
   long align;
 };
 
+/*
+ * セグメントがLZSSで圧縮されている(tools/kzpack で圧縮したイメージ)
+ * プログラムヘッダの flags のOS固有の範囲(PF_MASKOS)を使う。
+ * file_size は圧縮後のサイズで、展開後のサイズは memory_size 以下となる。
+ */
+#define ELF_PF_KZ_LZSS 0x00100000
+
+/*
+ * セグメントのデータを含まない(tools/kzpack -d で作成した差分イメージ)
+ * 前回ロードしたイメージから変わっていない読み出し専用のセグメントで、
+ * ロード済みの内容をそのまま使う。file_size は0で、align に
+ * セグメントの内容(memory_size バイト)のCRC32が入っている。
+ * 内容が一致しなければ（リセットで壊れた、別のイメージを転送したなど）
+ * エラーとするので、その場合は差分でないイメージを転送すること。
+ */
+#define ELF_PF_KZ_KEEP 0x00200000
+
+#define ELF_KEEP_IS_VALID(phdr) \
+  (crc32_calc((char *)(phdr)->physical_addr, (phdr)->memory_size) \
+   == (uint32)(phdr)->align)
+
 static int elf_check(struct elf_header *header)
 {
   if (memcmp(header->id.magic, "\x7f" "ELF", 4))
@@ -55,32 +79,397 @@ static int elf_check(struct elf_header *header)
   return 0;
 }
 
-static int elf_load_program(struct elf_header *header)
+#define ELF_PHDR(buf, header, i) ((struct elf_program_header *) \
+  ((buf) + (header)->program_header_offset \
+   + (header)->program_header_size * (i)))
+
+/* セグメントがXIPの領域（フラッシュROM）に置かれるか */
+#define ELF_IS_XIP(phdr) (((phdr)->physical_addr >= FLASH_XIP_ADDR) \
+  && ((phdr)->physical_addr < FLASH_XIP_ADDR + FLASH_XIP_SIZE))
+
+/* 範囲 [a, a + asize) と [b, b + bsize) が重なるか */
+#define ELF_OVERLAP(a, asize, b, bsize) \
+  (((a) < (b) + (bsize)) && ((b) < (a) + (asize)))
+
+/*
+ * セグメントの書き込み先(memory_size バイト)の確認
+ * OSに使わせるRAMの領域(ld.scr の loadram と外部DRAM)に収まり、
+ * ブートローダのデータ・スタック領域と重ならないこと。
+ */
+static int elf_check_addr(long addr, long size)
 {
-  int i;
+  extern char loadram_start, eloadram, dram_start, edram;
+  extern char data_start, bootstack;
+
+  if (size < 0)
+    return -1;
+  if (!((addr >= (long)&loadram_start) && (addr + size <= (long)&eloadram))
+      && !((addr >= (long)&dram_start) && (addr + size <= (long)&edram)))
+    return -1;
+  if (ELF_OVERLAP(addr, size, (long)&data_start, &bootstack - &data_start))
+    return -1;
+  return 0;
+}
+
+/*
+ * フラッシュROMに置くセグメント(XIPのOSの .text/.rodata)の書き込み
+ * 既に同じ内容が書き込まれていれば（フラッシュROMに保存したイメージからの
+ * 自動起動など）何もしない。RAMへのロードより前に行うこと
+ * （書き込みの関数をOSのRAMの領域にコピーして使うため）。
+ */
+static int elf_load_xip(char *buf, struct elf_header *header)
+{
+  int i, need = 0, keep = 0;
   struct elf_program_header *phdr;
 
   for (i = 0; i < header->program_header_num; i++) {
-    phdr = (struct elf_program_header *)
-      ((char *)header
-             + header->program_header_offset
-             + header->program_header_size * i);
+    phdr = ELF_PHDR(buf, header, i);
+    if ((phdr->type != 1) || !ELF_IS_XIP(phdr)) continue;
+    if (phdr->flags & ELF_PF_KZ_KEEP) {
+      if (!ELF_KEEP_IS_VALID(phdr))
+        return -1;
+      keep = 1;
+      continue;
+    }
+    /* 圧縮したセグメントやゼロクリアが必要なセグメントは置けない */
+    if ((phdr->flags & ELF_PF_KZ_LZSS) || (phdr->memory_size != phdr->file_size))
+      return -1;
+    if (memcmp((char *)phdr->physical_addr, buf + phdr->offset,
+               phdr->file_size))
+      need = 1;
+  }
+  if (!need)
+    return 0;
+  /* 消去するとデータを持たないセグメントが消えてしまう */
+  if (keep)
+    return -1;
+
+  if (flash_erase_xip() < 0)
+    return -1;
+  for (i = 0; i < header->program_header_num; i++) {
+    phdr = ELF_PHDR(buf, header, i);
+    if ((phdr->type != 1) || !ELF_IS_XIP(phdr)) continue;
+    if (flash_program_xip(phdr->physical_addr, buf + phdr->offset,
+                          phdr->file_size) < 0)
+      return -1;
+  }
+  return 0;
+}
 
+/*
+ * ロードの前の、全てのセグメントの確認（何も書き込まないうちに行う）
+ * ファイル中の範囲がイメージ(size バイト)に収まり、書き込み先が
+ * elf_check_addr() を満たすこと。さらに、書き込み先が後で読む部分
+ * （後のプログラムヘッダと、後のセグメントのデータ）と重ならないこと。
+ * 受信バッファのイメージをバッファと重なる位置にロードしても、
+ * 読み終えた部分を上書きするだけならば壊れない。
+ */
+static int elf_check_program(char *buf, long size, struct elf_header *header)
+{
+  int i, j;
+  struct elf_program_header *phdr, *p;
+  long dst, src;
+
+  if ((header->program_header_offset < 0)
+      || (header->program_header_num < 0)
+      || (header->program_header_size < sizeof(struct elf_program_header))
+      || (header->program_header_offset
+          + (long)header->program_header_size * header->program_header_num
+          > size))
+    return -1;
+
+  for (i = 0; i < header->program_header_num; i++) {
+    phdr = ELF_PHDR(buf, header, i);
     if (phdr->type != 1) continue;
 
-    memcpy((char *)phdr->physical_addr, (char *)header + phdr->offset, phdr->file_size);
-    memset((char *)phdr->physical_addr + phdr->file_size, 0, phdr->memory_size - phdr->file_size);
+    if ((phdr->offset < 0) || (phdr->file_size < 0)
+        || (phdr->offset + phdr->file_size > size))
+      return -1;
+    /* 圧縮していなければ、ファイル中のサイズはメモリ上のサイズ以下 */
+    if (!(phdr->flags & ELF_PF_KZ_LZSS) && (phdr->file_size > phdr->memory_size))
+      return -1;
+    /* XIPのセグメントはフラッシュROMに書き込むので、RAMは上書きしない */
+    if (ELF_IS_XIP(phdr) || (phdr->flags & ELF_PF_KZ_KEEP)) continue;
+
+    dst = phdr->physical_addr;
+    src = (long)buf + phdr->offset;
+    if (elf_check_addr(dst, phdr->memory_size) < 0)
+      return -1;
+
+    for (j = i + 1; j < header->program_header_num; j++) {
+      p = ELF_PHDR(buf, header, j);
+      if (ELF_OVERLAP(dst, phdr->memory_size,
+                      (long)p, header->program_header_size))
+        return -1;
+      if ((p->type == 1) && !ELF_IS_XIP(p) && !(p->flags & ELF_PF_KZ_KEEP)
+          && ELF_OVERLAP(dst, phdr->memory_size,
+                         (long)buf + p->offset, p->file_size))
+        return -1;
+    }
+
+    /*
+     * 自身のデータとの重なり
+     * memcpy() は先頭から順にコピーするので、書き込み先が前にあれば
+     * 重なってもよい。展開は読むより速く書き進むので、重なってはいけない。
+     */
+    if ((dst != src)
+        && ELF_OVERLAP(dst, phdr->memory_size, src, phdr->file_size)
+        && ((phdr->flags & ELF_PF_KZ_LZSS) || (dst > src)))
+      return -1;
+  }
+
+  return 0;
+}
+
+static int elf_load_program(char *buf, long size, struct elf_header *header)
+{
+  int i;
+  struct elf_program_header *phdr;
+  lzss_t lz;
+  long load_size;
+
+  if (elf_check_program(buf, size, header) < 0)
+    return -1;
+
+  if (elf_load_xip(buf, header) < 0)
+    return -1;
+
+  for (i = 0; i < header->program_header_num; i++) {
+    phdr = ELF_PHDR(buf, header, i);
+
+    if ((phdr->type != 1) || ELF_IS_XIP(phdr)) continue;
+
+    if (phdr->flags & ELF_PF_KZ_KEEP) {
+      if (!ELF_KEEP_IS_VALID(phdr))
+        return -1;
+      continue;
+    }
+    if (phdr->flags & ELF_PF_KZ_LZSS) {
+      lzss_init(&lz, (char *)phdr->physical_addr);
+      lzss_decode(&lz, buf + phdr->offset, phdr->file_size);
+      load_size = (char *)lz.dst - (char *)phdr->physical_addr;
+      if (load_size > phdr->memory_size)
+        return -1;
+    } else {
+      /* 既に書き込み先にある(その位置に受信した)ならばコピーしない */
+      if ((char *)phdr->physical_addr != buf + phdr->offset)
+        memcpy((char *)phdr->physical_addr, buf + phdr->offset, phdr->file_size);
+      load_size = phdr->file_size;
+    }
+    memset((char *)phdr->physical_addr + load_size, 0,
+           phdr->memory_size - load_size);
   }
 
   return 0;
 }
 
-char *elf_load(char *buf)
+/*
+ * イメージ(size バイト)のロード
+ * ELFヘッダはロードで上書きされてもよいように、先にコピーしておく。
+ */
+char *elf_load(char *buf, long size)
+{
+  struct elf_header header;
+
+  if (!buf || (size < (long)sizeof(header))) return NULL;
+  memcpy(&header, buf, sizeof(header));
+
+  if (elf_check(&header) < 0) return NULL;
+  if (elf_load_program(buf, size, &header) < 0) return NULL;
+
+  return (char *)header.entry_point;
+}
+
+/*
+ * ストリーミングでのロード
+ * XMODEMで受信したブロックを elf_stream_write() にファイルの先頭から順に
+ * 渡し、ロード対象のセグメントの部分をそのまま physical_addr に書き込む
+ * （受信バッファを経由しないので、イメージの大きさが受信バッファに
+ *  制限されず、受信後の再コピーも不要）。
+ * 先頭から順に見ていくので、プログラムヘッダはセグメントより前にあり、
+ * セグメントはヘッダを含まないこと。圧縮されたセグメントは受信しながら展開する
+ * （ファイル中でセグメントは重ならないので、展開の状態は1つでよい）。
+ */
+#define ELF_STREAM_SEGMENT_NUM 6
+
+static struct {
+  long pos;   /* 次に受け取るデータのファイル中の位置 */
+  int error;
+  union {
+    struct elf_header header;
+    struct elf_program_header phdr;
+  } h;        /* 受信中のヘッダ */
+  int hsize;  /* h に受け取ったサイズ */
+  int phindex; /* 受信中のプログラムヘッダの番号(-1ならELFヘッダ) */
+  long entry_point;
+  long phoff;
+  short phsize;
+  short phnum;
+  int num;
+  struct {
+    long offset;
+    long addr;
+    long file_size;
+    long memory_size;
+    long flags;
+    long load_size; /* 書き込んだ(展開した)サイズ */
+  } seg[ELF_STREAM_SEGMENT_NUM];
+  lzss_t lz;
+} stream;
+
+/*
+ * セグメントの書き込み先が、ブートローダが使っている領域と重ならないか
+ * （elf_check_addr() に加えて、ブロックバッファ）
+ */
+static int elf_stream_check_addr(long addr, long size)
 {
-  struct elf_header *header = (struct elf_header *)buf;
+  extern char xmodembuf_start, exmodembuf;
+
+  if (elf_check_addr(addr, size) < 0)
+    return -1;
+  if (ELF_OVERLAP(addr, size, (long)&xmodembuf_start,
+                  &exmodembuf - &xmodembuf_start))
+    return -1;
+  return 0;
+}
+
+/* 受信し終えたヘッダの処理 */
+static int elf_stream_header(void)
+{
+  struct elf_program_header *phdr = &stream.h.phdr;
+
+  if (stream.phindex < 0) {
+    if (elf_check(&stream.h.header) < 0)
+      return -1;
+    if (stream.h.header.program_header_size < sizeof(struct elf_program_header))
+      return -1;
+    stream.entry_point = stream.h.header.entry_point;
+    stream.phoff  = stream.h.header.program_header_offset;
+    stream.phsize = stream.h.header.program_header_size;
+    stream.phnum  = stream.h.header.program_header_num;
+  } else if (phdr->type == 1) {
+    /* ヘッダより前(通り過ぎた部分)にあるセグメントはロードできない */
+    if ((stream.num == ELF_STREAM_SEGMENT_NUM)
+        || (phdr->file_size
+            && (phdr->offset < stream.phoff + stream.phnum * stream.phsize))
+        || ELF_IS_XIP(phdr) /* XIPのOSは load でロードすること */
+        || (phdr->offset < 0) || (phdr->file_size < 0)
+        || (!(phdr->flags & ELF_PF_KZ_LZSS)
+            && (phdr->file_size > phdr->memory_size))
+        || (elf_stream_check_addr(phdr->physical_addr, phdr->memory_size) < 0)
+        || ((phdr->flags & ELF_PF_KZ_KEEP) && !ELF_KEEP_IS_VALID(phdr)))
+      return -1;
+    stream.seg[stream.num].offset      = phdr->offset;
+    stream.seg[stream.num].addr        = phdr->physical_addr;
+    stream.seg[stream.num].file_size   = phdr->file_size;
+    stream.seg[stream.num].memory_size = phdr->memory_size;
+    stream.seg[stream.num].flags       = phdr->flags;
+    /* データを持たないセグメントは、ロード済みとして扱う */
+    stream.seg[stream.num].load_size
+      = (phdr->flags & ELF_PF_KZ_KEEP) ? phdr->memory_size : 0;
+    stream.num++;
+  }
+  stream.phindex++;
+  stream.hsize = 0;
+  return 0;
+}
 
-  if (elf_check(header) < 0) return NULL;
-  if (elf_load_program(header) < 0) return NULL;
+int elf_stream_init(void)
+{
+  memset(&stream, 0, sizeof(stream));
+  stream.phindex = -1;
+  return 0;
+}
+
+int elf_stream_write(char *buf, int size, void *arg)
+{
+  long start, s, e;
+  int i, n, need;
+
+  if (stream.error)
+    return -1;
+
+  /* ヘッダ(ELFヘッダと全てのプログラムヘッダ)を受け取る */
+  while ((size > 0) && (stream.phindex < stream.phnum)) {
+    if (stream.phindex < 0) {
+      start = 0;
+      need = sizeof(struct elf_header);
+    } else {
+      start = stream.phoff + stream.phindex * stream.phsize;
+      need = sizeof(struct elf_program_header);
+    }
+    if (stream.pos < start) {
+      /* ヘッダの前の部分は読み飛ばす */
+      n = (start - stream.pos < size) ? start - stream.pos : size;
+    } else {
+      n = need - stream.hsize;
+      if (n > size)
+        n = size;
+      memcpy((char *)&stream.h + stream.hsize, buf, n);
+      stream.hsize += n;
+    }
+    buf += n;
+    size -= n;
+    stream.pos += n;
+    if ((stream.hsize == need) && (elf_stream_header() < 0))
+      goto err;
+  }
+
+  /* セグメントに含まれる部分を書き込む */
+  for (i = 0; i < stream.num; i++) {
+    s = stream.seg[i].offset;
+    e = s + stream.seg[i].file_size;
+    if (s < stream.pos)
+      s = stream.pos;
+    if (e > stream.pos + size)
+      e = stream.pos + size;
+    if (s >= e)
+      continue;
+    if (stream.seg[i].flags & ELF_PF_KZ_LZSS) {
+      if (s == stream.seg[i].offset)
+        lzss_init(&stream.lz, (char *)stream.seg[i].addr);
+      lzss_decode(&stream.lz, buf + (s - stream.pos), e - s);
+      stream.seg[i].load_size = (char *)stream.lz.dst - (char *)stream.seg[i].addr;
+      if (stream.seg[i].load_size > stream.seg[i].memory_size)
+        goto err;
+    } else {
+      /* 受信側が書き込み先に直接受信していれば、コピーしない */
+      if ((char *)stream.seg[i].addr + (s - stream.seg[i].offset)
+          != buf + (s - stream.pos))
+        memcpy((char *)stream.seg[i].addr + (s - stream.seg[i].offset),
+               buf + (s - stream.pos), e - s);
+      stream.seg[i].load_size = e - stream.seg[i].offset;
+    }
+  }
+  stream.pos += size;
+
+  return 0;
+
+err:
+  stream.error = 1;
+  return -1;
+}
+
+/*
+ * ストリーミングでのロードの終了
+ * 全てのセグメントを受信していれば、ファイル中にない部分(.bss)をゼロクリアして
+ * エントリポイントを返す
+ */
+char *elf_stream_end(void)
+{
+  int i;
+
+  if (stream.error || (stream.phindex < 0) || (stream.phindex < stream.phnum))
+    return NULL;
+
+  for (i = 0; i < stream.num; i++) {
+    if (stream.seg[i].offset + stream.seg[i].file_size > stream.pos)
+      return NULL;
+  }
+  for (i = 0; i < stream.num; i++) {
+    memset((char *)stream.seg[i].addr + stream.seg[i].load_size, 0,
+           stream.seg[i].memory_size - stream.seg[i].load_size);
+  }
 
-  return (char *)header->entry_point;
+  return (char *)stream.entry_point;
 }
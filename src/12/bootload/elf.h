@@ -1,6 +1,9 @@
 #ifndef _ELF_H_INCLUDED_
 #define _ELF_H_INCLUDED_
 
-char *elf_load(char *buf);
+char *elf_load(char *buf, long size);
+int elf_stream_init(void);
+int elf_stream_write(char *buf, int size, void *arg);
+char *elf_stream_end(void);
 
 #endif
@@ -0,0 +1,319 @@
+#include "defines.h"
+#include "flash.h"
+#include "lib.h"
+
+/*
+ * 内蔵フラッシュROMの書き込み・消去(H8/3069F のユーザプログラムモード)
+ * FWE端子を1にしておくこと（ボードのスイッチで設定する）。
+ * 書き込み・消去中はフラッシュROMを読めないので、実際に操作する関数は
+ * .ramtext セクションに置き、使う前にRAM(ld.scr の ramtext)にコピーする。
+ * ramtext はOSのロード先の先頭なので、ステージングしたイメージ(buffer)とは
+ * 重ならない。
+ * 手順はハードウェアマニュアルのフローチャートに従う
+ * （ウォッチドッグタイマによる暴走防止は省略している）。
+ */
+
+#define H8_3069F_FLMCR1 ((volatile uint8 *)0xfee030)
+#define H8_3069F_FLMCR2 ((volatile uint8 *)0xfee031)
+#define H8_3069F_EBR1   ((volatile uint8 *)0xfee032)
+#define H8_3069F_EBR2   ((volatile uint8 *)0xfee033)
+
+#define H8_3069F_FLMCR1_P   (1<<0)
+#define H8_3069F_FLMCR1_E   (1<<1)
+#define H8_3069F_FLMCR1_PV  (1<<2)
+#define H8_3069F_FLMCR1_EV  (1<<3)
+#define H8_3069F_FLMCR1_PSU (1<<4)
+#define H8_3069F_FLMCR1_ESU (1<<5)
+#define H8_3069F_FLMCR1_SWE (1<<6)
+#define H8_3069F_FLMCR1_FWE (1<<7)
+
+#define H8_3069F_FLMCR2_FLER (1<<7)
+
+#define FLASH_XIP_BLOCK_EBR2   (1<<6) /* EB14 */
+
+/* スロットのブロック */
+static const struct {
+  uint8 ebr2;
+  long addr;
+} flash_slots[FLASH_SLOT_NUM] = {
+  { (1<<7), FLASH_IMAGE_ADDR_A }, /* EB15 */
+  { (1<<5), FLASH_IMAGE_ADDR_B }, /* EB13 */
+};
+
+#define FLASH_PROGRAM_RETRY 1000
+#define FLASH_ERASE_RETRY   100
+
+/* 1マイクロ秒あたりのループ回数(φ=20MHz, -Os で1回あたり10ステート程度) */
+#define FLASH_WAIT_LOOP 2
+
+#define FLASH_RAMTEXT __attribute__((section(".ramtext")))
+#define FLASH_RAMDATA __attribute__((section(".ramdata")))
+
+/* 再書き込みデータ(書き込み中はROMを読めないので、RAMに置く) */
+static FLASH_RAMDATA unsigned char reprog[FLASH_UNIT_SIZE];
+
+static FLASH_RAMTEXT void flash_wait(int us)
+{
+  volatile int i;
+  for (; us > 0; us--)
+    for (i = 0; i < FLASH_WAIT_LOOP; i++)
+      ;
+}
+
+/*
+ * 128バイト単位の書き込み（dst は128バイト境界, src は RAM 上の128バイト）
+ * src の0xffのバイトは書き込まない（既に書き込まれていてもよい）ので、
+ * 複数のセグメントが同じ単位を共有していてもよい
+ */
+static FLASH_RAMTEXT int flash_program_unit(volatile unsigned char *dst,
+                                            unsigned char *src)
+{
+  int i, n, ok;
+  unsigned char v;
+
+  for (i = 0; i < FLASH_UNIT_SIZE; i++)
+    reprog[i] = src[i];
+
+  *H8_3069F_FLMCR1 = H8_3069F_FLMCR1_SWE;
+  flash_wait(1);
+
+  for (n = 0; n < FLASH_PROGRAM_RETRY; n++) {
+    /* 書き込みデータの転送(128バイトを連続して書く) */
+    for (i = 0; i < FLASH_UNIT_SIZE; i++)
+      dst[i] = reprog[i];
+
+    *H8_3069F_FLMCR1 |= H8_3069F_FLMCR1_PSU;
+    flash_wait(50);
+    *H8_3069F_FLMCR1 |= H8_3069F_FLMCR1_P;
+    flash_wait(200);
+    *H8_3069F_FLMCR1 &= ~H8_3069F_FLMCR1_P;
+    flash_wait(5);
+    *H8_3069F_FLMCR1 &= ~H8_3069F_FLMCR1_PSU;
+    flash_wait(5);
+
+    /* ベリファイと再書き込みデータの計算 */
+    *H8_3069F_FLMCR1 |= H8_3069F_FLMCR1_PV;
+    flash_wait(4);
+    ok = 1;
+    for (i = 0; i < FLASH_UNIT_SIZE; i++) {
+      dst[i] = 0xff; /* ダミーライト */
+      flash_wait(2);
+      v = dst[i];
+      if (v & ~src[i]) /* 0にすべきビットがまだ1 */
+        ok = 0;
+      reprog[i] = src[i] | ~v; /* まだ0になっていないビットだけ再度書き込む */
+    }
+    *H8_3069F_FLMCR1 &= ~H8_3069F_FLMCR1_PV;
+    flash_wait(2);
+    if (ok)
+      break;
+  }
+
+  *H8_3069F_FLMCR1 = 0;
+  flash_wait(100);
+
+  return (n < FLASH_PROGRAM_RETRY) ? 0 : -1;
+}
+
+/* 64KBのブロック(EB9～EB15)の消去（ebr2: EBR2のビット, addr: 先頭アドレス） */
+static FLASH_RAMTEXT int flash_erase_block(uint8 ebr2, long addr)
+{
+  volatile uint32 *p;
+  int n, ok;
+
+  *H8_3069F_FLMCR1 = H8_3069F_FLMCR1_SWE;
+  flash_wait(1);
+  *H8_3069F_EBR2 = ebr2;
+
+  for (n = 0; n < FLASH_ERASE_RETRY; n++) {
+    *H8_3069F_FLMCR1 |= H8_3069F_FLMCR1_ESU;
+    flash_wait(100);
+    *H8_3069F_FLMCR1 |= H8_3069F_FLMCR1_E;
+    flash_wait(10000);
+    *H8_3069F_FLMCR1 &= ~H8_3069F_FLMCR1_E;
+    flash_wait(10);
+    *H8_3069F_FLMCR1 &= ~H8_3069F_FLMCR1_ESU;
+    flash_wait(10);
+
+    /* 消去ベリファイ（全て0xffになっているか） */
+    *H8_3069F_FLMCR1 |= H8_3069F_FLMCR1_EV;
+    flash_wait(20);
+    ok = 1;
+    for (p = (uint32 *)addr; p < (uint32 *)(addr + 0x10000); p++) {
+      *p = 0xffffffff; /* ダミーライト */
+      flash_wait(2);
+      if (*p != 0xffffffff) {
+        ok = 0;
+        break;
+      }
+    }
+    *H8_3069F_FLMCR1 &= ~H8_3069F_FLMCR1_EV;
+    flash_wait(4);
+    if (ok)
+      break;
+  }
+
+  *H8_3069F_EBR2 = 0;
+  *H8_3069F_FLMCR1 = 0;
+  flash_wait(100);
+
+  return (n < FLASH_ERASE_RETRY) ? 0 : -1;
+}
+
+/* 書き込み・消去の関数をRAMにコピーする */
+static int flash_setup(void)
+{
+  extern char ramtext_start, eramtext, ramtext_load;
+
+  if (!(*H8_3069F_FLMCR1 & H8_3069F_FLMCR1_FWE))
+    return -1; /* FWE端子が0なので書き込めない */
+  memcpy(&ramtext_start, &ramtext_load, &eramtext - &ramtext_start);
+  return 0;
+}
+
+/*
+ * 任意のアドレス・サイズの書き込み（消去済みの領域に対して行うこと）
+ * 128バイト単位に分け、単位の中で書き込まない部分は0xffにする。
+ * 1単位ずつRAMにコピーしてから書き込むので、buf はフラッシュROM上でもよい。
+ */
+static int flash_program(long addr, char *buf, long size)
+{
+  static FLASH_RAMDATA unsigned char unit[FLASH_UNIT_SIZE];
+  long base, s, e;
+
+  for (base = addr & ~(FLASH_UNIT_SIZE - 1); base < addr + size;
+       base += FLASH_UNIT_SIZE) {
+    s = (base < addr) ? addr : base;
+    e = (base + FLASH_UNIT_SIZE > addr + size) ? addr + size
+                                                : base + FLASH_UNIT_SIZE;
+    memset(unit, 0xff, sizeof(unit));
+    memcpy(unit + (s - base), buf + (s - addr), e - s);
+    if (flash_program_unit((unsigned char *)base, unit) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* イメージの消去（そのスロットから起動しないようにする） */
+int flash_erase_image(int slot)
+{
+  if (flash_setup() < 0)
+    return -1;
+  return flash_erase_block(flash_slots[slot].ebr2, flash_slots[slot].addr);
+}
+
+static struct flash_image_header *flash_header(int slot)
+{
+  return (struct flash_image_header *)flash_slots[slot].addr;
+}
+
+/* 書き込んだ順番（以前の形式のヘッダなら0） */
+static uint32 flash_seq(int slot)
+{
+  uint32 seq = flash_header(slot)->seq;
+  return (seq == 0xffffffff) ? 0 : seq;
+}
+
+/*
+ * イメージの書き込み
+ * ブロックを消去して、ヘッダとイメージを書き込む。
+ * もう一方のスロットより後の順番にするので、次回からはこちらが起動する。
+ */
+int flash_write_image(int slot, char *buf, long size)
+{
+  struct flash_image_header hdr;
+  long addr = flash_slots[slot].addr;
+  int other = (slot == FLASH_SLOT_A) ? FLASH_SLOT_B : FLASH_SLOT_A;
+  long i;
+
+  if ((size <= 0) || (size > FLASH_IMAGE_MAX))
+    return -1;
+  if (flash_setup() < 0)
+    return -1;
+  if (flash_erase_block(flash_slots[slot].ebr2, addr) < 0)
+    return -1;
+
+  memcpy(hdr.magic, FLASH_IMAGE_MAGIC, 4);
+  hdr.size = size;
+  hdr.sum = 0;
+  for (i = 0; i < size; i++)
+    hdr.sum += (unsigned char)buf[i];
+  hdr.seq = flash_get_image(other, NULL) ? flash_seq(other) + 1 : 0;
+  hdr.failed = 0xffffffff;
+  if (flash_program(addr, (char *)&hdr, sizeof(hdr)) < 0)
+    return -1;
+
+  return flash_program(addr + FLASH_UNIT_SIZE, buf, size);
+}
+
+/*
+ * 起動に失敗したイメージを無効にする
+ * ヘッダの failed だけを0にする（他のバイトは0xffで書き込むので変わらない）
+ */
+int flash_fail_image(int slot)
+{
+  uint32 failed = 0;
+
+  if (flash_setup() < 0)
+    return -1;
+  return flash_program((long)&flash_header(slot)->failed,
+                       (char *)&failed, sizeof(failed));
+}
+
+/* XIPの領域の消去 */
+int flash_erase_xip(void)
+{
+  if (flash_setup() < 0)
+    return -1;
+  return flash_erase_block(FLASH_XIP_BLOCK_EBR2, FLASH_XIP_ADDR);
+}
+
+/* XIPの領域への書き込み（flash_erase_xip() の後に呼ぶ） */
+int flash_program_xip(long addr, char *buf, long size)
+{
+  if ((addr < FLASH_XIP_ADDR) || (addr + size > FLASH_XIP_ADDR + FLASH_XIP_SIZE))
+    return -1;
+  return flash_program(addr, buf, size);
+}
+
+/*
+ * スロットに保存されているイメージ（sizep が NULL でなければサイズも返す）
+ * なければ、壊れていれば、または起動に失敗していれば NULL
+ */
+char *flash_get_image(int slot, long *sizep)
+{
+  struct flash_image_header *hdr = flash_header(slot);
+  unsigned char *p = (unsigned char *)hdr + FLASH_UNIT_SIZE;
+  uint32 sum = 0;
+  long i;
+
+  if (memcmp(hdr->magic, FLASH_IMAGE_MAGIC, 4)
+      || (hdr->size <= 0) || (hdr->size > FLASH_IMAGE_MAX)
+      || (hdr->failed != 0xffffffff))
+    return NULL;
+  for (i = 0; i < hdr->size; i++)
+    sum += p[i];
+  if (sum != hdr->sum)
+    return NULL;
+
+  if (sizep)
+    *sizep = hdr->size;
+  return (char *)p;
+}
+
+/*
+ * 起動するスロット（exclude 以外で有効なもののうち、後から書き込んだもの）
+ * なければ FLASH_SLOT_NONE
+ */
+int flash_select_image(int exclude)
+{
+  int slot, selected = FLASH_SLOT_NONE;
+
+  for (slot = 0; slot < FLASH_SLOT_NUM; slot++) {
+    if ((slot == exclude) || !flash_get_image(slot, NULL))
+      continue;
+    if ((selected == FLASH_SLOT_NONE) || (flash_seq(slot) > flash_seq(selected)))
+      selected = slot;
+  }
+  return selected;
+}
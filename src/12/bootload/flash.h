@@ -0,0 +1,47 @@
+#ifndef _FLASH_H_INCLUDED_
+#define _FLASH_H_INCLUDED_
+
+/*
+ * 内蔵フラッシュROMに保存したOSのイメージ
+ * イメージは2つのスロットに保存できる（A: ブロックEB15 0x70000～0x7ffff,
+ * B: ブロックEB13 0x50000～0x5ffff。いずれも64KB）。ブロックの先頭128バイトに
+ * ヘッダを置き、続けて受信したイメージ(ELF)をそのまま書き込む。
+ * 自動起動は、有効なスロットのうち後から書き込んだもの(seq が大きい方)
+ * から行う。起動に失敗したスロットは、ヘッダの failed に0を書き込んで
+ * 無効にする（消去は不要）ので、もう一方のスロットから起動し直す。
+ */
+#define FLASH_SLOT_A    0
+#define FLASH_SLOT_B    1
+#define FLASH_SLOT_NUM  2
+#define FLASH_SLOT_NONE (-1)
+
+#define FLASH_IMAGE_ADDR_A 0x70000
+#define FLASH_IMAGE_ADDR_B 0x50000
+#define FLASH_IMAGE_MAX    (0x10000 - FLASH_UNIT_SIZE)
+#define FLASH_UNIT_SIZE    128 /* 書き込みの単位 */
+#define FLASH_IMAGE_MAGIC  "KZIM"
+
+/*
+ * XIPのOS(os/ld_xip.scr)の .text/.rodata を置く領域(ブロックEB14)
+ * ここに置くセグメントは、ロード時に elf_load() がフラッシュROMに書き込む
+ */
+#define FLASH_XIP_ADDR 0x60000
+#define FLASH_XIP_SIZE 0x10000
+
+struct flash_image_header {
+  char magic[4];
+  long size;    /* イメージのサイズ */
+  uint32 sum;   /* イメージのバイトの総和 */
+  uint32 seq;   /* 書き込んだ順番（0xffffffffは以前の形式のヘッダなので0とする） */
+  uint32 failed; /* 起動に失敗したら0にする（書き込んだときは0xffffffff） */
+};
+
+int flash_write_image(int slot, char *buf, long size);
+int flash_erase_image(int slot);
+int flash_fail_image(int slot);
+char *flash_get_image(int slot, long *sizep);
+int flash_select_image(int exclude);
+int flash_erase_xip(void);
+int flash_program_xip(long addr, char *buf, long size);
+
+#endif
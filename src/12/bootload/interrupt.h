@@ -17,6 +17,13 @@ typedef void (*softvec_handler_t)(softvec_type_t type, unsigned long sp);
 #define INTR_ENABLE  asm volatile ("andc.b #0x3f,ccr")
 #define INTR_DISABLE asm volatile ("orc.b #0xc0,ccr")
 
+/*
+ * 割り込みスタックに切り替えない(ブートスタック上で割り込みを処理する)
+ * ときに非0にする。OSの割り込みでは0でなければならないので、bss ではなく
+ * ld.scr の専用領域に置き、init() で明示的に0にする(intr.S 参照)
+ */
+extern volatile unsigned char intrmode;
+
 /* ソフトウェア割り込みベクタの初期化 */
 int softvec_init(void);
 
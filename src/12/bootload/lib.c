@@ -2,20 +2,58 @@
 #include "serial.h"
 #include "lib.h"
 
+/*
+ * 長い領域はアラインして32ビット単位で書き込む
+ * (.bss のクリアやELFのロードを速くする)
+ */
 void *memset(void *b, int c, long len)
 {
-    char *p;
-    for (p = b; len > 0; len--)
+    char *p = b;
+    uint32 *lp, v;
+
+    if (len >= 16) {
+        for (; ((unsigned long)p & 3) && (len > 0); len--)
+            *(p++) = c;
+        v = (uint8)c;
+        v |= v << 8;
+        v |= v << 16;
+        for (lp = (uint32 *)p; len >= 16; len -= 16) {
+            lp[0] = v;
+            lp[1] = v;
+            lp[2] = v;
+            lp[3] = v;
+            lp += 4;
+        }
+        p = (char *)lp;
+    }
+    for (; len > 0; len--)
         *(p++) = c;
     return b;
 }
 
+/*
+ * EEPMOV.B(ブロック転送命令)で、ER5 から ER6 へ R4L バイトを転送する
+ * (1バイトあたり4ステートで、バイト単位のループより速い)。
+ * 転送中は割り込みを受け付けないので、割り込みの遅延を抑えるために
+ * 1回の転送は255バイトまでとする。
+ * (アドレスの小さい方から順に転送する)
+ */
 void *memcpy(void *dst, const void *src, long len)
 {
     char *d = dst;
     const char *s = src;
-    for (; len > 0; len--)
-        *(d++) = *(s++);
+    int n;
+
+    for (; len > 0; len -= n) {
+        n = (len > 255) ? 255 : len;
+        asm volatile ("mov.l %0,er5\n\t"
+                      "mov.l %1,er6\n\t"
+                      "mov.w %2,r4\n\t"
+                      "eepmov.b"
+                      : : "r"(s), "r"(d), "r"(n) : "r4", "r5", "r6", "memory");
+        d += n;
+        s += n;
+    }
     return dst;
 }
 
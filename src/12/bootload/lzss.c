@@ -0,0 +1,46 @@
+#include "defines.h"
+#include "lzss.h"
+
+void lzss_init(lzss_t *z, char *dst)
+{
+  z->dst = (unsigned char *)dst;
+  z->bits = 0;
+  z->match = 0;
+}
+
+/* src から len バイトの圧縮データを展開する（続きは次の呼び出しで渡してよい） */
+void lzss_decode(lzss_t *z, char *src, long len)
+{
+  unsigned char *p = (unsigned char *)src;
+  unsigned char *dst = z->dst;
+  unsigned char *from;
+  unsigned char c;
+  int n;
+
+  for (; len > 0; len--) {
+    c = *(p++);
+    if (z->match) {
+      /* 一致の2バイト目: 既に展開した部分からコピーする */
+      from = dst - (((unsigned int)z->hi << 4) | (c >> 4)) - 1;
+      for (n = (c & 0xf) + LZSS_MIN_MATCH; n > 0; n--)
+        *(dst++) = *(from++);
+      z->match = 0;
+      continue;
+    }
+    if (!z->bits) {
+      z->flags = c;
+      z->bits = 8;
+      continue;
+    }
+    if (z->flags & 1) {
+      *(dst++) = c;
+    } else {
+      z->hi = c;
+      z->match = 1;
+    }
+    z->flags >>= 1;
+    z->bits--;
+  }
+
+  z->dst = dst;
+}
@@ -0,0 +1,28 @@
+#ifndef _LZSS_H_INCLUDED_
+#define _LZSS_H_INCLUDED_
+
+/*
+ * LZSSの展開（圧縮は tools/kzpack.c）
+ * 形式: フラグ1バイトに続いて8個の項目が並ぶ（フラグのビット0から順に対応）
+ *   ビットが1: リテラル(1バイト)
+ *   ビットが0: 一致(2バイト) 距離-1 の上位8ビット, 距離-1 の下位4ビット<<4 | 長さ-3
+ *             (距離 1～4096, 長さ 3～18)
+ * 一致は展開先の既に書き込んだ部分を参照するので、スライド窓は不要。
+ */
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (15 + LZSS_MIN_MATCH)
+#define LZSS_WINDOW    4096
+
+/* 展開の途中の状態（データを分割して渡せるようにする） */
+typedef struct {
+  unsigned char *dst; /* 次に書き込む位置 */
+  uint8 flags;        /* フラグの残りのビット */
+  uint8 bits;         /* flags の残りのビット数 */
+  uint8 match;        /* 一致の2バイト目を待っている */
+  uint8 hi;           /* 一致の1バイト目 */
+} lzss_t;
+
+void lzss_init(lzss_t *z, char *dst);
+void lzss_decode(lzss_t *z, char *src, long len);
+
+#endif
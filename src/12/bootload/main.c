@@ -1,8 +1,14 @@
 #include "defines.h"
 #include "interrupt.h"
 #include "serial.h"
+#include "dram.h"
 #include "xmodem.h"
 #include "elf.h"
+#include "flash.h"
+#include "crc32.h"
+#include "timer.h"
+#include "crashdump.h"
+#include "bootinfo.h"
 #include "lib.h"
 
 static int init(void)
@@ -13,6 +19,7 @@ static int init(void)
     /* initialize "data" and "bss" */
     memcpy(&data_start, &erodata, (long)&edata - (long)&data_start);
     memset(&bss_start, 0, (long)&ebss - (long)&bss_start);
+    intrmode = 0; /* bss ではないので電源投入時は不定 */
 
     /* initialize software vector */
     softvec_init();
@@ -20,38 +27,312 @@ static int init(void)
     /* initialize serial */
     serial_init(SERIAL_DEFAULT_DEVICE);
 
+    /* initialize external DRAM (used by OS as "dram" region) */
+    dram_init();
+
+    /* initialize timer (used for timeouts) */
+    timer_init();
+
     return 0;
 }
 
+/*
+ * 16バイトずつ1行に整形してから出力する
+ * (1バイトごとに putxval() で文字列を作って出力するより速い)
+ */
 static int dump(char *buf, long size)
 {
+  static const char hex[] = "0123456789abcdef";
+  char line[16 * 3 + 2 + 1];
+  char *p = line;
   long i;
+  unsigned char c;
 
   if (size < 0) {
     puts("no data.\n");
     return -1;
   }
   for (i = 0; i < size; i++) {
-    putxval(buf[i], 2);
+    c = buf[i];
+    *(p++) = hex[c >> 4];
+    *(p++) = hex[c & 0xf];
     if ((i & 0xf) == 15) {
-      puts("\n");
+      *(p++) = '\n';
+      *p = '\0';
+      puts(line);
+      p = line;
     } else {
-      if ((i & 0xf) == 7) {
-        puts(" ");
-      }
-      puts(" ");
+      if ((i & 0xf) == 7)
+        *(p++) = ' ';
+      *(p++) = ' ';
     }
   }
+  *p = '\0';
+  puts(line);
   puts("\n");
 
   return 0;
 }
 
+/*
+ * バイナリでの出力（ホスト側のツールで受け取る場合）
+ * "size: " の行の後にデータをそのまま送る（改行の変換をしない）
+ */
+static int dump_binary(char *buf, long size)
+{
+  if (size < 0) {
+    puts("no data.\n");
+    return -1;
+  }
+  for (; size > 0; size--)
+    serial_send_byte(SERIAL_DEFAULT_DEVICE, *(buf++));
+
+  return 0;
+}
+
+/* 10進数の文字列を数値にする（32ビットの乗算はライブラリがないのでシフトで行う） */
+static long parse_decimal(char *s)
+{
+  long n = 0;
+  for (; (*s >= '0') && (*s <= '9'); s++)
+    n = (n << 3) + (n << 1) + (*s - '0');
+  return n;
+}
+
+/*
+ * 転送の終了後、ホスト側のツールが終了して端末に戻るまで待つ
+ * (待たずに出力すると、メッセージが失われる)
+ */
+#define LOAD_WAIT_MSEC 200
+
 static void wait()
 {
-  volatile long i;
-  for (i = 0; i < 300000; i++)
-    ;
+  timer_msleep(LOAD_WAIT_MSEC);
+}
+
+/* 記録が ld.scr の crashdump 領域に収まることの検査（負のサイズの配列でエラーにする） */
+typedef char crashdump_size_check[(sizeof(kz_crashdump_t) <= KZ_CRASHDUMP_SIZE) ? 1 : -1];
+
+/*
+ * OSのクラッシュダンプ(crashdump.h)の表示
+ * 記録がなければ-1を返す
+ */
+static int crash_show(int verbose)
+{
+  extern kz_crashdump_t crashdump;
+  kz_crashdump_t *cd = &crashdump;
+  int i;
+
+  if ((cd->magic != KZ_CRASHDUMP_MAGIC) && (cd->magic != KZ_CRASHDUMP_MAGIC_OLD))
+    return -1;
+  if (!verbose) {
+    puts("OS crash dump found (\"crash\" to show).\n");
+    return 0;
+  }
+
+  cd->name[KZ_CRASHDUMP_NAME_SIZE - 1] = '\0';
+  puts("thread: ");
+  puts(cd->name);
+  puts(" (");
+  putxval(cd->thread, 0);
+  puts(")\ntick: ");
+  putxval(cd->tick, 0);
+  puts(" syscall: ");
+  if (cd->syscall == KZ_CRASHDUMP_NO_SYSCALL)
+    puts("-");
+  else
+    putxval(cd->syscall, 0);
+  puts(" nest: ");
+  putxval(cd->nest, 0);
+  puts("\n");
+  for (i = 0; i < 8; i++) {
+    puts((i < 7) ? "er" : "pc");
+    if (i < 7)
+      putc('0' + i);
+    puts(": ");
+    putxval(cd->regs[i], 8);
+    puts(((i & 3) == 3) ? "\n" : " ");
+  }
+  for (i = 0; (i < KZ_CRASHDUMP_POOL_NUM) && cd->pools[i].size; i++) {
+    puts("pool ");
+    putxval(cd->pools[i].size, 0);
+    puts(": used ");
+    putxval(cd->pools[i].used, 0);
+    puts(" peak ");
+    putxval(cd->pools[i].peak, 0);
+    puts("\n");
+  }
+  if (cd->trace_num) {
+    /* tick(2) count(2) thread(2) event(1) arg(1) の8バイトずつ */
+    puts("trace:\n");
+    dump((char *)cd->trace, cd->trace_num * 8);
+  }
+  return 0;
+}
+
+/* WDTのリセットの記録（OSの wdt_init() が読んでクリアするので、ここではクリアしない） */
+#define H8_3069F_WDT_RSTCSR_R    ((volatile uint8 *)0xffff8f)
+#define H8_3069F_WDT_RSTCSR_WRST (1<<7)
+
+static int slot_name(int slot)
+{
+  return 'a' + slot;
+}
+
+/*
+ * 前回の起動の確認（bootinfo.h）
+ * フラッシュROMのスロットから起動したOSが、起動を確認する前にクラッシュ
+ * ダンプを残すか、WDTでリセットされていたら、そのスロットを無効にする。
+ * 無効にしたスロット（なければ FLASH_SLOT_NONE）を返す。
+ */
+static int boot_check(void)
+{
+  extern kz_bootinfo_t bootinfo;
+  extern kz_crashdump_t crashdump;
+  int slot = FLASH_SLOT_NONE;
+
+  if ((bootinfo.magic == KZ_BOOTINFO_MAGIC)
+      && (bootinfo.state == KZ_BOOTINFO_TRIAL)
+      && (bootinfo.slot < FLASH_SLOT_NUM)
+      && ((crashdump.magic == KZ_CRASHDUMP_MAGIC)
+          || (*H8_3069F_WDT_RSTCSR_R & H8_3069F_WDT_RSTCSR_WRST))) {
+    slot = bootinfo.slot;
+    puts("slot ");
+    putc(slot_name(slot));
+    puts(" failed to boot.\n");
+    /* FWE端子が0で書き込めなくても、今回は起動しない */
+    if (flash_fail_image(slot) < 0)
+      puts("flash write error!\n");
+  }
+  bootinfo.magic = 0;
+
+  return slot;
+}
+
+/*
+ * OSの起動
+ * slot はフラッシュROMのスロット（RAMにロードしたものなら FLASH_SLOT_NONE）。
+ * スロットからの起動は bootinfo に記録し、OSが確認するまでは失敗の検出の
+ * 対象にする。残っているクラッシュダンプは古いものとして区別しておく。
+ */
+static void boot(char *entry_point, int slot)
+{
+  extern kz_bootinfo_t bootinfo;
+  extern kz_crashdump_t crashdump;
+
+  if (crashdump.magic == KZ_CRASHDUMP_MAGIC)
+    crashdump.magic = KZ_CRASHDUMP_MAGIC_OLD;
+  if (slot != FLASH_SLOT_NONE) {
+    bootinfo.slot = slot;
+    bootinfo.state = KZ_BOOTINFO_TRIAL;
+    bootinfo.magic = KZ_BOOTINFO_MAGIC;
+  }
+
+  puts("starting from entry point: ");
+  putxval((unsigned long)entry_point, 0);
+  puts("\n");
+  ((void (*)(void))entry_point)();
+}
+
+/* スロットのイメージをロードして起動する（失敗したら戻る） */
+static void boot_slot(int slot)
+{
+  char *image, *entry_point;
+  long size;
+
+  image = flash_get_image(slot, &size);
+  if (!image) {
+    puts("no image.\n");
+    return;
+  }
+  entry_point = elf_load(image, size);
+  if (!entry_point) {
+    puts("boot error!\n");
+    return;
+  }
+  boot(entry_point, slot);
+}
+
+/*
+ * フラッシュROMに保存したイメージからの自動起動
+ * 起動メッセージの後、一定時間内にキー入力がなければ起動する。
+ * キー入力があれば（またはイメージがなければ）コマンドの入力に進む。
+ * failed は前回起動に失敗したスロットで、そこからは起動しない。
+ */
+#define AUTOBOOT_WAIT_MSEC 1000
+
+static void autoboot(int failed)
+{
+  int slot;
+
+  slot = flash_select_image(failed);
+  if (slot == FLASH_SLOT_NONE)
+    return;
+
+  puts("autoboot slot ");
+  putc(slot_name(slot));
+  puts(" (press any key to stop)\n");
+  timer_start(AUTOBOOT_WAIT_MSEC);
+  while (!timer_is_expired()) {
+    if (serial_is_recv_enable(SERIAL_DEFAULT_DEVICE)) {
+      serial_recv_byte(SERIAL_DEFAULT_DEVICE);
+      timer_stop();
+      return;
+    }
+  }
+  timer_stop();
+
+  boot_slot(slot);
+}
+
+/*
+ * コマンドの引数のスロット（"a" か "b"）
+ * 引数がなければ def, それ以外なら FLASH_SLOT_NONE を返す
+ */
+static int parse_slot(char *arg, int def)
+{
+  while (*arg == ' ')
+    arg++;
+  if (!*arg)
+    return def;
+  if ((arg[0] == 'a' || arg[0] == 'b') && !arg[1])
+    return arg[0] - 'a';
+  return FLASH_SLOT_NONE;
+}
+
+/* コンソールのボーレート（baud コマンドで変更される） */
+static long console_rate = 9600;
+
+/*
+ * ロード中のボーレートの切り替え（load/sload の引数でボーレートを指定する）
+ * "baud <rate>" の行を出力してから切り替えるので、ホスト側のツールは
+ * この行を受け取ったら同じボーレートに切り替えてからXMODEMの送信を始め、
+ * 送信が終わったらコンソールのボーレートに戻すこと。
+ * 切り替えたら1, 引数がなければ0, 表にないボーレートならば-1を返す。
+ */
+static int load_baud_start(char *arg)
+{
+  while (*arg == ' ')
+    arg++;
+  if (!*arg)
+    return 0;
+  puts("baud ");
+  puts(arg);
+  puts("\n");
+  if (serial_set_baud(SERIAL_DEFAULT_DEVICE, parse_decimal(arg)) < 0) {
+    puts("unsupported baud rate.\n");
+    return -1;
+  }
+  return 1;
+}
+
+/* ロード後にコンソールのボーレートに戻す（ホスト側が戻すまで待ってから） */
+static void load_baud_end(int boosted)
+{
+  if (boosted > 0) {
+    wait();
+    serial_set_baud(SERIAL_DEFAULT_DEVICE, console_rate);
+  }
 }
 
 int main(void)
@@ -59,9 +340,12 @@ int main(void)
   static char buf[16];
   static long size = -1;
   static unsigned char *loadbuf = NULL;
+  static char *stream_entry = NULL; /* sload でロード済みのエントリポイント */
   char *entry_point;
-  void (*f)(void);
   extern int buffer_start;
+  extern unsigned char ebuffer;
+  extern kz_crashdump_t crashdump;
+  int boosted, slot;
 
   /* 割り込みを無効にする */
   INTR_DISABLE;
@@ -69,38 +353,131 @@ int main(void)
   init();
 
   puts("kzload (kozos boot loader) started.\n");
+  crash_show(0);
+
+  autoboot(boot_check());
 
   while (1) {
     puts("kzload> ");
     gets(buf);
 
-    if (!strcmp(buf, "load")) {
+    if (!strcmp(buf, "load") || !strncmp(buf, "load ", 5)) {
+      stream_entry = NULL;
+      if ((boosted = load_baud_start(buf + 4)) < 0)
+        continue;
       loadbuf = (char *)(&buffer_start);
-      size = xmodem_recv(loadbuf);
+      /* 受信中は受信割り込みでバッファリングし、取りこぼしを防ぐ */
+      serial_recv_intr_start(SERIAL_DEFAULT_DEVICE);
+      size = xmodem_recv(loadbuf, &ebuffer - loadbuf);
+      serial_recv_intr_stop(SERIAL_DEFAULT_DEVICE);
+      wait();
+      load_baud_end(boosted);
+      if (size == XMODEM_ERR_SIZE) {
+        puts("\nimage too large!\n");
+      } else if (size < 0) {
+        puts("\nXMODEM receive error!\n");
+      } else if (crc32_check() < 0) {
+        /* 受信したイメージのCRC32がフッタと一致しない（フッタがなければ検査しない） */
+        puts("\nimage CRC error!\n");
+        size = -1;
+      } else {
+        puts("\nXMODEM receive succeeded.\n");
+      }
+
+    } else if (!strcmp(buf, "sload") || !strncmp(buf, "sload ", 6)) {
+      /*
+       * 受信しながらセグメントを直接ロードする（受信バッファを経由しない）
+       * ロードしたら run で起動する
+       */
+      stream_entry = NULL;
+      size = -1;
+      if ((boosted = load_baud_start(buf + 5)) < 0)
+        continue;
+      elf_stream_init();
+      serial_recv_intr_start(SERIAL_DEFAULT_DEVICE);
+      if (xmodem_recv_func(elf_stream_write, NULL) >= 0)
+        stream_entry = elf_stream_end();
+      serial_recv_intr_stop(SERIAL_DEFAULT_DEVICE);
       wait();
-      if (size < 0) {
+      load_baud_end(boosted);
+      if (!stream_entry) {
         puts("\nXMODEM receive error!\n");
+      } else if (crc32_check() < 0) {
+        /* 既にロードしてしまっているが、起動はさせない */
+        puts("\nimage CRC error!\n");
+        stream_entry = NULL;
       } else {
         puts("\nXMODEM receive succeeded.\n");
       }
 
-    } else if (!strcmp(buf, "dump")) {
+    } else if (!strcmp(buf, "flash") || !strncmp(buf, "flash ", 6)) {
+      /*
+       * load で受信したイメージをフラッシュROMのスロットに保存する（次回から
+       * 自動起動）。スロットを指定しなければ、起動していない方に保存する。
+       */
+      slot = flash_select_image(FLASH_SLOT_NONE);
+      slot = parse_slot(buf + 5,
+                        (slot == FLASH_SLOT_A) ? FLASH_SLOT_B : FLASH_SLOT_A);
+      if (slot == FLASH_SLOT_NONE) {
+        puts("unknown slot.\n");
+      } else if (!loadbuf || (size < 0) || stream_entry) {
+        puts("no data.\n");
+      } else if (flash_write_image(slot, loadbuf, size) < 0) {
+        puts("flash write error!\n");
+      } else {
+        puts("flash write succeeded (slot ");
+        putc(slot_name(slot));
+        puts(").\n");
+      }
+
+    } else if (!strcmp(buf, "unflash") || !strncmp(buf, "unflash ", 8)) {
+      /* 保存したイメージを消去する（指定しなければ両方。自動起動しなくなる） */
+      slot = parse_slot(buf + 7, FLASH_SLOT_NUM);
+      if (slot == FLASH_SLOT_NONE) {
+        puts("unknown slot.\n");
+      } else if (((slot != FLASH_SLOT_B) && (flash_erase_image(FLASH_SLOT_A) < 0))
+                 || ((slot != FLASH_SLOT_A) && (flash_erase_image(FLASH_SLOT_B) < 0))) {
+        puts("flash erase error!\n");
+      }
+
+    } else if (!strcmp(buf, "boot") || !strncmp(buf, "boot ", 5)) {
+      /* スロットのイメージから起動する（指定しなければ自動起動と同じスロット） */
+      slot = parse_slot(buf + 4, flash_select_image(FLASH_SLOT_NONE));
+      if (slot == FLASH_SLOT_NONE)
+        puts("no image.\n");
+      else
+        boot_slot(slot);
+
+    } else if (!strcmp(buf, "dump") || !strcmp(buf, "dump bin")) {
       puts("size: ");
       putxval(size, 0);
       puts("\n");
-      dump(loadbuf, size);
+      if (buf[4])
+        dump_binary(loadbuf, size);
+      else
+        dump(loadbuf, size);
+
+    } else if (!strcmp(buf, "crash")) {
+      /* OSが kz_sysdown() したときの記録を表示する */
+      if (crash_show(1) < 0)
+        puts("no crash dump.\n");
+
+    } else if (!strcmp(buf, "crash clear")) {
+      crashdump.magic = 0;
 
     } else if (!strcmp(buf, "run")) {
-      entry_point = elf_load(loadbuf);
-      if (!entry_point) {
+      entry_point = stream_entry ? stream_entry : elf_load(loadbuf, size);
+      if (!entry_point)
         puts("run error!\n");
-      } else {
-        puts("starting from entry point: ");
-        putxval((unsigned long)entry_point, 0);
-        puts("\n");
-        f = (void (*)(void))entry_point;
-        f();
-      }
+      else
+        boot(entry_point, FLASH_SLOT_NONE);
+
+    } else if (!strncmp(buf, "baud ", 5)) {
+      /* ボーレートの変更（端末側も同じボーレートに切り替えること） */
+      if (serial_set_baud(SERIAL_DEFAULT_DEVICE, parse_decimal(buf + 5)) < 0)
+        puts("unsupported baud rate.\n");
+      else
+        console_rate = parse_decimal(buf + 5);
 
     } else {
       puts("unknown.\n");
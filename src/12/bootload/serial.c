@@ -1,4 +1,6 @@
 #include "defines.h"
+#include "intr.h"
+#include "interrupt.h"
 #include "serial.h"
 
 #define SERIAL_SCI_NUM 3
@@ -46,7 +48,8 @@ struct h8_3069f_sci {
 #define H8_3069F_SCI_SSR_RDRF   (1<<6)
 #define H8_3069F_SCI_SSR_TDRE   (1<<7)
 
-static struct {
+/* OSからもサービスとして呼ばれる(service.c)ので、ROMに置く */
+static const struct {
     volatile struct h8_3069f_sci *sci;
 } regs[SERIAL_SCI_NUM] = {
     { H8_3069F_SCI0 },
@@ -67,6 +70,61 @@ int serial_init(int index)
     return 0;
 }
 
+/*
+ * ボーレートの設定値(φ=20MHz)
+ * BRR = φ / (64 * 2^(2n-1) * B) - 1 (n は SMR の CKS の値)
+ * 115200bps は誤差が8%を超えるので使えない（近い値は125000bpsになる）
+ */
+static const struct {
+    long rate;
+    uint8 cks;
+    uint8 brr;
+} baud_table[] = {
+    {   2400, H8_3069F_SCI_SMR_CKS_PER4, 64  }, /* 誤差 0.16% */
+    {   4800, H8_3069F_SCI_SMR_CKS_PER1, 129 }, /* 誤差 0.16% */
+    {   9600, H8_3069F_SCI_SMR_CKS_PER1, 64  }, /* 誤差 0.16% */
+    {  19200, H8_3069F_SCI_SMR_CKS_PER1, 32  }, /* 誤差-1.36% */
+    {  31250, H8_3069F_SCI_SMR_CKS_PER1, 19  }, /* 誤差 0% */
+    {  38400, H8_3069F_SCI_SMR_CKS_PER1, 15  }, /* 誤差 1.73% */
+    {  57600, H8_3069F_SCI_SMR_CKS_PER1, 10  }, /* 誤差-1.36% */
+    { 125000, H8_3069F_SCI_SMR_CKS_PER1, 4   }, /* 誤差 0% */
+};
+
+/*
+ * ボーレートの変更
+ * 送信中のデータの送信完了を待ってから、送受信を一旦止めて設定する。
+ * 表にないボーレートならば -1 を返す。
+ */
+int serial_set_baud(int index, long rate)
+{
+    volatile struct h8_3069f_sci *sci = regs[index].sci;
+    volatile int i;
+    uint8 scr;
+    int n;
+
+    for (n = 0; n < sizeof(baud_table) / sizeof(baud_table[0]); n++) {
+        if (baud_table[n].rate == rate)
+            break;
+    }
+    if (n == sizeof(baud_table) / sizeof(baud_table[0]))
+        return -1;
+
+    while (!(sci->ssr & H8_3069F_SCI_SSR_TEND))
+        ;
+
+    scr = sci->scr;
+    sci->scr = 0;
+    sci->smr = (sci->smr & ~H8_3069F_SCI_SMR_CKS_PER64) | baud_table[n].cks;
+    sci->brr = baud_table[n].brr;
+
+    /* 1ビット期間以上待ってから送受信を再開する */
+    for (i = 0; i < 1000; i++)
+        ;
+    sci->scr = scr;
+
+    return 0;
+}
+
 int serial_is_send_enable(int index)
 {
     volatile struct h8_3069f_sci *sci = regs[index].sci;
@@ -85,9 +143,90 @@ int serial_send_byte(int index, unsigned char c)
     return 0;
 }
 
+/*
+ * 受信割り込みによる受信バッファ(serial_recv_intr_start()で開始する)
+ * XMODEMの受信中など、受信側の処理が1文字の受信時間より遅れると
+ * RDRが1文字分しかないのでオーバーランしてしまうので、受信データを
+ * 割り込みでリングバッファに移しておく。バッファは1チャネル分のみ。
+ */
+static struct {
+  volatile int enable; /* 受信割り込みを使っている */
+  int index;           /* 使っているチャネル */
+  volatile int head;   /* 次に読み出す位置 */
+  volatile int tail;   /* 次に書き込む位置（head と同じなら空） */
+  unsigned char buf[SERIAL_RECV_BUFFER_SIZE];
+} recv_ring;
+
+/*
+ * 受信割り込み・受信エラー割り込みのハンドラ
+ * 受信エラーはフラグをクリアして受信を続けさせる（欠けたデータは
+ * XMODEMのチェックサムの誤りになり、再送される）。
+ * バッファが一杯ならば受信データを捨てる。
+ */
+static void serial_intr_recv(softvec_type_t type, unsigned long sp)
+{
+  volatile struct h8_3069f_sci *sci = regs[recv_ring.index].sci;
+  int next;
+
+  if (sci->ssr & (H8_3069F_SCI_SSR_ORER | H8_3069F_SCI_SSR_FERERS
+                  | H8_3069F_SCI_SSR_PER)) {
+    sci->ssr &= ~(H8_3069F_SCI_SSR_ORER | H8_3069F_SCI_SSR_FERERS
+                  | H8_3069F_SCI_SSR_PER);
+    return;
+  }
+
+  while (sci->ssr & H8_3069F_SCI_SSR_RDRF) {
+    next = (recv_ring.tail + 1) & (SERIAL_RECV_BUFFER_SIZE - 1);
+    if (next != recv_ring.head) {
+      recv_ring.buf[recv_ring.tail] = sci->rdr;
+      recv_ring.tail = next;
+    }
+    sci->ssr &= ~H8_3069F_SCI_SSR_RDRF;
+  }
+}
+
+/* 受信割り込みによる受信を開始する（割り込みを有効にする） */
+int serial_recv_intr_start(int index)
+{
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+
+  recv_ring.index = index;
+  recv_ring.head = 0;
+  recv_ring.tail = 0;
+  recv_ring.enable = 1;
+  softvec_setintr(SOFTVEC_TYPE_SERINTR(index, SERINTR_RXI), serial_intr_recv);
+  softvec_setintr(SOFTVEC_TYPE_SERINTR(index, SERINTR_ERI), serial_intr_recv);
+  sci->scr |= H8_3069F_SCI_SCR_RIE;
+  intrmode = 1; /* ブートスタック上で割り込みを処理する */
+  INTR_ENABLE;
+
+  return 0;
+}
+
+/*
+ * 受信割り込みによる受信を終了する（割り込みを無効にする）
+ * OSの起動前に割り込み禁止・ソフトウェア割り込みベクタ未設定に戻すこと。
+ * バッファに残っているデータは捨てる。
+ */
+int serial_recv_intr_stop(int index)
+{
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+
+  INTR_DISABLE;
+  intrmode = 0; /* OSの割り込みは割り込みスタックに切り替える */
+  sci->scr &= ~H8_3069F_SCI_SCR_RIE;
+  softvec_setintr(SOFTVEC_TYPE_SERINTR(index, SERINTR_RXI), NULL);
+  softvec_setintr(SOFTVEC_TYPE_SERINTR(index, SERINTR_ERI), NULL);
+  recv_ring.enable = 0;
+
+  return 0;
+}
+
 int serial_is_recv_enable(int index)
 {
   volatile struct h8_3069f_sci *sci = regs[index].sci;
+  if (recv_ring.enable && (recv_ring.index == index))
+    return (recv_ring.head != recv_ring.tail);
   return (sci->ssr & H8_3069F_SCI_SSR_RDRF);
 }
 
@@ -99,6 +238,12 @@ unsigned char serial_recv_byte(int index)
   while (!serial_is_recv_enable(index))
     ;
 
+  if (recv_ring.enable && (recv_ring.index == index)) {
+    c = recv_ring.buf[recv_ring.head];
+    recv_ring.head = (recv_ring.head + 1) & (SERIAL_RECV_BUFFER_SIZE - 1);
+    return c;
+  }
+
   c = sci->rdr;
   sci->ssr &= ~H8_3069F_SCI_SSR_RDRF;
 
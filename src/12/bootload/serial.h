@@ -1,10 +1,19 @@
 #ifndef _SERIAL_H_INCLUDED_
 #define _SERIAL_H_INCLUDED_
 
+/*
+ * 受信割り込みによる受信バッファのサイズ（2のべき乗とすること）
+ * bssはスタックと同じ data 領域(0x300バイト)に置かれるので、大きくしすぎないこと
+ */
+#define SERIAL_RECV_BUFFER_SIZE 64
+
 int serial_init(int index);
+int serial_set_baud(int index, long rate);
 int serial_is_send_enable(int index);
 int serial_send_byte(int index, unsigned char b);
 int serial_is_recv_enable(int index);
 unsigned char serial_recv_byte(int index);
+int serial_recv_intr_start(int index);
+int serial_recv_intr_stop(int index);
 
 #endif
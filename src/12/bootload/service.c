@@ -0,0 +1,29 @@
+#include "defines.h"
+#include "serial.h"
+#include "lib.h"
+#include "cksum.h"
+#include "service.h"
+
+/* ld.scr で KZLOAD_SERVICE_ADDR に配置する */
+const kzload_service_t kzload_service __attribute__((section(".service"))) = {
+  KZLOAD_SERVICE_MAGIC,
+  KZLOAD_SERVICE_VERSION,
+  sizeof(kzload_service_t),
+  memset,
+  memcpy,
+  memcmp,
+  strlen,
+  strcpy,
+  strcmp,
+  strncmp,
+  putc,
+  puts,
+  putxval,
+  serial_is_send_enable,
+  serial_send_byte,
+  cksum_sum8,
+  cksum_crc16,
+  cksum_crc32,
+  cksum_inet,
+  cksum_inet_fold,
+};
@@ -0,0 +1,42 @@
+#ifndef _SERVICE_H_INCLUDED_
+#define _SERVICE_H_INCLUDED_
+
+/*
+ * ブートローダがOSに提供するサービス（ROM上の関数）のテーブル
+ * ROMの固定のアドレス（ベクタの直後）に置き、OSはここを経由して呼び出す
+ * (OSのイメージに同じ関数を持たなくてよいので、転送するイメージが小さくなる)。
+ * OSの実行中はブートローダの .data/.bss はOSに上書きされているので、
+ * RAM上の変数を使わない関数のみを登録すること。
+ * os/service.h と同じ内容にすること。
+ */
+#define KZLOAD_SERVICE_ADDR    0x000104 /* ADIのベクタ(0x100)の直後 */
+#define KZLOAD_SERVICE_MAGIC   0x4b5a5356 /* "KZSV" */
+#define KZLOAD_SERVICE_VERSION 2 /* 関数を追加したら上げる（末尾に追加する） */
+
+typedef struct {
+  uint32 magic;
+  uint16 version;
+  uint16 size; /* テーブルのサイズ */
+  void *(*memset)(void *b, int c, long len);
+  void *(*memcpy)(void *dst, const void *src, long len);
+  int (*memcmp)(const void *b1, const void *b2, long len);
+  int (*strlen)(const char *s);
+  char *(*strcpy)(char *dst, const char *src);
+  int (*strcmp)(const char *s1, const char *s2);
+  int (*strncmp)(const char *s1, const char *s2, int len);
+  int (*putc)(unsigned char c);
+  int (*puts)(unsigned char *str);
+  int (*putxval)(unsigned long value, int column);
+  int (*serial_is_send_enable)(int index);
+  int (*serial_send_byte)(int index, unsigned char c);
+  /* バージョン2: チェックサム・CRC(cksum.h, ROM上の256エントリの表を使う) */
+  uint8 (*cksum_sum8)(uint8 sum, const void *buf, long size);
+  uint16 (*cksum_crc16)(uint16 crc, const void *buf, long size);
+  uint32 (*cksum_crc32)(uint32 crc, const void *buf, long size);
+  uint32 (*cksum_inet)(uint32 sum, const void *buf, long size);
+  uint16 (*cksum_inet_fold)(uint32 sum);
+} kzload_service_t;
+
+#define KZLOAD_SERVICE ((const kzload_service_t *)KZLOAD_SERVICE_ADDR)
+
+#endif
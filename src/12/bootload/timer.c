@@ -0,0 +1,92 @@
+#include "defines.h"
+#include "timer.h"
+
+/*
+ * 16ビットタイマ(ITU)のチャネル0によるミリ秒単位のタイムアウト
+ * 1ミリ秒ごとのコンペアマッチのフラグをポーリングして数える
+ * （割り込みは使わない）。タイムアウトは同時に1つだけ扱う。
+ * ポーリングの間隔が1ミリ秒より長いと、その分だけタイムアウトは延びる。
+ * チャネル0はOSも使うが、OSの timer_init() で設定し直される。
+ */
+
+#define H8_3069F_TMR16 ((volatile struct h8_3069f_timer16 *)0xffff60)
+#define H8_3069F_TMR16_CH0 ((volatile struct h8_3069f_timer16_ch *)0xffff68)
+
+struct h8_3069f_timer16 {
+  volatile uint8 tstr;
+  volatile uint8 tsnc;
+  volatile uint8 tmdr;
+  volatile uint8 tolr;
+  volatile uint8 tisra;
+  volatile uint8 tisrb;
+  volatile uint8 tisrc;
+};
+
+struct h8_3069f_timer16_ch {
+  volatile uint8 tcr;
+  volatile uint8 tior;
+  volatile uint16 tcnt;
+  volatile uint16 gra;
+  volatile uint16 grb;
+};
+
+#define H8_3069F_TMR16_TCR_PER8     (3<<0)
+#define H8_3069F_TMR16_TCR_CKEG_UP  (0<<3)
+#define H8_3069F_TMR16_TCR_CCLR_GRA (1<<5)
+
+#define H8_3069F_TMR16_TISRA_IMFA0  (1<<0)
+#define H8_3069F_TMR16_TISRA_IMIEA0 (1<<4)
+
+#define H8_3069F_TMR16_TSTR_STR0    (1<<0)
+
+/* φ/8 (20MHz / 8 = 2.5MHz) でカウントした場合の1ミリ秒あたりのカウント数 */
+#define TIMER_COUNT_PER_MSEC 2500
+
+static int timer_remain; /* タイムアウトまでの残りのミリ秒数 */
+
+int timer_init(void)
+{
+  volatile struct h8_3069f_timer16_ch *ch = H8_3069F_TMR16_CH0;
+
+  timer_stop();
+  ch->tcr  = H8_3069F_TMR16_TCR_CCLR_GRA | H8_3069F_TMR16_TCR_CKEG_UP
+    | H8_3069F_TMR16_TCR_PER8;
+  ch->tior = 0;
+  ch->gra  = TIMER_COUNT_PER_MSEC - 1;
+  H8_3069F_TMR16->tisra &= ~(H8_3069F_TMR16_TISRA_IMFA0
+                             | H8_3069F_TMR16_TISRA_IMIEA0);
+  return 0;
+}
+
+/* msec ミリ秒後にタイムアウトするように、カウントを開始する */
+void timer_start(int msec)
+{
+  timer_stop();
+  H8_3069F_TMR16_CH0->tcnt = 0;
+  H8_3069F_TMR16->tisra &= ~H8_3069F_TMR16_TISRA_IMFA0;
+  timer_remain = msec;
+  H8_3069F_TMR16->tstr |= H8_3069F_TMR16_TSTR_STR0;
+}
+
+/* タイムアウトしたか（繰り返し呼び出して、経過したミリ秒を数える） */
+int timer_is_expired(void)
+{
+  if (timer_remain && (H8_3069F_TMR16->tisra & H8_3069F_TMR16_TISRA_IMFA0)) {
+    H8_3069F_TMR16->tisra &= ~H8_3069F_TMR16_TISRA_IMFA0;
+    timer_remain--;
+  }
+  return timer_remain ? 0 : 1;
+}
+
+void timer_stop(void)
+{
+  H8_3069F_TMR16->tstr &= ~H8_3069F_TMR16_TSTR_STR0;
+}
+
+void timer_msleep(int msec)
+{
+  timer_start(msec);
+  while (!timer_is_expired())
+    ;
+  timer_stop();
+}
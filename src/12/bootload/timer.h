@@ -0,0 +1,10 @@
+#ifndef _TIMER_H_INCLUDED_
+#define _TIMER_H_INCLUDED_
+
+int timer_init(void);
+void timer_start(int msec);
+int timer_is_expired(void);
+void timer_stop(void);
+void timer_msleep(int msec);
+
+#endif
@@ -3,17 +3,34 @@
 extern void start(void);
 extern void intr_softerr(void);
 extern void intr_syscall(void);
-extern void intr_serintr(void);
+extern void intr_timintr(void);
+extern void intr_serintr_eri0(void);
+extern void intr_serintr_rxi0(void);
+extern void intr_serintr_txi0(void);
+extern void intr_serintr_tei0(void);
+extern void intr_serintr_eri1(void);
+extern void intr_serintr_rxi1(void);
+extern void intr_serintr_txi1(void);
+extern void intr_serintr_tei1(void);
+extern void intr_serintr_eri2(void);
+extern void intr_serintr_rxi2(void);
+extern void intr_serintr_txi2(void);
+extern void intr_serintr_tei2(void);
+extern void intr_netintr(void);
+extern void intr_adintr(void);
+extern void intr_irqintr(void);
 
 void (*vectors[])(void) = {
     start,  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
     intr_syscall,  intr_softerr, intr_softerr, intr_softerr,
+    intr_irqintr, intr_irqintr, intr_irqintr, intr_irqintr, /* 12～15: IRQ0～3 */
+    intr_irqintr, intr_netintr, NULL, NULL, /* 16: IRQ4, 17: IRQ5(LAN) */
+    NULL,  NULL, NULL, NULL, intr_timintr, NULL, NULL, NULL,
     NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
     NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
     NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-    NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-    NULL,  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-    intr_serintr, intr_serintr, intr_serintr, intr_serintr,
-    intr_serintr, intr_serintr, intr_serintr, intr_serintr,
-    intr_serintr, intr_serintr, intr_serintr, intr_serintr,
+    intr_serintr_eri0, intr_serintr_rxi0, intr_serintr_txi0, intr_serintr_tei0,
+    intr_serintr_eri1, intr_serintr_rxi1, intr_serintr_txi1, intr_serintr_tei1,
+    intr_serintr_eri2, intr_serintr_rxi2, intr_serintr_txi2, intr_serintr_tei2,
+    intr_adintr, /* 64: ADI（ld.scr の vectors はここまで） */
 };
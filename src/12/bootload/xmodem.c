@@ -2,6 +2,9 @@
 #include "serial.h"
 #include "lib.h"
 #include "xmodem.h"
+#include "cksum.h"
+#include "crc32.h"
+#include "timer.h"
 
 #define  XMODEM_SOH 0x01
 #define  XMODEM_STX 0x02
@@ -11,88 +14,275 @@
 #define  XMODEM_CAN 0x18
 #define  XMODEM_EOF 0x1a /* ctrl+z */
 
-#define XMODEM_BLOCK_SIZE 128
+#define XMODEM_BLOCK_SIZE   128  /* SOH のブロック */
+#define XMODEM_1K_BLOCK_SIZE 1024 /* STX のブロック(XMODEM-1K) */
 
+#define XMODEM_CRC 'C' /* CRCモードでの送信開始の要求 */
+#define XMODEM_CRC_RETRY 3 /* 'C' で応答がなければ、チェックサムモードにする */
+#define XMODEM_WAIT_MSEC 1000 /* 'C' または NAK を送り直す間隔 */
+
+/*
+ * 送信開始を待つ
+ * 最初は 'C' を送ってCRCモード(XMODEM-CRC)を要求し、応答がなければ
+ * NAK を送って従来のチェックサムモードにする。CRCモードならば1を返す。
+ * 送信側が先に待っていればすぐに始められるように、最初の 'C' はすぐに送る。
+ */
 static int xmodem_wait(void)
 {
-  long cnt = 0;
+  int retry = 0;
+
+  serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_CRC);
+  timer_start(XMODEM_WAIT_MSEC);
   while (!serial_is_recv_enable(SERIAL_DEFAULT_DEVICE)) {
-    if (++cnt >= 2000000) {
-      cnt = 0;
-      serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_NAK);
+    if (timer_is_expired()) {
+      if (retry < XMODEM_CRC_RETRY)
+        retry++;
+      serial_send_byte(SERIAL_DEFAULT_DEVICE,
+                       (retry < XMODEM_CRC_RETRY) ? XMODEM_CRC : XMODEM_NAK);
+      timer_start(XMODEM_WAIT_MSEC);
     }
   }
-  return 0;
+  timer_stop();
+  return (retry < XMODEM_CRC_RETRY) ? 1 : 0;
 }
 
 /**
  * fields
  *   1byte: block number
  *   1byte: check sum for blocl number
- * 128byte: data
- *   1byte: check sum for data
+ * 128/1024byte: data
+ *   1byte: check sum for data (CRC mode: 2byte CRC-16, big endian)
+ *
+ * ブロックは xmodem_rx_poll() で受信済みの分だけ読み進める（待たない）。
+ * チェックサム・CRCは受信しながら計算するので、最後のバイトを読んだら
+ * すぐに判定して応答を返せる。
  */
-static int xmodem_read_block(unsigned char block_number, char *buf)
-{
-  unsigned char c, block_num, check_sum;
-  int i;
+#define XMODEM_RX_START 0 /* ブロックの先頭(SOH/STX)を待っている */
+#define XMODEM_RX_NUM   1
+#define XMODEM_RX_INV   2
+#define XMODEM_RX_DATA  3
+#define XMODEM_RX_CHECK 4
 
-  /* block number */
-  block_num = serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-  if (block_num != block_number)
-    return -1;
+static struct {
+  int state;
+  int crc_mode;
+  unsigned char start;  /* ブロックの先頭のバイト(SOH/STX) */
+  unsigned char num;
+  unsigned char inv;
+  char *buf;            /* データの受信先（ブロックの先頭までに設定する） */
+  long limit;           /* 受信先に格納できるサイズ（buf と同時に設定する） */
+  int size;             /* データのサイズ */
+  int pos;              /* 受信したデータのサイズ */
+  uint16 sum;           /* 受信しながら計算したチェックサム・CRC */
+  uint16 check;         /* 受信したチェックサム・CRC */
+  int check_len;
+} rx;
 
-  /* block number & checksum = 0xff */
-  block_num ^= serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-  if (block_num != 0xff)
-    return -1;
+/*
+ * 受信済みのバイトを読み進める
+ * ブロックを最後まで読んだらその先頭のバイト(SOH/STX)を、ブロックの外で
+ * 他のバイト(EOT, CANなど)を読んだらそのバイトを返し、それ以上は読まない。
+ * まだ途中ならば -1 を返す。
+ */
+static int xmodem_rx_poll(void)
+{
+  unsigned char c;
+  int start;
 
-  check_sum = 0;
-  for (i = 0; i < XMODEM_BLOCK_SIZE; i++) {
+  while (serial_is_recv_enable(SERIAL_DEFAULT_DEVICE)) {
     c = serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-    *(buf++) = c;
-    check_sum += c;
+    switch (rx.state) {
+    case XMODEM_RX_START:
+      if ((c != XMODEM_SOH) && (c != XMODEM_STX))
+        return c;
+      rx.start = c;
+      rx.size = (c == XMODEM_STX) ? XMODEM_1K_BLOCK_SIZE : XMODEM_BLOCK_SIZE;
+      rx.pos = 0;
+      rx.sum = 0;
+      rx.check = 0;
+      rx.check_len = 0;
+      rx.state = XMODEM_RX_NUM;
+      break;
+
+    case XMODEM_RX_NUM:
+      rx.num = c;
+      rx.state = XMODEM_RX_INV;
+      break;
+
+    case XMODEM_RX_INV:
+      rx.inv = c;
+      rx.state = XMODEM_RX_DATA;
+      break;
+
+    case XMODEM_RX_DATA:
+      if (rx.size > rx.limit) {
+        /* 受信先に入らないブロックは格納せずに読み捨てる（受理しない） */
+        if (rx.crc_mode)
+          rx.sum = cksum_crc16(rx.sum, &c, 1);
+        else
+          rx.sum = cksum_sum8(rx.sum, &c, 1);
+        if (++rx.pos == rx.size)
+          rx.state = XMODEM_RX_CHECK;
+        break;
+      }
+      /* 溜まっている分をまとめて格納し、まとめて計算する */
+      start = rx.pos;
+      rx.buf[rx.pos++] = c;
+      while ((rx.pos < rx.size) && serial_is_recv_enable(SERIAL_DEFAULT_DEVICE))
+        rx.buf[rx.pos++] = serial_recv_byte(SERIAL_DEFAULT_DEVICE);
+      if (rx.crc_mode)
+        rx.sum = cksum_crc16(rx.sum, rx.buf + start, rx.pos - start);
+      else
+        rx.sum = cksum_sum8(rx.sum, rx.buf + start, rx.pos - start);
+      if (rx.pos == rx.size)
+        rx.state = XMODEM_RX_CHECK;
+      break;
+
+    case XMODEM_RX_CHECK:
+      rx.check = (rx.check << 8) | c;
+      if (++rx.check_len == (rx.crc_mode ? 2 : 1)) {
+        rx.state = XMODEM_RX_START;
+        return rx.start;
+      }
+      break;
+    }
   }
 
-  check_sum ^= serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-  if (check_sum)
+  return -1;
+}
+
+/*
+ * 読み終えたブロックの判定
+ * 正しければデータのサイズを返す。
+ * 直前のブロックの再送（ACKが届かなかった場合）ならば 0 を返す。
+ */
+static int xmodem_rx_check(unsigned char block_number)
+{
+  if (rx.sum != rx.check)
+    return -1;
+  if ((rx.num ^ rx.inv) != 0xff)
+    return -1;
+  if (rx.num == (unsigned char)(block_number - 1))
+    return 0;
+  if (rx.num != block_number)
     return -1;
 
-  return i;
+  return rx.size;
 }
 
-long xmodem_recv(char *buf)
+/*
+ * 受理したブロックの処理(crc32_update() と func の呼び出し)
+ * 次のブロックの受信と並行して行うので、受信割り込みのバッファ
+ * (SERIAL_RECV_BUFFER_SIZE)が溢れないように XMODEM_CHUNK_SIZE バイトごとに
+ * 受信を進める。途中で次のブロックを読み終えたら(*eventp が -1 でなくなる)、
+ * 判定と応答はこの処理の後に行う（送信側は応答を待つので、その間に
+ * 次のデータは送られてこない）。
+ */
+#define XMODEM_CHUNK_SIZE 32
+
+static int xmodem_process(char *buf, int size, xmodem_func_t func, void *arg,
+                          int *eventp)
+{
+  int n;
+
+  for (; size > 0; buf += n, size -= n) {
+    n = (size > XMODEM_CHUNK_SIZE) ? XMODEM_CHUNK_SIZE : size;
+    if (*eventp < 0)
+      *eventp = xmodem_rx_poll();
+    crc32_update(buf, n);
+    if (func && (func(buf, n, arg) < 0))
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * XMODEMで受信する(XMODEM-CRC・XMODEM-1K にも対応する)
+ * func が NULL ならば buf に順に格納する。bufsize バイトに入らないブロックが
+ * 送られてきたら、CAN を送って中止し XMODEM_ERR_SIZE を返す
+ * （最後のブロックは埋め草を含めて入ること）。func が NULL でなければ、ブロックを
+ * ブロックバッファ(ld.scr の xmodembuf, 1KBのブロックが2つ入ること)に
+ * 交互に受信して、チェックサムが正しければ func に渡す
+ * （再送されたブロックが渡されることはない）。
+ * ブロックはチェックサムが正しければすぐに ACK を返し、格納・展開などの
+ * 処理は次のブロックを受信しながら行う（送信側が処理を待たない）。
+ * 処理に失敗したときは既に ACK を返しているので、CAN を送って中止する。
+ * 受け取ったブロックは順に crc32_update() に渡すので、受信後に crc32_check() で
+ * イメージのCRC32を検査できる。
+ */
+static long xmodem_recv_blocks(char *buf, long bufsize, xmodem_func_t func,
+                               void *arg)
 {
-  int r, receiving = 0;
+  extern char xmodembuf_start;
+  int r, event = -1, receiving = 0, next = 0, pending_size = 0;
+  char *pending = NULL; /* 処理を待っているブロック */
   long size = 0;
-  unsigned char c, block_number = 1;
+  unsigned char block_number = 1;
+
+  rx.state = XMODEM_RX_START;
+  crc32_init();
 
   while (1) {
     if (!receiving)
-      xmodem_wait();
+      rx.crc_mode = xmodem_wait();
 
-    c = serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-    if (c == XMODEM_EOT) {
+    /* 次のブロックの受信先（func を使うときは、処理中でない方のバッファ） */
+    rx.buf = func ? &xmodembuf_start + next * XMODEM_1K_BLOCK_SIZE : buf + size;
+    rx.limit = func ? XMODEM_1K_BLOCK_SIZE : bufsize - size;
+
+    if (pending) {
+      if (xmodem_process(pending, pending_size, func, arg, &event) < 0) {
+        serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_CAN);
+        return -1;
+      }
+      pending = NULL;
+    }
+
+    while (event < 0)
+      event = xmodem_rx_poll();
+
+    if (event == XMODEM_EOT) {
       serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_ACK);
       break;
-    } else if (c == XMODEM_CAN) {
+    } else if (event == XMODEM_CAN) {
       return -1;
-    } else if (c == XMODEM_SOH) {
+    } else if ((event == XMODEM_SOH) || (event == XMODEM_STX)) {
       receiving++;
-      r = xmodem_read_block(block_number, buf);
+      r = xmodem_rx_check(block_number);
       if (r < 0) {
         serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_NAK);
+      } else if (r == 0) {
+        /* 受信済みのブロックの再送なので、捨てて ACK を返す */
+        serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_ACK);
+      } else if (rx.size > rx.limit) {
+        /* 受信先に入らない（格納せずに読み捨てている） */
+        serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_CAN);
+        return XMODEM_ERR_SIZE;
       } else {
+        /* 先に ACK を返して、送信側に次のブロックを送らせる */
+        serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_ACK);
+        pending = rx.buf;
+        pending_size = r;
         block_number++;
         size += r;
-        buf  += r;
-        serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_ACK);
+        next ^= 1;
       }
     } else {
       if (receiving)
         return -1;
     }
+    event = -1;
   }
 
   return size;
 }
+
+long xmodem_recv(char *buf, long bufsize)
+{
+  return xmodem_recv_blocks(buf, bufsize, NULL, NULL);
+}
+
+long xmodem_recv_func(xmodem_func_t func, void *arg)
+{
+  return xmodem_recv_blocks(NULL, 0, func, arg);
+}
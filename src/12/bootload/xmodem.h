@@ -1,6 +1,16 @@
 #ifndef _XMODEM_H_INCLUDED_
 #define _XMODEM_H_INCLUDED_
 
-long xmodem_recv(char *buf);
+/*
+ * 受信したブロックを受け取る関数(xmodem_recv_func())
+ * ブロックは分割して渡すことがある（ファイル中の順に、続けて渡す）。
+ * 負の値を返すと受信を中止する
+ */
+typedef int (*xmodem_func_t)(char *buf, int size, void *arg);
+
+#define XMODEM_ERR_SIZE (-2) /* 受信バッファに入らない(xmodem_recv()) */
+
+long xmodem_recv(char *buf, long bufsize);
+long xmodem_recv_func(xmodem_func_t func, void *arg);
 
 #endif
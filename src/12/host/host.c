@@ -0,0 +1,308 @@
+/*
+ * ホスト環境(Linux/x86-64)でのシミュレーション
+ * H8依存の startup.s(dispatch), intr.S, interrupt.c の代わりに、
+ * ucontext によるコンテキスト切り替えとシグナルによる割り込みを提供する。
+ *
+ * ・スレッドのコンテキストは、スレッドのスタック上の host_frame で表す
+ *   (kz_context の sp には host_frame のアドレスが入る)
+ * ・トラップ(システムコール)と割り込みは、host_frame にコンテキストを保存し、
+ *   割り込みスタック上で interrupt() を呼び出す
+ * ・割り込み禁止はシグナルのブロックで模擬する
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "intr.h"
+#include "host.h"
+
+typedef short softvec_type_t;
+typedef void (*softvec_handler_t)(softvec_type_t type, unsigned long sp);
+
+struct host_frame {
+  ucontext_t uc;
+  /* 以下はスレッドの初期コンテキストのみ使用 */
+  void (*func)(void *);
+  void *arg;
+  int intr_enable;
+};
+
+/*
+ * リンカスクリプトで定義される領域の代わり
+ * (kozos.c は extern char で参照し、アドレスのみを使う)
+ */
+asm(".bss\n"
+    ".balign 16\n"
+    ".globl softvec\n"
+    "softvec:\n"
+    ".space " HOST_STR(HOST_SOFTVEC_SIZE) "\n"
+    ".globl crashdump\n"
+    "crashdump:\n"
+    ".space " HOST_STR(HOST_CRASHDUMP_SIZE) "\n"
+    ".globl bootinfo\n"
+    "bootinfo:\n"
+    ".space " HOST_STR(HOST_BOOTINFO_SIZE) "\n"
+    ".globl userstack\n"
+    "userstack:\n"
+    ".space " HOST_STR(HOST_USERSTACK_SIZE) "\n"
+    ".globl euserstack\n"
+    "euserstack:\n"
+    ".balign 16\n"
+    ".globl dram_freearea\n"
+    "dram_freearea:\n"
+    ".space " HOST_STR(HOST_DRAM_SIZE) "\n"
+    ".globl edram\n"
+    "edram:\n"
+    ".text\n");
+
+extern softvec_handler_t softvec[];
+
+static char intrstack[HOST_INTRSTACK_SIZE] __attribute__((aligned(16)));
+static ucontext_t intr_uc;
+static struct host_frame *intr_frame;
+static softvec_type_t intr_type;
+static struct host_frame *start_frame;
+static sigset_t intr_signals; /* 割り込みとして扱うシグナル */
+
+/* 割り込み禁止・有効化 */
+void host_intr_disable(void)
+{
+  sigprocmask(SIG_BLOCK, &intr_signals, NULL);
+}
+
+void host_intr_enable(void)
+{
+  sigprocmask(SIG_UNBLOCK, &intr_signals, NULL);
+}
+
+/* 割り込み禁止中ならば1を返す（kz_lock_ceiling() 用） */
+int host_intr_is_disable(void)
+{
+  sigset_t mask;
+
+  sigprocmask(SIG_BLOCK, NULL, &mask);
+  return sigismember(&mask, SIGALRM);
+}
+
+/* 割り込みスタック上での処理（intr.S の jsr @_interrupt 以降に相当） */
+static void host_intr_entry(void)
+{
+  struct host_frame *frame = intr_frame;
+  softvec_handler_t handler = softvec[intr_type];
+
+  if (handler)
+    handler(intr_type, (unsigned long)frame);
+
+  /* ハンドラから戻ってきた場合は、割り込まれたコンテキストに戻る */
+  setcontext(&frame->uc);
+  abort();
+}
+
+/*
+ * 割り込み（トラップ）の入口
+ * 呼び出し元のコンテキストを保存し、割り込みスタックに切り替える。
+ * 保存したコンテキストが dispatch() されると、ここから戻る。
+ */
+static void host_enter(softvec_type_t type)
+{
+  struct host_frame frame;
+  sigset_t mask;
+  volatile int resumed = 0;
+
+  /*
+   * setcontext() はシグナルマスクを戻してからレジスタを戻すので、
+   * 割り込み禁止のままコンテキストを保存して、戻った後に割り込みを元に戻す
+   * (割り込みスタック上でシグナルを受け付けないようにする)。
+   */
+  sigprocmask(SIG_BLOCK, &intr_signals, &mask);
+  getcontext(&frame.uc);
+  if (resumed) {
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    return;
+  }
+  resumed = 1;
+
+  intr_type = type;
+  intr_frame = &frame;
+
+  getcontext(&intr_uc);
+  intr_uc.uc_stack.ss_sp = intrstack;
+  intr_uc.uc_stack.ss_size = sizeof(intrstack);
+  intr_uc.uc_link = NULL;
+  intr_uc.uc_sigmask = intr_signals;
+  makecontext(&intr_uc, host_intr_entry, 0);
+  setcontext(&intr_uc);
+  abort();
+}
+
+/* トラップ命令(trapa #0)の代わり */
+void host_trap(softvec_type_t type)
+{
+  host_enter(type);
+}
+
+/* ハードウェア割り込みの発生（シグナルハンドラから呼ぶ） */
+void host_interrupt(softvec_type_t type)
+{
+  if (softvec[type])
+    host_enter(type);
+}
+
+/* スレッドの開始（初期コンテキストの実行開始位置） */
+static void host_thread_start(void)
+{
+  struct host_frame *frame = start_frame;
+
+  if (frame->intr_enable)
+    host_intr_enable();
+  frame->func(frame->arg);
+  abort(); /* スレッドの関数からは戻らない(kz_exit()する) */
+}
+
+/*
+ * スレッドの初期コンテキストの作成（thread_run() から呼ばれる）
+ * スタックの末尾に host_frame を置き、その下をスタックとして使う
+ */
+unsigned long host_context_init(char *stack, int size, void (*func)(void *),
+                                void *arg, int intr_disable)
+{
+  struct host_frame *frame;
+
+  frame = (struct host_frame *)((unsigned long)(stack - sizeof(*frame)) & ~15UL);
+  memset(frame, 0, sizeof(*frame));
+  getcontext(&frame->uc);
+  frame->uc.uc_stack.ss_sp = stack - size;
+  frame->uc.uc_stack.ss_size = (char *)frame - (stack - size);
+  frame->uc.uc_link = NULL;
+  /* 開始直後は割り込み禁止にしておき、host_thread_start() で戻す */
+  frame->uc.uc_sigmask = intr_signals;
+  makecontext(&frame->uc, host_thread_start, 0);
+  frame->func = func;
+  frame->arg = arg;
+  frame->intr_enable = !intr_disable;
+
+  return (unsigned long)frame;
+}
+
+/*
+ * ファイバ(fiber.c)のコンテキスト
+ * スタックの末尾に ucontext_t を置き、そのアドレスをスタックポインタとして扱う
+ */
+unsigned long host_fiber_init(char *stack, int size, void (*entry)(void))
+{
+  ucontext_t *uc;
+
+  uc = (ucontext_t *)((unsigned long)(stack + size - sizeof(*uc)) & ~15UL);
+  getcontext(uc);
+  uc->uc_stack.ss_sp = stack;
+  uc->uc_stack.ss_size = (char *)uc - stack;
+  uc->uc_link = NULL;
+  makecontext(uc, entry, 0);
+
+  return (unsigned long)uc;
+}
+
+/* ファイバの切り替え(startup.s の fiber_switch の代わり) */
+void fiber_switch(unsigned long *savesp, unsigned long sp)
+{
+  ucontext_t uc;
+
+  *savesp = (unsigned long)&uc;
+  swapcontext(&uc, (ucontext_t *)sp);
+}
+
+/* スレッドのディスパッチ(startup.s の dispatch の代わり) */
+void dispatch(unsigned long *context)
+{
+  struct host_frame *frame = (struct host_frame *)*context;
+
+  start_frame = frame;
+  setcontext(&frame->uc);
+  abort();
+}
+
+/* スリープ命令の代わり（割り込みを有効にして割り込みを待つ） */
+void host_idle(void)
+{
+  sigset_t empty;
+
+  host_serial_idle();
+
+  sigemptyset(&empty);
+  sigsuspend(&empty);
+  host_intr_enable();
+}
+
+/* シミュレーションの終了（make check の結果を終了コードで返す） */
+void host_exit(int status)
+{
+  exit(status);
+}
+
+/* シグナルの登録 */
+void host_signal(int sig, void (*handler)(int))
+{
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handler;
+  sa.sa_mask = intr_signals; /* ハンドラの実行中は全ての割り込みを禁止する */
+  sa.sa_flags = SA_RESTART;
+  sigaction(sig, &sa, NULL);
+}
+
+/* ソフトウェア割り込みベクタ（interrupt.c の代わり） */
+int softvec_init(void)
+{
+  int type;
+  for (type = 0; type < SOFTVEC_TYPE_NUM; type++)
+    softvec[type] = NULL;
+  return 0;
+}
+
+int softvec_setintr(softvec_type_t type, softvec_handler_t handler)
+{
+  softvec[type] = handler;
+  return 0;
+}
+
+void interrupt(softvec_type_t type, unsigned long sp)
+{
+  softvec_handler_t handler = softvec[type];
+  if (handler)
+    handler(type, sp);
+}
+
+/* 割り込みの優先レベルは模擬しない（全て優先レベル0として扱う） */
+int intr_level_init(void)
+{
+  return 0;
+}
+
+int intr_setlevel(softvec_type_t type, int level)
+{
+  return 0;
+}
+
+int intr_getlevel(softvec_type_t type)
+{
+  return 0;
+}
+
+/* main() の前に実行される初期化 */
+static void __attribute__((constructor)) host_init(void)
+{
+  /* SIGSEGVなどは割り込み禁止中でも受け付けるように、対象のシグナルのみとする */
+  sigemptyset(&intr_signals);
+  sigaddset(&intr_signals, SIGALRM); /* タイマ */
+  sigaddset(&intr_signals, SIGIO);   /* シリアル受信 */
+  sigaddset(&intr_signals, SIGUSR1); /* シリアルの割り込み要因 */
+  host_timer_setup();
+  host_serial_setup();
+
+  /* ブートローダから起動されたときと同様に、割り込み禁止で開始する */
+  host_intr_disable();
+}
@@ -0,0 +1,26 @@
+#ifndef _HOST_H_INCLUDED_
+#define _HOST_H_INCLUDED_
+
+/*
+ * ホスト環境でのシミュレーションの内部インターフェース
+ * (OSのヘッダはシステムのヘッダと衝突するので読み込まない)
+ */
+
+#define HOST_STR_(x) #x
+#define HOST_STR(x) HOST_STR_(x)
+
+#define HOST_SOFTVEC_SIZE   0x100   /* ソフトウェア割り込みベクタ（8バイト×20以上） */
+#define HOST_CRASHDUMP_SIZE 0xb0    /* クラッシュダンプ(crashdump.h) */
+#define HOST_BOOTINFO_SIZE  0x10    /* 起動の情報(bootinfo.h) */
+#define HOST_USERSTACK_SIZE 0x80000 /* スレッドのスタックの領域 */
+#define HOST_INTRSTACK_SIZE 0x10000 /* 割り込みスタック */
+#define HOST_DRAM_SIZE      0x200000 /* 外部DRAM */
+
+void host_interrupt(short type);
+void host_signal(int sig, void (*handler)(int));
+
+void host_timer_setup(void);
+void host_serial_setup(void);
+void host_serial_idle(void);
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * ホスト環境でのシリアルの模擬(serial.c の代わり)
+ * 全チャネルを標準入出力に対応させる。
+ * ・送信は write() で即時に完了するので、TDRE・TEND は常に1として扱う
+ * ・受信データは受信FIFOに読み込み、先頭の1文字を RDR として扱う
+ * ・割り込み要因(TXI/RXI/TEI)の発生は SIGUSR1 で通知する
+ *   (標準入力へのデータ到着は SIGIO で通知される)
+ * ・実機のシリアルは1文字ごとに時間がかかるが、ホストでは入力が一度に届くので、
+ *   受信割り込みはアイドル状態になるごとに1文字ずつ発生させる
+ *   (そうしないと、受信処理だけでFIFOを使い切るまでスレッドが動けない)
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "intr.h"
+#include "serial.h"
+#include "host.h"
+
+#define RECV_FIFO_SIZE 256
+
+static struct {
+  int tie;  /* 送信割り込み有効 */
+  int rie;  /* 受信割り込み有効 */
+  int teie; /* 送信終了割り込み有効 */
+} regs[SERIAL_DEVICE_NUM];
+
+/* 標準入力は全チャネルで共有する */
+static struct {
+  unsigned char buf[RECV_FIFO_SIZE];
+  int head;
+  int len;
+  int eof;
+  int ready; /* 受信割り込みを発生させてよい */
+} recv_fifo;
+
+/* 標準入力から受信FIFOに読み込む */
+static void serial_poll(void)
+{
+  int pos, size;
+
+  while (!recv_fifo.eof && recv_fifo.len < RECV_FIFO_SIZE) {
+    pos = (recv_fifo.head + recv_fifo.len) % RECV_FIFO_SIZE;
+    size = (pos < recv_fifo.head) ? recv_fifo.head - pos : RECV_FIFO_SIZE - pos;
+    size = read(0, recv_fifo.buf + pos, size);
+    if (size == 0)
+      recv_fifo.eof = 1;
+    if (size <= 0)
+      break;
+    recv_fifo.len += size;
+  }
+}
+
+/* 割り込み要因の発生を通知する（割り込み禁止中は保留される） */
+static void serial_raise(void)
+{
+  raise(SIGUSR1);
+}
+
+/* 割り込み要因の調べ、割り込みを発生させる */
+static void serial_intr(int sig)
+{
+  int index;
+
+  serial_poll();
+
+  for (index = 0; index < SERIAL_DEVICE_NUM; index++) {
+    if (regs[index].rie && recv_fifo.len && recv_fifo.ready) {
+      serial_raise(); /* 他の要因は、再度のシグナルで調べ直す */
+      host_interrupt(SOFTVEC_TYPE_SERINTR(index, SERINTR_RXI));
+      return;
+    }
+    if (regs[index].tie) {
+      serial_raise();
+      host_interrupt(SOFTVEC_TYPE_SERINTR(index, SERINTR_TXI));
+      return;
+    }
+    if (regs[index].teie) {
+      serial_raise();
+      host_interrupt(SOFTVEC_TYPE_SERINTR(index, SERINTR_TEI));
+      return;
+    }
+  }
+}
+
+void host_serial_setup(void)
+{
+  int flags;
+
+  host_signal(SIGUSR1, serial_intr);
+  host_signal(SIGIO, serial_intr);
+
+  flags = fcntl(0, F_GETFL);
+  fcntl(0, F_SETFL, flags | O_NONBLOCK | O_ASYNC);
+  fcntl(0, F_SETOWN, getpid());
+}
+
+/*
+ * アイドル時の処理（割り込みを待つ前に呼ばれる）
+ * 次の1文字の受信割り込みを許可する。
+ * 入力が終了していて、送受信が完了していれば終了する。
+ * (KZ_BENCH の場合は、ベンチマークの終了時に bench_main() が host_exit() で終了する)
+ */
+void host_serial_idle(void)
+{
+  int index;
+
+  serial_poll();
+  recv_fifo.ready = 1;
+  if (recv_fifo.len) {
+    serial_raise();
+    return;
+  }
+  if (!recv_fifo.eof)
+    return;
+#ifdef KZ_BENCH
+  return;
+#endif
+
+  for (index = 0; index < SERIAL_DEVICE_NUM; index++) {
+    if (regs[index].tie || regs[index].teie)
+      return;
+  }
+  exit(0);
+}
+
+int serial_init(int index)
+{
+  regs[index].tie = 0;
+  regs[index].rie = 0;
+  regs[index].teie = 0;
+  return 0;
+}
+
+/* ボーレートは模擬しない(表にある値と同じものを受け付ける) */
+int serial_set_baud(int index, long rate)
+{
+  switch (rate) {
+  case 2400: case 4800: case 9600: case 19200:
+  case 31250: case 38400: case 57600: case 125000:
+    return 0;
+  }
+  return -1;
+}
+
+/* ボーレートは模擬しないので、9600bpsでの1文字の時間を返す */
+uint32 serial_char_time(int index)
+{
+  return 2600;
+}
+
+int serial_is_send_enable(int index)
+{
+  return 1;
+}
+
+int serial_send_byte(int index, unsigned char c)
+{
+  while (write(1, &c, 1) < 0)
+    ;
+  if (regs[index].tie)
+    serial_raise();
+  return 0;
+}
+
+/* DMACの転送は write() で即時に完了させ、次の送信割り込みを発生させる */
+int serial_dma_send(int index, unsigned char *buf, int len)
+{
+  int size;
+
+  while (len > 0) {
+    size = write(1, buf, len);
+    if (size < 0)
+      continue;
+    buf += size;
+    len -= size;
+  }
+  if (regs[index].tie)
+    serial_raise();
+  return 0;
+}
+
+int serial_is_recv_enable(int index)
+{
+  serial_poll();
+  return recv_fifo.len ? 1 : 0;
+}
+
+unsigned char serial_recv_byte(int index)
+{
+  unsigned char c;
+
+  while (!serial_is_recv_enable(index)) {
+    if (recv_fifo.eof)
+      exit(0);
+  }
+
+  c = recv_fifo.buf[recv_fifo.head];
+  recv_fifo.head = (recv_fifo.head + 1) % RECV_FIFO_SIZE;
+  recv_fifo.len--;
+  recv_fifo.ready = 0;
+
+  return c;
+}
+
+int serial_intr_is_send_enable(int index)
+{
+  return regs[index].tie;
+}
+
+void serial_intr_send_enable(int index)
+{
+  regs[index].tie = 1;
+  serial_raise(); /* TDRE は常に1なので、すぐに送信割り込みが発生する */
+}
+
+void serial_intr_send_disable(int index)
+{
+  regs[index].tie = 0;
+}
+
+void serial_intr_send_end_enable(int index)
+{
+  regs[index].teie = 1;
+  serial_raise(); /* TEND は常に1なので、すぐに送信終了割り込みが発生する */
+}
+
+void serial_intr_send_end_disable(int index)
+{
+  regs[index].teie = 0;
+}
+
+/* 送信は即時に完了するので、常に送信終了している */
+int serial_is_send_done(int index)
+{
+  return 1;
+}
+
+int serial_intr_is_recv_enable(int index)
+{
+  return regs[index].rie;
+}
+
+void serial_intr_recv_enable(int index)
+{
+  regs[index].rie = 1;
+}
+
+void serial_intr_recv_disable(int index)
+{
+  regs[index].rie = 0;
+}
+
+/* フロー制御の端子はないので、相手は常に受信可能とする */
+int serial_flow_init(int index)
+{
+  return 0;
+}
+
+void serial_rts_set(int index, int ready)
+{
+}
+
+int serial_cts_is_ready(int index)
+{
+  return 1;
+}
+
+/* 受信エラーは発生しないので、回数は常に0 */
+void serial_recv_error_clear(int index)
+{
+}
+
+int serial_get_errstat(int index, serial_errstat_t *statp)
+{
+  statp->overrun = 0;
+  statp->framing = 0;
+  statp->parity = 0;
+  return 0;
+}
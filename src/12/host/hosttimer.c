@@ -0,0 +1,150 @@
+/*
+ * ホスト環境でのタイマの模擬(timer.c の代わり)
+ * ITUのカウンタ(φ/8 = 2.5MHz)を CLOCK_MONOTONIC から算出し、
+ * コンペアマッチ割り込みを setitimer(ITIMER_REAL) の SIGALRM で発生させる。
+ * (SIGALRMは1つしかないので、割り込みを発生できるのは1チャネルのみ)
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "defines.h"
+#include "intr.h"
+#include "timer.h"
+#include "host.h"
+
+#define TIMER_NUM 3
+#define TIMER_COUNT_PER_MSEC 2500
+
+static struct {
+  int running;
+  int expired;              /* コンペアマッチのフラグ(IMFA) */
+  unsigned long period;     /* 周期のカウント数(GRA+1) */
+  unsigned long long base;  /* カウンタが0だった時刻(ナノ秒) */
+} regs[TIMER_NUM];
+
+static int alarm_index = -1; /* SIGALRMを割り当てているチャネル */
+
+static unsigned long long now_nsec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 現在のカウンタの値を求める（周期を過ぎていればクリアしてフラグを立てる） */
+static unsigned long timer_update(int index)
+{
+  unsigned long long count;
+
+  if (!regs[index].running)
+    return 0;
+
+  count = (now_nsec() - regs[index].base) * TIMER_COUNT_PER_MSEC / 1000000;
+  if (count >= regs[index].period) {
+    regs[index].expired = 1;
+    regs[index].base += count / regs[index].period * regs[index].period
+      * 1000000 / TIMER_COUNT_PER_MSEC;
+    count %= regs[index].period;
+  }
+  return count;
+}
+
+/* 次のコンペアマッチでSIGALRMが発生するように設定する */
+static void timer_arm(int index)
+{
+  struct itimerval it;
+  unsigned long usec, remain;
+
+  it.it_interval.tv_sec = it.it_interval.tv_usec = 0;
+  it.it_value = it.it_interval;
+
+  if (regs[index].running) {
+    usec = regs[index].period * 1000 / TIMER_COUNT_PER_MSEC;
+    remain = (regs[index].period - timer_update(index)) * 1000
+      / TIMER_COUNT_PER_MSEC;
+    if (!remain)
+      remain = 1;
+    it.it_interval.tv_sec = usec / 1000000;
+    it.it_interval.tv_usec = usec % 1000000;
+    it.it_value.tv_sec = remain / 1000000;
+    it.it_value.tv_usec = remain % 1000000;
+  }
+
+  alarm_index = index;
+  setitimer(ITIMER_REAL, &it, NULL);
+}
+
+static void timer_intr(int sig)
+{
+  if (alarm_index < 0)
+    return;
+  timer_update(alarm_index);
+  if (regs[alarm_index].expired)
+    host_interrupt(SOFTVEC_TYPE_TIMINTR);
+}
+
+void host_timer_setup(void)
+{
+  host_signal(SIGALRM, timer_intr);
+}
+
+int timer_init(int index, int msec)
+{
+  timer_stop(index);
+  regs[index].period = msec * TIMER_COUNT_PER_MSEC;
+  regs[index].expired = 0;
+  return 0;
+}
+
+void timer_start(int index)
+{
+  regs[index].running = 1;
+  regs[index].base = now_nsec();
+  timer_arm(index);
+}
+
+void timer_stop(int index)
+{
+  timer_update(index);
+  regs[index].running = 0;
+  if (alarm_index == index)
+    timer_arm(index);
+}
+
+int timer_is_expired(int index)
+{
+  timer_update(index);
+  return regs[index].expired;
+}
+
+void timer_clear(int index)
+{
+  regs[index].expired = 0;
+}
+
+uint16 timer_get_count(int index)
+{
+  return timer_update(index);
+}
+
+uint16 timer_get_period(int index)
+{
+  return regs[index].period;
+}
+
+void timer_set_period(int index, uint32 count)
+{
+  timer_update(index);
+  regs[index].period = count;
+  timer_arm(index);
+}
+
+void timer_set_count(int index, uint16 count)
+{
+  timer_update(index);
+  regs[index].base = now_nsec()
+    - (unsigned long long)count * 1000000 / TIMER_COUNT_PER_MSEC;
+  timer_arm(index);
+}
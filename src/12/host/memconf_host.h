@@ -0,0 +1,7 @@
+/*
+ * ホスト環境でのメモリプールの構成
+ * メッセージに含めるポインタなどが大きいので、各サイズを ../os/memconf.h の倍にする
+ */
+MEMORY_POOL(32, 8)
+MEMORY_POOL(64, 8)
+MEMORY_POOL(128, 4)
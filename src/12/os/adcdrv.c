@@ -0,0 +1,138 @@
+#include "defines.h"
+#include "kozos.h"
+#include "intr.h"
+#include "interrupt.h"
+#include "drv.h"
+#include "adcdrv.h"
+
+/*
+ * A/D変換ドライバ（内蔵の10ビットA/D変換器, make ADC=1 で組み込む）
+ * 要求の受け付けと完了の通知は drv.c で行う。割り込みハンドラは変換が
+ * 終わるたびに結果をバッファに読み出し、指定の回数が終わったら変換を
+ * 止めて kx_drv_complete() を呼ぶ。スレッドが起きるのは要求ごとに1回。
+ * 割り込みの処理が次の変換の終了までに間に合わなければ、その間の
+ * 変換の結果は失われる（次の変換の結果を読む）。
+ */
+
+#define H8_3069F_ADDR  ((volatile uint8 *)0xffffe0) /* ADDRA～ADDRD(各2バイト) */
+#define H8_3069F_ADCSR ((volatile uint8 *)0xffffe8)
+
+#define H8_3069F_ADCSR_ADF  (1<<7) /* 変換終了 */
+#define H8_3069F_ADCSR_ADIE (1<<6) /* 変換終了の割り込み */
+#define H8_3069F_ADCSR_ADST (1<<5) /* 変換の開始 */
+#define H8_3069F_ADCSR_SCAN (1<<4) /* スキャンモード */
+#define H8_3069F_ADCSR_CKS  (1<<3) /* 1: 134ステート, 0: 266ステート */
+
+static struct adcreg {
+  uint16 *buf;    /* 次に書き込む位置 */
+  int count;      /* 残りの変換の回数 */
+  int done;       /* 変換した回数 */
+  uint8 first;
+  uint8 channels;
+  uint8 adcsr;    /* 変換の開始時に ADCSR に書き込む値 */
+} adcreg;
+
+static drv_dev_t adcdev;
+
+/* 変換を止める（ADF もクリアする） */
+static void adc_stop(void)
+{
+  *H8_3069F_ADCSR = 0;
+}
+
+/* チャネルの変換結果を読む（上位バイトを先に読むこと） */
+static uint16 adc_read(int ch)
+{
+  volatile uint8 *addr = H8_3069F_ADDR + ((ch & 3) << 1);
+  uint16 value;
+
+  value = addr[0] << 8;
+  value |= addr[1];
+  return value >> 6; /* 上位10ビットに左詰めされている */
+}
+
+/* 変換終了の割り込み */
+static void adcdrv_intr(int type)
+{
+  struct adcreg *adc = &adcreg;
+  int i;
+
+  if (!(*H8_3069F_ADCSR & H8_3069F_ADCSR_ADF))
+    return;
+
+  for (i = 0; i < adc->channels; i++)
+    *(adc->buf++) = adc_read(adc->first + i);
+  adc->done++;
+
+  if (--adc->count == 0) {
+    adc_stop();
+    kx_drv_complete(&adcdev, adc->done);
+    return;
+  }
+
+  /*
+   * ADF を読んだ後に0を書き込んでクリアする。スキャンモードでは変換が
+   * 続いているが、単一モードでは止まっているので再び開始する。
+   */
+  if (adc->channels == 1)
+    *H8_3069F_ADCSR = adc->adcsr;
+  else
+    *H8_3069F_ADCSR &= ~H8_3069F_ADCSR_ADF;
+}
+
+/* 要求の開始（ドライバのスレッドから呼ばれる） */
+static int adcdrv_start(drv_dev_t *dev, drv_req_t *req)
+{
+  adcdrv_req_t *areq = (adcdrv_req_t *)req;
+  struct adcreg *adc = &adcreg;
+  uint8 adcsr;
+
+  if (req->command != ADCDRV_CMD_SCAN)
+    return ADCDRV_ERR_PARAM;
+  if ((areq->channels < 1) || (areq->channels > 4) || (areq->first > 7) ||
+      (req->size <= 0) || (req->data == NULL))
+    return ADCDRV_ERR_PARAM;
+  if ((areq->channels > 1) && (areq->first & 3))
+    return ADCDRV_ERR_PARAM;
+
+  /*
+   * 単一モードでは CH2～CH0 が変換するチャネル、スキャンモードでは CH2 が
+   * グループで CH1～CH0 が最後のチャネルになる。
+   */
+  adcsr = H8_3069F_ADCSR_ADIE | H8_3069F_ADCSR_ADST;
+  if (!areq->slow)
+    adcsr |= H8_3069F_ADCSR_CKS;
+  if (areq->channels > 1)
+    adcsr |= H8_3069F_ADCSR_SCAN | areq->first | (areq->channels - 1);
+  else
+    adcsr |= areq->first;
+
+  adc->buf = (uint16 *)req->data;
+  adc->count = req->size;
+  adc->done = 0;
+  adc->first = areq->first;
+  adc->channels = areq->channels;
+  adc->adcsr = adcsr;
+
+  /* モードやチャネルは変換を止めた状態で設定する */
+  adc_stop();
+  *H8_3069F_ADCSR = adcsr & ~H8_3069F_ADCSR_ADST;
+  *H8_3069F_ADCSR = adcsr;
+
+  return DRV_PENDING;
+}
+
+static const drv_ops_t adcdrv_ops = {
+  adcdrv_start,
+};
+
+int adcdrv_main(int argc, char *argv[])
+{
+  adc_stop();
+  drv_init(&adcdev, &adcdrv_ops, MSGBOX_ID_ADC, NULL);
+  kz_setintr(SOFTVEC_TYPE_ADINTR, adcdrv_intr);
+
+  drv_loop(MSGBOX_ID_ADC, &adcdev, 1);
+
+  return 0;
+}
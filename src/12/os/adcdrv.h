@@ -0,0 +1,34 @@
+#ifndef _ADCDRV_H_INCLUDED_
+#define _ADCDRV_H_INCLUDED_
+
+#include "defines.h"
+#include "drv.h"
+
+#define ADCDRV_CMD_SCAN 's' /* 指定した回数だけ変換してバッファに読み込む */
+
+/*
+ * A/D変換ドライバへの要求（drv_call()/drv_submit() で MSGBOX_ID_ADC に送る）
+ * 非同期のドライバの共通部分(drv.h)の要求に、チャネルの指定を加えたもの。
+ *
+ * ・req.index は 0（A/D変換器は1つ）
+ * ・req.size 回の変換を行い、1回ごとに first から channels 個のチャネルの
+ *   結果(0～1023)を req.data に uint16 で続けて書き込む
+ *   （req.data は uint16 × channels × req.size の領域）
+ * ・channels が 1 ならば単一モード、2～4 ならばスキャンモードで変換する。
+ *   スキャンモードでは first は 0 か 4 であること（AN0～AN3 か AN4～AN7）。
+ * ・結果(req.result)は変換した回数。不正な指定は ADCDRV_ERR_PARAM
+ *
+ * 割り込みは1回の変換（スキャン）ごとに入るが、ドライバのスレッドは
+ * 全部の変換が終わったときに1回だけ起こされる。
+ */
+typedef struct {
+  drv_req_t req;
+  uint8 first;    /* 最初のチャネル(0～7) */
+  uint8 channels; /* チャネルの数(1～4) */
+  uint8 slow;     /* 0: 変換時間134ステート, 1: 266ステート */
+  uint8 dummy;
+} adcdrv_req_t;
+
+#define ADCDRV_ERR_PARAM (-2) /* チャネルや回数の指定が不正 */
+
+#endif
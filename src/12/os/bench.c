@@ -0,0 +1,850 @@
+#include "defines.h"
+#include "kozos.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "lib.h"
+#include "cksum.h"
+#include "drv.h"
+#ifdef KZ_IRQDRV
+#include "irqdrv.h"
+#endif
+#include "overlay.h"
+#include "task.h"
+#include "shbuf.h"
+#include "bench.h"
+
+/*
+ * マイクロベンチマーク
+ * 16ビットタイマ(φ/8 = 0.4us単位, 1カウント = 8サイクル)で各処理の時間を測定し、
+ * 最小・最大・平均をカウント数で通知する。
+ * コマンドスレッドの bench コマンドから bench_run() で実行する。
+ * make BENCH=1 の場合は、起動時にベンチマークスレッドが全てを実行して
+ * 結果をシリアルに表示する。
+ * 測定中は呼び出したスレッドの優先度を BENCH_PRIORITY に上げる。
+ * kmrandom と storm はメモリプールとメッセージボックスの負荷試験を兼ねていて、
+ * drv はドライバの共通部分(drv.c)の試験を兼ねていて、
+ * cksum は既知の値・分割した計算との一致を調べて、
+ * irq は割り込みの回数も調べて(KZ_IRQDRV のみ)、
+ * task はイベントの順序と実行回数も調べて、
+ * spawn はコピーした引数(KZ_THREAD_ATTR_ARGCOPY)の内容も調べて、
+ * shbuf は所有権のない操作が失敗することと、内容が渡ることも調べて、
+ * 内容の検査で見つけた誤りの数も通知する。ホスト環境(src/12/host)では
+ * make check で全てを実行し、誤りがあれば終了コードを1にして終了する。
+ * bench.o はオーバーレイ(OVERLAY_ID_BENCH)なので、kz_overlay_enter() して
+ * から呼ぶこと。測定は内蔵RAMのウィンドウで実行するので、常駐のコードと
+ * 同じ速度になる。
+ */
+
+/* 繰り返し回数（平均を割り算なしで求めるので2のべき乗にする） */
+#define BENCH_LOOP_SHIFT 6
+#define BENCH_LOOP_SHIFT_MAX 10
+#define BENCH_PRIORITY 3
+
+/* kmrandom で同時に保持するブロックの数と最大サイズ(2のべき乗) */
+#define BENCH_KMRANDOM_SLOTS 4
+#define BENCH_KMRANDOM_SIZE  32
+/* storm で一度に送信するメッセージの数 */
+#define BENCH_STORM_NUM 8
+/* cksum で計算するバイト数（XMODEMのブロックの半分。スタックに置く） */
+#define BENCH_CKSUM_SIZE 64
+
+typedef uint32 bench_time_t;
+
+static struct {
+  uint32 min;
+  uint32 max;
+  uint32 total;
+  int loops;
+  int shift;
+  int errors; /* 内容の検査で見つけた誤りの数 */
+  bench_report_t report;
+  void *arg;
+} result;
+
+static kz_msgbox_id_t ping_box, pong_box, drv_box;
+static int pong_running, yield_running;
+#ifdef KZ_IRQDRV
+static int irq_running;
+static bench_time_t irq_time; /* irq の相手スレッドが起床した時刻 */
+#endif
+static bench_time_t task_time; /* task のハンドラが呼ばれた時刻 */
+static int task_seq;            /* task のハンドラが受け取った順番 */
+static uint16 rand_state = 1;
+
+/* 現在時刻の取得（kz_gettime() のカウント数） */
+static void bench_now(bench_time_t *tp)
+{
+  *tp = kz_gettime();
+}
+
+/* 2つの時刻の差（カウント数） */
+static uint32 bench_elapsed(bench_time_t *start, bench_time_t *end)
+{
+  return *end - *start;
+}
+
+static void result_init(void)
+{
+  result.min = 0xffffffff;
+  result.max = 0;
+  result.total = 0;
+  result.errors = 0;
+}
+
+static void result_add(uint32 elapsed)
+{
+  if (elapsed < result.min)
+    result.min = elapsed;
+  if (elapsed > result.max)
+    result.max = elapsed;
+  result.total += elapsed;
+}
+
+static void result_print(char *name)
+{
+  result.report(result.arg, name, result.min, result.max,
+                result.total >> result.shift, result.errors);
+}
+
+/* ping-pong の相手スレッド（受信したメッセージをそのまま返す） */
+static int bench_pong_main(int argc, char *argv[])
+{
+  int size;
+  char *p;
+
+  while (1) {
+    kz_recv(ping_box, &size, &p);
+    if (!pong_running)
+      break;
+    kz_send(pong_box, size, p);
+  }
+
+  return 0;
+}
+
+/* drv の何もしないデバイス（その場でデータのサイズを結果として返す） */
+static int bench_drv_start(drv_dev_t *dev, drv_req_t *req)
+{
+  return req->size;
+}
+
+static const drv_ops_t bench_drv_ops = { bench_drv_start };
+
+/* drv のドライバのスレッド */
+static int bench_drv_main(int argc, char *argv[])
+{
+  drv_dev_t dev;
+
+  drv_init(&dev, &bench_drv_ops, drv_box, NULL);
+  drv_loop(drv_box, &dev, 1);
+  return 0;
+}
+
+#ifdef KZ_IRQDRV
+/* irq の相手スレッド（割り込みで起こされた時刻を記録する） */
+static int bench_irq_main(int argc, char *argv[])
+{
+  if (irqdrv_attach(IRQDRV_BENCH_IRQ, IRQDRV_SENSE_EDGE) < 0)
+    return -1;
+  while (1) {
+    irqdrv_wait(IRQDRV_BENCH_IRQ, 0);
+    bench_now(&irq_time);
+    if (!irq_running)
+      break;
+  }
+  irqdrv_detach(IRQDRV_BENCH_IRQ);
+  return 0;
+}
+#endif
+
+/* kz_wait() の相手スレッド（同じ優先度で実行権を譲り合う） */
+static int bench_yield_main(int argc, char *argv[])
+{
+  while (yield_running)
+    kz_wait();
+  return 0;
+}
+
+/*
+ * spawn で起動するスレッド
+ * 引数はコピーされているので、元の文字列が書き換えられていても
+ * 起動時の内容のまま。正しければ0で終了する。
+ */
+static int bench_spawn_main(int argc, char *argv[])
+{
+  if ((argc != 2) || strcmp(argv[0], "spawn") || strcmp(argv[1], "42")
+      || argv[2])
+    return 1;
+  return 0;
+}
+
+/*
+ * shbuf の相手スレッド
+ * トークンを受信して共有バッファを受け取り、先頭の値を1増やして
+ * 送信元に渡し返す。
+ */
+static int bench_shbuf_main(int argc, char *argv[])
+{
+  kz_thread_id_t from;
+  kz_buf_t buf;
+  int size;
+  char *p;
+
+  while (1) {
+    from = kz_recv(ping_box, &buf, NULL);
+    if (!pong_running)
+      break;
+    p = kz_buf_take(buf, &size);
+    if (p)
+      p[0]++;
+    kz_buf_give(buf, from);
+    kz_send(pong_box, buf, NULL);
+  }
+
+  return 0;
+}
+
+/* task のハンドラ（イベントの順番を調べて、呼ばれた時刻を記録する） */
+static void bench_task_func(kz_task_t *task, int size, char *p)
+{
+  bench_now(&task_time);
+  if ((size != task_seq) || (p != task->arg))
+    result.errors++;
+  task_seq++;
+}
+
+/* システムコールのトラップの往復（何もしないシステムコール） */
+static void bench_trap(void)
+{
+  bench_time_t t0, t1;
+  int i;
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    kz_chpri(-1); /* 優先度を変更せずに返る */
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+  }
+  result_print("trap round trip   ");
+}
+
+/* kz_send() → kz_recv() の往復 */
+static void bench_pingpong(void)
+{
+  bench_time_t t0, t1;
+  int i, size;
+  char *p;
+  kz_thread_id_t id;
+
+  ping_box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  pong_box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  if (((int)ping_box < 0) || ((int)pong_box < 0))
+    goto out;
+  pong_running = 1;
+  id = kz_run(bench_pong_main, "bpong", BENCH_PRIORITY - 1, 0x100, 0, NULL);
+  if ((int)id < 0)
+    goto out;
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    kz_send(ping_box, 0, NULL);
+    kz_recv(pong_box, &size, &p);
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+  }
+  result_print("send/recv pingpong");
+
+  /* 相手スレッドを終了させる */
+  pong_running = 0;
+  kz_send(ping_box, 0, NULL);
+  kz_join(id, NULL);
+out:
+  if ((int)ping_box >= 0)
+    kz_mbox_delete(ping_box);
+  if ((int)pong_box >= 0)
+    kz_mbox_delete(pong_box);
+}
+
+/*
+ * drv_call() の往復（ドライバの共通部分を経由して、その場で完了する要求）
+ * 結果が要求したサイズと一致するか、drv_submit() の完了の通知と、
+ * 不正なデバイスの番号のエラーも調べる。
+ */
+static void bench_drv(void)
+{
+  bench_time_t t0, t1;
+  kz_thread_id_t id;
+  drv_req_t req;
+  int i, ret, size;
+  char *p;
+
+  drv_box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  pong_box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  if (((int)drv_box < 0) || ((int)pong_box < 0))
+    goto out;
+  id = kz_run(bench_drv_main, "bdrv", BENCH_PRIORITY - 1, 0x100, 0, NULL);
+  if ((int)id < 0)
+    goto out;
+
+  result_init();
+  req.index = 0;
+  req.command = 0;
+  req.data = NULL;
+  for (i = 0; i < result.loops; i++) {
+    req.size = i;
+    bench_now(&t0);
+    ret = drv_call(drv_box, &req);
+    bench_now(&t1);
+    if ((ret != i) || (req.result != i))
+      result.errors++;
+    result_add(bench_elapsed(&t0, &t1));
+  }
+
+  req.size = 3;
+  if ((drv_submit(drv_box, &req, pong_box) < 0)
+      || (kz_recv(pong_box, &size, &p) == (kz_thread_id_t)KZ_ERR_EMPTY)
+      || (p != (char *)&req) || (size != 3))
+    result.errors++;
+  req.index = 1;
+  if (drv_call(drv_box, &req) != DRV_ERR_PARAM)
+    result.errors++;
+  result_print("drv call          ");
+
+  kz_send(drv_box, 0, NULL);
+  kz_join(id, NULL);
+out:
+  if ((int)drv_box >= 0)
+    kz_mbox_delete(drv_box);
+  if ((int)pong_box >= 0)
+    kz_mbox_delete(pong_box);
+}
+
+/* kz_kmalloc() / kz_kmfree() の組 */
+static void bench_kmalloc(void)
+{
+  bench_time_t t0, t1;
+  int i;
+  char *p;
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    p = kz_kmalloc(16);
+    kz_kmfree(p);
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+  }
+  result_print("kmalloc/kmfree    ");
+}
+
+/* 16ビットの xorshift 疑似乱数（乗除算を使わない） */
+static uint16 bench_rand(void)
+{
+  rand_state ^= rand_state << 7;
+  rand_state ^= rand_state >> 9;
+  rand_state ^= rand_state << 8;
+  return rand_state;
+}
+
+/* bench_kmrandom() で獲得したブロック */
+struct kmrandom_slot {
+  unsigned char *p;
+  int size;
+  unsigned char fill; /* ブロックを埋めた値 */
+};
+
+/* ブロックが獲得時に埋めた値のままかを調べる（壊れていれば1） */
+static int kmrandom_broken(struct kmrandom_slot *sp)
+{
+  int j;
+
+  for (j = 0; j < sp->size; j++) {
+    if (sp->p[j] != sp->fill)
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * ランダムなサイズ・順序での kz_kmalloc() / kz_kmfree()
+ * 獲得したブロックは番号で埋めてその値を覚えておき、解放の前と最後に
+ * 残っているブロックが壊れていないかを調べる。
+ * 1回の獲得または解放の時間を測定する。
+ */
+static void bench_kmrandom(void)
+{
+  struct kmrandom_slot slots[BENCH_KMRANDOM_SLOTS];
+  bench_time_t t0, t1;
+  int i, n, size;
+  uint16 r;
+
+  for (n = 0; n < BENCH_KMRANDOM_SLOTS; n++)
+    slots[n].p = NULL;
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    r = bench_rand();
+    n = r & (BENCH_KMRANDOM_SLOTS - 1);
+    if (slots[n].p == NULL) {
+      size = ((r >> 8) & (BENCH_KMRANDOM_SIZE - 1)) + 1;
+      bench_now(&t0);
+      slots[n].p = kz_kmalloc(size);
+      bench_now(&t1);
+      if (slots[n].p == NULL) /* プールが空いていなければ次の機会に */
+        continue;
+      slots[n].size = size;
+      slots[n].fill = n + i;
+      memset(slots[n].p, slots[n].fill, size);
+    } else {
+      if (kmrandom_broken(&slots[n]))
+        result.errors++;
+      bench_now(&t0);
+      kz_kmfree(slots[n].p);
+      bench_now(&t1);
+      slots[n].p = NULL;
+    }
+    result_add(bench_elapsed(&t0, &t1));
+  }
+
+  for (n = 0; n < BENCH_KMRANDOM_SLOTS; n++) {
+    if (slots[n].p) {
+      if (kmrandom_broken(&slots[n]))
+        result.errors++;
+      kz_kmfree(slots[n].p);
+    }
+  }
+  result_print("kmalloc random    ");
+}
+
+/*
+ * 自分のメッセージボックスへの BENCH_STORM_NUM 個の連続送信と、その受信
+ * サイズに通し番号を入れて、送信した順に、送信元が自分で受信できるかを調べる。
+ * 1組の送受信の時間を測定する。
+ */
+static void bench_storm(void)
+{
+  bench_time_t t0, t1;
+  kz_msgbox_id_t box;
+  kz_thread_id_t self, id;
+  int i, j, size, errors;
+  char *p;
+
+  box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  if ((int)box < 0)
+    return;
+  self = kz_getid();
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    errors = 0;
+    bench_now(&t0);
+    for (j = 0; j < BENCH_STORM_NUM; j++)
+      kz_send(box, j, NULL);
+    for (j = 0; j < BENCH_STORM_NUM; j++) {
+      id = kz_recv(box, &size, &p);
+      if ((id != self) || (size != j))
+        errors++;
+    }
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+    result.errors += errors;
+  }
+  result_print("send/recv storm   ");
+
+  kz_mbox_delete(box);
+}
+
+/*
+ * チェックサム・CRC(cksum.c)の BENCH_CKSUM_SIZE バイトの計算
+ * 最初に "123456789" の既知の値と、2つに分けて計算した結果が一度に
+ * 計算したものと一致するかを調べる。
+ */
+static void bench_cksum(void)
+{
+  unsigned char buf[BENCH_CKSUM_SIZE];
+  bench_time_t t0, t1;
+  uint16 sum;
+  int i, errors = 0;
+
+  for (i = 0; i < BENCH_CKSUM_SIZE; i++)
+    buf[i] = bench_rand();
+
+  if (cksum_crc16(0, "123456789", 9) != 0x31c3)
+    errors++;
+  if ((cksum_crc32(CKSUM_CRC32_INIT, "123456789", 9) ^ CKSUM_CRC32_XOR)
+      != 0xcbf43926)
+    errors++;
+  if (cksum_crc16(cksum_crc16(0, buf, 10), buf + 10, BENCH_CKSUM_SIZE - 10)
+      != cksum_crc16(0, buf, BENCH_CKSUM_SIZE))
+    errors++;
+  if (cksum_crc32(cksum_crc32(CKSUM_CRC32_INIT, buf, 7), buf + 7,
+                  BENCH_CKSUM_SIZE - 7)
+      != cksum_crc32(CKSUM_CRC32_INIT, buf, BENCH_CKSUM_SIZE))
+    errors++;
+  if (cksum_sum8(cksum_sum8(0, buf, 5), buf + 5, BENCH_CKSUM_SIZE - 5)
+      != cksum_sum8(0, buf, BENCH_CKSUM_SIZE))
+    errors++;
+  /* 末尾の2バイトにチェックサムを入れると、全体の検査が0になる */
+  buf[BENCH_CKSUM_SIZE - 2] = buf[BENCH_CKSUM_SIZE - 1] = 0;
+  sum = cksum_inet_fold(cksum_inet(0, buf, BENCH_CKSUM_SIZE));
+  buf[BENCH_CKSUM_SIZE - 2] = sum >> 8;
+  buf[BENCH_CKSUM_SIZE - 1] = sum & 0xff;
+  if (cksum_inet_fold(cksum_inet(cksum_inet(0, buf, 6), buf + 6,
+                                 BENCH_CKSUM_SIZE - 6)))
+    errors++;
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    cksum_crc16(0, buf, BENCH_CKSUM_SIZE);
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+  }
+  result.errors = errors;
+  result_print("cksum crc16 64B   ");
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    cksum_crc32(CKSUM_CRC32_INIT, buf, BENCH_CKSUM_SIZE);
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+  }
+  result_print("cksum crc32 64B   ");
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    cksum_inet(0, buf, BENCH_CKSUM_SIZE);
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+  }
+  result_print("cksum inet 64B    ");
+}
+
+/* kz_wait() による実行権の譲渡（同じ優先度のスレッドとの往復） */
+static void bench_yield(void)
+{
+  bench_time_t t0, t1;
+  kz_thread_id_t id;
+  int i;
+
+  yield_running = 1;
+  id = kz_run(bench_yield_main, "byield", BENCH_PRIORITY, 0x100, 0, NULL);
+  if ((int)id < 0)
+    return;
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    kz_wait();
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+  }
+  result_print("wait yield        ");
+
+  yield_running = 0;
+  kz_join(id, NULL); /* 相手スレッドを終了させる */
+}
+
+/*
+ * 引数をコピーするスレッドの起動(KZ_THREAD_ATTR_ARGCOPY の kz_run())
+ * 相手スレッドは同じ優先度なので、kz_join() するまで動かない。
+ * 引数はスタック上に置き、kz_run() から戻ったらすぐに書き換える。
+ */
+static void bench_spawn(void)
+{
+  bench_time_t t0, t1;
+  kz_thread_id_t id;
+  char arg0[8], arg1[4], *argv[3];
+  int i, status;
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    strcpy(arg0, "spawn");
+    strcpy(arg1, "42");
+    argv[0] = arg0;
+    argv[1] = arg1;
+    argv[2] = NULL;
+    bench_now(&t0);
+    id = kz_run(bench_spawn_main, "bspawn",
+                BENCH_PRIORITY | KZ_THREAD_ATTR_ARGCOPY, 0x100, 2, argv);
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+    arg0[0] = arg1[0] = '\0';
+    argv[0] = argv[1] = NULL;
+    if (((int)id < 0) || (kz_join(id, &status) < 0) || status)
+      result.errors++;
+  }
+  result_print("run with argcopy  ");
+}
+
+/*
+ * 共有バッファ(shbuf.h)の所有権の往復
+ * トークンだけを送り、相手スレッドが受け取って渡し返すまでの時間を測る。
+ * 渡した後は自分でも参照・受け取りができないこと、戻ってきた領域が
+ * 同じ（コピーされていない）で、相手の書き込みが見えることも調べる。
+ */
+static void bench_shbuf(void)
+{
+  bench_time_t t0, t1;
+  kz_thread_id_t id;
+  kz_buf_t buf, rbuf;
+  int i, size;
+  char *p, *q;
+
+  ping_box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  pong_box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  buf = kz_buf_create("bench", 64);
+  if (((int)ping_box < 0) || ((int)pong_box < 0) || (buf < 0))
+    goto out;
+  p = kz_buf_ptr(buf, &size);
+  if (!p || (size != 64) || (kz_buf_find("bench") != buf)
+      || (kz_buf_create("bench", 64) != KZ_ERR_STATE))
+    result.errors++;
+  pong_running = 1;
+  id = kz_run(bench_shbuf_main, "bshbuf", BENCH_PRIORITY - 1, 0x100, 0, NULL);
+  if ((int)id < 0)
+    goto out;
+
+  result_init();
+  p[0] = 0;
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    kz_buf_give(buf, id);
+    kz_send(ping_box, buf, NULL);
+    kz_recv(pong_box, &rbuf, NULL);
+    q = kz_buf_take(rbuf, NULL);
+    bench_now(&t1);
+    result_add(bench_elapsed(&t0, &t1));
+    if ((rbuf != buf) || (q != p) || (p[0] != (char)(i + 1)))
+      result.errors++;
+  }
+
+  /* 渡した後は、所有者でも宛先でもないので参照も受け取りもできない */
+  kz_buf_give(buf, id);
+  if (kz_buf_ptr(buf, NULL) || kz_buf_take(buf, NULL)
+      || (kz_buf_delete(buf) != KZ_ERR_STATE))
+    result.errors++;
+  kz_send(ping_box, buf, NULL);
+  kz_recv(pong_box, &rbuf, NULL);
+  if (!kz_buf_take(buf, NULL))
+    result.errors++;
+  result_print("shbuf give/take   ");
+
+  /* 相手スレッドを終了させる */
+  pong_running = 0;
+  kz_send(ping_box, 0, NULL);
+  kz_join(id, NULL);
+out:
+  if (buf >= 0) {
+    kz_buf_delete(buf);
+    if (kz_buf_ptr(buf, NULL) || (kz_buf_find("bench") >= 0))
+      result.errors++;
+  }
+  if ((int)ping_box >= 0)
+    kz_mbox_delete(ping_box);
+  if ((int)pong_box >= 0)
+    kz_mbox_delete(pong_box);
+}
+
+/*
+ * ランツーコンプリーションのタスク(task.h)へのイベントの送信から実行まで
+ * 優先度の高いレベルのタスクに送り、送信の直後に実行されるまでの時間を測る。
+ * 続けて同じレベルの2つのタスクにまとめて送り、ディスパッチスレッドが
+ * 1回の起床で送った順に全てを実行するかも調べる。
+ */
+static void bench_task(void)
+{
+  static kz_task_t tasks[2];
+  bench_time_t t0;
+  int level, i;
+
+  level = kz_task_level_start(BENCH_PRIORITY - 1, 0x100);
+  if (level < 0)
+    return;
+  kz_task_init(&tasks[0], level, bench_task_func, &tasks[0]);
+  kz_task_init(&tasks[1], level, bench_task_func, &tasks[1]);
+
+  result_init();
+  task_seq = 0;
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    kz_task_post(&tasks[0], i, (char *)&tasks[0]);
+    result_add(bench_elapsed(&t0, &task_time));
+  }
+
+  /* 優先度を上げて、まとめて送ってから実行させる */
+  kz_chpri(BENCH_PRIORITY - 2);
+  for (i = 0; i < 4; i++)
+    kz_task_post(&tasks[i & 1], result.loops + i, (char *)&tasks[i & 1]);
+  kz_chpri(BENCH_PRIORITY);
+  if ((task_seq != result.loops + 4) || (tasks[0].runs != result.loops + 2)
+      || (tasks[1].runs != 2))
+    result.errors++;
+  result_print("task post to run  ");
+
+  kz_task_level_stop(level);
+}
+
+/*
+ * 割り込みからスレッドの起床まで
+ * タイマのカウンタはコンペアマッチ（割り込み発生）で0にクリアされるので、
+ * kz_sleep() から戻った直後のカウンタ値がそのまま割り込みから起床までの時間になる。
+ * （シリアル受信割り込みからの起床も、ハンドラ→サービスコール→スケジューリング→
+ *  ディスパッチという同じ経路をたどる。受信には外部からの入力が必要なので、
+ *  タイマ割り込みで代用する）
+ */
+static void bench_wakeup(void)
+{
+  int i;
+
+  result_init();
+  for (i = 0; i < result.loops; i++) {
+    kz_sleep(1);
+    result_add(timer_get_count(TIMER_DEFAULT_DEVICE));
+  }
+  result_print("intr to wakeup    ");
+}
+
+#ifdef KZ_IRQDRV
+/*
+ * 外部端子割り込みからスレッドの起床まで
+ * 端子に立ち下がりエッジを出力してから、優先度の高い相手スレッドが
+ * irqdrv_wait() から戻るまで（irqdrv_trigger() を参照）。
+ * 割り込みの回数が出力した回数と一致するかも調べる。
+ */
+static void bench_irq(void)
+{
+  bench_time_t t0;
+  kz_thread_id_t id;
+  uint32 count;
+  int i;
+
+  irq_running = 1;
+  id = kz_run(bench_irq_main, "birq", BENCH_PRIORITY - 1, 0x100, 0, NULL);
+  if ((int)id < 0)
+    return;
+
+  result_init();
+  count = irqdrv_count(IRQDRV_BENCH_IRQ);
+  for (i = 0; i < result.loops; i++) {
+    bench_now(&t0);
+    irqdrv_trigger(IRQDRV_BENCH_IRQ);
+    result_add(bench_elapsed(&t0, &irq_time));
+  }
+  if (irqdrv_count(IRQDRV_BENCH_IRQ) - count != result.loops)
+    result.errors++;
+  result_print("irq to wakeup     ");
+
+  irq_running = 0;
+  irqdrv_trigger(IRQDRV_BENCH_IRQ);
+  kz_join(id, NULL);
+}
+#endif
+
+static const struct {
+  char *name;
+  void (*func)(void);
+} benches[] = {
+  { "trap",     bench_trap },
+  { "pingpong", bench_pingpong },
+  { "drv",      bench_drv },
+  { "kmalloc",  bench_kmalloc },
+  { "kmrandom", bench_kmrandom },
+  { "storm",    bench_storm },
+  { "cksum",    bench_cksum },
+  { "yield",    bench_yield },
+  { "task",     bench_task },
+  { "spawn",    bench_spawn },
+  { "shbuf",    bench_shbuf },
+  { "wakeup",   bench_wakeup },
+#ifdef KZ_IRQDRV
+  { "irq",      bench_irq },
+#endif
+};
+
+#define BENCH_NUM ((int)(sizeof(benches) / sizeof(*benches)))
+
+/* index 番目のベンチマークの名前（なければNULL） */
+char *bench_name(int index)
+{
+  if ((unsigned int)index >= BENCH_NUM)
+    return NULL;
+  return benches[index].name;
+}
+
+/*
+ * ベンチマークの実行
+ * name が NULL ならば全てを実行する。loops は繰り返し回数で、2のべき乗に
+ * 切り下げる（0ならば既定の回数）。測定結果ごとに report を呼ぶ。
+ * 同時に実行できるのは1つのスレッドのみ。
+ * 見つけた誤りの合計を返す（名前のベンチマークがなければ KZ_ERR_PARAM）。
+ */
+int bench_run(char *name, int loops, bench_report_t report, void *arg)
+{
+  int i, old, found = 0, errors = 0;
+
+  result.shift = BENCH_LOOP_SHIFT;
+  if (loops > 0) {
+    for (result.shift = 0; (result.shift < BENCH_LOOP_SHIFT_MAX)
+           && ((2 << result.shift) <= loops); result.shift++)
+      ;
+  }
+  result.loops = 1 << result.shift;
+  result.report = report;
+  result.arg = arg;
+
+  old = kz_chpri(BENCH_PRIORITY);
+  for (i = 0; i < BENCH_NUM; i++) {
+    if (name && strcmp(name, benches[i].name))
+      continue;
+    benches[i].func();
+    errors += result.errors;
+    found = 1;
+  }
+  kz_chpri(old);
+
+  return found ? errors : KZ_ERR_PARAM;
+}
+
+static void bench_print(void *arg, char *name,
+                        uint32 min, uint32 max, uint32 avg, int errors)
+{
+  puts(name);
+  puts(": min ");
+  putxval(min, 0);
+  puts(" max ");
+  putxval(max, 0);
+  puts(" avg ");
+  putxval(avg, 0);
+  if (errors) {
+    puts(" errors ");
+    putxval(errors, 0);
+  }
+  puts("\n");
+}
+
+static int bench_all(void)
+{
+  int errors;
+
+  puts("benchmark started. (1 count = 8 cycles)\n");
+
+  errors = bench_run(NULL, 0, bench_print, NULL);
+
+  puts(errors ? "benchmark failed.\n" : "benchmark done.\n");
+#ifdef KZ_HOST
+  host_exit(errors ? 1 : 0); /* make check の結果にする */
+#endif
+
+  return 0;
+}
+
+/* ベンチマークスレッド（入口は常駐させて、オーバーレイを読み込んでから呼ぶ） */
+KZ_RESIDENT int bench_main(int argc, char *argv[])
+{
+  return KZ_OVERLAY_CALL(OVERLAY_ID_BENCH, bench_all());
+}
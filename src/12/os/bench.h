@@ -0,0 +1,13 @@
+#ifndef _BENCH_H_INCLUDED_
+#define _BENCH_H_INCLUDED_
+
+#include "defines.h"
+
+/* 測定結果の通知（時間はタイマのカウント数、errors は内容の検査での誤りの数） */
+typedef void (*bench_report_t)(void *arg, char *name,
+                               uint32 min, uint32 max, uint32 avg, int errors);
+
+int bench_run(char *name, int loops, bench_report_t report, void *arg);
+char *bench_name(int index);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _KOZOS_BOOTINFO_H_INCLUDED_
+#define _KOZOS_BOOTINFO_H_INCLUDED_
+
+/*
+ * 起動の情報（ブートローダがフラッシュROMのスロットからOSを起動したときの記録）
+ * ld.scr の bootinfo 領域(0xffff00～, 16バイト。スタックの底より上)に置く。
+ * クラッシュダンプと同じく、リセット後も残っている。
+ * ブートローダは起動時に state を KZ_BOOTINFO_TRIAL にし、OSは一定時間
+ * 動作できたら KZ_BOOTINFO_CONFIRMED にする(KZ_BOOT_CONFIRM_TICKS)。
+ * TRIAL のままクラッシュダンプが記録されるかWDTでリセットされると、
+ * ブートローダはそのスロットを無効にして、もう一方のスロットから起動する。
+ * bootload/bootinfo.h と同じ内容にすること。
+ */
+#define KZ_BOOTINFO_MAGIC 0x4b5a4249 /* "KZBI" */
+
+#define KZ_BOOTINFO_TRIAL     1 /* 起動した直後（OSがまだ確認していない） */
+#define KZ_BOOTINFO_CONFIRMED 2 /* OSが起動できたことを確認した */
+
+typedef struct {
+  uint32 magic;
+  uint8 slot;   /* 起動したスロット(0: A, 1: B) */
+  uint8 state;
+  uint16 dummy;
+} kz_bootinfo_t;
+
+#endif
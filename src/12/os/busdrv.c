@@ -0,0 +1,261 @@
+#include "defines.h"
+#include "kozos.h"
+#include "drv.h"
+#include "busdrv.h"
+
+/*
+ * I2C/SPIのバスドライバ（ポートBの端子をソフトウェアで操作する, make BUSDRV=1）
+ * 要求の受け付けと完了の通知は drv.c で行う。
+ *
+ * クロックはマスタ（このドライバ）が出すので、転送の途中で待たされても
+ * クロックの周期が延びるだけで、転送は壊れない。そこで転送はドライバの
+ * スレッド(優先度 BUSDRV_PRIORITY)で1ビットずつ進め、クロックの半周期は
+ * kz_gettime() の経過で計る。アプリケーションより低い優先度にしておけば、
+ * 転送はCPUの空き時間だけを使い、要求したスレッドは完了までスリープする
+ * （各アプリケーションが待ちループでCPUを占有しなくなる）。
+ * ITU1,2 の割り込みのベクタはブートローダにないので、タイマ割り込みでの
+ * クロックの生成は行わない。
+ *
+ * I2Cのオープンドレインは、DRを0にしたままDDRで模擬する（出力にすると
+ * Low、入力にすると外部のプルアップでHigh）。
+ */
+
+#define H8_3069F_PBDDR ((volatile uint8 *)0xfee00a)
+#define H8_3069F_PBDR  ((volatile uint8 *)0xffffda)
+
+#define I2C_SCL  (1 << BUSDRV_I2C_SCL)
+#define I2C_SDA  (1 << BUSDRV_I2C_SDA)
+#define SPI_SCK  (1 << BUSDRV_SPI_SCK)
+#define SPI_MOSI (1 << BUSDRV_SPI_MOSI)
+#define SPI_MISO (1 << BUSDRV_SPI_MISO)
+#define SPI_CS(n) (1 << (BUSDRV_SPI_CS + (n)))
+#define SPI_CS_ALL (((1 << BUSDRV_SPI_CS_NUM) - 1) << BUSDRV_SPI_CS)
+
+/*
+ * PBDDRは書き込み専用で、PBDRは入力の端子を読むと端子の状態になるので、
+ * どちらも設定値を覚えておいて全体を書き込む（ドライバのスレッドだけが使う）
+ */
+static uint8 pbddr;
+static uint8 pbdr;
+
+static drv_dev_t busdevs[BUSDRV_NUM];
+
+/* クロックの半周期などの待ち（タイマのカウント数） */
+static void bus_delay(uint16 counts)
+{
+  uint32 start;
+
+  if (!counts)
+    return;
+  start = kz_gettime();
+  while (kz_gettime() - start < counts)
+    ;
+}
+
+static void port_out(uint8 mask, int high)
+{
+  if (high)
+    pbdr |= mask;
+  else
+    pbdr &= ~mask;
+  *H8_3069F_PBDR = pbdr;
+}
+
+static int port_in(uint8 mask)
+{
+  return (*H8_3069F_PBDR & mask) ? 1 : 0;
+}
+
+/* I2Cの線を Low にするか、離して High にする */
+static void i2c_line(uint8 mask, int high)
+{
+  if (high)
+    pbddr &= ~mask;
+  else
+    pbddr |= mask;
+  *H8_3069F_PBDDR = pbddr;
+}
+
+/* SCLを離す（スレーブがLowに保っている間は、BUSDRV_I2C_STRETCH まで待つ） */
+static void i2c_scl_high(void)
+{
+  uint32 start;
+
+  i2c_line(I2C_SCL, 1);
+  start = kz_gettime();
+  while (!port_in(I2C_SCL) && (kz_gettime() - start < BUSDRV_I2C_STRETCH))
+    ;
+}
+
+/* スタートコンディション（転送の途中ならばリピーテッドスタート） */
+static void i2c_start(void)
+{
+  i2c_line(I2C_SDA, 1);
+  bus_delay(BUSDRV_I2C_HALF);
+  i2c_scl_high();
+  bus_delay(BUSDRV_I2C_HALF);
+  i2c_line(I2C_SDA, 0);
+  bus_delay(BUSDRV_I2C_HALF);
+  i2c_line(I2C_SCL, 0);
+}
+
+/* ストップコンディション */
+static void i2c_stop(void)
+{
+  i2c_line(I2C_SDA, 0);
+  bus_delay(BUSDRV_I2C_HALF);
+  i2c_scl_high();
+  bus_delay(BUSDRV_I2C_HALF);
+  i2c_line(I2C_SDA, 1);
+  bus_delay(BUSDRV_I2C_HALF);
+}
+
+/* 1ビットの送受信（SCLがLowの状態で呼び、Lowにして戻る） */
+static int i2c_bit(int bit)
+{
+  i2c_line(I2C_SDA, bit);
+  bus_delay(BUSDRV_I2C_HALF);
+  i2c_scl_high();
+  bus_delay(BUSDRV_I2C_HALF);
+  bit = port_in(I2C_SDA);
+  i2c_line(I2C_SCL, 0);
+  return bit;
+}
+
+/* 1バイトの送信（ACKが返れば0以上） */
+static int i2c_write(uint8 c)
+{
+  int i;
+
+  for (i = 0; i < 8; i++, c <<= 1)
+    i2c_bit(c & 0x80);
+  return i2c_bit(1) ? BUSDRV_ERR_NACK : 0;
+}
+
+/* 1バイトの受信（ack が0ならば最後のバイトとしてNACKを返す） */
+static uint8 i2c_read(int ack)
+{
+  uint8 c = 0;
+  int i;
+
+  for (i = 0; i < 8; i++)
+    c = (c << 1) | i2c_bit(1);
+  i2c_bit(!ack);
+  return c;
+}
+
+/*
+ * I2Cの転送
+ * 書き込みも読み出しもなければ、アドレスだけを送ってスレーブの有無を調べる
+ */
+static int i2c_start_req(drv_dev_t *dev, drv_req_t *req)
+{
+  busdrv_req_t *breq = (busdrv_req_t *)req;
+  int i, n = 0, ret = 0;
+
+  if (breq->addr > 0x7f)
+    return BUSDRV_ERR_PARAM;
+
+  if (req->size || !breq->rsize) {
+    i2c_start();
+    ret = i2c_write(breq->addr << 1);
+    for (i = 0; (ret == 0) && (i < req->size); i++) {
+      ret = i2c_write(req->data[i]);
+      if (ret == 0)
+        n++;
+    }
+  }
+  if ((ret == 0) && breq->rsize) {
+    i2c_start();
+    ret = i2c_write((breq->addr << 1) | 1);
+    for (i = 0; (ret == 0) && (i < breq->rsize); i++) {
+      breq->rdata[i] = i2c_read(i < breq->rsize - 1);
+      n++;
+    }
+  }
+  i2c_stop();
+
+  return (ret < 0) ? ret : n;
+}
+
+/*
+ * SPIの1バイトの送受信
+ * CPHA=0 では前縁で、CPHA=1 では後縁でMISOを読む（MOSIはその半周期前に出す）
+ */
+static uint8 spi_byte(uint8 out, int mode)
+{
+  int cpol = (mode >> 1) & 1;
+  uint8 in = 0;
+  int i;
+
+  for (i = 0; i < 8; i++, out <<= 1) {
+    if (mode & 1)
+      port_out(SPI_SCK, !cpol);
+    port_out(SPI_MOSI, out & 0x80);
+    bus_delay(BUSDRV_SPI_HALF);
+    port_out(SPI_SCK, (mode & 1) ? cpol : !cpol);
+    in = (in << 1) | port_in(SPI_MISO);
+    bus_delay(BUSDRV_SPI_HALF);
+    if (!(mode & 1))
+      port_out(SPI_SCK, cpol);
+  }
+  return in;
+}
+
+/* SPIの転送 */
+static int spi_start_req(drv_dev_t *dev, drv_req_t *req)
+{
+  busdrv_req_t *breq = (busdrv_req_t *)req;
+  int i;
+
+  if ((breq->addr >= BUSDRV_SPI_CS_NUM) || (breq->mode > 3))
+    return BUSDRV_ERR_PARAM;
+
+  port_out(SPI_SCK, breq->mode & 2);
+  port_out(SPI_CS(breq->addr), 0);
+  for (i = 0; i < req->size; i++)
+    spi_byte(req->data[i], breq->mode);
+  for (i = 0; i < breq->rsize; i++)
+    breq->rdata[i] = spi_byte(0xff, breq->mode);
+  port_out(SPI_CS(breq->addr), 1);
+
+  return req->size + breq->rsize;
+}
+
+/* 要求の開始（ドライバのスレッドから呼ばれ、その場で転送を終える） */
+static int busdrv_start(drv_dev_t *dev, drv_req_t *req)
+{
+  busdrv_req_t *breq = (busdrv_req_t *)req;
+
+  if (req->command != BUSDRV_CMD_XFER)
+    return BUSDRV_ERR_PARAM;
+  if ((req->size < 0) || (breq->rsize < 0) ||
+      (req->size && !req->data) || (breq->rsize && !breq->rdata))
+    return BUSDRV_ERR_PARAM;
+
+  if (dev == &busdevs[BUSDRV_I2C])
+    return i2c_start_req(dev, req);
+  return spi_start_req(dev, req);
+}
+
+static const drv_ops_t busdrv_ops = {
+  busdrv_start,
+};
+
+int busdrv_main(int argc, char *argv[])
+{
+  int i;
+
+  /* I2Cは両方とも離し、SPIはCSをHigh、SCK・MOSIを出力にする */
+  pbdr = SPI_CS_ALL;
+  *H8_3069F_PBDR = pbdr;
+  pbddr = SPI_SCK | SPI_MOSI | SPI_CS_ALL;
+  *H8_3069F_PBDDR = pbddr;
+
+  for (i = 0; i < BUSDRV_NUM; i++)
+    drv_init(&busdevs[i], &busdrv_ops, MSGBOX_ID_BUS, NULL);
+
+  drv_loop(MSGBOX_ID_BUS, busdevs, BUSDRV_NUM);
+
+  return 0;
+}
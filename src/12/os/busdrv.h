@@ -0,0 +1,43 @@
+#ifndef _BUSDRV_H_INCLUDED_
+#define _BUSDRV_H_INCLUDED_
+
+#include "defines.h"
+#include "drv.h"
+
+/* デバイスの番号(req.index) */
+#define BUSDRV_I2C 0
+#define BUSDRV_SPI 1
+#define BUSDRV_NUM 2
+
+#define BUSDRV_CMD_XFER 'x' /* 書き込みと読み出しを1つの転送として行う */
+
+/*
+ * I2C/SPIのバスドライバへの要求（drv_call()/drv_submit() で MSGBOX_ID_BUS に送る）
+ * 非同期のドライバの共通部分(drv.h)の要求に、読み出しの領域を加えたもの。
+ *
+ * ・req.data から req.size バイトを書き込んだ後、rdata に rsize バイトを
+ *   読み出す（どちらも0バイトでよい）
+ * ・I2C: addr は7ビットのスレーブアドレス。書き込み・読み出しの間は
+ *   リピーテッドスタートでつなぎ、最後にストップコンディションを出す
+ * ・SPI: addr はチップセレクトの番号(0～BUSDRV_SPI_CS_NUM-1)、mode は
+ *   クロックのモード(0～3, CPOL=bit1, CPHA=bit0)。転送中はCSをLowにし続け、
+ *   読み出しの間は 0xff を送る。MSBから送受信する
+ * ・結果(req.result)は転送したバイト数。I2CでACKが返らなければ
+ *   BUSDRV_ERR_NACK（そこで転送をやめてストップコンディションを出す）
+ *
+ * 要求はデバイスごとに待ち行列につながれ、まとめて送った複数の転送は
+ * 順に行われる。要求したスレッドは完了までスリープする。
+ */
+typedef struct {
+  drv_req_t req;
+  char *rdata;    /* 読み出したデータを書き込む領域 */
+  int rsize;      /* 読み出すバイト数 */
+  uint8 addr;     /* I2C: スレーブアドレス, SPI: チップセレクトの番号 */
+  uint8 mode;     /* SPI: クロックのモード */
+  uint16 dummy;
+} busdrv_req_t;
+
+#define BUSDRV_ERR_PARAM (-2) /* 要求の種類やアドレスの指定が不正 */
+#define BUSDRV_ERR_NACK  (-3) /* I2CのスレーブがACKを返さなかった */
+
+#endif
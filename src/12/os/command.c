@@ -1,55 +1,1451 @@
 #include "defines.h"
 #include "kozos.h"
+#include "intr.h"
 #include "consdrv.h"
+#include "serial.h"
 #include "lib.h"
+#include "overlay.h"
+#include "bench.h"
+#include "timer.h"
+#include "trace.h"
+#include "prof.h"
+#ifdef KZ_SYMTAB
+#include "symtab.h"
+#endif
+
+/*
+ * コンソールへの出力のバッファ
+ * 出力する文字列はここに貯めておき、改行時かバッファが一杯になったときに
+ * まとめてコンソールドライバに依頼する（メッセージの数を減らす）。
+ */
+#define WRITE_BUFFER_SIZE 32
+
+/*
+ * 複数行の表示（ps など）をまとめて出力するためのバッファのサイズ
+ * send_hold() で外部DRAMから獲得し、表示の終わりに1回の依頼で出力する。
+ */
+#define HOLD_BUFFER_SIZE 1024
+
+/* top コマンドの測定期間（ティック数）と、測定できるスレッドの数 */
+#define TOP_INTERVAL 100
+#define TOP_THREAD_NUM 16
+
+/* プロファイラのサンプル数（外部DRAMから獲得する）と、既定のサンプリング間隔 */
+#define PROF_NUM 1024
+#define PROF_INTERVAL 1
+#define PROF_TOP_NUM 10 /* prof top で表示する関数の数 */
+
+/* send_printf() で1回に作成できる文字数（終端を含む） */
+#define PRINTF_BUFFER_SIZE 80
+
+/* コマンド行を区切る引数の最大数（コマンド名を含む） */
+#define COMMAND_ARGV_NUM 8
+
+/*
+ * run コマンドのスクリプトの受信（rawモード）
+ * 最大のバイト数と、受信側に渡すバイト数・途切れたときに渡すまでの
+ * ティック数（CONSDRV_CMD_MODE）、中止するまでの受信の途切れのティック数
+ */
+#define RUN_SCRIPT_SIZE   0x4000
+#define RUN_RAW_THRESHOLD 16
+#define RUN_RAW_TIMEOUT   2
+#define RUN_TIMEOUT       1000
+
+/*
+ * serbench コマンドのシリアルの性能測定(KZ_SERBENCH, tools/kzserbench.c)
+ * 試験データは SERBENCH_LINE バイトの行の繰り返しで、行の中の位置 i の
+ * バイトは '0' + i（行の最後は改行）。行モードの1行に収まる長さにする。
+ * 受信が SERBENCH_TIMEOUT ティック途切れたら終了する。
+ */
+#define SERBENCH_LINE          16
+#define SERBENCH_TIMEOUT       100
+#define SERBENCH_RAW_THRESHOLD 16 /* rawモードで受信側に渡すバイト数の既定値 */
+#define SERBENCH_RAW_TIMEOUT   2
+#define SERBENCH_TX_CHUNK      256 /* 送信で1回に依頼するバイト数 */
+
+/*
+ * コマンドスレッドが利用するコンソール
+ * コンソールごとにコマンドスレッドを起動するので、スレッドのスタック上に置く
+ */
+struct command_cons {
+  int index;              /* コンソールの番号 */
+  kz_msgbox_id_t input;   /* 入力を受け取るメッセージボックス */
+  int serial;             /* シリアルの番号 */
+  char *write_ptr;        /* 出力先のバッファ（通常は write_buf） */
+  int write_size;
+  int write_len;
+  int write_hold;         /* 改行で出力しない（send_hold() の間） */
+  int hold_depth;         /* send_hold() の入れ子の数（外側でまとめて出力する） */
+  int running;            /* run コマンドでスクリプトを実行中 */
+  char write_buf[WRITE_BUFFER_SIZE];
+};
+
+/* コンソールドライバへの要求のヘッダを作成する */
+static void req_init(struct command_cons *cc, consdrv_req_t *req, int command,
+                     int flags, int size, char *data)
+{
+  req->index = cc->index;
+  req->command = command;
+  req->flags = flags;
+  req->dummy = 0;
+  req->size = size;
+  req->data = data;
+  req->flag = 0;
+  req->pattern = 0;
+}
 
 /* コンソールドライバの使用開始をコンソールドライバに依頼する */
-static void send_use(int index)
+static void send_use(struct command_cons *cc, int serial)
+{
+  consdrv_req_t *req;
+  req = kz_kmalloc(sizeof(*req) + 2);
+  if (req == NULL)
+    return;
+  req_init(cc, req, CONSDRV_CMD_USE, 0, 2, NULL);
+  ((char *)(req + 1))[0] = serial;
+  ((char *)(req + 1))[1] = cc->input;
+  if (kz_send(MSGBOX_ID_CONSOUTPUT, sizeof(*req) + 2, (char *)req) < 0)
+    kz_kmfree(req);
+}
+
+/*
+ * 受信のモードの切り替えをコンソールドライバに依頼する（切り替わるまで待つ）
+ * threshold, timeout はrawモードで受信側に渡すバイト数とティック数
+ */
+static void send_mode(struct command_cons *cc, int mode, int threshold,
+                      int timeout)
+{
+  consdrv_req_t req;
+  char data[3];
+
+  data[0] = mode;
+  data[1] = threshold;
+  data[2] = timeout;
+  req_init(cc, &req, CONSDRV_CMD_MODE, CONSDRV_REQ_FLAG_CALL,
+           sizeof(data), data);
+  kz_call(MSGBOX_ID_CONSOUTPUT, sizeof(req), (char *)&req, NULL);
+}
+
+/*
+ * 受信した行のバッファをコンソールドライバに返却する
+ * (バッファはドライバのものなので kz_kmfree() してはいけない。
+ *  返却の要求にはバッファ自体を使う)
+ */
+static void send_release(struct command_cons *cc, char *p)
+{
+  req_init(cc, (consdrv_req_t *)p, CONSDRV_CMD_RELEASE, 0, 0, NULL);
+  kz_send(MSGBOX_ID_CONSOUTPUT, sizeof(consdrv_req_t), p);
+}
+
+/*
+ * バッファに貯めた文字列の出力をコンソールドライバに依頼する
+ * バッファを直接参照させ、送信バッファに書き込まれるまで kz_call() で待つ
+ * (要求のヘッダもスタック上に置くので、メモリの獲得とコピーが不要)
+ */
+static void send_flush(struct command_cons *cc)
+{
+  consdrv_req_t req;
+
+  if (!cc->write_len)
+    return;
+  req_init(cc, &req, CONSDRV_CMD_WRITE, CONSDRV_REQ_FLAG_CALL,
+           cc->write_len, cc->write_ptr);
+  kz_call(MSGBOX_ID_CONSOUTPUT, sizeof(req), (char *)&req, NULL);
+  cc->write_len = 0;
+}
+
+/*
+ * コンソールへの文字列出力（改行かバッファが一杯になるまで貯めておく）
+ * send_hold() の間は改行では出力せず、send_unhold() でまとめて出力する
+ */
+static void send_write(struct command_cons *cc, char *str)
+{
+  for (; *str; str++) {
+    cc->write_ptr[cc->write_len++] = *str;
+    if (((*str == '\n') && !cc->write_hold)
+        || (cc->write_len == cc->write_size))
+      send_flush(cc);
+  }
+}
+
+/*
+ * 複数行の出力の開始
+ * 大きなバッファに切り替えて、出力の依頼（kz_call()）を1回にまとめる。
+ * バッファを獲得できなければ、通常通り行ごとに出力する。
+ * 入れ子にした場合（run コマンドから実行したコマンド）は、一番外側の
+ * send_unhold() まで貯める。
+ */
+static void send_hold(struct command_cons *cc)
+{
+  char *buf;
+
+  if (cc->hold_depth++)
+    return;
+  buf = kz_dmalloc(HOLD_BUFFER_SIZE);
+  if (buf == NULL)
+    return;
+  send_flush(cc);
+  cc->write_ptr = buf;
+  cc->write_size = HOLD_BUFFER_SIZE;
+  cc->write_hold = 1;
+}
+
+/* 複数行の出力の終了（貯めた出力をまとめて依頼し、バッファを戻す） */
+static void send_unhold(struct command_cons *cc)
+{
+  if (--cc->hold_depth)
+    return;
+  send_flush(cc);
+  if (cc->write_ptr != cc->write_buf)
+    kz_dmfree(cc->write_ptr);
+  cc->write_ptr = cc->write_buf;
+  cc->write_size = WRITE_BUFFER_SIZE;
+  cc->write_hold = 0;
+}
+
+/*
+ * 数値を16進数でコンソールに出力する
+ * column が0でなければ、その桁数になるまで先頭を空白で埋める
+ */
+static void send_xval(struct command_cons *cc, unsigned long value, int column)
+{
+  char buf[FORMAT_HEX_SIZE];
+  char *p = format_hex(buf, value, 1);
+
+  while ((buf + sizeof(buf) - 1 - p < column) && (p > buf))
+    *(--p) = ' ';
+  send_write(cc, p);
+}
+
+/* 文字列を column 文字の幅で出力する（足りない分は空白で埋める） */
+static void send_field(struct command_cons *cc, char *str, int column)
+{
+  send_write(cc, str);
+  for (column -= strlen(str); column > 0; column--)
+    send_write(cc, " ");
+}
+
+/*
+ * 書式付きの出力（snprintf() の書式, format.c を参照）
+ * 1行をまとめて作ってからバッファに貯めるので、値ごとの出力の呼び出しが不要。
+ * uint32 の値は %lx で、(unsigned long) にキャストして渡すこと。
+ */
+static void send_printf(struct command_cons *cc, char *fmt, ...)
+{
+  char buf[PRINTF_BUFFER_SIZE];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  send_write(cc, buf);
+}
+
+/* スレッドの一覧の1行を出力する（ps, top） */
+static void send_thread(struct command_cons *cc, kz_thread_id_t id,
+                        kz_threadstat_t *statp, uint32 runticks)
+{
+  send_printf(cc, "%5lx %-16s%3x%c %s%9lx%9lx%9lx%6x/%x\n",
+              (unsigned long)id, statp->name, statp->priority,
+              (statp->attr & KZ_THREAD_ATTR_KERNEL) ? 'k' :
+              (statp->attr & KZ_THREAD_ATTR_DRAM)   ? 'd' : ' ',
+              (statp->state == KZ_THREAD_STATE_RUN)   ? "run  " :
+              (statp->state == KZ_THREAD_STATE_READY) ? "ready" :
+              (statp->state == KZ_THREAD_STATE_SLEEP) ? "sleep" :
+              (statp->state == KZ_THREAD_STATE_SUSPEND) ? "susp " :
+              (statp->state == KZ_THREAD_STATE_THROTTLED) ? "thrtl" : "wait ",
+              (unsigned long)runticks, (unsigned long)statp->voluntary,
+              (unsigned long)statp->involuntary,
+              statp->stackused, statp->stacksize);
+}
+
+/* 見出しは send_thread() と同じ幅で出力し、数値の列と右端を揃える */
+static void send_thread_header(struct command_cons *cc, char *ticks)
+{
+  send_printf(cc, "%5s %-16s%3s  %-5s%9s%9s%9s  %s\n", "id", "name", "pri",
+              "state", ticks, "vol", "invol", "stack");
+}
+
+/*
+ * ps コマンド: スレッドの一覧（数値は16進数）
+ * pri の後の k はカーネルスレッド(KZ_THREAD_ATTR_KERNEL)、d はスタックが
+ * 外部DRAMにあるスレッド(KZ_THREAD_ATTR_DRAM)、ticks は起動からの
+ * 実行ティック数、vol/invol は自発的/横取りによる切り替えの回数、
+ * stack はスタックの使用量の最大値/サイズ
+ */
+static void command_ps(struct command_cons *cc, int argc, char *argv[])
+{
+  kz_threadstat_t stat;
+  kz_thread_id_t id;
+
+  send_hold(cc);
+  send_thread_header(cc, "ticks");
+  for (id = kz_thread_next(0); id; id = kz_thread_next(id)) {
+    if (kz_getstat(id, &stat) < 0)
+      continue; /* 終了済み */
+    send_thread(cc, id, &stat, stat.runticks);
+  }
+  send_unhold(cc);
+}
+
+/*
+ * stack コマンド: スレッドごとのスタックの推奨サイズ（数値は16進数）
+ * used はスタックの使用量の最大値、size は現在のサイズで、recommend は
+ * used に STACKSIZE_MARGIN（割り込み時に保存されるレジスタの分など）を加えて
+ * 16バイト単位に切り上げたもの。出力を保存して make stacksize WATERMARK=<ファイル>
+ * に渡すと、stacksize.h の推奨値を作り直す（十分に動かした後で実行すること）。
+ */
+static void command_stack(struct command_cons *cc, int argc, char *argv[])
+{
+  kz_threadstat_t stat;
+  kz_thread_id_t id;
+
+  send_hold(cc);
+  send_write(cc, "name              used  size recommend\n");
+  for (id = kz_thread_next(0); id; id = kz_thread_next(id)) {
+    if (kz_getstat(id, &stat) < 0)
+      continue; /* 終了済み */
+    send_printf(cc, "%-16s%6x%6x%6x\n", stat.name, stat.stackused,
+                stat.stacksize, (stat.stackused + STACKSIZE_MARGIN + 15) & ~15);
+  }
+  send_unhold(cc);
+}
+
+/*
+ * mem コマンド: メモリプールごとの使用状況と、スタック領域・外部DRAMの使用量
+ * (数値は16進数。free はプールの空きブロック数、peak は使用中の最大値、
+ *  fails は獲得に失敗した回数)
+ */
+static void command_mem(struct command_cons *cc, int argc, char *argv[])
+{
+  kz_memstat_t mstat;
+  kz_regionstat_t rstat;
+  int i;
+
+  send_hold(cc);
+  send_write(cc, " size  num free peak fails\n");
+  for (i = 0; kz_memstat(i, &mstat) == 0; i++) {
+    send_printf(cc, "%5x%5x%5x%5x%6x\n", mstat.size, mstat.num,
+                mstat.num - mstat.used, mstat.peak, mstat.fails);
+  }
+  kz_regionstat(&rstat);
+  send_printf(cc, "stack: used %lx/%lx (freed %lx)\n",
+              (unsigned long)rstat.stack_used, (unsigned long)rstat.stack_size,
+              (unsigned long)rstat.stack_free);
+  send_printf(cc, "dram: used %lx/%lx (largest free %lx)\n",
+              (unsigned long)(rstat.dram_size - rstat.dram_free),
+              (unsigned long)rstat.dram_size,
+              (unsigned long)rstat.dram_largest);
+  send_unhold(cc);
+}
+
+/*
+ * stat コマンド: カーネル全体の性能カウンタ（起動時からの通算）
+ * 割り込みとシステムコールは、回数が0でないものをベクタ・種類の番号つきで表示する
+ * (数値は16進数。システムコールの番号は syscall.h の enum の並び順)
+ */
+static void command_stat(struct command_cons *cc, int argc, char *argv[])
+{
+  kz_perfstat_t *statp;
+  uint32 *syscalls;
+  int i, n, num = 0;
+
+  statp = kz_dmalloc(sizeof(*statp) + sizeof(uint32) * KZ_SYSCALL_TYPE_NUM);
+  if (statp == NULL) {
+    send_write(cc, "no memory.\n");
+    return;
+  }
+  syscalls = (uint32 *)(statp + 1);
+  n = kz_perfstat(statp, syscalls, KZ_SYSCALL_TYPE_NUM);
+
+  send_hold(cc);
+  send_printf(cc, "ticks %lx dispatches %lx\n",
+              (unsigned long)statp->ticks, (unsigned long)statp->dispatches);
+  send_printf(cc, "syscalls %lx srvcalls %lx\n",
+              (unsigned long)statp->syscalls, (unsigned long)statp->srvcalls);
+  send_printf(cc, "sends %lx recvs %lx allocfails %lx\nintr:",
+              (unsigned long)statp->sends, (unsigned long)statp->recvs,
+              (unsigned long)statp->allocfails);
+  for (i = 0; i < KZ_PERFSTAT_INTR_NUM; i++) {
+    if (!statp->intrs[i])
+      continue;
+    send_xval(cc, i, 3);
+    send_write(cc, "=");
+    send_xval(cc, statp->intrs[i], 0);
+  }
+  send_write(cc, "\nsyscall:");
+  for (i = 0; i < n; i++) {
+    if (!syscalls[i])
+      continue;
+    if (num && !(num % 6))
+      send_write(cc, "\n        ");
+    send_xval(cc, i, 3);
+    send_write(cc, "=");
+    send_xval(cc, syscalls[i], 0);
+    num++;
+  }
+  send_write(cc, "\n");
+  send_unhold(cc);
+
+  kz_dmfree(statp);
+}
+
+/*
+ * top コマンド: TOP_INTERVAL ティックの間の実行ティック数の多い順にスレッドを表示する
+ * 先頭にCPU負荷（1000分率）を表示する
+ */
+static void command_top(struct command_cons *cc, int argc, char *argv[])
+{
+  struct {
+    kz_thread_id_t id;
+    uint32 runticks;
+  } *samples;
+  kz_threadstat_t stat;
+  kz_thread_id_t id;
+  int i, best, num = 0, load;
+
+  samples = kz_dmalloc(sizeof(*samples) * TOP_THREAD_NUM);
+  if (samples == NULL) {
+    send_write(cc, "no memory.\n");
+    return;
+  }
+
+  for (id = kz_thread_next(0); id && (num < TOP_THREAD_NUM);
+       id = kz_thread_next(id)) {
+    if (kz_getstat(id, &stat) < 0)
+      continue;
+    samples[num].id = id;
+    samples[num].runticks = stat.runticks;
+    num++;
+  }
+  kz_sleep(TOP_INTERVAL);
+  /* 測定期間の実行ティック数に置き換える（終了したスレッドは除く） */
+  for (i = 0; i < num; i++) {
+    if (kz_getstat(samples[i].id, &stat) < 0)
+      samples[i].id = 0;
+    else
+      samples[i].runticks = stat.runticks - samples[i].runticks;
+  }
+
+  send_hold(cc);
+  send_write(cc, "load: ");
+  load = kz_getload(0);
+  send_xval(cc, (load < 0) ? 0 : load, 0);
+  send_write(cc, " (1/1000) interval: ");
+  send_xval(cc, TOP_INTERVAL, 0);
+  send_write(cc, "\n");
+  send_thread_header(cc, "delta");
+  while (1) {
+    /* 残っている中で最も多いものを表示して外す */
+    best = -1;
+    for (i = 0; i < num; i++) {
+      if (samples[i].id && ((best < 0)
+                            || (samples[i].runticks > samples[best].runticks)))
+        best = i;
+    }
+    if (best < 0)
+      break;
+    i = best;
+    if (kz_getstat(samples[i].id, &stat) == 0)
+      send_thread(cc, samples[i].id, &stat, samples[i].runticks);
+    samples[i].id = 0;
+  }
+  send_unhold(cc);
+
+  kz_dmfree(samples);
+}
+
+/* echo コマンド: 引数を空白で区切って表示する */
+static void command_echo(struct command_cons *cc, int argc, char *argv[])
+{
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    send_write(cc, " ");
+    send_write(cc, argv[i]);
+  }
+  send_write(cc, "\n");
+}
+
+/* sererr コマンド: シリアルの受信エラーの回数(16進数) */
+static void command_sererr(struct command_cons *cc, int argc, char *argv[])
+{
+  serial_errstat_t errstat;
+
+  serial_get_errstat(cc->serial, &errstat);
+  send_write(cc, "overrun: ");
+  send_xval(cc, errstat.overrun, 0);
+  send_write(cc, " framing: ");
+  send_xval(cc, errstat.framing, 0);
+  send_write(cc, " parity: ");
+  send_xval(cc, errstat.parity, 0);
+  send_write(cc, "\n");
+}
+
+/* intrstack コマンド: 割り込みスタックの使用量の最大値とサイズ(16進数) */
+static void command_intrstack(struct command_cons *cc, int argc, char *argv[])
+{
+  send_write(cc, "used: ");
+  send_xval(cc, kz_intrstack_used(), 0);
+  send_write(cc, " size: ");
+  send_xval(cc, INTRSTACK_SIZE, 0);
+  send_write(cc, "\n");
+}
+
+/* 10進数の文字列を数値に変換する（数字以外があれば負の値を返す） */
+static int command_atoi(char *str)
+{
+  int value = 0;
+
+  if (!*str)
+    return -1;
+  for (; *str; str++) {
+    if ((*str < '0') || (*str > '9'))
+      return -1;
+    value = value * 10 + (*str - '0');
+  }
+  return value;
+}
+
+#ifdef KZ_SYMTAB
+/* 16進数の文字列を数値に変換する（16進数の数字以外があれば負の値を返す） */
+static long command_xtoi(char *str)
+{
+  long value = 0;
+  int c;
+
+  if (!*str)
+    return -1;
+  for (; *str; str++) {
+    c = *str;
+    if ((c >= '0') && (c <= '9'))
+      c -= '0';
+    else if ((c >= 'a') && (c <= 'f'))
+      c -= 'a' - 10;
+    else if ((c >= 'A') && (c <= 'F'))
+      c -= 'A' - 10;
+    else
+      return -1;
+    if (value > 0x7ffffff)
+      return -1;
+    value = (value << 4) | c;
+  }
+  return value;
+}
+#endif
+
+static void bench_report(void *arg, char *name,
+                         uint32 min, uint32 max, uint32 avg, int errors)
+{
+  struct command_cons *cc = arg;
+
+  send_printf(cc, "%s: min %lx max %lx avg %lx", name,
+              (unsigned long)min, (unsigned long)max, (unsigned long)avg);
+  if (errors)
+    send_printf(cc, " errors %x", errors);
+  send_write(cc, "\n");
+}
+
+/*
+ * bench コマンド: マイクロベンチマーク（bench [名前|all] [回数]）
+ * 結果はタイマのカウント数(16進数)。回数は2のべき乗に切り下げられる
+ */
+static void command_bench(struct command_cons *cc, int argc, char *argv[])
+{
+  char *name = NULL;
+  int i, loops = 0;
+
+  if ((argc > 1) && strcmp(argv[1], "all"))
+    name = argv[1];
+  if (argc > 2) {
+    loops = command_atoi(argv[2]);
+    if (loops <= 0) {
+      send_write(cc, "bad count.\n");
+      return;
+    }
+  }
+
+  send_write(cc, "1 count = 8 cycles\n");
+  kz_overlay_enter(OVERLAY_ID_BENCH);
+  if (bench_run(name, loops, bench_report, cc) < 0) {
+    send_write(cc, "bench:");
+    for (i = 0; bench_name(i); i++) {
+      send_write(cc, " ");
+      send_write(cc, bench_name(i));
+    }
+    send_write(cc, "\n");
+  }
+  kz_overlay_leave();
+}
+
+/* スレッド名の一覧の出力（trace dump raw, prof dump） */
+static void send_thread_names(struct command_cons *cc)
+{
+  kz_threadstat_t stat;
+  kz_thread_id_t id;
+
+  for (id = kz_thread_next(0); id; id = kz_thread_next(id)) {
+    if (kz_getstat(id, &stat) < 0)
+      continue;
+    send_write(cc, "N ");
+    send_xval(cc, (uint16)id, 0);
+    send_write(cc, " ");
+    send_write(cc, stat.name);
+    send_write(cc, "\n");
+  }
+}
+
+#ifdef KZ_TRACE
+/* スレッドの名前（トレースのスレッドIDの下位16ビットから引く） */
+static char *trace_thread_name(uint16 thread, kz_threadstat_t *statp)
+{
+  kz_thread_id_t id;
+
+  if (!thread)
+    return "-";
+  for (id = kz_thread_next(0); id; id = kz_thread_next(id)) {
+    if (((uint16)id == thread) && (kz_getstat(id, statp) == 0))
+      return statp->name;
+  }
+  return "?";
+}
+
+/*
+ * トレースの表示（trace dump）
+ * ティック.カウンタ値 スレッド名 イベント 引数 の形式で古い順に表示する
+ * 値を持つ記録(sysarg, sysret)は、時刻の代わりに値を表示する。
+ */
+static void trace_dump_text(struct command_cons *cc, kz_trace_t *tp, int num)
+{
+  static char *events[] = {
+    "?", "syscall", "srvcall", "intr", "dispatch",
+    "send", "recv", "kmalloc", "kmfree",
+    "sysarg", "sysexit", "sysret",
+  };
+  kz_threadstat_t stat;
+
+  for (; num > 0; num--, tp++) {
+    if ((tp->event == KZ_TRACE_SYSARG) || (tp->event == KZ_TRACE_SYSRET))
+      send_printf(cc, "=%8lx", (unsigned long)KZ_TRACE_VALUE(tp));
+    else
+      send_printf(cc, "%4x.%4x", tp->tick, tp->count);
+    send_printf(cc, " %-16s%-9s%x\n",
+                trace_thread_name(tp->thread, &stat),
+                (tp->event < sizeof(events) / sizeof(*events))
+                ? events[tp->event] : "?", tp->arg);
+  }
+}
+
+/*
+ * トレースの出力（trace dump raw、ホストの tools/kztrace で解析する）
+ * 端末やログに取り込めるように、16進数のテキストの枠で囲む。
+ *   #kztrace <記録数> <1ティックのカウント数> <1ティックのミリ秒数>
+ *   N <スレッドID> <スレッド名>          （動作中のスレッドの数だけ）
+ *   R <tick> <count> <thread> <event> <arg> （記録数だけ）
+ *   #end <各行の数値の合計の下位16ビット>
+ */
+static void trace_dump_raw(struct command_cons *cc, kz_trace_t *tp, int num)
 {
+  uint16 sum = 0;
+
+  send_write(cc, "#kztrace ");
+  send_xval(cc, num, 0);
+  send_write(cc, " ");
+  send_xval(cc, timer_get_period(TIMER_DEFAULT_DEVICE), 0);
+  send_write(cc, " ");
+  send_xval(cc, KZ_TICK_MSEC, 0);
+  send_write(cc, "\n");
+  send_thread_names(cc);
+  for (; num > 0; num--, tp++) {
+    send_write(cc, "R ");
+    send_xval(cc, tp->tick, 0);
+    send_write(cc, " ");
+    send_xval(cc, tp->count, 0);
+    send_write(cc, " ");
+    send_xval(cc, tp->thread, 0);
+    send_write(cc, " ");
+    send_xval(cc, tp->event, 0);
+    send_write(cc, " ");
+    send_xval(cc, tp->arg, 0);
+    send_write(cc, "\n");
+    sum += tp->tick + tp->count + tp->thread + tp->event + tp->arg;
+  }
+  send_write(cc, "#end ");
+  send_xval(cc, sum, 0);
+  send_write(cc, "\n");
+}
+#endif
+
+/*
+ * latency コマンド: 割り込みの遅延のヒストグラム（KZ_INTR_LATENCY でビルドした場合）
+ * 記録のあるベクタごとに、区間の番号=回数 を表示する（区間 n はタイマの
+ * カウント数で 2^(n-1) 以上 2^n 未満。数値は16進数）
+ */
+#ifdef KZ_INTR_LATENCY
+static void latency_bins(struct command_cons *cc, char *label, uint32 *bins)
+{
+  int i;
+
+  send_write(cc, label);
+  for (i = 0; i < KZ_LATENCY_BIN_NUM; i++) {
+    if (!bins[i])
+      continue;
+    send_xval(cc, i, 3);
+    send_write(cc, "=");
+    send_xval(cc, bins[i], 0);
+  }
+  send_write(cc, "\n");
+}
+#endif
+
+static void command_latency(struct command_cons *cc, int argc, char *argv[])
+{
+#ifdef KZ_INTR_LATENCY
+  kz_latencystat_t *statp;
+  int type, i;
+
+  statp = kz_dmalloc(sizeof(*statp));
+  if (statp == NULL) {
+    send_write(cc, "no memory.\n");
+    return;
+  }
+  send_hold(cc);
+  for (type = 0; type < KZ_PERFSTAT_INTR_NUM; type++) {
+    kz_intr_latency(type, statp);
+    for (i = 0; i < KZ_LATENCY_BIN_NUM; i++) {
+      if (statp->entry[i] || statp->wakeup[i])
+        break;
+    }
+    if (i == KZ_LATENCY_BIN_NUM)
+      continue;
+    send_write(cc, "vector ");
+    send_xval(cc, type, 0);
+    send_write(cc, "\n");
+    latency_bins(cc, " entry :", statp->entry);
+    latency_bins(cc, " wakeup:", statp->wakeup);
+  }
+  send_unhold(cc);
+  kz_dmfree(statp);
+#else
+  send_write(cc, "not supported. (build with KZ_INTR_LATENCY)\n");
+#endif
+}
+
+/*
+ * mbox コマンド: メッセージボックスごとの統計（KZ_MBOX_STAT でビルドした場合）
+ * 使われたことのあるものについて、格納数・その最大値・受信数と、送信から
+ * 受信までの待ち時間の合計(wait_sum)・最大値（タイマのカウント数）を16進数で表示する
+ */
+static void command_mbox(struct command_cons *cc, int argc, char *argv[])
+{
+#ifdef KZ_MBOX_STAT
+  kz_mboxstat_t stat;
+  int id;
+
+  send_hold(cc);
+  send_write(cc, "id count peak messages wait_sum wait_max\n");
+  for (id = 0; id < MSGBOX_NUM; id++) {
+    if ((kz_mbox_stat(id, &stat) < 0) || (!stat.peak && !stat.messages))
+      continue;
+    send_xval(cc, id, 2);
+    send_write(cc, " ");
+    send_xval(cc, stat.count, 5);
+    send_write(cc, " ");
+    send_xval(cc, stat.peak, 4);
+    send_write(cc, " ");
+    send_xval(cc, stat.messages, 8);
+    send_write(cc, " ");
+    send_xval(cc, stat.wait_total, 8);
+    send_write(cc, " ");
+    send_xval(cc, stat.wait_max, 8);
+    send_write(cc, "\n");
+  }
+  send_unhold(cc);
+#else
+  send_write(cc, "not supported. (build with KZ_MBOX_STAT)\n");
+#endif
+}
+
+/*
+ * trace コマンド: カーネルのイベントトレース（KZ_TRACE でビルドした場合）
+ *   trace start|stop|clear : 記録の再開・停止・消去
+ *   trace dump [raw]       : 記録の表示（raw はホストのツールで解析する形式）
+ *   trace sys <name> [off] : スレッドのシステムコールの記録の開始・停止(kz_strace())
+ */
+static void command_trace(struct command_cons *cc, int argc, char *argv[])
+{
+#ifdef KZ_TRACE
+  kz_threadstat_t stat;
+  kz_thread_id_t id;
+  kz_trace_t *buf;
+  int num;
+
+  if (argc < 2) {
+    send_write(cc, "trace start|stop|clear|dump [raw]|sys <name> [off]\n");
+  } else if (!strcmp(argv[1], "sys") && (argc > 2)) {
+    /* 同じ名前のスレッドが複数あれば、全てを対象にする */
+    num = 0;
+    for (id = kz_thread_next(0); id; id = kz_thread_next(id)) {
+      if ((kz_getstat(id, &stat) == 0) && !strcmp(stat.name, argv[2])
+          && (kz_strace(id, !((argc > 3) && !strcmp(argv[3], "off"))) >= 0))
+        num++;
+    }
+    if (!num)
+      send_write(cc, "no such thread.\n");
+  } else if (!strcmp(argv[1], "start")) {
+    kz_trace_enable(1);
+  } else if (!strcmp(argv[1], "stop")) {
+    kz_trace_enable(0);
+  } else if (!strcmp(argv[1], "clear")) {
+    kz_trace_clear();
+  } else if (!strcmp(argv[1], "dump")) {
+    /* 表示中の記録で上書きされないように、先に全てコピーする */
+    buf = kz_dmalloc(sizeof(*buf) * TRACE_NUM);
+    if (buf == NULL) {
+      send_write(cc, "no memory.\n");
+      return;
+    }
+    num = kz_trace_read(buf);
+    send_hold(cc);
+    if ((argc > 2) && !strcmp(argv[2], "raw"))
+      trace_dump_raw(cc, buf, num);
+    else
+      trace_dump_text(cc, buf, num);
+    send_unhold(cc);
+    kz_dmfree(buf);
+  } else {
+    send_write(cc, "unknown.\n");
+  }
+#else
+  send_write(cc, "not supported. (build with KZ_TRACE)\n");
+#endif
+}
+
+/*
+ * プロファイラのサンプルのバッファ
+ * 全てのコンソールで共通なので、最後に prof start した時点で獲得したものを
+ * 次の prof start まで残しておく
+ */
+static kz_prof_sample_t *prof_buf;
+
+/*
+ * プロファイルの出力（prof dump、ホストの tools/kzprof で集計する）
+ *   #kzprof <サンプル数> <記録できなかった数> <間隔(ティック)> <1ティックのミリ秒数>
+ *   N <スレッドID> <スレッド名>
+ *   S <PC> <スレッドID>  （サンプル数だけ）
+ *   #end <PCとスレッドIDの合計の下位16ビット>
+ */
+static void prof_dump(struct command_cons *cc, int interval)
+{
+  kz_prof_sample_t *sp;
+  uint16 sum = 0;
+  int num, lost;
+
+  num = kz_prof_count(&lost);
+  send_hold(cc);
+  send_write(cc, "#kzprof ");
+  send_xval(cc, num, 0);
+  send_write(cc, " ");
+  send_xval(cc, lost, 0);
+  send_write(cc, " ");
+  send_xval(cc, interval, 0);
+  send_write(cc, " ");
+  send_xval(cc, KZ_TICK_MSEC, 0);
+  send_write(cc, "\n");
+  send_thread_names(cc);
+  for (sp = prof_buf; num > 0; num--, sp++) {
+    send_write(cc, "S ");
+    send_xval(cc, sp->pc, 0);
+    send_write(cc, " ");
+    send_xval(cc, sp->thread, 0);
+    send_write(cc, "\n");
+    sum += sp->pc + sp->thread;
+  }
+  send_write(cc, "#end ");
+  send_xval(cc, sum, 0);
+  send_write(cc, "\n");
+  send_unhold(cc);
+}
+
+#ifdef KZ_SYMTAB
+/*
+ * 関数ごとのサンプル数の多い順に num 個を表示する（prof top）
+ * 組み込みのシンボル表で引く。割り込み処理中(PCが0)と表にないPCは
+ * (other) にまとめる。
+ */
+static void prof_top(struct command_cons *cc, int num)
+{
+  kz_prof_sample_t *sp;
+  uint16 *counts;
+  int n, i, max;
+
+  counts = kz_dmalloc(sizeof(*counts) * (kz_symtab_num + 1));
+  if (!counts) {
+    send_write(cc, "no memory.\n");
+    return;
+  }
+  memset(counts, 0, sizeof(*counts) * (kz_symtab_num + 1));
+  for (sp = prof_buf, n = kz_prof_count(NULL); n > 0; n--, sp++) {
+    i = sp->pc ? kz_symbol_index(sp->pc) : -1;
+    counts[(i < 0) ? kz_symtab_num : i]++;
+  }
+
+  send_hold(cc);
+  for (; num > 0; num--) {
+    max = 0;
+    for (i = 1; i <= kz_symtab_num; i++) {
+      if (counts[i] > counts[max])
+        max = i;
+    }
+    if (!counts[max])
+      break;
+    send_xval(cc, counts[max], 5);
+    send_write(cc, " ");
+    send_write(cc, (max < kz_symtab_num) ? kz_symbol_name(max) : "(other)");
+    send_write(cc, "\n");
+    counts[max] = 0;
+  }
+  send_unhold(cc);
+  kz_dmfree(counts);
+}
+#endif
+
+/*
+ * prof コマンド: PCサンプリングによるプロファイラ
+ *   prof start [間隔] : 間隔（ティック数, 10進数）ごとにPCを記録する
+ *   prof stop         : 記録の停止
+ *   prof dump         : 記録の出力（ホストの tools/kzprof で集計する）
+ *   prof top [個数]   : 関数ごとのサンプル数（16進数, 組み込みのシンボル表で引く）
+ */
+static void command_prof(struct command_cons *cc, int argc, char *argv[])
+{
+  static int interval = PROF_INTERVAL;
+  int i, lost;
+
+  if (argc < 2) {
+    send_write(cc, "prof start [interval]|stop|dump\n");
+  } else if (!strcmp(argv[1], "start")) {
+    i = PROF_INTERVAL;
+    if ((argc > 2) && ((i = command_atoi(argv[2])) <= 0)) {
+      send_write(cc, "bad interval.\n");
+      return;
+    }
+    if (!prof_buf)
+      prof_buf = kz_dmalloc(sizeof(*prof_buf) * PROF_NUM);
+    if (!prof_buf) {
+      send_write(cc, "no memory.\n");
+      return;
+    }
+    if (kz_prof_start(prof_buf, PROF_NUM, i) < 0)
+      send_write(cc, "already started.\n");
+    else
+      interval = i;
+  } else if (!strcmp(argv[1], "stop")) {
+    kz_prof_stop();
+    send_write(cc, "samples: ");
+    send_xval(cc, kz_prof_count(&lost), 0);
+    send_write(cc, " lost: ");
+    send_xval(cc, lost, 0);
+    send_write(cc, "\n");
+  } else if (!strcmp(argv[1], "dump")) {
+    if (prof_buf)
+      prof_dump(cc, interval);
+  } else if (!strcmp(argv[1], "top")) {
+#ifdef KZ_SYMTAB
+    i = PROF_TOP_NUM;
+    if ((argc > 2) && ((i = command_atoi(argv[2])) <= 0)) {
+      send_write(cc, "bad count.\n");
+      return;
+    }
+    if (prof_buf)
+      prof_top(cc, i);
+#else
+    send_write(cc, "not supported. (build with SYMTAB=1)\n");
+#endif
+  } else {
+    send_write(cc, "unknown.\n");
+  }
+}
+
+/*
+ * sym コマンド: アドレス（16進数）を含む関数と、先頭からのオフセット
+ * （組み込みのシンボル表で引く）
+ */
+static void command_sym(struct command_cons *cc, int argc, char *argv[])
+{
+#ifdef KZ_SYMTAB
+  uint32 offset;
+  char *name;
+  long addr;
+
+  if ((argc < 2) || ((addr = command_xtoi(argv[1])) < 0)) {
+    send_write(cc, "sym <address>\n");
+    return;
+  }
+  if ((name = kz_symbol(addr, &offset)) == NULL) {
+    send_write(cc, "not found.\n");
+    return;
+  }
+  send_write(cc, name);
+  send_write(cc, "+");
+  send_xval(cc, offset, 0);
+  send_write(cc, "\n");
+#else
+  send_write(cc, "not supported. (build with SYMTAB=1)\n");
+#endif
+}
+
+#ifdef KZ_SERBENCH
+/* 10進数の文字列を long に変換する（数字以外があれば負の値を返す） */
+static long command_atol(char *str)
+{
+  long value = 0;
+
+  if (!*str)
+    return -1;
+  for (; *str; str++) {
+    if ((*str < '0') || (*str > '9') || (value > 0x7ffffffL / 10))
+      return -1;
+    value = value * 10 + (*str - '0');
+  }
+  return value;
+}
+
+/* 試験データの検査（行の中の位置 *colp を進め、誤りの数を返す） */
+static int serbench_check(char *p, int size, int *colp)
+{
+  int i, errors = 0;
+
+  for (i = 0; i < size; i++) {
+    if (p[i] == '\n') {
+      if (*colp != SERBENCH_LINE - 1)
+        errors++;
+      *colp = 0;
+      continue;
+    }
+    if ((*colp >= SERBENCH_LINE - 1) || (p[i] != '0' + *colp))
+      errors++;
+    (*colp)++;
+  }
+  return errors;
+}
+
+/*
+ * コンソールドライバへの書き込みの依頼（send_write() のバッファを通さない）
+ * flags に CONSDRV_REQ_FLAG_BULK を加えると大量出力の送信バッファを使う
+ */
+static void serbench_write(struct command_cons *cc, char *p, int size,
+                           int flags)
+{
+  consdrv_req_t req;
+
+  req_init(cc, &req, CONSDRV_CMD_WRITE, CONSDRV_REQ_FLAG_CALL | flags,
+           size, p);
+  kz_call(MSGBOX_ID_CONSOUTPUT, sizeof(req), (char *)&req, NULL);
+}
+
+/* 受信エラーの増分の表示 */
+static void serbench_errstat(struct command_cons *cc, serial_errstat_t *start)
+{
+  serial_errstat_t end;
+
+  serial_get_errstat(cc->serial, &end);
+  send_printf(cc, " overrun %u framing %u\n",
+              (uint16)(end.overrun - start->overrun),
+              (uint16)(end.framing - start->framing));
+}
+
+/*
+ * 受信の測定（ホストからの送信を受け取って数える）
+ * rawモードでは threshold バイトごとに、行モードでは1行ごとに受け取る。
+ */
+static void serbench_rx(struct command_cons *cc, long bytes, int raw,
+                        int threshold)
+{
+  serial_errstat_t errstat;
+  uint32 start = 0, end = 0;
+  long got = 0;
+  int n, col = 0, errors = 0;
   char *p;
-  p = kz_kmalloc(3);
-  p[0] = '0';
-  p[1] = CONSDRV_CMD_USE;
-  p[2] = '0' + index;
-  kz_send(MSGBOX_ID_CONSOUTPUT, 3, p);
+
+  serial_get_errstat(cc->serial, &errstat);
+  send_write(cc, "ready.\n");
+  if (raw)
+    send_mode(cc, CONSDRV_MODE_RAW, threshold, SERBENCH_RAW_TIMEOUT);
+  while (got < bytes) {
+    if (kz_trecv(cc->input, &n, &p, SERBENCH_TIMEOUT)
+        == (kz_thread_id_t)KZ_ERR_TIMEOUT)
+      break;
+    end = kz_gettick();
+    if (!got)
+      start = end;
+    errors += serbench_check(p, n, &col);
+    got += n;
+    if (!raw) {
+      /* 行モードでは改行を除いて渡されるので、ここで数える */
+      errors += serbench_check("\n", 1, &col);
+      got++;
+    }
+    send_release(cc, p);
+  }
+  if (raw)
+    send_mode(cc, CONSDRV_MODE_LINE, 0, 0);
+  send_printf(cc, "serbench rx %s bytes %ld got %ld ticks %ld errors %d",
+              raw ? "raw" : "line", bytes, got, (long)(end - start), errors);
+  serbench_errstat(cc, &errstat);
 }
 
-/* コンソールへの文字列出力をコンソールドライバに依頼する */
-static void send_write(char *str)
+/* 送信の測定（試験データを送り続ける。行モードでは改行が CR LF になる） */
+static void serbench_tx(struct command_cons *cc, long bytes, int flags)
 {
+  uint32 start;
+  long sent;
+  int i, n;
+  char *buf;
+
+  buf = kz_dmalloc(SERBENCH_TX_CHUNK);
+  if (buf == NULL) {
+    send_write(cc, "no memory.\n");
+    return;
+  }
+  for (i = 0; i < SERBENCH_TX_CHUNK; i++)
+    buf[i] = ((i % SERBENCH_LINE) == SERBENCH_LINE - 1)
+      ? '\n' : '0' + (i % SERBENCH_LINE);
+
+  send_write(cc, "ready.\n");
+  start = kz_gettick();
+  for (sent = 0; sent < bytes; sent += n) {
+    n = (bytes - sent < SERBENCH_TX_CHUNK) ? bytes - sent : SERBENCH_TX_CHUNK;
+    serbench_write(cc, buf, n, flags);
+  }
+  kz_dmfree(buf);
+  send_printf(cc, "serbench tx %s bytes %ld ticks %ld\n",
+              flags ? "bulk" : "send", bytes, (long)(kz_gettick() - start));
+}
+
+/*
+ * 往復の測定（rawモードで受け取った文字をそのまま送り返す）
+ * threshold を1にすると、1文字ごとに送り返す。
+ */
+static void serbench_echo(struct command_cons *cc, long bytes, int threshold)
+{
+  serial_errstat_t errstat;
+  long got = 0;
+  int n;
   char *p;
-  int len;
-  len = strlen(str);
-  p = kz_kmalloc(len + 2);
-  p[0] = '0';
-  p[1] = CONSDRV_CMD_WRITE;
-  memcpy(&p[2], str, len);
-  kz_send(MSGBOX_ID_CONSOUTPUT, len + 2, p);
+
+  serial_get_errstat(cc->serial, &errstat);
+  send_write(cc, "ready.\n");
+  send_mode(cc, CONSDRV_MODE_RAW, threshold, SERBENCH_RAW_TIMEOUT);
+  while (got < bytes) {
+    if (kz_trecv(cc->input, &n, &p, SERBENCH_TIMEOUT)
+        == (kz_thread_id_t)KZ_ERR_TIMEOUT)
+      break;
+    serbench_write(cc, p, n, 0);
+    got += n;
+    send_release(cc, p);
+  }
+  send_mode(cc, CONSDRV_MODE_LINE, 0, 0);
+  send_printf(cc, "serbench echo bytes %ld got %ld", bytes, got);
+  serbench_errstat(cc, &errstat);
+}
+
+/*
+ * ボーレートの変更（表示を送り終えてから切り替える）
+ * serial_set_baud() の表にないボーレートでは変更せず、元のボーレートのまま
+ * エラーを表示する
+ */
+static void serbench_baud(struct command_cons *cc, long rate)
+{
+  consdrv_req_t req;
+
+  send_printf(cc, "serbench baud %ld\n", rate);
+  req_init(cc, &req, CONSDRV_CMD_BAUD, CONSDRV_REQ_FLAG_CALL,
+           sizeof(rate), (char *)&rate);
+  if (kz_call(MSGBOX_ID_CONSOUTPUT, sizeof(req), (char *)&req, NULL) < 0)
+    send_write(cc, "bad baud rate.\n");
+}
+#endif
+
+/*
+ * serbench コマンド: シリアルの性能測定のサービス(KZ_SERBENCH)
+ * ホストの tools/kzserbench から使う（手で実行してもよい）。
+ *   serbench conf                        バッファのサイズなどの構成
+ *   serbench rx <バイト数> [raw [<しきい値>]|line]  受信のスループット
+ *   serbench tx <バイト数> [bulk]        送信のスループット
+ *   serbench echo <バイト数> [<しきい値>]  受け取った文字を送り返す（往復時間）
+ *   serbench baud <ボーレート>           コンソールのボーレートの変更
+ * rx, tx, echo は "ready." を表示してから始め、終わると "serbench ..." の
+ * 1行で結果（ティック数・受信エラーの増分など）を表示する。
+ */
+static void command_serbench(struct command_cons *cc, int argc, char *argv[])
+{
+#ifdef KZ_SERBENCH
+  long bytes = -1;
+  int threshold;
+
+  if (argc > 2)
+    bytes = command_atol(argv[2]);
+  if ((argc >= 2) && !strcmp(argv[1], "conf")) {
+    send_printf(cc, "serbench conf send %d recv %d bulk %d dma %d line %d"
+                " tick %d\n", CONSDRV_SEND_SIZE, CONSDRV_RECV_SIZE,
+                CONSDRV_BULK_SIZE,
+#ifdef CONSDRV_DMA
+                (cc->serial == 0),
+#else
+                0,
+#endif
+                SERBENCH_LINE, KZ_TICK_MSEC);
+  } else if ((argc >= 2) && (bytes <= 0)) {
+    send_write(cc, "bad size.\n");
+  } else if ((argc >= 3) && !strcmp(argv[1], "rx")) {
+    if ((argc > 3) && !strcmp(argv[3], "line")) {
+      serbench_rx(cc, bytes, 0, 0);
+      return;
+    }
+    threshold = SERBENCH_RAW_THRESHOLD;
+    if ((argc > 4) && (((threshold = command_atoi(argv[4])) <= 0)
+                       || (threshold > CONSDRV_RECV_SIZE))) {
+      send_write(cc, "bad threshold.\n");
+      return;
+    }
+    serbench_rx(cc, bytes, 1, threshold);
+  } else if ((argc >= 3) && !strcmp(argv[1], "tx")) {
+    serbench_tx(cc, bytes, ((argc > 3) && !strcmp(argv[3], "bulk"))
+                ? CONSDRV_REQ_FLAG_BULK : 0);
+  } else if ((argc >= 3) && !strcmp(argv[1], "echo")) {
+    threshold = 1;
+    if ((argc > 3) && (((threshold = command_atoi(argv[3])) <= 0)
+                       || (threshold > CONSDRV_RECV_SIZE))) {
+      send_write(cc, "bad threshold.\n");
+      return;
+    }
+    serbench_echo(cc, bytes, threshold);
+  } else if ((argc >= 3) && !strcmp(argv[1], "baud")) {
+    serbench_baud(cc, bytes);
+  } else {
+    send_write(cc, "serbench conf|rx|tx|echo|baud ...\n");
+  }
+#else
+  send_write(cc, "not supported. (build with SERBENCH=1)\n");
+#endif
+}
+
+static void command_help(struct command_cons *cc, int argc, char *argv[]);
+static void command_run(struct command_cons *cc, int argc, char *argv[]);
+
+/*
+ * コマンドの表
+ * 二分探索で引くので、名前の順（strcmp() の順）に並べること
+ */
+static const struct command {
+  char *name;
+  void (*func)(struct command_cons *cc, int argc, char *argv[]);
+  char *help;
+} commands[] = {
+  { "bench",     command_bench,     "run microbenchmarks [name] [count]" },
+  { "echo",      command_echo,      "print arguments" },
+  { "help",      command_help,      "list commands" },
+  { "intrstack", command_intrstack, "interrupt stack usage" },
+  { "latency",   command_latency,   "interrupt latency histograms" },
+  { "mbox",      command_mbox,      "message box depth and wait times" },
+  { "mem",       command_mem,       "memory pool, stack and DRAM usage" },
+  { "prof",      command_prof,      "PC sampling profiler start|stop|dump|top" },
+  { "ps",        command_ps,        "thread list" },
+  { "run",       command_run,       "run a script sent in raw mode <size>" },
+  { "serbench",  command_serbench,  "serial throughput test service" },
+  { "sererr",    command_sererr,    "serial receive error counts" },
+  { "stack",     command_stack,     "recommended thread stack sizes" },
+  { "stat",      command_stat,      "kernel performance counters" },
+  { "sym",       command_sym,       "function containing an address <hex>" },
+  { "top",       command_top,       "threads by CPU time" },
+  { "trace",     command_trace,     "kernel event trace start|stop|clear|dump" },
+};
+
+#define COMMAND_NUM ((int)(sizeof(commands) / sizeof(*commands)))
+
+/* help コマンド: コマンドの一覧 */
+static void command_help(struct command_cons *cc, int argc, char *argv[])
+{
+  int i;
+
+  send_hold(cc);
+  for (i = 0; i < COMMAND_NUM; i++) {
+    send_field(cc, commands[i].name, 11);
+    send_write(cc, commands[i].help);
+    send_write(cc, "\n");
+  }
+  send_unhold(cc);
+}
+
+/* コマンド名からコマンドを引く（完全に一致するもののみ） */
+static const struct command *command_find(char *name)
+{
+  int lo = 0, hi = COMMAND_NUM - 1, mid, cmp;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    cmp = strcmp(name, commands[mid].name);
+    if (!cmp)
+      return &commands[mid];
+    if (cmp < 0)
+      hi = mid - 1;
+    else
+      lo = mid + 1;
+  }
+  return NULL;
+}
+
+/*
+ * コマンド行を空白で区切って argv に格納する（行のバッファを書き換える）
+ * COMMAND_ARGV_NUM を超える分は無視する
+ */
+static int command_split(char *line, char *argv[])
+{
+  int argc = 0;
+
+  while (1) {
+    while (*line == ' ')
+      *(line++) = '\0';
+    if (!*line)
+      break;
+    if (argc == COMMAND_ARGV_NUM)
+      break;
+    argv[argc++] = line;
+    while (*line && (*line != ' '))
+      line++;
+  }
+  return argc;
+}
+
+/* コマンド行を1行実行する（行のバッファを書き換える） */
+static void command_exec(struct command_cons *cc, char *line)
+{
+  const struct command *cmdp;
+  char *argv[COMMAND_ARGV_NUM];
+  int argc;
+
+  argc = command_split(line, argv);
+  if (!argc)
+    return;
+  cmdp = command_find(argv[0]);
+  if (cmdp)
+    cmdp->func(cc, argc, argv);
+  else
+    send_write(cc, "unknown.\n");
 }
 
+/*
+ * run コマンド: スクリプトの一括実行（run <バイト数(10進数)>）
+ * "ready." を表示してコンソールをrawモードにするので、続けてスクリプトを
+ * 指定したバイト数だけ一度に送ること。外部DRAMに受信してから1行ずつ
+ * 実行する（CR・LFのどちらで区切ってもよく、# で始まる行は無視する）。
+ * 行ごとの受信割り込み・メッセージ・エコーバックがなく、出力は全体を
+ * まとめて依頼するので、試験装置から多数のコマンドを流すときに速い。
+ * 受信が RUN_TIMEOUT ティック途切れたら、実行せずに中止する。
+ */
+static void command_run(struct command_cons *cc, int argc, char *argv[])
+{
+  char *script, *line, *p, *end;
+  int size, len, n;
+
+  if (cc->running) {
+    send_write(cc, "cannot nest.\n");
+    return;
+  }
+  size = (argc > 1) ? command_atoi(argv[1]) : -1;
+  if ((size <= 0) || (size > RUN_SCRIPT_SIZE)) {
+    send_write(cc, "bad size.\n");
+    return;
+  }
+  script = kz_dmalloc(size + 1);
+  if (script == NULL) {
+    send_write(cc, "no memory.\n");
+    return;
+  }
+
+  /* 表示が送り出される前に切り替わるので、表示を待って送ってよい */
+  send_write(cc, "ready.\n");
+  send_mode(cc, CONSDRV_MODE_RAW, RUN_RAW_THRESHOLD, RUN_RAW_TIMEOUT);
+  for (len = 0; len < size; len += n) {
+    if (kz_trecv(cc->input, &n, &p, RUN_TIMEOUT)
+        == (kz_thread_id_t)KZ_ERR_TIMEOUT)
+      break;
+    if (n > size - len)
+      n = size - len;
+    memcpy(script + len, p, n);
+    send_release(cc, p);
+  }
+  send_mode(cc, CONSDRV_MODE_LINE, 0, 0);
+  if (len < size) {
+    send_write(cc, "timeout.\n");
+    kz_dmfree(script);
+    return;
+  }
+
+  cc->running = 1;
+  send_hold(cc);
+  end = script + size;
+  *end = '\0';
+  for (line = script; line < end; line = p + 1) {
+    for (p = line; (p < end) && (*p != '\n') && (*p != '\r'); p++)
+      ;
+    *p = '\0';
+    if (!*line || (*line == '#'))
+      continue;
+    send_write(cc, "> ");
+    send_write(cc, line);
+    send_write(cc, "\n");
+    command_exec(cc, line);
+  }
+  send_unhold(cc);
+  cc->running = 0;
+  kz_dmfree(script);
+}
+
+/*
+ * コマンドスレッド
+ * argv[1]: コンソールの番号, argv[2]: シリアルの番号（省略時は 0 と
+ * SERIAL_DEFAULT_DEVICE）。コンソール0の入力は MSGBOX_ID_CONSINPUT で、
+ * 他のコンソールは入力用のメッセージボックスを作成して受け取る。
+ */
 int command_main(int argc, char *argv[])
 {
+  struct command_cons cc;
   char *p;
   int size;
 
-  send_use(SERIAL_DEFAULT_DEVICE);
+  cc.index = 0;
+  if (argc > 1)
+    cc.index = argv[1][0] - '0';
+  cc.serial = SERIAL_DEFAULT_DEVICE;
+  if (argc > 2)
+    cc.serial = argv[2][0] - '0';
+  cc.write_ptr = cc.write_buf;
+  cc.write_size = WRITE_BUFFER_SIZE;
+  cc.write_len = 0;
+  cc.write_hold = 0;
+  cc.hold_depth = 0;
+  cc.running = 0;
+  cc.input = MSGBOX_ID_CONSINPUT;
+  if (cc.index != 0) {
+    cc.input = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+    if ((int)cc.input < 0)
+      return -1;
+  }
+
+  send_use(&cc, cc.serial);
 
   while (1) {
     /* コンソール表示 */
-    send_write("command> ");
+    send_write(&cc, "command> ");
+    send_flush(&cc);
 
     /* コンソールからの受信文字列を受け取る */
-    kz_recv(MSGBOX_ID_CONSINPUT, &size, &p);
+    kz_recv(cc.input, &size, &p);
     p[size] = '\0';
-
-    if (!strncmp(p, "echo", 4)) {
-      send_write(p + 4);
-      send_write("\n");
-    } else {
-      send_write("unknown.\n");
-    }
-
-    kz_kmfree(p);
+    command_exec(&cc, p);
+    send_release(&cc, p);
   }
 
   return 0;
@@ -6,61 +6,299 @@
 #include "lib.h"
 #include "consdrv.h"
 
-#define CONS_BUFFER_SIZE 24
+/*
+ * コンソールごとのバッファのサイズ（consdrv.h を参照）
+ * バッファは kz_kmalloc() で獲得するので、メモリプールの最大のブロックサイズ
+ * (memconf.h)以下とすること。
+ */
+static const struct consconf {
+  int send_size; /* 送信バッファのサイズ（2のべき乗とすること） */
+  int recv_size; /* 受信バッファのサイズ（1行の最大長+1） */
+  int bulk_size; /* 大量出力の送信バッファのサイズ（2のべき乗, 0なら分けない） */
+} consconf[CONSDRV_DEVICE_NUM] = {
+  { CONSDRV_SEND_SIZE, CONSDRV_RECV_SIZE, CONSDRV_BULK_SIZE },
+  { CONSDRV_SEND_SIZE, CONSDRV_RECV_SIZE, CONSDRV_BULK_SIZE },
+  { CONSDRV_SEND_SIZE, CONSDRV_RECV_SIZE, CONSDRV_BULK_SIZE },
+};
+
+/* 行モードの受信の処理で、リングバッファから一度に取り出す文字数 */
+#define CONSDRV_INPUT_SIZE 8
+
+/* 行の削除の文字(^U) */
+#define CONSDRV_CHAR_KILL 0x15
+
+/*
+ * スレッドから割り込み処理と共有するデータを操作するときに、マスクする
+ * 割り込みの優先レベル（シリアルの割り込みの優先レベルまで。同じチャネルの
+ * 要因は同じ優先レベルになる。kz_lock_ceiling() を参照）
+ */
+#define CONSDRV_INTR_LEVEL(cons) \
+  intr_getlevel(SOFTVEC_TYPE_SERINTR((cons)->index, SERINTR_TXI))
 
-static struct consreg {
+/* 送信バッファ（リングバッファ） */
+struct conslane {
+  char *buf;
+  int head;          /* 次に送信する位置 */
+  int tail;          /* 次に書き込む位置（head と同じなら空） */
+  int mask;          /* サイズ-1 */
+};
+
+#define LANE_EMPTY(lane) ((lane)->head == (lane)->tail)
+#define LANE_USED(lane)  (((lane)->tail - (lane)->head) & (lane)->mask)
+#define LANE_SPACE(lane) (((lane)->head - (lane)->tail - 1) & (lane)->mask)
+
+struct consreg {
   kz_thread_id_t id; /* コンソールを利用するスレッド */
   int index;         /* 利用するシリアルの番号 */
+  kz_msgbox_id_t input; /* 受信した行を渡すメッセージボックス */
+
+  /*
+   * 送信バッファは対話用(send)と大量出力用(bulk, CONSDRV_REQ_FLAG_BULK)に分け、
+   * send に文字があれば常に先に送信する。ただし bulk の行を送り始めたら
+   * (bulk_line)、行が混ざらないように改行までは bulk を続ける。
+   * bulk が一杯のときは、bulk_drop ならば古い行から捨てて空ける
+   * (CONSDRV_CMD_BULK で切り替える, bulk_write())。捨てた行の数を
+   * bulk_drops に数える。
+   * bulk がなければ(CONSDRV_BULK_SIZE が0)、全て send に書き込む。
+   */
+  struct conslane send;
+  struct conslane bulk;
+  int bulk_line;
+  int bulk_skip;
+  int bulk_drop;
+  uint32 bulk_drops;
 
-  char *send_buf;    /* 送信バッファ */
-  char *recv_buf;    /* 受信バッファ */
-  int send_len;      /* 送信バッファ中のデータサイズ */
+  char *recv_buf;    /* 受信バッファ（受信中の行のバッファ） */
+  int recv_size;     /* 受信バッファのサイズ */
   int recv_len;      /* 受信バッファ中のデータサイズ */
 
-  /* ダミーメンバでサイズ調整 */
-  long dummy[3];
-} consreg[CONSDRV_DEVICE_NUM];
+  /*
+   * 受信した行のバッファ（ドライバが所有し、リングとして順に使う）
+   * 改行時に受信中の行のバッファをメッセージで渡して次のバッファに移り、
+   * 受信側は処理が終わったら CONSDRV_CMD_RELEASE で受信した順に返却する。
+   * 割り込み処理でメモリを獲得しなくてすむようにする。
+   */
+  char *recv_lines[CONSDRV_RECV_LINES];
+  int recv_cur;      /* 受信中の行のバッファの番号 */
+  int recv_busy;     /* 受信側に渡していて未返却のバッファの数 */
+
+  /*
+   * 行モードの受信（エコーバックと行の編集はスレッドで行う）
+   * 受信割り込みは受信した文字をリングバッファ(kx_ring_put())に入れて、
+   * recv_req を MSGBOX_ID_CONSOUTPUT に送ってスレッドを起こすだけにする。
+   * 送ってからスレッドが処理を始めるまでは recv_pending を立てて、重ねて
+   * 送らない。リングバッファが作成できなければ、受信した文字は捨てる。
+   */
+  kz_ring_id_t recv_ring;
+  int recv_pending;
+  consdrv_req_t recv_req;
+
+  /*
+   * 受信のモード(CONSDRV_CMD_MODE で切り替える)
+   * rawモードではエコーバックと改行の変換を行わず、受信した文字が
+   * raw_threshold バイトたまるか、最後の受信から raw_timeout ティック
+   * 受信がなければ、受信側に渡す。
+   */
+  int mode;
+  int raw_threshold;
+  int raw_timeout;   /* 0ならタイムアウトしない */
+  uint32 recv_tick;  /* 最後に受信したときのティック */
+  int recv_flush;    /* タイムアウトしたので、次の送信割り込みで渡す */
+
+  uint32 rx_last;     /* 最後に受信した時刻（受信割り込みのまとめ処理で使う） */
+  uint32 rx_gap;      /* バーストとみなす受信の間隔（ボーレートの設定時に計算する） */
+
+  /*
+   * RTS/CTSのフロー制御(CONSDRV_CMD_FLOW で有効にする)
+   * 受信バッファが残り少なくなったらRTSで相手の送信を止める。
+   * CTSで止められたら送信割り込みを止めて send_hold とし、
+   * consdrv_timeout() でCTSを調べて再開する。
+   */
+  int flow;
+  int send_hold;
+
+  /*
+   * 送信バッファに入りきらなかった書き込みの残り
+   * 送信割り込みで送信バッファに空きができるたびに追加し、
+   * 全て追加したら send_sem で書き込み元のスレッドに通知する
+   */
+  char *send_rest;
+  int send_rest_len;
+  struct conslane *send_rest_lane; /* 残りを追加する送信バッファ */
+  kz_sem_id_t send_sem;
+
+  /*
+   * 書き込みの完了通知(CONSDRV_REQ_FLAG_NOTIFY)の待ち行列
+   * 最後の文字が送信シフトレジスタから送り出されたら（send_count が count を
+   * 越えた後の送信割り込みか、送信終了割り込みで）、イベントフラグをセットする
+   */
+  uint16 send_count; /* 送信データレジスタに書き込んだ文字数 */
+#ifdef CONSDRV_DMA
+  int send_dma_len;  /* DMACで転送中の文字数（送信バッファの head から） */
+#endif
+  struct consnotify {
+    uint16 count;
+    kz_flag_id_t flag;
+    uint16 pattern;
+  } notify[CONSDRV_NOTIFY_NUM];
+  int notify_head;
+  int notify_num;
+};
+typedef KZ_TABLE_ELEMENT(struct consreg) consreg_elem;
+static consreg_elem consreg[CONSDRV_DEVICE_NUM];
+#define CONSREG(i) (&consreg[i].e)
+#define CONSREG_INDEX(cons) ((consreg_elem *)(cons) - consreg)
+
+/* シリアルのチャネルごとの利用しているコンソール（割り込みハンドラから引く） */
+static struct consreg *serial_cons[SERIAL_DEVICE_NUM];
 
 /*
- * 以下の２つの関数(send_char(), send_string())は
+ * 以下の関数(send_char(), send_fill(), send_start(), bulk_*())は
  * 割り込み処理とスレッドから呼ばれるが、
  * 送信バッファを操作していて再入不可のため、
  * スレッドから呼び出す場合は排他のため割り込み禁止状態で呼ぶこと。
  */
 
- /* 送信バッファの先頭1文字を送信する */
+ /*
+  * 送信バッファの先頭1文字を送信する
+  * CONSDRV_DMA ではDMACを使えるチャネルならば、リングの折り返しまでを
+  * まとめて転送させる。転送中の分は送信が終わるまで head を進めないので、
+  * send_fill() で上書きされることはない。
+  */
  static void send_char(struct consreg *cons)
  {
-   int i;
-   serial_send_byte(cons->index, cons->send_buf[0]);
-   cons->send_len--;
-   /* 先頭文字を送信したので1文字分ずらす */
-   for (i = 0; i < cons->send_len; i++)
-     cons->send_buf[i] = cons->send_buf[i + 1];
+#ifdef CONSDRV_DMA
+   int len;
+#endif
+   char c;
+
+   /*
+    * bulk の行の途中か、send が空ならば bulk から送る
+    * (send の書き込みをすぐに割り込ませられるように、DMACは使わずに1文字ずつ)
+    */
+   if (!LANE_EMPTY(&cons->bulk)
+       && (cons->bulk_line || LANE_EMPTY(&cons->send))) {
+     c = cons->bulk.buf[cons->bulk.head];
+     cons->bulk.head = (cons->bulk.head + 1) & cons->bulk.mask;
+     cons->bulk_line = (c != '\n');
+     serial_send_byte(cons->index, c);
+     cons->send_count++;
+     return;
+   }
+
+#ifdef CONSDRV_DMA
+   if (cons->send.head < cons->send.tail)
+     len = cons->send.tail - cons->send.head;
+   else
+     len = cons->send.mask + 1 - cons->send.head;
+   if (serial_dma_send(cons->index,
+                       (unsigned char *)cons->send.buf + cons->send.head,
+                       len) == 0) {
+     cons->send_dma_len = len;
+     return;
+   }
+#endif
+   serial_send_byte(cons->index, cons->send.buf[cons->send.head]);
+   cons->send.head = (cons->send.head + 1) & cons->send.mask;
+   cons->send_count++;
  }
 
- /* 文字列を送信バッファに書き込み送信開始する */
- static void send_string(struct consreg *cons, char *str, int len)
+ /*
+  * 文字列を送信バッファ(lane)に書き込む
+  * 送信バッファの空きの分だけ書き込み、書き込んだ文字数を返す
+  */
+ static int send_fill(struct consreg *cons, struct conslane *lane,
+                      char *str, int len)
  {
-   int i;
-   /* 文字列を送信バッファにコピー */
+   int i, space;
+
+   space = LANE_SPACE(lane);
    for (i = 0; i < len; i++) {
-     /* \n => \r\n に変換 */
-     if (str[i] == '\n')
-       cons->send_buf[cons->send_len++] = '\r';
+     /* \n => \r\n に変換（2文字分の空きがなければ、次の機会に書き込む） */
+     if ((str[i] == '\n') && (cons->mode == CONSDRV_MODE_LINE)) {
+       if (space < 2)
+         break;
+       lane->buf[lane->tail] = '\r';
+       lane->tail = (lane->tail + 1) & lane->mask;
+       space--;
+     }
+     if (space < 1)
+       break;
+     lane->buf[lane->tail] = str[i];
+     lane->tail = (lane->tail + 1) & lane->mask;
+     space--;
+   }
+   return i;
+ }
 
-     cons->send_buf[cons->send_len++] = str[i];
+ /* bulk の pos の位置から、改行の次（なければ tail）の位置を求める */
+ static int bulk_next_line(struct consreg *cons, int pos)
+ {
+   struct conslane *lane = &cons->bulk;
+
+   while (pos != lane->tail) {
+     if (lane->buf[pos] == '\n')
+       return (pos + 1) & lane->mask;
+     pos = (pos + 1) & lane->mask;
    }
+   return pos;
+ }
 
+ /* bulk の最後の行が改行で終わっていない（続きが書き込まれる） */
+ static int bulk_open(struct consreg *cons)
+ {
+   struct conslane *lane = &cons->bulk;
+
+   if (LANE_EMPTY(lane))
+     return cons->bulk_line;
+   return lane->buf[(lane->tail - 1) & lane->mask] != '\n';
+ }
+
+ /*
+  * bulk に need 文字の空きを作る（古い行から捨てる）
+  * 送信中の行(bulk_line)の残りと、続きが書き込まれる最後の行は捨てずに、
+  * その間の行を古い方から捨てて、後ろを詰める。
+  */
+ static void bulk_drop_lines(struct consreg *cons, int need)
+ {
+   struct conslane *lane = &cons->bulk;
+   int keep, drop, next, used, open;
+
+   open = bulk_open(cons);
+   keep = cons->bulk_line ? bulk_next_line(cons, lane->head) : lane->head;
+   drop = keep;
+   while (drop != lane->tail) {
+     used = ((keep - lane->head) & lane->mask)
+       + ((lane->tail - drop) & lane->mask);
+     if (lane->mask - used >= need)
+       break;
+     next = bulk_next_line(cons, drop);
+     if ((next == lane->tail) && open)
+       break;
+     drop = next;
+     cons->bulk_drops++;
+   }
+   while (drop != lane->tail) {
+     lane->buf[keep] = lane->buf[drop];
+     keep = (keep + 1) & lane->mask;
+     drop = (drop + 1) & lane->mask;
+   }
+   lane->tail = keep;
+ }
+
+ /* 送信を開始する */
+ static void send_start(struct consreg *cons)
+ {
    /*
     * 送信割り込み無効であれば、送信開始されていないので送信開始する。
-    * 送信割り込み有効であれば、送信歌詞されており、送信割り込みの延長で
+    * 送信割り込み有効であれば、送信開始されており、送信割り込みの延長で
     * 送信バッファ内のデータが順次送信されるので何もしなくていい
     */
-    if (cons->send_len && !serial_intr_is_send_enable(cons->index)) {
-      serial_intr_send_enable(cons->index);
-      send_char(cons);
-    }
+   if ((!LANE_EMPTY(&cons->send) || !LANE_EMPTY(&cons->bulk))
+       && !cons->send_hold && !serial_intr_is_send_enable(cons->index)) {
+     serial_intr_send_enable(cons->index);
+     send_char(cons);
+   }
  }
 
  /*
@@ -73,99 +311,652 @@ static struct consreg {
   *　また非コンテキスト状態でよばれるため、システムコールは利用してはいけない。
   * （サービスコールを利用すること）
   */
-static int consdrv_intrproc(struct consreg *cons)
+/* 受信中のバッファを受信側に渡したので、次のバッファに移る */
+static void recv_next(struct consreg *cons)
 {
-  unsigned char c;
-  char *p;
+  cons->recv_busy++;
+  if (++cons->recv_cur == CONSDRV_RECV_LINES)
+    cons->recv_cur = 0;
+  cons->recv_buf = cons->recv_lines[cons->recv_cur];
+  cons->recv_len = 0;
+}
 
-  /* 受信割り込みが発生している場合 */
-  if (serial_is_recv_enable(cons->index)) {
-    c = serial_recv_byte(cons->index);
-    if (c == '\r')
-      c = '\n';
+/*
+ * 受信中のバッファを受信側に渡して、次のバッファに移る（rawモード）
+ * 全てのバッファが返却されていなければ(次のバッファが空いていなければ)、
+ * 渡せないので -1 を返す。
+ */
+static int recv_deliver(struct consreg *cons)
+{
+  if ((cons->recv_busy >= CONSDRV_RECV_LINES - 1)
+      || (kx_send(cons->input, cons->recv_len, cons->recv_buf) < 0))
+    return -1;
 
-    /* エコーバック */
-    send_string(cons, &c, 1);
+  recv_next(cons);
+  return 0;
+}
 
-    if (cons->id) {
-      if (c != '\n') {
-        /* 改行でなければ受信バッファにバッファリングする */
-        cons->recv_buf[cons->recv_len++] = c;
-      } else {
-        /* Enterが押されたら、バッファの内容をコマンド処理スレッドに通知 */
-        p = kx_kmalloc(CONS_BUFFER_SIZE);
-        memcpy(p, cons->recv_buf, cons->recv_len);
-        kx_send(MSGBOX_ID_CONSINPUT, cons->recv_len, p);
-        cons->recv_len = 0;
-      }
-    }
+/*
+ * フロー制御のRTSを更新する
+ * 次に渡すバッファがないか、受信中のバッファ（行モードではリングバッファ）の
+ * 空きが CONSDRV_FLOW_MARGIN 以下ならば、相手の送信を止める
+ * （スレッドからは割り込み禁止で呼ぶこと）
+ */
+static void recv_flow(struct consreg *cons)
+{
+  int ready;
+
+  if (!cons->flow)
+    return;
+  if (cons->mode == CONSDRV_MODE_RAW)
+    ready = (cons->recv_len < cons->recv_size - CONSDRV_FLOW_MARGIN);
+  else
+    ready = (cons->recv_ring < 0)
+      || (kz_ring_space(cons->recv_ring) > CONSDRV_FLOW_MARGIN);
+  serial_rts_set(cons->index,
+                 (cons->recv_busy < CONSDRV_RECV_LINES - 1) && ready);
+}
+
+/* 受信した1文字の処理 */
+static void recv_char(struct consreg *cons, unsigned char c)
+{
+  if (cons->mode == CONSDRV_MODE_RAW) {
+    /*
+     * rawモードでは、一定量たまったら渡す
+     * (渡せなければたまったままにしておき、溢れた分は捨てる)
+     */
+    if (cons->recv_len < cons->recv_size)
+      cons->recv_buf[cons->recv_len++] = c;
+    cons->recv_tick = kz_gettick();
+    if (cons->recv_len >= cons->raw_threshold)
+      recv_deliver(cons);
+    recv_flow(cons);
+    return;
   }
 
-  /* 送信割り込みが発生している場合 */
-  if (serial_intr_is_send_enable(cons->index)) {
-    if (!cons->id || !cons->send_len) {
-      /* 送信データがないなら送信処理終了 */
-      serial_intr_send_disable(cons->index);
-    } else {
-      /* 送信データあるなら引き続き送信 */
-      send_char(cons);
-    }
+  /* 行モードでは、リングバッファに入れてスレッドに処理させる */
+  if ((cons->recv_ring >= 0) && kx_ring_put(cons->recv_ring, (char *)&c, 1)
+      && !cons->recv_pending) {
+    cons->recv_pending = 1;
+    if (kx_send(MSGBOX_ID_CONSOUTPUT, sizeof(cons->recv_req),
+                (char *)&cons->recv_req) < 0)
+      cons->recv_pending = 0;
+  }
+  recv_flow(cons);
+}
+
+/* 受信した文字を溢れさせずに受け取れる数（行モードではリングバッファの空き） */
+static int recv_room(struct consreg *cons)
+{
+  if (cons->mode == CONSDRV_MODE_RAW)
+    return cons->recv_size - cons->recv_len;
+  return (cons->recv_ring < 0) ? 1 : kz_ring_space(cons->recv_ring);
+}
+
+/*
+ * 受信割り込みの処理
+ * 前の受信からの間隔が rx_gap 未満ならばバーストの途中とみなして、処理の間に
+ * 届いていた文字も続けて処理する（文字ごとの割り込みの入口・出口とスレッドの
+ * 切り替えを省く）。届いていなければ待たずに終わる。まとめるのは
+ * CONSDRV_RX_BATCH 文字までで、受け取れる空きを超えないようにする（残りは
+ * 次の割り込みで処理する）。
+ */
+static void consdrv_intr_recv(struct consreg *cons)
+{
+  int n, max = 1;
+
+  if (kz_gettime() - cons->rx_last < cons->rx_gap) {
+    max = recv_room(cons);
+    if (max > CONSDRV_RX_BATCH)
+      max = CONSDRV_RX_BATCH;
   }
+  n = 0;
+  do {
+    recv_char(cons, serial_recv_byte(cons->index));
+  } while ((++n < max) && serial_is_recv_enable(cons->index));
+  cons->rx_last = kz_gettime();
+}
+
+/* ボーレートに合わせて、バーストとみなす受信の間隔を設定する */
+static void recv_set_gap(struct consreg *cons)
+{
+  cons->rx_gap = serial_char_time(cons->index) * CONSDRV_RX_BURST_CHARS;
+}
+
+/*
+ * 書き込みの完了を通知する
+ * 送信割り込み(TXI)は送信データレジスタの文字がシフトレジスタに移ったとき
+ * に発生するので、最後に書き込んだ文字はまだ送信中で、それより前の文字が
+ * 送り出されている。done が真(送信終了割り込み(TEI)。TENDが1)ならば、
+ * 書き込んだ文字は全て送り出されている。
+ */
+static void send_notify(struct consreg *cons, int done)
+{
+  struct consnotify *np;
+
+  while (cons->notify_num) {
+    np = &cons->notify[cons->notify_head];
+    if ((short)(cons->send_count - np->count) < (done ? 0 : 1))
+      break;
+    kx_flag_set(np->flag, np->pattern);
+    if (++cons->notify_head == CONSDRV_NOTIFY_NUM)
+      cons->notify_head = 0;
+    cons->notify_num--;
+  }
+}
+
+/* 送信割り込みの処理 */
+static void consdrv_intr_send(struct consreg *cons)
+{
+  int n;
+
+#ifdef CONSDRV_DMA
+  /*
+   * DMACの転送の終了後の送信割り込みならば、転送した分を送信済みとする
+   * (最後の文字も送信データレジスタから送り出されている)
+   */
+  if (cons->send_dma_len) {
+    cons->send.head = (cons->send.head + cons->send_dma_len) & cons->send.mask;
+    cons->send_count += cons->send_dma_len;
+    cons->send_dma_len = 0;
+  }
+#endif
+
+  send_notify(cons, 0);
+
+  /* rawモードの受信のタイムアウト(consdrv_timeout()で要求される) */
+  if (cons->recv_flush) {
+    cons->recv_flush = 0;
+    if (cons->recv_len)
+      recv_deliver(cons);
+    recv_flow(cons);
+  }
+
+  /* 書き込みの残りがあれば、空いた分を送信バッファに追加する */
+  if (cons->send_rest_len) {
+    n = send_fill(cons, cons->send_rest_lane, cons->send_rest,
+                  cons->send_rest_len);
+    cons->send_rest += n;
+    cons->send_rest_len -= n;
+    if (!cons->send_rest_len)
+      kx_sem_post(cons->send_sem);
+  }
+
+  if (LANE_EMPTY(&cons->send) && LANE_EMPTY(&cons->bulk)) {
+    /* 送信データがないなら送信処理終了 */
+    serial_intr_send_disable(cons->index);
+  } else if (cons->flow && !serial_cts_is_ready(cons->index)) {
+    /* CTSで止められているので、consdrv_timeout() で再開させる */
+    cons->send_hold = 1;
+    serial_intr_send_disable(cons->index);
+  } else {
+    /* 送信データあるなら引き続き送信 */
+    cons->send_hold = 0;
+    send_char(cons);
+    return;
+  }
+
+  /* 送信中の最後の文字の完了は、送信終了割り込みで通知する */
+  if (cons->notify_num)
+    serial_intr_send_end_enable(cons->index);
+}
 
+/* 送信終了割り込みの処理（書き込んだ文字が全て送り出された） */
+static void consdrv_intr_send_end(struct consreg *cons)
+{
+  send_notify(cons, 1);
+  /* TENDは次に書き込むまで1のままなので、割り込みを止める */
+  serial_intr_send_end_disable(cons->index);
+}
+
+/*
+ * 割り込みハンドラ
+ * シリアルのチャネル・要因ごとにソフトウェア割り込みベクタが分かれているので、
+ * 種類から直接チャネルと要因を求める（全デバイスのレジスタを調べる必要はない）
+ */
+static void consdrv_intr(int type)
+{
+  unsigned int n = type - SOFTVEC_TYPE_SERINTR(0, 0);
+  struct consreg *cons = serial_cons[n / SERINTR_NUM];
+
+  if (!cons)
+    return;
+
+  switch (n % SERINTR_NUM) {
+    case SERINTR_RXI:
+      consdrv_intr_recv(cons);
+      break;
+
+    case SERINTR_TXI:
+      consdrv_intr_send(cons);
+      break;
+
+    case SERINTR_TEI:
+      consdrv_intr_send_end(cons);
+      break;
+
+    case SERINTR_ERI:
+      serial_recv_error_clear(cons->index);
+      break;
+
+    default:
+      break;
+  }
+}
+
+/* 初期化処理 */
+static KZ_COLD int consdrv_init(void)
+{
+  memset(consreg, 0, sizeof(consreg));
+  memset(serial_cons, 0, sizeof(serial_cons));
   return 0;
 }
 
-/* 割り込みハンドラ */
-static void consdrv_intr(void)
+/*
+ * bulk に古い行を捨てて書き込む（スレッドから、割り込みをマスクして呼ぶ）
+ * 空きを作っても入りきらなければ、入りきる行までを書き込んで残りを捨てる。
+ * 行が途中で切れないように、捨てた行の続き（次の書き込みの最初の改行まで）は
+ * 捨て(bulk_skip)、書き込めなかった行の前が行の途中ならば改行で閉じる。
+ */
+static void bulk_write(struct consreg *cons, char *str, int len)
+{
+  struct conslane *lane = &cons->bulk;
+  int i, fit, size, space, crlf = (cons->mode == CONSDRV_MODE_LINE);
+
+  if (cons->bulk_skip) {
+    for (i = 0; (i < len) && (str[i] != '\n'); i++)
+      ;
+    if (i == len)
+      return;
+    cons->bulk_skip = 0;
+    str += i + 1;
+    len -= i + 1;
+  }
+  if (!len)
+    return;
+
+  /* 閉じるための改行(\r\n)の分を空けておく */
+  for (i = 0, size = 2; i < len; i++)
+    size += (crlf && (str[i] == '\n')) ? 2 : 1;
+  if (LANE_SPACE(lane) < size)
+    bulk_drop_lines(cons, size);
+
+  space = LANE_SPACE(lane) - 2;
+  for (i = 0, fit = 0, size = 0; i < len; i++) {
+    size += (crlf && (str[i] == '\n')) ? 2 : 1;
+    if (size > space)
+      break;
+    if (str[i] == '\n')
+      fit = i + 1;
+  }
+  if (i == len)
+    fit = len;
+
+  send_fill(cons, lane, str, fit);
+  if (fit < len) {
+    cons->bulk_drops++;
+    cons->bulk_skip = (str[len - 1] != '\n');
+    if (bulk_open(cons))
+      send_fill(cons, lane, "\n", 1);
+  }
+}
+
+/*
+ * 文字列を出力する（スレッドから）
+ * 送信バッファに入りきらない場合は、残りを送信割り込みで追加させて、
+ * 全て送信バッファに追加されるまで待つ（文字列の領域はそれまで参照される）。
+ * bulk ならば大量出力用の送信バッファに書き込み、bulk_drop ならば待たずに
+ * 古い行を捨てて空ける（それでも入りきらない分は捨てる）。
+ */
+static void consdrv_write(struct consreg *cons, char *str, int len, int bulk)
+{
+  struct conslane *lane = bulk ? &cons->bulk : &cons->send;
+  int n, ceiling;
+
+  /*
+   * 送信バッファは割り込み処理と共用しているので、排他のために
+   * シリアルの割り込みの優先レベルまでの割り込みをマスクして操作する。
+   */
+  ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+  if (bulk && cons->bulk_drop) {
+    bulk_write(cons, str, len);
+    send_start(cons);
+    kz_unlock_ceiling(ceiling);
+    return;
+  }
+  n = send_fill(cons, lane, str, len);
+  if ((n < len) && (cons->send_sem >= 0)) {
+    cons->send_rest = str + n;
+    cons->send_rest_len = len - n;
+    cons->send_rest_lane = lane;
+  }
+  send_start(cons);
+  kz_unlock_ceiling(ceiling);
+
+  if ((n < len) && (cons->send_sem >= 0))
+    kz_sem_wait(cons->send_sem);
+}
+
+/*
+ * 書き込みの完了通知を登録する（スレッドから、consdrv_write()の後に呼ぶ）
+ * 送信バッファ中の文字が全て送り出されたら、イベントフラグをセットさせる。
+ * send の書き込みは、送信中の bulk の行の残りの後に送られる。bulk の
+ * 書き込みは、後から send に書き込まれた分だけ早く通知されることがある。
+ * 待ち行列が一杯ならば、空くまで待つ。
+ */
+static void consdrv_notify(struct consreg *cons, kz_flag_id_t flag,
+                           uint16 pattern, int bulk)
+{
+  struct consnotify *np;
+  int i, ceiling;
+
+  while (1) {
+    ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+    /*
+     * 送信割り込みが無効で(CTSでの停止中を除き)送信終了していれば、
+     * 既に全て送り出されている
+     */
+    if (!serial_intr_is_send_enable(cons->index) && !cons->send_hold
+        && serial_is_send_done(cons->index)) {
+      kz_unlock_ceiling(ceiling);
+      kz_flag_set(flag, pattern);
+      return;
+    }
+    if (cons->notify_num < CONSDRV_NOTIFY_NUM)
+      break;
+    kz_unlock_ceiling(ceiling);
+    kz_sleep(1);
+  }
+
+  i = cons->notify_head + cons->notify_num;
+  if (i >= CONSDRV_NOTIFY_NUM)
+    i -= CONSDRV_NOTIFY_NUM;
+  np = &cons->notify[i];
+  np->count = cons->send_count + LANE_USED(&cons->send);
+  if (bulk)
+    np->count += LANE_USED(&cons->bulk);
+  else if (cons->bulk_line)
+    np->count += (bulk_next_line(cons, cons->bulk.head) - cons->bulk.head)
+      & cons->bulk.mask;
+  np->flag = flag;
+  np->pattern = pattern;
+  cons->notify_num++;
+  /* 送信割り込みが止まっていれば、送信中の文字の完了は送信終了割り込みで知る */
+  if (!serial_intr_is_send_enable(cons->index))
+    serial_intr_send_end_enable(cons->index);
+  kz_unlock_ceiling(ceiling);
+}
+
+/*
+ * rawモードの受信のタイムアウトを調べる（スレッドから）
+ * タイムアウトしていれば、受信中のバッファを割り込み処理の延長で渡させる。
+ * 送信割り込みを有効にすると、送信中でなければすぐに送信割り込みが
+ * 発生するので、それを利用する（スレッドからは kx_send() を使えないため）。
+ * フロー制御のCTSで送信が止められていれば、CTSを調べて同様に再開する。
+ * 次に調べるまでのティック数を返す（タイムアウトのあるコンソールがなければ0）。
+ */
+static int consdrv_timeout(void)
 {
-  int i;
   struct consreg *cons;
+  int i, timeout = 0, ceiling;
 
   for (i = 0; i < CONSDRV_DEVICE_NUM; i++) {
-    cons = &consreg[i];
-    if (cons->id) {
-      if (serial_intr_is_send_enable(cons->index)
-        || serial_is_recv_enable(cons->index)) {
-        /* 割り込みがあれば割り込み処理を呼び出す */
-        consdrv_intrproc(cons);
+    cons = CONSREG(i);
+    if (!cons->id)
+      continue;
+    if (cons->flow) {
+      ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+      if (cons->send_hold && serial_cts_is_ready(cons->index)) {
+        cons->send_hold = 0;
+        serial_intr_send_enable(cons->index);
       }
+      kz_unlock_ceiling(ceiling);
+      timeout = 1; /* CTSは毎ティック調べる */
+    }
+    if ((cons->mode != CONSDRV_MODE_RAW) || !cons->raw_timeout)
+      continue;
+    ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+    if (cons->recv_len
+        && (kz_gettick() - cons->recv_tick >= cons->raw_timeout)) {
+      cons->recv_flush = 1;
+      if (!serial_intr_is_send_enable(cons->index))
+        serial_intr_send_enable(cons->index);
     }
+    kz_unlock_ceiling(ceiling);
+    if (!timeout || (cons->raw_timeout < timeout))
+      timeout = cons->raw_timeout;
   }
+  return timeout;
 }
 
-/* 初期化処理 */
-static int consdrv_init(void)
+/*
+ * 行モードで受信した文字の処理（スレッドから, CONSDRV_CMD_INPUT）
+ * 受信割り込みがリングバッファに入れた文字を取り出して、エコーバックと
+ * 行の編集(BS・DELで1文字、^Uで行の全体を削除)をする。改行で受信中の行の
+ * バッファを受信側に渡して次のバッファに移る（渡せなければその行を捨てる）。
+ */
+static void consdrv_input(struct consreg *cons)
 {
-  memset(consreg, 0, sizeof(consreg));
-  return 0;
+  char buf[CONSDRV_INPUT_SIZE];
+  int i, n, ceiling;
+  char c;
+
+  while ((n = kz_ring_get(cons->recv_ring, buf, sizeof(buf))) > 0) {
+    for (i = 0; i < n; i++) {
+      c = buf[i];
+      if (c == '\r')
+        c = '\n';
+
+      if ((c == '\b') || (c == 0x7f)) {
+        if (cons->recv_len > 0) {
+          cons->recv_len--;
+          consdrv_write(cons, "\b \b", 3, 0);
+        }
+      } else if (c == CONSDRV_CHAR_KILL) {
+        for (; cons->recv_len > 0; cons->recv_len--)
+          consdrv_write(cons, "\b \b", 3, 0);
+      } else if (c != '\n') {
+        /* 受信側で終端文字を付けるので、1バイト残して溢れた分は捨てる */
+        consdrv_write(cons, &c, 1, 0);
+        if (cons->recv_len < cons->recv_size - 1)
+          cons->recv_buf[cons->recv_len++] = c;
+      } else {
+        consdrv_write(cons, &c, 1, 0);
+        if ((cons->recv_busy < CONSDRV_RECV_LINES - 1)
+            && (kz_send(cons->input, cons->recv_len, cons->recv_buf) >= 0))
+          recv_next(cons);
+        else
+          cons->recv_len = 0;
+      }
+    }
+
+    /* リングバッファが空いたので、止めていた相手の送信を再開させる */
+    ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+    recv_flow(cons);
+    kz_unlock_ceiling(ceiling);
+  }
 }
 
-/* スレッドからの要求を処理する */
+/*
+ * スレッドからの要求を処理する
+ * 要求のメッセージの領域がドライバの受信バッファならば(CONSDRV_CMD_RELEASE)、
+ * 解放してはいけないので 1 を返す。
+ * 要求の結果（kz_call() への返信のサイズ, エラーならば負の値）を *resultp に返す
+ */
 static int consdrv_command(struct consreg *cons, kz_thread_id_t id,
-                           int index, int size, char *command)
+                           consdrv_req_t *req, int *resultp)
 {
-  switch (command[0]) {
+  int i, index = CONSREG_INDEX(cons), size = req->size, ceiling;
+  long rate;
+  char c;
+  char *data = req->data ? req->data : (char *)(req + 1);
+
+  switch (req->command) {
     case CONSDRV_CMD_USE:
+      if ((size < 1) || ((uint8)data[0] >= SERIAL_DEVICE_NUM))
+        break;
       cons->id = id;
-      cons->index = command[1] - '0';
-      cons->send_buf = kz_kmalloc(CONS_BUFFER_SIZE);
-      cons->recv_buf = kz_kmalloc(CONS_BUFFER_SIZE);
-      cons->send_len = 0;
+      cons->index = data[0];
+      cons->input = (size >= 2) ? data[1] : MSGBOX_ID_CONSINPUT;
+      cons->send.mask = consconf[index].send_size - 1;
+      cons->recv_size = consconf[index].recv_size;
+      cons->send.buf = kz_kmalloc(cons->send.mask + 1);
+      cons->bulk.buf = consconf[index].bulk_size
+        ? kz_kmalloc(consconf[index].bulk_size) : NULL;
+      cons->bulk.mask = cons->bulk.buf ? consconf[index].bulk_size - 1 : 0;
+      cons->bulk.head = 0;
+      cons->bulk.tail = 0;
+      cons->bulk_line = 0;
+      cons->bulk_skip = 0;
+      cons->bulk_drop = CONSDRV_BULK_DROP;
+      cons->bulk_drops = 0;
+      for (i = 0; i < CONSDRV_RECV_LINES; i++)
+        cons->recv_lines[i] = kz_kmalloc(cons->recv_size);
+      cons->recv_cur = 0;
+      cons->recv_busy = 0;
+      cons->recv_buf = cons->recv_lines[0];
+      cons->recv_ring = kz_ring_create(kz_kmalloc(CONSDRV_RECV_RING_SIZE),
+                                       CONSDRV_RECV_RING_SIZE, 0);
+      cons->recv_pending = 0;
+      cons->recv_req.index = index;
+      cons->recv_req.command = CONSDRV_CMD_INPUT;
+      cons->recv_req.flags = 0;
+      cons->mode = CONSDRV_MODE_LINE;
+      cons->recv_flush = 0;
+      cons->flow = 0;
+      cons->send_hold = 0;
+      cons->send.head = 0;
+      cons->send.tail = 0;
+      cons->send_rest_len = 0;
+      cons->send_count = 0;
+#ifdef CONSDRV_DMA
+      cons->send_dma_len = 0;
+#endif
+      cons->notify_head = 0;
+      cons->notify_num = 0;
+      /* 作成できなければ、送信バッファに入りきらない分は捨てる */
+      cons->send_sem = kz_sem_create(0);
       cons->recv_len = 0;
       serial_init(cons->index);
+      recv_set_gap(cons);
+      serial_cons[cons->index] = cons;
+      /* 割り込みハンドラ登録 */
+      kz_setintr(SOFTVEC_TYPE_SERINTR(cons->index, SERINTR_ERI), consdrv_intr);
+      kz_setintr(SOFTVEC_TYPE_SERINTR(cons->index, SERINTR_RXI), consdrv_intr);
+      kz_setintr(SOFTVEC_TYPE_SERINTR(cons->index, SERINTR_TXI), consdrv_intr);
+      kz_setintr(SOFTVEC_TYPE_SERINTR(cons->index, SERINTR_TEI), consdrv_intr);
       serial_intr_recv_enable(cons->index); /* 受信割り込み有効化（受信開始） */
       break;
 
     case CONSDRV_CMD_WRITE:
+      /* 大量出力用の送信バッファがなければ、対話用に書き込む */
+      i = (req->flags & CONSDRV_REQ_FLAG_BULK) && cons->bulk.buf;
+      consdrv_write(cons, data, size, i);
+      if (req->flags & CONSDRV_REQ_FLAG_NOTIFY)
+        consdrv_notify(cons, req->flag, req->pattern, i);
+      break;
+
+    case CONSDRV_CMD_BULK:
+      /* 大量出力用の送信バッファが一杯のときの動作(data[0]: 0以外で古い行を捨てる) */
+      if (size < 1)
+        break;
+      cons->bulk_drop = data[0] ? 1 : 0;
+      break;
+
+    case CONSDRV_CMD_MODE:
       /*
-       * send_string() では送信バッファを操作しており再入不可なので
-       * 排他のために割り込み禁止にして呼び出す。
+       * モードの切り替え
+       * data[0]: モード, data[1]: 渡すバイト数, data[2]: タイムアウト
+       * 受信中のデータは捨てる
        */
-      INTR_DISABLE;
-      send_string(cons, command + 1, size - 1);
-      INTR_ENABLE;
+      if (size < 1)
+        break;
+      ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+      cons->mode = (data[0] == CONSDRV_MODE_RAW) ? CONSDRV_MODE_RAW
+                                                 : CONSDRV_MODE_LINE;
+      cons->raw_threshold = cons->recv_size;
+      cons->raw_timeout = 0;
+      if (size >= 2 && (uint8)data[1] > 0
+          && (uint8)data[1] < cons->recv_size)
+        cons->raw_threshold = (uint8)data[1];
+      if (size >= 3)
+        cons->raw_timeout = (uint8)data[2];
+      cons->recv_len = 0;
+      cons->recv_flush = 0;
+      kz_unlock_ceiling(ceiling);
+      /* 行モードで処理していない文字も捨てる */
+      if (cons->recv_ring >= 0)
+        while (kz_ring_get(cons->recv_ring, &c, 1) > 0)
+          ;
       break;
 
+    case CONSDRV_CMD_BAUD:
+      /*
+       * ボーレートの変更(data: ボーレート(long))
+       * 送信バッファ中の文字を送り終えるまで待ってから変更する
+       */
+      if (size < sizeof(rate)) {
+        *resultp = KZ_ERR_PARAM;
+        break;
+      }
+      memcpy(&rate, data, sizeof(rate));
+      while (!LANE_EMPTY(&cons->send) || !LANE_EMPTY(&cons->bulk)
+             || cons->send_rest_len)
+        kz_sleep(1);
+      ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+      if (serial_set_baud(cons->index, rate) < 0)
+        *resultp = KZ_ERR_PARAM; /* 表にないボーレート */
+      recv_set_gap(cons);
+      kz_unlock_ceiling(ceiling);
+      break;
+
+    case CONSDRV_CMD_FLOW:
+      /* フロー制御の有効化・無効化（止めていた送受信は再開する） */
+      if (size < 1)
+        break;
+      ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+      if (data[0]) {
+        serial_flow_init(cons->index);
+        cons->flow = 1;
+        recv_flow(cons);
+      } else {
+        serial_rts_set(cons->index, 1);
+        cons->flow = 0;
+      }
+      if (cons->send_hold) {
+        cons->send_hold = 0;
+        serial_intr_send_enable(cons->index);
+      }
+      kz_unlock_ceiling(ceiling);
+      break;
+
+    case CONSDRV_CMD_INPUT:
+      /*
+       * 要求は recv_req なので解放させない。以降に受信した文字は、
+       * 改めて要求を送らせる（rawモードに切り替えた後でも戻す）
+       */
+      cons->recv_pending = 0;
+      if ((cons->mode == CONSDRV_MODE_LINE) && (cons->recv_ring >= 0))
+        consdrv_input(cons);
+      return 1;
+
+    case CONSDRV_CMD_RELEASE:
+      ceiling = kz_lock_ceiling(CONSDRV_INTR_LEVEL(cons));
+      cons->recv_busy--;
+      recv_flow(cons);
+      /*
+       * rawモードで渡せずにたまっている分は、送信割り込みの延長で渡させる
+       * (フロー制御で相手の送信を止めていると、次の受信がないため)
+       */
+      if ((cons->mode == CONSDRV_MODE_RAW)
+          && (cons->recv_len >= cons->raw_threshold)) {
+        cons->recv_flush = 1;
+        if (!serial_intr_is_send_enable(cons->index))
+          serial_intr_send_enable(cons->index);
+      }
+      kz_unlock_ceiling(ceiling);
+      return 1;
+
     default:
       break;
   }
@@ -174,18 +965,45 @@ static int consdrv_command(struct consreg *cons, kz_thread_id_t id,
 
 int consdrv_main(int argc, char *argv[])
 {
-  int size, index;
+  int size, timeout, owned, result;
   kz_thread_id_t id;
-  char *p;
+  consdrv_req_t *req;
+  char *p, *release;
 
   consdrv_init();
-  kz_setintr(SOFTVEC_TYPE_SERINTR, consdrv_intr); /* 割り込みハンドラ登録 */
 
   while (1) {
-    id = kz_recv(MSGBOX_ID_CONSOUTPUT, &size, &p);
-    index = p[0] - '0';
-    consdrv_command(&consreg[index], id, index, size - 1, p + 1);
-    kz_kmfree(p);
+    /*
+     * rawモードの受信のタイムアウトがあれば、その間隔で調べる
+     * (最後の受信からタイムアウトまでの時間は、最大で2倍程度になる)
+     */
+    timeout = consdrv_timeout();
+    if (timeout) {
+      id = kz_trecv(MSGBOX_ID_CONSOUTPUT, &size, &p, timeout);
+      if (id == (kz_thread_id_t)KZ_ERR_TIMEOUT)
+        continue;
+    } else {
+      id = kz_recv(MSGBOX_ID_CONSOUTPUT, &size, &p);
+    }
+
+    /*
+     * 受信待ちから戻ったら、既に届いている要求もまとめて処理してから
+     * 次の受信待ちに入る（書き込みは続けて送信バッファに追加される）。
+     * 処理した要求の領域は、次の要求の受信と同じシステムコールで解放する。
+     */
+    do {
+      req = (consdrv_req_t *)p;
+      owned = 0;
+      result = 0;
+      release = NULL;
+      if (req->index < CONSDRV_DEVICE_NUM)
+        owned = consdrv_command(CONSREG(req->index), id, req, &result);
+      if (req->flags & CONSDRV_REQ_FLAG_CALL)
+        kz_reply(id, result, NULL);
+      else if (!owned)
+        release = p;
+      id = kz_recv_free(MSGBOX_ID_CONSOUTPUT, &size, &p, -1, release);
+    } while (id != (kz_thread_id_t)KZ_ERR_EMPTY);
   }
 
   return 0;
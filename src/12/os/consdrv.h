@@ -1,8 +1,82 @@
 #ifndef _CONSDRV_H_INCLUDED_
 #define _CONSDRV_H_INCLUDED_
 
-#define CONSDRV_DEVICE_NUM 1
+#include "defines.h"
+
+#define CONSDRV_DEVICE_NUM 3 /* SCIの3チャネルを独立に使える */
 #define CONSDRV_CMD_USE   'u'
 #define CONSDRV_CMD_WRITE 'w'
+#define CONSDRV_CMD_RELEASE 'r' /* 受信した行のバッファの返却 */
+#define CONSDRV_CMD_MODE    'm' /* 受信のモードの切り替え */
+#define CONSDRV_CMD_BAUD    'b' /* ボーレートの変更 */
+#define CONSDRV_CMD_FLOW    'f' /* RTS/CTSのフロー制御の有効化・無効化 */
+#define CONSDRV_CMD_BULK    'p' /* 大量出力が溢れたときの動作の切り替え */
+#define CONSDRV_CMD_INPUT   'i' /* 受信した文字の処理（ドライバ内部で使う） */
+
+/* 受信のモード(CONSDRV_CMD_MODE) */
+#define CONSDRV_MODE_LINE 'l' /* 1行ずつ渡す（エコーバック・改行の変換・行の編集あり） */
+#define CONSDRV_MODE_RAW  'r' /* バイト列をそのまま渡す（エコーバックなし） */
+
+/*
+ * コンソールドライバへの要求（MSGBOX_ID_CONSOUTPUT に送るメッセージ）
+ * data が NULL ならば、データはヘッダの直後に続く。
+ * data でデータを指す場合はコピーせずに参照するので、CONSDRV_REQ_FLAG_CALL
+ * を指定して kz_call() で送り、返信されるまでデータを変更しないこと。
+ *
+ * 各要求のデータ
+ * ・CONSDRV_CMD_USE:     [0]: シリアルの番号,
+ *                        [1]: 入力を渡すメッセージボックス（省略時は
+ *                             MSGBOX_ID_CONSINPUT）
+ * ・CONSDRV_CMD_WRITE:   出力する文字列
+ * ・CONSDRV_CMD_MODE:    [0]: モード, [1]: 渡すバイト数, [2]: タイムアウト
+ * ・CONSDRV_CMD_BAUD:    ボーレート(long, serial_set_baud() を参照)
+ * ・CONSDRV_CMD_FLOW:    [0]: 0以外ならフロー制御を有効にする
+ *                        (端子は serial.c の serial_flow_init() を参照)
+ * ・CONSDRV_CMD_BULK:    [0]: 0以外なら CONSDRV_REQ_FLAG_BULK の書き込みが
+ *                             溢れたときに古い行を捨てる（0なら空くまで待つ）
+ * ・CONSDRV_CMD_RELEASE: なし（受信した行のバッファをヘッダとして使う）
+ */
+typedef struct {
+  uint8 index;   /* コンソールの番号 */
+  uint8 command; /* CONSDRV_CMD_* */
+  uint8 flags;   /* CONSDRV_REQ_FLAG_* */
+  uint8 dummy;
+  int size;      /* データのサイズ */
+  char *data;    /* データ（NULLならばヘッダの直後） */
+  kz_flag_id_t flag; /* 完了通知のイベントフラグ(CONSDRV_REQ_FLAG_NOTIFY) */
+  uint16 pattern;    /* 完了通知でセットするビット */
+} consdrv_req_t;
+
+/*
+ * kz_call() で送った要求（処理が終わったら kz_reply() する）
+ * 要求の領域は要求元のものなので、ドライバは解放しない(スタック上でもよい)
+ * kz_call() は要求の結果を返す（成功ならば0。CONSDRV_CMD_BAUD で表にない
+ * ボーレートならば KZ_ERR_PARAM で、ボーレートは変わらない）
+ */
+#define CONSDRV_REQ_FLAG_CALL (1 << 0)
+
+/*
+ * 書き込みの最後の文字がシリアルから送り出されたら、flag のイベントフラグに
+ * pattern をセットする(CONSDRV_CMD_WRITE のみ)。送信中の書き込みの数を
+ * 制限して、出力の速度に合わせたい場合に使う。
+ */
+#define CONSDRV_REQ_FLAG_NOTIFY (1 << 1)
+
+/*
+ * ログなどの大量の出力（CONSDRV_CMD_WRITE のみ）
+ * 対話用とは別の送信バッファに書き込み、対話用の出力がなく、送信中の
+ * 行もないときに送信する（コマンドの応答を大量の出力の後に待たせない）。
+ * 送信バッファが一杯のときは、古い行を捨てて書き込む（CONSDRV_CMD_BULK で
+ * 空くまで待つようにもできる）。
+ */
+#define CONSDRV_REQ_FLAG_BULK (1 << 2)
+
+/*
+ * バッファのサイズのデフォルト CONSDRV_SEND_SIZE, CONSDRV_RECV_SIZE,
+ * CONSDRV_BULK_SIZE などは
+ * kozos_config.h で設定する（コンソールごとには consdrv.c の consconf で指定）
+ * 送信バッファは2のべき乗とすること。受信バッファは返却の要求に使うので、
+ * 要求のヘッダ(consdrv_req_t)以上にすること。
+ */
 
 #endif
@@ -0,0 +1,39 @@
+#ifndef _KOZOS_CRASHDUMP_H_INCLUDED_
+#define _KOZOS_CRASHDUMP_H_INCLUDED_
+
+/*
+ * クラッシュダンプ（kz_sysdown() したときの状態の記録）
+ * ld.scr の crashdump 領域(0xffbf70～, 176バイト = KZ_CRASHDUMP_SIZE)に置く。この領域は
+ * ブートローダもOSもロード・初期化しないので、リセット後も残っており、
+ * ブートローダの crash コマンドで表示できる。
+ * bootload/crashdump.h と同じ内容にすること。
+ * kz_crashdump_t は KZ_CRASHDUMP_SIZE を超えないこと（使う側で検査する）。
+ */
+#define KZ_CRASHDUMP_SIZE      0xb0 /* ld.scr の crashdump 領域の大きさ */
+#define KZ_CRASHDUMP_MAGIC     0x4b5a4344 /* "KZCD" */
+/* ブートローダがOSを起動する前に、残っていた記録をこれに変える（表示はできる） */
+#define KZ_CRASHDUMP_MAGIC_OLD 0x4b5a436f /* "KZCo" */
+#define KZ_CRASHDUMP_NAME_SIZE 16
+#define KZ_CRASHDUMP_POOL_NUM  4  /* 記録するメモリプールの数 */
+#define KZ_CRASHDUMP_TRACE_NUM 10 /* 記録するトレースの数（最新のもの） */
+#define KZ_CRASHDUMP_NO_SYSCALL 0xffff
+
+typedef struct {
+  uint32 magic;
+  uint32 tick;    /* システムティック */
+  uint32 thread;  /* カレントスレッドのID（なければ0） */
+  char name[KZ_CRASHDUMP_NAME_SIZE]; /* カレントスレッドの名前 */
+  uint16 syscall; /* カレントスレッドが最後に発行したシステムコールの種類 */
+  uint16 nest;    /* 割り込みのネストの深さ */
+  uint32 regs[8]; /* 保存されたレジスタ(ER0～ER6, CCR+PC) */
+  struct {
+    uint16 size;
+    uint16 used;
+    uint16 peak;
+  } pools[KZ_CRASHDUMP_POOL_NUM];
+  uint16 trace_num; /* 記録したトレースの数(KZ_TRACE でなければ0) */
+  uint16 dummy;
+  uint8 trace[KZ_CRASHDUMP_TRACE_NUM][8]; /* kz_trace_t の内容（古い順） */
+} kz_crashdump_t;
+
+#endif
@@ -0,0 +1,83 @@
+#include "defines.h"
+#include "kozos.h"
+#include "interrupt.h"
+#include "lib.h"
+
+/*
+ * 割り込みの遅延処理
+ * 割り込みハンドラからは処理を登録するだけにして、実際の処理は
+ * 遅延処理スレッドが割り込み有効の状態で実行する。
+ * スレッドから実行されるので、処理関数ではシステムコールも利用できる。
+ *
+ * 遅延処理スレッドは main.c で KZ_THREAD_DEFINE() により定義し、kz_start() が
+ * start_threads() より先に起動する。終了することはなく、OSの動作中は常に
+ * kx_defer() を受け付ける（セマフォを作成するまでは KZ_ERR_STATE を返す）。
+ * 標準の構成のドライバは使っていない（コンソールの受信は行バッファを渡す）が、
+ * 割り込みハンドラから処理を移すドライバのために常に組み込んでおく
+ * (使うのはTCB1つと STACKSIZE_DEFER のスタック、セマフォ1つ)。
+ */
+
+/* 登録できる遅延処理の数 DEFER_NUM は kozos_config.h で設定する */
+#if DEFER_NUM & (DEFER_NUM - 1)
+#error "DEFER_NUM must be a power of 2"
+#endif
+
+struct defer {
+  kz_defer_func_t func;
+  void *p;
+  int arg;
+};
+static KZ_TABLE_ELEMENT(struct defer) deferque[DEFER_NUM];
+
+static int defer_head; /* 次に実行する位置 */
+static int defer_tail; /* 次に登録する位置 */
+static kz_sem_id_t defer_sem = -1;
+
+/*
+ * 遅延処理の登録
+ * 割り込みハンドラ（割り込み禁止状態）から呼ぶこと
+ */
+int kx_defer(kz_defer_func_t func, void *p, int arg)
+{
+  struct defer *dp;
+  int next;
+
+  if (defer_sem < 0)
+    return KZ_ERR_STATE; /* 遅延処理スレッドが動作していない */
+
+  next = (defer_tail + 1) & (DEFER_NUM - 1);
+  if (next == defer_head)
+    return KZ_ERR_FULL;
+
+  dp = &deferque[defer_tail].e;
+  dp->func = func;
+  dp->p    = p;
+  dp->arg  = arg;
+  defer_tail = next;
+
+  kx_sem_post(defer_sem);
+
+  return 0;
+}
+
+/* 遅延処理スレッド */
+int defer_main(int argc, char *argv[])
+{
+  struct defer d;
+
+  defer_sem = kz_sem_create(0);
+
+  while (1) {
+    kz_sem_wait(defer_sem);
+
+    /* 割り込みハンドラと排他するため、取り出しは割り込み禁止で行う */
+    INTR_DISABLE;
+    memcpy(&d, &deferque[defer_head].e, sizeof(d));
+    defer_head = (defer_head + 1) & (DEFER_NUM - 1);
+    INTR_ENABLE;
+
+    d.func(d.p, d.arg);
+  }
+
+  return 0;
+}
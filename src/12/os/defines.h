@@ -1,21 +1,207 @@
 #ifndef _DEFINES_H_INCLUDED_
 #define _DEFINES_H_INCLUDED_
 
+#include "kozos_config.h"
+
 #define NULL ((void *)0)
 #define SERIAL_DEFAULT_DEVICE 1
+#define TIMER_DEFAULT_DEVICE 0
+
+/*
+ * 起動時の初期化などの実行頻度の低い関数を、外部DRAMに配置する(ld.scr)
+ * (内蔵RAMは、ディスパッチや割り込み処理などの頻繁に実行されるコードと
+ *  スタックのために空けておく)
+ */
+#define KZ_COLD __attribute__((section(".text.dram")))
+
+/*
+ * コンパイル時の検査（cond が偽ならば負のサイズの配列になり、コンパイル
+ * エラーとなる。name はエラーに表示される名前で、同じファイルの中で重ならない
+ * ようにする）
+ */
+#define KZ_STATIC_ASSERT(cond, name) \
+  typedef char kz_static_assert_##name[(cond) ? 1 : -1]
+
+/* 2の累乗への切り上げ（定数式, 1～0x10000） */
+#define KZ_POW2_OR1(x) ((x) | ((x) >> 1))
+#define KZ_POW2_OR2(x) (KZ_POW2_OR1(x) | (KZ_POW2_OR1(x) >> 2))
+#define KZ_POW2_OR4(x) (KZ_POW2_OR2(x) | (KZ_POW2_OR2(x) >> 4))
+#define KZ_POW2_OR8(x) (KZ_POW2_OR4(x) | (KZ_POW2_OR4(x) >> 8))
+#define KZ_ROUNDUP_POW2(x) (KZ_POW2_OR8((x) - 1) + 1)
+
+/*
+ * 表（構造体の配列）の要素の型
+ * H8は16ビットCPUなので32ビット整数に対しての乗算命令がなく、要素の
+ * サイズが2の累乗でないと、インデックスやポインタの差の計算で乗算が使われて
+ * "__mulsi3"がないなどのリンクエラーになる場合がある（2の累乗であれば
+ * シフト演算になる）。このため type のサイズを2の累乗に切り上げた共用体にして、
+ * 要素は e で参照する。メンバを追加してもダミーメンバでの調整は不要。
+ *   typedef KZ_TABLE_ELEMENT(struct foo) foo_elem;
+ *   static foo_elem foos[FOO_NUM];   （&foos[i].e で参照する）
+ */
+#define KZ_TABLE_ELEMENT(type) \
+  union { type e; char pad[KZ_ROUNDUP_POW2(sizeof(type))]; }
+
+/* 表の要素のサイズが2の累乗であることの検査 */
+#define KZ_TABLE_ASSERT(type, name) \
+  KZ_STATIC_ASSERT(!(sizeof(type) & (sizeof(type) - 1)), name)
 
 typedef unsigned char  uint8;
 typedef unsigned short uint16;
+#ifdef KZ_HOST
+/* ホスト環境(64ビット)でのシミュレーション(src/12/host) */
+typedef unsigned int   uint32;
+#else
 typedef unsigned long  uint32;
+#endif
+typedef uint32 kz_thread_id_t; /* TCBの番号と世代番号(kozos.c) */
+typedef int kz_sem_id_t;
+typedef int kz_mutex_id_t;
+typedef int kz_flag_id_t;
+typedef int kz_timer_id_t;
+typedef int kz_topic_id_t;
+typedef int kz_ring_id_t;
+
+/*
+ * スレッドの属性
+ * kz_run()・kz_start()・KZ_THREAD_DEFINE() の優先度に論理和で指定する。
+ *   KZ_THREAD_ATTR_INTRMASK: 割り込み禁止(CCRのI,UIビットを立てた状態)で
+ *     動作を開始する。起動処理を行う最初のスレッド(idle)などに使う
+ *   KZ_THREAD_ATTR_KERNEL: カーネルスレッド（ドライバなどのシステムタスク）。
+ *     タイムスライスで同じ優先度の他のスレッドに切り替えない
+ *   KZ_THREAD_ATTR_DRAM: スタックを内蔵RAM(userstack)ではなく外部DRAMに
+ *     獲得する。低速なので、シェルなどの応答時間を問わないスレッドに使う
+ *     (割り込みの処理はスレッドのスタックを使わないので影響しない)
+ *   KZ_THREAD_ATTR_ARGCOPY: argv の配列と文字列を、起動時に新しいスレッドの
+ *     スタックの末尾へまとめてコピーする。呼び出し側は kz_run() から戻れば
+ *     argv を破棄・再利用してよい。コピーの分はスタックのサイズに加えて
+ *     サイズクラスを選ぶ。kz_run() のみで、起動後は属性として残らない
+ * 優先度の値そのものは何も意味しないので、優先度0も通常のスレッドになる。
+ */
+#define KZ_THREAD_PRIORITY_MASK 0x00ff
+#define KZ_THREAD_ATTR_INTRMASK 0x0100
+#define KZ_THREAD_ATTR_KERNEL   0x0200
+#define KZ_THREAD_ATTR_DRAM     0x0400
+#define KZ_THREAD_ATTR_MASK     0x0700
+#define KZ_THREAD_ATTR_ARGCOPY  0x0800
+
+/* スレッドの統計情報(kz_getstat()で取得する) */
+typedef struct {
+  char name[16];      /* スレッド名（THREAD_NAME_SIZE を超える部分は切り詰める） */
+  int state;          /* 状態 */
+  #define KZ_THREAD_STATE_RUN   0 /* 実行中（kz_getstat() を呼んだスレッド） */
+  #define KZ_THREAD_STATE_READY 1 /* 実行可能 */
+  #define KZ_THREAD_STATE_SLEEP 2 /* kz_sleep() でスリープ中 */
+  #define KZ_THREAD_STATE_WAIT  3 /* メッセージなどの待ち */
+  #define KZ_THREAD_STATE_SUSPEND 4 /* kz_suspend() で中断中（待ち状態を含む） */
+  #define KZ_THREAD_STATE_THROTTLED 5 /* CPUの割り当て(kz_setbudget())を使い切って停止中 */
+  int priority;       /* 優先度 */
+  int attr;           /* 属性(KZ_THREAD_ATTR_*) */
+  int stacksize;      /* スタックのサイズ */
+  int stackused;      /* スタックの使用量（最大値） */
+  uint32 runticks;    /* 実行中にタイマ割り込みを受けた回数 */
+  uint32 dispatches;  /* ディスパッチされた回数 */
+  uint32 voluntary;   /* システムコールによる切り替えの回数 */
+  uint32 involuntary; /* 割り込みによる切り替え（横取り）の回数 */
+  uint32 syscalls;    /* 発行したシステムコールの回数 */
+  uint32 overruns;    /* 周期起動の起動時刻に間に合わなかった回数 */
+} kz_threadstat_t;
+
+/* メモリプールごとの使用状況（kz_memstat()で取得する） */
+typedef struct {
+  int size;  /* ブロックサイズ */
+  int num;   /* ブロック数 */
+  int used;  /* 使用中のブロック数 */
+  int peak;  /* 使用中のブロック数の最大値 */
+  int fails; /* 獲得に失敗した回数 */
+} kz_memstat_t;
+
+/*
+ * カーネル全体の性能カウンタ（kz_perfstat()で取得する）
+ * 起動時からの通算で、32ビットで一周する。システムコールの種類ごとの回数は
+ * kz_perfstat() の別の引数で取得する。
+ */
+#define KZ_PERFSTAT_INTR_NUM 20 /* ソフトウェア割り込みベクタの数以上にすること */
+typedef struct {
+  uint32 ticks;      /* 取得したときのシステムティック */
+  uint32 dispatches; /* ディスパッチ（コンテキストスイッチ）の回数 */
+  uint32 syscalls;   /* システムコールの回数 */
+  uint32 srvcalls;   /* サービスコールの回数 */
+  uint32 sends;      /* 送信したメッセージの数 */
+  uint32 recvs;      /* 受信したメッセージの数 */
+  uint32 allocfails; /* メモリプールからの獲得に失敗した回数の合計 */
+  uint32 intrs[KZ_PERFSTAT_INTR_NUM]; /* ソフトウェア割り込みベクタごとの回数 */
+} kz_perfstat_t;
+
+/* スタック領域と外部DRAMの使用状況（kz_regionstat()で取得する） */
+typedef struct {
+  uint32 stack_size;   /* スレッドのスタック領域(userstack)のサイズ */
+  uint32 stack_used;   /* 切り出し済みのサイズ（解放済みのスタックを含む） */
+  uint32 stack_free;   /* 切り出し済みで、解放されて再利用を待つサイズ */
+  uint32 dram_size;    /* 外部DRAMの空き領域(kz_dmalloc()用)のサイズ */
+  uint32 dram_free;    /* 未使用のサイズの合計 */
+  uint32 dram_largest; /* 未使用の領域の最大のサイズ（管理ヘッダを含む） */
+} kz_regionstat_t;
+
+/* kz_sendv() でまとめて送信するメッセージ */
+typedef struct {
+  int size;
+  char *p;
+} kz_msgvec_t;
+
+/* システムコールごとの統計情報（kz_syscall_stat()で取得） */
+typedef struct {
+  uint32 count; /* 呼び出し回数 */
+  uint32 total; /* 処理時間の合計（タイマのカウント数） */
+  uint16 min;   /* 処理時間の最小値 */
+  uint16 max;   /* 処理時間の最大値 */
+  uint32 dummy; /* 配列で扱うので16バイトにする（利用側に見えるので明示する） */
+} kz_syscallstat_t;
+KZ_TABLE_ASSERT(kz_syscallstat_t, kz_syscallstat_t);
+/*
+ * メッセージボックスごとの統計情報（KZ_MBOX_STAT, kz_mbox_stat()で取得）
+ * 待ち時間は送信から受信までの時間で、kz_gettime() のカウント数（0.4us単位）
+ */
+typedef struct {
+  uint16 count;      /* 格納されているメッセージ数 */
+  uint16 peak;       /* 格納されたメッセージ数の最大値 */
+  uint32 messages;   /* 受信されたメッセージ数 */
+  uint32 wait_total; /* 待ち時間の合計 */
+  uint32 wait_max;   /* 待ち時間の最大値 */
+} kz_mboxstat_t;
+/*
+ * 割り込みの遅延のヒストグラム（KZ_INTR_LATENCY, kz_intr_latency()で取得）
+ * ソフトウェア割り込みベクタごとに、タイマのカウント数（φ/8 = 0.4us単位）を
+ * 2の累乗の区間で数える（区間 n は 2^(n-1) 以上 2^n 未満, 0は0のみ,
+ * 最後の区間はそれ以上全て）。
+ */
+#define KZ_LATENCY_BIN_NUM 16
+typedef struct {
+  uint32 entry[KZ_LATENCY_BIN_NUM];  /* 発生から割り込み処理の入口まで */
+  uint32 wakeup[KZ_LATENCY_BIN_NUM]; /* 発生から起床したスレッドの実行まで */
+} kz_latencystat_t;
 
-typedef uint32 kz_thread_id_t;
 typedef int (*kz_func_t)(int argc, char *argv[]);
-typedef void (*kz_handler_t)(void);
+typedef void (*kz_handler_t)(int type); /* type: 発生したソフトウェア割り込みベクタの種類 */
+typedef void (*kz_defer_func_t)(void *p, int arg);
+typedef void (*kz_work_func_t)(void *arg); /* kz_workq_submit() で登録する処理 */
 
 typedef enum {
   MSGBOX_ID_CONSINPUT = 0, /* コンソールからの入力 */
   MSGBOX_ID_CONSOUTPUT,    /* コンソールへの出力  */
-  MSGBOX_ID_NUM,
+#ifdef KZ_NETDRV
+  MSGBOX_ID_NETOUTPUT,     /* イーサネットドライバへの要求(netdrv.h) */
+#endif
+#ifdef KZ_NET
+  MSGBOX_ID_NETSTACK,      /* プロトコルスタックへの要求(net.c) */
+#endif
+#ifdef KZ_ADC
+  MSGBOX_ID_ADC,           /* A/D変換ドライバへの要求(adcdrv.h) */
+#endif
+#ifdef KZ_BUSDRV
+  MSGBOX_ID_BUS,           /* I2C/SPIのバスドライバへの要求(busdrv.h) */
+#endif
+  MSGBOX_ID_NUM,           /* 固定IDの数（以降は kz_mbox_create() で作成） */
 } kz_msgbox_id_t;
 
 #endif
@@ -0,0 +1,151 @@
+#include "defines.h"
+#include "kozos.h"
+#include "dram.h"
+
+/*
+ * 外部DRAM上の大きなバッファの獲得と解放
+ * 内蔵RAMはメモリプール(memory.c)とスタックで共用していて余裕がないので、
+ * 大きなデータのバッファは、低速だが容量の大きい外部DRAM(ld.scr の dram)から
+ * 可変長で獲得する。DRAMコントローラはブートローダが初期化する(bootload/dram.c)。
+ *
+ * ・解放済みの領域をアドレス順のリストにつなぎ、先頭から最初に見つかった
+ *   十分な大きさの領域から切り出す(ファーストフィット)
+ * ・解放時には、前後の解放済み領域と隣接していれば結合する
+ * ・獲得できない場合はシステムを停止せず NULL を返す
+ *   (大きなバッファは呼び出し側で獲得の失敗を処理する前提とする)
+ */
+
+/*
+ * 領域のヘッダ
+ * 獲得した領域と解放済みの領域の先頭に置く。size はヘッダを含むサイズ。
+ * 領域のサイズはヘッダのサイズの倍数に切り上げるので、全ての領域の先頭は
+ * ヘッダのサイズでアラインされる。
+ */
+typedef struct _kzdram_block {
+  uint32 size;
+  struct _kzdram_block *next; /* 解放済みリストの次の領域(獲得中はNULL) */
+} kzdram_block;
+
+#define DRAM_ALIGN ((uint32)sizeof(kzdram_block))
+
+/* これより小さい余りは切り出さずに、獲得した領域に含める */
+#define DRAM_SPLIT_MIN (DRAM_ALIGN * 2)
+
+static kzdram_block *dram_free; /* 解放済み領域のリスト(アドレス順) */
+
+/* リンカスクリプトで定義される、外部DRAMの空き領域 */
+extern char dram_freearea, edram;
+
+/* 外部DRAMの領域の初期化 */
+KZ_COLD int kzdram_init(void)
+{
+  unsigned long start, end;
+
+  start = ((unsigned long)&dram_freearea + DRAM_ALIGN - 1) & ~(unsigned long)(DRAM_ALIGN - 1);
+  end = (unsigned long)&edram & ~(unsigned long)(DRAM_ALIGN - 1);
+
+  dram_free = NULL;
+  if (end - start < DRAM_SPLIT_MIN)
+    return -1;
+
+  dram_free = (kzdram_block *)start;
+  dram_free->size = end - start;
+  dram_free->next = NULL;
+
+  return 0;
+}
+
+/*
+ * 外部DRAMの領域の獲得
+ * 操作はシステムコールの延長で、全ての割り込みを禁止した状態で行われる。
+ */
+void *kzdram_alloc(uint32 size)
+{
+  kzdram_block *mp, **mpp, *np;
+
+  if (size == 0)
+    return NULL;
+  size = (size + sizeof(kzdram_block) + DRAM_ALIGN - 1) & ~(DRAM_ALIGN - 1);
+  if (size < sizeof(kzdram_block)) /* 桁あふれ */
+    return NULL;
+
+  for (mpp = &dram_free; (mp = *mpp) != NULL; mpp = &mp->next) {
+    if (mp->size < size)
+      continue;
+
+    if (mp->size - size < DRAM_SPLIT_MIN) {
+      /* 全体を獲得する */
+      *mpp = mp->next;
+    } else {
+      /*
+       * 後ろ側から切り出す
+       * (解放済みリストは残った前側をそのまま使うので、つなぎ直さなくてよい)
+       */
+      mp->size -= size;
+      np = (kzdram_block *)((char *)mp + mp->size);
+      np->size = size;
+      mp = np;
+    }
+    mp->next = NULL;
+    return mp + 1;
+  }
+
+  return NULL;
+}
+
+/* 外部DRAMの領域の解放 */
+int kzdram_free(void *mem)
+{
+  kzdram_block *mp, *prev, *next;
+
+  mp = (kzdram_block *)mem - 1;
+
+  /* 獲得した領域ではない */
+  if ((char *)mp < &dram_freearea || (char *)mp >= &edram)
+    return -1;
+
+  /* アドレス順に挿入する位置を探す */
+  prev = NULL;
+  for (next = dram_free; next && (next < mp); next = next->next)
+    prev = next;
+
+  /* 解放済みの領域と重なっている(二重解放) */
+  if ((next == mp) ||
+      (prev && ((char *)prev + prev->size > (char *)mp)))
+    return -1;
+
+  /* 後ろの解放済み領域と結合する */
+  if (next && ((char *)mp + mp->size == (char *)next)) {
+    mp->size += next->size;
+    mp->next = next->next;
+  } else {
+    mp->next = next;
+  }
+
+  /* 前の解放済み領域と結合する */
+  if (prev && ((char *)prev + prev->size == (char *)mp)) {
+    prev->size += mp->size;
+    prev->next = mp->next;
+  } else if (prev) {
+    prev->next = mp;
+  } else {
+    dram_free = mp;
+  }
+
+  return 0;
+}
+
+/* 外部DRAMの使用状況の取得（dram_ で始まるメンバのみ設定する） */
+void kzdram_stat(kz_regionstat_t *statp)
+{
+  kzdram_block *mp;
+
+  statp->dram_size = (unsigned long)&edram - (unsigned long)&dram_freearea;
+  statp->dram_free = 0;
+  statp->dram_largest = 0;
+  for (mp = dram_free; mp; mp = mp->next) {
+    statp->dram_free += mp->size;
+    if (mp->size > statp->dram_largest)
+      statp->dram_largest = mp->size;
+  }
+}
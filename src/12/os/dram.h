@@ -0,0 +1,9 @@
+#ifndef _KOZOS_DRAM_H_INCLUDED_
+#define _KOZOS_DRAM_H_INCLUDED_
+
+int kzdram_init(void);            /* 外部DRAMの領域の初期化 */
+void *kzdram_alloc(uint32 size);  /* 外部DRAMの領域の獲得 */
+int kzdram_free(void *mem);       /* 外部DRAMの領域の解放 */
+void kzdram_stat(kz_regionstat_t *statp); /* 使用状況の取得 */
+
+#endif
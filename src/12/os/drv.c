@@ -0,0 +1,133 @@
+#include "defines.h"
+#include "kozos.h"
+#include "drv.h"
+#include "queue.h"
+
+/*
+ * 非同期のデバイスドライバの共通部分（drv.h を参照）
+ * 待ち行列と処理中の要求はドライバのスレッドだけが操作する。割り込み
+ * ハンドラは処理中の要求を読んで送り返すだけなので、排他は不要
+ * (処理中の要求は、送り返された要求をスレッドが受け取るまで変わらない)。
+ */
+
+void drv_init(drv_dev_t *dev, const drv_ops_t *ops, kz_msgbox_id_t box,
+              void *priv)
+{
+  dev->ops = ops;
+  dev->box = box;
+  KZ_QUEUE_INIT(dev);
+  dev->active = NULL;
+  dev->priv = priv;
+  dev->requests = 0;
+  dev->completes = 0;
+}
+
+/* 要求元に完了を通知する */
+static void drv_finish(drv_req_t *req, int result)
+{
+  req->result = result;
+  if (req->flags & DRV_REQ_FLAG_CALL)
+    kz_reply(req->id, result, (char *)req);
+  else
+    kz_send(req->reply, result, (char *)req);
+}
+
+/*
+ * 待っている要求を開始する
+ * その場で終わったものは完了を通知して、割り込みで終わるものを
+ * 開始するか待ち行列が空になるまで続ける。
+ */
+static void drv_next(drv_dev_t *dev)
+{
+  drv_req_t *req;
+  int result;
+
+  while (!dev->active && !KZ_QUEUE_EMPTY(dev)) {
+    req = dev->head;
+    KZ_QUEUE_GET(dev, next);
+
+    /* 開始の処理の途中で完了の割り込みが入ってもよいように、先に設定する */
+    dev->active = req;
+    result = dev->ops->start(dev, req);
+    if (result == DRV_PENDING)
+      break;
+    dev->active = NULL;
+    dev->completes++;
+    drv_finish(req, result);
+  }
+}
+
+/*
+ * ドライバのスレッドの処理
+ * box に届いた要求を devs[req->index] の待ち行列につなぎ、
+ * kx_drv_complete() で送り返された要求の完了を通知する。
+ * 領域が NULL のメッセージを受け取ったら戻る（処理中の要求がないこと）。
+ */
+void drv_loop(kz_msgbox_id_t box, drv_dev_t *devs, int num)
+{
+  kz_thread_id_t id;
+  drv_req_t *req;
+  drv_dev_t *dev;
+  char *p;
+
+  while (1) {
+    id = kz_recv(box, NULL, &p);
+    if (p == NULL)
+      break;
+    req = (drv_req_t *)p;
+
+    if (req->flags & DRV_REQ_FLAG_DONE) {
+      dev = &devs[req->index];
+      req->flags &= ~DRV_REQ_FLAG_DONE;
+      dev->active = NULL;
+      dev->completes++;
+      drv_finish(req, req->result);
+      drv_next(dev);
+      continue;
+    }
+
+    req->id = id;
+    if (req->index >= num) {
+      drv_finish(req, DRV_ERR_PARAM);
+      continue;
+    }
+    dev = &devs[req->index];
+    dev->requests++;
+    KZ_QUEUE_PUT(dev, req, next);
+    drv_next(dev);
+  }
+}
+
+/*
+ * 処理中の要求の完了（割り込みハンドラから呼ぶ）
+ * 結果を書き込んで、ドライバのスレッドに要求を送り返す。
+ */
+void kx_drv_complete(drv_dev_t *dev, int result)
+{
+  drv_req_t *req = dev->active;
+
+  if (!req || (req->flags & DRV_REQ_FLAG_DONE))
+    return;
+  req->result = result;
+  req->flags |= DRV_REQ_FLAG_DONE;
+  kx_send(dev->box, 0, (char *)req);
+}
+
+/* 要求して完了を待つ（結果を返す） */
+int drv_call(kz_msgbox_id_t box, drv_req_t *req)
+{
+  req->flags = DRV_REQ_FLAG_CALL;
+  return kz_call(box, sizeof(*req), (char *)req, NULL);
+}
+
+/*
+ * 要求して、完了を待たずに戻る
+ * 完了したら reply に要求が送られる（size が結果）。それまでは要求の
+ * 領域とデータを変更しないこと。
+ */
+int drv_submit(kz_msgbox_id_t box, drv_req_t *req, kz_msgbox_id_t reply)
+{
+  req->flags = 0;
+  req->reply = reply;
+  return kz_send(box, sizeof(*req), (char *)req);
+}
@@ -0,0 +1,75 @@
+#ifndef _DRV_H_INCLUDED_
+#define _DRV_H_INCLUDED_
+
+#include "defines.h"
+#include "kozos.h"
+
+/*
+ * 非同期のデバイスドライバの共通部分（drv.c）
+ * consdrv.c の要求の受け付け・割り込み処理からの完了・要求元への通知を
+ * 共通にしたもの。ドライバは開始の処理(drv_ops_t)を用意して、ドライバの
+ * スレッドで drv_loop() を呼ぶだけでよい。
+ *
+ * ・要求(drv_req_t)は要求元の領域のまま、ポインタでドライバに渡す。
+ *   ドライバはデバイスごとの待ち行列につなぎ、1つずつ開始する。
+ * ・開始した処理が割り込みで終わるものならば、割り込みハンドラから
+ *   kx_drv_complete() を呼ぶ（サービスコールで要求をドライバに送り返す）。
+ * ・完了したら、drv_call() の要求元には kz_reply() で結果を返し、
+ *   drv_submit() の要求元には指定したメッセージボックスに要求を送る
+ *   （size が結果になる）。
+ */
+
+/* 要求 */
+typedef struct _drv_req {
+  struct _drv_req *next; /* デバイスの待ち行列（ドライバが使う） */
+  uint8 index;           /* デバイスの番号 */
+  uint8 command;         /* ドライバごとの要求の種類 */
+  uint8 flags;           /* DRV_REQ_FLAG_* */
+  uint8 dummy;
+  int size;              /* データのサイズ */
+  char *data;            /* データ */
+  int result;            /* 結果（完了時に設定される） */
+  kz_msgbox_id_t reply;  /* 完了を通知するメッセージボックス(drv_submit()) */
+  kz_thread_id_t id;     /* 要求元のスレッド(drv_call()、ドライバが設定する) */
+} drv_req_t;
+
+#define DRV_REQ_FLAG_CALL (1 << 0) /* drv_call() の要求（kz_reply() で返す） */
+#define DRV_REQ_FLAG_DONE (1 << 1) /* 割り込み処理で完了した（ドライバが使う） */
+
+/* 開始の処理が、完了を割り込みで通知することを示す戻り値 */
+#define DRV_PENDING (-0x7fff)
+
+/* 要求元に返すエラー（ドライバごとのエラーは、これら以外の負の値にする） */
+#define DRV_ERR_PARAM (-1) /* デバイスの番号が不正 */
+
+typedef struct _drv_dev drv_dev_t;
+
+/*
+ * ドライバごとの処理（ドライバのスレッドから呼ばれる）
+ * start: 要求を開始する。その場で終わったら結果を、割り込みで終わるなら
+ *        DRV_PENDING を返す（割り込みハンドラで kx_drv_complete() を呼ぶ）。
+ */
+typedef struct {
+  int (*start)(drv_dev_t *dev, drv_req_t *req);
+} drv_ops_t;
+
+/* デバイス（ドライバの静的な領域に置く） */
+struct _drv_dev {
+  const drv_ops_t *ops;
+  kz_msgbox_id_t box;    /* ドライバのスレッドのメッセージボックス */
+  drv_req_t *head;       /* 開始を待っている要求 */
+  drv_req_t *tail;
+  drv_req_t *active;     /* 処理中の要求 */
+  void *priv;            /* ドライバごとの情報 */
+  uint32 requests;       /* 受け付けた要求の数 */
+  uint32 completes;      /* 完了した要求の数 */
+};
+
+void drv_init(drv_dev_t *dev, const drv_ops_t *ops, kz_msgbox_id_t box,
+              void *priv);
+void drv_loop(kz_msgbox_id_t box, drv_dev_t *devs, int num);
+void kx_drv_complete(drv_dev_t *dev, int result);
+int drv_call(kz_msgbox_id_t box, drv_req_t *req);
+int drv_submit(kz_msgbox_id_t box, drv_req_t *req, kz_msgbox_id_t reply);
+
+#endif
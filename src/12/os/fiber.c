@@ -0,0 +1,220 @@
+#include "defines.h"
+#include "kozos.h"
+#include "lib.h"
+#include "fiber.h"
+
+/*
+ * ファイバの切り替え（startup.s, ホスト環境では host.c で定義）
+ * 呼び出し先保存のレジスタをスタックに積んで、スタックポインタを *savesp に
+ * 保存し、sp のスタックに切り替えてレジスタを戻す。
+ */
+void fiber_switch(unsigned long *savesp, unsigned long sp);
+
+static fiber_sched_t *fiber_sched(void)
+{
+  return kz_tls_get(FIBER_TLS_INDEX);
+}
+
+/* スケジューラに戻る（ファイバから呼ぶ） */
+static void fiber_block(fiber_sched_t *sched, fiber_t *fp)
+{
+  fiber_switch(&fp->sp, sched->sp);
+}
+
+/* ファイバのスタートアップ（fiber_switch() から戻る形で実行される） */
+static void fiber_entry(void)
+{
+  fiber_t *fp = fiber_sched()->current;
+
+  fp->func(fp->arg);
+  fiber_exit();
+}
+
+/* ファイバの初期コンテキストの作成 */
+static unsigned long fiber_context_init(char *stack, int size)
+{
+#ifdef KZ_HOST
+  return host_fiber_init(stack, size, fiber_entry);
+#else
+  uint32 *sp = (uint32 *)((unsigned long)(stack + size) & ~3UL);
+
+  /* fiber_switch() が戻すレジスタと、rts で戻るアドレス */
+  *(--sp) = (uint32)fiber_entry;
+  *(--sp) = 0; /* ER6 */
+  *(--sp) = 0; /* ER5 */
+  *(--sp) = 0; /* ER4 */
+
+  return (unsigned long)sp;
+#endif
+}
+
+/* スケジューラの初期化（fiber_run() するスレッドから呼ぶ） */
+int fiber_init(fiber_sched_t *sched)
+{
+  memset(sched, 0, sizeof(*sched));
+  return kz_tls_set(FIBER_TLS_INDEX, sched);
+}
+
+/*
+ * ファイバの作成
+ * fiber_run() の実行中に、ファイバから作成してもよい。
+ */
+int fiber_create(fiber_t *fp, fiber_func_t func, void *arg,
+                 char *stack, int size)
+{
+  fiber_sched_t *sched = fiber_sched();
+  fiber_t **fpp;
+
+  if (!sched || (size < FIBER_STACK_MIN))
+    return KZ_ERR_PARAM;
+
+  memset(fp, 0, sizeof(*fp));
+  fp->state = FIBER_STATE_READY;
+  fp->func = func;
+  fp->arg = arg;
+  fp->sp = fiber_context_init(stack, size);
+
+  /* 作成した順に実行されるように、末尾に接続する */
+  for (fpp = &sched->head; *fpp; fpp = &(*fpp)->next)
+    ;
+  *fpp = fp;
+
+  return 0;
+}
+
+/* ファイバが実行可能かを調べる（待ち条件が成立していれば待ちを解除する） */
+static int fiber_is_ready(fiber_t *fp)
+{
+  switch (fp->state) {
+    case FIBER_STATE_READY:
+      return 1;
+
+    case FIBER_STATE_RECV:
+      fp->ret = kz_precv(fp->box, fp->sizep, fp->pp);
+      if (fp->ret == (kz_thread_id_t)KZ_ERR_EMPTY)
+        return 0;
+      break;
+
+    case FIBER_STATE_SLEEP:
+      /* 現在のティック - wakeup が負（最上位ビットが1）ならまだ */
+      if ((kz_gettick() - fp->wakeup) & 0x80000000)
+        return 0;
+      break;
+
+    default:
+      return 0;
+  }
+
+  fp->state = FIBER_STATE_READY;
+  return 1;
+}
+
+/*
+ * ファイバの実行（全てのファイバが終了するまで戻らない）
+ * 実行可能なファイバを作成順に1つずつ実行する。どれも実行できなければ
+ * 1ティックだけスリープしてから、メッセージと時間の待ちを調べ直す
+ * (他のスレッドが kz_wakeup() すれば、すぐに調べ直す)。
+ */
+int fiber_run(void)
+{
+  fiber_sched_t *sched = fiber_sched();
+  fiber_t *fp, **fpp;
+  int ran;
+
+  if (!sched)
+    return KZ_ERR_STATE;
+
+  while (sched->head) {
+    ran = 0;
+    for (fpp = &sched->head; (fp = *fpp) != NULL; ) {
+      if (fiber_is_ready(fp)) {
+        sched->current = fp;
+        fiber_switch(&sched->sp, fp->sp);
+        sched->current = NULL;
+        ran = 1;
+      }
+      if (fp->state == FIBER_STATE_DONE) {
+        *fpp = fp->next;
+        fp->next = NULL;
+        continue;
+      }
+      fpp = &fp->next;
+    }
+    if (!ran)
+      kz_sleep(1);
+  }
+
+  return 0;
+}
+
+/*
+ * 以下はファイバから呼ぶ。ファイバ以外から呼んだ場合は、
+ * 対応するシステムコールでスレッドごと待つ。
+ */
+
+/* 実行権を他のファイバに渡す */
+void fiber_yield(void)
+{
+  fiber_sched_t *sched = fiber_sched();
+
+  if (!sched || !sched->current) {
+    kz_wait();
+    return;
+  }
+  fiber_block(sched, sched->current);
+}
+
+/* ファイバの終了（ファイバの関数から戻っても終了する） */
+void fiber_exit(void)
+{
+  fiber_sched_t *sched = fiber_sched();
+
+  if (!sched || !sched->current)
+    return;
+  sched->current->state = FIBER_STATE_DONE;
+  fiber_block(sched, sched->current);
+  /* ここには返ってこない */
+}
+
+/* 指定したティック数の間、他のファイバに実行権を渡す */
+void fiber_sleep(int ticks)
+{
+  fiber_sched_t *sched = fiber_sched();
+  fiber_t *fp;
+
+  if (!sched || !sched->current) {
+    kz_sleep(ticks);
+    return;
+  }
+  fp = sched->current;
+  fp->wakeup = kz_gettick() + ticks;
+  fp->state = FIBER_STATE_SLEEP;
+  fiber_block(sched, fp);
+}
+
+/*
+ * メッセージの受信（kz_recv() と同じ戻り値）
+ * メッセージがなければ、届くまで他のファイバに実行権を渡す。
+ */
+kz_thread_id_t fiber_recv(kz_msgbox_id_t id, int *sizep, char **pp)
+{
+  fiber_sched_t *sched = fiber_sched();
+  fiber_t *fp;
+  kz_thread_id_t ret;
+
+  if (!sched || !sched->current)
+    return kz_recv(id, sizep, pp);
+
+  ret = kz_precv(id, sizep, pp);
+  if (ret != (kz_thread_id_t)KZ_ERR_EMPTY)
+    return ret;
+
+  fp = sched->current;
+  fp->box = id;
+  fp->sizep = sizep;
+  fp->pp = pp;
+  fp->state = FIBER_STATE_RECV;
+  fiber_block(sched, fp);
+
+  return fp->ret;
+}
@@ -0,0 +1,60 @@
+#ifndef _FIBER_H_INCLUDED_
+#define _FIBER_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * ファイバ（1つのスレッドの中で動作する協調型の軽量スレッド）
+ * fiber_init() したスレッドで fiber_create() したファイバを fiber_run() で
+ * 順番に実行する。ファイバの切り替えは fiber_yield() などを呼んだときのみで、
+ * カーネルのTCBもスタックのサイズクラスも使わない。
+ * スケジューラはスレッドごとのユーザ領域(FIBER_TLS_INDEX)から参照するので、
+ * 複数のスレッドがそれぞれ fiber_run() してもよい。
+ *
+ * スタックは呼び出し側で用意する。スレッドのスタックと同様に、割り込みの
+ * 入口でレジスタが退避されるので、その分の余裕を持たせること。
+ * (ホスト環境ではホストのライブラリ関数も動くので、0x4000程度にする)
+ */
+
+#define FIBER_TLS_INDEX 0     /* 使用するスレッドごとのユーザ領域の番号 */
+#define FIBER_STACK_MIN 0x80  /* スタックの最小サイズ */
+
+typedef void (*fiber_func_t)(void *arg);
+
+/* ファイバの管理情報（呼び出し側で確保する） */
+typedef struct _fiber {
+  struct _fiber *next;
+  unsigned long sp; /* 切り替え時のスタックポインタ */
+  int state;
+  #define FIBER_STATE_READY 0
+  #define FIBER_STATE_RECV  1 /* fiber_recv() でメッセージ待ち */
+  #define FIBER_STATE_SLEEP 2 /* fiber_sleep() で時間待ち */
+  #define FIBER_STATE_DONE  3
+  fiber_func_t func;
+  void *arg;
+
+  /* 待ち状態のパラメータ */
+  kz_msgbox_id_t box;
+  int *sizep;
+  char **pp;
+  uint32 wakeup; /* 起床するティック */
+  kz_thread_id_t ret;
+} fiber_t;
+
+/* スケジューラ（fiber_run() するスレッドごとに1つ） */
+typedef struct {
+  fiber_t *head; /* 終了していないファイバのリスト */
+  fiber_t *current;
+  unsigned long sp; /* fiber_run() のスタックポインタ */
+} fiber_sched_t;
+
+int fiber_init(fiber_sched_t *sched);
+int fiber_create(fiber_t *fp, fiber_func_t func, void *arg,
+                 char *stack, int size);
+int fiber_run(void);
+void fiber_yield(void);
+void fiber_exit(void);
+void fiber_sleep(int ticks);
+kz_thread_id_t fiber_recv(kz_msgbox_id_t id, int *sizep, char **pp);
+
+#endif
@@ -0,0 +1,186 @@
+#include "defines.h"
+#include "lib.h"
+
+/*
+ * 書式付きの文字列の作成（snprintf() の小さなサブセット）
+ * ブートローダのROMのライブラリ(romlib.c)には無いので、lib.c とは別に
+ * どちらの場合も組み込む。出力はせずに呼び出し元のバッファに書き込むので、
+ * 1行をまとめて作ってからコンソールドライバに1回で渡せる。
+ *
+ * 使える変換は %d %u %x %s %c %% のみ。フラグは '-'(左詰め)と '0'(0で
+ * 埋める)、幅は10進数で指定する。l を付けると long の引数を取る
+ * (H8では int が16ビットなので、uint32 などは %lx とすること)。
+ */
+
+/*
+ * 数値の文字列への変換（vsnprintf() とコンソールへの出力で使う）
+ * どちらも buf に書き込み、buf 中の先頭の桁へのポインタを返す。
+ * H8/300H には32ビットの除算命令がない（ライブラリの除算は遅い）ので、
+ * 10進数は10の累乗の表を引いて引き算で各桁を求め、16進数は下位から
+ * 1バイトずつ2桁ずつ変換する。
+ */
+static const char format_hex_digits[] = "0123456789abcdef";
+
+static const unsigned long format_pow10[] = {
+  1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10,
+};
+#define FORMAT_POW10_NUM ((int)(sizeof(format_pow10) / sizeof(*format_pow10)))
+
+/*
+ * 16進数（digits 桁に満たなければ先頭を0で埋める。buf は FORMAT_HEX_SIZE バイト）
+ * buf の先頭より前には書かない
+ */
+char *format_hex(char *buf, unsigned long value, int digits)
+{
+  char *end = buf + FORMAT_HEX_SIZE - 1;
+  char *p = end;
+  uint8 b;
+
+  if (digits < 1)
+    digits = 1;
+  if (digits > FORMAT_HEX_SIZE - 1)
+    digits = FORMAT_HEX_SIZE - 1;
+  *p = '\0';
+  do {
+    b = value;
+    *(--p) = format_hex_digits[b & 0xf];
+    *(--p) = format_hex_digits[b >> 4];
+    value >>= 8;
+  } while ((value || (end - p < digits)) && (p > buf));
+  /* 2桁ずつ作るので、余分な先頭の0を除く */
+  if ((*p == '0') && (end - p > digits))
+    p++;
+  return p;
+}
+
+/* 10進数（符号なし。buf は FORMAT_DEC_SIZE バイト） */
+char *format_dec(char *buf, unsigned long value)
+{
+  char *p = buf;
+  char d;
+  int i;
+
+  for (i = 0; (i < FORMAT_POW10_NUM) && (value < format_pow10[i]); i++)
+    ;
+  for (; i < FORMAT_POW10_NUM; i++) {
+    for (d = '0'; value >= format_pow10[i]; d++)
+      value -= format_pow10[i];
+    *(p++) = d;
+  }
+  *(p++) = '0' + value;
+  *p = '\0';
+  return buf;
+}
+
+/* 1文字書き込む（size-1 文字を超える分は捨てる） */
+static void format_putc(char *buf, int size, int *lenp, char c)
+{
+  if (*lenp < size - 1)
+    buf[*lenp] = c;
+  (*lenp)++;
+}
+
+/*
+ * バッファに書き込んで、終端の '\0' を除いた長さを返す
+ * バッファが足りなければ size-1 文字で切り詰める（戻り値は切り詰めた後の長さ）
+ */
+int vsnprintf(char *buf, int size, const char *fmt, va_list ap)
+{
+  /* 符号の1文字 + 16進数・10進数の長い方 */
+  char tmp[1 + ((FORMAT_HEX_SIZE > FORMAT_DEC_SIZE) ? FORMAT_HEX_SIZE : FORMAT_DEC_SIZE)];
+  char *s;
+  unsigned long value;
+  int len = 0, n, width, left, pad, neg;
+
+  if (size <= 0)
+    return 0;
+
+  for (; *fmt; fmt++) {
+    if (*fmt != '%') {
+      format_putc(buf, size, &len, *fmt);
+      continue;
+    }
+
+    left = 0;
+    pad = ' ';
+    for (fmt++; (*fmt == '-') || (*fmt == '0'); fmt++) {
+      if (*fmt == '-')
+        left = 1;
+      else
+        pad = '0';
+    }
+    for (width = 0; (*fmt >= '0') && (*fmt <= '9'); fmt++)
+      width = width * 10 + (*fmt - '0');
+
+    /* 変換結果は s から n 文字（数値は tmp の末尾から詰める） */
+    neg = 0;
+    switch ((*fmt == 'l') ? *(++fmt) : *fmt) {
+      case 's':
+        s = va_arg(ap, char *);
+        if (s == NULL)
+          s = "(null)";
+        n = strlen(s);
+        break;
+      case 'c':
+        tmp[0] = va_arg(ap, int);
+        s = tmp;
+        n = 1;
+        break;
+      case 'd':
+      case 'u':
+      case 'x':
+        if (fmt[-1] == 'l')
+          value = va_arg(ap, unsigned long);
+        else if (*fmt == 'd')
+          value = (long)va_arg(ap, int);
+        else
+          value = va_arg(ap, unsigned int);
+        if ((*fmt == 'd') && ((long)value < 0)) {
+          neg = 1;
+          value = -value;
+        }
+        /* 符号を付けられるように、tmp の2文字目から変換する */
+        if (*fmt == 'x')
+          s = format_hex(tmp + 1, value, 1);
+        else
+          s = format_dec(tmp + 1, value);
+        if (neg)
+          *(--s) = '-';
+        n = strlen(s);
+        break;
+      case '\0':
+        fmt--;
+        continue;
+      default:
+        format_putc(buf, size, &len, *fmt);
+        continue;
+    }
+
+    /* 0で埋める場合は、符号の後ろを埋める */
+    if (neg && (pad == '0') && !left) {
+      format_putc(buf, size, &len, *(s++));
+      n--;
+      width--;
+    }
+    for (width -= n; !left && (width > 0); width--)
+      format_putc(buf, size, &len, pad);
+    while (n-- > 0)
+      format_putc(buf, size, &len, *(s++));
+    for (; width > 0; width--)
+      format_putc(buf, size, &len, ' ');
+  }
+
+  buf[(len < size) ? len : size - 1] = '\0';
+  return (len < size) ? len : size - 1;
+}
+
+int snprintf(char *buf, int size, const char *fmt, ...)
+{
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf, size, fmt, ap);
+  va_end(ap);
+  return len;
+}
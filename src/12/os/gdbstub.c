@@ -0,0 +1,414 @@
+#include "defines.h"
+#include "kozos.h"
+#include "intr.h"
+#include "interrupt.h"
+#include "serial.h"
+#include "power.h"
+#include "lib.h"
+
+/*
+ * GDBのリモートシリアルプロトコルのスタブ（make GDBSTUB=1 で組み込む）
+ * コンソールが使っていないSCI(GDBSTUB_SCI)につなぎ、システムを止めずに
+ * メモリの読み書き(m, M)とスレッドの一覧(qfThreadInfo など)に応答する。
+ * 性能の調査で、カウンタやトレースのバッファを動作中のまま読むためのもの。
+ *   (gdb) set serial baud 57600
+ *   (gdb) target remote /dev/ttyUSB1
+ *   (gdb) x/16xw &perf
+ * 受信割り込み(RXI)でパケットを組み立てて検査し、そろったらスタブの
+ * スレッドを kx_wakeup() で起こす。応答の組み立てと送信は優先度の低い
+ * スレッドで行うので、他のスレッドや割り込みの処理を遅らせない。
+ * ブレークポイントとステップ実行はできない。continue はそのまま待ち、
+ * ctrl+c で停止したと応答する（実際には止まっていない）。
+ * レジスタ(g)は、実行中でないスレッドのスタックに保存されたものを返す
+ * (Hg で選んだスレッド。実行中のスレッドのものは不明として返す)。
+ */
+
+#if (GDBSTUB_SCI == SERIAL_DEFAULT_DEVICE) \
+  || (defined(KZ_CONSOLE_SCI0) && (GDBSTUB_SCI == 0)) \
+  || (defined(KZ_CONSOLE_SCI2) && (GDBSTUB_SCI == 2))
+#error "GDBSTUB_SCI is used by a console."
+#endif
+
+/* 受信の状態 */
+#define GDBSTUB_RECV_IDLE  0 /* '$' を待つ */
+#define GDBSTUB_RECV_DATA  1 /* '#' までのデータ */
+#define GDBSTUB_RECV_SUM1  2 /* チェックサムの上位の桁 */
+#define GDBSTUB_RECV_SUM2  3 /* チェックサムの下位の桁 */
+
+/* g で返すレジスタ(ER0～ER7, CCR, PC)の数 */
+#define GDBSTUB_REG_NUM 10
+
+static struct {
+  kz_thread_id_t id;      /* スタブのスレッド */
+  int state;              /* 受信の状態(GDBSTUB_RECV_*) */
+  int len;
+  uint8 sum;
+  uint8 sum_recv;
+  uint8 overflow;         /* パケットが GDBSTUB_PACKET_SIZE を超えた */
+  volatile uint8 ready;   /* 1:受信した 2:チェックサムの誤り（応答まで受信しない） */
+  volatile uint8 brk;     /* ctrl+c を受信した */
+  uint8 running;          /* continue の応答を保留している */
+  kz_thread_id_t gthread; /* Hg で選んだスレッド（0なら先頭のスレッド） */
+  char buf[GDBSTUB_PACKET_SIZE + 1];
+} gdb;
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static int hexval(char c)
+{
+  if ((c >= '0') && (c <= '9'))
+    return c - '0';
+  if ((c >= 'a') && (c <= 'f'))
+    return c - 'a' + 10;
+  if ((c >= 'A') && (c <= 'F'))
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* 16進数の読み取り（*pp を進める） */
+static uint32 parse_hex(char **pp)
+{
+  uint32 val = 0;
+  int n;
+
+  while ((n = hexval(**pp)) >= 0) {
+    val = (val << 4) | n;
+    (*pp)++;
+  }
+  return val;
+}
+
+/* p に val を digits 桁の16進数で書き込み、末尾を返す */
+static char *put_hex(char *p, uint32 val, int digits)
+{
+  while (digits-- > 0)
+    *(p++) = hexdigits[(val >> (digits * 4)) & 0xf];
+  return p;
+}
+
+/* 先頭の0を省いた16進数（スレッドIDなど） */
+static char *put_hexnum(char *p, uint32 val)
+{
+  int digits;
+
+  for (digits = 1; (digits < 8) && (val >> (digits * 4)); digits++)
+    ;
+  return put_hex(p, val, digits);
+}
+
+static char *put_str(char *p, char *s)
+{
+  while (*s)
+    *(p++) = *(s++);
+  return p;
+}
+
+/* 受信割り込み（パケットの組み立てと検査のみ） */
+static void gdbstub_intr(int type)
+{
+  unsigned char c;
+  int n;
+
+  if (type == SOFTVEC_TYPE_SERINTR(GDBSTUB_SCI, SERINTR_ERI)) {
+    serial_recv_error_clear(GDBSTUB_SCI);
+    gdb.state = GDBSTUB_RECV_IDLE;
+    return;
+  }
+
+  c = serial_recv_byte(GDBSTUB_SCI);
+  if (gdb.ready)
+    return; /* 応答を返すまで、GDBは次のパケットを送らない */
+
+  switch (gdb.state) {
+    case GDBSTUB_RECV_IDLE:
+      if (c == '$') {
+        gdb.len = 0;
+        gdb.sum = 0;
+        gdb.overflow = 0;
+        gdb.state = GDBSTUB_RECV_DATA;
+      } else if (c == 0x03) {
+        gdb.brk = 1;
+        kx_wakeup(gdb.id);
+      }
+      break; /* '+', '-' は読み捨てる（応答は送り直さない） */
+
+    case GDBSTUB_RECV_DATA:
+      if (c == '#') {
+        gdb.state = GDBSTUB_RECV_SUM1;
+        break;
+      }
+      gdb.sum += c;
+      if (gdb.len < GDBSTUB_PACKET_SIZE)
+        gdb.buf[gdb.len++] = c;
+      else
+        gdb.overflow = 1;
+      break;
+
+    case GDBSTUB_RECV_SUM1:
+      n = hexval(c);
+      gdb.sum_recv = (n < 0) ? 0 : n << 4;
+      gdb.state = GDBSTUB_RECV_SUM2;
+      break;
+
+    case GDBSTUB_RECV_SUM2:
+    default:
+      n = hexval(c);
+      gdb.sum_recv |= (n < 0) ? 0 : n;
+      gdb.buf[gdb.len] = '\0';
+      gdb.ready = ((n >= 0) && !gdb.overflow && (gdb.sum_recv == gdb.sum))
+        ? 1 : 2;
+      gdb.state = GDBSTUB_RECV_IDLE;
+      kx_wakeup(gdb.id);
+      break;
+  }
+}
+
+static void send_char(unsigned char c)
+{
+  serial_send_byte(GDBSTUB_SCI, c);
+}
+
+/* パケットの送信（"$データ#チェックサム"） */
+static void send_packet(char *data, int len)
+{
+  uint8 sum = 0;
+  int i;
+
+  send_char('$');
+  for (i = 0; i < len; i++) {
+    send_char(data[i]);
+    sum += data[i];
+  }
+  send_char('#');
+  send_char(hexdigits[sum >> 4]);
+  send_char(hexdigits[sum & 0xf]);
+}
+
+/* 問い合わせのスレッドID（0, -1 は先頭のスレッドにする） */
+static kz_thread_id_t thread_arg(char *p)
+{
+  kz_thread_id_t id;
+
+  if (*p == '-')
+    return kz_thread_next(0);
+  id = parse_hex(&p);
+  return id ? id : kz_thread_next(0);
+}
+
+/* m addr,len: メモリの読み出し */
+static char *cmd_read_mem(char *p)
+{
+  unsigned char *addr;
+  uint32 len;
+  char *out = gdb.buf;
+
+  addr = (unsigned char *)parse_hex(&p);
+  if (*(p++) != ',')
+    return put_str(out, "E01");
+  len = parse_hex(&p);
+  if (len > GDBSTUB_PACKET_SIZE / 2)
+    len = GDBSTUB_PACKET_SIZE / 2;
+  for (; len > 0; len--)
+    out = put_hex(out, *(addr++), 2);
+  return out;
+}
+
+/* M addr,len:XX...: メモリの書き込み */
+static char *cmd_write_mem(char *p)
+{
+  unsigned char *addr;
+  uint32 len;
+  int hi, lo;
+
+  addr = (unsigned char *)parse_hex(&p);
+  if (*(p++) != ',')
+    return put_str(gdb.buf, "E01");
+  len = parse_hex(&p);
+  if (*(p++) != ':')
+    return put_str(gdb.buf, "E01");
+  for (; len > 0; len--, p += 2) {
+    hi = hexval(p[0]);
+    lo = (hi < 0) ? -1 : hexval(p[1]);
+    if (lo < 0)
+      return put_str(gdb.buf, "E02");
+    *(addr++) = (hi << 4) | lo;
+  }
+  return put_str(gdb.buf, "OK");
+}
+
+/* g: レジスタ（ER0～ER7, CCR, PC） */
+static char *cmd_read_regs(void)
+{
+  kz_thread_id_t id = gdb.gthread ? gdb.gthread : kz_thread_next(0);
+  uint32 *sp = (uint32 *)kz_thread_context(id);
+  char *out = gdb.buf;
+  int i;
+
+  if (sp == NULL) {
+    /* 実行中のスレッドのレジスタは不明 */
+    for (i = 0; i < GDBSTUB_REG_NUM * 8; i++)
+      *(out++) = 'x';
+    return out;
+  }
+  for (i = 0; i < 7; i++)
+    out = put_hex(out, sp[i], 8);       /* ER0～ER6 */
+  out = put_hex(out, (uint32)(sp + 8), 8); /* ER7(SP): 割り込み前の値 */
+  out = put_hex(out, sp[7] >> 24, 8);      /* CCR */
+  out = put_hex(out, sp[7] & 0xffffff, 8); /* PC */
+  return out;
+}
+
+/* qfThreadInfo: スレッドの一覧（一度に全てを返す） */
+static char *cmd_thread_list(void)
+{
+  kz_thread_id_t id;
+  char *out = gdb.buf;
+
+  *(out++) = 'm';
+  for (id = kz_thread_next(0); id; id = kz_thread_next(id)) {
+    if (out > gdb.buf + GDBSTUB_PACKET_SIZE - 10)
+      break;
+    if (out > gdb.buf + 1)
+      *(out++) = ',';
+    out = put_hexnum(out, id);
+  }
+  return out;
+}
+
+/* qThreadExtraInfo,id: スレッド名と状態・優先度（16進数の文字列で返す） */
+static char *cmd_thread_info(char *p)
+{
+  static char *states[] = { "run", "ready", "sleep", "wait", "suspend" };
+  kz_threadstat_t stat;
+  char text[48], *t = text;
+  char *out = gdb.buf;
+
+  if (kz_getstat(parse_hex(&p), &stat) < 0)
+    return put_str(out, "E01");
+  t = put_str(t, stat.name);
+  *(t++) = ' ';
+  if ((unsigned int)stat.state < sizeof(states) / sizeof(*states))
+    t = put_str(t, states[stat.state]);
+  t = put_str(t, " pri ");
+  t = put_hexnum(t, stat.priority);
+  for (p = text; p < t; p++)
+    out = put_hex(out, *p, 2);
+  return out;
+}
+
+/* 受信したパケットを処理して、応答を gdb.buf に作る（応答しないなら NULL） */
+static char *gdbstub_command(void)
+{
+  kz_threadstat_t stat;
+  char *p = gdb.buf + 1;
+  char *out = gdb.buf;
+
+  switch (gdb.buf[0]) {
+    case '?':
+      out = put_str(out, "T00thread:");
+      out = put_hexnum(out, gdb.gthread ? gdb.gthread : kz_thread_next(0));
+      return put_str(out, ";");
+
+    case 'm':
+      return cmd_read_mem(p);
+
+    case 'M':
+      return cmd_write_mem(p);
+
+    case 'g':
+      return cmd_read_regs();
+
+    case 'H':
+      if (*(p++) == 'g')
+        gdb.gthread = thread_arg(p);
+      return put_str(out, "OK");
+
+    case 'T':
+      if (kz_getstat(thread_arg(p), &stat) < 0)
+        return put_str(out, "E01");
+      return put_str(out, "OK");
+
+    case 'c':
+    case 'C':
+      gdb.running = 1; /* ctrl+c まで応答しない */
+      return NULL;
+
+    case 's':
+    case 'S':
+      return put_str(out, "S05");
+
+    case 'D':
+      gdb.running = 0;
+      return put_str(out, "OK");
+
+    case 'k':
+      return NULL;
+
+    case 'q':
+      if (!strcmp(p, "C")) {
+        out = put_str(out, "QC");
+        return put_hexnum(out, gdb.gthread ? gdb.gthread : kz_thread_next(0));
+      }
+      if (!strcmp(p, "fThreadInfo"))
+        return cmd_thread_list();
+      if (!strcmp(p, "sThreadInfo"))
+        return put_str(out, "l");
+      if (!strncmp(p, "ThreadExtraInfo,", 16))
+        return cmd_thread_info(p + 16);
+      if (!strcmp(p, "Attached"))
+        return put_str(out, "1");
+      if (!strncmp(p, "Supported", 9)) {
+        out = put_str(out, "PacketSize=");
+        return put_hexnum(out, GDBSTUB_PACKET_SIZE);
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return out; /* 未対応のパケットには空の応答を返す */
+}
+
+/* スタブのスレッド */
+int gdbstub_main(int argc, char *argv[])
+{
+  char *end;
+  int ceiling;
+
+  gdb.id = kz_getid();
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  power_module_start(POWER_MODULE_SCI(GDBSTUB_SCI));
+  kz_unlock_ceiling(ceiling);
+  serial_init(GDBSTUB_SCI);
+  serial_set_baud(GDBSTUB_SCI, GDBSTUB_BAUD);
+  kz_setintr(SOFTVEC_TYPE_SERINTR(GDBSTUB_SCI, SERINTR_ERI), gdbstub_intr);
+  kz_setintr(SOFTVEC_TYPE_SERINTR(GDBSTUB_SCI, SERINTR_RXI), gdbstub_intr);
+  serial_intr_recv_enable(GDBSTUB_SCI);
+
+  while (1) {
+    kz_sleep(0); /* 割り込みからの kx_wakeup() を待つ */
+
+    if (gdb.brk) {
+      gdb.brk = 0;
+      if (gdb.running) {
+        gdb.running = 0;
+        send_packet("S02", 3);
+      }
+    }
+
+    if (gdb.ready == 2) {
+      send_char('-');
+      gdb.ready = 0;
+    } else if (gdb.ready) {
+      send_char('+');
+      end = gdbstub_command();
+      if (end)
+        send_packet(gdb.buf, end - gdb.buf);
+      gdb.ready = 0;
+    }
+  }
+
+  return 0;
+}
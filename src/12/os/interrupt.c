@@ -1,7 +1,12 @@
 #include "defines.h"
+#include "kozos.h"
 #include "intr.h"
 #include "interrupt.h"
 
+#define H8_3069F_P8DDR ((volatile uint8 *)0xfee007)
+
+static uint8 port8_ddr_value = PORT8_DDR_BOOT;
+
 /* ソフトウェア割り込みベクタの初期化 */
 int softvec_init(void)
 {
@@ -28,3 +33,88 @@ void interrupt(softvec_type_t type, unsigned long sp)
   if (handler)
     handler(type, sp);
 }
+
+/*
+ * 割り込みの優先レベル(H8/3069Fの割り込みコントローラ)
+ * SYSCRのUEビットを0にすると、CCRのUIビットが割り込みマスクとして働き、
+ * I=1,UI=0で優先レベル1の割り込みのみを受け付けるようになる。
+ * 優先レベルはIPRA/IPRBで割り込み要因ごとに設定する。
+ */
+#define H8_3069F_SYSCR ((volatile uint8 *)0xfee012)
+#define H8_3069F_IPRA  ((volatile uint8 *)0xfee018)
+#define H8_3069F_IPRB  ((volatile uint8 *)0xfee019)
+
+#define H8_3069F_SYSCR_UE (1<<3)
+
+/*
+ * ソフトウェア割り込みベクタごとの割り込み要因（IPRのビット）
+ * 優先レベルはSCIのチャネル単位なので、同じチャネルの4要因は同じビットになる
+ */
+#define IPR_SCI(index) { H8_3069F_IPRB, 1 << (3 - (index)) }
+
+static struct {
+  volatile uint8 *ipr;
+  uint8 mask;
+} intr_sources[SOFTVEC_TYPE_NUM] = {
+  { NULL, 0 },                                 /* SOFTERR */
+  { NULL, 0 },                                 /* SYSCALL */
+  { H8_3069F_IPRA, (1<<2) | (1<<1) | (1<<0) }, /* TIMINTR: ITU0～2 */
+  IPR_SCI(0), IPR_SCI(0), IPR_SCI(0), IPR_SCI(0), /* SCI0: ERI/RXI/TXI/TEI */
+  IPR_SCI(1), IPR_SCI(1), IPR_SCI(1), IPR_SCI(1), /* SCI1 */
+  IPR_SCI(2), IPR_SCI(2), IPR_SCI(2), IPR_SCI(2), /* SCI2 */
+  { H8_3069F_IPRA, (1<<4) },                   /* NETINTR: IRQ4,5 */
+  { H8_3069F_IPRB, (1<<0) },                   /* ADINTR: A/D */
+  { H8_3069F_IPRA, (1<<7) | (1<<6) | (1<<5) }, /* IRQINTR: IRQ0～3(IRQ4はNETINTR) */
+};
+
+/* 割り込みの優先レベルの初期化（全て優先レベル0にする） */
+KZ_COLD int intr_level_init(void)
+{
+  *H8_3069F_IPRA = 0;
+  *H8_3069F_IPRB = 0;
+  *H8_3069F_SYSCR &= ~H8_3069F_SYSCR_UE; /* UIビットを割り込みマスクとして使う */
+  return 0;
+}
+
+/* 割り込みの優先レベルの設定 */
+int intr_setlevel(softvec_type_t type, int level)
+{
+  if (!intr_sources[type].ipr)
+    return -1; /* ソフトウェア割り込みは設定できない */
+  if (level)
+    *intr_sources[type].ipr |= intr_sources[type].mask;
+  else
+    *intr_sources[type].ipr &= ~intr_sources[type].mask;
+  return 0;
+}
+
+/*
+ * 割り込みの優先レベルの取得
+ * ソフトウェア割り込み（システムコールなど）は多重割り込みを許さないので
+ * 優先レベル1として扱う
+ */
+int intr_getlevel(softvec_type_t type)
+{
+  if (!intr_sources[type].ipr)
+    return INTR_LEVEL_HIGH;
+  return (*intr_sources[type].ipr & intr_sources[type].mask)
+    ? INTR_LEVEL_HIGH : INTR_LEVEL_LOW;
+}
+
+/*
+ * P8DDR の set のビットを出力に、clear のビットを入力にする
+ * 変更前の設定値を返す（割り込みハンドラからも呼べる）
+ */
+int port8_ddr(uint8 set, uint8 clear)
+{
+  uint8 old;
+  int ceiling;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  old = port8_ddr_value;
+  port8_ddr_value = (old | set) & ~clear;
+  *H8_3069F_P8DDR = port8_ddr_value;
+  kz_unlock_ceiling(ceiling);
+
+  return old;
+}
@@ -13,9 +13,35 @@ typedef void (*softvec_handler_t)(softvec_type_t type, unsigned long sp);
 /* ソフトウェア割り込みベクタの位置 */
 #define SOFTVECS ((softvec_handler_t *)SOFTVEC_ADDR)
 
+#ifdef KZ_HOST
+/*
+ * ホスト環境でのシミュレーション(src/12/host)
+ * 割り込みはシグナルで模擬し、割り込み禁止はシグナルのブロックで行う。
+ * 多重割り込みは模擬しないので、優先レベル1の有効化は何もしない。
+ */
+void host_intr_enable(void);
+void host_intr_disable(void);
+int host_intr_is_disable(void);
+void host_trap(softvec_type_t type);
+void host_idle(void);
+void host_exit(int status);
+unsigned long host_context_init(char *stack, int size, void (*func)(void *),
+                                void *arg, int intr_disable);
+unsigned long host_fiber_init(char *stack, int size, void (*entry)(void));
+#define INTR_ENABLE  host_intr_enable()
+#define INTR_DISABLE host_intr_disable()
+#define INTR_ENABLE_HIGH
+#else
 /* 割り込み有効化・無効化 */
 #define INTR_ENABLE  asm volatile ("andc.b #0x3f,ccr")
 #define INTR_DISABLE asm volatile ("orc.b #0xc0,ccr")
+/* 優先レベル1の割り込みのみ有効化（I=1,UI=0） */
+#define INTR_ENABLE_HIGH asm volatile ("andc.b #0xbf,ccr")
+#endif
+
+/* 割り込みの優先レベル */
+#define INTR_LEVEL_LOW  0
+#define INTR_LEVEL_HIGH 1
 
 /* ソフトウェア割り込みベクタの初期化 */
 int softvec_init(void);
@@ -26,4 +52,22 @@ int softvec_setintr(softvec_type_t type, softvec_handler_t handler);
 /* 共通割り込みハンドラ */
 void interrupt(softvec_type_t type, unsigned long sp);
 
+/* 割り込みの優先レベルの初期化・設定・取得 */
+int intr_level_init(void);
+int intr_setlevel(softvec_type_t type, int level);
+int intr_getlevel(softvec_type_t type);
+
+/*
+ * ポート8のデータディレクションレジスタ(P8DDR)
+ * P81～P84 は出力にすると CS3～CS0 になり、P80～P83 は IRQ0～IRQ3 の端子を
+ * 兼ねる。P8DDR は書き込み専用なので、設定値は interrupt.c で一つだけ覚えて
+ * おき、変更はすべて port8_ddr() で行う（初期値はブートローダの dram.c が
+ * 設定する CS2 のみ）。
+ */
+#define PORT8_CS3 (1<<1) /* P81: エリア3 */
+#define PORT8_CS2 (1<<2) /* P82: エリア2(DRAMのRAS) */
+#define PORT8_CS1 (1<<3) /* P83: エリア1(RTL8019AS) */
+#define PORT8_DDR_BOOT PORT8_CS2
+int port8_ddr(uint8 set, uint8 clear);
+
 #endif
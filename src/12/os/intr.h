@@ -1,10 +1,37 @@
 #ifndef _INTR_H_INCLUDED_
 #define _INTR_H_INCLUDED_
 
-#define SOFTVEC_TYPE_NUM 3
+#define SOFTVEC_TYPE_NUM 20
+
+/* 割り込みスタックのサイズ（多重割り込みの判定に使う） */
+#define INTRSTACK_SIZE 0x100
 
 #define SOFTVEC_TYPE_SOFTERR 0 /* ソフトウェアエラー */
 #define SOFTVEC_TYPE_SYSCALL 1 /* システムコール */
-#define SOFTVEC_TYPE_SERINTR 2 /* シリアル割り込み */
+#define SOFTVEC_TYPE_TIMINTR 2 /* タイマ割り込み */
+
+/*
+ * シリアル割り込み
+ * SCI0～2のチャネルごと・要因ごとに別のソフトウェア割り込みベクタとする
+ */
+#define SERINTR_ERI 0 /* 受信エラー */
+#define SERINTR_RXI 1 /* 受信データフル */
+#define SERINTR_TXI 2 /* 送信データエンプティ */
+#define SERINTR_TEI 3 /* 送信終了 */
+#define SERINTR_NUM 4
+#define SOFTVEC_TYPE_SERINTR(index, ev) (3+(index)*SERINTR_NUM+(ev)) /* 空白を含めないこと(intr.S) */
+
+/* イーサネット割り込み（LANボードの RTL8019AS, IRQ5） */
+#define SOFTVEC_TYPE_NETINTR 15
+
+/* A/D変換終了割り込み(ADI) */
+#define SOFTVEC_TYPE_ADINTR 16
+
+/*
+ * 外部端子割り込み(IRQ0～IRQ4)
+ * 全ての端子で1つのベクタを共用し、ハンドラがISRで要因を判別する
+ * ソフトウェア割り込みベクタの領域は0x50バイト(20個)で、18～19は空き
+ */
+#define SOFTVEC_TYPE_IRQINTR 17
 
 #endif
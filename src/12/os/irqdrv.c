@@ -0,0 +1,156 @@
+#include "defines.h"
+#include "kozos.h"
+#include "intr.h"
+#include "interrupt.h"
+#include "irqdrv.h"
+
+/*
+ * 外部端子割り込みのドライバ（irqdrv.h を参照）
+ * IRQ0～IRQ4 のベクタは全て SOFTVEC_TYPE_IRQINTR にしてあり、ハンドラは
+ * ISR と IER で要因の端子を調べる。ISCR/IER/ISR は IRQ5 (rtl8019.c) と
+ * 共用なので、スレッドからの変更は割り込みをマスクして行う。
+ */
+
+#define H8_3069F_ISCR  ((volatile uint8 *)0xfee014)
+#define H8_3069F_IER   ((volatile uint8 *)0xfee015)
+#define H8_3069F_ISR   ((volatile uint8 *)0xfee016)
+
+/* IRQ0～IRQ3 の端子(P80～P83)。irqdrv_trigger() で使う（P8DDR は port8_ddr()） */
+#define H8_3069F_P8DR  ((volatile uint8 *)0xffffd7)
+
+#define IRQDRV_MASK ((1 << IRQDRV_NUM) - 1)
+
+static struct irqreg {
+  kz_thread_id_t id; /* 登録したスレッド（0なら未登録） */
+  uint8 sense;
+  uint32 count;      /* 割り込みの回数 */
+} irqreg[IRQDRV_NUM];
+
+static int irqdrv_ready;
+
+/* 外部端子割り込み */
+static void irqdrv_intr(int type)
+{
+  struct irqreg *irq;
+  uint8 status;
+  int i;
+
+  status = *H8_3069F_ISR & *H8_3069F_IER & IRQDRV_MASK;
+
+  for (i = 0; status; i++, status >>= 1) {
+    if (!(status & 1))
+      continue;
+    irq = &irqreg[i];
+    /* レベル検出の端子は、要因が取り除かれるまで禁止しておく */
+    if (irq->sense == IRQDRV_SENSE_LEVEL)
+      *H8_3069F_IER &= ~(1 << i);
+    *H8_3069F_ISR &= ~(1 << i);
+    irq->count++;
+    if (irq->id)
+      kx_wakeup(irq->id);
+  }
+}
+
+/* 呼び出したスレッドを irq の端子に登録して、割り込みを許可する */
+int irqdrv_attach(int irq, int sense)
+{
+  int ceiling;
+
+  if ((irq < 0) || (irq >= IRQDRV_NUM) || irqreg[irq].id)
+    return KZ_ERR_PARAM;
+
+  if (!irqdrv_ready) {
+    kz_setintr(SOFTVEC_TYPE_IRQINTR, irqdrv_intr);
+    irqdrv_ready = 1;
+  }
+
+  irqreg[irq].id = kz_getid();
+  irqreg[irq].sense = sense;
+  irqreg[irq].count = 0;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  if (sense == IRQDRV_SENSE_EDGE)
+    *H8_3069F_ISCR |= (1 << irq);
+  else
+    *H8_3069F_ISCR &= ~(1 << irq);
+  *H8_3069F_ISR &= ~(1 << irq);
+  *H8_3069F_IER |= (1 << irq);
+  kz_unlock_ceiling(ceiling);
+
+  return 0;
+}
+
+/* 割り込みを禁止して、登録を解除する */
+int irqdrv_detach(int irq)
+{
+  int ceiling;
+
+  if ((irq < 0) || (irq >= IRQDRV_NUM) || !irqreg[irq].id)
+    return KZ_ERR_PARAM;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  *H8_3069F_IER &= ~(1 << irq);
+  *H8_3069F_ISR &= ~(1 << irq);
+  irqreg[irq].id = 0;
+  kz_unlock_ceiling(ceiling);
+
+  return 0;
+}
+
+/*
+ * 割り込みを待つ（登録したスレッドから呼ぶ）
+ * ticks と戻り値は kz_sleep() と同じ（0なら割り込みまで待つ）。
+ */
+int irqdrv_wait(int irq, int ticks)
+{
+  int ceiling;
+
+  if ((irq < 0) || (irq >= IRQDRV_NUM) || (irqreg[irq].id != kz_getid()))
+    return KZ_ERR_PARAM;
+
+  if (irqreg[irq].sense == IRQDRV_SENSE_LEVEL) {
+    ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+    *H8_3069F_IER |= (1 << irq);
+    kz_unlock_ceiling(ceiling);
+  }
+
+  return kz_sleep(ticks);
+}
+
+/* 割り込みの回数（登録からの通算） */
+uint32 irqdrv_count(int irq)
+{
+  if ((irq < 0) || (irq >= IRQDRV_NUM))
+    return 0;
+  return irqreg[irq].count;
+}
+
+/*
+ * 端子に立ち下がりエッジを出力して割り込みを起こす（ベンチマーク用）
+ * IRQ端子は出力にしていても入力の変化を検出するので、一時的に出力に
+ * して High → Low → High とする。外部に何もつないでいない端子で使うこと。
+ * IRQ4 は SCK1 と共用なので使えない。チップセレクトとして出力にしている
+ * 端子(P81～P83 の CS3～CS1)は、切り替えるとそのエリアにアクセスできなく
+ * なるので KZ_ERR_STATE を返す。
+ */
+int irqdrv_trigger(int irq)
+{
+  int ceiling;
+
+  if ((irq < 0) || (irq > 3))
+    return KZ_ERR_PARAM;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  if (port8_ddr(0, 0) & (1 << irq)) {
+    kz_unlock_ceiling(ceiling);
+    return KZ_ERR_STATE;
+  }
+  *H8_3069F_P8DR |= (1 << irq);
+  port8_ddr(1 << irq, 0);
+  *H8_3069F_P8DR &= ~(1 << irq);
+  *H8_3069F_P8DR |= (1 << irq);
+  port8_ddr(0, 1 << irq);
+  kz_unlock_ceiling(ceiling);
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef _IRQDRV_H_INCLUDED_
+#define _IRQDRV_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * 外部端子割り込みのドライバ（IRQ0～IRQ4, irqdrv.c, make IRQDRV=1 で組み込む）
+ * 端子ごとに1つのスレッドを登録し、割り込みが入ったら kx_wakeup() で
+ * 起こす。メッセージを獲得しないので、割り込みから起床までが短い。
+ * ウェイクアップの要求は保留されるので(kz_sleep() を参照)、スレッドが
+ * 処理中に入った割り込みも失われない。IRQ5 はLANボードが使う。
+ *
+ * ・irqdrv_attach(): 呼び出したスレッドを登録して、割り込みを許可する
+ * ・irqdrv_wait():   割り込みを待つ（kz_sleep() の ticks と戻り値）
+ * ・irqdrv_detach(): 割り込みを禁止して、登録を解除する
+ *
+ * レベル検出の端子は、割り込みが入ったらハンドラが禁止し、次の
+ * irqdrv_wait() で許可し直す（それまでに要因を取り除くこと）。
+ */
+
+#define IRQDRV_NUM 5
+
+#define IRQDRV_SENSE_LEVEL 0 /* Lowレベルで検出 */
+#define IRQDRV_SENSE_EDGE  1 /* 立ち下がりエッジで検出 */
+
+int irqdrv_attach(int irq, int sense);
+int irqdrv_detach(int irq);
+int irqdrv_wait(int irq, int ticks);
+uint32 irqdrv_count(int irq);
+int irqdrv_trigger(int irq);
+
+#endif
@@ -4,7 +4,31 @@
 #include "interrupt.h"
 #include "syscall.h"
 #include "memory.h"
+#include "dram.h"
+#include "timer.h"
+#include "trace.h"
+#include "prof.h"
+#include "crashdump.h"
+#include "bootinfo.h"
+#ifdef KZ_SYMTAB
+#include "symtab.h"
+#endif
+#ifdef KZ_LOG
+#include "log.h"
+#endif
+#ifdef KZ_WDT
+#include "wdt.h"
+#endif
+#ifndef KZ_HOST
+#include "power.h"
+#endif
 #include "lib.h"
+#include "queue.h"
+
+/* ソフトウェアスタンバイ(power.c)はH8のみ */
+#if defined(KZ_STANDBY) && defined(KZ_HOST)
+#undef KZ_STANDBY
+#endif
 
 /*******************************
  * OS の本体
@@ -13,9 +37,76 @@
  *  割り込み処理
  *******************************/
 
-#define  THREAD_NUM 6
-#define PRIORITY_NUM 16
-#define  THREAD_NAME_SIZE 15
+/*
+ * スレッドやメッセージボックスなどのテーブルの大きさは kozos_config.h で
+ * 設定する（Makefileの CFLAGS で -DTHREAD_NUM=8 などとしてもよい）
+ */
+
+/*
+ * スレッド名を付けたメッセージの出力（msg は文字列の定数）
+ * KZ_LOG ならばロガースレッドに任せて、シリアルの送信を待たない。
+ * 停止する直前のもの(kz_sysdown())は、ロガーが動けないので puts() のまま。
+ */
+#ifdef KZ_LOG
+#define THREAD_MESSAGE(thp, msg) kz_log("%s" msg, 0, 0, (thp)->name)
+#else
+#define THREAD_MESSAGE(thp, msg) (puts((thp)->name), puts(msg))
+#endif
+
+/* レディキューのビットマップが16ビットのため */
+#if PRIORITY_NUM > 16
+#error "PRIORITY_NUM must be 16 or less"
+#endif
+
+/*
+ * EDFスケジューリング（Makefileの CFLAGS で -DKZ_EDF_PRIORITY=n とする）
+ * 優先度 n のレディキューだけは、kz_setdeadline() で設定した締め切りの
+ * 早い順に並べる（他の優先度は従来通りの固定優先度でFIFO）
+ */
+#if defined(KZ_EDF_PRIORITY) && (KZ_EDF_PRIORITY >= PRIORITY_NUM)
+#error "KZ_EDF_PRIORITY must be less than PRIORITY_NUM"
+#endif
+
+/*
+ * スタックのサイズクラス
+ * STACK_CLASS_MIN(0x100) から倍々の4種類で、要求サイズは切り上げる
+ */
+#define STACK_CLASS_NUM 4
+
+/*
+ * CPU負荷の測定
+ * LOAD_SAMPLE_TICKS ティックごとにアイドルスレッドのスリープ時間から負荷を求め、
+ * 直近 LOAD_WINDOW 回分を保持する
+ */
+#define LOAD_SAMPLE_TICKS 100
+#define LOAD_WINDOW 8
+
+/* スタックの使用量を測定するために、獲得時に書き込んでおくパターン */
+#define STACK_FILL_PATTERN 0xa5
+
+#ifdef KZ_STACK_CANARY
+/*
+ * スタックの溢れの検出（スタック領域の先頭＝最も深い位置に置く値）
+ * スレッドが割り込まれるたびに確認し、書き換えられていれば
+ * そのスレッドをソフトウェアエラーとして終了させる。
+ */
+#define STACK_CANARY 0xdeadbeefUL
+#define STACK_CANARY_SIZE sizeof(uint32)
+#define STACK_BOTTOM(thp) \
+  ((uint32 *)((thp)->stack - (STACK_CLASS_MIN << (thp)->stackclass)))
+#else
+#define STACK_CANARY_SIZE 0
+#endif
+
+/*
+ * 割り込みスタック（ld.scr の intrstack から INTRSTACK_SIZE バイト）
+ * kz_start() で未使用の部分をパターンで埋めておき、使用量を測定する。
+ * KZ_STACK_CANARY ならば先頭にカナリアを置き、割り込みのたびに確認する。
+ */
+#ifndef KZ_HOST
+#define INTRSTACK_BOTTOM() (&intrstack - INTRSTACK_SIZE)
+extern char intrstack;
+#endif
 
 /*
  * スレッドコンテキスト
@@ -25,7 +116,7 @@
  * スタックポインタのみ保持する
  */
 typedef struct _kz_context {
-  uint32 sp;
+  unsigned long sp;
 } kz_context;
 
 /*
@@ -35,11 +126,33 @@ typedef struct _kz_context {
  */
 typedef struct _kz_thread {
   struct _kz_thread *next;
+  kz_thread_id_t id;               /* スレッドID（未使用のTCBでは0） */
+  int index;                       /* TCBの番号（クリアしても残す） */
   char name[THREAD_NAME_SIZE + 1]; /* スレッド名 */
-  int priority;                    /* 優先度 */
+  int priority;                    /* 優先度（優先度継承を含む実効値） */
+  int base_priority;               /* 本来の優先度 */
+  int slice;                       /* タイムスライスの残りティック数 */
   char *stack;                     /* スタック */
+  int stackclass;                  /* スタックのサイズクラス */
   uint32 flags;                    /* 各種フラグ */
   #define KZ_THREAD_FLAG_READY (1 << 0)
+  #define KZ_THREAD_FLAG_TIMER (1 << 1) /* タイマ待ちキューに接続中 */
+  #define KZ_THREAD_FLAG_REPLY (1 << 2) /* kz_call()の返信待ち */
+  #define KZ_THREAD_FLAG_ZOMBIE (1 << 3) /* 終了済みで、kz_join()されていない */
+  #define KZ_THREAD_FLAG_SLEEP (1 << 4) /* kz_sleep()でスリープ中 */
+  #define KZ_THREAD_FLAG_DONATED (1 << 5) /* kz_wait_for()で優先度を借りている */
+  #define KZ_THREAD_FLAG_HELD (1 << 6) /* 中断中にレディになり、kz_resume()待ち */
+  #define KZ_THREAD_FLAG_STATIC (1 << 7) /* スタックが静的(KZ_THREAD_DEFINE()) */
+  /* 起動時の属性(KZ_THREAD_ATTR_*)は、同じビットのフラグにする */
+  #define KZ_THREAD_FLAG_INTRMASK KZ_THREAD_ATTR_INTRMASK
+  #define KZ_THREAD_FLAG_KERNEL   KZ_THREAD_ATTR_KERNEL
+  #define KZ_THREAD_FLAG_DRAM     KZ_THREAD_ATTR_DRAM
+  #define KZ_THREAD_FLAG_THROTTLED (1 << 11) /* CPUの割り当てを使い切って停止中 */
+  #define KZ_THREAD_FLAG_STRACE (1 << 12) /* システムコールをトレースする(kz_strace()) */
+  int wakeup_count;                /* 保留中のkz_wakeup()の数 */
+  #define WAKEUP_COUNT_MAX 127
+  int suspend_count;               /* kz_suspend()のネストの数 */
+  #define SUSPEND_COUNT_MAX 127
 
    /* スレッド起動時のパラメータ */
   struct {
@@ -54,10 +167,88 @@ typedef struct _kz_thread {
     kz_syscall_param_t *param;
   } syscall;
 
+  /*
+   * タイマ待ちのパラメータ
+   * タイマ待ちキューは起床時刻の順に並べ、delta には
+   * 直前のスレッドの起床時刻からの相対ティック数を格納する
+   */
+  struct {
+    struct _kz_thread *next;
+    int delta;
+  } timer;
+
+  /*
+   * 待ち状態で接続されているキュー（メッセージボックスの受信待ちなど）
+   * 待ち状態のスレッドはレディキューに繋がっていないので、キューの接続には
+   * next を利用する。
+   */
+  struct _kz_thread **waitque;
+
+  /* 獲得中のmutexのリスト */
+  struct _kz_mutex *mutex;
+
+  /*
+   * 死活監視（kz_heartbeat() で登録する）
+   * period が0でなければ、deadline のティックまでに次の kz_heartbeat() が必要
+   */
+  struct {
+    int period;
+    uint32 deadline;
+  } heartbeat;
+
+  /*
+   * 周期起動（kz_setperiod() で設定する）
+   * ticks が0でなければ、kz_wait_period() で release のティックまで待つ
+   */
+  struct {
+    int ticks;
+    uint32 release;
+    uint32 overruns; /* 起動時刻に間に合わなかった周期の数 */
+  } period;
+
+  uint32 deadline; /* 締め切りのティック（KZ_EDF_PRIORITY のレディキューの順序） */
+
+#ifdef KZ_BUDGET
+  /*
+   * CPU時間の割り当て（kz_setbudget() で設定する）
+   * period が0でなければ、release のティックから period ティックごとに
+   * ticks ティックまで実行できる（left は今の周期の残り）
+   */
+  struct {
+    int ticks;
+    int period;
+    int left;
+    uint32 release;
+    uint32 throttles; /* 使い切って停止した回数 */
+  } budget;
+#endif
+
+  void *tls[KZ_TLS_NUM];     /* スレッドごとのユーザ領域（kz_tls_get()） */
+
+  int exit_status;           /* スレッドの関数の戻り値（終了後も保持する） */
+  struct _kz_thread *joiner; /* kz_join()で終了を待っているスレッド */
+
+#ifdef KZ_KMALLOC_OWNER
+  /* 獲得した動的メモリのリスト（スレッドの終了時に解放する） */
+  struct _kz_memowner *memlist;
+#endif
+
+  /* 統計情報（kz_getstat()で取得する） */
+  struct {
+    uint32 runticks;    /* 実行中にタイマ割り込みを受けた回数 */
+    uint32 dispatches;  /* ディスパッチされた回数 */
+    uint32 voluntary;   /* システムコールによる切り替えの回数 */
+    uint32 involuntary; /* 割り込みによる切り替え（横取り）の回数 */
+    uint32 syscalls;    /* 発行したシステムコールの回数 */
+  } stat;
+
   /* スレッドのコンテキスト情報の格納領域 */
   kz_context context;
 } kz_thread;
 
+/* トレースに記録するスレッドID（割り込み処理などでスレッドがなければ0） */
+#define TRACE_ID(thp) ((thp) ? (thp)->id : KZ_THREAD_ID_INTR)
+
 /* メッセージバッファ */
 typedef struct _kz_msgbuf {
   struct _kz_msgbuf *next;
@@ -68,45 +259,411 @@ typedef struct _kz_msgbuf {
     int size;
     char *p;
   } param;
+
+  /* 受信したスレッドに領域の所有権を移す(KZ_KMALLOC_OWNER) */
+  int owned;
+
+  /* メッセージの優先度（小さいものほど先に受信される） */
+  int priority;
+
+  /*
+   * kz_send_inline() で送信された小さいメッセージの本体
+   * (param.p がここを指していれば、受信時に受信側のバッファにコピーする)
+   */
+  char data[KZ_MSG_INLINE_SIZE];
+
+  /* ソフトウェアタイマの埋め込みメッセージならば、そのタイマ（解放しない） */
+  struct _kz_swtimer *timer;
+
+#ifdef KZ_MBOX_STAT
+  uint32 sent; /* メッセージボックスに接続した時刻(kz_gettime()) */
+#endif
 } kz_msgbuf;
 
+#ifdef KZ_KMALLOC_OWNER
+/*
+ * スレッドが獲得した動的メモリの管理ヘッダ
+ * kz_kmalloc() で獲得した領域の先頭に置いて、獲得したスレッドのリストに
+ * つなぐ。スレッドの終了時には、リストに残っている領域をまとめて解放する。
+ * メッセージとして送信した領域は、受信したスレッドのリストにつなぎ替える。
+ */
+typedef struct _kz_memowner {
+  struct _kz_memowner *next;
+  struct _kz_memowner **pprev; /* リストの直前の next（所有者なしなら NULL） */
+} kz_memowner;
+#endif
+
 /* メッセージボックス */
 typedef struct _kz_msgbox {
-  /* 受信待ち状態のスレッド */
+  /* 受信待ち状態のスレッドのキュー（先頭のスレッド） */
   kz_thread *receiver;
+  /* 送信待ち状態のスレッドのキュー（先頭のスレッド） */
+  kz_thread *sender;
   kz_msgbuf *head;
   kz_msgbuf *tail;
-
-  /*
-   * H8は16ビットCPUなので32ビット整数に対しての乗算命令がない。
-   * よって構造体のサイズが2の累乗になっていないと、
-   * 構造体の配列のインデックス計算で乗算が使われて"__mulsi3"がないなどの
-   * リンクエラーになる場合がある。（2の累乗であればシフト演算が利用されるので問題はでない）
-   * 対策としてサイズが2の累乗になるようにダミーメンバで調整する。
-   * 他構造体で同様のエラーが出た場合には同様の対処をすること。
-   */
-  long dummy[1];
+  int count;    /* 格納されているメッセージ数 */
+  int attr;     /* 属性(KZ_MSGBOX_ATTR_*) */
+  int capacity; /* 格納できる最大メッセージ数（0なら無制限） */
+  int flags;    /* 各種フラグ */
+  #define KZ_MSGBOX_FLAG_USED (1 << 0) /* 使用中 */
 } kz_msgbox;
 
+/* セマフォ */
+typedef struct _kz_sem {
+  /* 獲得待ち状態のスレッドのキュー（先頭のスレッド） */
+  kz_thread *waiter;
+  int count; /* 資源数 */
+  int flags; /* 各種フラグ */
+  #define KZ_SEM_FLAG_USED (1 << 0) /* 使用中 */
+} kz_sem;
+
+/* mutex */
+typedef struct _kz_mutex {
+  kz_thread *owner;  /* 獲得しているスレッド */
+  /* 獲得待ち状態のスレッドのキュー（優先度順） */
+  kz_thread *waiter;
+  /* 所有スレッドが獲得している他のmutex */
+  struct _kz_mutex *next;
+  int flags; /* 各種フラグ */
+  #define KZ_MUTEX_FLAG_USED (1 << 0) /* 使用中 */
+} kz_mutex;
+
+/* イベントフラグ */
+typedef struct _kz_flag {
+  /* 待ち状態のスレッドのキュー（FIFO） */
+  kz_thread *waiter;
+  uint16 pattern; /* フラグのビットパターン */
+  int flags;      /* 各種フラグ */
+  #define KZ_FLAG_FLAG_USED (1 << 0) /* 使用中 */
+} kz_flag;
+
+/*
+ * トピック（1つのメッセージを購読しているメッセージボックスの全てに配信する）
+ * 配信するのは kz_topic_alloc() で獲得した領域で、その先頭の管理ヘッダで
+ * 配信先の数を参照カウントとして持つ。領域はコピーせずに全ての配信先で
+ * 共有し、最後の受信者が kz_topic_release() したときに解放する。
+ */
+#if MSGBOX_NUM > 16
+#error "MSGBOX_NUM must not exceed the bits of kz_topic.subscribers"
+#endif
+typedef struct _kz_topic {
+  uint16 subscribers; /* 購読しているメッセージボックスのビットマップ */
+  int flags;          /* 各種フラグ */
+  #define KZ_TOPIC_FLAG_USED (1 << 0) /* 使用中 */
+} kz_topic;
+
+/* kz_topic_alloc() で獲得した領域の管理ヘッダ */
+typedef struct {
+  uint32 refs;  /* 受信者が解放していない配信の数 */
+  uint32 dummy; /* ホスト環境でも本体の境界を揃えるためのダミー */
+} kz_topicbuf;
+
+/*
+ * リングバッファ（割り込みハンドラから1つのスレッドへのバイト列の受け渡し）
+ * 書き込みは割り込みハンドラのみ(head)、読み出しは1つのスレッドのみ(tail)
+ * が行うので、どちらも排他せずに直接操作する（システムコールを使わない）。
+ * 読み出し側のスレッドは空のときだけ kz_ring_wait() で待ち、threshold バイト
+ * たまるか、他に動作するスレッドがなくなったとき(kz_idle())に起こされる。
+ */
+typedef struct _kz_ring {
+  kz_thread *reader;     /* kz_ring_wait() で待っているスレッド */
+  char *buf;
+  int mask;              /* サイズ-1（サイズは2の累乗） */
+  volatile int head;     /* 次に書き込む位置（割り込みハンドラが更新） */
+  volatile int tail;     /* 次に読み出す位置（スレッドが更新） */
+  int threshold;         /* 待っているスレッドを起こすバイト数 */
+  int flags;             /* 各種フラグ */
+  #define KZ_RING_FLAG_USED (1 << 0) /* 使用中 */
+  uint16 overruns;       /* 満杯で書き込めなかったバイト数 */
+} kz_ring;
+
+/*
+ * ソフトウェアタイマ
+ * 満了時に、func があればタイマ割り込みの延長で呼び出し、なければ
+ * 埋め込みのメッセージバッファをメッセージボックスに送信する
+ * (メッセージバッファのプールを使わないので、満了時に資源不足にならない)。
+ * 満了時刻の順に、相対ティック数で swtimerque に接続する。
+ */
+typedef struct _kz_swtimer {
+  struct _kz_swtimer *next;
+  int delta;            /* 前のタイマからの相対ティック数 */
+  int ticks;            /* 満了までのティック数（周期） */
+  int periodic;         /* 真ならば周期タイマ */
+  int flags;            /* 各種フラグ */
+  #define KZ_SWTIMER_FLAG_USED   (1 << 0) /* 使用中 */
+  #define KZ_SWTIMER_FLAG_QUEUED (1 << 1) /* swtimerque に接続中 */
+  #define KZ_SWTIMER_FLAG_SENT   (1 << 2) /* 送信したメッセージが未受信 */
+  kz_timer_id_t id;
+  kz_msgbox_id_t box;   /* 送信先のメッセージボックス */
+  kz_defer_func_t func; /* 満了時に呼び出す関数 */
+  char *p;              /* メッセージのポインタ（funcの引数） */
+  uint32 overruns;      /* 前のメッセージが受信される前に満了した回数 */
+  kz_msgbuf msg;
+} kz_swtimer;
+
 /* スレッドのレディキュー */
 static struct {
   kz_thread *head;
   kz_thread *tail;
 } readyque[PRIORITY_NUM];
 
+/*
+ * レディキューのビットマップ
+ * 優先度nのレディキューにスレッドが存在する場合にビットnを立てる。
+ * (PRIORITY_NUM は16以下であること)
+ */
+static uint16 readyque_bitmap;
+
+/*
+ * 8ビット値の最下位の立っているビット番号を引くためのテーブル
+ * (ビット0が最も優先度が高い。インデックス0は使用しない)
+ */
+static const uint8 bitmap_ffs[256] = {
+  0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  7, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+  4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+};
+
 /* カレントスレッド */
 static kz_thread *current;
 
+/*
+ * 割り込みのネスト数と、優先レベル1の割り込みを受け付けているか
+ * (優先レベル0の割り込みハンドラの実行中のみ受け付ける)
+ */
+static int intr_nest;
+static int intr_open;
+
+/*
+ * システムコール以外の割り込みで割り込まれたスレッドと、その割り込みで
+ * スケジューリングが必要になったか（割り込まれたスレッドより先に
+ * 動作すべきスレッドがレディになった場合に putcurrent() で立てる）
+ */
+static kz_thread *intr_thread;
+static int intr_resched;
+
+/* システムティック（起動時からのタイマ割り込みの回数） */
+static uint32 systicks;
+
+/*
+ * ティックレスアイドル
+ * アイドルスレッドしか動作できない間は、次のタイマ待ちの起床時刻まで
+ * タイマ割り込みの周期を延ばしてスリープする。
+ * tick_count: 1ティックのカウント数, tickless_max: 延ばせる最大ティック数
+ * tickless: 延ばしているティック数（0なら通常動作）
+ */
+static uint16 tick_count;
+static int tickless_max;
+static int tickless;
+
+#ifdef KZ_STANDBY
+/*
+ * ソフトウェアスタンバイ(kz_standby() を参照)
+ * standby_enable: 許可されているか, standby: スタンバイ中か
+ */
+static int standby_enable;
+static int standby;
+#endif
+
+/*
+ * 高分解能の時刻（kz_gettime()）
+ * ティックのタイマのカウンタが最後にクリアされた時点の、起動からの通算の
+ * カウント数。タイマ割り込みごとに1ティック分を加え、ティックレスアイドルから
+ * 戻ったときは経過したティックの分を加える（乗算は16ビット×16ビットのみ）。
+ */
+static uint32 time_base;
+
+/*
+ * カーネル全体の性能カウンタ（kz_perfstat()）
+ * 加算のみで、システムコールの種類ごとの回数は別の配列で数える
+ */
+#if SOFTVEC_TYPE_NUM > KZ_PERFSTAT_INTR_NUM
+#error "KZ_PERFSTAT_INTR_NUM is smaller than SOFTVEC_TYPE_NUM"
+#endif
+static kz_perfstat_t perf;
+static uint32 perf_syscalls[KZ_SYSCALL_TYPE_NUM];
+
+/*
+ * CPU負荷の測定
+ * アイドルスレッドがスリープしていた時間をタイマのカウント数で積算し、
+ * 測定期間ごとに負荷（1000分率）に変換して保存する
+ */
+static struct {
+  int sleeping;         /* アイドルスレッドがスリープ中か */
+  uint32 start_ticks;   /* スリープ開始時のシステムティック */
+  uint16 start_count;   /* スリープ開始時のタイマのカウンタ値 */
+  int ticks;            /* 現在の測定期間の経過ティック数 */
+  uint32 idle;          /* 現在の測定期間のスリープ時間の合計（カウント数） */
+  uint32 unit;          /* 測定期間の1000分の1のカウント数 */
+  uint16 samples[LOAD_WINDOW]; /* 直近の測定期間ごとの負荷（1000分率） */
+  int pos;              /* 次に書き込む位置 */
+  int num;              /* 保存されている測定期間の数 */
+} load;
+
+/* タイマ待ちキュー（先頭が次に起床するスレッド） */
+static kz_thread *timerque;
+
+/*
+ * 優先度ごとのタイムスライス（ティック数）
+ * 0 の場合はタイムスライスによる切り替えを行わない（デフォルト）
+ */
+static int timeslice[PRIORITY_NUM];
+
 /* タスクコントロールブロックのリスト */
-static kz_thread threads[THREAD_NUM];
+typedef KZ_TABLE_ELEMENT(kz_thread) kz_thread_elem;
+static kz_thread_elem threads[THREAD_NUM];
+#define THREAD(index) (&threads[index].e)
+KZ_TABLE_ASSERT(kz_thread_elem, thread_elem);
+
+/* 未使用のタスクコントロールブロックのリスト（nextで接続する） */
+static kz_thread *thread_freelist;
+
+/*
+ * スレッドID
+ * 下位8ビットがTCBの番号で、上位はkz_run()ごとに進める世代番号とする。
+ * 終了したスレッドのIDで、TCBを再利用した別のスレッドを操作しないように
+ * システムコールでは thread_find() でIDを検査する
+ * (世代番号は16ビットで一周するまで重複しない)。
+ */
+#define THREAD_ID_INDEX_BITS 8
+#define THREAD_ID_INDEX_MASK ((1 << THREAD_ID_INDEX_BITS) - 1)
+#define THREAD_ID(thp) ((thp) ? (thp)->id : 0)
+static uint16 thread_generation;
+
+/* スレッドIDからTCBを得る（無効なIDならNULL） */
+static kz_thread *thread_find(kz_thread_id_t id)
+{
+  int index = id & THREAD_ID_INDEX_MASK;
+
+  if (!id || (index >= THREAD_NUM) || (THREAD(index)->id != id))
+    return NULL;
+  return THREAD(index);
+}
+
+/* TCBのゼロクリア（TCBの番号は残す） */
+static void thread_clear(kz_thread *thp)
+{
+  int index = thp->index;
+  memset(thp, 0, sizeof(*thp));
+  thp->index = index;
+}
+
+/*
+ * スタック領域
+ * userstack から順に切り出し、スレッドの終了時にはサイズクラスごとの
+ * 解放済みリストに戻して再利用する。（解放済み領域の先頭に次の領域を格納する）
+ */
+static char *stack_area;
+static char *stack_freelist[STACK_CLASS_NUM];
 
 /* 割り込みハンドラのリスト */
 static kz_handler_t handlers[SOFTVEC_TYPE_NUM];
-/* メッセージボックスのリスト */
-static kz_msgbox msgboxes[MSGBOX_ID_NUM];
+/*
+ * メッセージボックスのリスト
+ * 先頭の MSGBOX_ID_NUM 個は defines.h で定義される固定IDのもので、
+ * 残りは kz_mbox_create() で動的に割り当てる。
+ */
+typedef KZ_TABLE_ELEMENT(kz_msgbox) kz_msgbox_elem;
+static kz_msgbox_elem msgboxes[MSGBOX_NUM];
+#define MSGBOX(id) (&msgboxes[id].e)
+#define MSGBOX_ID(mboxp) ((kz_msgbox_elem *)(mboxp) - msgboxes)
+
+/*
+ * kz_recv_any() で複数のメッセージボックスを受信待ちしているスレッドのキュー
+ * (待っているメッセージボックスのビットマップは、システムコールのパラメータ)
+ */
+#if MSGBOX_NUM > 16
+#error "MSGBOX_NUM must not exceed the bits of the kz_recv_any() mask"
+#endif
+static kz_thread *recvany_receiver;
+
+/*
+ * メッセージバッファのプール
+ * 送受信のたびに動的メモリを使わないように、専用の解放済みリストで管理する
+ */
+static kz_msgbuf msgbufs[MSGBUF_NUM];
+static kz_msgbuf *msgbuf_free;
+
+/*
+ * メッセージボックスごとの取り置き(kz_mbox_reserve())
+ * 共有のプールから取り置いたメッセージバッファと本体の領域で、他のボックスへの
+ * 送信で共有のプールが尽きても、このボックスへの送信は取り置きを使える。
+ * 取り置きが減っていれば、受信や kz_mbox_free() のときに共有のプールより先に
+ * 取り置きに戻す（取り置く数は一定のまま）。
+ */
+typedef struct {
+  kz_msgbuf *nodes; /* 取り置いたメッセージバッファのリスト */
+  int nodes_num;    /* 現在の数 */
+  int nodes_max;    /* 取り置く数 */
+  void *blocks;     /* 取り置いた本体の領域のリスト（先頭をリンクに使う） */
+  int blocks_num;
+  int blocks_max;
+  int blocksize;    /* 本体の領域のサイズ */
+} kz_mboxres;
+static KZ_TABLE_ELEMENT(kz_mboxres) mboxres[MSGBOX_NUM];
+#define MBOXRES(id) (&mboxres[id].e)
+
+#ifdef KZ_MBOX_STAT
+/*
+ * メッセージボックスごとの統計情報（kz_mbox_stat()）
+ * kz_msgbox は2の累乗のサイズにしているので、別の配列にする。
+ * count は kz_msgbox のものを取得時に設定する。
+ */
+static kz_mboxstat_t mboxstat[MSGBOX_NUM];
+#endif
+
+/* セマフォのリスト */
+static kz_sem sems[SEM_NUM];
+
+/* mutexのリスト */
+static KZ_TABLE_ELEMENT(kz_mutex) mutexes[MUTEX_NUM];
+#define MUTEX(id) (&mutexes[id].e)
+
+/* イベントフラグのリスト */
+static kz_flag eventflags[FLAG_NUM];
+
+#if KZ_CONFIG_SWTIMER
+/* ソフトウェアタイマのリストと、満了待ちのキュー（先頭が次に満了するもの） */
+static kz_swtimer swtimers[SWTIMER_NUM];
+static kz_swtimer *swtimerque;
+#else
+/* 満了待ちのタイマは常にない（ティックレスの処理などで参照する箇所は消える） */
+#define swtimerque ((kz_swtimer *)NULL)
+#endif
+
+#if KZ_CONFIG_TOPIC
+/* トピックのリスト */
+static kz_topic topics[TOPIC_NUM];
+#endif
+
+/*
+ * リングバッファのリストと、しきい値未満のデータを待っているスレッドが
+ * あることのフラグ（kz_idle() で起こす）
+ */
+static kz_ring rings[RING_NUM];
+static volatile int ring_pending;
 
 void dispatch(kz_context *context);
 
+static void readyque_remove(kz_thread *thp);
+static void waitque_insert(kz_thread **quep, kz_thread *thp, int priority);
+static void waitque_remove(kz_thread *thp);
+static kz_mutex *thread_waiting_mutex(kz_thread *thp);
+static void mutex_pass(kz_mutex *mtxp);
+
 /* カレントスレッドをレディキューから抜き出す */
 static int getcurrent(void)
 {
@@ -118,10 +675,19 @@ static int getcurrent(void)
     return 1;
   }
 
+#ifdef KZ_EDF_PRIORITY
+  /* 締め切りの早いスレッドが先頭に割り込んでいる場合がある */
+  if (readyque[current->priority].head != current) {
+    readyque_remove(current);
+    return 0;
+  }
+#endif
+
   /* カレントスレッドは必ず先頭にあるはずなので、先頭から抜き出す */
-  readyque[current->priority].head = current->next;
-  if (readyque[current->priority].head == NULL) {
-    readyque[current->priority].tail = NULL;
+  KZ_QUEUE_GET(&readyque[current->priority], next);
+  if (KZ_QUEUE_EMPTY(&readyque[current->priority])) {
+    /* レディキューが空になったのでビットを落とす */
+    readyque_bitmap &= ~(1 << current->priority);
   }
   current->flags &= ~KZ_THREAD_FLAG_READY;
   current->next = NULL;
@@ -129,6 +695,23 @@ static int getcurrent(void)
   return 0;
 }
 
+#ifdef KZ_EDF_PRIORITY
+/*
+ * EDFのレディキューに、締め切りの順に接続する（同じ締め切りならFIFO）
+ * 締め切りの比較は、ティックの一周を考慮して差の符号で行う
+ */
+static void edf_insert(kz_thread *thp)
+{
+  kz_thread **thpp;
+
+  for (thpp = &readyque[KZ_EDF_PRIORITY].head; *thpp; thpp = &(*thpp)->next) {
+    if ((thp->deadline - (*thpp)->deadline) & 0x80000000)
+      break;
+  }
+  KZ_QUEUE_INSERT(&readyque[KZ_EDF_PRIORITY], thpp, thp, next);
+}
+#endif
+
 /* カレントスレッドをレディキューに繋げる */
 static int putcurrent(void)
 {
@@ -141,576 +724,4963 @@ static int putcurrent(void)
     return 1;
   }
 
-  /* レディキューの末尾に接続する */
-  if (readyque[current->priority].tail) {
-    readyque[current->priority].tail->next = current;
-  } else {
-    readyque[current->priority].head = current;
+  /* kz_suspend() されていれば、kz_resume() されるまでレディキューに繋がない */
+  if (current->suspend_count) {
+    current->flags |= KZ_THREAD_FLAG_HELD;
+    return 1;
   }
-  readyque[current->priority].tail = current;
+
+#ifdef KZ_EDF_PRIORITY
+  if (current->priority == KZ_EDF_PRIORITY) {
+    edf_insert(current);
+  } else
+#endif
+  {
+    /* レディキューの末尾に接続する */
+    KZ_QUEUE_PUT(&readyque[current->priority], current, next);
+  }
+  readyque_bitmap |= (1 << current->priority);
   current->flags |= KZ_THREAD_FLAG_READY;
 
+  /* 末尾に繋いだのでタイムスライスを再設定する */
+  current->slice = timeslice[current->priority];
+
+  /*
+   * 割り込まれたスレッドより優先度が高いか、同じ優先度で先頭に繋がれたか、
+   * 割り込まれたスレッド自身が繋ぎ直された（タイムスライスなど）場合
+   */
+  if (intr_thread
+      && ((current->priority < intr_thread->priority)
+          || (current == intr_thread)
+          || ((current->priority == intr_thread->priority)
+              && (readyque[current->priority].head == current))))
+    intr_resched = 1;
+
   return 0;
 }
 
-/* スレッドの終了 */
-static void thread_end(void)
+/*
+ * 指定したスレッドをレディキューから抜き出す
+ * (getcurrent() と異なり、レディキューの途中にあってもよい)
+ */
+static void readyque_remove(kz_thread *thp)
 {
-  kz_exit();
+  if (!(thp->flags & KZ_THREAD_FLAG_READY))
+    return;
+
+  KZ_QUEUE_REMOVE(&readyque[thp->priority], thp, next);
+  if (KZ_QUEUE_EMPTY(&readyque[thp->priority]))
+    readyque_bitmap &= ~(1 << thp->priority);
+
+  thp->flags &= ~KZ_THREAD_FLAG_READY;
+  thp->next = NULL;
 }
 
-/* スレッドのスタートアップ */
-static void thread_init(kz_thread *thp)
+/*
+ * レディキューの先頭に接続する（kz_wait_for() や kz_chpri_thread() で、
+ * 同じ優先度のスレッドより先に動作させる場合）
+ */
+static void readyque_insert_head(kz_thread *thp)
 {
-  thp->init.func(thp->init.argc, thp->init.argv);
-  thread_end();
+  int priority = thp->priority;
+
+  KZ_QUEUE_PUSH(&readyque[priority], thp, next);
+  readyque_bitmap |= (1 << priority);
+  thp->flags |= KZ_THREAD_FLAG_READY;
 }
 
 /*
- * システムコールの処理（kz_run():スレッドの起動）
- *
- * ユーザスタックに指定した関数を登録しておき、
- * dispatch()を実行した時に、その関数が呼ばれるようにする。
- *（実際はthread_init()で実行）
- * 実行後はthread_end()が実行され、kz_exit()が実行される。
- * スレッド実行されるようにレディキューに追加される。
+ * スレッドの実効優先度を変更する
+ * レディ状態であれば、新しい優先度のレディキューに繋ぎ直す。
+ * mutexの獲得待ちであれば、優先度順の獲得待ちキューに繋ぎ直す
+ * (優先度継承の連鎖の途中のスレッドは、別のmutexを待っている)。
  */
-static kz_thread_id_t thread_run(kz_func_t func, char *name, int priority,
-                                 int stacksize, int argc, char *argv[])
+static void thread_setpri(kz_thread *thp, int priority)
 {
-  int i;
-  kz_thread *thp;
-  uint32 *sp;
-  extern char userstack;
-  static char *thread_stack = &userstack;
+  kz_thread *self = current;
+  kz_mutex *mtxp;
 
-  /* 開いているタスクコントロールブロックを検索 */
-  for (i = 0; i < THREAD_NUM; i++) {
-    thp = &threads[i];
-    if (!thp->init.func)
-      break;
-  }
-  if (i == THREAD_NUM)
-    return -1;
+  if (thp->priority == priority)
+    return;
 
-  /* タスクコントロールブロックをゼロクリア */
-  memset(thp, 0, sizeof(*thp));
+  if (thp->flags & KZ_THREAD_FLAG_READY) {
+    readyque_remove(thp);
+    thp->priority = priority;
+    current = thp;
+    putcurrent();
+    current = self;
+  } else {
+    thp->priority = priority;
+    if ((mtxp = thread_waiting_mutex(thp)) != NULL) {
+      waitque_remove(thp);
+      waitque_insert(&mtxp->waiter, thp, 1);
+    }
+  }
+}
 
-  /* タスクコントロールブロックの設定 */
-  strcpy(thp->name, name);
-  thp->next = NULL;
-  thp->priority  = priority;
-  thp->flags     = 0;
+/*
+ * 優先度継承を考慮した実効優先度を求める
+ * 本来の優先度と、獲得中のmutexの獲得待ちスレッドの最高優先度のうち高い方
+ */
+static int thread_inherited_priority(kz_thread *thp)
+{
+  int priority = thp->base_priority;
+  kz_mutex *mtxp;
 
-  thp->init.func = func;
-  thp->init.argc = argc;
-  thp->init.argv = argv;
+  for (mtxp = thp->mutex; mtxp; mtxp = mtxp->next) {
+    /* 獲得待ちキューは優先度順なので先頭が最高優先度 */
+    if (mtxp->waiter && (mtxp->waiter->priority < priority))
+      priority = mtxp->waiter->priority;
+  }
+  return priority;
+}
 
-  /* スタック領域を獲得 */
-  memset(thread_stack, 0, stacksize);
-  thread_stack += stacksize;
+/* スレッドをタイマ待ちキューに接続する */
+static void timerque_insert(kz_thread *thp, int ticks)
+{
+  kz_thread **thpp;
 
-  thp->stack = thread_stack;
+  /* 起床時刻の順になるように、相対ティック数を引きながら挿入位置を探す */
+  for (thpp = &timerque; *thpp; thpp = &(*thpp)->timer.next) {
+    if (ticks < (*thpp)->timer.delta)
+      break;
+    ticks -= (*thpp)->timer.delta;
+  }
 
-  /* スタックの初期化 */
-  sp = (uint32 *)thp->stack;
-  *(--sp) = (uint32)thread_end;
+  /* 後続のスレッドの相対ティック数から挿入した分を引く */
+  if (*thpp)
+    (*thpp)->timer.delta -= ticks;
 
-  /*
-   * プログラムカウンタを設定する
-   * スレッドの優先度がゼロの場合には割り込み禁止スレッドとする
-   */
-  *(--sp) = (uint32)thread_init | ((uint32)(priority ? 0 : 0xc0) << 24);
+  thp->timer.delta = ticks;
+  KZ_LIST_INSERT(thpp, thp, timer.next);
+  thp->flags |= KZ_THREAD_FLAG_TIMER;
+}
 
-  *(--sp) = 0; /* ER6 */
-  *(--sp) = 0; /* ER5 */
-  *(--sp) = 0; /* ER4 */
-  *(--sp) = 0; /* ER3 */
-  *(--sp) = 0; /* ER2 */
-  *(--sp) = 0; /* ER1 */
+/* スレッドをタイマ待ちキューから外す */
+static void timerque_remove(kz_thread *thp)
+{
+  kz_thread **thpp;
 
-  /* スレッドのスタートアップ(thread_init())に渡す引数 */
-  *(--sp) = (uint32)thp; /* ER0 */
+  if (!(thp->flags & KZ_THREAD_FLAG_TIMER))
+    return;
 
-  /* スレッドのコンテキストを設定 */
-  thp->context.sp = (uint32)sp;
+  thpp = &timerque;
+  KZ_LIST_FIND(thpp, thp, timer.next);
+  if (*thpp) {
+    /* 後続のスレッドに相対ティック数を引き継ぐ */
+    if (thp->timer.next)
+      thp->timer.next->timer.delta += thp->timer.delta;
+    KZ_LIST_UNLINK(thpp, timer.next);
+  }
 
-  /* システムコールを呼び出したスレッドをレディキューに戻す */
-  putcurrent();
+  thp->timer.next = NULL;
+  thp->flags &= ~KZ_THREAD_FLAG_TIMER;
+}
 
-  /* 新規作成したスレッドをレディキューに接続する */
-  current = thp;
-  putcurrent();
+/*
+ * 待ち状態のキューにスレッドを接続する
+ * priority が真の場合は優先度順（同一優先度内はFIFO）、それ以外はFIFOで接続する。
+ */
+static void waitque_insert(kz_thread **quep, kz_thread *thp, int priority)
+{
+  kz_thread **thpp;
 
-  return (kz_thread_id_t)current;
+  for (thpp = quep; *thpp; thpp = &(*thpp)->next) {
+    if (priority && (thp->priority < (*thpp)->priority))
+      break;
+  }
+  KZ_LIST_INSERT(thpp, thp, next);
+  thp->waitque = quep;
 }
 
-/* システムコールの処理(kz_exit():スレッドの終了) */
-static int thread_exit(void)
+/* 待ち状態のキューからスレッドを外す */
+static void waitque_remove(kz_thread *thp)
 {
-  puts(current->name);
-  puts(" EXIT.\n");
-  memset(current, 0, sizeof(*current));
-  return 0;
+  if (thp->waitque == NULL)
+    return;
+
+  KZ_LIST_REMOVE(*thp->waitque, thp, next);
+  thp->next = NULL;
+  thp->waitque = NULL;
 }
 
-/* システムコールの処理(kz_wait(): スレッドの実行権放棄) */
-static int thread_wait(void)
+/* スタックのサイズクラスを求める */
+static int stack_class(int size)
 {
-  putcurrent();
-  return 0;
+  int i;
+
+  for (i = 0; i < STACK_CLASS_NUM; i++) {
+    if (size <= (STACK_CLASS_MIN << i))
+      return i;
+  }
+  return -1;
 }
 
-/* システムコールの処理(kz_sleep(): スレッドのスリープ) */
-static int thread_sleep(void)
+/*
+ * スタック領域の獲得（領域の末尾＝スタックの初期位置を返す）
+ * 同じサイズクラスの解放済み領域があれば再利用し、なければ新たに切り出す
+ * KZ_STACK_LAZY_FILL の場合は、領域は起動時と解放時にパターンで埋めてあるので、
+ * 獲得時には解放済みリストのリンクを書き潰した先頭だけを埋め直す
+ * (スレッドの起動が速くなる分、解放するスレッドの終了が遅くなる)。
+ */
+static char *stack_alloc(int class)
 {
-  return 0;
-}
+  extern char euserstack;
+  int size = STACK_CLASS_MIN << class;
+  char *p;
 
-/* システムコールの処理(kz_wakeup(): スレッドのウェイクアップ) */
-static int thread_wakeup(kz_thread_id_t id)
+  if (stack_freelist[class]) {
+    p = stack_freelist[class];
+    stack_freelist[class] = *(char **)p;
+  } else {
+    if (stack_area + size > &euserstack)
+      return NULL;
+    p = stack_area;
+    stack_area += size;
+  }
+
+#ifdef KZ_STACK_LAZY_FILL
+  memset(p, STACK_FILL_PATTERN, sizeof(char *));
+#else
+  memset(p, STACK_FILL_PATTERN, size);
+#endif
+#ifdef KZ_STACK_CANARY
+  *(uint32 *)p = STACK_CANARY;
+#endif
+  return p + size;
+}
+
+/*
+ * 外部DRAMのスタック領域の獲得と解放(KZ_THREAD_ATTR_DRAM)
+ * 再利用はDRAMの解放済みリストに任せるので、獲得時に全体をパターンで埋める
+ */
+static char *stack_alloc_dram(int class)
 {
-  /* ウェイクアップを呼び出したスレッドをレディキューに戻す */
+  int size = STACK_CLASS_MIN << class;
+  char *p;
+
+  p = kzdram_alloc(size);
+  if (p == NULL)
+    return NULL;
+  memset(p, STACK_FILL_PATTERN, size);
+#ifdef KZ_STACK_CANARY
+  *(uint32 *)p = STACK_CANARY;
+#endif
+  return p + size;
+}
+
+static void stack_free_dram(char *stack, int class)
+{
+  kzdram_free(stack - (STACK_CLASS_MIN << class));
+}
+
+/*
+ * スタック領域の解放
+ * KZ_STACK_LAZY_FILL の場合は、使われた範囲（パターンが書き換えられた範囲）を
+ * 埋め直しておく
+ */
+static void stack_free(char *stack, int class)
+{
+  char *p = stack - (STACK_CLASS_MIN << class);
+#ifdef KZ_STACK_LAZY_FILL
+  int size = STACK_CLASS_MIN << class;
+  int i;
+
+  for (i = STACK_CANARY_SIZE; (i < size) && (p[i] == (char)STACK_FILL_PATTERN);
+       i++)
+    ;
+  memset(p + i, STACK_FILL_PATTERN, size - i);
+#endif
+
+  *(char **)p = stack_freelist[class];
+  stack_freelist[class] = p;
+}
+
+/*
+ * スタックの使用量（最大値）を求める
+ * 領域の先頭(カナリアの後)から、獲得時のパターンが書き換えられていない範囲を数える
+ */
+static int stack_used(kz_thread *thp)
+{
+  int size = STACK_CLASS_MIN << thp->stackclass;
+  unsigned char *p = (unsigned char *)thp->stack - size;
+  int i;
+
+  for (i = STACK_CANARY_SIZE; i < size; i++) {
+    if (p[i] != STACK_FILL_PATTERN)
+      break;
+  }
+  return size - i;
+}
+
+/*
+ * 引数のコピー(KZ_THREAD_ATTR_ARGCOPY)に必要なサイズ
+ * argv の配列(NULL終端を含む)と文字列の合計を4バイト単位に切り上げる
+ */
+static int thread_argsize(int argc, char *argv[])
+{
+  int i, size = (argc + 1) * sizeof(char *);
+
+  if (!argv)
+    return 0;
+  for (i = 0; i < argc; i++)
+    size += strlen(argv[i]) + 1;
+  return (size + 3) & ~3;
+}
+
+/*
+ * 引数をスタックの末尾にまとめてコピーして、コピーした argv を返す
+ * stack は領域の末尾で、コピーした分だけ下げた位置を *topp に返す
+ * （スレッドのスタックはそこから使う）。
+ */
+static char **thread_argcopy(char *stack, char **topp, int argc, char *argv[])
+{
+  char **args, *p;
+  int i, len;
+
+  *topp = stack - thread_argsize(argc, argv);
+  args = (char **)*topp;
+  p = (char *)(args + argc + 1);
+  for (i = 0; i < argc; i++) {
+    len = strlen(argv[i]) + 1;
+    memcpy(p, argv[i], len);
+    args[i] = p;
+    p += len;
+  }
+  args[argc] = NULL;
+  return args;
+}
+
+/* スレッドの終了 */
+static void thread_end(void)
+{
+  kz_exit();
+}
+
+/* スレッドのスタートアップ */
+static void thread_init(kz_thread *thp)
+{
+  thp->exit_status = thp->init.func(thp->init.argc, thp->init.argv);
+  thread_end();
+}
+
+/*
+ * 終了済みで kz_join() されていないスレッドのTCBの回収
+ * 未使用のTCBがなくなったときに、TCBの表の先頭から探して最初に見つかった
+ * ものを再利用する（終了した順ではない）
+ */
+static kz_thread *thread_reap(void)
+{
+  kz_thread *thp;
+  int i;
+
+  for (i = 0; i < THREAD_NUM; i++) {
+    thp = THREAD(i);
+    if (thp->flags & KZ_THREAD_FLAG_ZOMBIE)
+      return thp;
+  }
+  return NULL;
+}
+
+/*
+ * TCBの設定とスタックの初期化
+ * 獲得済みのTCB(未使用リストから外したもの)とスタックの末尾を渡す
+ */
+static void thread_setup(kz_thread *thp, kz_func_t func, char *name,
+                         int priority, char *stack, int class,
+                         int argc, char *argv[])
+{
+  int i;
+  uint32 *sp;
+  char *top = stack;
+
+  /* タスクコントロールブロックをゼロクリアして、新しいIDを割り当てる */
+  thread_clear(thp);
+  if (++thread_generation == 0)
+    thread_generation = 1;
+  thp->id = ((kz_thread_id_t)thread_generation << THREAD_ID_INDEX_BITS) | thp->index;
+
+  /* タスクコントロールブロックの設定（スレッド名は THREAD_NAME_SIZE で切り詰める） */
+  for (i = 0; (i < THREAD_NAME_SIZE) && name[i]; i++)
+    thp->name[i] = name[i];
+  thp->next = NULL;
+  thp->priority  = priority & KZ_THREAD_PRIORITY_MASK;
+  thp->base_priority = thp->priority;
+  thp->deadline = systicks; /* kz_setdeadline() するまでは起動時を締め切りとする */
+  thp->flags     = priority & KZ_THREAD_ATTR_MASK;
+
+  /* 引数をコピーする場合は、コピーの下からスタックとして使う */
+  if ((priority & KZ_THREAD_ATTR_ARGCOPY) && argv)
+    argv = thread_argcopy(stack, &top, argc, argv);
+
+  thp->init.func = func;
+  thp->init.argc = argc;
+  thp->init.argv = argv;
+
+  thp->stack = stack;
+  thp->stackclass = class;
+
+#ifdef KZ_HOST
+  /* ホスト環境ではコンテキストの形式が異なるので、シミュレーション側で作成する */
+  thp->context.sp = host_context_init(top, (STACK_CLASS_MIN << class)
+                                      - (stack - top),
+                                      (void (*)(void *))thread_init, thp,
+                                      thp->flags & KZ_THREAD_FLAG_INTRMASK);
+  (void)sp;
+#else
+  /* スタックの初期化 */
+  sp = (uint32 *)top;
+  *(--sp) = (uint32)thread_end;
+
+  /*
+   * プログラムカウンタを設定する
+   * KZ_THREAD_ATTR_INTRMASK の場合は、CCRのI,UIビットを立てて割り込み禁止で開始する
+   */
+  *(--sp) = (uint32)thread_init
+    | ((uint32)((thp->flags & KZ_THREAD_FLAG_INTRMASK) ? 0xc0 : 0) << 24);
+
+  *(--sp) = 0; /* ER6 */
+  *(--sp) = 0; /* ER5 */
+  *(--sp) = 0; /* ER4 */
+  *(--sp) = 0; /* ER3 */
+  *(--sp) = 0; /* ER2 */
+  *(--sp) = 0; /* ER1 */
+
+  /* スレッドのスタートアップ(thread_init())に渡す引数 */
+  *(--sp) = (uint32)thp; /* ER0 */
+
+  /* スレッドのコンテキストを設定 */
+  thp->context.sp = (unsigned long)sp;
+#endif
+}
+
+/*
+ * システムコールの処理（kz_run():スレッドの起動）
+ *
+ * ユーザスタックに指定した関数を登録しておき、
+ * dispatch()を実行した時に、その関数が呼ばれるようにする。
+ *（実際はthread_init()で実行）
+ * 実行後はthread_end()が実行され、kz_exit()が実行される。
+ * スレッド実行されるようにレディキューに追加される。
+ */
+static kz_thread_id_t thread_run(kz_func_t func, char *name, int priority,
+                                 int stacksize, int argc, char *argv[])
+{
+  int class;
+  kz_thread *thp;
+  char *stack;
+
+  /* 起動に失敗した場合も、呼び出したスレッドは動作を継続する */
+  if (priority & KZ_THREAD_ATTR_ARGCOPY)
+    stacksize += thread_argsize(argc, argv);
+  class = stack_class(stacksize);
+  if (class < 0) {
+    putcurrent();
+    return -1;
+  }
+
+  /* 開いているタスクコントロールブロックを未使用リストから取得 */
+  thp = thread_freelist;
+  if (thp == NULL)
+    thp = thread_reap();
+  if (thp == NULL) {
+    putcurrent();
+    return -1;
+  }
+
+  /* スタック領域を獲得 */
+  if (priority & KZ_THREAD_ATTR_DRAM)
+    stack = stack_alloc_dram(class);
+  else
+    stack = stack_alloc(class);
+  if (stack == NULL) {
+    putcurrent();
+    return -1;
+  }
+
+  if (thp == thread_freelist)
+    KZ_LIST_POP(thread_freelist, next);
+
+  thread_setup(thp, func, name, priority, stack, class, argc, argv);
+
+/* システムコールを呼び出したスレッドをレディキューに戻す */
   putcurrent();
 
-  /* 指定されたスレッドをレディキューに接続してウェイクアップする */
-  current = (kz_thread *)id;
+  /* 新規作成したスレッドをレディキューに接続する */
+  current = thp;
   putcurrent();
 
-  return 0;
+  return current->id;
 }
 
-/* システムコールの処理(kz_geid(): スレッドIDの取得) */
-static kz_thread_id_t thread_getid(void)
+#ifdef KZ_KMALLOC_OWNER
+/* 領域をスレッドのリストにつなぐ */
+static void memowner_attach(kz_thread *thp, kz_memowner *mp)
 {
-  putcurrent();
-  return (kz_thread_id_t)current;
+  mp->next = thp->memlist;
+  if (mp->next)
+    mp->next->pprev = &mp->next;
+  mp->pprev = &thp->memlist;
+  thp->memlist = mp;
 }
 
-/* システムコールの処理(kz_chpri(): スレッドの優先度の変更) */
-static int thread_chpri(int priority)
+/* 領域をリストから外す（所有者なしにする） */
+static void memowner_detach(kz_memowner *mp)
 {
-  int old = current->priority;
-  if (priority >= 0)
-    current->priority = priority;
+  if (mp->pprev) {
+    *mp->pprev = mp->next;
+    if (mp->next)
+      mp->next->pprev = mp->pprev;
+    mp->next = NULL;
+    mp->pprev = NULL;
+  }
+}
 
-  /* 新しい優先度のレディキューに繋ぎ直す */
-  putcurrent();
-  return old;
+/*
+ * スレッドが所有している領域ならば、リストから外して管理ヘッダを返す
+ * (任意のアドレスが渡されうるので、ヘッダを直接参照せずにリストを探す)
+ */
+static kz_memowner *memowner_release(kz_thread *thp, char *p)
+{
+  kz_memowner *mp;
+
+  for (mp = thp->memlist; mp; mp = mp->next) {
+    if ((char *)(mp + 1) == p) {
+      memowner_detach(mp);
+      return mp;
+    }
+  }
+  return NULL;
 }
 
-/* システムコールの処理(kz_kmalloc(): 動的メモリ獲得) */
-static void *thread_kmalloc(int size)
+/* スレッドの終了時に、所有している領域を全て解放する */
+static void memowner_free_all(kz_thread *thp)
 {
-  putcurrent();
-  return kzmem_alloc(size);
+  kz_memowner *mp;
+
+  while ((mp = thp->memlist) != NULL) {
+    memowner_detach(mp);
+    kzmem_free(mp);
+  }
 }
+#endif
 
-/* システムコールの処理(kz_kmfree(): メモリ解放) */
-static int thread_kmfree(char *p)
+/*
+ * 終了するスレッドを、カーネルのキューと獲得中のmutexから切り離す
+ * (TCBをクリアした後に、待ちキューなどに終了したTCBが残らないようにする)
+ * レディキュー・待ちキュー（メッセージボックスの送受信待ちや kz_recv_any()、
+ * リングバッファを含む）・タイマ待ちキューから外し、獲得中のmutexは
+ * 獲得待ちキューの先頭のスレッドに渡す（保護していたデータの整合性は
+ * 保証されない）。
+ */
+static void thread_detach(kz_thread *thp)
 {
-  kzmem_free(p);
+  kz_mutex *mtxp;
+
+  readyque_remove(thp);
+  waitque_remove(thp);
+  timerque_remove(thp);
+
+  while ((mtxp = thp->mutex) != NULL) {
+    KZ_LIST_POP(thp->mutex, next);
+    mtxp->next = NULL;
+    mtxp->owner = NULL;
+    mutex_pass(mtxp);
+  }
+}
+
+/*
+ * システムコールの処理(kz_exit():スレッドの終了)
+ * softerr_intr() で異常終了させる場合にも使う
+ */
+static int thread_exit(void)
+{
+  kz_thread *joiner = current->joiner;
+  kz_thread_id_t id = current->id;
+  int status = current->exit_status;
+
+  THREAD_MESSAGE(current, " EXIT.\n");
+  thread_detach(current);
+  /*
+   * スタック領域を解放する（静的なスタックは解放しない）
+   * (割り込みスタック上で処理しているので、解放しても問題ない)
+   */
+  if (!(current->flags & KZ_THREAD_FLAG_STATIC)) {
+    if (current->flags & KZ_THREAD_FLAG_DRAM)
+      stack_free_dram(current->stack, current->stackclass);
+    else
+      stack_free(current->stack, current->stackclass);
+  }
+#ifdef KZ_KMALLOC_OWNER
+  /* 解放されずに残っている動的メモリをまとめて解放する */
+  memowner_free_all(current);
+#endif
+  thread_clear(current);
+
+  if (!joiner) {
+    /* kz_join() されるまで、終了状態としてTCBを残す（IDも有効のまま） */
+    current->id = id;
+    current->flags = KZ_THREAD_FLAG_ZOMBIE;
+    current->exit_status = status;
+    return 0;
+  }
+
+  /* タスクコントロールブロックを未使用リストに戻す */
+  KZ_LIST_PUSH(thread_freelist, current, next);
+
+  /* 終了を待っているスレッドに戻り値を渡して、レディキューに戻す */
+  if (joiner->syscall.param->un.join.statusp)
+    *joiner->syscall.param->un.join.statusp = status;
+  joiner->syscall.param->un.join.ret = 0;
+  current = joiner;
   putcurrent();
   return 0;
 }
 
-/* メッセージの送信処理 */
-static void sendmsg(kz_msgbox *mboxp, kz_thread *thp, int size, char *p)
+/*
+ * システムコールの処理(kz_join(): スレッドの終了待ち)
+ * スレッドが終了済みならば戻り値を返してTCBを回収し、動作中ならば
+ * 終了するまで待つ（thread_exit() で戻り値が渡される）。
+ * 1つのスレッドを待てるのは1つのスレッドのみ。
+ * 終了済みのTCBは、未使用のTCBがなくなると再利用される（thread_reap()）ので、
+ * 多くのスレッドを起動する場合は早めに kz_join() すること。
+ */
+static int thread_join(kz_thread_id_t id, int *statusp)
 {
-  kz_msgbuf *mp;
+  kz_thread *thp = thread_find(id);
 
-  /* メッセージバッファの作成 */
-  mp = (kz_msgbuf *)kzmem_alloc(sizeof(*mp));
-  if (mp == NULL)
-    kz_sysdown();
+  if (!thp || (thp == current)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
 
-  mp->next       = NULL;
-  mp->sender     = thp;
-  mp->param.size = size;
-  mp->param.p    = p;
+  if (thp->flags & KZ_THREAD_FLAG_ZOMBIE) {
+    if (statusp)
+      *statusp = thp->exit_status;
+    thread_clear(thp);
+    KZ_LIST_PUSH(thread_freelist, thp, next);
+    putcurrent();
+    return 0;
+  }
 
-  /* メッセージボックスの末尾にメッセージを接続する */
-  if (mboxp->tail) {
-    mboxp->tail->next = mp;
-  } else {
-    mboxp->head = mp;
+  if (!thp->init.func || thp->joiner) {
+    putcurrent();
+    return KZ_ERR_STATE;
   }
-  mboxp->tail = mp;
+
+  /* 終了するまでスリープする（戻り値は thread_exit() で書き込まれる） */
+  thp->joiner = current;
+  return KZ_ERR_STATE;
 }
 
-/* メッセージの受信処理 */
-static void recvmsg(kz_msgbox *mboxp)
+/* システムコールの処理(kz_wait(): スレッドの実行権放棄) */
+static int thread_wait(void)
 {
-  kz_msgbuf *mp;
-  kz_syscall_param_t *p;
+  putcurrent();
+  return 0;
+}
 
-  /* メッセージボックスの先頭にあるメッセージを抜き出す */
-  mp = mboxp->head;
-  mboxp->head = mp->next;
-  if (mboxp->head == NULL)
-    mboxp->tail = NULL;
-  mp->next = NULL;
+/*
+ * システムコールの処理(kz_wait_for(): 指定したスレッドへの実行権の譲渡)
+ * レディ状態の対象スレッドをレディキューの先頭に置き、自スレッドは末尾に戻す。
+ * 対象が自スレッドより低い優先度であれば、対象が次にシステムコールを
+ * 呼ぶまで自スレッドの優先度を貸す（syscall_proc() で元に戻す）。
+ * タイムスライスの残りも対象に引き継ぐ。
+ */
+static int thread_wait_for(kz_thread_id_t id)
+{
+  kz_thread *thp = thread_find(id);
+  int priority = current->priority;
+
+  if (!thp || (thp == current)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  /* 高い優先度のスレッドは、譲らなくても先に動いている */
+  if (!(thp->flags & KZ_THREAD_FLAG_READY) || (thp->priority < priority)) {
+    putcurrent();
+    return KZ_ERR_STATE;
+  }
 
-  /* メッセージを受信するスレッドに返す値を設定する */
-  p = mboxp->receiver->syscall.param;
-  p->un.recv.ret = (kz_thread_id_t)mp->sender;
-  if (p->un.recv.sizep)
-    *(p->un.recv.sizep) = mp->param.size;
-  if (p->un.recv.pp)
-    *(p->un.recv.pp) = mp->param.p;
+  readyque_remove(thp);
+  if (thp->priority != priority) {
+    thp->priority = priority;
+    thp->flags |= KZ_THREAD_FLAG_DONATED;
+  }
 
-  /* 受信待ちスレッドはいなくなったのでNULLに戻す */
-  mboxp->receiver = NULL;
+  /* レディキューの先頭に接続する */
+  readyque_insert_head(thp);
+  thp->slice = current->slice;
 
-  /* メッセージバッファの解放 */
-  kzmem_free(mp);
+  putcurrent();
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_sleep(): スレッドのスリープ)
+ *
+ * レディキューから外されたまま戻るので、スレッドはスリープする。
+ * ticks が正の場合はタイマ待ちキューに接続し、指定ティック数の経過後に
+ * tick_intr() によってレディキューに戻される（KZ_ERR_TIMEOUTを返す）。
+ * ticks が0の場合は kz_wakeup() されるまでスリープする。
+ * 先に kz_wakeup() されていた場合は、保留中の要求を1つ消費してすぐに戻る
+ * (uITRONの slp_tsk()/wup_tsk() と同様で、ウェイクアップが失われない)。
+ */
+static int thread_sleep(int ticks)
+{
+  if (current->wakeup_count > 0) {
+    current->wakeup_count--;
+    putcurrent();
+    return 0;
+  }
+
+  current->flags |= KZ_THREAD_FLAG_SLEEP;
+  if (ticks > 0)
+    timerque_insert(current, ticks);
+  /* kz_wakeup() で起床した場合は、thread_wakeup() で0に書き換えられる */
+  return KZ_ERR_TIMEOUT;
 }
 
-/* システムコールの処理(kz_send(): メッセージ送信) */
-static int thread_send(kz_msgbox_id_t id, int size, char *p)
+/*
+ * システムコールの処理(kz_wakeup(): スレッドのウェイクアップ)
+ * kz_sleep() 中のスレッドのみを起床させる。スリープしていなければ
+ * 要求を保留して、次の kz_sleep() をすぐに戻す。
+ * kx_wakeup() で割り込みハンドラからも呼べる（current は NULL）。
+ */
+static int thread_wakeup(kz_thread_id_t id)
 {
-  kz_msgbox *mboxp = &msgboxes[id];
+  kz_thread *thp = thread_find(id);
 
+  /* ウェイクアップを呼び出したスレッドをレディキューに戻す */
   putcurrent();
-  /* メッセージ送信処理 */
-  sendmsg(mboxp, current, size, p);
 
-  /* 受信待ちスレッドが存在している場合には受信処理を行う */
-  if (mboxp->receiver) {
-    /* 受信待ちスレッド */
-    current = mboxp->receiver;
-    /* メッセージ受信処理 */
-    recvmsg(mboxp);
-    /* 受信により動作可能になったので、ブロック解除する */
+  if (!thp || !thp->init.func)
+    return KZ_ERR_PARAM;
+
+  if (!(thp->flags & KZ_THREAD_FLAG_SLEEP)) {
+    if (thp->wakeup_count >= WAKEUP_COUNT_MAX)
+      return KZ_ERR_FULL;
+    thp->wakeup_count++;
+    return 0;
+  }
+
+  /* 指定されたスレッドをレディキューに接続してウェイクアップする */
+  thp->flags &= ~KZ_THREAD_FLAG_SLEEP;
+  thp->syscall.param->un.sleep.ret = 0;
+  current = thp;
+  timerque_remove(current);
+  putcurrent();
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_suspend(): スレッドの強制的な中断)
+ *
+ * id のスレッドを、同じ数の kz_resume() が呼ばれるまで動作させない
+ * (ネストした数を返す)。レディ状態であればレディキューから外す。
+ * 待ち状態であれば待ちはそのまま続け、待ちが解除されてもレディキューには
+ * 繋がない（putcurrent() で保留する。uITRONの sus_tsk() と同様）。
+ * 自スレッドも中断できる。アイドルスレッドは中断しないこと。
+ */
+static int thread_suspend(kz_thread_id_t id)
+{
+  kz_thread *thp = thread_find(id);
+
+  if (!thp || !thp->init.func) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  if (thp->suspend_count >= SUSPEND_COUNT_MAX) {
     putcurrent();
+    return KZ_ERR_FULL;
   }
 
-  return size;
+  thp->suspend_count++;
+  /* 自スレッドの場合は、レディキューから外れたままにする */
+  if (thp != current)
+    putcurrent();
+  if (thp->flags & KZ_THREAD_FLAG_READY) {
+    readyque_remove(thp);
+    thp->flags |= KZ_THREAD_FLAG_HELD;
+  } else if (thp == current) {
+    thp->flags |= KZ_THREAD_FLAG_HELD;
+  }
+
+  return thp->suspend_count;
 }
 
-/* システムコールの処理(kz_recv(): メッセージ受信) */
-static kz_thread_id_t thread_recv(kz_msgbox_id_t id, int *sizep, char **pp)
+/*
+ * システムコールの処理(kz_resume(): 中断したスレッドの再開)
+ * ネストした数を1つ減らして返し、0になれば中断中にレディになっていた
+ * スレッドをレディキューに戻す（中断していなければ KZ_ERR_STATE）。
+ */
+static int thread_resume(kz_thread_id_t id)
 {
-  kz_msgbox *mboxp = &msgboxes[id];
+  kz_thread *thp = thread_find(id);
 
-  if (mboxp->receiver)
-    kz_sysdown();
+  putcurrent();
+
+  if (!thp || !thp->init.func)
+    return KZ_ERR_PARAM;
+  if (!thp->suspend_count)
+    return KZ_ERR_STATE;
 
-  mboxp->receiver = current;
+  if (--thp->suspend_count)
+    return thp->suspend_count;
+
+  if (thp->flags & KZ_THREAD_FLAG_HELD) {
+    thp->flags &= ~KZ_THREAD_FLAG_HELD;
+    current = thp;
+    putcurrent();
+  }
+
+  return 0;
+}
+
+/* システムコールの処理(kz_geid(): スレッドIDの取得) */
+static kz_thread_id_t thread_getid(void)
+{
+  putcurrent();
+  return current->id;
+}
+
+/* システムコールの処理(kz_chpri(): スレッドの優先度の変更) */
+static int thread_chpri(int priority)
+{
+  int old = current->base_priority;
+  if (priority >= 0) {
+    current->base_priority = priority;
+    /* mutexによる優先度継承中であれば、継承した優先度を維持する */
+    current->priority = thread_inherited_priority(current);
+  }
+
+  /* 新しい優先度のレディキューに繋ぎ直す */
+  putcurrent();
+  return old;
+}
+
+/*
+ * システムコールの処理(kz_chpri_thread(): 他のスレッドの優先度の変更)
+ *
+ * id のスレッドの本来の優先度を変更して、変更前の値を返す（priority が
+ * 負ならば変更しない）。レディ状態であれば新しい優先度のレディキューに
+ * 繋ぎ直し、KZ_CHPRI_HEAD を指定すると末尾ではなく先頭に繋ぐ。
+ * mutexの獲得待ちであれば待ちキューの位置を直し、所有スレッドの継承する
+ * 優先度を連鎖の先まで求め直す（上げた場合も下げた場合も）。
+ */
+static int thread_chpri_thread(kz_thread_id_t id, int priority, int flags)
+{
+  kz_thread *thp = thread_find(id);
+  kz_thread *self = current;
+  kz_mutex *mtxp;
+  int old, ready;
+
+  if (!thp || (priority >= PRIORITY_NUM)
+      || (thp->flags & KZ_THREAD_FLAG_ZOMBIE)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+
+  old = thp->base_priority;
+  if (priority >= 0) {
+    thp->base_priority = priority;
+    /* mutexによる優先度継承中であれば、継承した優先度を維持する */
+    priority = thread_inherited_priority(thp);
+  } else {
+    priority = thp->priority;
+  }
+
+  /* 呼び出したスレッド自身はレディキューから外れているが、レディとして扱う */
+  ready = (thp == self) || (thp->flags & KZ_THREAD_FLAG_READY);
+  if (thp != self)
+    putcurrent();
+  readyque_remove(thp);
+  thp->priority = priority;
+
+  if (ready) {
+    if (flags & KZ_CHPRI_HEAD) {
+      readyque_insert_head(thp);
+      thp->slice = timeslice[priority];
+    } else {
+      current = thp;
+      putcurrent();
+    }
+  } else if ((mtxp = thread_waiting_mutex(thp)) != NULL) {
+    /*
+     * 獲得待ちキューは優先度順なので繋ぎ直し、所有スレッドの継承している
+     * 優先度を求め直す（下げた場合は、継承していた分を連鎖の先まで戻す）
+     */
+    waitque_remove(thp);
+    waitque_insert(&mtxp->waiter, thp, 1);
+    for (thp = mtxp->owner; thp; ) {
+      priority = thread_inherited_priority(thp);
+      if (priority == thp->priority)
+        break;
+      /* kz_wait_for() で借りている優先度は、次のシステムコールまで下げない */
+      if ((thp->flags & KZ_THREAD_FLAG_DONATED) && (priority > thp->priority))
+        break;
+      thread_setpri(thp, priority);
+      mtxp = thread_waiting_mutex(thp);
+      thp = mtxp ? mtxp->owner : NULL;
+    }
+  }
+
+  current = self;
+  return old;
+}
+
+/* システムコールの処理(kz_setslice(): タイムスライスの設定) */
+static int thread_setslice(int priority, int ticks)
+{
+  int old = -1;
+
+  if ((priority >= 0) && (priority < PRIORITY_NUM)) {
+    old = timeslice[priority];
+    if (ticks >= 0)
+      timeslice[priority] = ticks;
+  }
+
+  putcurrent();
+  return old;
+}
+
+/*
+ * システムコールの処理(kz_stackinfo(): スタックのサイズと使用量の取得)
+ * id が0の場合は自スレッドを対象とする
+ */
+static int thread_stackinfo(kz_thread_id_t id, int *sizep, int *usedp)
+{
+  kz_thread *thp = id ? thread_find(id) : current;
+
+  putcurrent();
+
+  if (!thp || !thp->init.func)
+    return KZ_ERR_PARAM;
+
+  if (sizep)
+    *sizep = STACK_CLASS_MIN << thp->stackclass;
+  if (usedp)
+    *usedp = stack_used(thp);
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_getstat(): スレッドの統計情報の取得)
+ * id が0の場合は自スレッドを対象とする
+ */
+static int thread_getstat(kz_thread_id_t id, kz_threadstat_t *statp)
+{
+  kz_thread *thp = id ? thread_find(id) : current;
+  int i;
+
+  putcurrent();
+
+  if (!thp || !thp->init.func)
+    return KZ_ERR_PARAM;
+
+  for (i = 0; (i < (int)sizeof(statp->name) - 1) && thp->name[i]; i++)
+    statp->name[i] = thp->name[i];
+  statp->name[i] = '\0';
+  if (thp == current)
+    statp->state = KZ_THREAD_STATE_RUN;
+  else if (thp->suspend_count)
+    statp->state = KZ_THREAD_STATE_SUSPEND;
+#ifdef KZ_BUDGET
+  else if (thp->flags & KZ_THREAD_FLAG_THROTTLED)
+    statp->state = KZ_THREAD_STATE_THROTTLED;
+#endif
+  else if (thp->flags & KZ_THREAD_FLAG_READY)
+    statp->state = KZ_THREAD_STATE_READY;
+  else if (thp->flags & KZ_THREAD_FLAG_SLEEP)
+    statp->state = KZ_THREAD_STATE_SLEEP;
+  else
+    statp->state = KZ_THREAD_STATE_WAIT;
+  statp->priority    = thp->priority;
+  statp->attr        = thp->flags & KZ_THREAD_ATTR_MASK;
+  statp->stacksize   = STACK_CLASS_MIN << thp->stackclass;
+  statp->stackused   = stack_used(thp);
+  statp->runticks    = thp->stat.runticks;
+  statp->dispatches  = thp->stat.dispatches;
+  statp->voluntary   = thp->stat.voluntary;
+  statp->involuntary = thp->stat.involuntary;
+  statp->syscalls    = thp->stat.syscalls;
+  statp->overruns    = thp->period.overruns;
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_getload(): CPU負荷の取得)
+ * 直近 samples 回分の測定期間（LOAD_SAMPLE_TICKS ティックごと）の
+ * 平均の負荷を1000分率で返す。samples が0の場合は保存されている全てを使う。
+ */
+static int thread_getload(int samples)
+{
+  int i, pos, sum = 0;
+
+  putcurrent();
+
+  if ((samples < 0) || (samples > LOAD_WINDOW))
+    return KZ_ERR_PARAM;
+  if (!samples || (samples > load.num))
+    samples = load.num;
+  if (!samples)
+    return KZ_ERR_EMPTY; /* まだ測定期間が終わっていない */
+
+  pos = load.pos;
+  for (i = 0; i < samples; i++) {
+    pos = (pos - 1) & (LOAD_WINDOW - 1);
+    sum += load.samples[pos];
+  }
+
+  return sum / samples;
+}
+
+/*
+ * 動的メモリの獲得
+ * サービスコール(kx_kmalloc())では current が NULL なので、
+ * 割り込み処理用の取り置きを使える獲得を行う
+ */
+static void *kmalloc(int size)
+{
+  return current ? kzmem_alloc(size) : kzmem_alloc_isr(size);
+}
+
+/*
+ * kz_kmfree() で解放する領域の獲得(kz_kmalloc(), kz_send_inline() の受信)
+ * KZ_KMALLOC_OWNER の場合は、管理ヘッダを付けて owner のリストにつなぐ
+ * (owner が NULL ならば所有者なし)
+ */
+static void *kmem_acquire(kz_thread *owner, int size)
+{
+#ifdef KZ_KMALLOC_OWNER
+  kz_memowner *mp;
+
+  mp = kmalloc(size + sizeof(*mp));
+  if (mp == NULL)
+    return NULL;
+  mp->next = NULL;
+  mp->pprev = NULL;
+  if (owner)
+    memowner_attach(owner, mp);
+  return mp + 1;
+#else
+  return kmalloc(size);
+#endif
+}
+
+/*
+ * システムコールの処理(kz_kmalloc(): 動的メモリ獲得)
+ * サービスコールで獲得した場合は所有者なし
+ */
+static void *thread_kmalloc(int size)
+{
+  putcurrent();
+  return kmem_acquire(current, size);
+}
+
+/* kz_kmalloc() で獲得した領域の解放(kz_kmfree(), kz_recv_free()) */
+static void kmem_release(char *p)
+{
+#ifdef KZ_KMALLOC_OWNER
+  kz_memowner *mp = (kz_memowner *)p - 1;
+  memowner_detach(mp);
+  kzmem_free(mp);
+#else
+  kzmem_free(p);
+#endif
+}
+
+/* システムコールの処理(kz_kmfree(): メモリ解放) */
+static int thread_kmfree(char *p)
+{
+  kmem_release(p);
+  putcurrent();
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_memstat(): メモリプールの使用状況の取得)
+ * index 番目のメモリプールの使用状況を返す（プールがなければ KZ_ERR_PARAM）
+ */
+static int thread_memstat(int index, kz_memstat_t *statp)
+{
+  putcurrent();
+  return kzmem_stat(index, statp);
+}
+
+/*
+ * システムコールの処理(kz_regionstat(): スタック領域と外部DRAMの使用状況の取得)
+ * スタック領域は userstack から切り出した位置までを使用済みとし、
+ * そのうちサイズクラスごとの解放済みリストにあるものを別に数える
+ */
+static int thread_regionstat(kz_regionstat_t *statp)
+{
+  extern char userstack, euserstack;
+  char *p;
+  int class;
+
+  putcurrent();
+
+  statp->stack_size = &euserstack - &userstack;
+  statp->stack_used = stack_area - &userstack;
+  statp->stack_free = 0;
+  for (class = 0; class < STACK_CLASS_NUM; class++) {
+    for (p = stack_freelist[class]; p; p = *(char **)p)
+      statp->stack_free += STACK_CLASS_MIN << class;
+  }
+  kzdram_stat(statp);
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_perfstat(): カーネル全体の性能カウンタの取得)
+ * syscalls が NULL でなければ、システムコールの種類ごとの回数を先頭から
+ * num 個までコピーする。システムコールの種類の数を返す。
+ * メモリプールの獲得失敗はプールごとの回数(kzmem_stat())を合計する。
+ */
+static int thread_perfstat(kz_perfstat_t *statp, uint32 *syscalls, int num)
+{
+  kz_memstat_t mstat;
+  int i;
+
+  putcurrent();
+
+  memcpy(statp, &perf, sizeof(*statp));
+  statp->ticks = systicks;
+  statp->syscalls = 0;
+  for (i = 0; i < KZ_SYSCALL_TYPE_NUM; i++) {
+    statp->syscalls += perf_syscalls[i];
+    if (syscalls && (i < num))
+      syscalls[i] = perf_syscalls[i];
+  }
+  statp->allocfails = 0;
+  for (i = 0; kzmem_stat(i, &mstat) == 0; i++)
+    statp->allocfails += mstat.fails;
+
+  return KZ_SYSCALL_TYPE_NUM;
+}
+
+/*
+ * システムコールの処理(kz_dmalloc(): 外部DRAMの領域の獲得)
+ * 大きなバッファ用なので、獲得できなくてもシステムを停止せずに NULL を返す
+ */
+static void *thread_dmalloc(uint32 size)
+{
+  putcurrent();
+  return kzdram_alloc(size);
+}
+
+/* システムコールの処理(kz_dmfree(): 外部DRAMの領域の解放) */
+static int thread_dmfree(void *p)
+{
+  putcurrent();
+  if (kzdram_free(p) < 0)
+    return KZ_ERR_PARAM;
+  return 0;
+}
+
+/* メッセージボックスの末尾にメッセージを接続する */
+static void mbox_append(kz_msgbox *mboxp, kz_msgbuf *mp)
+{
+  kz_msgbuf **mpp;
+
+  if (KZ_QUEUE_EMPTY(mboxp) || (mboxp->tail->priority <= mp->priority)) {
+    /* 同じ優先度ばかりの通常の場合は、末尾に繋ぐだけ */
+    KZ_QUEUE_PUT(mboxp, mp, next);
+  } else {
+    /* 優先度の低いメッセージより前に割り込ませる（同じ優先度ではFIFO） */
+    for (mpp = &mboxp->head; (*mpp)->priority <= mp->priority;
+         mpp = &(*mpp)->next)
+      ;
+    KZ_LIST_INSERT(mpp, mp, next);
+  }
+  mboxp->count++;
+
+#ifdef KZ_MBOX_STAT
+  mp->sent = kz_gettime();
+  if (mboxp->count > mboxstat[MSGBOX_ID(mboxp)].peak)
+    mboxstat[MSGBOX_ID(mboxp)].peak = mboxp->count;
+#endif
+
+  KZ_TRACE_EVENT(KZ_TRACE_SEND, TRACE_ID(mp->sender), MSGBOX_ID(mboxp));
+}
+
+/*
+ * メッセージの送信処理
+ * メッセージバッファが不足した場合は、KZ_KMALLOC_NULL が指定されていれば
+ * -1 を返す（指定されていなければ kz_sysdown() する）
+ */
+static int sendmsg(kz_msgbox *mboxp, kz_thread *thp, int size, char *p,
+                   int priority, int copy)
+{
+  kz_msgbuf *mp;
+  kz_mboxres *resp = MBOXRES(MSGBOX_ID(mboxp));
+
+  /* 取り置きがあればそこから、なければ解放済みリストから取得 */
+  if (resp->nodes) {
+    mp = resp->nodes;
+    KZ_LIST_POP(resp->nodes, next);
+    resp->nodes_num--;
+  } else {
+    mp = msgbuf_free;
+    if (mp == NULL) {
+#ifndef KZ_KMALLOC_NULL
+      kz_sysdown();
+#endif
+      return -1;
+    }
+    KZ_LIST_POP(msgbuf_free, next);
+  }
+
+  /* 小さいメッセージは、送信側の領域を解放できるようにコピーしておく */
+  if (copy) {
+    memcpy(mp->data, p, size);
+    p = mp->data;
+  }
+
+  mp->next       = NULL;
+  mp->sender     = thp;
+  mp->param.size = size;
+  mp->param.p    = p;
+  mp->owned      = 0;
+  mp->priority   = priority;
+#ifdef KZ_KMALLOC_OWNER
+  /* 送信したスレッドが所有している領域ならば、受信時に所有権を移す */
+  if (thp && memowner_release(thp, p))
+    mp->owned = 1;
+#endif
+
+  mbox_append(mboxp, mp);
+  perf.sends++;
+
+  return 0;
+}
+
+/*
+ * 受信したメッセージを受信するスレッドに返す値として設定する
+ * copied が真の場合は、p の内容を受信側のバッファにコピーする
+ * (コピーして送信されたメッセージ。送信側やメッセージバッファの領域はすぐに
+ *  再利用されるので、バッファがなければ動的メモリを獲得してコピーする)
+ */
+static void recvmsg_deliver(kz_msgbox *mboxp, kz_thread *thp, kz_thread *sender,
+                            int size, char *p, int copied)
+{
+  kz_syscall_param_t *param;
+
+  param = thp->syscall.param;
+  param->un.recv.ret = THREAD_ID(sender);
+  if (param->un.recv.sizep)
+    *(param->un.recv.sizep) = size;
+  if (copied) {
+    if (param->un.recv.buf) {
+      memcpy(param->un.recv.buf, p, size);
+    } else if (param->un.recv.pp) {
+      /*
+       * バッファを渡さない受信(kz_recv() など)では、通常のメッセージと同じく
+       * kz_kmfree() で解放する領域にコピーして渡す
+       */
+      param->un.recv.buf = kmem_acquire(thp, size);
+      if (param->un.recv.buf == NULL) {
+        param->un.recv.ret = KZ_ERR_NORES; /* メッセージは失われる */
+      } else {
+        memcpy(param->un.recv.buf, p, size);
+      }
+    }
+    if (param->un.recv.pp)
+      *(param->un.recv.pp) = param->un.recv.buf;
+  } else if (param->un.recv.pp) {
+    *(param->un.recv.pp) = p;
+  }
+  if (param->un.recv.idp)
+    *(param->un.recv.idp) = MSGBOX_ID(mboxp);
+
+  KZ_TRACE_EVENT(KZ_TRACE_RECV, TRACE_ID(thp), MSGBOX_ID(mboxp));
+  perf.recvs++;
+
+  /* タイムアウト付きで受信待ちしていた場合はタイマ待ちを解除する */
+  timerque_remove(thp);
+}
+
+/* メッセージの受信処理 */
+static void recvmsg(kz_msgbox *mboxp, kz_thread *thp)
+{
+  kz_msgbuf *mp;
+  kz_mboxres *resp;
+#ifdef KZ_MBOX_STAT
+  kz_mboxstat_t *sp;
+  uint32 wait;
+#endif
+
+  /* メッセージボックスの先頭にあるメッセージを抜き出す */
+  mp = mboxp->head;
+  KZ_QUEUE_GET(mboxp, next);
+  mp->next = NULL;
+  mboxp->count--;
+
+#ifdef KZ_MBOX_STAT
+  sp = &mboxstat[MSGBOX_ID(mboxp)];
+  wait = kz_gettime() - mp->sent;
+  sp->wait_total += wait;
+  if (wait > sp->wait_max)
+    sp->wait_max = wait;
+  sp->messages++;
+#endif
+
+#ifdef KZ_KMALLOC_OWNER
+  if (mp->owned)
+    memowner_attach(thp, (kz_memowner *)mp->param.p - 1);
+#endif
+  recvmsg_deliver(mboxp, thp, mp->sender, mp->param.size, mp->param.p,
+                  mp->param.p == mp->data);
+
+  /* メッセージバッファを解放済みリストに戻す（タイマのものは戻さない） */
+  if (mp->timer) {
+    mp->timer->flags &= ~KZ_SWTIMER_FLAG_SENT;
+    return;
+  }
+  resp = MBOXRES(MSGBOX_ID(mboxp));
+  if (resp->nodes_num < resp->nodes_max) {
+    KZ_LIST_PUSH(resp->nodes, mp, next);
+    resp->nodes_num++;
+    return;
+  }
+  KZ_LIST_PUSH(msgbuf_free, mp, next);
+}
+
+/* メッセージボックスの受信を待っているスレッド（いなければ NULL） */
+static kz_thread *recvmsg_receiver(kz_msgbox *mboxp)
+{
+  kz_thread *thp;
+  uint16 bit;
+
+  /* 受信待ちキューの先頭のスレッド */
+  thp = mboxp->receiver;
+  if (thp == NULL) {
+    /* このメッセージボックスを kz_recv_any() で待っているスレッド */
+    bit = 1U << MSGBOX_ID(mboxp);
+    for (thp = recvany_receiver; thp; thp = thp->next) {
+      if (thp->syscall.param->un.recv.mask & bit)
+        break;
+    }
+  }
+  return thp;
+}
+
+/*
+ * 受信待ちスレッドが存在している場合には受信処理を行う
+ * (current は書き換わる)
+ */
+static void recvmsg_waiting(kz_msgbox *mboxp)
+{
+  kz_thread *thp;
+
+  thp = recvmsg_receiver(mboxp);
+  if (thp == NULL)
+    return;
+
+  current = thp;
+  waitque_remove(current);
+  /* メッセージ受信処理 */
+  recvmsg(mboxp, current);
+  /* 受信により動作可能になったので、ブロック解除する */
+  putcurrent();
+}
+
+/*
+ * 送信待ちスレッドのメッセージを格納する
+ * 受信によりメッセージボックスに空きができたときに呼ぶ
+ */
+static void sendmsg_waiting(kz_msgbox *mboxp)
+{
+  kz_syscall_param_t *p;
+
+  if (mboxp->sender == NULL)
+    return;
+
+  /* 送信待ちキューの先頭のスレッドのメッセージを格納して、ブロック解除する */
+  current = mboxp->sender;
+  waitque_remove(current);
+  p = current->syscall.param;
+  if (sendmsg(mboxp, current, p->un.send.size, p->un.send.p,
+              p->un.send.priority, p->un.send.copy) < 0)
+    p->un.send.ret = KZ_ERR_NORES;
+  else
+    p->un.send.ret = p->un.send.size;
+  putcurrent();
+}
+
+/*
+ * メッセージボックスのIDが使用できるものか
+ * (固定IDのものは kz_mbox_create() せずに使えるので常に有効)
+ */
+static int mbox_valid(kz_msgbox_id_t id)
+{
+  if ((id < 0) || (id >= MSGBOX_NUM))
+    return 0;
+  return (id < MSGBOX_ID_NUM) || (MSGBOX(id)->flags & KZ_MSGBOX_FLAG_USED);
+}
+
+/*
+ * システムコールの処理(kz_send(), kz_psend(): メッセージ送信)
+ *
+ * 最大メッセージ数が設定されているメッセージボックスが満杯の場合は、
+ * 受信により空きができるまで送信スレッドをブロックする。
+ * nowait が真の場合(kz_psend())はブロックせずに KZ_ERR_FULL を返す。
+ * メッセージは priority の順（同じ優先度では送信順）に受信される。
+ * copy が真の場合(kz_send_inline())は、p の内容をメッセージバッファに
+ * コピーして送信する（KZ_MSG_INLINE_SIZE バイトまで）。
+ * メッセージボックスが空で受信待ちのスレッドがいる場合は、メッセージバッファを
+ * 使わずに受信スレッドに直接渡す（ping-pong の通信ではほとんどがこの場合）。
+ */
+static int thread_send(kz_msgbox_id_t id, int size, char *p, int nowait,
+                       int priority, int copy)
+{
+  kz_msgbox *mboxp;
+  kz_thread *thp;
+
+  if (!mbox_valid(id)
+      || (copy && ((size < 0) || (size > KZ_MSG_INLINE_SIZE)))) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  mboxp = MSGBOX(id);
+
+  if (mboxp->capacity && (mboxp->count >= mboxp->capacity)) {
+    if (nowait) {
+      putcurrent();
+      return KZ_ERR_FULL;
+    }
+    /* 送信待ちキューに接続しスレッドをスリープさせる */
+    waitque_insert(&mboxp->sender, current,
+                   mboxp->attr & KZ_MSGBOX_ATTR_PRIORITY);
+    return -1;
+  }
+
+  putcurrent();
+
+  /* 受信待ちのスレッドへの直接の受け渡し（先に届いたメッセージがない場合のみ） */
+  if ((mboxp->head == NULL) && ((thp = recvmsg_receiver(mboxp)) != NULL)) {
+    KZ_TRACE_EVENT(KZ_TRACE_SEND, TRACE_ID(current), MSGBOX_ID(mboxp));
+    perf.sends++;
+#ifdef KZ_KMALLOC_OWNER
+    /*
+     * 送信したスレッドが所有している領域ならば、所有権を移す
+     * (割り込み処理からの kx_send() では current が NULL)
+     */
+    if (!copy && current) {
+      kz_memowner *mp = memowner_release(current, p);
+      if (mp)
+        memowner_attach(thp, mp);
+    }
+#endif
+    waitque_remove(thp);
+    recvmsg_deliver(mboxp, thp, current, size, p, copy);
+    current = thp;
+    putcurrent();
+    return size;
+  }
+
+  /* メッセージ送信処理（メッセージバッファ不足なら送信せずにエラーを返す） */
+  if (sendmsg(mboxp, current, size, p, priority, copy) < 0)
+    return KZ_ERR_NORES;
+
+  recvmsg_waiting(mboxp);
+
+  return size;
+}
+
+/*
+ * システムコールの処理(kz_sendv(): 複数メッセージの一括送信)
+ *
+ * vec の count 個のメッセージを1回のシステムコールで順に格納し、送信できた
+ * 数を返す。満杯になった場合はブロックせずに、そこで送信をやめる
+ * (1つも送信できなければ KZ_ERR_FULL を返す)。
+ * 受信待ちのスレッドはメッセージごとに起こすが、スケジューリングは
+ * システムコールの最後に1回だけ行われる。
+ */
+static int thread_sendv(kz_msgbox_id_t id, kz_msgvec_t *vec, int count)
+{
+  kz_msgbox *mboxp;
+  kz_thread *thp;
+  int i;
+
+  putcurrent();
+
+  if (!mbox_valid(id) || (count < 0))
+    return KZ_ERR_PARAM;
+  mboxp = MSGBOX(id);
+
+  thp = current;
+  for (i = 0; i < count; i++) {
+    if (mboxp->capacity && (mboxp->count >= mboxp->capacity))
+      break;
+    if (sendmsg(mboxp, thp, vec[i].size, vec[i].p, KZ_MSG_PRIORITY_DEFAULT, 0) < 0)
+      break;
+    recvmsg_waiting(mboxp);
+    current = thp;
+  }
+
+  if ((i == 0) && (count > 0)) {
+    if (mboxp->capacity && (mboxp->count >= mboxp->capacity))
+      return KZ_ERR_FULL;
+    return KZ_ERR_NORES;
+  }
+
+  return i;
+}
+
+/*
+ * システムコールの処理(kz_recv(), kz_trecv(): メッセージ受信)
+ *
+ * timeout が正の場合は、指定ティック数が経過してもメッセージが
+ * 届かなければ受信待ちを解除して KZ_ERR_TIMEOUT を返す。
+ * timeout が負の場合(kz_precv())はブロックせず、メッセージがなければ
+ * KZ_ERR_EMPTY を返す。
+ */
+static kz_thread_id_t thread_recv(kz_msgbox_id_t id, int *sizep, char **pp,
+                                  int timeout)
+{
+  kz_msgbox *mboxp;
+  kz_thread *thp;
+
+  if (!mbox_valid(id)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  mboxp = MSGBOX(id);
+
+  if (mboxp->head == NULL) {
+    /* ポーリング受信でメッセージがない場合はそのまま戻る */
+    if (timeout < 0) {
+      putcurrent();
+      return KZ_ERR_EMPTY;
+    }
+
+    /*
+     * メッセージボックスにメッセージがないので受信待ちキューに接続し、
+     * スレッドをスリープさせる（システムコールがブロックする）
+     */
+    waitque_insert(&mboxp->receiver, current,
+                   mboxp->attr & KZ_MSGBOX_ATTR_PRIORITY);
+    if (timeout > 0)
+      timerque_insert(current, timeout);
+    return -1;
+  }
+
+  /* メッセージの受信処理 */
+  recvmsg(mboxp, current);
+  /* メッセージを受信できたのでレディ状態にする */
+  putcurrent();
+
+  /* 空きができたので、送信待ちのスレッドがいればメッセージを格納する */
+  thp = current;
+  sendmsg_waiting(mboxp);
+  current = thp;
+
+  return current->syscall.param->un.recv.ret;
+}
+
+/*
+ * システムコールの処理(kz_recv_any(): 複数のメッセージボックスからの受信)
+ *
+ * mask のビットに対応するメッセージボックスのいずれかにメッセージが届くまで
+ * 待ち、受信したメッセージボックスのIDを *idp に返す。メッセージがすでに
+ * あれば、番号の小さいメッセージボックスから受信する。
+ * 個別に kz_recv() で待っているスレッドがいれば、そちらが優先される。
+ */
+static kz_thread_id_t thread_recv_any(uint16 mask)
+{
+  kz_msgbox *mboxp = NULL;
+  kz_thread *thp;
+  int i;
+
+  if ((mask == 0) || (mask & ~(uint16)((1UL << MSGBOX_NUM) - 1))) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+
+  for (i = 0; i < MSGBOX_NUM; i++) {
+    if ((mask & (1U << i)) && MSGBOX(i)->head) {
+      mboxp = MSGBOX(i);
+      break;
+    }
+  }
+
+  if (mboxp == NULL) {
+    /* どれにもメッセージがないので、全体で1つの受信待ちキューに接続する */
+    waitque_insert(&recvany_receiver, current, 0);
+    return -1;
+  }
+
+  /* 以降は thread_recv() と同様 */
+  recvmsg(mboxp, current);
+  putcurrent();
+
+  thp = current;
+  sendmsg_waiting(mboxp);
+  current = thp;
+
+  return current->syscall.param->un.recv.ret;
+}
+
+/*
+ * システムコールの処理(kz_call(): メッセージ送信と返信待ち)
+ *
+ * メッセージを送信した後、kz_reply() で返信されるまでブロックする。
+ * 送信と受信のシステムコールを1回にまとめる。
+ */
+static int thread_call(kz_msgbox_id_t id, int size, char *p)
+{
+  kz_msgbox *mboxp;
+
+  if (!mbox_valid(id)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  mboxp = MSGBOX(id);
+
+  /* 満杯の場合は返信を待てないので、ブロックせずにエラーを返す */
+  if (mboxp->capacity && (mboxp->count >= mboxp->capacity)) {
+    putcurrent();
+    return KZ_ERR_FULL;
+  }
+
+  /* レディキューには戻さずに、返信待ちにする */
+  if (sendmsg(mboxp, current, size, p, KZ_MSG_PRIORITY_DEFAULT, 0) < 0) {
+    putcurrent();
+    return KZ_ERR_NORES;
+  }
+  current->flags |= KZ_THREAD_FLAG_REPLY;
+
+  /* 受信待ちスレッドが存在している場合には受信処理を行う */
+  recvmsg_waiting(mboxp);
+
+  return -1;
+}
+
+/*
+ * システムコールの処理(kz_reply(): kz_call()への返信)
+ *
+ * 返信待ちのスレッドを、返信したスレッドより先にレディキューに繋ぐ。
+ * これにより同一優先度であれば、返信先のスレッドに直接実行権が渡る。
+ */
+static int thread_reply(kz_thread_id_t id, int size, char *p)
+{
+  kz_thread *thp = thread_find(id);
+  kz_thread *self = current;
+  kz_syscall_param_t *param;
+
+  if (!thp) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  if (!(thp->flags & KZ_THREAD_FLAG_REPLY)) {
+    putcurrent();
+    return KZ_ERR_STATE;
+  }
+  thp->flags &= ~KZ_THREAD_FLAG_REPLY;
+
+  /* 返信待ちのスレッドに返す値を設定する */
+  param = thp->syscall.param;
+  param->un.call.ret = size;
+  if (param->un.call.replyp)
+    *(param->un.call.replyp) = p;
+#ifdef KZ_KMALLOC_OWNER
+  /* 返信した領域の所有権を返信待ちのスレッドに移す */
+  {
+    kz_memowner *mp = memowner_release(self, p);
+    if (mp)
+      memowner_attach(thp, mp);
+  }
+#endif
+
+  current = thp;
+  putcurrent();
+
+  current = self;
+  putcurrent();
+
+  return 0;
+}
+
+/* システムコールの処理(kz_mbox_create(): メッセージボックスの作成) */
+static kz_msgbox_id_t thread_mbox_create(int attr)
+{
+  int i;
+  kz_msgbox *mboxp;
+
+  putcurrent();
+
+  /* 固定ID以降から空いているメッセージボックスを検索 */
+  for (i = MSGBOX_ID_NUM; i < MSGBOX_NUM; i++) {
+    mboxp = MSGBOX(i);
+    if (!(mboxp->flags & KZ_MSGBOX_FLAG_USED))
+      break;
+  }
+  if (i == MSGBOX_NUM)
+    return KZ_ERR_NORES;
+
+  memset(mboxp, 0, sizeof(*mboxp));
+  mboxp->attr  = attr;
+  mboxp->flags = KZ_MSGBOX_FLAG_USED;
+#ifdef KZ_MBOX_STAT
+  memset(&mboxstat[i], 0, sizeof(mboxstat[i]));
+#endif
+
+  return i;
+}
+
+/* メッセージボックスの取り置きを、共有のプールに返す */
+static void mboxres_release(kz_mboxres *resp)
+{
+  kz_msgbuf *mp;
+  void *block;
+
+  while ((mp = resp->nodes) != NULL) {
+    KZ_LIST_POP(resp->nodes, next);
+    KZ_LIST_PUSH(msgbuf_free, mp, next);
+  }
+  while ((block = resp->blocks) != NULL) {
+    resp->blocks = *(void **)block;
+    kzmem_free(block);
+  }
+  memset(resp, 0, sizeof(*resp));
+}
+
+/*
+ * システムコールの処理(kz_mbox_reserve(): メッセージボックスの取り置き)
+ * nodes 個のメッセージバッファと、size バイトの本体の領域 blocks 個を
+ * 共有のプールから取り置く。本体の領域は kz_mbox_alloc() で獲得し、
+ * kz_mbox_free() で解放する。取り置きの変更はできない（KZ_ERR_STATE）。
+ */
+static int thread_mbox_reserve(kz_msgbox_id_t id, int nodes, int blocks,
+                               int size)
+{
+  kz_mboxres *resp;
+  kz_msgbuf *mp;
+  void *block;
+
+  putcurrent();
+
+  if (!mbox_valid(id) || (nodes < 0) || (blocks < 0)
+      || (blocks && (size < (int)sizeof(void *))))
+    return KZ_ERR_PARAM;
+
+  resp = MBOXRES(id);
+  if (resp->nodes_max || resp->blocks_max)
+    return KZ_ERR_STATE;
+
+  resp->blocksize = size;
+  for (; resp->nodes_num < nodes; resp->nodes_num++) {
+    if ((mp = msgbuf_free) == NULL)
+      break;
+    KZ_LIST_POP(msgbuf_free, next);
+    KZ_LIST_PUSH(resp->nodes, mp, next);
+  }
+  for (; resp->blocks_num < blocks; resp->blocks_num++) {
+    if ((block = kzmem_alloc(size)) == NULL)
+      break;
+    *(void **)block = resp->blocks;
+    resp->blocks = block;
+  }
+
+  /* 全て取り置けなければ、取り置いた分を戻す */
+  if ((resp->nodes_num < nodes) || (resp->blocks_num < blocks)) {
+    mboxres_release(resp);
+    return KZ_ERR_NORES;
+  }
+  resp->nodes_max  = nodes;
+  resp->blocks_max = blocks;
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_mbox_alloc(): 取り置きからの本体の領域の獲得)
+ * 取り置きが尽きていれば、共有のプールから同じサイズで獲得する
+ */
+static void *thread_mbox_alloc(kz_msgbox_id_t id)
+{
+  kz_mboxres *resp;
+  void *block;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= MSGBOX_NUM))
+    return NULL;
+  resp = MBOXRES(id);
+  if (!resp->blocksize)
+    return NULL;
+  if ((block = resp->blocks) != NULL) {
+    resp->blocks = *(void **)block;
+    resp->blocks_num--;
+    return block;
+  }
+  return kzmem_alloc(resp->blocksize);
+}
+
+/*
+ * システムコールの処理(kz_mbox_free(): 本体の領域の解放)
+ * 取り置きが減っていれば取り置きに戻し、そうでなければ共有のプールに戻す
+ */
+static int thread_mbox_free(kz_msgbox_id_t id, void *block)
+{
+  kz_mboxres *resp;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= MSGBOX_NUM))
+    return KZ_ERR_PARAM;
+  resp = MBOXRES(id);
+  if (resp->blocks_num < resp->blocks_max) {
+    *(void **)block = resp->blocks;
+    resp->blocks = block;
+    resp->blocks_num++;
+  } else {
+    kzmem_free(block);
+  }
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_mbox_delete(): メッセージボックスの削除)
+ * 固定IDのもの、およびメッセージや待ちスレッドが残っているものは削除できない
+ */
+static int thread_mbox_delete(kz_msgbox_id_t id)
+{
+  kz_msgbox *mboxp;
+
+  putcurrent();
+
+  if ((id < MSGBOX_ID_NUM) || (id >= MSGBOX_NUM))
+    return KZ_ERR_PARAM;
+
+  mboxp = MSGBOX(id);
+  if (!(mboxp->flags & KZ_MSGBOX_FLAG_USED))
+    return KZ_ERR_PARAM;
+  if (mboxp->head || mboxp->receiver || mboxp->sender)
+    return KZ_ERR_STATE;
+
+  mboxres_release(MBOXRES(id));
+  mboxp->flags = 0;
+  return 0;
+}
+
+/* システムコールの処理(kz_mbox_setcap(): メッセージボックスの最大メッセージ数設定) */
+static int thread_mbox_setcap(kz_msgbox_id_t id, int capacity)
+{
+  kz_msgbox *mboxp;
+  int old;
+
+  putcurrent();
+
+  if (!mbox_valid(id))
+    return KZ_ERR_PARAM;
+  mboxp = MSGBOX(id);
+  old = mboxp->capacity;
+  if (capacity >= 0)
+    mboxp->capacity = capacity;
+  return old;
+}
+
+/* システムコールの処理(kz_mbox_setattr(): メッセージボックスの属性設定) */
+static int thread_mbox_setattr(kz_msgbox_id_t id, int attr)
+{
+  kz_msgbox *mboxp;
+  int old;
+
+  putcurrent();
+
+  if (!mbox_valid(id))
+    return KZ_ERR_PARAM;
+  mboxp = MSGBOX(id);
+  old = mboxp->attr;
+  mboxp->attr = attr;
+  return old;
+}
+
+/* システムコールの処理(kz_sem_create(): セマフォの作成) */
+static kz_sem_id_t thread_sem_create(int count)
+{
+  int i;
+  kz_sem *semp;
+
+  putcurrent();
+
+  if (count < 0)
+    return KZ_ERR_PARAM;
+
+  for (i = 0; i < SEM_NUM; i++) {
+    semp = &sems[i];
+    if (!(semp->flags & KZ_SEM_FLAG_USED))
+      break;
+  }
+  if (i == SEM_NUM)
+    return KZ_ERR_NORES;
+
+  semp->waiter = NULL;
+  semp->count  = count;
+  semp->flags  = KZ_SEM_FLAG_USED;
+
+  return i;
+}
+
+/* システムコールの処理(kz_sem_delete(): セマフォの削除) */
+static int thread_sem_delete(kz_sem_id_t id)
+{
+  kz_sem *semp;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= SEM_NUM) || !(sems[id].flags & KZ_SEM_FLAG_USED))
+    return KZ_ERR_PARAM;
+  semp = &sems[id];
+  if (semp->waiter)
+    return KZ_ERR_STATE;
+
+  semp->flags = 0;
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_sem_wait(): セマフォの獲得)
+ * 資源がなければ、kz_sem_post() されるまでブロックする
+ */
+static int thread_sem_wait(kz_sem_id_t id)
+{
+  kz_sem *semp;
+
+  if ((id < 0) || (id >= SEM_NUM) || !(sems[id].flags & KZ_SEM_FLAG_USED)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  semp = &sems[id];
+
+  if (semp->count > 0) {
+    semp->count--;
+    putcurrent();
+    return 0;
+  }
+
+  /* 獲得待ちキューに接続しスレッドをスリープさせる */
+  waitque_insert(&semp->waiter, current, 0);
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_sem_post(), kx_sem_post(): セマフォの返却)
+ * 獲得待ちのスレッドがいれば、資源を直接渡してブロック解除する。
+ * メモリの獲得などを行わないので、割り込みハンドラからも安全に呼べる。
+ */
+static int thread_sem_post(kz_sem_id_t id)
+{
+  kz_sem *semp;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= SEM_NUM) || !(sems[id].flags & KZ_SEM_FLAG_USED))
+    return KZ_ERR_PARAM;
+  semp = &sems[id];
+  if (semp->waiter == NULL) {
+    semp->count++;
+    return 0;
+  }
+
+  current = semp->waiter;
+  waitque_remove(current);
+  putcurrent();
+
+  return 0;
+}
+
+/* システムコールの処理(kz_mutex_create(): mutexの作成) */
+static kz_mutex_id_t thread_mutex_create(void)
+{
+  int i;
+  kz_mutex *mtxp;
+
+  putcurrent();
+
+  for (i = 0; i < MUTEX_NUM; i++) {
+    mtxp = MUTEX(i);
+    if (!(mtxp->flags & KZ_MUTEX_FLAG_USED))
+      break;
+  }
+  if (i == MUTEX_NUM)
+    return KZ_ERR_NORES;
+
+  memset(mtxp, 0, sizeof(*mtxp));
+  mtxp->flags = KZ_MUTEX_FLAG_USED;
+
+  return i;
+}
+
+/* システムコールの処理(kz_mutex_delete(): mutexの削除) */
+static int thread_mutex_delete(kz_mutex_id_t id)
+{
+  kz_mutex *mtxp;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= MUTEX_NUM) || !(MUTEX(id)->flags & KZ_MUTEX_FLAG_USED))
+    return KZ_ERR_PARAM;
+  mtxp = MUTEX(id);
+  if (mtxp->owner)
+    return KZ_ERR_STATE;
+
+  mtxp->flags = 0;
+  return 0;
+}
+
+/* スレッドが獲得待ちしているmutexを取得する */
+static kz_mutex *thread_waiting_mutex(kz_thread *thp)
+{
+  int i;
+
+  if (thp->waitque == NULL)
+    return NULL;
+  for (i = 0; i < MUTEX_NUM; i++) {
+    if (thp->waitque == &MUTEX(i)->waiter)
+      return MUTEX(i);
+  }
+  return NULL;
+}
+
+/*
+ * システムコールの処理(kz_mutex_lock(): mutexの獲得)
+ *
+ * 他のスレッドが獲得済みであれば獲得待ちキューに接続してブロックする。
+ * その際、所有スレッドの優先度が低ければ待ちスレッドの優先度を継承させる。
+ * 所有スレッドがさらに別のmutexを待っている場合は、その所有スレッドにも
+ * 順に継承させる。
+ */
+static int thread_mutex_lock(kz_mutex_id_t id)
+{
+  kz_mutex *mtxp;
+  kz_thread *thp;
+
+  if ((id < 0) || (id >= MUTEX_NUM) || !(MUTEX(id)->flags & KZ_MUTEX_FLAG_USED)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  mtxp = MUTEX(id);
+
+  if (mtxp->owner == NULL) {
+    mtxp->owner = current;
+    KZ_LIST_PUSH(current->mutex, mtxp, next);
+    putcurrent();
+    return 0;
+  }
+
+  /* 再帰的な獲得はできない */
+  if (mtxp->owner == current) {
+    putcurrent();
+    return KZ_ERR_STATE;
+  }
+
+  waitque_insert(&mtxp->waiter, current, 1);
+
+  /* 優先度継承 */
+  for (thp = mtxp->owner; thp && (current->priority < thp->priority); ) {
+    thread_setpri(thp, current->priority);
+    mtxp = thread_waiting_mutex(thp);
+    thp = mtxp ? mtxp->owner : NULL;
+  }
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_mutex_unlock(): mutexの解放)
+ *
+ * 継承していた優先度を元に戻し、獲得待ちキューの先頭のスレッドに
+ * mutexを渡してブロック解除する。
+ */
+static int thread_mutex_unlock(kz_mutex_id_t id)
+{
+  kz_mutex *mtxp;
+
+  if ((id < 0) || (id >= MUTEX_NUM) || !(MUTEX(id)->flags & KZ_MUTEX_FLAG_USED)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  mtxp = MUTEX(id);
+
+  if (mtxp->owner != current) {
+    putcurrent();
+    return KZ_ERR_STATE;
+  }
+
+  /* 獲得中のmutexのリストから外す */
+  KZ_LIST_REMOVE(current->mutex, mtxp, next);
+  mtxp->next = NULL;
+  mtxp->owner = NULL;
+
+  /* レディキューから外れている状態なので、直接優先度を戻せる */
+  current->priority = thread_inherited_priority(current);
+  putcurrent();
+
+  mutex_pass(mtxp);
+
+  return 0;
+}
+
+/*
+ * 所有者のいなくなったmutexを、獲得待ちキューの先頭のスレッドに渡して
+ * ブロック解除する（current は変更しない）
+ */
+static void mutex_pass(kz_mutex *mtxp)
+{
+  kz_thread *thp, *self = current;
+
+  if (!mtxp->waiter)
+    return;
+
+  thp = mtxp->waiter;
+  waitque_remove(thp);
+  mtxp->owner = thp;
+  KZ_LIST_PUSH(thp->mutex, mtxp, next);
+  /* 残りの獲得待ちスレッドの優先度を継承する */
+  thp->priority = thread_inherited_priority(thp);
+
+  current = thp;
+  putcurrent();
+  current = self;
+}
+
+/* システムコールの処理(kz_flag_create(): イベントフラグの作成) */
+static kz_flag_id_t thread_flag_create(uint16 pattern)
+{
+  int i;
+  kz_flag *flgp;
+
+  putcurrent();
+
+  for (i = 0; i < FLAG_NUM; i++) {
+    flgp = &eventflags[i];
+    if (!(flgp->flags & KZ_FLAG_FLAG_USED))
+      break;
+  }
+  if (i == FLAG_NUM)
+    return KZ_ERR_NORES;
+
+  flgp->waiter  = NULL;
+  flgp->pattern = pattern;
+  flgp->flags   = KZ_FLAG_FLAG_USED;
+
+  return i;
+}
+
+/* システムコールの処理(kz_flag_delete(): イベントフラグの削除) */
+static int thread_flag_delete(kz_flag_id_t id)
+{
+  kz_flag *flgp;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= FLAG_NUM) || !(eventflags[id].flags & KZ_FLAG_FLAG_USED))
+    return KZ_ERR_PARAM;
+  flgp = &eventflags[id];
+  if (flgp->waiter)
+    return KZ_ERR_STATE;
+
+  flgp->flags = 0;
+  return 0;
+}
+
+/*
+ * 待ち条件が成立していれば、成立時のパターンを返して待ちを解除する
+ * (KZ_FLAG_WAIT_CLEAR が指定されていれば待ちパターンのビットをクリアする)
+ */
+static int flag_check(kz_flag *flgp, kz_syscall_param_t *p)
+{
+  uint16 match = flgp->pattern & p->un.flag_wait.pattern;
+
+  if (p->un.flag_wait.mode & KZ_FLAG_WAIT_AND) {
+    if (match != p->un.flag_wait.pattern)
+      return 0;
+  } else {
+    if (!match)
+      return 0;
+  }
+
+  if (p->un.flag_wait.flagsp)
+    *(p->un.flag_wait.flagsp) = flgp->pattern;
+  if (p->un.flag_wait.mode & KZ_FLAG_WAIT_CLEAR)
+    flgp->pattern &= ~p->un.flag_wait.pattern;
+
+  return 1;
+}
+
+/*
+ * システムコールの処理(kz_flag_wait(): イベントフラグ待ち)
+ * 条件が成立していなければ、kz_flag_set() で成立するまでブロックする
+ */
+static int thread_flag_wait(kz_flag_id_t id)
+{
+  kz_flag *flgp;
+
+  if ((id < 0) || (id >= FLAG_NUM) || !(eventflags[id].flags & KZ_FLAG_FLAG_USED)) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  flgp = &eventflags[id];
+
+  if (flag_check(flgp, current->syscall.param)) {
+    putcurrent();
+    return 0;
+  }
+
+  waitque_insert(&flgp->waiter, current, 0);
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_flag_set(), kx_flag_set(): イベントフラグのセット)
+ * 条件が成立した待ちスレッドをすべてブロック解除する
+ */
+static int thread_flag_set(kz_flag_id_t id, uint16 pattern)
+{
+  kz_flag *flgp;
+  kz_thread *thp, *next;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= FLAG_NUM) || !(eventflags[id].flags & KZ_FLAG_FLAG_USED))
+    return KZ_ERR_PARAM;
+  flgp = &eventflags[id];
+  flgp->pattern |= pattern;
+
+  for (thp = flgp->waiter; thp; thp = next) {
+    next = thp->next;
+    if (flag_check(flgp, thp->syscall.param)) {
+      waitque_remove(thp);
+      current = thp;
+      putcurrent();
+    }
+  }
+
+  return 0;
+}
+
+/* システムコールの処理(kz_flag_clear(): イベントフラグのクリア) */
+static int thread_flag_clear(kz_flag_id_t id, uint16 pattern)
+{
+  putcurrent();
+
+  if ((id < 0) || (id >= FLAG_NUM) || !(eventflags[id].flags & KZ_FLAG_FLAG_USED))
+    return KZ_ERR_PARAM;
+  eventflags[id].pattern &= ~pattern;
+  return 0;
+}
+
+#if KZ_CONFIG_TOPIC
+/* システムコールの処理(kz_topic_create(): トピックの作成) */
+static kz_topic_id_t thread_topic_create(void)
+{
+  int i;
+
+  putcurrent();
+
+  for (i = 0; i < TOPIC_NUM; i++) {
+    if (!(topics[i].flags & KZ_TOPIC_FLAG_USED))
+      break;
+  }
+  if (i == TOPIC_NUM)
+    return KZ_ERR_NORES;
+
+  topics[i].subscribers = 0;
+  topics[i].flags = KZ_TOPIC_FLAG_USED;
+
+  return i;
+}
+
+/*
+ * システムコールの処理(kz_topic_delete(): トピックの削除)
+ * 配信済みのメッセージは、受信者の kz_topic_release() で解放される
+ */
+static int thread_topic_delete(kz_topic_id_t id)
+{
+  putcurrent();
+
+  if ((id < 0) || (id >= TOPIC_NUM) || !(topics[id].flags & KZ_TOPIC_FLAG_USED))
+    return KZ_ERR_PARAM;
+
+  topics[id].flags = 0;
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_topic_subscribe(), kz_topic_unsubscribe():
+ * 購読の開始と終了)
+ */
+static int thread_topic_subscribe(kz_topic_id_t id, kz_msgbox_id_t box, int on)
+{
+  uint16 bit;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= TOPIC_NUM) || !(topics[id].flags & KZ_TOPIC_FLAG_USED))
+    return KZ_ERR_PARAM;
+  if ((box < 0) || (box >= MSGBOX_NUM))
+    return KZ_ERR_PARAM;
+
+  bit = 1 << box;
+  if (on)
+    topics[id].subscribers |= bit;
+  else
+    topics[id].subscribers &= ~bit;
+
+  return 0;
+}
+
+/* システムコールの処理(kz_topic_alloc(): 配信する領域の獲得) */
+static void *thread_topic_alloc(int size)
+{
+  kz_topicbuf *bp;
+
+  putcurrent();
+
+  /* 所有者は付けない（配信後は受信者が解放する） */
+  bp = kmalloc(size + sizeof(*bp));
+  if (bp == NULL)
+    return NULL;
+  bp->refs = 0;
+
+  return bp + 1;
+}
+
+/*
+ * システムコールの処理(kz_topic_publish(): 購読している全てに配信)
+ * 配信先ごとにメッセージバッファを1つずつ使うが、p の領域はコピーしない。
+ * 満杯のメッセージボックスには配信せずに（送信者をブロックさせない）、
+ * 配信できた数を返す。1つも配信できなければ、ここで領域を解放する。
+ */
+static int thread_topic_publish(kz_topic_id_t id, int size, char *p)
+{
+  kz_topicbuf *bp;
+  kz_thread *thp;
+  kz_msgbox *mboxp;
+  uint16 subscribers;
+  int i, count = 0;
+
+  putcurrent();
+
+  if ((id < 0) || (id >= TOPIC_NUM) || !(topics[id].flags & KZ_TOPIC_FLAG_USED))
+    return KZ_ERR_PARAM;
+  /* kz_topic_alloc() で獲得した領域でなければ、参照カウントに触れない */
+  if ((p == NULL) || (kzmem_check((kz_topicbuf *)p - 1) < 0))
+    return KZ_ERR_PARAM;
+  bp = (kz_topicbuf *)p - 1;
+
+  /* 受信したスレッドが動作するのはシステムコールから戻った後 */
+  thp = current;
+  subscribers = topics[id].subscribers;
+  for (i = 0; subscribers; i++, subscribers >>= 1) {
+    if (!(subscribers & 1))
+      continue;
+    mboxp = MSGBOX(i);
+    if (!(mboxp->flags & KZ_MSGBOX_FLAG_USED) && (i >= MSGBOX_ID_NUM))
+      continue;
+    if (mboxp->capacity && (mboxp->count >= mboxp->capacity))
+      continue;
+    if (sendmsg(mboxp, thp, size, p, KZ_MSG_PRIORITY_DEFAULT, 0) < 0)
+      break;
+    bp->refs++;
+    count++;
+    recvmsg_waiting(mboxp);
+    current = thp;
+  }
+
+  if (count == 0)
+    kzmem_free(bp);
+
+  return count;
+}
+
+/*
+ * システムコールの処理(kz_topic_release(): 受信したメッセージの解放)
+ * 最後の受信者が解放したときに領域を解放する
+ */
+static int thread_topic_release(char *p)
+{
+  kz_topicbuf *bp;
+
+  putcurrent();
+
+  if ((p == NULL) || (kzmem_check((kz_topicbuf *)p - 1) < 0))
+    return KZ_ERR_PARAM;
+  bp = (kz_topicbuf *)p - 1;
+  if (bp->refs == 0)
+    return KZ_ERR_STATE;
+  if (--bp->refs == 0)
+    kzmem_free(bp);
+
+  return 0;
+}
+#endif
+
+/*
+ * システムコールの処理(kz_ring_create(): リングバッファの作成)
+ * buf は size バイト（2の累乗）の領域で、格納できるのは size-1 バイトまで
+ */
+static kz_ring_id_t thread_ring_create(char *buf, int size, int threshold)
+{
+  int i;
+  kz_ring *ringp;
+
+  putcurrent();
+
+  if ((size < 2) || (size & (size - 1)))
+    return KZ_ERR_PARAM;
+  if ((threshold < 1) || (threshold > size - 1))
+    threshold = size - 1;
+
+  for (i = 0; i < RING_NUM; i++) {
+    ringp = &rings[i];
+    if (!(ringp->flags & KZ_RING_FLAG_USED))
+      break;
+  }
+  if (i == RING_NUM)
+    return KZ_ERR_NORES;
+
+  memset(ringp, 0, sizeof(*ringp));
+  ringp->buf       = buf;
+  ringp->mask      = size - 1;
+  ringp->threshold = threshold;
+  ringp->flags     = KZ_RING_FLAG_USED;
+
+  return i;
+}
+
+/* システムコールの処理(kz_ring_delete(): リングバッファの削除) */
+static int thread_ring_delete(kz_ring_id_t id)
+{
+  kz_ring *ringp = &rings[id];
+
+  putcurrent();
+
+  if (ringp->reader)
+    return KZ_ERR_STATE;
+
+  ringp->flags = 0;
+  return 0;
+}
+
+/* リングバッファを待っているスレッドを起こす（current は変えない） */
+static void ring_wakeup(kz_ring *ringp)
+{
+  kz_thread *thp = current;
+
+  current = ringp->reader;
+  waitque_remove(current);
+  current->syscall.param->un.ring_wait.ret = 0;
+  putcurrent();
+  current = thp;
+}
+
+/*
+ * システムコールの処理(kz_ring_wait(): リングバッファのデータ待ち)
+ * データがあればすぐに戻る。なければ書き込みを待つ（読み出しは kz_ring_get()）
+ */
+static int thread_ring_wait(kz_ring_id_t id)
+{
+  kz_ring *ringp = &rings[id];
+
+  if (!(ringp->flags & KZ_RING_FLAG_USED) || ringp->reader) {
+    putcurrent();
+    return KZ_ERR_STATE;
+  }
+  if (ringp->head != ringp->tail) {
+    putcurrent();
+    return 0;
+  }
+
+  waitque_insert(&ringp->reader, current, 0);
+  return -1;
+}
+
+/*
+ * システムコールの処理(リングバッファのしきい値未満のデータの受け渡し)
+ * kz_idle() から呼ばれて、データがあるのに待っているスレッドを起こす
+ */
+static int thread_ring_flush(void)
+{
+  int i;
+  kz_ring *ringp;
+
+  putcurrent();
+
+  ring_pending = 0;
+  for (i = 0; i < RING_NUM; i++) {
+    ringp = &rings[i];
+    if (ringp->reader && (ringp->head != ringp->tail))
+      ring_wakeup(ringp);
+  }
+
+  return 0;
+}
+
+#if KZ_CONFIG_SWTIMER
+/* ソフトウェアタイマを満了待ちのキューに接続する（timerque_insert() と同様） */
+static void swtimerque_insert(kz_swtimer *tp, int ticks)
+{
+  kz_swtimer **tpp;
+
+  for (tpp = &swtimerque; *tpp; tpp = &(*tpp)->next) {
+    if (ticks < (*tpp)->delta)
+      break;
+    ticks -= (*tpp)->delta;
+  }
+  if (*tpp)
+    (*tpp)->delta -= ticks;
+
+  tp->delta = ticks;
+  KZ_LIST_INSERT(tpp, tp, next);
+  tp->flags |= KZ_SWTIMER_FLAG_QUEUED;
+}
+
+/* ソフトウェアタイマを満了待ちのキューから外す */
+static void swtimerque_remove(kz_swtimer *tp)
+{
+  kz_swtimer **tpp;
+
+  if (!(tp->flags & KZ_SWTIMER_FLAG_QUEUED))
+    return;
+
+  tpp = &swtimerque;
+  KZ_LIST_FIND(tpp, tp, next);
+  if (*tpp) {
+    if (tp->next)
+      tp->next->delta += tp->delta;
+    KZ_LIST_UNLINK(tpp, next);
+  }
+
+  tp->next = NULL;
+  tp->flags &= ~KZ_SWTIMER_FLAG_QUEUED;
+}
+
+/*
+ * ソフトウェアタイマのメッセージの送信（タイマ割り込みから呼ばれる）
+ * 前回のメッセージが未受信、またはメッセージボックスが満杯の場合は送らずに
+ * overruns を数える。メッセージのサイズにはタイマのIDが入る。
+ */
+static void swtimer_send(kz_swtimer *tp)
+{
+  kz_msgbox *mboxp = MSGBOX(tp->box);
+  kz_msgbuf *mp = &tp->msg;
+
+  if ((tp->flags & KZ_SWTIMER_FLAG_SENT)
+      || (mboxp->capacity && (mboxp->count >= mboxp->capacity))) {
+    tp->overruns++;
+    return;
+  }
+  tp->flags |= KZ_SWTIMER_FLAG_SENT;
+
+  mp->next       = NULL;
+  mp->sender     = NULL;
+  mp->param.size = tp->id;
+  mp->param.p    = tp->p;
+  mp->owned      = 0;
+  mp->priority   = KZ_MSG_PRIORITY_DEFAULT;
+  mp->timer      = tp;
+  mbox_append(mboxp, mp);
+
+  recvmsg_waiting(mboxp);
+}
+
+/* ソフトウェアタイマの満了処理（タイマ割り込みごとに呼ばれる） */
+static void swtimer_tick(void)
+{
+  kz_swtimer *tp;
+
+  if (swtimerque == NULL)
+    return;
+
+  swtimerque->delta--;
+  while (swtimerque && (swtimerque->delta <= 0)) {
+    tp = swtimerque;
+    KZ_LIST_POP(swtimerque, next);
+    tp->next = NULL;
+    tp->flags &= ~KZ_SWTIMER_FLAG_QUEUED;
+
+    /* 周期タイマは、満了時刻を基準に次の満了時刻を設定する */
+    if (tp->periodic)
+      swtimerque_insert(tp, tp->ticks);
+
+    if (tp->func)
+      tp->func(tp->p, tp->id);
+    else
+      swtimer_send(tp);
+  }
+}
+
+/*
+ * システムコールの処理(kz_timer_create(): ソフトウェアタイマの作成)
+ * ticks ティック後（periodic が真ならば ticks ティックごと）に満了する。
+ * func が NULL ならばメッセージボックス box にメッセージを送り、
+ * そうでなければタイマ割り込みの延長で func(p, id) を呼び出す
+ * (割り込みハンドラと同様に、サービスコール以外は呼べない)。
+ */
+static kz_timer_id_t thread_timer_create(int ticks, int periodic,
+                                         kz_msgbox_id_t box,
+                                         kz_defer_func_t func, char *p)
+{
+  int i;
+  kz_swtimer *tp;
+
+  putcurrent();
+
+  if ((ticks <= 0) || (!func && ((unsigned int)box >= MSGBOX_NUM)))
+    return KZ_ERR_PARAM;
+
+  for (i = 0; i < SWTIMER_NUM; i++) {
+    tp = &swtimers[i];
+    if (!(tp->flags & KZ_SWTIMER_FLAG_USED))
+      break;
+  }
+  if (i == SWTIMER_NUM)
+    return KZ_ERR_NORES;
+
+  memset(tp, 0, sizeof(*tp));
+  tp->ticks    = ticks;
+  tp->periodic = periodic;
+  tp->flags    = KZ_SWTIMER_FLAG_USED;
+  tp->id       = i;
+  tp->box      = box;
+  tp->func     = func;
+  tp->p        = p;
+  swtimerque_insert(tp, ticks);
+
+  return i;
+}
+
+/*
+ * システムコールの処理(kz_timer_delete(): ソフトウェアタイマの削除)
+ * 送信したメッセージが受信されていない場合は、埋め込みのメッセージバッファが
+ * メッセージボックスに繋がっているので削除できない（KZ_ERR_STATE）。
+ */
+static int thread_timer_delete(kz_timer_id_t id)
+{
+  kz_swtimer *tp;
+
+  putcurrent();
+
+  if ((unsigned int)id >= SWTIMER_NUM)
+    return KZ_ERR_PARAM;
+  tp = &swtimers[id];
+  if (!(tp->flags & KZ_SWTIMER_FLAG_USED))
+    return KZ_ERR_PARAM;
+  if (tp->flags & KZ_SWTIMER_FLAG_SENT)
+    return KZ_ERR_STATE;
+
+  swtimerque_remove(tp);
+  tp->flags = 0;
+  return 0;
+}
+#endif
+
+static void thread_intr(softvec_type_t type, unsigned long sp);
+
+/* システムコールの処理(kz_setintr(): 割り込みハンドラ登録) */
+static int thread_setintr(softvec_type_t type, kz_handler_t handler)
+{
+  /*
+   * 割り込みを受け付けるために、ソフトウェア割り込みベクタに
+   * OSの割り込み処理の入口となる関数を登録する。
+   */
+  softvec_setintr(type, thread_intr);
+
+  handlers[type] = handler;
+  /* 処理後にレディキューに接続し直す */
+  putcurrent();
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_setintrlevel(): 割り込みの優先レベルの設定)
+ * 優先レベル1(INTR_LEVEL_HIGH)の割り込みは、優先レベル0の割り込みの
+ * 処理中にも受け付けられる（多重割り込み）。
+ */
+static int thread_setintrlevel(softvec_type_t type, int level)
+{
+  putcurrent();
+
+  if ((type < 0) || (type >= SOFTVEC_TYPE_NUM))
+    return KZ_ERR_PARAM;
+  if (intr_setlevel(type, level) < 0)
+    return KZ_ERR_PARAM;
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_heartbeat(): 死活監視の登録と生存の通知)
+ * 呼び出したスレッドを、ticks ティック以内に再度 kz_heartbeat() を呼ぶ
+ * スレッドとして監視する。ticks が0ならば監視をやめる。
+ */
+static int thread_heartbeat(int ticks)
+{
+  putcurrent();
+
+  if (ticks < 0)
+    return KZ_ERR_PARAM;
+  current->heartbeat.period = ticks;
+  current->heartbeat.deadline = systicks + ticks;
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_setdeadline(): 締め切りの設定)
+ * 締め切りを ticks ティック後とする。KZ_EDF_PRIORITY の優先度のスレッドは
+ * 締め切りの早い順に実行される（それ以外の優先度では使われない）。
+ */
+static int thread_setdeadline(int ticks)
+{
+  if (ticks < 0) {
+    putcurrent();
+    return KZ_ERR_PARAM;
+  }
+  /* レディキューに繋ぐ前に設定して、新しい締め切りの位置に繋ぐ */
+  current->deadline = systicks + ticks;
+  putcurrent();
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_setperiod(): 周期起動の設定)
+ * 最初の起動時刻を phase ティック後とし、以降 ticks ティックごとに
+ * kz_wait_period() から戻るようにする。ticks が0ならば周期起動をやめる。
+ */
+static int thread_setperiod(int ticks, int phase)
+{
+  putcurrent();
+
+  if ((ticks < 0) || (phase < 0))
+    return KZ_ERR_PARAM;
+  current->period.ticks = ticks;
+  current->period.release = systicks + phase;
+  current->period.overruns = 0;
+
+  return 0;
+}
+
+/*
+ * システムコールの処理(kz_wait_period(): 次の周期の起動時刻まで待つ)
+ * 起動時刻は絶対時刻で進めるので、スレッドの処理時間によって周期がずれない。
+ * 起動時刻をすでに過ぎていた場合は、間に合わなかった周期を飛ばして
+ * その数を返す（間に合っていれば0）。
+ * 締め切り（EDF）は、起動した周期の終わり（次の起動時刻）とする。
+ */
+static int thread_wait_period(void)
+{
+  uint32 wait;
+  int missed = 0;
+
+  if (!current->period.ticks) {
+    putcurrent();
+    return KZ_ERR_STATE;
+  }
+
+  /* release - systicks が負（最上位ビットが1）なら起動時刻を過ぎている */
+  while ((wait = current->period.release - systicks) & 0x80000000) {
+    current->period.release += current->period.ticks;
+    current->period.overruns++;
+    missed++;
+  }
+  current->period.release += current->period.ticks;
+  current->deadline = current->period.release;
+
+  if (wait > 0)
+    timerque_insert(current, wait);
+  else
+    putcurrent();
+
+  return missed;
+}
+
+#ifdef KZ_TRACE
+/*
+ * システムコールの処理(kz_strace(): システムコールのトレースの指定)
+ * 記録は call_functions() の前後で行う(strace_enter(), strace_exit())。
+ */
+static int thread_strace(kz_thread_id_t id, int on)
+{
+  kz_thread *thp = thread_find(id);
+  int old;
+
+  putcurrent();
+
+  if (!thp || !thp->init.func)
+    return KZ_ERR_PARAM;
+
+  old = (thp->flags & KZ_THREAD_FLAG_STRACE) ? 1 : 0;
+  if (on)
+    thp->flags |= KZ_THREAD_FLAG_STRACE;
+  else
+    thp->flags &= ~KZ_THREAD_FLAG_STRACE;
+
+  return old;
+}
+#endif
+
+#ifdef KZ_BUDGET
+/* CPU時間の割り当てを使い切って停止中のスレッドの数（kz_idle() で参照する） */
+static int budget_throttled;
+
+/* 停止中のスレッドをレディに戻す（kz_suspend() されていれば HELD にする） */
+static void budget_release(kz_thread *thp)
+{
+  kz_thread *self = current;
+
+  thp->flags &= ~KZ_THREAD_FLAG_THROTTLED;
+  budget_throttled--;
+  current = thp;
+  putcurrent();
+  current = self;
+}
+
+/*
+ * システムコールの処理(kz_setbudget(): CPU時間の割り当ての設定)
+ * id のスレッドを、period ティックごとに ticks ティックまでしか実行させない。
+ * 使い切ると次の周期の始まりまでレディキューから外す（tick_intr() で行う）。
+ * ticks か period が0ならば割り当てをやめ、停止中であればレディに戻す。
+ */
+static int thread_setbudget(kz_thread_id_t id, int ticks, int period)
+{
+  kz_thread *thp = thread_find(id);
+
+  putcurrent();
+
+  if (!thp || !thp->init.func || (ticks < 0) || (period < 0)
+      || (ticks > period))
+    return KZ_ERR_PARAM;
+
+  if (!ticks)
+    period = 0;
+  thp->budget.ticks = ticks;
+  thp->budget.period = period;
+  thp->budget.left = ticks;
+  thp->budget.release = systicks + period;
+  if (thp->flags & KZ_THREAD_FLAG_THROTTLED)
+    budget_release(thp);
+
+  return 0;
+}
+
+/*
+ * CPU時間の割り当ての処理（タイマ割り込みごとに呼ばれる）
+ * 割り込まれたスレッドの残りを減らし、使い切ったらレディキューから外す。
+ * mutexを獲得中であれば、待っているスレッドを止めないように解放まで遅らせる。
+ * 周期の始まりになったスレッドは残りを戻し、停止中であればレディに戻す
+ * （ティックレスアイドルでティックを飛ばした場合は、飛ばした周期を数えない）。
+ */
+static void budget_tick(void)
+{
+  kz_thread *thp;
+  int i;
+
+  if (current && (current->flags & KZ_THREAD_FLAG_READY)
+      && current->budget.period && (--current->budget.left <= 0)
+      && !current->mutex) {
+    readyque_remove(current);
+    current->flags |= KZ_THREAD_FLAG_THROTTLED;
+    current->budget.throttles++;
+    budget_throttled++;
+  }
+
+  for (i = 0; i < THREAD_NUM; i++) {
+    thp = THREAD(i);
+    if (!thp->budget.period)
+      continue;
+    /* 周期の始まり前ならば、差が負なので最上位ビットが立つ */
+    if ((systicks - thp->budget.release) & 0x80000000)
+      continue;
+    while (!((systicks - thp->budget.release) & 0x80000000))
+      thp->budget.release += thp->budget.period;
+    thp->budget.left = thp->budget.ticks;
+    if (thp->flags & KZ_THREAD_FLAG_THROTTLED)
+      budget_release(thp);
+  }
+}
+#endif
+
+/*
+ * システムコールの処理関数
+ * kz_syscall_type_t の番号で関数テーブルを引いて呼び出す
+ */
+/* kz_run() */
+static void call_run(kz_syscall_param_t *p)
+{
+  p->un.run.ret = thread_run(p->un.run.func, p->un.run.name,
+                             p->un.run.priority, p->un.run.stacksize,
+                             p->un.run.argc, p->un.run.argv);
+}
+
+/* kz_exit() */
+static void call_exit(kz_syscall_param_t *p)
+{
+  /* TCBが消去されるので戻り値を書き込んではいけない */
+  thread_exit();
+}
+
+/* kz_wait() */
+static void call_wait(kz_syscall_param_t *p)
+{
+  p->un.wait.ret = thread_wait();
+}
+
+/* kz_sleep() */
+static void call_sleep(kz_syscall_param_t *p)
+{
+  p->un.sleep.ret = thread_sleep(p->un.sleep.ticks);
+}
+
+/* kz_wakeup() */
+static void call_wakeup(kz_syscall_param_t *p)
+{
+  p->un.wakeup.ret = thread_wakeup(p->un.wakeup.id);
+}
+
+/* kz_suspend() */
+static void call_suspend(kz_syscall_param_t *p)
+{
+  p->un.suspend.ret = thread_suspend(p->un.suspend.id);
+}
+
+/* kz_resume() */
+static void call_resume(kz_syscall_param_t *p)
+{
+  p->un.suspend.ret = thread_resume(p->un.suspend.id);
+}
+
+#ifdef KZ_BUDGET
+/* kz_setbudget() */
+static void call_setbudget(kz_syscall_param_t *p)
+{
+  p->un.setbudget.ret = thread_setbudget(p->un.setbudget.id,
+                                         p->un.setbudget.ticks,
+                                         p->un.setbudget.period);
+}
+#endif
+
+#ifdef KZ_TRACE
+/* kz_strace() */
+static void call_strace(kz_syscall_param_t *p)
+{
+  p->un.strace.ret = thread_strace(p->un.strace.id, p->un.strace.on);
+}
+#endif
+
+/* kz_getid() */
+static void call_getid(kz_syscall_param_t *p)
+{
+  p->un.getid.ret = thread_getid();
+}
+
+/* kz_chpri() */
+static void call_chpri(kz_syscall_param_t *p)
+{
+  p->un.chpri.ret = thread_chpri(p->un.chpri.priority);
+}
+
+/* kz_setslice() */
+static void call_setslice(kz_syscall_param_t *p)
+{
+  p->un.setslice.ret = thread_setslice(p->un.setslice.priority,
+                                       p->un.setslice.ticks);
+}
+
+/* kz_stackinfo() */
+static void call_stackinfo(kz_syscall_param_t *p)
+{
+  p->un.stackinfo.ret = thread_stackinfo(p->un.stackinfo.id,
+                                         p->un.stackinfo.sizep,
+                                         p->un.stackinfo.usedp);
+}
+
+/* kz_getstat() */
+static void call_getstat(kz_syscall_param_t *p)
+{
+  p->un.getstat.ret = thread_getstat(p->un.getstat.id, p->un.getstat.statp);
+}
+
+/* kz_getload() */
+static void call_getload(kz_syscall_param_t *p)
+{
+  p->un.getload.ret = thread_getload(p->un.getload.samples);
+}
+
+/* kz_kmalloc() */
+static void call_kmalloc(kz_syscall_param_t *p)
+{
+  p->un.kmalloc.ret = thread_kmalloc(p->un.kmalloc.size);
+}
+
+/* kz_kmfree() */
+static void call_kmfree(kz_syscall_param_t *p)
+{
+  p->un.kmfree.ret = thread_kmfree(p->un.kmfree.p);
+}
+
+/* kz_memstat() */
+static void call_memstat(kz_syscall_param_t *p)
+{
+  p->un.memstat.ret = thread_memstat(p->un.memstat.index, p->un.memstat.statp);
+}
+
+/* kz_dmalloc() */
+static void call_dmalloc(kz_syscall_param_t *p)
+{
+  p->un.dmalloc.ret = thread_dmalloc(p->un.dmalloc.size);
+}
+
+/* kz_regionstat() */
+static void call_regionstat(kz_syscall_param_t *p)
+{
+  p->un.regionstat.ret = thread_regionstat(p->un.regionstat.statp);
+}
+
+/* kz_perfstat() */
+static void call_perfstat(kz_syscall_param_t *p)
+{
+  p->un.perfstat.ret = thread_perfstat(p->un.perfstat.statp,
+                                       p->un.perfstat.syscalls,
+                                       p->un.perfstat.num);
+}
+
+/* kz_dmfree() */
+static void call_dmfree(kz_syscall_param_t *p)
+{
+  p->un.dmfree.ret = thread_dmfree(p->un.dmfree.p);
+}
+
+/* kz_send() */
+static void call_send(kz_syscall_param_t *p)
+{
+  p->un.send.ret = thread_send(p->un.send.id, p->un.send.size, p->un.send.p,
+                               p->un.send.nowait, p->un.send.priority,
+                               p->un.send.copy);
+}
+
+/* kz_recv() */
+static void call_recv(kz_syscall_param_t *p)
+{
+  /* kz_recv_free() ならば、受信の前に前回のメッセージの領域を解放する */
+  if (p->un.recv.release)
+    kmem_release(p->un.recv.release);
+  p->un.recv.ret = thread_recv(p->un.recv.id, p->un.recv.sizep, p->un.recv.pp,
+                               p->un.recv.timeout);
+}
+
+/* kz_mbox_reserve() */
+static void call_mbox_reserve(kz_syscall_param_t *p)
+{
+  p->un.mbox_reserve.ret = thread_mbox_reserve(p->un.mbox_reserve.id,
+                                               p->un.mbox_reserve.nodes,
+                                               p->un.mbox_reserve.blocks,
+                                               p->un.mbox_reserve.size);
+}
+
+/* kz_mbox_alloc() */
+static void call_mbox_alloc(kz_syscall_param_t *p)
+{
+  p->un.mbox_alloc.ret = thread_mbox_alloc(p->un.mbox_alloc.id);
+}
+
+/* kz_mbox_free() */
+static void call_mbox_free(kz_syscall_param_t *p)
+{
+  p->un.mbox_free.ret = thread_mbox_free(p->un.mbox_free.id,
+                                         p->un.mbox_free.p);
+}
+
+/* kz_ring_create() */
+static void call_ring_create(kz_syscall_param_t *p)
+{
+  p->un.ring_create.ret = thread_ring_create(p->un.ring_create.buf,
+                                             p->un.ring_create.size,
+                                             p->un.ring_create.threshold);
+}
+
+/* kz_ring_delete() */
+static void call_ring_delete(kz_syscall_param_t *p)
+{
+  p->un.ring_delete.ret = thread_ring_delete(p->un.ring_delete.id);
+}
+
+/* kz_ring_wait() */
+static void call_ring_wait(kz_syscall_param_t *p)
+{
+  p->un.ring_wait.ret = thread_ring_wait(p->un.ring_wait.id);
+}
+
+/* kz_idle() からのリングバッファの受け渡し */
+static void call_ring_flush(kz_syscall_param_t *p)
+{
+  p->un.ring_wait.ret = thread_ring_flush();
+}
+
+/* kz_sendv() */
+static void call_sendv(kz_syscall_param_t *p)
+{
+  p->un.sendv.ret = thread_sendv(p->un.sendv.id, p->un.sendv.vec,
+                                 p->un.sendv.count);
+}
+
+/* kz_recv_any() */
+static void call_recv_any(kz_syscall_param_t *p)
+{
+  p->un.recv.ret = thread_recv_any(p->un.recv.mask);
+}
+
+/* kz_call() */
+static void call_call(kz_syscall_param_t *p)
+{
+  p->un.call.ret = thread_call(p->un.call.id, p->un.call.size, p->un.call.p);
+}
+
+/* kz_reply() */
+static void call_reply(kz_syscall_param_t *p)
+{
+  p->un.reply.ret = thread_reply(p->un.reply.id, p->un.reply.size,
+                                 p->un.reply.p);
+}
+
+/* kz_mbox_create() */
+static void call_mbox_create(kz_syscall_param_t *p)
+{
+  p->un.mbox_create.ret = thread_mbox_create(p->un.mbox_create.attr);
+}
+
+/* kz_mbox_delete() */
+static void call_mbox_delete(kz_syscall_param_t *p)
+{
+  p->un.mbox_delete.ret = thread_mbox_delete(p->un.mbox_delete.id);
+}
+
+/* kz_mbox_setattr() */
+static void call_mbox_setattr(kz_syscall_param_t *p)
+{
+  p->un.mbox_setattr.ret = thread_mbox_setattr(p->un.mbox_setattr.id,
+                                               p->un.mbox_setattr.attr);
+}
+
+/* kz_mbox_setcap() */
+static void call_mbox_setcap(kz_syscall_param_t *p)
+{
+  p->un.mbox_setcap.ret = thread_mbox_setcap(p->un.mbox_setcap.id,
+                                             p->un.mbox_setcap.capacity);
+}
+
+/* kz_sem_create() */
+static void call_sem_create(kz_syscall_param_t *p)
+{
+  p->un.sem_create.ret = thread_sem_create(p->un.sem_create.count);
+}
+
+/* kz_sem_delete() */
+static void call_sem_delete(kz_syscall_param_t *p)
+{
+  p->un.sem_delete.ret = thread_sem_delete(p->un.sem_delete.id);
+}
+
+/* kz_sem_wait() */
+static void call_sem_wait(kz_syscall_param_t *p)
+{
+  p->un.sem_wait.ret = thread_sem_wait(p->un.sem_wait.id);
+}
+
+/* kz_sem_post() */
+static void call_sem_post(kz_syscall_param_t *p)
+{
+  p->un.sem_post.ret = thread_sem_post(p->un.sem_post.id);
+}
+
+/* kz_mutex_create() */
+static void call_mutex_create(kz_syscall_param_t *p)
+{
+  p->un.mutex_create.ret = thread_mutex_create();
+}
+
+/* kz_mutex_delete() */
+static void call_mutex_delete(kz_syscall_param_t *p)
+{
+  p->un.mutex_delete.ret = thread_mutex_delete(p->un.mutex_delete.id);
+}
+
+/* kz_mutex_lock() */
+static void call_mutex_lock(kz_syscall_param_t *p)
+{
+  p->un.mutex_lock.ret = thread_mutex_lock(p->un.mutex_lock.id);
+}
+
+/* kz_mutex_unlock() */
+static void call_mutex_unlock(kz_syscall_param_t *p)
+{
+  p->un.mutex_unlock.ret = thread_mutex_unlock(p->un.mutex_unlock.id);
+}
+
+/* kz_flag_create() */
+static void call_flag_create(kz_syscall_param_t *p)
+{
+  p->un.flag_create.ret = thread_flag_create(p->un.flag_create.pattern);
+}
+
+/* kz_flag_delete() */
+static void call_flag_delete(kz_syscall_param_t *p)
+{
+  p->un.flag_delete.ret = thread_flag_delete(p->un.flag_delete.id);
+}
+
+/* kz_flag_wait() */
+static void call_flag_wait(kz_syscall_param_t *p)
+{
+  p->un.flag_wait.ret = thread_flag_wait(p->un.flag_wait.id);
+}
+
+/* kz_flag_set() */
+static void call_flag_set(kz_syscall_param_t *p)
+{
+  p->un.flag_set.ret = thread_flag_set(p->un.flag_set.id,
+                                       p->un.flag_set.pattern);
+}
+
+/* kz_flag_clear() */
+static void call_flag_clear(kz_syscall_param_t *p)
+{
+  p->un.flag_set.ret = thread_flag_clear(p->un.flag_set.id,
+                                         p->un.flag_set.pattern);
+}
+
+#if KZ_CONFIG_TOPIC
+/* kz_topic_create() */
+static void call_topic_create(kz_syscall_param_t *p)
+{
+  p->un.topic_create.ret = thread_topic_create();
+}
+
+/* kz_topic_delete() */
+static void call_topic_delete(kz_syscall_param_t *p)
+{
+  p->un.topic_delete.ret = thread_topic_delete(p->un.topic_delete.id);
+}
+
+/* kz_topic_subscribe(), kz_topic_unsubscribe() */
+static void call_topic_subscribe(kz_syscall_param_t *p)
+{
+  p->un.topic_subscribe.ret = thread_topic_subscribe(p->un.topic_subscribe.id,
+                                                     p->un.topic_subscribe.box,
+                                                     p->un.topic_subscribe.on);
+}
+
+/* kz_topic_alloc() */
+static void call_topic_alloc(kz_syscall_param_t *p)
+{
+  p->un.topic_alloc.ret = thread_topic_alloc(p->un.topic_alloc.size);
+}
+
+/* kz_topic_publish() */
+static void call_topic_publish(kz_syscall_param_t *p)
+{
+  p->un.topic_publish.ret = thread_topic_publish(p->un.topic_publish.id,
+                                                 p->un.topic_publish.size,
+                                                 p->un.topic_publish.p);
+}
+
+/* kz_topic_release() */
+static void call_topic_release(kz_syscall_param_t *p)
+{
+  p->un.topic_release.ret = thread_topic_release(p->un.topic_release.p);
+}
+#endif
+
+#if KZ_CONFIG_SWTIMER
+/* kz_timer_create(), kz_timer_create_func() */
+static void call_timer_create(kz_syscall_param_t *p)
+{
+  p->un.timer_create.ret = thread_timer_create(p->un.timer_create.ticks,
+                                               p->un.timer_create.periodic,
+                                               p->un.timer_create.box,
+                                               p->un.timer_create.func,
+                                               p->un.timer_create.p);
+}
+
+/* kz_timer_delete() */
+static void call_timer_delete(kz_syscall_param_t *p)
+{
+  p->un.timer_delete.ret = thread_timer_delete(p->un.timer_delete.id);
+}
+#endif
+
+/* kz_setintr() */
+static void call_setintr(kz_syscall_param_t *p)
+{
+  p->un.setintr.ret = thread_setintr(p->un.setintr.type, p->un.setintr.handler);
+}
+
+/* kz_setintrlevel() */
+static void call_setintrlevel(kz_syscall_param_t *p)
+{
+  p->un.setintrlevel.ret = thread_setintrlevel(p->un.setintrlevel.type,
+                                               p->un.setintrlevel.level);
+}
+
+/* kz_join() */
+static void call_join(kz_syscall_param_t *p)
+{
+  p->un.join.ret = thread_join(p->un.join.id, p->un.join.statusp);
+}
+
+/* kz_wait_for() */
+static void call_wait_for(kz_syscall_param_t *p)
+{
+  p->un.wait_for.ret = thread_wait_for(p->un.wait_for.id);
+}
+
+/* kz_heartbeat() */
+static void call_heartbeat(kz_syscall_param_t *p)
+{
+  p->un.heartbeat.ret = thread_heartbeat(p->un.heartbeat.ticks);
+}
+
+/* kz_chpri_thread() */
+static void call_chpri_thread(kz_syscall_param_t *p)
+{
+  p->un.chpri_thread.ret = thread_chpri_thread(p->un.chpri_thread.id,
+                                               p->un.chpri_thread.priority,
+                                               p->un.chpri_thread.flags);
+}
+
+/* kz_setdeadline() */
+static void call_setdeadline(kz_syscall_param_t *p)
+{
+  p->un.setdeadline.ret = thread_setdeadline(p->un.setdeadline.ticks);
+}
+
+/* kz_setperiod() */
+static void call_setperiod(kz_syscall_param_t *p)
+{
+  p->un.setperiod.ret = thread_setperiod(p->un.setperiod.ticks,
+                                         p->un.setperiod.phase);
+}
+
+/* kz_wait_period() */
+static void call_wait_period(kz_syscall_param_t *p)
+{
+  p->un.wait_period.ret = thread_wait_period();
+}
+
+/* kz_syscall_batch()（各システムコールを呼び出すので、関数テーブルの後で定義） */
+static void call_batch(kz_syscall_param_t *p);
+
+static void (* const functions[KZ_SYSCALL_TYPE_NUM])(kz_syscall_param_t *p) = {
+  [KZ_SYSCALL_TYPE_RUN] = call_run,
+  [KZ_SYSCALL_TYPE_EXIT] = call_exit,
+  [KZ_SYSCALL_TYPE_WAIT] = call_wait,
+  [KZ_SYSCALL_TYPE_SLEEP] = call_sleep,
+  [KZ_SYSCALL_TYPE_WAKEUP] = call_wakeup,
+  [KZ_SYSCALL_TYPE_GETID] = call_getid,
+  [KZ_SYSCALL_TYPE_CHPRI] = call_chpri,
+  [KZ_SYSCALL_TYPE_SETSLICE] = call_setslice,
+  [KZ_SYSCALL_TYPE_STACKINFO] = call_stackinfo,
+  [KZ_SYSCALL_TYPE_GETSTAT] = call_getstat,
+  [KZ_SYSCALL_TYPE_GETLOAD] = call_getload,
+  [KZ_SYSCALL_TYPE_KMALLOC] = call_kmalloc,
+  [KZ_SYSCALL_TYPE_KMFREE] = call_kmfree,
+  [KZ_SYSCALL_TYPE_MEMSTAT] = call_memstat,
+  [KZ_SYSCALL_TYPE_DMALLOC] = call_dmalloc,
+  [KZ_SYSCALL_TYPE_DMFREE] = call_dmfree,
+  [KZ_SYSCALL_TYPE_SEND] = call_send,
+  [KZ_SYSCALL_TYPE_RECV] = call_recv,
+  [KZ_SYSCALL_TYPE_CALL] = call_call,
+  [KZ_SYSCALL_TYPE_REPLY] = call_reply,
+  [KZ_SYSCALL_TYPE_MBOX_CREATE] = call_mbox_create,
+  [KZ_SYSCALL_TYPE_MBOX_DELETE] = call_mbox_delete,
+  [KZ_SYSCALL_TYPE_MBOX_SETATTR] = call_mbox_setattr,
+  [KZ_SYSCALL_TYPE_MBOX_SETCAP] = call_mbox_setcap,
+  [KZ_SYSCALL_TYPE_SEM_CREATE] = call_sem_create,
+  [KZ_SYSCALL_TYPE_SEM_DELETE] = call_sem_delete,
+  [KZ_SYSCALL_TYPE_SEM_WAIT] = call_sem_wait,
+  [KZ_SYSCALL_TYPE_SEM_POST] = call_sem_post,
+  [KZ_SYSCALL_TYPE_MUTEX_CREATE] = call_mutex_create,
+  [KZ_SYSCALL_TYPE_MUTEX_DELETE] = call_mutex_delete,
+  [KZ_SYSCALL_TYPE_MUTEX_LOCK] = call_mutex_lock,
+  [KZ_SYSCALL_TYPE_MUTEX_UNLOCK] = call_mutex_unlock,
+  [KZ_SYSCALL_TYPE_FLAG_CREATE] = call_flag_create,
+  [KZ_SYSCALL_TYPE_FLAG_DELETE] = call_flag_delete,
+  [KZ_SYSCALL_TYPE_FLAG_WAIT] = call_flag_wait,
+  [KZ_SYSCALL_TYPE_FLAG_SET] = call_flag_set,
+  [KZ_SYSCALL_TYPE_FLAG_CLEAR] = call_flag_clear,
+  [KZ_SYSCALL_TYPE_SETINTR] = call_setintr,
+  [KZ_SYSCALL_TYPE_SETINTRLEVEL] = call_setintrlevel,
+  [KZ_SYSCALL_TYPE_HEARTBEAT] = call_heartbeat,
+  [KZ_SYSCALL_TYPE_JOIN] = call_join,
+  [KZ_SYSCALL_TYPE_WAIT_FOR] = call_wait_for,
+  [KZ_SYSCALL_TYPE_SETPERIOD] = call_setperiod,
+  [KZ_SYSCALL_TYPE_WAIT_PERIOD] = call_wait_period,
+#if KZ_CONFIG_SWTIMER
+  [KZ_SYSCALL_TYPE_TIMER_CREATE] = call_timer_create,
+  [KZ_SYSCALL_TYPE_TIMER_DELETE] = call_timer_delete,
+#endif
+  [KZ_SYSCALL_TYPE_SETDEADLINE] = call_setdeadline,
+#if KZ_CONFIG_TOPIC
+  [KZ_SYSCALL_TYPE_TOPIC_CREATE] = call_topic_create,
+  [KZ_SYSCALL_TYPE_TOPIC_DELETE] = call_topic_delete,
+  [KZ_SYSCALL_TYPE_TOPIC_SUBSCRIBE] = call_topic_subscribe,
+  [KZ_SYSCALL_TYPE_TOPIC_ALLOC] = call_topic_alloc,
+  [KZ_SYSCALL_TYPE_TOPIC_PUBLISH] = call_topic_publish,
+  [KZ_SYSCALL_TYPE_TOPIC_RELEASE] = call_topic_release,
+#endif
+  [KZ_SYSCALL_TYPE_RECV_ANY] = call_recv_any,
+  [KZ_SYSCALL_TYPE_SENDV] = call_sendv,
+  [KZ_SYSCALL_TYPE_BATCH] = call_batch,
+  [KZ_SYSCALL_TYPE_RING_CREATE] = call_ring_create,
+  [KZ_SYSCALL_TYPE_RING_DELETE] = call_ring_delete,
+  [KZ_SYSCALL_TYPE_RING_WAIT] = call_ring_wait,
+  [KZ_SYSCALL_TYPE_RING_FLUSH] = call_ring_flush,
+  [KZ_SYSCALL_TYPE_MBOX_RESERVE] = call_mbox_reserve,
+  [KZ_SYSCALL_TYPE_MBOX_ALLOC] = call_mbox_alloc,
+  [KZ_SYSCALL_TYPE_MBOX_FREE] = call_mbox_free,
+  [KZ_SYSCALL_TYPE_CHPRI_THREAD] = call_chpri_thread,
+  [KZ_SYSCALL_TYPE_REGIONSTAT] = call_regionstat,
+  [KZ_SYSCALL_TYPE_PERFSTAT] = call_perfstat,
+  [KZ_SYSCALL_TYPE_SUSPEND] = call_suspend,
+  [KZ_SYSCALL_TYPE_RESUME] = call_resume,
+#ifdef KZ_BUDGET
+  [KZ_SYSCALL_TYPE_SETBUDGET] = call_setbudget,
+#endif
+#ifdef KZ_TRACE
+  [KZ_SYSCALL_TYPE_STRACE] = call_strace,
+#endif
+};
+
+#ifdef KZ_TRACE
+/*
+ * システムコールのトレース(kz_strace())
+ * 戻り値はパラメータの種類ごとに位置が異なるので、表で引く
+ * （ret のないもの(kz_exit())は大きさが0）。
+ */
+#define STRACE_RET(m) \
+  { __builtin_offsetof(kz_syscall_param_t, un.m.ret), \
+    sizeof(((kz_syscall_param_t *)0)->un.m.ret) }
+
+static const struct {
+  uint8 offset;
+  uint8 size;
+} strace_rets[KZ_SYSCALL_TYPE_NUM] = {
+  [KZ_SYSCALL_TYPE_RUN] = STRACE_RET(run),
+  [KZ_SYSCALL_TYPE_WAIT] = STRACE_RET(wait),
+  [KZ_SYSCALL_TYPE_SLEEP] = STRACE_RET(sleep),
+  [KZ_SYSCALL_TYPE_WAKEUP] = STRACE_RET(wakeup),
+  [KZ_SYSCALL_TYPE_GETID] = STRACE_RET(getid),
+  [KZ_SYSCALL_TYPE_CHPRI] = STRACE_RET(chpri),
+  [KZ_SYSCALL_TYPE_SETSLICE] = STRACE_RET(setslice),
+  [KZ_SYSCALL_TYPE_STACKINFO] = STRACE_RET(stackinfo),
+  [KZ_SYSCALL_TYPE_GETSTAT] = STRACE_RET(getstat),
+  [KZ_SYSCALL_TYPE_GETLOAD] = STRACE_RET(getload),
+  [KZ_SYSCALL_TYPE_KMALLOC] = STRACE_RET(kmalloc),
+  [KZ_SYSCALL_TYPE_KMFREE] = STRACE_RET(kmfree),
+  [KZ_SYSCALL_TYPE_MEMSTAT] = STRACE_RET(memstat),
+  [KZ_SYSCALL_TYPE_DMALLOC] = STRACE_RET(dmalloc),
+  [KZ_SYSCALL_TYPE_DMFREE] = STRACE_RET(dmfree),
+  [KZ_SYSCALL_TYPE_SEND] = STRACE_RET(send),
+  [KZ_SYSCALL_TYPE_RECV] = STRACE_RET(recv),
+  [KZ_SYSCALL_TYPE_CALL] = STRACE_RET(call),
+  [KZ_SYSCALL_TYPE_REPLY] = STRACE_RET(reply),
+  [KZ_SYSCALL_TYPE_MBOX_CREATE] = STRACE_RET(mbox_create),
+  [KZ_SYSCALL_TYPE_MBOX_DELETE] = STRACE_RET(mbox_delete),
+  [KZ_SYSCALL_TYPE_MBOX_SETATTR] = STRACE_RET(mbox_setattr),
+  [KZ_SYSCALL_TYPE_MBOX_SETCAP] = STRACE_RET(mbox_setcap),
+  [KZ_SYSCALL_TYPE_SEM_CREATE] = STRACE_RET(sem_create),
+  [KZ_SYSCALL_TYPE_SEM_DELETE] = STRACE_RET(sem_delete),
+  [KZ_SYSCALL_TYPE_SEM_WAIT] = STRACE_RET(sem_wait),
+  [KZ_SYSCALL_TYPE_SEM_POST] = STRACE_RET(sem_post),
+  [KZ_SYSCALL_TYPE_MUTEX_CREATE] = STRACE_RET(mutex_create),
+  [KZ_SYSCALL_TYPE_MUTEX_DELETE] = STRACE_RET(mutex_delete),
+  [KZ_SYSCALL_TYPE_MUTEX_LOCK] = STRACE_RET(mutex_lock),
+  [KZ_SYSCALL_TYPE_MUTEX_UNLOCK] = STRACE_RET(mutex_unlock),
+  [KZ_SYSCALL_TYPE_FLAG_CREATE] = STRACE_RET(flag_create),
+  [KZ_SYSCALL_TYPE_FLAG_DELETE] = STRACE_RET(flag_delete),
+  [KZ_SYSCALL_TYPE_FLAG_WAIT] = STRACE_RET(flag_wait),
+  [KZ_SYSCALL_TYPE_FLAG_SET] = STRACE_RET(flag_set),
+  [KZ_SYSCALL_TYPE_FLAG_CLEAR] = STRACE_RET(flag_set),
+  [KZ_SYSCALL_TYPE_SETINTR] = STRACE_RET(setintr),
+  [KZ_SYSCALL_TYPE_SETINTRLEVEL] = STRACE_RET(setintrlevel),
+  [KZ_SYSCALL_TYPE_HEARTBEAT] = STRACE_RET(heartbeat),
+  [KZ_SYSCALL_TYPE_JOIN] = STRACE_RET(join),
+  [KZ_SYSCALL_TYPE_WAIT_FOR] = STRACE_RET(wait_for),
+  [KZ_SYSCALL_TYPE_SETPERIOD] = STRACE_RET(setperiod),
+  [KZ_SYSCALL_TYPE_WAIT_PERIOD] = STRACE_RET(wait_period),
+  [KZ_SYSCALL_TYPE_TIMER_CREATE] = STRACE_RET(timer_create),
+  [KZ_SYSCALL_TYPE_TIMER_DELETE] = STRACE_RET(timer_delete),
+  [KZ_SYSCALL_TYPE_SETDEADLINE] = STRACE_RET(setdeadline),
+  [KZ_SYSCALL_TYPE_TOPIC_CREATE] = STRACE_RET(topic_create),
+  [KZ_SYSCALL_TYPE_TOPIC_DELETE] = STRACE_RET(topic_delete),
+  [KZ_SYSCALL_TYPE_TOPIC_SUBSCRIBE] = STRACE_RET(topic_subscribe),
+  [KZ_SYSCALL_TYPE_TOPIC_ALLOC] = STRACE_RET(topic_alloc),
+  [KZ_SYSCALL_TYPE_TOPIC_PUBLISH] = STRACE_RET(topic_publish),
+  [KZ_SYSCALL_TYPE_TOPIC_RELEASE] = STRACE_RET(topic_release),
+  [KZ_SYSCALL_TYPE_RECV_ANY] = STRACE_RET(recv),
+  [KZ_SYSCALL_TYPE_SENDV] = STRACE_RET(sendv),
+  [KZ_SYSCALL_TYPE_BATCH] = STRACE_RET(batch),
+  [KZ_SYSCALL_TYPE_RING_CREATE] = STRACE_RET(ring_create),
+  [KZ_SYSCALL_TYPE_RING_DELETE] = STRACE_RET(ring_delete),
+  [KZ_SYSCALL_TYPE_RING_WAIT] = STRACE_RET(ring_wait),
+  [KZ_SYSCALL_TYPE_RING_FLUSH] = STRACE_RET(ring_wait),
+  [KZ_SYSCALL_TYPE_MBOX_RESERVE] = STRACE_RET(mbox_reserve),
+  [KZ_SYSCALL_TYPE_MBOX_ALLOC] = STRACE_RET(mbox_alloc),
+  [KZ_SYSCALL_TYPE_MBOX_FREE] = STRACE_RET(mbox_free),
+  [KZ_SYSCALL_TYPE_CHPRI_THREAD] = STRACE_RET(chpri_thread),
+  [KZ_SYSCALL_TYPE_REGIONSTAT] = STRACE_RET(regionstat),
+  [KZ_SYSCALL_TYPE_PERFSTAT] = STRACE_RET(perfstat),
+  [KZ_SYSCALL_TYPE_SUSPEND] = STRACE_RET(suspend),
+  [KZ_SYSCALL_TYPE_RESUME] = STRACE_RET(suspend),
+#ifdef KZ_BUDGET
+  [KZ_SYSCALL_TYPE_SETBUDGET] = STRACE_RET(setbudget),
+#endif
+  [KZ_SYSCALL_TYPE_STRACE] = STRACE_RET(strace),
+};
+
+/* 引数の記録（パラメータの先頭の8バイト） */
+static void strace_enter(kz_thread *thp, kz_syscall_param_t *p)
+{
+  if (!p)
+    return;
+  kz_trace_put_value(KZ_TRACE_SYSARG, thp->id, 0, ((uint32 *)p)[0]);
+  kz_trace_put_value(KZ_TRACE_SYSARG, thp->id, 1, ((uint32 *)p)[1]);
+}
+
+/*
+ * 終了と戻り値の記録
+ * 処理の後もレディならばそのまま戻るので、戻り値が確定している。
+ * 待ちになった場合は待ち解除のときに書き込まれるので、記録しない。
+ */
+static void strace_exit(kz_thread *thp, kz_thread_id_t id,
+                        kz_syscall_type_t type, kz_syscall_param_t *p)
+{
+  int blocked = (thp->id != id) || !(thp->flags & KZ_THREAD_FLAG_READY);
+  char *rp;
+  uint32 value;
+
+  kz_trace_put(KZ_TRACE_SYSEXIT, id,
+               type | (blocked ? KZ_TRACE_SYSEXIT_BLOCKED : 0));
+  if (blocked || !p || !strace_rets[type].size)
+    return;
+
+  rp = (char *)p + strace_rets[type].offset;
+  if (strace_rets[type].size == sizeof(uint16))
+    value = *(uint16 *)rp;
+  else if (strace_rets[type].size == sizeof(uint32))
+    value = *(uint32 *)rp;
+  else
+    value = *(unsigned long *)rp; /* ホスト環境のポインタ */
+  kz_trace_put_value(KZ_TRACE_SYSRET, id, 0, value);
+}
+#endif
+
+#ifdef KZ_SYSCALL_STAT
+/*
+ * システムコールごとの統計情報
+ * 処理時間はタイマのカウント数（φ/8 = 0.4us単位）で記録する
+ */
+static kz_syscallstat_t syscallstat[KZ_SYSCALL_TYPE_NUM];
+#endif
+
+/* システムコールの呼び出し */
+static void call_functions(kz_syscall_type_t type, kz_syscall_param_t *p)
+{
+#ifdef KZ_SYSCALL_STAT
+  kz_syscallstat_t *sp;
+  uint16 start, end;
+  uint32 elapsed;
+#endif
+#ifdef KZ_TRACE
+  /* サービスコール(current が NULL)は記録しない */
+  kz_thread *self = current;
+  kz_thread_id_t id = self ? self->id : 0;
+  int traced = self && (self->flags & KZ_THREAD_FLAG_STRACE);
+#endif
+
+  if ((unsigned int)type >= KZ_SYSCALL_TYPE_NUM || !functions[type])
+    return;
+
+#ifdef KZ_TRACE
+  if (traced)
+    strace_enter(self, p);
+#endif
+
+#ifdef KZ_SYSCALL_STAT
+  start = timer_get_count(TIMER_DEFAULT_DEVICE);
+#endif
+
+  /* システムコールの実行中にcurrentが書き換わるので注意 */
+  functions[type](p);
+
+#ifdef KZ_SYSCALL_STAT
+  /*
+   * 割り込み禁止で実行しているので、処理中にカウンタがクリアされるのは
+   * 高々1回（コンペアマッチでクリアされた場合は1周期分を加える）。
+   * 引き算が負にならないように、クリアされたかを先に調べる
+   */
+  end = timer_get_count(TIMER_DEFAULT_DEVICE);
+  if (end < start)
+    elapsed = timer_get_period(TIMER_DEFAULT_DEVICE) - start + end;
+  else
+    elapsed = end - start;
+
+  sp = &syscallstat[type];
+  if (!sp->count || elapsed < sp->min)
+    sp->min = elapsed;
+  if (elapsed > sp->max)
+    sp->max = elapsed;
+  sp->total += elapsed;
+  sp->count++;
+#endif
+
+#ifdef KZ_TRACE
+  if (traced)
+    strace_exit(self, id, type, p);
+#endif
+}
+
+/*
+ * システムコールの処理(kz_syscall_batch(): 複数のシステムコールの一括実行)
+ *
+ * types[i] のシステムコールを params[i] をパラメータとして順に実行し、
+ * 実行した数を返す（各システムコールの戻り値は params[i] に格納される）。
+ * 途中でブロックした場合はそこでやめる。ブロックしたシステムコールは
+ * 通常と同様に待ち解除時に戻り値が格納されて、実行した数に含まれる。
+ * トラップは1回で済むが、レディキューの操作は個々に呼んだ場合と同じに
+ * なるように、システムコールごとに呼び出したスレッドを外して呼び出す。
+ * kz_exit() と kz_syscall_batch() 自体は指定できない。
+ */
+static int thread_batch(kz_syscall_type_t *types, kz_syscall_param_t *params,
+                        int count)
+{
+  kz_thread *self = current;
+  kz_syscall_param_t *batch = current->syscall.param;
+  kz_syscall_type_t type;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    type = types[i];
+    if (((unsigned int)type >= KZ_SYSCALL_TYPE_NUM) || !functions[type]
+        || (type == KZ_SYSCALL_TYPE_EXIT) || (type == KZ_SYSCALL_TYPE_BATCH))
+      break;
+
+    current = self;
+    current->stat.syscalls++;
+    perf_syscalls[type]++;
+    KZ_TRACE_EVENT(KZ_TRACE_SYSCALL, TRACE_ID(current), type);
+    /* 前のシステムコールでレディキューに戻っているので、また外す */
+    if (i > 0)
+      getcurrent();
+
+    /* ブロックした場合に待ち解除の処理が参照するパラメータ */
+    self->syscall.type  = type;
+    self->syscall.param = &params[i];
+    call_functions(type, &params[i]);
+    current = self;
+
+    if (!(self->flags & KZ_THREAD_FLAG_READY))
+      return i + 1;
+  }
+
+  self->syscall.type  = KZ_SYSCALL_TYPE_BATCH;
+  self->syscall.param = batch;
+  /* 1つも実行していなければ、まだレディキューから外れたまま */
+  if (i == 0)
+    putcurrent();
+
+  return i;
+}
+
+/* kz_syscall_batch() */
+static void call_batch(kz_syscall_param_t *p)
+{
+  p->un.batch.ret = thread_batch(p->un.batch.types, p->un.batch.params,
+                                 p->un.batch.count);
+}
+
+/* システムコールの処理 */
+static void syscall_proc(kz_syscall_type_t type, kz_syscall_param_t *p)
+{
+  /*
+   * システムコールを呼び出したスレッドをレディキューから外した状態で
+   * 処理関数を呼び出す。このためシステムコールを呼び出したスレッドを
+   * そのまま動作継続させたい場合は、処理関数内部でputcurrent()を実行する。
+   */
+  current->stat.syscalls++;
+  /* 範囲外の type は call_functions() で無視されるので、数えない */
+  if ((unsigned int)type < KZ_SYSCALL_TYPE_NUM)
+    perf_syscalls[type]++;
+  KZ_TRACE_EVENT(KZ_TRACE_SYSCALL, TRACE_ID(current), type);
+  getcurrent();
+
+  /* kz_wait_for() で借りていた優先度を返す */
+  if (current->flags & KZ_THREAD_FLAG_DONATED) {
+    current->flags &= ~KZ_THREAD_FLAG_DONATED;
+    current->priority = thread_inherited_priority(current);
+  }
+
+  call_functions(type, p);
+}
+
+/* サービスコールの処理 */
+static void srvcall_proc(kz_syscall_type_t type, kz_syscall_param_t *p)
+{
+  kz_thread *intr = current; /* 割り込まれたスレッド */
+
+  /*
+   * システムコールとサービスコールの処理関数の内部で
+   * システムコールの実行したスレッドIDを取得するために
+   * currentを参照している部分がある（thread_send() etc...）
+   * サービスコールでは current を NULL にして、割り込みハンドラからの
+   * 呼び出しであることを示す（送信したメッセージの送信元は
+   * KZ_THREAD_ID_INTR になり、呼び出し元の putcurrent() は何もしない）。
+   * 処理関数は待ち解除したスレッドを current に設定するので、呼び出し後は
+   * 割り込まれたスレッドに戻す。thread_intr() ではこのスレッドを基準に
+   * スケジューリングが必要かを判断する。
+   */
+  current = NULL;
+  perf.srvcalls++;
+  KZ_TRACE_EVENT(KZ_TRACE_SRVCALL, TRACE_ID(intr), type);
+  call_functions(type, p);
+  current = intr;
+}
+
+/* スレッドのスケジューリング */
+static void schedule(void)
+{
+  int i;
+
+  /* 見つからなかった */
+  if (!readyque_bitmap)
+    kz_sysdown();
+
+  /*
+   * レディキューのビットマップから最も優先度の高い（優先度の数値の小さい）
+   * 動作可能なレディキューを検索する。
+   * 優先度によらず一定時間で検索できるように、下位・上位バイトの順に
+   * テーブルを引く。
+   */
+  if (readyque_bitmap & 0xff)
+    i = bitmap_ffs[readyque_bitmap & 0xff];
+  else
+    i = bitmap_ffs[readyque_bitmap >> 8] + 8;
+
+  current = readyque[i].head;
+}
+
+/* システムコール割り込み呼び出し */
+static void syscall_intr(int type)
+{
+  syscall_proc(current->syscall.type, current->syscall.param);
+}
+
+/*
+ * 32ビットの符号無し除算
+ * (-nostdlib でリンクするためlibgccの除算は使えない。測定期間ごとに
+ *  1回しか呼ばないので、単純なシフト減算で求める)
+ */
+static uint32 udiv32(uint32 n, uint32 d)
+{
+  uint32 q = 0, bit = 1;
+
+  if (!d)
+    return 0;
+  while ((d < n) && !(d & 0x80000000)) {
+    d <<= 1;
+    bit <<= 1;
+  }
+  while (bit) {
+    if (n >= d) {
+      n -= d;
+      q |= bit;
+    }
+    d >>= 1;
+    bit >>= 1;
+  }
+  return q;
+}
+
+/* 現在の時刻（システムティックとタイマのカウンタ値） */
+static uint32 load_now(uint16 *countp)
+{
+  *countp = timer_get_count(TIMER_DEFAULT_DEVICE);
+  /* ティックが処理待ちならば、カウンタはクリア済みなので1ティック進める */
+  return systicks + timer_is_expired(TIMER_DEFAULT_DEVICE);
+}
+
+/* アイドルスレッドのスリープ時間の積算（スリープから起床したときに呼ばれる） */
+static void load_idle_end(void)
+{
+  uint32 ticks;
+  uint16 count;
+
+  ticks = load_now(&count) - load.start_ticks;
+  load.idle += (uint32)(uint16)ticks * tick_count + count - load.start_count;
+  load.sleeping = 0;
+}
+
+#ifdef KZ_INTR_LATENCY
+/*
+ * 割り込みの遅延のヒストグラム(kz_intr_latency())
+ * 割り込みの発生時刻はシステムティックのタイマしか分からない（コンペア
+ * マッチでカウンタがクリアされるので、入口でのカウンタの値が遅延になる）。
+ * それ以外のベクタの起床までの遅延は、割り込み処理の入口から測る。
+ * 起床までの遅延は、割り込みでスレッドが切り替わったときに記録する。
+ * 表は大きいので外部DRAMに置く（ロードされないので kz_start() でクリアする）。
+ */
+static kz_latencystat_t latency[KZ_PERFSTAT_INTR_NUM]
+  __attribute__((section(".dram")));
+static uint16 latency_start; /* 処理中の割り込みの入口でのカウンタの値 */
+static uint16 latency_entry; /* 処理中の割り込みの入口までの遅延 */
+
+static void latency_add(uint32 *bins, uint32 value)
+{
+  int n;
+
+  for (n = 0; value && (n < KZ_LATENCY_BIN_NUM - 1); n++)
+    value >>= 1;
+  bins[n]++;
+}
+
+/* 割り込み処理の入口で呼ぶ */
+static void latency_intr_entry(softvec_type_t type)
+{
+  latency_start = timer_get_count(TIMER_DEFAULT_DEVICE);
+  latency_entry = 0;
+  if (type == SOFTVEC_TYPE_TIMINTR) {
+    latency_entry = latency_start;
+    latency_add(latency[type].entry, latency_entry);
+  }
+}
+
+/* 割り込みで起床したスレッドにディスパッチする直前に呼ぶ */
+static void latency_intr_wakeup(softvec_type_t type)
+{
+  uint16 now = timer_get_count(TIMER_DEFAULT_DEVICE);
+  uint32 elapsed;
+
+  /* 処理中にカウンタがクリアされた場合（高々1回）は1周期分を加える */
+  if (now < latency_start)
+    elapsed = timer_get_period(TIMER_DEFAULT_DEVICE) - latency_start + now;
+  else
+    elapsed = now - latency_start;
+  latency_add(latency[type].wakeup, latency_entry + elapsed);
+}
+#endif
+
+/*
+ * 起動の確認（bootinfo.h）
+ * ブートローダがフラッシュROMのスロットから起動した場合、KZ_BOOT_CONFIRM_TICKS
+ * の間動作できたら確認済みにする（以降のクラッシュでは、ブートローダは
+ * もう一方のスロットに切り替えない）。負荷の測定期間ごとに調べる。
+ */
+static void boot_confirm(void)
+{
+  extern kz_bootinfo_t bootinfo;
+
+  if ((bootinfo.magic == KZ_BOOTINFO_MAGIC)
+      && (bootinfo.state == KZ_BOOTINFO_TRIAL)
+      && (systicks >= KZ_BOOT_CONFIRM_TICKS))
+    bootinfo.state = KZ_BOOTINFO_CONFIRMED;
+}
+
+/* 測定期間の終了（タイマ割り込みで呼ばれる） */
+static void load_sample(int ticks)
+{
+  uint32 idle;
+
+  load.ticks += ticks;
+  if (load.ticks < LOAD_SAMPLE_TICKS)
+    return;
+
+  idle = udiv32(load.idle, load.unit);
+  if (idle > 1000)
+    idle = 1000;
+  load.samples[load.pos] = 1000 - idle;
+  load.pos = (load.pos + 1) & (LOAD_WINDOW - 1);
+  if (load.num < LOAD_WINDOW)
+    load.num++;
+
+  load.ticks = 0;
+  load.idle = 0;
+
+  boot_confirm();
+}
+
+/* ティックレスアイドルの終了（割り込みが入ったときに呼ばれる） */
+static void tickless_exit(void)
+{
+  uint16 count;
+  int elapsed;
+
+  count = timer_get_count(TIMER_DEFAULT_DEVICE);
+
+  if (timer_is_expired(TIMER_DEFAULT_DEVICE)) {
+    /* 予定通りに起床時刻になった（最後の1ティックは tick_intr() で処理する） */
+    elapsed = tickless - 1;
+  } else {
+    /*
+     * 他の割り込みで起床した。経過したティック数を求め、
+     * カウンタをティックの途中の位置に戻して通常の周期に戻す
+     */
+    elapsed = count / tick_count;
+    timer_set_count(TIMER_DEFAULT_DEVICE, count - elapsed * tick_count);
+  }
+  timer_set_period(TIMER_DEFAULT_DEVICE, tick_count);
+
+  /* 経過したティックを反映する（起床時刻を越えることはない） */
+  systicks += elapsed;
+  time_base += (uint32)(uint16)elapsed * tick_count;
+  current->stat.runticks += elapsed;
+  if (timerque)
+    timerque->timer.delta -= elapsed;
+  if (swtimerque)
+    swtimerque->delta -= elapsed;
+  load.ticks += elapsed;
+
+  tickless = 0;
+}
+
+#ifdef KZ_STANDBY
+/*
+ * ソフトウェアスタンバイからの復帰（起床の割り込みが入ったときに呼ばれる）
+ * スタンバイ中は内蔵モジュールが初期化されてクロックも止まっているので、
+ * SCIとタイマを設定し直す。スタンバイ中の時間は経過しなかったものとする
+ * （タイマ待ちがないときだけスタンバイするので、起床時刻はずれない）。
+ */
+static void standby_exit(void)
+{
+  power_resume();
+  timer_init(TIMER_DEFAULT_DEVICE, KZ_TICK_MSEC);
+  timer_start(TIMER_DEFAULT_DEVICE);
+#ifdef KZ_WDT
+  wdt_start();
+#endif
+  standby = 0;
+}
+#endif
+
+/*
+ * 死活監視（タイマ割り込みごとに呼ばれる）
+ * 監視対象のスレッドが全て期限内に kz_heartbeat() を呼んでいれば
+ * ウォッチドッグタイマをクリアする。期限を過ぎたスレッドがあれば
+ * クリアをやめるので、ウォッチドッグタイマによってリセットされる
+ * （ウォッチドッグタイマを使わない場合は、メッセージの出力のみ）。
+ * 多重割り込みの禁止中やスレッドが割り込み禁止で暴走した場合も、
+ * ここが呼ばれなくなるのでリセットされる。
+ */
+static void heartbeat_check(void)
+{
+  static int lost = 0;
+  kz_thread *thp;
+  uint32 over;
+  int i;
+
+  for (i = 0; i < THREAD_NUM; i++) {
+    thp = THREAD(i);
+    if (!thp->heartbeat.period)
+      continue;
+    /* 期限を過ぎたティック数（期限前ならば負の値なので最上位ビットが立つ） */
+    over = systicks - thp->heartbeat.deadline;
+    if (over && !(over & 0x80000000)) {
+      if (!lost) {
+        THREAD_MESSAGE(thp, " HEARTBEAT LOST.\n");
+        lost = 1;
+      }
+      return;
+    }
+  }
+#ifdef KZ_WDT
+  wdt_kick();
+#endif
+}
+
+/*
+ * 割り込まれたスレッドのPC（プロファイラ用）
+ * 割り込みの入口でスタックに保存されたレジスタ(ER0～ER6, CCR+PC)の最後から求める。
+ * 多重割り込みで割り込み処理に割り込んだ場合は、保存されたコンテキストは
+ * 外側の割り込みのものなので0とする（ホスト環境では常に0）。
+ */
+static uint32 intr_pc(void)
+{
+#ifndef KZ_HOST
+  if ((intr_nest == 1) && current->context.sp)
+    return ((uint32 *)current->context.sp)[7] & 0x00ffffff;
+#endif
+  return 0;
+}
+
+/* タイマ割り込みの呼び出し */
+static void tick_intr(int type)
+{
+  kz_thread *thp;
+
+  timer_clear(TIMER_DEFAULT_DEVICE);
+
+  systicks++;
+  time_base += tick_count;
+  current->stat.runticks++;
+  kz_prof_tick(intr_pc(), current->id);
+  load_sample(1);
+  heartbeat_check();
+
+  /*
+   * タイムスライスの処理
+   * 割り込まれたスレッド（current）はレディキューの先頭にいるので、
+   * タイムスライスを使い切った場合は同じ優先度のレディキューの末尾に繋ぎ直し、
+   * 同一優先度の他のスレッドに実行権を回す。
+   * (以降の起床処理で current が書き換わるので、先に処理すること)
+   */
+  if (current && (current->flags & KZ_THREAD_FLAG_READY)
+      && !(current->flags & KZ_THREAD_FLAG_KERNEL)
+      && timeslice[current->priority]) {
+    if (--current->slice <= 0) {
+      getcurrent();
+      putcurrent();
+    }
+  }
+
+#ifdef KZ_BUDGET
+  budget_tick();
+#endif
+
+#if KZ_CONFIG_SWTIMER
+  swtimer_tick();
+#endif
+
+  if (timerque == NULL)
+    return;
+
+  /*
+   * 先頭のスレッドの相対ティック数を減らし、
+   * 起床時刻になったスレッドをすべてレディキューに戻す
+   */
+  timerque->timer.delta--;
+  while (timerque && (timerque->timer.delta <= 0)) {
+    thp = timerque;
+    KZ_LIST_POP(timerque, timer.next);
+    thp->timer.next = NULL;
+    thp->flags &= ~KZ_THREAD_FLAG_TIMER;
+
+    /* kz_sleep() であれば、戻り値は KZ_ERR_TIMEOUT のまま */
+    thp->flags &= ~KZ_THREAD_FLAG_SLEEP;
+
+    /* メッセージの受信待ちであれば、受信待ちを解除してタイムアウトを返す */
+    if (thp->waitque) {
+      waitque_remove(thp);
+      thp->syscall.param->un.recv.ret = KZ_ERR_TIMEOUT;
+    }
+
+    current = thp;
+    putcurrent();
+  }
+}
+
+/* ソフトウェアエラー割り込みの呼び出し */
+static void softerr_intr(int type)
+{
+  THREAD_MESSAGE(current, " DOWN.\n");
+  getcurrent();
+  thread_exit();
+}
+
+/*
+ * 割り込み処理の入り口関数
+ *
+ * ソフトウェア割り込みを一括で処理するハンドラ
+ * 実際に実行する処理はhandlersに格納しておく
+ */
+static void thread_intr(softvec_type_t type, unsigned long sp)
+{
+  kz_thread *prev = current;
+  int open;
+
+#if defined(KZ_STACK_CANARY) && !defined(KZ_HOST)
+  /* 割り込みスタックが溢れていれば、どのスレッドも継続できない */
+  if (*(uint32 *)INTRSTACK_BOTTOM() != STACK_CANARY) {
+    puts("INTRSTACK OVERFLOW.\n");
+    kz_sysdown();
+  }
+#endif
+
+  /*
+   * 優先レベル0の割り込みハンドラの実行中に、優先レベル1の割り込みが
+   * 入った場合（多重割り込み）。スタックは割り込みスタックのままなので
+   * コンテキストの保存やスケジューリングは行わずに、ハンドラだけ実行して
+   * 割り込まれたハンドラに戻る。スケジューリングは外側の割り込みで行われる。
+   */
+  perf.intrs[type]++;
+
+#ifdef KZ_INTR_LATENCY
+  if ((type != SOFTVEC_TYPE_SYSCALL) && (type != SOFTVEC_TYPE_SOFTERR)
+      && !intr_nest)
+    latency_intr_entry(type);
+#endif
+
+  if (intr_nest) {
+    open = intr_open;
+    intr_open = 0;
+    intr_nest++;
+    if (handlers[type])
+      handlers[type](type);
+    intr_nest--;
+    intr_open = open;
+    return;
+  }
+
+  /* カレントスレッドのコンテキストを保存する */
+  current->context.sp = sp;
+
+#ifdef KZ_STACK_CANARY
+  /*
+   * 割り込まれたスレッドのスタックが溢れていれば、本来の割り込みの処理の
+   * 代わりにソフトウェアエラーとして終了させる（ハードウェア割り込みの要因は
+   * クリアされていないので、ディスパッチ後に再度割り込みが入る）
+   */
+  if (*STACK_BOTTOM(current) != STACK_CANARY) {
+    THREAD_MESSAGE(current, " STACK OVERFLOW.\n");
+    type = SOFTVEC_TYPE_SOFTERR;
+  }
+#endif
+
+  KZ_TRACE_EVENT(KZ_TRACE_INTR, TRACE_ID(current), type);
+
+#ifdef KZ_STANDBY
+  if (standby)
+    standby_exit();
+#endif
+  if (tickless)
+    tickless_exit();
+  if (load.sleeping)
+    load_idle_end();
+
+  /*
+   * 割り込みごとの処理を実行する
+   * SOFTVEC_TYPE_SYSCALL => syscall_intr()
+   * SOFTVEC_TYPE_SOFTERR => softerr_intr()
+   * それ以外の場合は、kz_setintr() によって
+   * ユーザに登録されたハンドラが実行される。
+   * 優先レベル0の割り込みであれば、ユーザのハンドラの実行中は
+   * 優先レベル1の割り込みを受け付ける。タイマ割り込み(tick_intr())は
+   * サービスコールを経由せずにキューや current を直接操作するので
+   * (ソフトウェアタイマのコールバックも含めて)、全て禁止のままで実行する。
+   */
+  intr_resched = 0;
+  if ((type != SOFTVEC_TYPE_SYSCALL) && (type != SOFTVEC_TYPE_SOFTERR))
+    intr_thread = current;
+
+  intr_nest = 1;
+  if (handlers[type]) {
+    if ((type != SOFTVEC_TYPE_TIMINTR)
+        && (intr_getlevel(type) == INTR_LEVEL_LOW)) {
+      intr_open = 1;
+      INTR_ENABLE_HIGH;
+      handlers[type](type);
+      INTR_DISABLE;
+      intr_open = 0;
+    } else {
+      handlers[type](type);
+    }
+  }
+  intr_nest = 0;
+
+  /*
+   * 割り込まれたスレッドがレディのままで、より先に動作すべきスレッドが
+   * レディにならなければ、スケジューリングせずにそのまま戻る
+   * (受信割り込みでバッファに格納しただけの場合など。サービスコールで
+   *  current は書き換わっているので戻しておく)
+   */
+  if (intr_thread) {
+    intr_thread = NULL;
+    if (!intr_resched && (prev->flags & KZ_THREAD_FLAG_READY)) {
+      current = prev;
+      return;
+    }
+  }
+
+  /* スレッドのスケジューリング */
+  schedule();
+
+  /*
+   * スレッドの切り替えの統計
+   * システムコールによるものは自発的、それ以外の割り込みによるものは横取りとする
+   */
+  if (current == prev) {
+    /*
+     * 割り込まれたスレッドがそのまま継続する場合は、dispatch()せずに
+     * 割り込みの入口(intr.S)に戻る。スタックは割り込み時のままなので、
+     * 入口側の復帰処理でコンテキストが戻される（呼び出し先保存の
+     * レジスタの再ロードも省略される）。
+     */
+    return;
+  }
+
+  KZ_TRACE_EVENT(KZ_TRACE_DISPATCH, TRACE_ID(current), current->priority);
+  current->stat.dispatches++;
+  perf.dispatches++;
+  if (type == SOFTVEC_TYPE_SYSCALL)
+    prev->stat.voluntary++;
+  else
+    prev->stat.involuntary++;
+#ifdef KZ_INTR_LATENCY
+  if ((type != SOFTVEC_TYPE_SYSCALL) && (type != SOFTVEC_TYPE_SOFTERR))
+    latency_intr_wakeup(type);
+#endif
+
+  /*
+   * スレッドのディスパッチ
+   * start.sで定義
+   */
+  dispatch(&current->context);
+
+  /* ここには返ってこない */
+}
+
+/* タスクコントロールブロックの初期化 */
+static KZ_COLD void thread_tcb_init(void)
+{
+  kz_thread *thp;
+  int i;
+
+  for (i = THREAD_NUM - 1; i >= 0; i--) {
+    thp = THREAD(i);
+    thp->index = i;
+    KZ_LIST_PUSH(thread_freelist, thp, next);
+  }
+}
+
+/* メッセージボックスの初期化（固定IDのものは使用中にしておく） */
+static KZ_COLD void msgbox_init(void)
+{
+  int i;
+
+  for (i = 0; i < MSGBOX_ID_NUM; i++)
+    MSGBOX(i)->flags = KZ_MSGBOX_FLAG_USED;
+}
+
+/*
+ * 静的なメッセージボックスの割り当て(KZ_MBOX_DEFINE())
+ * 固定IDの次から、リンクされた順に割り当てる
+ */
+static KZ_COLD void static_mbox_init(void)
+{
+  extern const kz_mbox_def_t __start_kz_mboxes[] __attribute__((weak));
+  extern const kz_mbox_def_t __stop_kz_mboxes[] __attribute__((weak));
+  const kz_mbox_def_t *def;
+  int i = MSGBOX_ID_NUM;
+
+  for (def = __start_kz_mboxes; def < __stop_kz_mboxes; def++, i++) {
+    if (i == MSGBOX_NUM) {
+      puts("too many static msgboxes.\n");
+      kz_sysdown();
+    }
+    MSGBOX(i)->attr = def->attr;
+    MSGBOX(i)->flags = KZ_MSGBOX_FLAG_USED;
+    *def->idp = i;
+  }
+}
+
+/*
+ * 静的なスレッドの起動(KZ_THREAD_DEFINE())
+ * 初期スレッドの作成後に呼び、定義の順にレディキューに繋ぐ
+ * (current は初期スレッドのままにする)
+ */
+static KZ_COLD void static_thread_start(void)
+{
+  extern const kz_thread_def_t __start_kz_threads[] __attribute__((weak));
+  extern const kz_thread_def_t __stop_kz_threads[] __attribute__((weak));
+  const kz_thread_def_t *def;
+  kz_thread *first = current, *thp;
+  int class;
 
-  if (mboxp->head == NULL) {
-    /*
-     * メッセージボックスにメッセージがないので
-     * スレッドをスリープさせる（システムコールがブロックする）
-     */
-     return -1;
+  for (def = __start_kz_threads; def < __stop_kz_threads; def++) {
+    thp = thread_freelist;
+    class = stack_class(def->stacksize);
+    if (!thp || (class < 0)) {
+      puts("cannot start static thread.\n");
+      kz_sysdown();
+    }
+    KZ_LIST_POP(thread_freelist, next);
+    memset(def->stack, STACK_FILL_PATTERN, def->stacksize);
+#ifdef KZ_STACK_CANARY
+    *(uint32 *)def->stack = STACK_CANARY;
+#endif
+    thread_setup(thp, def->func, def->name,
+                 def->priority & ~KZ_THREAD_ATTR_ARGCOPY, /* argv は静的 */
+                 def->stack + def->stacksize, class, def->argc, def->argv);
+    thp->flags &= ~KZ_THREAD_FLAG_DRAM; /* 静的なスタックには指定できない */
+    thp->flags |= KZ_THREAD_FLAG_STATIC;
+    *def->idp = thp->id;
+    current = thp;
+    putcurrent();
   }
+  current = first;
+}
 
-  /* メッセージの受信処理 */
-  recvmsg(mboxp);
-  /* メッセージを受信できたのでレディ状態にする */
-  putcurrent();
+/* メッセージバッファのプールの初期化 */
+static KZ_COLD void msgbuf_init(void)
+{
+  kz_msgbuf *mp;
 
-  return current->syscall.param->un.recv.ret;
+  for (mp = msgbufs; mp < msgbufs + MSGBUF_NUM; mp++)
+    KZ_LIST_PUSH(msgbuf_free, mp, next);
 }
 
-/* システムコールの処理(kz_setintr(): 割り込みハンドラ登録) */
-static int thread_setintr(softvec_type_t type, kz_handler_t handler)
+/*
+ * 割り込みスタックをパターンで埋める
+ * ブートスタックは割り込みスタックと同じ領域なので、現在実行中の部分
+ * （スタックポインタより上）は残す。関数を呼ぶとその分のスタックを
+ * 使うので、ループで直接書き込む。
+ */
+static KZ_COLD void intrstack_init(void)
 {
-  static void thread_intr(softvec_type_t type, unsigned long sp);
+#ifndef KZ_HOST
+  char *p, *end;
 
-  /*
-   * 割り込みを受け付けるために、ソフトウェア割り込みベクタに
-   * OSの割り込み処理の入口となる関数を登録する。
-   */
-  softvec_setintr(type, thread_intr);
+  end = (char *)&p - 32;
+  for (p = INTRSTACK_BOTTOM(); p < end; p++)
+    *p = STACK_FILL_PATTERN;
+#ifdef KZ_STACK_CANARY
+  *(uint32 *)INTRSTACK_BOTTOM() = STACK_CANARY;
+#endif
+#endif
+}
 
-  handlers[type] = handler;
-  /* 処理後にレディキューに接続し直す */
-  putcurrent();
+/*
+ * 起動時間の測定(-DKZ_BOOT_TIME)
+ * kz_start() の先頭でシステムティックのタイマを起動し、各段階の終了時の
+ * カウンタの値を記録して、最初のスレッドにディスパッチする直前に表示する
+ * (16ビットタイマの φ/8 = 0.4us単位の16進)。割り込みは禁止のままなので、
+ * 合計がティックの1周期(KZ_TICK_MSEC)を超えると測れず、その旨を表示する。
+ */
+#ifdef KZ_BOOT_TIME
+enum {
+  BOOT_PHASE_INTRSTACK = 0, /* 割り込みスタックのパターンでの埋め込み */
+  BOOT_PHASE_MEMORY,        /* メモリプール・外部DRAM */
+  BOOT_PHASE_KERNEL,        /* TCB・メッセージボックスなどの表とベクタ */
+  BOOT_PHASE_TIMER,         /* ティック・ウォッチドッグタイマ */
+  BOOT_PHASE_THREAD,        /* 初期スレッドの作成 */
+  BOOT_PHASE_NUM
+};
 
-  return 0;
+static const char * const boot_phase_names[BOOT_PHASE_NUM] = {
+  "intrstack", "memory", "kernel", "timer", "thread",
+};
+static uint16 boot_times[BOOT_PHASE_NUM];
+static int boot_time_over;
+
+static KZ_COLD void boot_time_mark(int phase)
+{
+  boot_times[phase] = timer_get_count(TIMER_DEFAULT_DEVICE);
+  if (timer_is_expired(TIMER_DEFAULT_DEVICE))
+    boot_time_over = 1;
 }
 
-/* システムコールの呼び出し */
-static void call_functions(kz_syscall_type_t type, kz_syscall_param_t *p)
+static KZ_COLD void boot_time_print(void)
 {
-  /* システムコールの実行中にcurrentが書き換わるので注意 */
-  switch (type) {
-    /* kz_run() */
-    case KZ_SYSCALL_TYPE_RUN:
-      p->un.run.ret = thread_run(p->un.run.func, p->un.run.name,
-                                 p->un.run.priority, p->un.run.stacksize,
-                                 p->un.run.argc, p->un.run.argv);
-      break;
+  uint16 prev = 0;
+  int i;
 
-    /* kz_exit() */
-    case KZ_SYSCALL_TYPE_EXIT:
-      thread_exit();
-      break;
+  puts("boot time:");
+  for (i = 0; i < BOOT_PHASE_NUM; i++) {
+    puts(" ");
+    puts((char *)boot_phase_names[i]);
+    puts("=");
+    putxval(boot_times[i] - prev, 0);
+    prev = boot_times[i];
+  }
+  puts(boot_time_over ? " (over 1 tick)\n" : "\n");
+}
 
-    /* kz_wait() */
-    case KZ_SYSCALL_TYPE_WAIT:
-      p->un.wait.ret = thread_wait();
-      break;
+#define BOOT_TIME_START() do { \
+    timer_init(TIMER_DEFAULT_DEVICE, KZ_TICK_MSEC); \
+    timer_start(TIMER_DEFAULT_DEVICE); \
+  } while (0)
+#define BOOT_TIME_MARK(phase) boot_time_mark(phase)
+#define BOOT_TIME_PRINT() boot_time_print()
+#else
+#define BOOT_TIME_START()
+#define BOOT_TIME_MARK(phase)
+#define BOOT_TIME_PRINT()
+#endif
 
-    /* kz_sleep() */
-    case KZ_SYSCALL_TYPE_SLEEP:
-      p->un.sleep.ret = thread_sleep();
-      break;
+/* 初期スレッドの起動 */
+KZ_COLD void kz_start(kz_func_t func, char *name, int priority, int stacksize, int argc, char *argv[])
+{
+  extern char userstack, euserstack;
 
-    /* kz_wakeup() */
-    case KZ_SYSCALL_TYPE_WAKEUP:
-      p->un.wakeup.ret = thread_wakeup(p->un.wakeup.id);
-      break;
+  /*
+   * .bss はブートローダがロード時に0で埋めている(bootload/elf.c)ので、
+   * 0・NULLで始まる変数(current, readyque, handlers, 各オブジェクトの表など)は
+   * ここでは初期化しない。0以外の値を持つものと、空きリストのみを作る。
+   */
+  BOOT_TIME_START();
+  intrstack_init();
+  BOOT_TIME_MARK(BOOT_PHASE_INTRSTACK);
 
-    /* kz_getid() */
-    case KZ_SYSCALL_TYPE_GETID:
-      p->un.getid.ret = thread_getid();
-      break;
+  /* 動的メモリの初期化 */
+  kzmem_init();
+  kzdram_init();
+#ifdef KZ_INTR_LATENCY
+  memset(latency, 0, sizeof(latency));
+#endif
+  BOOT_TIME_MARK(BOOT_PHASE_MEMORY);
 
-    /* kz_chpri() */
-    case KZ_SYSCALL_TYPE_CHPRI:
-      p->un.chpri.ret = thread_chpri(p->un.chpri.priority);
-      break;
+  thread_tcb_init();
+  stack_area = &userstack;
+#ifdef KZ_STACK_LAZY_FILL
+  memset(&userstack, STACK_FILL_PATTERN, &euserstack - &userstack);
+#endif
+  msgbox_init();
+  static_mbox_init();
+  msgbuf_init();
+  intr_level_init();
+#ifndef KZ_HOST
+  power_init();
+#endif
 
-    /* kz_kmalloc() */
-    case KZ_SYSCALL_TYPE_KMALLOC:
-      p->un.kmalloc.ret = thread_kmalloc(p->un.kmalloc.size);
-      break;
+  thread_setintr(SOFTVEC_TYPE_SYSCALL, syscall_intr);
+  thread_setintr(SOFTVEC_TYPE_SOFTERR, softerr_intr);
+  thread_setintr(SOFTVEC_TYPE_TIMINTR, tick_intr);
+  BOOT_TIME_MARK(BOOT_PHASE_KERNEL);
 
-    /* kz_kmfree() */
-    case KZ_SYSCALL_TYPE_KMFREE:
-      p->un.kmfree.ret = thread_kmfree(p->un.kmfree.p);
-      break;
+  /*
+   * システムティック用のタイマを起動する
+   * (割り込みは idle スレッドが INTR_ENABLE するまで受け付けられない)
+   */
+#ifndef KZ_BOOT_TIME
+  timer_init(TIMER_DEFAULT_DEVICE, KZ_TICK_MSEC);
+  timer_start(TIMER_DEFAULT_DEVICE);
+#endif
+  tick_count = timer_get_period(TIMER_DEFAULT_DEVICE);
+  tickless_max = 0xffff / tick_count;
+  load.unit = udiv32((uint32)(uint16)LOAD_SAMPLE_TICKS * tick_count, 1000);
 
-    /* kz_send() */
-    case KZ_SYSCALL_TYPE_SEND:
-      p->un.send.ret = thread_send(p->un.send.id, p->un.send.size, p->un.send.p);
-      break;
+#ifdef KZ_WDT
+  /*
+   * ウォッチドッグタイマの起動（以降はタイマ割り込みごとにクリアする）
+   * ティックレスアイドル中もタイマ割り込みの間隔はオーバーフローより短い
+   */
+  wdt_init();
+  if (wdt_is_reset())
+    puts("reset by watchdog timer.\n");
+  wdt_start();
+#endif
+  BOOT_TIME_MARK(BOOT_PHASE_TIMER);
 
-    /* kz_recv() */
-    case KZ_SYSCALL_TYPE_RECV:
-      p->un.recv.ret = thread_recv(p->un.recv.id, p->un.recv.sizep, p->un.recv.pp);
-      break;
+  /*
+   * システムコール発行不可なので直接関数を呼び出してスレッド作成する
+   * (thread_run() は作成したスレッドを current に設定して戻る)
+   */
+  thread_run(func, name, priority, stacksize, argc, argv);
+  static_thread_start();
+  BOOT_TIME_MARK(BOOT_PHASE_THREAD);
+  BOOT_TIME_PRINT();
 
-    /* kz_setintr() */
-    case KZ_SYSCALL_TYPE_SETINTR:
-      p->un.setintr.ret = thread_setintr(p->un.setintr.type, p->un.setintr.handler);
-      break;
+  /*
+   * 渡されたスタックポインタをもとに実行される＝上で登録したcurrentが実行される
+   */
+  dispatch(&current->context);
 
-    default:
-      break;
-  }
+  /* ここには返ってこない */
 }
 
 /*
-void call_run(kz_syscall_param_t *p)
-{
-  p->un.run.ret = thread_run(p->un.run.func, p->un.run.name,
-                             p->un.run.priority, p->un.run.stacksize,
-                             p->un.run.argc, p->un.run.argv);
-}
-void call_exit(kz_syscall_param_t *p)
-{
-  // TCBが消去されるので戻り値を書き込んではいけない
-  thread_exit();
-}
-void call_wait(kz_syscall_param_t *p)
+ * メッセージボックスに格納されているメッセージ数の取得
+ * 読み出しのみなのでシステムコールを発行せずに直接参照する
+ */
+int kz_mbox_count(kz_msgbox_id_t id)
 {
-  p->un.wait.ret = thread_wait();
+  if (!mbox_valid(id))
+    return KZ_ERR_PARAM;
+  return MSGBOX(id)->count;
 }
-void call_sleep(kz_syscall_param_t *p)
+
+/*
+ * スレッドIDの取得
+ * スレッドの動作中は current は常にそのスレッド自身を指しているので、
+ * トラップを発行せずに直接参照する（KZ_SYSCALL_TYPE_GETID は互換のため残す）
+ * サービスコールの処理中(current が NULL)は KZ_THREAD_ID_INTR を返す
+ * (memory.c の KZ_KMALLOC_DEBUG で獲得したスレッドを記録するため)
+ */
+kz_thread_id_t kz_getid(void)
 {
-  p->un.sleep.ret = thread_sleep();
+  return current ? current->id : KZ_THREAD_ID_INTR;
 }
-void call_wakeup(kz_syscall_param_t *p)
+
+/*
+ * スレッドの列挙（ps コマンドなどで kz_getstat() と組み合わせて使う）
+ * id のTCBより後ろで使用中のTCBのスレッドIDを返す（id が0ならば先頭から探す）。
+ * 終了済みで kz_join() されていないスレッドも含む。なければ0を返す。
+ * 読み出しのみなのでシステムコールを発行せずに直接参照する
+ * (列挙の途中でスレッドが終了・起動されることはあり得る)
+ */
+kz_thread_id_t kz_thread_next(kz_thread_id_t id)
 {
-  p->un.wakeup.ret = thread_wakeup(p->un.wakeup.id);
+  int index = id ? (id & THREAD_ID_INDEX_MASK) + 1 : 0;
+
+  for (; index < THREAD_NUM; index++) {
+    if (THREAD(index)->id)
+      return THREAD(index)->id;
+  }
+  return 0;
 }
-void call_getid(kz_syscall_param_t *p)
+
+/*
+ * 実行中でないスレッドの保存されたコンテキスト（スタックポインタ）
+ * スタックには ER0～ER6 と CCR:PC が積まれている(thread_setup() を参照)。
+ * 呼び出したスレッド自身や、存在しないスレッドならば0を返す。
+ * デバッガ(gdbstub.c)がレジスタを表示するためのもので、直接参照する。
+ */
+unsigned long kz_thread_context(kz_thread_id_t id)
 {
-  p->un.getid.ret = thread_getid();
+  kz_thread *thp = thread_find(id);
+
+  if (!thp || (thp == current))
+    return 0;
+  return thp->context.sp;
 }
-void call_chpri(kz_syscall_param_t *p)
+
+/*
+ * スレッドごとのユーザ領域の読み書き
+ * ライブラリがスレッドごとの状態を置くために使う（起動時はNULL）。
+ * 自スレッドのTCBのみを操作するので、kz_getid() と同様にトラップを発行しない。
+ */
+void *kz_tls_get(int index)
 {
-  p->un.chpri.ret = thread_chpri(p->un.chpri.priority);
+  if ((unsigned int)index >= KZ_TLS_NUM)
+    return NULL;
+  return current->tls[index];
 }
-void call_kmalloc(kz_syscall_param_t *p)
+
+int kz_tls_set(int index, void *value)
 {
-  p->un.kmalloc.ret = thread_kmalloc(p->un.kmalloc.size);
+  if ((unsigned int)index >= KZ_TLS_NUM)
+    return KZ_ERR_PARAM;
+  current->tls[index] = value;
+  return 0;
 }
-void call_kmfree(kz_syscall_param_t *p)
+
+/*
+ * リングバッファへの書き込み（割り込みハンドラから呼ぶ）
+ * 書き込めたバイト数を返す（満杯で書き込めなかった分は捨てる）。
+ * サービスコールを使わずに直接書き込み、しきい値に達したときだけ
+ * 待っているスレッドを起こす。起こす処理はキューを操作するので、
+ * 優先レベル0のハンドラから呼ばれた場合も含めて全ての割り込みを
+ * マスクして行う（kz_srvcall() と同様）。
+ */
+int kx_ring_put(kz_ring_id_t id, char *p, int size)
 {
-  p->un.kmfree.ret = thread_kmfree(p->un.kmfree.p);
+  kz_ring *ringp = &rings[id];
+  int head = ringp->head;
+  int i, next, ceiling;
+
+  for (i = 0; i < size; i++) {
+    next = (head + 1) & ringp->mask;
+    if (next == ringp->tail) {
+      ringp->overruns += size - i;
+      break;
+    }
+    ringp->buf[head] = p[i];
+    head = next;
+  }
+  ringp->head = head;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  if (ringp->reader && i) {
+    if (((head - ringp->tail) & ringp->mask) >= ringp->threshold)
+      ring_wakeup(ringp);
+    else
+      ring_pending = 1;
+  }
+  kz_unlock_ceiling(ceiling);
+
+  return i;
 }
-void call_send(kz_syscall_param_t *p)
+
+/*
+ * リングバッファからの読み出し（読み出すスレッドからのみ呼ぶ）
+ * 読み出したバイト数を返す（空ならば0）。書き込み側とは排他せずに、
+ * トラップも発行しない。
+ */
+int kz_ring_get(kz_ring_id_t id, char *buf, int size)
 {
-  p->un.send.ret = thread_send(p->un.send.id, p->un.send.size, p->un.send.p);
+  kz_ring *ringp = &rings[id];
+  int head = ringp->head;
+  int tail = ringp->tail;
+  int n = 0;
+
+  while ((tail != head) && (n < size)) {
+    buf[n++] = ringp->buf[tail];
+    tail = (tail + 1) & ringp->mask;
+  }
+  ringp->tail = tail;
+
+  return n;
 }
-void call_recv(kz_syscall_param_t *p)
+
+/*
+ * リングバッファの空きのバイト数（書き込む側から呼ぶ）
+ * 記録を途中で切らずに書き込めるかを、kx_ring_put() の前に調べる。
+ */
+int kz_ring_space(kz_ring_id_t id)
 {
-  p->un.recv.ret = thread_recv(p->un.recv.id, p->un.recv.sizep, p->un.recv.pp);
+  kz_ring *ringp = &rings[id];
+
+  return (ringp->tail - ringp->head - 1) & ringp->mask;
 }
-void call_setintr(kz_syscall_param_t *p)
+
+/* システムティックの取得（読み出しのみなので直接参照する） */
+uint32 kz_gettick(void)
 {
-  p->un.setintr.ret = thread_setintr(p->un.setintr.type, p->un.setintr.handler);
+  return systicks;
 }
-void (*functions[])(kz_syscall_param_t *p) = {
-    call_run,
-    call_exit,
-    call_wait,
-    call_sleep,
-    call_wakeup,
-    call_getid,
-    call_chpri,
-    call_kmalloc,
-    call_kmfree,
-    call_send,
-    call_recv,
-    call_setintr,
-}
-static void call_functions(kz_syscall_type_t type, kz_syscall_param_t *p)
+
+/*
+ * 高分解能の時刻の取得（起動からのタイマのカウント数, 1カウント = 8サイクル）
+ * 32ビットで約28分で一周するので、差を取って使うこと。
+ * トラップを発行せず、スレッドと割り込みハンドラのどちらからも呼べる。
+ */
+uint32 kz_gettime(void)
 {
-  // システムコールの実行中にcurrentが書き換わるので注意
-  functions[type](p);
+  uint32 t;
+  uint16 count;
+  int old;
+
+  old = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  count = timer_get_count(TIMER_DEFAULT_DEVICE);
+  t = time_base;
+  if (timer_is_expired(TIMER_DEFAULT_DEVICE)) {
+    /*
+     * カウンタはクリアされているが、タイマ割り込みが未処理で time_base に
+     * 反映されていない。クリア後のカウンタ値を読み直して1周期分を加える
+     */
+    count = timer_get_count(TIMER_DEFAULT_DEVICE);
+    t += timer_get_period(TIMER_DEFAULT_DEVICE);
+  }
+  t += count;
+  kz_unlock_ceiling(old);
+
+  return t;
 }
-*/
 
-/* システムコールの処理 */
-static void syscall_proc(kz_syscall_type_t type, kz_syscall_param_t *p)
+#ifdef KZ_FAST_INTR
+/* ファストISRの登録（ハンドラの規約は kozos.h を参照） */
+int kz_setintr_fast(softvec_type_t type, softvec_handler_t handler)
 {
-  /*
-   * システムコールを呼び出したスレッドをレディキューから外した状態で
-   * 処理関数を呼び出す。このためシステムコールを呼び出したスレッドを
-   * そのまま動作継続させたい場合は、処理関数内部でputcurrent()を実行する。
-   */
-  getcurrent();
-  call_functions(type, p);
+  int old;
+
+  if ((type <= SOFTVEC_TYPE_TIMINTR) || (type >= SOFTVEC_TYPE_NUM))
+    return -1;
+
+  old = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  handlers[type] = NULL;
+  softvec_setintr(type, handler);
+  kz_unlock_ceiling(old);
+
+  return 0;
 }
+#endif
 
-/* サービスコールの処理 */
-static void srvcall_proc(kz_syscall_type_t type, kz_syscall_param_t *p)
+/*
+ * 割り込みハンドラ（サービスコールを使うべき文脈）から呼ばれているかの判定
+ * スレッドからは常に0となる（読み出しのみなので直接参照する）
+ */
+int kz_intr_context(void)
 {
-  /*
-   * システムコールとさーびすコールの処理関数の内部で
-   * システムコールの実行したスレッドIDを取得するために
-   * currentを参照している部分がある（thread_send() etc...）
-   * currentが残っていると誤動作するためNULLに設定する。
-   * サービスコールは thread_intrvec() 内部の割り込みハンドラ呼び出しの
-   * 延長で呼ばれているはずなので、呼び出し後に thread_intrvec()
-   * スケジューリング処理が行われ、currentは再設定される。
-   */
-  current = NULL;
-  call_functions(type, p);
+  return intr_nest;
 }
 
-/* スレッドのスケジューリング */
-static void schedule(void)
+/*
+ * 割り込みスタックの使用量（最大値）の取得（読み出しのみなので直接参照する）
+ * 起動時に埋めたパターンが書き換えられていない範囲を除いた大きさを返す
+ * （ホスト環境では測定しないので -1 を返す）
+ */
+int kz_intrstack_used(void)
 {
+#ifndef KZ_HOST
+  unsigned char *p = (unsigned char *)INTRSTACK_BOTTOM();
   int i;
 
-  /*
-   * 優先度の高い順（優先度の数値の小さい順）にレディキューをみて
-   * 動作可能なスレッドを検索する
-   */
-  for (i = 0; i < PRIORITY_NUM; i++) {
-    if (readyque[i].head)
+  for (i = STACK_CANARY_SIZE; i < INTRSTACK_SIZE; i++) {
+    if (p[i] != STACK_FILL_PATTERN)
       break;
   }
+  return INTRSTACK_SIZE - i;
+#else
+  return -1;
+#endif
+}
 
-  /* 見つからなかった */
-  if (i == PRIORITY_NUM)
-    kz_sysdown();
+/*
+ * 優先度シーリング（スレッドから、割り込みハンドラと共有するデータの排他）
+ * 優先レベル level 以下の割り込みをマスクして、以前のマスク状態を返す。
+ * INTR_LEVEL_LOW ならば優先レベル1の割り込みは受け付けたままなので、
+ * INTR_DISABLE による排他よりも、関係のない割り込みを遅らせない。
+ * 戻り値を kz_unlock_ceiling() に渡して元に戻す（入れ子にできる）。
+ * トラップを発行せずにCCRを直接操作する。
+ */
+int kz_lock_ceiling(int level)
+{
+#ifdef KZ_HOST
+  /* ホストでは優先レベルを模擬しないので、全ての割り込みをマスクする */
+  int old = host_intr_is_disable();
+  host_intr_disable();
+  return old;
+#else
+  uint8 ccr;
 
-  current = readyque[i].head;
+  asm volatile ("stc ccr,%0" : "=r"(ccr));
+  if (level == INTR_LEVEL_LOW)
+    asm volatile ("orc.b #0x80,ccr" ::: "cc"); /* I=1: 優先レベル0をマスク */
+  else
+    INTR_DISABLE;
+  return ccr & 0xc0;
+#endif
 }
 
-/* システムコール割り込み呼び出し */
-static void syscall_intr(void)
+void kz_unlock_ceiling(int old)
 {
-  syscall_proc(current->syscall.type, current->syscall.param);
+#ifdef KZ_HOST
+  if (!old)
+    host_intr_enable();
+#else
+  uint8 ccr = old;
+  asm volatile ("ldc %0,ccr" :: "r"(ccr) : "cc");
+#endif
 }
 
-/* ソフトウェアエラー割り込みの呼び出し */
-static void softerr_intr(void)
+#ifdef KZ_SYSCALL_STAT
+/* システムコールごとの統計情報の取得（読み出しのみなので直接参照する） */
+int kz_syscall_stat(kz_syscall_type_t type, kz_syscallstat_t *statp)
 {
-  puts(current->name);
-  puts(" DOWN.\n");
-  getcurrent();
-  thread_exit();
+  if ((unsigned int)type >= KZ_SYSCALL_TYPE_NUM)
+    return KZ_ERR_PARAM;
+  memcpy(statp, &syscallstat[type], sizeof(*statp));
+  return 0;
 }
+#endif
 
+#ifdef KZ_MBOX_STAT
 /*
- * 割り込み処理の入り口関数
- *
- * ソフトウェア割り込みを一括で処理するハンドラ
- * 実際に実行する処理はhandlersに格納しておく
+ * メッセージボックスごとの統計情報の取得
+ * 割り込みからの送信(kx_send())でも更新されるので、割り込みを禁止してコピーする
  */
-static void thread_intr(softvec_type_t type, unsigned long sp)
+int kz_mbox_stat(kz_msgbox_id_t id, kz_mboxstat_t *statp)
 {
-  /* カレントスレッドのコンテキストを保存する */
-  current->context.sp = sp;
+  int ceiling;
 
-  /*
-   * 割り込みごとの処理を実行する
-   * SOFTVEC_TYPE_SYSCALL => syscall_intr()
-   * SOFTVEC_TYPE_SOFTERR => softerr_intr()
-   * それ以外の場合は、kz_setintr() によって
-   * ユーザに登録されたハンドラが実行される。
-   */
-  if (handlers[type])
-    handlers[type]();
+  if ((id < 0) || (id >= MSGBOX_NUM))
+    return KZ_ERR_PARAM;
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  memcpy(statp, &mboxstat[id], sizeof(*statp));
+  statp->count = MSGBOX(id)->count;
+  kz_unlock_ceiling(ceiling);
+  return 0;
+}
+#endif
 
-  /* スレッドのスケジューリング */
-  schedule();
+#ifdef KZ_INTR_LATENCY
+/*
+ * 割り込みの遅延のヒストグラムの取得
+ * 割り込みハンドラが更新するので、割り込みを禁止してコピーする
+ */
+int kz_intr_latency(softvec_type_t type, kz_latencystat_t *statp)
+{
+  int ceiling;
 
-  /*
-   * スレッドのディスパッチ
-   * start.sで定義
-   */
-  dispatch(&current->context);
+  if ((type < 0) || (type >= KZ_PERFSTAT_INTR_NUM))
+    return KZ_ERR_PARAM;
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  memcpy(statp, &latency[type], sizeof(*statp));
+  kz_unlock_ceiling(ceiling);
+  return 0;
+}
+#endif
 
-  /* ここには返ってこない */
+#ifdef KZ_STANDBY
+/*
+ * ソフトウェアスタンバイの許可・禁止（以前の設定を返す）
+ * 許可すると、他に動作可能なスレッドもタイマ待ちも無いときに、アイドル
+ * 処理がスリープの代わりにソフトウェアスタンバイにする。起床できるのは
+ * IRQ0～IRQ2 の割り込みのみで、起床には発振の安定待ち(約13ミリ秒)が入る。
+ * シリアルの送信以外の周辺（A/D変換やLANボードなど）の処理が残って
+ * いないときに許可すること。
+ */
+int kz_standby(int enable)
+{
+  int old = standby_enable;
+  standby_enable = enable;
+  return old;
 }
+#endif
 
-/* 初期スレッドの起動 */
-void kz_start(kz_func_t func, char *name, int priority, int stacksize, int argc, char *argv[])
+/*
+ * アイドル処理（アイドルスレッドから繰り返し呼び出す）
+ * 他に動作可能なスレッドが無い場合は、次のタイマ待ちの起床時刻まで
+ * タイマ割り込みの周期を延ばしてからスリープする（ティックレスアイドル）。
+ * 16ビットタイマのため、延ばせるのは tickless_max ティックまで。
+ * タイマ待ちが無く、kz_standby() で許可されていればソフトウェアスタンバイにする。
+ */
+void kz_idle(void)
 {
-  /* 動的メモリの初期化 */
-  kzmem_init();
+  int n;
 
-  /*
-   * 以降で呼び出すスレッド関連のライブラリ関数の内部で
-   * current を見ている場合があるので、currentをNULLに初期化しておく
-   */
-  current = NULL;
+  /* しきい値未満でも、他に動作するスレッドがなければリングバッファを渡す */
+  if (ring_pending) {
+    kz_syscall_param_t param;
+    kz_syscall(KZ_SYSCALL_TYPE_RING_FLUSH, &param);
+    return;
+  }
 
-  memset(readyque, 0, sizeof(readyque));
-  memset(threads, 0, sizeof(threads));
-  memset(handlers, 0, sizeof(handlers));
-  memset(msgboxes, 0, sizeof(msgboxes));
+  INTR_DISABLE;
 
-  thread_setintr(SOFTVEC_TYPE_SYSCALL, syscall_intr);
-  thread_setintr(SOFTVEC_TYPE_SOFTERR, softerr_intr);
+  /* チェック後の割り込みで書き込まれていれば、スリープせずにやり直す */
+  if (ring_pending) {
+    INTR_ENABLE;
+    return;
+  }
 
-  /*
-   * システムコール発行不可なので直接関数を呼び出してスレッド作成する
-   */
-  current = (kz_thread *)thread_run(func, name, priority, stacksize, argc, argv);
+  if (!tickless && !timer_is_expired(TIMER_DEFAULT_DEVICE)
+#ifdef KZ_BUDGET
+      /* 停止中のスレッドを周期の始まりに遅れずに戻すため */
+      && !budget_throttled
+#endif
+      && (readyque_bitmap == (1 << current->priority))
+      && (readyque[current->priority].head == current)
+      && (current->next == NULL)) {
+#ifdef KZ_STANDBY
+    if (standby_enable && !timerque && !swtimerque && power_standby_ready()) {
+#ifdef KZ_WDT
+      wdt_stop();
+#endif
+      standby = 1;
+      power_standby(); /* 割り込みを有効にしてスタンバイする */
+      return;
+    }
+#endif
+    n = timerque ? timerque->timer.delta : tickless_max;
+    if (swtimerque && (swtimerque->delta < n))
+      n = swtimerque->delta;
+    if (n > tickless_max)
+      n = tickless_max;
+    if (n > 1) {
+      /* カウンタは止めずに周期だけ延ばすので、ティックの区切りはずれない */
+      timer_set_period(TIMER_DEFAULT_DEVICE, (uint32)tick_count * (uint16)n);
+      tickless = n;
+    }
+  }
+
+  /* スリープ時間の測定開始（起床時に thread_intr() で積算する） */
+  load.start_ticks = load_now(&load.start_count);
+  load.sleeping = 1;
 
   /*
-   * 渡されたスタックポインタをもとに実行される＝上で登録したcurrentが実行される
+   * 割り込みを有効にしてスリープする
+   * (CCRを操作した直後の命令の前では割り込みは受け付けられないので、
+   *  有効化からスリープまでの間に割り込みが入って起床を取りこぼすことはない)
    */
-  dispatch(&current->context);
+#ifdef KZ_HOST
+  host_idle();
+#else
+  asm volatile ("andc.b #0x3f,ccr\n\tsleep");
+#endif
+}
 
-  /* ここには返ってこない */
+KZ_STATIC_ASSERT(sizeof(kz_crashdump_t) <= KZ_CRASHDUMP_SIZE, crashdump_size);
+
+/*
+ * クラッシュダンプの記録
+ * レジスタは、割り込みの入口でカレントスレッドのスタックに保存されたもの
+ */
+static void crashdump_save(void)
+{
+  extern kz_crashdump_t crashdump;
+  kz_crashdump_t *cd = &crashdump;
+  kz_memstat_t mstat;
+  int i;
+#ifdef KZ_TRACE
+  kz_trace_t *tp;
+  int pos;
+#endif
+
+  memset(cd, 0, sizeof(*cd));
+  cd->tick = systicks;
+  cd->syscall = KZ_CRASHDUMP_NO_SYSCALL;
+  cd->nest = intr_nest;
+  if (current) {
+    cd->thread = current->id;
+    for (i = 0; (i < KZ_CRASHDUMP_NAME_SIZE - 1) && current->name[i]; i++)
+      cd->name[i] = current->name[i];
+    cd->syscall = current->syscall.type;
+    if (current->context.sp)
+      memcpy(cd->regs, (char *)current->context.sp, sizeof(cd->regs));
+  }
+  for (i = 0; i < KZ_CRASHDUMP_POOL_NUM; i++) {
+    if (kzmem_stat(i, &mstat) < 0)
+      break;
+    cd->pools[i].size = mstat.size;
+    cd->pools[i].used = mstat.used;
+    cd->pools[i].peak = mstat.peak;
+  }
+#ifdef KZ_TRACE
+  tp = kz_trace_buffer(&pos);
+  for (i = 0; i < KZ_CRASHDUMP_TRACE_NUM; i++) {
+    memcpy(cd->trace[i],
+           &tp[(pos - KZ_CRASHDUMP_TRACE_NUM + i) & (TRACE_NUM - 1)],
+           sizeof(cd->trace[i]));
+  }
+  cd->trace_num = KZ_CRASHDUMP_TRACE_NUM;
+#endif
+  cd->magic = KZ_CRASHDUMP_MAGIC;
+}
+
+#ifdef KZ_SYMTAB
+/* 記録したPCを関数名で表示する（組み込みのシンボル表で引く） */
+static void crashdump_print_pc(void)
+{
+  extern kz_crashdump_t crashdump;
+  uint32 pc = crashdump.regs[7] & 0xffffff, offset;
+  char *name;
+
+  if (!pc)
+    return;
+  puts("pc: ");
+  putxval(pc, 0);
+  if ((name = kz_symbol(pc, &offset)) != NULL) {
+    puts(" <");
+    puts(name);
+    puts("+");
+    putxval(offset, 0);
+    puts(">");
+  }
+  puts("\n");
 }
+#endif
 
-/* OS内部で致命的なエラーが発生したときにこの関数を実行する */
+/*
+ * OS内部で致命的なエラーが発生したときにこの関数を実行する
+ * 状態をクラッシュダンプの領域に記録してから停止する
+ */
 void kz_sysdown(void)
 {
+  INTR_DISABLE;
+  crashdump_save();
   puts("system error!\n");
+#ifdef KZ_SYMTAB
+  crashdump_print_pc();
+#endif
   while (1)
     ;
 }
@@ -724,12 +5694,27 @@ void kz_syscall(kz_syscall_type_t type, kz_syscall_param_t *param)
   /*
    * トラップ命令実行
    * vector.cよりintr_syscallが発生
+   * er0～er3 は復帰時に復元されないので、破壊されるものとして指定する
    */
-  asm volatile ("trapa #0");
+#ifdef KZ_HOST
+  host_trap(SOFTVEC_TYPE_SYSCALL);
+#else
+  asm volatile ("trapa #0" : : : "er0", "er1", "er2", "er3", "memory");
+#endif
 }
 
 /* サービスコール呼び出し用ライブラリ関数 */
 void kz_srvcall(kz_syscall_type_t type, kz_syscall_param_t *param)
 {
-  srvcall_proc(type, param);
+  /*
+   * 優先レベル0の割り込みハンドラから呼ばれた場合は、優先レベル1の
+   * 割り込みが入ってOSの内部状態を壊さないように全て禁止にして処理する
+   */
+  if (intr_open) {
+    INTR_DISABLE;
+    srvcall_proc(type, param);
+    INTR_ENABLE_HIGH;
+  } else {
+    srvcall_proc(type, param);
+  }
 }
@@ -9,37 +9,269 @@
 /* OS のサービスを提供           */
 /*******************************/
 
+/* タイマ割り込みの周期（1ティックのミリ秒数） */
+#define KZ_TICK_MSEC 10
+
+/* システムコールのエラーコード */
+#define KZ_ERR_TIMEOUT (-2) /* タイムアウト */
+#define KZ_ERR_EMPTY   (-3) /* メッセージなし */
+#define KZ_ERR_FULL    (-4) /* メッセージボックスが満杯 */
+#define KZ_ERR_STATE   (-5) /* 対象が要求された状態にない */
+#define KZ_ERR_NORES   (-6) /* 資源（オブジェクトの空き）がない */
+#define KZ_ERR_PARAM   (-7) /* パラメータが不正 */
+
+/*
+ * 割り込みハンドラ（サービスコール）やソフトウェアタイマから送信された
+ * メッセージの送信元のID（kz_recv() の戻り値。スレッドのIDは0にならない）
+ */
+#define KZ_THREAD_ID_INTR 0
+
+/* メッセージボックスの属性 */
+#define KZ_MSGBOX_ATTR_FIFO     0        /* 受信待ちスレッドはFIFO順（デフォルト） */
+#define KZ_MSGBOX_ATTR_PRIORITY (1 << 0) /* 受信待ちスレッドは優先度順 */
+
+/*
+ * メッセージの優先度（kz_send_pri()、小さいものほど先に受信される）
+ * kz_send() などの優先度を指定しない送信は KZ_MSG_PRIORITY_DEFAULT となる
+ */
+#define KZ_MSG_PRIORITY_HIGHEST 0
+#define KZ_MSG_PRIORITY_DEFAULT 8
+
+/* kz_chpri_thread() のフラグ */
+#define KZ_CHPRI_HEAD (1 << 0) /* レディキューの末尾ではなく先頭に繋ぐ */
+
+/* イベントフラグの待ちモード */
+#define KZ_FLAG_WAIT_OR    0        /* いずれかのビットがセットされるまで待つ */
+#define KZ_FLAG_WAIT_AND   (1 << 0) /* すべてのビットがセットされるまで待つ */
+#define KZ_FLAG_WAIT_CLEAR (1 << 1) /* 待ち解除時に待ちパターンのビットをクリアする */
+
+/*
+ * 静的なスレッドとメッセージボックスの定義（リンク時に登録する）
+ * KZ_THREAD_DEFINE() はスタックを .bss.userstack (ld.scr の userstack 領域の
+ * 先頭) に確保し、kz_start() が初期スレッドの後に定義の順番で起動する
+ * (kz_run() と違い、TCBとスタックの検索・獲得がない)。起動したスレッドのIDは
+ * <sym>_id に入る。スタックのサイズは kz_run() と同じサイズクラスに切り上げる。
+ * KZ_MBOX_DEFINE() のメッセージボックスは kz_start() が固定IDの次から順に
+ * 割り当て、IDを sym に入れる。
+ * TCB・メッセージボックスが足りなければ kz_start() で停止する。
+ * 同じファイルに複数定義する場合は、sym を変えること。
+ */
+typedef struct {
+  kz_func_t func;
+  char *name;
+  int priority;
+  int stacksize;
+  char *stack;         /* スタックの領域の先頭 */
+  int argc;
+  char **argv;
+  kz_thread_id_t *idp;
+} kz_thread_def_t;
+
+typedef struct {
+  kz_msgbox_id_t *idp;
+  int attr;
+} kz_mbox_def_t;
+
+#define KZ_STACK_SIZE(size) \
+  (((size) <= STACK_CLASS_MIN) ? STACK_CLASS_MIN : \
+   ((size) <= (STACK_CLASS_MIN << 1)) ? (STACK_CLASS_MIN << 1) : \
+   ((size) <= (STACK_CLASS_MIN << 2)) ? (STACK_CLASS_MIN << 2) : \
+   ((size) <= (STACK_CLASS_MIN << 3)) ? (STACK_CLASS_MIN << 3) : -1)
+
+#define KZ_THREAD_DEFINE(sym, func, name, priority, stacksize, argc, argv) \
+  kz_thread_id_t sym##_id; \
+  static char sym##_stack[KZ_STACK_SIZE(stacksize)] \
+    __attribute__((section(".bss.userstack"), aligned(4))); \
+  static const kz_thread_def_t sym##_thread_def \
+    __attribute__((section("kz_threads"), used)) = \
+    { func, name, priority, KZ_STACK_SIZE(stacksize), sym##_stack, \
+      argc, argv, &sym##_id }
+
+#define KZ_MBOX_DEFINE(sym, attr) \
+  kz_msgbox_id_t sym; \
+  static const kz_mbox_def_t sym##_mbox_def \
+    __attribute__((section("kz_mboxes"), used)) = { &sym, attr }
+
 /* システムコール */
 kz_thread_id_t kz_run(kz_func_t func, char *name, int priority, int stacksize, int argc, char *argv[]);
 
 void kz_exit(void);
 int kz_wait(void);
-int kz_sleep(void);
+int kz_sleep(int ticks);
 int kz_wakeup(kz_thread_id_t id);
-kz_thread_id_t kz_getid(void);
+int kz_suspend(kz_thread_id_t id);
+int kz_resume(kz_thread_id_t id);
 int kz_chpri(int priority);
+int kz_chpri_thread(kz_thread_id_t id, int priority, int flags);
+int kz_setslice(int priority, int ticks);
+int kz_stackinfo(kz_thread_id_t id, int *sizep, int *usedp);
+int kz_getstat(kz_thread_id_t id, kz_threadstat_t *statp);
+int kz_getload(int samples);
 void *kz_kmalloc(int size);
 int kz_kmfree(void *p);
+int kz_memstat(int index, kz_memstat_t *statp);
+int kz_regionstat(kz_regionstat_t *statp);
+int kz_perfstat(kz_perfstat_t *statp, uint32 *syscalls, int num);
+void *kz_dmalloc(uint32 size);
+int kz_dmfree(void *p);
 int kz_send(kz_msgbox_id_t id, int size, char *p);
+int kz_psend(kz_msgbox_id_t id, int size, char *p);
+int kz_send_pri(kz_msgbox_id_t id, int size, char *p, int priority);
+int kz_send_inline(kz_msgbox_id_t id, int size, char *p);
+int kz_sendv(kz_msgbox_id_t id, kz_msgvec_t *vec, int count);
+int kz_syscall_batch(kz_syscall_type_t *types, kz_syscall_param_t *params, int count);
+kz_ring_id_t kz_ring_create(char *buf, int size, int threshold);
+int kz_ring_delete(kz_ring_id_t id);
+int kz_ring_wait(kz_ring_id_t id);
 kz_thread_id_t kz_recv(kz_msgbox_id_t id, int *sizep, char **pp);
+kz_thread_id_t kz_trecv(kz_msgbox_id_t id, int *sizep, char **pp, int timeout);
+kz_thread_id_t kz_precv(kz_msgbox_id_t id, int *sizep, char **pp);
+kz_thread_id_t kz_recv_inline(kz_msgbox_id_t id, int *sizep, char **pp, char *buf);
+kz_thread_id_t kz_recv_any(uint16 mask, kz_msgbox_id_t *idp, int *sizep, char **pp);
+kz_thread_id_t kz_recv_free(kz_msgbox_id_t id, int *sizep, char **pp, int timeout, void *release);
+int kz_call(kz_msgbox_id_t id, int size, char *p, char **replyp);
+int kz_reply(kz_thread_id_t id, int size, char *p);
+kz_msgbox_id_t kz_mbox_create(int attr);
+int kz_mbox_delete(kz_msgbox_id_t id);
+int kz_mbox_setattr(kz_msgbox_id_t id, int attr);
+int kz_mbox_setcap(kz_msgbox_id_t id, int capacity);
+int kz_mbox_reserve(kz_msgbox_id_t id, int nodes, int blocks, int size);
+void *kz_mbox_alloc(kz_msgbox_id_t id);
+int kz_mbox_free(kz_msgbox_id_t id, void *p);
+kz_sem_id_t kz_sem_create(int count);
+int kz_sem_delete(kz_sem_id_t id);
+int kz_sem_wait(kz_sem_id_t id);
+int kz_sem_post(kz_sem_id_t id);
+kz_mutex_id_t kz_mutex_create(void);
+int kz_mutex_delete(kz_mutex_id_t id);
+int kz_mutex_lock(kz_mutex_id_t id);
+int kz_mutex_unlock(kz_mutex_id_t id);
+kz_flag_id_t kz_flag_create(uint16 pattern);
+int kz_flag_delete(kz_flag_id_t id);
+int kz_flag_wait(kz_flag_id_t id, uint16 pattern, int mode, uint16 *flagsp);
+int kz_flag_set(kz_flag_id_t id, uint16 pattern);
+int kz_flag_clear(kz_flag_id_t id, uint16 pattern);
 int kz_setintr(softvec_type_t type, kz_handler_t handler);
+int kz_setintrlevel(softvec_type_t type, int level);
+int kz_heartbeat(int ticks);
+int kz_join(kz_thread_id_t id, int *statusp);
+int kz_wait_for(kz_thread_id_t id);
+int kz_setperiod(int ticks, int phase);
+int kz_wait_period(void);
+#if KZ_CONFIG_SWTIMER
+kz_timer_id_t kz_timer_create(int ticks, int periodic, kz_msgbox_id_t id, char *p);
+kz_timer_id_t kz_timer_create_func(int ticks, int periodic, kz_defer_func_t func, void *p);
+int kz_timer_delete(kz_timer_id_t id);
+#endif
+int kz_setdeadline(int ticks);
+#ifdef KZ_BUDGET
+/*
+ * CPU時間の割り当て(KZ_BUDGET)
+ * id のスレッドを period ティックごとに ticks ティックまでしか実行させない。
+ * 使い切ったスレッドは、優先度にかかわらず次の周期の始まりまで停止する
+ * （mutexを獲得中は解放まで停止を遅らせる）。ticks が0ならば割り当てをやめる。
+ * アプリケーションのスレッドが暴走しても、より低い優先度のドライバや
+ * 制御ループが動作できるようにするために使う。
+ */
+int kz_setbudget(kz_thread_id_t id, int ticks, int period);
+#endif
+#ifdef KZ_TRACE
+/*
+ * スレッドのシステムコールのトレース(KZ_TRACE)
+ * on が0でなければ、id のスレッドが発行するシステムコールの引数・戻り値と
+ * 終了時刻をトレースに記録する(trace.h の KZ_TRACE_SYSARG など)。
+ * 指定していないスレッドのシステムコールは、フラグを調べるだけで記録しない。
+ * 以前の設定(0か1)を返す。
+ */
+int kz_strace(kz_thread_id_t id, int on);
+#endif
+#if KZ_CONFIG_TOPIC
+kz_topic_id_t kz_topic_create(void);
+int kz_topic_delete(kz_topic_id_t id);
+int kz_topic_subscribe(kz_topic_id_t id, kz_msgbox_id_t box);
+int kz_topic_unsubscribe(kz_topic_id_t id, kz_msgbox_id_t box);
+void *kz_topic_alloc(int size);
+int kz_topic_publish(kz_topic_id_t id, int size, char *p);
+int kz_topic_release(char *p);
+#endif
 
 /* サービスコール */
 int kx_wakeup(kz_thread_id_t id);
 void *kx_kmalloc(int size);
 int kx_kmfree(void *p);
 int kx_send(kz_msgbox_id_t id, int size, char *p);
+int kx_sem_post(kz_sem_id_t id);
+int kx_flag_set(kz_flag_id_t id, uint16 pattern);
+int kx_defer(kz_defer_func_t func, void *p, int arg);
+int kx_ring_put(kz_ring_id_t id, char *p, int size); /* サービスコールを使わない */
 
 /* ライブラリ関数 */
 void kz_start(kz_func_t func, char *name, int priority, int stacksize, int argc, char *argv[]);
+int kz_workq_start(int num, int priority, int stacksize);
+int kz_workq_submit(kz_work_func_t func, void *arg);
+/* 以下はトラップを発行せずに直接参照する読み出し専用の問い合わせ */
+kz_thread_id_t kz_getid(void);
+kz_thread_id_t kz_thread_next(kz_thread_id_t id);
+unsigned long kz_thread_context(kz_thread_id_t id);
+void *kz_tls_get(int index);
+int kz_tls_set(int index, void *value);
+int kz_ring_get(kz_ring_id_t id, char *buf, int size);
+int kz_ring_space(kz_ring_id_t id);
+int kz_mbox_count(kz_msgbox_id_t id);
+uint32 kz_gettick(void);
+uint32 kz_gettime(void);
+int kz_intrstack_used(void);
+int kz_intr_context(void);
+int kz_lock_ceiling(int level);
+void kz_unlock_ceiling(int old);
+#ifdef KZ_SYSCALL_STAT
+int kz_syscall_stat(kz_syscall_type_t type, kz_syscallstat_t *statp);
+#endif
+#ifdef KZ_INTR_LATENCY
+int kz_intr_latency(softvec_type_t type, kz_latencystat_t *statp);
+#endif
+#ifdef KZ_FAST_INTR
+/*
+ * ファストISR(KZ_FAST_INTR)の登録
+ * ハンドラをソフトウェア割り込みベクタに直接登録し、割り込みの入口から
+ * カーネル(thread_intr())を経由せずに呼び出させる。
+ * ハンドラは以下を守ること。
+ *   ・全ての割り込みを禁止した状態で、割り込みスタック上で呼ばれる。
+ *     短く終えて、割り込み要因をクリアしてから戻る
+ *   ・カーネルを経由しないので、サービスコール(kx_*())を含むシステムコールや
+ *     スケジューリングはできない（current も割り込まれたスレッドとは限らない）。
+ *     スレッドへの通知は、共有変数に書いてスレッドからポーリングするか、
+ *     別の通常の割り込みを起こして行う
+ *   ・割り込みの回数・遅延の統計やトレースには現れない。スタンバイ
+ *     (KZ_STANDBY)からの起床にも使えない
+ * カーネルが使う割り込み（システムコール・タイマなど）には登録できない。
+ * kz_setintr() で登録し直すと、通常のハンドラに戻る。
+ */
+int kz_setintr_fast(softvec_type_t type, softvec_handler_t handler);
+#endif
+#ifdef KZ_MBOX_STAT
+int kz_mbox_stat(kz_msgbox_id_t id, kz_mboxstat_t *statp);
+#endif
+void kz_idle(void);
+#ifdef KZ_STANDBY
+int kz_standby(int enable);
+#endif
 void kz_sysdown(void);
 void kz_syscall(kz_syscall_type_t type, kz_syscall_param_t *param);
 void kz_srvcall(kz_syscall_type_t type, kz_syscall_param_t *param);
 
 /* システムタスク */
+int defer_main(int argc, char *argv[]);   /* 割り込みの遅延処理スレッド */
 int consdrv_main(int argc, char *argv[]); /* コンソールドライバスレッド */
+int netdrv_main(int argc, char *argv[]);  /* イーサネットドライバスレッド(KZ_NETDRV) */
+int net_main(int argc, char *argv[]);     /* プロトコルスタックスレッド(KZ_NET) */
+int log_main(int argc, char *argv[]);     /* ロガースレッド(KZ_LOG) */
+int gdbstub_main(int argc, char *argv[]); /* GDBのリモートスタブ(KZ_GDBSTUB) */
+int adcdrv_main(int argc, char *argv[]);  /* A/D変換ドライバスレッド(KZ_ADC) */
+int busdrv_main(int argc, char *argv[]);  /* I2C/SPIのバスドライバスレッド(KZ_BUSDRV) */
 
 /* ユーザタスク */
+int bench_main(int argc, char *argv[]);   /* マイクロベンチマーク(KZ_BENCH) */
 int command_main(int argc, char *argv[]); /* コマンドスレッド */
 
 #endif
@@ -0,0 +1,255 @@
+#ifndef _KOZOS_CONFIG_H_INCLUDED_
+#define _KOZOS_CONFIG_H_INCLUDED_
+
+/*
+ * カーネルの構成（テーブルの大きさと、組み込む機能の選択）
+ * defines.h から読み込まれるので、OSの全てのソースで参照できる。
+ *
+ * 製品ごとの構成は、変更したい値だけを定義したファイルを用意して
+ * -DKOZOS_CONFIG=\"ファイル名\" で指定する（先に読み込むので、ここでの
+ * 値より優先される）。Makefile の CFLAGS で -DTHREAD_NUM=8 などと
+ * 個別に指定してもよい。
+ *
+ * 以下はここでは変更できない。
+ * ・メモリプールのブロックサイズと個数：memconf.h (-DMEMORY_CONFIG)
+ * ・ソフトウェア割り込みベクタの数(intr.h)：ブートローダのベクタと合わせる
+ * ・固定IDのメッセージボックス(defines.h)：アプリケーションとの取り決め
+ */
+#ifdef KOZOS_CONFIG
+#include KOZOS_CONFIG
+#endif
+
+/*
+ * 組み込む機能
+ * 0 にすると、そのシステムコールのカーネル側の処理とライブラリ関数を
+ * 組み込まない（システムコールの番号は変わらない）。
+ * セマフォとイベントフラグはコンソールドライバや遅延処理(defer.c)が、
+ * ミューテックスはオーバレイ(overlay.c)と優先度継承が、リングバッファ
+ * (kz_ring_*()) はコンソールドライバの受信が使うので、常に組み込む。
+ * 以下の機能は、定義した場合のみ組み込む(-DKZ_TRACE などでもよい)。
+ * トレースと統計は KZ_TRACE・KZ_SYSCALL_STAT・KZ_MBOX_STAT などで選ぶ。
+ *   KZ_TRACE          カーネルのイベントトレース(trace.h)
+ *   KZ_SYSCALL_STAT   システムコールごとの呼び出し回数・処理時間の計測
+ *   KZ_INTR_LATENCY   割り込みの遅延のヒストグラム(kz_intr_latency())
+ *   KZ_MBOX_STAT      メッセージボックスごとの滞留数・待ち時間(kz_mbox_stat())
+ *   KZ_FAST_INTR      カーネルを経由しないファストISR(kz_setintr_fast())
+ *   KZ_BUDGET         スレッドごとのCPU時間の割り当て(kz_setbudget())
+ *   KZ_WDT            ウォッチドッグタイマ
+ *   KZ_STACK_CANARY   スタックの溢れの検出
+ *   KZ_KMALLOC_OWNER  スレッドの終了時の動的メモリの解放
+ *   KZ_KMALLOC_DEBUG  動的メモリの二重解放・解放後の書き込みの検出(memory.c)
+ *   KZ_BOOT_TIME      kz_start() の各段階の時間の表示
+ *   KZ_STANDBY        アイドル時のソフトウェアスタンバイ(kz_standby(), power.c)
+ *   KZ_NETDRV         イーサネットドライバ(netdrv.c, make NETDRV=1 で定義される)
+ *   KZ_NET            ARP/IP/ICMP/UDPのプロトコルスタック(net.c, make NET=1)
+ *   KZ_LOG            非同期のログ(log.c, make LOG=1 で定義される)
+ *   KZ_ADC            A/D変換ドライバ(adcdrv.c, make ADC=1 で定義される)
+ *   KZ_IRQDRV         外部端子割り込みのドライバ(irqdrv.c, make IRQDRV=1)
+ *   KZ_BUSDRV         I2C/SPIのバスドライバ(busdrv.c, make BUSDRV=1)
+ *   KZ_GDBSTUB        GDBのリモートスタブ(gdbstub.c, make GDBSTUB=1 で定義される)
+ *   KZ_SERBENCH       シリアルの性能測定の serbench コマンド(make SERBENCH=1)
+ */
+#ifndef KZ_CONFIG_TOPIC
+#define KZ_CONFIG_TOPIC 1 /* トピック配信(kz_topic_*()) */
+#endif
+#ifndef KZ_CONFIG_SWTIMER
+#define KZ_CONFIG_SWTIMER 1 /* ソフトウェアタイマ(kz_timer_*()。kz_sleep() などのタイムアウトは別) */
+#endif
+
+/* スレッド */
+#ifndef THREAD_NUM
+#define THREAD_NUM 6         /* TCBの数 */
+#endif
+#ifndef PRIORITY_NUM
+#define PRIORITY_NUM 16      /* 優先度の数（16以下） */
+#endif
+#ifndef THREAD_NAME_SIZE
+#define THREAD_NAME_SIZE 15  /* スレッド名の最大長 */
+#endif
+#ifndef STACK_CLASS_MIN
+#define STACK_CLASS_MIN 0x100 /* スタックの最小のサイズクラス（4種類の最小） */
+#endif
+#ifndef STACKSIZE_MARGIN
+#define STACKSIZE_MARGIN 32  /* stack コマンドの推奨値で使用量の最大値に加える分 */
+#endif
+#ifndef KZ_TLS_NUM
+#define KZ_TLS_NUM 4         /* スレッドごとのユーザ領域(kz_tls_get())の数 */
+#endif
+
+/* 起動の確認(bootinfo.h) */
+#ifndef KZ_BOOT_CONFIRM_TICKS
+#define KZ_BOOT_CONFIRM_TICKS 1000 /* この間クラッシュしなければ起動できたとする */
+#endif
+
+/* カーネルのオブジェクト */
+#ifndef MSGBUF_NUM
+#define MSGBUF_NUM 16   /* メッセージバッファ（送信済みで未受信のメッセージ）の数 */
+#endif
+#ifndef MSGBOX_NUM
+#define MSGBOX_NUM 8    /* 固定IDのものを含むメッセージボックスの総数（16以下） */
+#endif
+#ifndef KZ_MSG_INLINE_SIZE
+#define KZ_MSG_INLINE_SIZE 8 /* kz_send_inline() でコピーして送れる最大サイズ */
+#endif
+#ifndef SEM_NUM
+#define SEM_NUM 8
+#endif
+#ifndef MUTEX_NUM
+#define MUTEX_NUM 8
+#endif
+#ifndef FLAG_NUM
+#define FLAG_NUM 8
+#endif
+#ifndef SWTIMER_NUM
+#define SWTIMER_NUM 8   /* ソフトウェアタイマ(kz_timer_create())の数 */
+#endif
+#ifndef TOPIC_NUM
+#define TOPIC_NUM 4
+#endif
+#ifndef RING_NUM
+#define RING_NUM 4      /* コンソール(consdrv.c)が1つずつ使う */
+#endif
+
+/* システムタスク・ライブラリ */
+#ifndef DEFER_NUM
+#define DEFER_NUM 8      /* 登録できる遅延処理の数（2の累乗であること） */
+#endif
+#ifndef WORKQ_JOB_NUM
+#define WORKQ_JOB_NUM 8  /* ワークキューに同時に登録できる処理の数 */
+#endif
+#ifndef TASK_LEVEL_NUM
+#define TASK_LEVEL_NUM 2 /* タスクのレベル（ディスパッチスレッド）の数(task.h) */
+#endif
+#ifndef TASK_EVENT_NUM
+#define TASK_EVENT_NUM 16 /* タスクへの未処理のイベントの総数 */
+#endif
+#ifndef SHBUF_NUM
+#define SHBUF_NUM 4      /* 共有バッファの数(shbuf.h) */
+#endif
+#ifndef SHBUF_NAME_SIZE
+#define SHBUF_NAME_SIZE 8 /* 共有バッファの名前の最大長（終端を含む） */
+#endif
+#ifndef TRACE_NUM
+#define TRACE_NUM 64     /* トレースのリングバッファの記録数（2の累乗であること） */
+#endif
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 256 /* ログのリングバッファのバイト数（2の累乗であること） */
+#endif
+#ifndef LOG_WAKE_SIZE
+#define LOG_WAKE_SIZE 128 /* ロガースレッドを起こすバイト数（満たなければアイドル時） */
+#endif
+
+/* コンソールドライバ */
+#ifndef CONSDRV_SEND_SIZE
+#define CONSDRV_SEND_SIZE 32
+#endif
+#ifndef CONSDRV_RECV_SIZE
+#define CONSDRV_RECV_SIZE 24 /* 1行の最大長+1 */
+#endif
+#ifndef CONSDRV_BULK_SIZE
+#define CONSDRV_BULK_SIZE 64 /* 大量出力用の送信バッファ（2のべき乗, 0で対話用と共用） */
+#endif
+#ifndef CONSDRV_BULK_DROP
+#define CONSDRV_BULK_DROP 1  /* 大量出力が溢れたら古い行を捨てる（0なら待つ） */
+#endif
+#ifndef CONSDRV_NOTIFY_NUM
+#define CONSDRV_NOTIFY_NUM 4  /* 完了通知を待つ書き込みの数 */
+#endif
+#ifndef CONSDRV_FLOW_MARGIN
+#define CONSDRV_FLOW_MARGIN 4 /* RTSを止めてから受信し得る文字数 */
+#endif
+#ifndef CONSDRV_RECV_LINES
+#define CONSDRV_RECV_LINES 3  /* 受信した行のバッファの数 */
+#endif
+#ifndef CONSDRV_RX_BURST_CHARS
+#define CONSDRV_RX_BURST_CHARS 2 /* 受信の間隔がこの文字数の時間未満ならバーストとみなす（0でまとめない） */
+#endif
+#ifndef CONSDRV_RX_BATCH
+#define CONSDRV_RX_BATCH 8    /* 1回の受信割り込みで処理する最大の文字数 */
+#endif
+#ifndef CONSDRV_RECV_RING_SIZE
+#define CONSDRV_RECV_RING_SIZE 16 /* 行モードでスレッドに渡す前の受信文字（2の累乗） */
+#endif
+
+/* 外部端子割り込みのドライバ(KZ_IRQDRV) */
+#ifndef IRQDRV_BENCH_IRQ
+#define IRQDRV_BENCH_IRQ 0    /* ベンチマークで割り込みを起こす端子（チップセレクトでないIRQ0(P80)） */
+#endif
+
+/*
+ * I2C/SPIのバスドライバ(KZ_BUSDRV)
+ * 端子はポートBのビット番号。SPIのCSは BUSDRV_SPI_CS から BUSDRV_SPI_CS_NUM 本。
+ * 半周期はタイマのカウント数(0.4マイクロ秒)で、kz_gettime() の呼び出しの
+ * 時間が加わるので、実際のクロックはこれより遅くなる。
+ */
+#ifndef BUSDRV_PRIORITY
+#define BUSDRV_PRIORITY 12   /* ドライバのスレッドの優先度（アプリケーションより低くする） */
+#endif
+#ifndef BUSDRV_I2C_SCL
+#define BUSDRV_I2C_SCL 0
+#endif
+#ifndef BUSDRV_I2C_SDA
+#define BUSDRV_I2C_SDA 1
+#endif
+#ifndef BUSDRV_I2C_HALF
+#define BUSDRV_I2C_HALF 13   /* SCLの半周期（100kHz以下） */
+#endif
+#ifndef BUSDRV_I2C_STRETCH
+#define BUSDRV_I2C_STRETCH 2500 /* スレーブのクロックストレッチを待つ最大の時間 */
+#endif
+#ifndef BUSDRV_SPI_SCK
+#define BUSDRV_SPI_SCK 2
+#endif
+#ifndef BUSDRV_SPI_MOSI
+#define BUSDRV_SPI_MOSI 3
+#endif
+#ifndef BUSDRV_SPI_MISO
+#define BUSDRV_SPI_MISO 4
+#endif
+#ifndef BUSDRV_SPI_CS
+#define BUSDRV_SPI_CS 5
+#endif
+#ifndef BUSDRV_SPI_CS_NUM
+#define BUSDRV_SPI_CS_NUM 2
+#endif
+#ifndef BUSDRV_SPI_HALF
+#define BUSDRV_SPI_HALF 0    /* SCKの半周期（0ならば待たずに最速で動かす） */
+#endif
+
+/* GDBのリモートスタブ(KZ_GDBSTUB) */
+#ifndef GDBSTUB_SCI
+#define GDBSTUB_SCI 0            /* 使うSCI（コンソールと別のもの） */
+#endif
+#ifndef GDBSTUB_BAUD
+#define GDBSTUB_BAUD 57600       /* ボーレート（serial_set_baud() の表にあるもの） */
+#endif
+#ifndef GDBSTUB_PACKET_SIZE
+#define GDBSTUB_PACKET_SIZE 256  /* パケットの最大長（m で一度に読めるのは半分） */
+#endif
+
+/* ネットワークのパケットのバッファ(KZ_NETDRV, netbuf.h。外部DRAMに獲得する) */
+#ifndef NETBUF_NUM
+#define NETBUF_NUM 8          /* バッファの数（受信・送信で共用） */
+#endif
+#ifndef NETBUF_DATA_SIZE
+#define NETBUF_DATA_SIZE 1536 /* バッファの大きさ（最大のフレーム長以上） */
+#endif
+
+/* プロトコルスタック(KZ_NET, アドレスは NET_ADDR() で指定する) */
+#ifndef NET_IPADDR
+#define NET_IPADDR NET_ADDR(192, 168, 0, 10)
+#endif
+#ifndef NET_IP_TTL
+#define NET_IP_TTL 64
+#endif
+#ifndef NET_ARP_NUM
+#define NET_ARP_NUM 4      /* ARPの表の大きさ */
+#endif
+#ifndef NET_ARP_RETRY
+#define NET_ARP_RETRY 3    /* ARPの応答を待って送り直す回数(net_udp_sendto()) */
+#endif
+#ifndef NET_UDP_PORT_NUM
+#define NET_UDP_PORT_NUM 4 /* 受信を登録できるUDPのポートの数 */
+#endif
+
+#endif
@@ -16,4 +16,25 @@ int gets(unsigned char *buf);
 
 int putxval(unsigned long value, int column);
 
+/* 可変長引数（-nostdinc なので、GCCの組み込み関数を直接使う） */
+typedef __builtin_va_list va_list;
+#define va_start(ap, last) __builtin_va_start(ap, last)
+#define va_arg(ap, type)   __builtin_va_arg(ap, type)
+#define va_end(ap)         __builtin_va_end(ap)
+
+/* 書式付きの文字列の作成（format.c, %d %u %x %s %c と幅・'0'・'-' のみ） */
+int vsnprintf(char *buf, int size, const char *fmt, va_list ap);
+int snprintf(char *buf, int size, const char *fmt, ...);
+
+/* 数値の変換（format.c, buf 中の先頭の桁へのポインタを返す。除算を使わない） */
+/* unsigned long の16進数の最大桁数+1（H8では9。ホストの64ビットでは17） */
+#define FORMAT_HEX_SIZE ((int)sizeof(unsigned long) * 2 + 1)
+#define FORMAT_DEC_SIZE 11 /* 32ビットの10進数の最大桁数+1 */
+char *format_hex(char *buf, unsigned long value, int digits);
+char *format_dec(char *buf, unsigned long value);
+
+#ifdef KZ_ROMLIB
+int romlib_check(void);
+#endif
+
 #endif
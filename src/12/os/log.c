@@ -0,0 +1,181 @@
+#include "defines.h"
+#include "kozos.h"
+#include "interrupt.h"
+#include "consdrv.h"
+#include "lib.h"
+#include "log.h"
+
+/*
+ * 非同期のログ（log.h を参照）
+ * 記録はカーネルのリングバッファ(kz_ring_*())に書き込み、LOG_WAKE_SIZE
+ * バイトたまるか、他に動作するスレッドがなくなったときにロガースレッドが
+ * 起こされる。記録は途中で切れないように、空きが足りなければ丸ごと捨てて
+ * 数を数えておき、ロガースレッドがその数を出力する。
+ */
+
+#if LOG_RING_SIZE & (LOG_RING_SIZE - 1)
+#error "LOG_RING_SIZE must be a power of 2"
+#endif
+
+#define LOG_CONSOLE 0        /* 出力するコンソールの番号 */
+#define LOG_LINE_SIZE 32     /* まとめてコンソールドライバに渡す大きさ(CONSDRV_BULK_SIZE の半分) */
+
+static char log_buf[LOG_RING_SIZE];
+static kz_ring_id_t log_ring = -1; /* ロガースレッドが作成するまでは捨てる */
+static uint32 log_drops;           /* 捨てた記録の数 */
+
+/*
+ * ログの記録（スレッド・割り込みハンドラ・カーネルの内部から呼べる）
+ * 書き込む側が複数になるので、全ての割り込みをマスクして書き込む。
+ * スレッドから呼んだ場合、ロガースレッドを起こしてもディスパッチは
+ * 次の割り込みかシステムコールまで遅れる（ロガーは優先度が低いので問題ない）。
+ */
+void kz_log(const char *fmt, uint32 arg1, uint32 arg2, const char *str)
+{
+  kz_logrec_t rec;
+  int i, ceiling;
+
+  rec.fmt = fmt;
+  rec.args[0] = arg1;
+  rec.args[1] = arg2;
+  for (i = 0; i < LOG_STR_SIZE; i++)
+    rec.str[i] = (str && *str) ? *(str++) : '\0';
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  if ((log_ring >= 0) && (kz_ring_space(log_ring) >= (int)sizeof(rec)))
+    kx_ring_put(log_ring, (char *)&rec, sizeof(rec));
+  else
+    log_drops++;
+  kz_unlock_ceiling(ceiling);
+}
+
+/*
+ * 捨てた記録の数（起動時からの通算）
+ * 32ビットの読み出しは H8 では1命令で済まないので、kz_log() と同じく
+ * 割り込みをマスクして読む
+ */
+uint32 kz_log_dropped(void)
+{
+  uint32 n;
+  int ceiling;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  n = log_drops;
+  kz_unlock_ceiling(ceiling);
+
+  return n;
+}
+
+/* ロガースレッドの出力のバッファ */
+static struct {
+  char buf[LOG_LINE_SIZE];
+  int len;
+} out;
+
+/* 貯めた出力をコンソールドライバに渡す（送信バッファに書き込まれるまで待つ） */
+static void log_flush(void)
+{
+  consdrv_req_t req;
+
+  if (!out.len)
+    return;
+  req.index = LOG_CONSOLE;
+  req.command = CONSDRV_CMD_WRITE;
+  req.flags = CONSDRV_REQ_FLAG_CALL | CONSDRV_REQ_FLAG_BULK;
+  req.dummy = 0;
+  req.size = out.len;
+  req.data = out.buf;
+  req.flag = 0;
+  req.pattern = 0;
+  kz_call(MSGBOX_ID_CONSOUTPUT, sizeof(req), (char *)&req, NULL);
+  out.len = 0;
+}
+
+static void log_putc(char c)
+{
+  if (out.len == LOG_LINE_SIZE)
+    log_flush();
+  out.buf[out.len++] = c;
+}
+
+static void log_puts(const char *s)
+{
+  for (; *s; s++)
+    log_putc(*s);
+}
+
+/*
+ * 数値の出力（base は 10 か 16）
+ * libgcc の除算はリンクしないので、format.c の除算を使わない変換で行う
+ */
+static void log_putnum(uint32 value, int base)
+{
+  char buf[(FORMAT_HEX_SIZE > FORMAT_DEC_SIZE) ? FORMAT_HEX_SIZE : FORMAT_DEC_SIZE];
+
+  if (base == 16) {
+    log_puts(format_hex(buf, value, 1));
+    return;
+  }
+  if (value & 0x80000000) {
+    log_putc('-');
+    value = -value;
+  }
+  log_puts(format_dec(buf, value));
+}
+
+/* 記録の書式を展開して、出力のバッファに貯める */
+static void log_format(kz_logrec_t *rec)
+{
+  const char *p;
+  int arg = 0, i;
+
+  for (p = rec->fmt; *p; p++) {
+    if ((*p != '%') || !p[1]) {
+      log_putc(*p);
+      continue;
+    }
+    switch (*(++p)) {
+      case 's':
+        for (i = 0; (i < LOG_STR_SIZE) && rec->str[i]; i++)
+          log_putc(rec->str[i]);
+        break;
+      case 'x':
+      case 'd':
+        log_putnum((arg < 2) ? rec->args[arg] : 0, (*p == 'x') ? 16 : 10);
+        arg++;
+        break;
+      default:
+        log_putc(*p);
+        break;
+    }
+  }
+}
+
+/* ロガースレッド */
+int log_main(int argc, char *argv[])
+{
+  kz_logrec_t rec;
+  uint32 drops = 0, n;
+
+  log_ring = kz_ring_create(log_buf, LOG_RING_SIZE, LOG_WAKE_SIZE);
+  if (log_ring < 0)
+    return -1;
+
+  while (1) {
+    kz_ring_wait(log_ring);
+
+    while (kz_ring_get(log_ring, (char *)&rec, sizeof(rec)) == sizeof(rec))
+      log_format(&rec);
+
+    n = kz_log_dropped();
+    if (n != drops) {
+      log_putc('(');
+      log_putnum(n - drops, 10);
+      log_puts(" log records dropped)\n");
+      drops = n;
+    }
+    log_flush();
+  }
+
+  return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef _KOZOS_LOG_H_INCLUDED_
+#define _KOZOS_LOG_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * 非同期のログ（log.c, make LOG=1 で組み込む）
+ * kz_log() は書式の文字列のアドレスと引数をリングバッファに記録するだけで、
+ * 書式の展開とコンソールへの出力は優先度の低いロガースレッド(log_main)が
+ * 行う。シリアルの送信を待たないので、割り込みハンドラやカーネルの内部
+ * (割り込み禁止状態)からも呼べる。
+ * 出力はコンソールの大量出力用の送信バッファ(CONSDRV_REQ_FLAG_BULK)に書くので、
+ * コマンドの応答より後に送られ、溢れると古い行から捨てられる。
+ *
+ * 書式は後で展開するので、定数の文字列であること。使える変換は以下のみ。
+ *   %s  str（記録時に先頭の LOG_STR_SIZE 文字までをコピーする）
+ *   %x  次の数値の引数を16進数で
+ *   %d  次の数値の引数を符号付きの10進数で
+ *   %%  '%' そのもの
+ */
+
+/* リングバッファの大きさ LOG_RING_SIZE などは kozos_config.h で設定する */
+
+#define LOG_STR_SIZE 8
+
+/* ログの記録（リングバッファにそのまま書き込む） */
+typedef struct {
+  const char *fmt;         /* 書式 */
+  uint32 args[2];          /* 数値の引数 */
+  char str[LOG_STR_SIZE];  /* 文字列の引数（終端の'\0'はなくてもよい） */
+} kz_logrec_t;
+
+#ifdef KZ_LOG
+void kz_log(const char *fmt, uint32 arg1, uint32 arg2, const char *str);
+uint32 kz_log_dropped(void);
+#endif
+
+#endif
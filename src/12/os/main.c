@@ -2,33 +2,93 @@
 #include "kozos.h"
 #include "interrupt.h"
 #include "lib.h"
+#include "overlay.h"
+#include "stacksize.h"
+
+/*
+ * 追加のコンソールのコマンドスレッドの引数（コンソールの番号, シリアルの番号）
+ * コンソール0は SERIAL_DEFAULT_DEVICE を使う
+ */
+#ifdef KZ_CONSOLE_SCI0
+static char *command1_argv[] = { "command1", "1", "0", NULL };
+#endif
+#ifdef KZ_CONSOLE_SCI2
+static char *command2_argv[] = { "command2", "2", "2", NULL };
+#endif
+
+/*
+ * 割り込みの遅延処理スレッド（常に組み込むので、静的に定義して kz_start() で起動する）
+ * 他のシステムタスクより先に動作し、終了しない（defer.c を参照）
+ */
+KZ_THREAD_DEFINE(defer, defer_main, "defer", 1 | KZ_THREAD_ATTR_KERNEL,
+                 STACKSIZE_DEFER, 0, NULL);
 
 /* システムタスクとユーザタスクの起動 */
 static int start_threads(int argc, char *argv[])
 {
-  kz_run(consdrv_main, "consdrv", 1, 0x200, 0, NULL);
-  kz_run(command_main, "command", 8, 0x200, 0, NULL);
+  kz_overlay_init();
+  kz_run(consdrv_main, "consdrv", 1 | KZ_THREAD_ATTR_KERNEL,
+         STACKSIZE_CONSDRV, 0, NULL);
+#ifdef KZ_NETDRV
+  kz_run(netdrv_main, "netdrv", 1 | KZ_THREAD_ATTR_KERNEL,
+         STACKSIZE_NETDRV, 0, NULL);
+#endif
+#ifdef KZ_NET
+  kz_run(net_main, "net", 2 | KZ_THREAD_ATTR_KERNEL, STACKSIZE_NET, 0, NULL);
+#endif
+#ifdef KZ_ADC
+  kz_run(adcdrv_main, "adcdrv", 1 | KZ_THREAD_ATTR_KERNEL,
+         STACKSIZE_ADCDRV, 0, NULL);
+#endif
+#ifdef KZ_BUSDRV
+  kz_run(busdrv_main, "busdrv", BUSDRV_PRIORITY, STACKSIZE_BUSDRV, 0, NULL);
+#endif
+  kz_run(command_main, "command", 8 | KZ_THREAD_ATTR_DRAM,
+         STACKSIZE_COMMAND, 0, NULL);
+#ifdef KZ_LOG
+  kz_run(log_main, "log", 14 | KZ_THREAD_ATTR_DRAM, STACKSIZE_LOG, 0, NULL);
+#endif
+#ifdef KZ_GDBSTUB
+  kz_run(gdbstub_main, "gdbstub", 14, STACKSIZE_GDBSTUB, 0, NULL);
+#endif
+#ifdef KZ_CONSOLE_SCI0
+  kz_run(command_main, "command1", 8 | KZ_THREAD_ATTR_DRAM,
+         STACKSIZE_COMMAND, 3, command1_argv);
+#endif
+#ifdef KZ_CONSOLE_SCI2
+  kz_run(command_main, "command2", 8 | KZ_THREAD_ATTR_DRAM,
+         STACKSIZE_COMMAND, 3, command2_argv);
+#endif
+#ifdef KZ_BENCH
+  kz_run(bench_main, "bench", 3, STACKSIZE_BENCH, 0, NULL);
+#endif
 
   /* 優先順位を下げて、アイドルスレッドに移行する */
   kz_chpri(15);
   /* 割り込み有効にする */
   INTR_ENABLE;
-  /* 省電力モードに移行 */
+  /* 省電力モードに移行（次のタイマ待ちまでは不要なタイマ割り込みを止める） */
   while (1) {
-    asm volatile ("sleep");
+    kz_idle();
   }
 
   return 0;
 }
 
-int main(void)
+KZ_COLD int main(void)
 {
   INTR_DISABLE;
 
+#ifdef KZ_ROMLIB
+  if (romlib_check() < 0)
+    return 0;
+#endif
+
   puts("kozos boot succeed!\n");
 
   /* OS の動作開始 */
-  kz_start(start_threads, "idle", 0, 0x100, 0, NULL);
+  kz_start(start_threads, "idle",
+           0 | KZ_THREAD_ATTR_INTRMASK | KZ_THREAD_ATTR_KERNEL, 0x100, 0, NULL);
   /* ここには戻ってこない */
 
   return 0;
@@ -0,0 +1,14 @@
+/*
+ * メモリプールの構成（ブロックサイズと個数）
+ * ボードや製品ごとにメッセージのサイズの分布が異なるので、
+ * 別のファイルを用意して -DMEMORY_CONFIG=\"ファイル名\" で差し替えられる。
+ *
+ * ・MEMORY_POOL(ブロックサイズ, 個数) の形式で、ブロックサイズの昇順に並べること
+ * ・ブロックサイズは4の倍数とすること（同じサイズは不可）
+ *   (ブロックはヘッダを持たないので、ブロックサイズがそのまま獲得できるサイズになる)
+ * ・合計(ブロックサイズ×個数)が _end から userstack までに収まらない場合は
+ *   リンク時にエラーとなる(ld.scr)
+ */
+MEMORY_POOL(16, 8)
+MEMORY_POOL(32, 8)
+MEMORY_POOL(64, 4)
@@ -2,14 +2,17 @@
 #include "kozos.h"
 #include "lib.h"
 #include "memory.h"
+#include "trace.h"
+#include "queue.h"
 
 /*
- * メモリブロック構造体（ヘッダ情報）
- * （獲得された各領域は、先頭に以下の構造体を持っている）
+ * メモリブロック構造体
+ * 解放済みリンクリストにつなぐためのもので、解放済みの領域の先頭にのみ置く。
+ * 獲得された領域にはヘッダを持たず、ブロック全体を利用できる
+ * （解放時には、アドレスの範囲から所属するメモリプールを求める）。
  */
 typedef struct _kzmem_block {
   struct _kzmem_block *next;
-  int size;
 } kzmem_block;
 
 /*
@@ -20,111 +23,390 @@ typedef struct _kzmem_pool {
   int size;
   int num;
   kzmem_block *free;
+  kzmem_block *reserve; /* 割り込み処理用に取り置いたブロック */
+  int reserve_num;
+  char *end; /* 領域の終端（先頭は直前のメモリプールの終端） */
+#ifdef KZ_KMALLOC_DEBUG
+  char *start; /* 領域の先頭 */
+  int first;   /* 先頭のブロックの全体での番号(kzmem_debug) */
+#endif
+  /* 使用状況（kz_memstat()で取得する） */
+  int used;
+  int peak;
+  int fails;
 } kzmem_pool;
 
+/*
+ * 割り込み処理(kx_kmalloc())用に各メモリプールで取り置くブロック数
+ * スレッドからの獲得では取り置きを使わないので、スレッドがメモリプールを
+ * 使い切っていても、割り込み処理では取り置きの分は獲得できる。
+ * 取り置きは解放されたブロックで補充する。
+ */
+#ifndef MEMORY_ISR_RESERVE
+#define MEMORY_ISR_RESERVE 0
+#endif
+
+/* メモリプールの構成を定義したファイル(memconf.h を参照) */
+#ifndef MEMORY_CONFIG
+#define MEMORY_CONFIG "memconf.h"
+#endif
+
 /*
  * メモリプールの定義（個々のサイズと個数）
- * 16byte, 32byte, 64byte 3種類のメモリプールを定義
  */
-static kzmem_pool pool[] = {
-  {16, 8, NULL},
-  {32, 8, NULL},
-  {64, 4, NULL},
+typedef KZ_TABLE_ELEMENT(kzmem_pool) kzmem_pool_elem;
+static kzmem_pool_elem pool[] = {
+#ifdef KZ_KMALLOC_DEBUG
+#define MEMORY_POOL(size, num) { { size, num, NULL, NULL, 0, NULL, NULL, 0, 0, 0, 0 } },
+#else
+#define MEMORY_POOL(size, num) { { size, num, NULL, NULL, 0, NULL, 0, 0, 0 } },
+#endif
+#include MEMORY_CONFIG
+#undef MEMORY_POOL
 };
+#define POOL(index) (&pool[index].e)
+KZ_TABLE_ASSERT(kzmem_pool_elem, pool_elem);
 
 #define MEMORY_AREA_NUM (sizeof(pool) / sizeof(*pool))
 
+/*
+ * 構成からコンパイル時にサイズを求めるための型
+ * (共用体のサイズは最大のブロックサイズ、構造体のサイズは全プールの合計になる)
+ */
+typedef union {
+#define MEMORY_POOL(size, num) char block##size[size];
+#include MEMORY_CONFIG
+#undef MEMORY_POOL
+} kzmem_block_max;
+
+typedef struct {
+#define MEMORY_POOL(size, num) char pool##size[(size) * (num)];
+#include MEMORY_CONFIG
+#undef MEMORY_POOL
+} kzmem_area_total;
+
+/* 獲得できる最大のサイズ */
+#define MEMORY_ALLOC_MAX (sizeof(kzmem_block_max))
+
+/*
+ * メモリプールの領域
+ * リンカスクリプトで _end の後ろ(.freearea)に配置され、
+ * userstack にはみ出る場合はリンク時にエラーとなる
+ */
+static char kzmem_area[sizeof(kzmem_area_total)]
+  __attribute__((section(".bss.freearea"), aligned(4)));
+
+#ifdef KZ_KMALLOC_DEBUG
+/*
+ * 獲得・解放の検査(KZ_KMALLOC_DEBUG)
+ * ・ブロックごとに獲得中かどうかと、最後に獲得したスレッドを記録し、
+ *   獲得していないブロックの解放（二重解放）やブロックの途中を指す
+ *   ポインタの解放を検出する
+ * ・解放したブロックは(リンクの後ろを) MEMORY_POISON_FREE で埋め、
+ *   獲得時に書き換えられていれば解放後の書き込みとして検出する。
+ *   獲得したブロックは MEMORY_POISON_ALLOC で埋めて、初期化忘れを
+ *   目立たせる
+ * いずれも検出したらブロックと所有者を表示してシステムを停止する。
+ * 獲得・解放ごとにブロック全体を埋めて調べるので、デバッグ時のみ使う。
+ */
+#define MEMORY_POISON_FREE  0xdd
+#define MEMORY_POISON_ALLOC 0xcd
+
+/* 全プールのブロック数の合計（構造体のサイズで求める） */
+typedef struct {
+#define MEMORY_POOL(size, num) char blocks##size[num];
+#include MEMORY_CONFIG
+#undef MEMORY_POOL
+} kzmem_block_total;
+
+#define MEMORY_BLOCK_NUM (sizeof(kzmem_block_total))
+
+static struct {
+  kz_thread_id_t owner; /* 最後に獲得したスレッド(KZ_THREAD_ID_INTR は割り込み) */
+  uint8 used;           /* 獲得中 */
+} kzmem_debug[MEMORY_BLOCK_NUM];
+#endif
+
+/*
+ * 要求サイズからメモリプールの番号を引く表（kzmem_init()で作成する）
+ * 獲得のたびにプールを順に調べなくてすむようにする
+ */
+static uint8 size_to_pool[MEMORY_ALLOC_MAX + 1];
 
 /* メモリプールの初期化 */
-static int kzmem_init_pool(kzmem_pool *p)
+static KZ_COLD int kzmem_init_pool(int index)
 {
+  kzmem_pool *p = POOL(index);
   int i;
   kzmem_block *mp;
   kzmem_block **mpp;
 
-  /* リンカスクリプトで定義される空き領域 */
-  extern char freearea;
-  static char *area = &freearea;
+  static char *area = kzmem_area;
 
   mp = (kzmem_block *)area;
+#ifdef KZ_KMALLOC_DEBUG
+  {
+    static int first = 0;
+    p->start = area;
+    p->first = first;
+    first += p->num;
+    memset(area, MEMORY_POISON_FREE, p->size * p->num);
+  }
+#endif
 
   /* 個々の領域をすべて解放済みリンクリストにつなぐ */
   mpp = &p->free;
   for (i = 0; i < p->num; i++) {
     *mpp = mp;
-    memset(mp, 0, sizeof(*mp));
-    mp->size = p->size;
     mpp = &(mp->next);
     mp = (kzmem_block *)((char *)mp + p->size);
     area += p->size;
   }
+  *mpp = NULL;
+  p->end = area;
+
+  /* 先頭から割り込み処理用の取り置きに移す */
+  while (p->free && (p->reserve_num < MEMORY_ISR_RESERVE)) {
+    mp = p->free;
+    KZ_LIST_POP(p->free, next);
+    KZ_LIST_PUSH(p->reserve, mp, next);
+    p->reserve_num++;
+  }
 
   return 0;
 }
 
 /* 動的メモリの初期化 */
-int kzmem_init(void)
+KZ_COLD int kzmem_init(void)
 {
-  int i;
+  int i, size;
   for (i = 0; i < MEMORY_AREA_NUM; i++) {
     /* 各メモリプールを初期化する */
-    kzmem_init_pool(&pool[i]);
+    kzmem_init_pool(i);
+  }
+
+  /* 各サイズを格納できる最小のメモリプールを求めておく */
+  i = 0;
+  for (size = 0; size <= MEMORY_ALLOC_MAX; size++) {
+    while (size > POOL(i)->size)
+      i++;
+    size_to_pool[size] = i;
   }
   return 0;
 }
 
-/* 動的メモリの獲得 */
-void *kzmem_alloc(int size)
+/*
+ * 獲得できない場合の処理
+ * KZ_KMALLOC_NULL が指定されていれば、システムを停止せずに NULL を返し、
+ * 呼び出し側で処理を取りやめる（負荷が集中した場合に要求を捨てる）
+ */
+static void *kzmem_fail(kzmem_pool *p)
+{
+  p->fails++;
+#ifndef KZ_KMALLOC_NULL
+  kz_sysdown();
+#endif
+  return NULL;
+}
+
+#ifdef KZ_KMALLOC_DEBUG
+/* 検査で異常を見つけたときの表示と停止 */
+static void kzmem_debug_fail(char *msg, void *mem, int index)
+{
+  puts("KMALLOC: ");
+  puts(msg);
+  puts(" block ");
+  putxval((unsigned long)mem, 0);
+  if (index >= 0) {
+    puts(" owner ");
+    putxval(kzmem_debug[index].owner, 0);
+  }
+  puts("\n");
+  kz_sysdown();
+}
+
+/*
+ * ブロックの全体での番号を求める（ブロックの先頭でなければ -1）
+ * 除算を避けて先頭から順に数える（デバッグ時のみなので遅くてよい）
+ */
+static int kzmem_debug_index(kzmem_pool *p, void *mem)
+{
+  char *q;
+  int index = p->first;
+
+  for (q = p->start; q < (char *)mem; q += p->size)
+    index++;
+  return (q == (char *)mem) ? index : -1;
+}
+
+/* 獲得時の検査（解放後の書き込みがないこと）と記録 */
+static void kzmem_debug_alloc(kzmem_pool *p, kzmem_block *mp, int isr)
+{
+  unsigned char *q = (unsigned char *)(mp + 1);
+  int index = kzmem_debug_index(p, mp);
+
+  for (; q < (unsigned char *)mp + p->size; q++) {
+    if (*q != MEMORY_POISON_FREE)
+      kzmem_debug_fail("write after free", mp, index);
+  }
+  memset(mp, MEMORY_POISON_ALLOC, p->size);
+  kzmem_debug[index].owner = isr ? KZ_THREAD_ID_INTR : kz_getid();
+  kzmem_debug[index].used = 1;
+}
+
+/* 解放時の検査（獲得中のブロックの先頭であること） */
+static void kzmem_debug_free(kzmem_pool *p, kzmem_block *mp)
+{
+  int index = kzmem_debug_index(p, mp);
+
+  if (index < 0)
+    kzmem_debug_fail("bad pointer", mp, -1);
+  if (!kzmem_debug[index].used)
+    kzmem_debug_fail("double free", mp, index);
+  kzmem_debug[index].used = 0;
+  memset(mp, MEMORY_POISON_FREE, p->size);
+}
+#endif
+
+/*
+ * 動的メモリの獲得
+ * メモリプールの操作は、スレッドからはシステムコール、割り込み処理からは
+ * サービスコールの延長で、いずれも全ての割り込みを禁止した状態で行われる
+ * (kz_srvcall() は多重割り込みを受け付けている場合も禁止してから呼ぶ)ので、
+ * 操作中に割り込まれることはない。
+ */
+static void *kzmem_get(int size, int isr)
 {
-  int i;
   kzmem_block *mp;
   kzmem_pool *p;
 
-  for (i = 0; i < MEMORY_AREA_NUM; i++) {
-    p = &pool[i];
-    if (size <= p->size - sizeof(kzmem_block)) {
-      /* 解放済み領域がない（メモリブロック不足） */
-      if (p->free == NULL) {
-        kz_sysdown();
-        return NULL;
-      }
-      /* 解放済みリンクリストから領域を取得する */
-      mp = p->free;
-      p->free = p->free->next;
-      mp->next = NULL;
-
-      /*
-       * 実際に利用可能な領域は
-       * メモリブロック構造体の直後の領域になるので直後のアドレスを返す
-       */
-      return mp + 1;
-    }
+  /*
+   * 指定されたサイズの領域を格納できるメモリプールがない
+   * (失敗の回数は最大のメモリプールに数える)
+   */
+  if ((unsigned int)size > MEMORY_ALLOC_MAX)
+    return kzmem_fail(POOL(MEMORY_AREA_NUM - 1));
+
+  p = POOL(size_to_pool[size]);
+
+  if (isr && p->reserve) {
+    /* 割り込み処理からは、取り置きがあれば先に使う */
+    mp = p->reserve;
+    KZ_LIST_POP(p->reserve, next);
+    p->reserve_num--;
+  } else {
+    /* 解放済み領域がない（メモリブロック不足） */
+    if (p->free == NULL)
+      return kzmem_fail(p);
+    /* 解放済みリンクリストから領域を取得する */
+    mp = p->free;
+    KZ_LIST_POP(p->free, next);
   }
+#ifdef KZ_KMALLOC_DEBUG
+  kzmem_debug_alloc(p, mp, isr);
+#endif
+  mp->next = NULL;
 
-  /* 指定されたサイズの領域を格納できるメモリプールがない */
-  kz_sysdown();
-  return NULL;
+  if (++p->used > p->peak)
+    p->peak = p->used;
+
+  KZ_TRACE_EVENT(KZ_TRACE_KMALLOC, 0, size);
+
+  /* ヘッダは持たないので、ブロックの先頭をそのまま返す */
+  return mp;
+}
+
+/* 動的メモリの獲得（スレッドから） */
+void *kzmem_alloc(int size)
+{
+  return kzmem_get(size, 0);
+}
+
+/* 動的メモリの獲得（割り込み処理から、取り置きを使える） */
+void *kzmem_alloc_isr(int size)
+{
+  return kzmem_get(size, 1);
 }
 
 /* メモリの解放 */
 void kzmem_free(void *mem)
 {
-  int i;
-  kzmem_block *mp;
+  kzmem_block *mp = mem;
   kzmem_pool *p;
+  int i;
 
-  /* 領域の直前にある（はずの）メモリブロック構造体を取得 */
-  mp = ((kzmem_block *)mem - 1);
+  /* 獲得した領域ではない */
+  if ((char *)mem < kzmem_area) {
+    kz_sysdown();
+    return;
+  }
 
-  for (i = 0; i < MEMORY_AREA_NUM; i++) {
-    p = &pool[i];
-    /* 領域を解放済みリンクリストに戻す */
-    if (mp->size == p->size) {
-      mp->next = p->free;
-      p->free = mp;
+  /*
+   * 各メモリプールは kzmem_area から順に切り出されているので、
+   * アドレスの範囲から所属するメモリプールを求める
+   */
+  for (i = 0; (char *)mem >= POOL(i)->end; i++) {
+    if (i == MEMORY_AREA_NUM - 1) {
+      kz_sysdown();
       return;
     }
   }
+  p = POOL(i);
 
-  kz_sysdown();
+  /*
+   * 領域を所属するメモリプールの解放済みリンクリストに戻す
+   * (割り込み処理用の取り置きが減っていれば、取り置きを補充する)
+   */
+#ifdef KZ_KMALLOC_DEBUG
+  kzmem_debug_free(p, mp);
+#endif
+  KZ_TRACE_EVENT(KZ_TRACE_KMFREE, 0, p->size);
+  if (p->reserve_num < MEMORY_ISR_RESERVE) {
+    KZ_LIST_PUSH(p->reserve, mp, next);
+    p->reserve_num++;
+  } else {
+    KZ_LIST_PUSH(p->free, mp, next);
+  }
+  p->used--;
+}
+
+/*
+ * 獲得したブロックの先頭かの確認（正しければ0）
+ * ブロックサイズは2の累乗とは限らないので、除算を使わずにメモリプールの
+ * 先頭からブロックサイズずつ進めて調べる（ブロック数に比例した時間がかかる）
+ */
+int kzmem_check(void *mem)
+{
+  char *p = mem, *start = kzmem_area;
+  int i;
+
+  if (p < kzmem_area)
+    return KZ_ERR_PARAM;
+  for (i = 0; p >= POOL(i)->end; i++) {
+    if (i == MEMORY_AREA_NUM - 1)
+      return KZ_ERR_PARAM;
+    start = POOL(i)->end;
+  }
+  while (start < p)
+    start += POOL(i)->size;
+
+  return (start == p) ? 0 : KZ_ERR_PARAM;
+}
+
+/* メモリプールの使用状況の取得 */
+int kzmem_stat(int index, kz_memstat_t *statp)
+{
+  kzmem_pool *p;
+
+  if ((unsigned int)index >= MEMORY_AREA_NUM)
+    return KZ_ERR_PARAM;
+
+  p = POOL(index);
+  statp->size  = p->size;
+  statp->num   = p->num;
+  statp->used  = p->used;
+  statp->peak  = p->peak;
+  statp->fails = p->fails;
+
+  return 0;
 }
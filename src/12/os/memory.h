@@ -3,6 +3,9 @@
 
 int kzmem_init(void);        /* 動的メモリの初期化 */
 void *kzmem_alloc(int size); /* 動的メモリの獲得 */
+void *kzmem_alloc_isr(int size); /* 動的メモリの獲得（割り込み処理から） */
 void kzmem_free(void *mem);  /* メモリの開放 */
+int kzmem_check(void *mem);  /* 獲得したブロックの先頭かの確認 */
+int kzmem_stat(int index, kz_memstat_t *statp); /* 使用状況の取得 */
 
 #endif
@@ -0,0 +1,571 @@
+#include "defines.h"
+#include "kozos.h"
+#include "lib.h"
+#include "cksum.h"
+#include "netbuf.h"
+#include "netdrv.h"
+#include "net.h"
+
+/*
+ * ARP/IPv4/ICMP/UDP の最小限のプロトコルスタック（make NET=1 で組み込む）
+ * 1つのスレッド(net_main)で全ての層を処理し、イーサネットドライバから
+ * 受け取ったフレームと、アプリケーションからの要求(MSGBOX_ID_NETSTACK)を
+ * kz_recv_any() で待つ。パケットのバッファ(netbuf.h)はどの層でもコピーせず、
+ * ポインタのまま受け渡す（ヘッダは netbuf_pull()/netbuf_push() で付け外す）。
+ * ・ARPは自分宛ての要求に応答し、応答と要求の送信元を表に覚える。
+ * ・ICMPはエコー要求(ping)にのみ、受信したバッファをそのまま使って応答する。
+ * ・UDPは net_udp_bind() で登録したポート宛てのものをアプリケーションに渡す。
+ * ・ルーティングはしない（宛先は同じネットワーク上にあるものとする）。
+ *   IPのフラグメントは捨て、送信時は分割しない。
+ */
+
+#define ETH_HDR_SIZE  14
+#define ETH_TYPE_IP   0x0800
+#define ETH_TYPE_ARP  0x0806
+
+#define ARP_SIZE       28
+#define ARP_HTYPE_ETH  1
+#define ARP_OP_REQUEST 1
+#define ARP_OP_REPLY   2
+
+#define IP_HDR_SIZE   20
+#define IP_PROTO_ICMP 1
+#define IP_PROTO_UDP  17
+#define IP_FLAG_DF    0x4000
+#define IP_FRAG_MASK  0x3fff /* MFビットとフラグメントオフセット */
+
+#define ICMP_ECHO_REPLY   0
+#define ICMP_ECHO_REQUEST 8
+
+#define UDP_HDR_SIZE  8
+
+/* アプリケーションからの要求(MSGBOX_ID_NETSTACK に kz_call() で送る) */
+#define NET_CMD_BIND   'b'
+#define NET_CMD_SENDTO 's'
+
+typedef struct {
+  uint8 command;   /* NET_CMD_* */
+  uint8 dummy;
+  uint16 port;     /* BIND: 受信するポート, SENDTO: 送信元のポート */
+  uint16 dst_port; /* SENDTO: 宛先のポート */
+  int box;         /* BIND: 受信したデータグラムを渡すメッセージボックス */
+  uint32 dst_addr; /* SENDTO: 宛先のIPアドレス */
+  netbuf_t *nb;    /* SENDTO: データのバッファ */
+  int result;      /* 処理の結果(0 か NET_ERR_*) */
+} net_req_t;
+
+static const unsigned char eth_broadcast[6] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static struct {
+  unsigned char macaddr[6];
+  uint32 ipaddr;
+  kz_msgbox_id_t frame_box; /* イーサネットドライバから受信したフレームを受け取る */
+  uint16 ip_id;
+
+  struct netarp {
+    uint32 ipaddr;          /* 0なら未使用 */
+    unsigned char macaddr[6];
+  } arp[NET_ARP_NUM];
+  int arp_next;             /* 表が一杯のときに置き換える位置 */
+
+  struct netport {
+    uint16 port;            /* 0なら未使用 */
+    kz_msgbox_id_t box;
+  } ports[NET_UDP_PORT_NUM];
+} net;
+
+/*
+ * ヘッダの読み書き（ネットワークバイトオーダー）
+ * IPのオプションの長さによっては半端な位置になるので、バイト単位でアクセスする
+ */
+static uint16 get16(unsigned char *p)
+{
+  return ((uint16)p[0] << 8) | p[1];
+}
+
+static void put16(unsigned char *p, uint16 val)
+{
+  p[0] = val >> 8;
+  p[1] = val & 0xff;
+}
+
+static uint32 get32(unsigned char *p)
+{
+  return ((uint32)get16(p) << 16) | get16(p + 2);
+}
+
+static void put32(unsigned char *p, uint32 val)
+{
+  put16(p, val >> 16);
+  put16(p + 2, val & 0xffff);
+}
+
+/*
+ * つながったバッファを含めたパケットの部分和
+ * 奇数バイト目から始まるバッファの部分和は、上位と下位のバイトを入れ替えて加える
+ */
+static uint32 cksum_netbuf(uint32 sum, netbuf_t *nb)
+{
+  uint32 s;
+  int odd = 0;
+
+  for (; nb; nb = nb->next) {
+    s = cksum_inet(0, netbuf_data(nb), nb->len);
+    if (odd) {
+      s = (s & 0xffff) + (s >> 16);
+      s = (s & 0xffff) + (s >> 16);
+      s = ((s << 8) | (s >> 8)) & 0xffff;
+    }
+    sum += s;
+    if (nb->len & 1)
+      odd = !odd;
+  }
+  return sum;
+}
+
+/* UDPの疑似ヘッダの部分和 */
+static uint32 cksum_pseudo(uint32 src, uint32 dst, int len)
+{
+  uint32 sum;
+
+  sum = (src >> 16) + (src & 0xffff) + (dst >> 16) + (dst & 0xffff);
+  sum += IP_PROTO_UDP;
+  sum += len;
+  return sum;
+}
+
+/* イーサネットドライバへの要求（データを参照させるので返信を待つ） */
+static void netdrv_call(uint8 command, char *data, int size)
+{
+  netdrv_req_t req;
+
+  req.command = command;
+  req.flags = NETDRV_REQ_FLAG_CALL;
+  req.size = size;
+  req.data = data;
+  kz_call(MSGBOX_ID_NETOUTPUT, sizeof(req), (char *)&req, NULL);
+}
+
+/* Ethernetのヘッダを付けて送信する（バッファはドライバが送信後に解放する） */
+static void eth_output(netbuf_t *nb, const unsigned char *dst, uint16 type)
+{
+  unsigned char *frame;
+  netdrv_req_t *req;
+
+  frame = (unsigned char *)netbuf_push(nb, ETH_HDR_SIZE);
+  req = kz_kmalloc(sizeof(*req));
+  if ((frame == NULL) || (req == NULL)) {
+    if (req)
+      kz_kmfree(req);
+    netbuf_free(nb);
+    return;
+  }
+  memcpy(frame, dst, 6);
+  memcpy(frame + 6, net.macaddr, 6);
+  put16(frame + 12, type);
+
+  req->command = NETDRV_CMD_SEND;
+  req->flags = NETDRV_REQ_FLAG_NETBUF;
+  req->size = 0;
+  req->data = (char *)nb;
+  kz_send(MSGBOX_ID_NETOUTPUT, sizeof(*req), (char *)req);
+}
+
+static unsigned char *arp_lookup(uint32 ipaddr)
+{
+  int i;
+
+  for (i = 0; i < NET_ARP_NUM; i++) {
+    if (net.arp[i].ipaddr == ipaddr)
+      return net.arp[i].macaddr;
+  }
+  return NULL;
+}
+
+static void arp_update(uint32 ipaddr, unsigned char *macaddr)
+{
+  unsigned char *p;
+
+  if ((p = arp_lookup(ipaddr)) == NULL) {
+    net.arp[net.arp_next].ipaddr = ipaddr;
+    p = net.arp[net.arp_next].macaddr;
+    if (++net.arp_next == NET_ARP_NUM)
+      net.arp_next = 0;
+  }
+  memcpy(p, macaddr, 6);
+}
+
+/* ARPのパケットの作成（送信元は自分） */
+static void arp_fill(unsigned char *arp, uint16 op,
+                     unsigned char *target_mac, uint32 target_ip)
+{
+  put16(arp, ARP_HTYPE_ETH);
+  put16(arp + 2, ETH_TYPE_IP);
+  arp[4] = 6;
+  arp[5] = 4;
+  put16(arp + 6, op);
+  memcpy(arp + 8, net.macaddr, 6);
+  put32(arp + 14, net.ipaddr);
+  memcpy(arp + 18, target_mac, 6);
+  put32(arp + 24, target_ip);
+}
+
+static void arp_request(uint32 ipaddr)
+{
+  unsigned char zero[6];
+  netbuf_t *nb;
+
+  if ((nb = netbuf_alloc(ETH_HDR_SIZE)) == NULL)
+    return;
+  memset(zero, 0, sizeof(zero));
+  arp_fill((unsigned char *)netbuf_put(nb, ARP_SIZE), ARP_OP_REQUEST,
+           zero, ipaddr);
+  eth_output(nb, eth_broadcast, ETH_TYPE_ARP);
+}
+
+/*
+ * ARPの受信（自分宛ての要求には、受信したバッファを書き換えて応答する）
+ * 応答したら、バッファはドライバに渡すので 1 を返す。
+ */
+static int arp_input(netbuf_t *nb)
+{
+  unsigned char *arp = (unsigned char *)netbuf_data(nb), mac[6];
+  uint32 sender;
+
+  if ((nb->len < ARP_SIZE) || (get16(arp) != ARP_HTYPE_ETH)
+      || (get16(arp + 2) != ETH_TYPE_IP) || (arp[4] != 6) || (arp[5] != 4))
+    return 0;
+  if (get32(arp + 24) != net.ipaddr)
+    return 0;
+
+  sender = get32(arp + 14);
+  arp_update(sender, arp + 8);
+  if (get16(arp + 6) != ARP_OP_REQUEST)
+    return 0;
+
+  memcpy(mac, arp + 8, 6);
+  arp_fill(arp, ARP_OP_REPLY, mac, sender);
+  netbuf_trim(nb, ARP_SIZE);
+  eth_output(nb, mac, ETH_TYPE_ARP);
+  return 1;
+}
+
+/* IPのヘッダの作成（オプションなし） */
+static void ip_fill(unsigned char *ip, uint8 proto, uint32 dst, int len)
+{
+  ip[0] = 0x45; /* バージョン4, ヘッダ長20バイト */
+  ip[1] = 0;
+  put16(ip + 2, len);
+  put16(ip + 4, net.ip_id++);
+  put16(ip + 6, IP_FLAG_DF);
+  ip[8] = NET_IP_TTL;
+  ip[9] = proto;
+  put16(ip + 10, 0);
+  put32(ip + 12, net.ipaddr);
+  put32(ip + 16, dst);
+  put16(ip + 10, cksum_inet_fold(cksum_inet(0, ip, IP_HDR_SIZE)));
+}
+
+/*
+ * ICMPのエコー要求に、受信したバッファの宛先と送信元を入れ替えて応答する
+ * 応答したら、バッファはドライバに渡すので 1 を返す。
+ */
+static int icmp_input(netbuf_t *nb, unsigned char *ip, int hlen)
+{
+  unsigned char *icmp, mac[6];
+  uint32 src;
+
+  /* 送信元は、ヘッダを書き換える前に取り出しておく（MACはEthernetのヘッダから） */
+  src = get32(ip + 12);
+  memcpy(mac, ip - ETH_HDR_SIZE + 6, 6);
+
+  icmp = (unsigned char *)netbuf_pull(nb, hlen);
+  if ((nb->len < 8) || (icmp[0] != ICMP_ECHO_REQUEST)
+      || cksum_inet_fold(cksum_inet(0, icmp, nb->len)))
+    return 0;
+
+  icmp[0] = ICMP_ECHO_REPLY;
+  put16(icmp + 2, 0);
+  put16(icmp + 2, cksum_inet_fold(cksum_inet(0, icmp, nb->len)));
+
+  /* オプションは付けずに、ICMPのメッセージの直前にIPのヘッダを作り直す */
+  ip = (unsigned char *)netbuf_push(nb, IP_HDR_SIZE);
+  ip_fill(ip, IP_PROTO_ICMP, src, nb->len);
+  eth_output(nb, mac, ETH_TYPE_IP);
+  return 1;
+}
+
+/*
+ * UDPの受信（登録されたポート宛てならば、データまで取り除いたバッファを渡す）
+ * 渡したら、バッファはアプリケーションが解放するので 1 を返す。
+ */
+static int udp_input(netbuf_t *nb, unsigned char *ip, int hlen)
+{
+  unsigned char *udp = ip + hlen;
+  net_udp_hdr_t *hdr = NET_UDP_HDR(nb);
+  int i, ulen = nb->len - hlen;
+  uint16 port;
+
+  if ((ulen < UDP_HDR_SIZE) || (get16(udp + 4) < UDP_HDR_SIZE)
+      || (get16(udp + 4) > ulen))
+    return 0;
+  ulen = get16(udp + 4);
+  if (get16(udp + 6)
+      && cksum_inet_fold(cksum_inet(cksum_pseudo(get32(ip + 12),
+                                                 get32(ip + 16), ulen),
+                                    udp, ulen)))
+    return 0;
+
+  port = get16(udp + 2);
+  for (i = 0; i < NET_UDP_PORT_NUM; i++) {
+    if (net.ports[i].port == port)
+      break;
+  }
+  if (i == NET_UDP_PORT_NUM)
+    return 0;
+
+  hdr->src_addr = get32(ip + 12);
+  hdr->src_port = get16(udp);
+  hdr->dst_port = port;
+  hdr->size = ulen - UDP_HDR_SIZE;
+  netbuf_pull(nb, hlen + UDP_HDR_SIZE);
+  netbuf_trim(nb, hdr->size);
+  if (kz_send(net.ports[i].box, hdr->size, (char *)nb) < 0)
+    return 0;
+  return 1;
+}
+
+/* IPの受信（バッファを他のスレッドに渡したら 1 を返す） */
+static int ip_input(netbuf_t *nb)
+{
+  unsigned char *ip = (unsigned char *)netbuf_data(nb);
+  int hlen, iplen;
+  uint32 dst;
+
+  if ((nb->len < IP_HDR_SIZE) || ((ip[0] >> 4) != 4))
+    return 0;
+  hlen = (ip[0] & 0x0f) << 2;
+  iplen = get16(ip + 2);
+  if ((hlen < IP_HDR_SIZE) || (iplen < hlen) || (iplen > nb->len))
+    return 0;
+  if (cksum_inet_fold(cksum_inet(0, ip, hlen)))
+    return 0;
+  if (get16(ip + 6) & IP_FRAG_MASK)
+    return 0;
+  dst = get32(ip + 16);
+  if ((dst != net.ipaddr) && (dst != NET_ADDR_BROADCAST))
+    return 0;
+  netbuf_trim(nb, iplen); /* 最小フレーム長までのパディングを除く */
+
+  switch (ip[9]) {
+    case IP_PROTO_ICMP:
+      if (dst == net.ipaddr)
+        return icmp_input(nb, ip, hlen);
+      break;
+
+    case IP_PROTO_UDP:
+      return udp_input(nb, ip, hlen);
+
+    default:
+      break;
+  }
+  return 0;
+}
+
+/* 受信したフレームの処理（バッファを他のスレッドに渡したら 1 を返す） */
+static int net_input(netbuf_t *nb)
+{
+  unsigned char *frame = (unsigned char *)netbuf_data(nb);
+
+  if (nb->len < ETH_HDR_SIZE)
+    return 0;
+  netbuf_pull(nb, ETH_HDR_SIZE);
+
+  switch (get16(frame + 12)) {
+    case ETH_TYPE_ARP:
+      return arp_input(nb);
+
+    case ETH_TYPE_IP:
+      return ip_input(nb);
+
+    default:
+      break;
+  }
+  return 0;
+}
+
+/*
+ * UDPの送信
+ * データのバッファの参照が1つだけで、先頭に空きがあればそこにヘッダを書き込む。
+ * そうでなければ（アプリケーションが再送のために参照を持っている場合など）、
+ * ヘッダ用のバッファを獲得して、データのバッファをつなぐ。
+ * 送信できたら、データのバッファはドライバが解放する。
+ */
+static int udp_output(net_req_t *req)
+{
+  netbuf_t *nb = req->nb, *hb;
+  unsigned char *udp, *mac;
+  int size, ulen;
+  uint16 sum;
+
+  size = netbuf_total(nb);
+  if ((size > NET_UDP_DATA_MAX) || !req->dst_port)
+    return NET_ERR_PARAM;
+
+  if (req->dst_addr == NET_ADDR_BROADCAST) {
+    mac = (unsigned char *)eth_broadcast;
+  } else if ((mac = arp_lookup(req->dst_addr)) == NULL) {
+    arp_request(req->dst_addr);
+    return NET_ERR_ARP;
+  }
+
+  if ((nb->refs == 1) && (netbuf_headroom(nb) >= NET_UDP_HEADROOM)) {
+    hb = nb;
+  } else {
+    if ((hb = netbuf_alloc(NET_UDP_HEADROOM)) == NULL)
+      return NET_ERR_NORES;
+    netbuf_chain(hb, nb);
+  }
+
+  ulen = UDP_HDR_SIZE + size;
+  udp = (unsigned char *)netbuf_push(hb, UDP_HDR_SIZE);
+  put16(udp, req->port);
+  put16(udp + 2, req->dst_port);
+  put16(udp + 4, ulen);
+  put16(udp + 6, 0);
+  sum = cksum_inet_fold(cksum_netbuf(cksum_pseudo(net.ipaddr, req->dst_addr,
+                                                 ulen), hb));
+  put16(udp + 6, sum ? sum : 0xffff); /* 0はチェックサムなしの意味になる */
+
+  ip_fill((unsigned char *)netbuf_push(hb, IP_HDR_SIZE), IP_PROTO_UDP,
+          req->dst_addr, IP_HDR_SIZE + ulen);
+  eth_output(hb, mac, ETH_TYPE_IP);
+  return 0;
+}
+
+static int udp_bind(net_req_t *req)
+{
+  int i, n = -1;
+
+  if (!req->port)
+    return NET_ERR_PARAM;
+  for (i = 0; i < NET_UDP_PORT_NUM; i++) {
+    if (net.ports[i].port == req->port) {
+      n = i;
+      break;
+    }
+    if ((n < 0) && !net.ports[i].port)
+      n = i;
+  }
+  if (n < 0)
+    return NET_ERR_NORES;
+  net.ports[n].port = req->port;
+  net.ports[n].box = req->box;
+  return 0;
+}
+
+/* アプリケーションからの要求の処理 */
+static void net_command(net_req_t *req)
+{
+  switch (req->command) {
+    case NET_CMD_BIND:
+      req->result = udp_bind(req);
+      break;
+
+    case NET_CMD_SENDTO:
+      req->result = udp_output(req);
+      break;
+
+    default:
+      req->result = NET_ERR_PARAM;
+      break;
+  }
+}
+
+/* 初期化処理（イーサネットドライバの利用を開始し、MACアドレスを得る） */
+static KZ_COLD int net_init(void)
+{
+  char box;
+
+  memset(&net, 0, sizeof(net));
+  net.ipaddr = NET_IPADDR;
+  net.frame_box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  if ((int)net.frame_box < 0)
+    return -1;
+
+  box = net.frame_box;
+  netdrv_call(NETDRV_CMD_USE, &box, 1);
+  netdrv_call(NETDRV_CMD_ADDR, (char *)net.macaddr, sizeof(net.macaddr));
+  return 0;
+}
+
+int net_main(int argc, char *argv[])
+{
+  kz_msgbox_id_t box;
+  kz_thread_id_t id;
+  int size;
+  char *p;
+
+  if (net_init() < 0)
+    return -1;
+
+  while (1) {
+    id = kz_recv_any((1 << MSGBOX_ID_NETSTACK) | (1 << net.frame_box),
+                     &box, &size, &p);
+    if (box == net.frame_box) {
+      if (!net_input((netbuf_t *)p))
+        netbuf_free((netbuf_t *)p);
+    } else {
+      net_command((net_req_t *)p);
+      kz_reply(id, 0, NULL);
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * 以下はアプリケーションのスレッドから呼ぶライブラリ関数
+ */
+
+/* UDPのポートの受信の登録（同じポートを登録し直すと、渡す先を変える） */
+int net_udp_bind(uint16 port, kz_msgbox_id_t box)
+{
+  net_req_t req;
+
+  req.command = NET_CMD_BIND;
+  req.port = port;
+  req.box = box;
+  kz_call(MSGBOX_ID_NETSTACK, sizeof(req), (char *)&req, NULL);
+  return req.result;
+}
+
+/*
+ * UDPの送信
+ * 送信できたら(0を返したら)バッファはドライバが解放するので、以降は参照しないこと
+ * （エラーならば呼び出し元のもののままなので、解放するか送り直す）。
+ * 先頭に NET_UDP_HEADROOM の空きがあれば、そこにヘッダを書き込む。
+ * 宛先のMACアドレスが分からなければARPで問い合わせ、1ティックずつ待って
+ * NET_ARP_RETRY 回まで送り直す。
+ */
+int net_udp_sendto(uint32 addr, uint16 port, uint16 src_port, netbuf_t *nb)
+{
+  net_req_t req;
+  int i;
+
+  for (i = 0; i <= NET_ARP_RETRY; i++) {
+    if (i)
+      kz_sleep(1);
+    req.command = NET_CMD_SENDTO;
+    req.port = src_port;
+    req.dst_port = port;
+    req.dst_addr = addr;
+    req.nb = nb;
+    kz_call(MSGBOX_ID_NETSTACK, sizeof(req), (char *)&req, NULL);
+    if (req.result != NET_ERR_ARP)
+      break;
+  }
+  return req.result;
+}
@@ -0,0 +1,45 @@
+#ifndef _NET_H_INCLUDED_
+#define _NET_H_INCLUDED_
+
+#include "defines.h"
+#include "kozos.h"
+#include "netbuf.h"
+
+/* IPv4アドレス（上位バイトから a.b.c.d の順） */
+#define NET_ADDR(a, b, c, d) \
+  (((uint32)(a) << 24) | ((uint32)(b) << 16) | ((uint32)(c) << 8) | (uint32)(d))
+#define NET_ADDR_BROADCAST 0xffffffff
+
+/*
+ * UDPで送信するデータの前に必要な領域（Ethernet, IP, UDPのヘッダ）
+ * 送信するバッファを netbuf_alloc(NET_UDP_HEADROOM) で獲得すると、
+ * ヘッダはデータの前に書き込まれる（空きがなければヘッダ用のバッファをつなぐ）。
+ */
+#define NET_UDP_HEADROOM (14 + 20 + 8)
+#define NET_UDP_DATA_MAX (1514 - NET_UDP_HEADROOM)
+
+/* エラーコード */
+#define NET_ERR_PARAM (-1) /* 大きさやポートが不正 */
+#define NET_ERR_NORES (-2) /* ポートの登録やヘッダ用のバッファの空きがない */
+#define NET_ERR_ARP   (-3) /* 宛先のMACアドレスが分からない（ARPの応答待ち） */
+
+/*
+ * 受信したUDPのデータグラム
+ * net_udp_bind() で登録したメッセージボックスに、受信したパケットの
+ * バッファ(netbuf_t *)のまま送られる（size はデータの大きさ）。データは
+ * netbuf_data() の位置にあり、送信元などは NET_UDP_HDR() で参照する。
+ * 処理が終わったら netbuf_free() すること。
+ */
+typedef struct {
+  uint32 src_addr;  /* 送信元のIPアドレス */
+  uint16 src_port;  /* 送信元のポート */
+  uint16 dst_port;  /* 宛先のポート */
+  uint16 size;      /* データの大きさ */
+} net_udp_hdr_t;
+
+#define NET_UDP_HDR(nb) ((net_udp_hdr_t *)(nb)->cb)
+
+int net_udp_bind(uint16 port, kz_msgbox_id_t box);
+int net_udp_sendto(uint32 addr, uint16 port, uint16 src_port, netbuf_t *nb);
+
+#endif
@@ -0,0 +1,172 @@
+#include "defines.h"
+#include "kozos.h"
+#include "interrupt.h"
+#include "lib.h"
+#include "netbuf.h"
+#include "queue.h"
+
+/*
+ * ネットワークのパケットのバッファ（netbuf.h を参照）
+ * 空きリストは割り込み処理(ドライバの受信)とスレッドで共有するので、
+ * 全ての割り込みをマスクして操作する（操作は数命令で終わる）。
+ * netbuf_alloc() は割り込み処理からも呼べるが、netbuf_free() は
+ * 空きの通知にシステムコールを使うのでスレッドからのみ呼ぶこと。
+ */
+
+static netbuf_t *netbufs;   /* 外部DRAMに獲得したバッファの領域 */
+static netbuf_t *free_list; /* 空いているバッファ */
+static int free_num;
+static int notify_box = -1; /* 空きができたら通知するメッセージボックス */
+
+/* バッファの領域の獲得（2回目以降は何もしない） */
+KZ_COLD int netbuf_init(void)
+{
+  int i;
+
+  if (netbufs)
+    return 0;
+  netbufs = kz_dmalloc(sizeof(netbuf_t) * NETBUF_NUM);
+  if (netbufs == NULL)
+    return -1;
+  for (i = 0; i < NETBUF_NUM; i++) {
+    netbufs[i].refs = 0;
+    KZ_LIST_PUSH(free_list, &netbufs[i], next);
+  }
+  free_num = NETBUF_NUM;
+  return 0;
+}
+
+/* バッファの獲得（先頭に headroom バイトの空きを取る。空きがなければ NULL） */
+netbuf_t *netbuf_alloc(int headroom)
+{
+  netbuf_t *nb;
+  int ceiling;
+
+  if ((headroom < 0) || (headroom > NETBUF_DATA_SIZE))
+    return NULL;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  nb = free_list;
+  if (nb) {
+    KZ_LIST_POP(free_list, next);
+    free_num--;
+  }
+  kz_unlock_ceiling(ceiling);
+  if (nb == NULL)
+    return NULL;
+
+  nb->next = NULL;
+  nb->refs = 1;
+  nb->offset = headroom;
+  nb->len = 0;
+  return nb;
+}
+
+/* 参照を増やす */
+void netbuf_ref(netbuf_t *nb)
+{
+  int ceiling;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  nb->refs++;
+  kz_unlock_ceiling(ceiling);
+}
+
+/*
+ * 参照を減らし、0になったら空きに戻す（スレッドから）
+ * 空きに戻したバッファにつながっているバッファも、同様に参照を減らす。
+ * 空きがない状態から空きができたら、netbuf_set_notify() で登録された
+ * メッセージボックスに空のメッセージを送る。
+ */
+void netbuf_free(netbuf_t *nb)
+{
+  netbuf_t *next;
+  int ceiling, notify = 0;
+
+  while (nb) {
+    ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+    if (--nb->refs) {
+      kz_unlock_ceiling(ceiling);
+      break;
+    }
+    next = nb->next;
+    if (!free_list)
+      notify = 1;
+    KZ_LIST_PUSH(free_list, nb, next);
+    free_num++;
+    kz_unlock_ceiling(ceiling);
+    nb = next;
+  }
+
+  if (notify && (notify_box >= 0))
+    kz_send(notify_box, 0, NULL);
+}
+
+/* 先頭にデータを追加して、その位置を返す（空きが足りなければ NULL） */
+char *netbuf_push(netbuf_t *nb, int size)
+{
+  if (size > nb->offset)
+    return NULL;
+  nb->offset -= size;
+  nb->len += size;
+  return netbuf_data(nb);
+}
+
+/* 先頭からデータを取り除いて、新しい先頭を返す（データが足りなければ NULL） */
+char *netbuf_pull(netbuf_t *nb, int size)
+{
+  if (size > nb->len)
+    return NULL;
+  nb->offset += size;
+  nb->len -= size;
+  return netbuf_data(nb);
+}
+
+/* 末尾にデータを追加して、その位置を返す（空きが足りなければ NULL） */
+char *netbuf_put(netbuf_t *nb, int size)
+{
+  char *p;
+
+  if (size > netbuf_tailroom(nb))
+    return NULL;
+  p = netbuf_data(nb) + nb->len;
+  nb->len += size;
+  return p;
+}
+
+/* データを size バイトに切り詰める（パケットのパディングの除去など） */
+void netbuf_trim(netbuf_t *nb, int size)
+{
+  if (size < nb->len)
+    nb->len = size;
+}
+
+/* パケットの末尾にバッファをつなぐ（next の参照は nb に移る） */
+void netbuf_chain(netbuf_t *nb, netbuf_t *next)
+{
+  while (nb->next)
+    nb = nb->next;
+  nb->next = next;
+}
+
+/* つながったバッファを含めたパケットの大きさ */
+int netbuf_total(netbuf_t *nb)
+{
+  int total = 0;
+
+  for (; nb; nb = nb->next)
+    total += nb->len;
+  return total;
+}
+
+/* 空いているバッファの数 */
+int netbuf_count(void)
+{
+  return free_num;
+}
+
+/* 空きができたときの通知先の登録(受信を止めたドライバの再開用) */
+void netbuf_set_notify(kz_msgbox_id_t box)
+{
+  notify_box = box;
+}
@@ -0,0 +1,50 @@
+#ifndef _NETBUF_H_INCLUDED_
+#define _NETBUF_H_INCLUDED_
+
+#include "defines.h"
+#include "kozos.h"
+
+/*
+ * ネットワークのパケットのバッファ（netbuf.c）
+ * 大きさ NETBUF_DATA_SIZE の固定長のバッファを NETBUF_NUM 個、起動後の
+ * 最初の利用時に外部DRAMから獲得する（kz_kmalloc() のメモリプールは使わない）。
+ * ドライバからプロトコルスタック、アプリケーションまで、netbuf_t のポインタを
+ * メッセージで渡していき、最後の参照が netbuf_free() されたら空きに戻る。
+ *
+ * ・データは data[] の offset バイト目から len バイト。先頭に空き(headroom)を
+ *   取っておけば、netbuf_push() でヘッダをコピーなしに前に付けられる。
+ * ・netbuf_ref() で参照を増やすと、その数だけ netbuf_free() されるまで
+ *   解放されない（送信したバッファを再送のために保持する場合など）。
+ * ・next で複数のバッファをつないで1つのパケットにできる（ヘッダのバッファの
+ *   後ろにアプリケーションのデータのバッファをつなぐ場合など）。先頭の
+ *   バッファが解放されると、つながったバッファの参照も1つずつ減らす。
+ */
+typedef struct _netbuf {
+  struct _netbuf *next; /* パケットの次の部分（空きリストのリンクにも使う） */
+  uint8 refs;           /* 参照の数（0なら空き） */
+  uint8 dummy;
+  uint16 offset;        /* data の先頭からデータの先頭までのバイト数 */
+  uint16 len;           /* データの大きさ */
+  uint16 dummy2;
+  char cb[12];          /* 受け渡す層ごとの情報(net_udp_hdr_t など) */
+  char data[NETBUF_DATA_SIZE];
+} netbuf_t;
+
+#define netbuf_data(nb) ((nb)->data + (nb)->offset)
+#define netbuf_headroom(nb) ((nb)->offset)
+#define netbuf_tailroom(nb) (NETBUF_DATA_SIZE - (nb)->offset - (nb)->len)
+
+int netbuf_init(void);
+netbuf_t *netbuf_alloc(int headroom);
+void netbuf_ref(netbuf_t *nb);
+void netbuf_free(netbuf_t *nb);
+char *netbuf_push(netbuf_t *nb, int size);
+char *netbuf_pull(netbuf_t *nb, int size);
+char *netbuf_put(netbuf_t *nb, int size);
+void netbuf_trim(netbuf_t *nb, int size);
+void netbuf_chain(netbuf_t *nb, netbuf_t *next);
+int netbuf_total(netbuf_t *nb);
+int netbuf_count(void);
+void netbuf_set_notify(kz_msgbox_id_t box);
+
+#endif
@@ -0,0 +1,306 @@
+#include "defines.h"
+#include "kozos.h"
+#include "intr.h"
+#include "interrupt.h"
+#include "rtl8019.h"
+#include "lib.h"
+#include "netbuf.h"
+#include "netdrv.h"
+
+/*
+ * イーサネットドライバ（LANボードの RTL8019AS, make NETDRV=1 で組み込む）
+ * コンソールドライバ(consdrv.c)と同じく、要求はメッセージで受け付け、
+ * 受信したフレームは割り込み処理から利用するスレッドのメッセージボックスに
+ * 渡す。受信したフレームはパケットのバッファ(netbuf.h)に読み出して、
+ * ポインタのまま渡す（netbuf_alloc() は割り込み処理から呼べる）。
+ */
+
+#if NETBUF_DATA_SIZE < RTL8019_FRAME_MAX
+#error "NETBUF_DATA_SIZE is smaller than the maximum frame size"
+#endif
+
+/*
+ * スレッドから割り込み処理と共有するデータ・NICのリモートDMAを操作するときに、
+ * マスクする割り込みの優先レベル（kz_lock_ceiling() を参照）
+ */
+#define NETDRV_INTR_LEVEL intr_getlevel(SOFTVEC_TYPE_NETINTR)
+
+#define NETDRV_INTR_RECV (RTL8019_INTR_PRX | RTL8019_INTR_RXE)
+#define NETDRV_INTR_SEND (RTL8019_INTR_PTX | RTL8019_INTR_TXE)
+
+static struct netreg {
+  kz_thread_id_t id;     /* ドライバを利用するスレッド（0なら未初期化） */
+  kz_msgbox_id_t input;  /* 受信したフレームを渡すメッセージボックス */
+  unsigned char macaddr[RTL8019_MACADDR_SIZE];
+
+  /*
+   * 次に受信するバッファ（渡せなかったバッファもここに戻して使う）
+   * 割り込み処理では netbuf_free() を呼べないので、読み出す前に獲得しておき、
+   * 受信リングが空だったときや受信エラーのときは次の受信に使う。
+   * バッファに空きがなくなったら受信割り込みを止めて(recv_stop)、受信した
+   * フレームはNICの受信リングに残しておく。空きができたら(netbuf_free() から
+   * 通知される)スレッドからリングを読み出し、リングが空になったら受信割り込み
+   * を再開する。
+   */
+  netbuf_t *spare;
+  int recv_stop;
+
+  kz_sem_id_t send_sem;  /* 送信中でなければ1（送信完了の割り込みで戻す） */
+  netdrv_stat_t stat;
+} netreg;
+
+/*
+ * 以下の関数(recv_take())は割り込み処理とスレッドから呼ばれるが、
+ * 次に受信するバッファとNICのリモートDMAを操作していて再入不可のため、
+ * スレッドから呼び出す場合は kz_lock_ceiling() で割り込みをマスクして呼ぶこと。
+ */
+
+/*
+ * 受信リングからフレームを1つバッファに読み出し、そのバッファを返す
+ * リングが空か、バッファに空きがなければ NULL を返す（空きがなければ受信割り込み
+ * を止める）。受信割り込みを止めている間にリングが空になったら再開する。
+ */
+static netbuf_t *recv_take(void)
+{
+  netbuf_t *nb;
+  int len;
+
+  while (1) {
+    if (!netreg.spare && !(netreg.spare = netbuf_alloc(0))) {
+      if (!netreg.recv_stop) {
+        netreg.recv_stop = 1;
+        netreg.stat.rx_stops++;
+        rtl8019_intr_disable(NETDRV_INTR_RECV);
+      }
+      return NULL;
+    }
+
+    /* 読み出す前に要因をクリアする（読み出し中に届いたフレームで再び割り込ませる） */
+    rtl8019_intr_clear(NETDRV_INTR_RECV);
+    nb = netreg.spare;
+    len = rtl8019_recv(nb->data, NETBUF_DATA_SIZE);
+    if (len == 0) {
+      if (netreg.recv_stop) {
+        netreg.recv_stop = 0;
+        rtl8019_intr_enable(NETDRV_INTR_RECV);
+      }
+      return NULL;
+    }
+    if (len < 0) { /* 受信エラー・長すぎるフレーム・リングの破損（リセット済み） */
+      netreg.stat.rx_errors++;
+      continue;
+    }
+    netreg.spare = NULL;
+    nb->offset = 0;
+    nb->len = len;
+    return nb;
+  }
+}
+
+/*
+ * 以下は割り込みハンドラから呼ばれる割り込み処理であり、
+ * 非コンテキスト状態でよばれるため、システムコールは利用してはいけない。
+ * （サービスコールを利用すること）
+ */
+static void netdrv_intr(int type)
+{
+  netbuf_t *nb;
+  int status;
+
+  status = rtl8019_intr_status();
+
+  /* 受信リングが溢れたら、受信済みのフレームを全て捨てて再開する */
+  if (status & RTL8019_INTR_OVW) {
+    rtl8019_recover();
+    netreg.stat.rx_overflows++;
+  }
+
+  /* 受信したフレームを、空いているバッファがある限り渡す */
+  if (status & (NETDRV_INTR_RECV | RTL8019_INTR_OVW)) {
+    while ((nb = recv_take()) != NULL) {
+      if (kx_send(netreg.input, nb->len, (char *)nb) < 0) {
+        netreg.spare = nb; /* 次の受信に使う */
+        netreg.stat.rx_drops++;
+      } else {
+        netreg.stat.rx_frames++;
+      }
+    }
+  }
+
+  if (status & NETDRV_INTR_SEND) {
+    rtl8019_intr_clear(NETDRV_INTR_SEND);
+    if (status & RTL8019_INTR_TXE)
+      netreg.stat.tx_errors++;
+    else
+      netreg.stat.tx_frames++;
+    kx_sem_post(netreg.send_sem);
+  }
+
+  /* IRQ はレベル検出なので、NICの要因をクリアしてからフラグをクリアする */
+  rtl8019_irq_clear();
+}
+
+/* 初期化処理 */
+static KZ_COLD int netdrv_init(void)
+{
+  memset(&netreg, 0, sizeof(netreg));
+  return 0;
+}
+
+/*
+ * NICとパケットのバッファの初期化（最初の USE で行う）
+ * NICが応答しないか、資源を獲得できなければ -1 を返す
+ */
+static KZ_COLD int netdrv_open(void)
+{
+  if (rtl8019_init(netreg.macaddr) < 0)
+    return -1;
+  if ((netreg.send_sem = kz_sem_create(1)) < 0)
+    return -1;
+  if (netbuf_init() < 0)
+    return -1;
+  netbuf_set_notify(MSGBOX_ID_NETOUTPUT);
+  netreg.spare = NULL;
+  netreg.recv_stop = 0;
+
+  kz_setintr(SOFTVEC_TYPE_NETINTR, netdrv_intr);
+  rtl8019_intr_enable(NETDRV_INTR_RECV | NETDRV_INTR_SEND | RTL8019_INTR_OVW);
+  return 0;
+}
+
+/*
+ * 受信割り込みを止めている間に受信リングに残ったフレームを渡す（スレッドから）
+ * パケットのバッファに空きができたときに、netbuf_free() からの通知で呼ばれる。
+ */
+static void netdrv_recv_poll(void)
+{
+  netbuf_t *nb;
+  int ceiling;
+
+  while (1) {
+    ceiling = kz_lock_ceiling(NETDRV_INTR_LEVEL);
+    nb = netreg.recv_stop ? recv_take() : NULL;
+    kz_unlock_ceiling(ceiling);
+    if (!nb)
+      break;
+
+    if (kz_send(netreg.input, nb->len, (char *)nb) < 0) {
+      netbuf_free(nb);
+      netreg.stat.rx_drops++;
+    } else {
+      netreg.stat.rx_frames++; /* 受信割り込みは止めているので、排他は不要 */
+    }
+  }
+}
+
+/*
+ * フレームを送信する（スレッドから）
+ * 前の送信が終わるまで待ってから、送信バッファに書き込んで送信を開始する。
+ * パケットのバッファ(nb)ならば、つながったバッファも順に書き込んでから
+ * 解放する。書き込みの間（最大で1.5KBのリモートDMA）はNICの割り込みをマスクする。
+ */
+static void netdrv_send(char *data, int size, netbuf_t *nb)
+{
+  netbuf_t *p;
+  int ret = -1, ceiling;
+
+  if (kz_sem_wait(netreg.send_sem) == 0) {
+    ceiling = kz_lock_ceiling(NETDRV_INTR_LEVEL);
+    if (!nb) {
+      ret = rtl8019_send(data, size);
+    } else if ((ret = rtl8019_send_begin(netbuf_total(nb))) == 0) {
+      for (p = nb; p; p = p->next)
+        rtl8019_send_data(netbuf_data(p), p->len);
+      rtl8019_send_end();
+    }
+    if (ret < 0)
+      netreg.stat.tx_errors++;
+    kz_unlock_ceiling(ceiling);
+
+    /* 送信を開始できなければ、完了の割り込みもないので自分で戻す */
+    if (ret < 0)
+      kz_sem_post(netreg.send_sem);
+  }
+
+  if (nb)
+    netbuf_free(nb);
+}
+
+/* スレッドからの要求を処理する */
+static void netdrv_command(kz_thread_id_t id, netdrv_req_t *req)
+{
+  int size = req->size, ceiling;
+  char *data = req->data ? req->data : (char *)(req + 1);
+
+  if (!netreg.id && (req->command != NETDRV_CMD_USE)) {
+    /* 初期化されていなければ無視する（送信するバッファは解放する） */
+    if ((req->command == NETDRV_CMD_SEND)
+        && (req->flags & NETDRV_REQ_FLAG_NETBUF))
+      netbuf_free((netbuf_t *)req->data);
+    return;
+  }
+
+  switch (req->command) {
+    case NETDRV_CMD_USE:
+      if (size < 1)
+        break;
+      if (!netreg.id && (netdrv_open() < 0))
+        break;
+      ceiling = kz_lock_ceiling(NETDRV_INTR_LEVEL);
+      netreg.id = id;
+      netreg.input = data[0];
+      kz_unlock_ceiling(ceiling);
+      break;
+
+    case NETDRV_CMD_SEND:
+      if (req->flags & NETDRV_REQ_FLAG_NETBUF)
+        netdrv_send(NULL, 0, (netbuf_t *)req->data);
+      else
+        netdrv_send(data, size, NULL);
+      break;
+
+    case NETDRV_CMD_ADDR:
+      if (size >= RTL8019_MACADDR_SIZE)
+        memcpy(data, netreg.macaddr, RTL8019_MACADDR_SIZE);
+      break;
+
+    case NETDRV_CMD_STAT:
+      if (size >= sizeof(netdrv_stat_t)) {
+        ceiling = kz_lock_ceiling(NETDRV_INTR_LEVEL);
+        memcpy(data, &netreg.stat, sizeof(netdrv_stat_t));
+        kz_unlock_ceiling(ceiling);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+int netdrv_main(int argc, char *argv[])
+{
+  kz_thread_id_t id;
+  netdrv_req_t *req;
+  int size;
+  char *p, *release = NULL;
+
+  netdrv_init();
+
+  while (1) {
+    /* 前の要求の領域は、次の受信と同じシステムコールで解放する */
+    id = kz_recv_free(MSGBOX_ID_NETOUTPUT, &size, &p, 0, release);
+    release = NULL;
+    if (p == NULL) { /* パケットのバッファに空きができた(netbuf_free()) */
+      netdrv_recv_poll();
+      continue;
+    }
+    req = (netdrv_req_t *)p;
+    netdrv_command(id, req);
+    if (req->flags & NETDRV_REQ_FLAG_CALL)
+      kz_reply(id, 0, NULL);
+    else
+      release = p;
+  }
+
+  return 0;
+}
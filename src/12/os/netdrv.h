@@ -0,0 +1,59 @@
+#ifndef _NETDRV_H_INCLUDED_
+#define _NETDRV_H_INCLUDED_
+
+#include "defines.h"
+
+#define NETDRV_CMD_USE     'u'
+#define NETDRV_CMD_SEND    's'
+#define NETDRV_CMD_ADDR    'a' /* MACアドレスの取得 */
+#define NETDRV_CMD_STAT    'S' /* 統計情報(netdrv_stat_t)の取得 */
+
+/*
+ * イーサネットドライバへの要求（MSGBOX_ID_NETOUTPUT に送るメッセージ）
+ * data が NULL ならば、データはヘッダの直後に続く。
+ * data でデータを指す場合はコピーせずに参照するので、NETDRV_REQ_FLAG_CALL
+ * を指定して kz_call() で送り、返信されるまでデータを変更しないこと。
+ *
+ * 各要求のデータ
+ * ・NETDRV_CMD_USE:     [0]: 受信したフレームを渡すメッセージボックス
+ * ・NETDRV_CMD_SEND:    送信するフレーム（宛先のMACアドレスから、CRCを除く）
+ *                       NETDRV_REQ_FLAG_NETBUF ならば data はパケットのバッファ
+ *                       (netbuf_t *)で、送信したらドライバが netbuf_free() する
+ * ・NETDRV_CMD_ADDR:    MACアドレスを書き込む領域（6バイト）
+ * ・NETDRV_CMD_STAT:    統計情報を書き込む領域(netdrv_stat_t)
+ *
+ * 受信したフレームは、パケットのバッファ(netbuf.h)に読み出し、そのポインタを
+ * USE で指定したメッセージボックスに送る（size はフレーム長）。処理が
+ * 終わったら netbuf_free() すること。バッファに空きがない間に受信した
+ * フレームは、NICの受信リングに残しておき、空きができたら渡す
+ * （リングが溢れたら、その時点で受信済みのフレームは捨てる）。
+ */
+typedef struct {
+  uint8 command; /* NETDRV_CMD_* */
+  uint8 flags;   /* NETDRV_REQ_FLAG_* */
+  uint16 dummy;
+  int size;      /* データのサイズ */
+  char *data;    /* データ（NULLならばヘッダの直後） */
+} netdrv_req_t;
+
+/*
+ * kz_call() で送った要求（処理が終わったら kz_reply() する）
+ * 要求の領域は要求元のものなので、ドライバは解放しない(スタック上でもよい)
+ */
+#define NETDRV_REQ_FLAG_CALL (1 << 0)
+
+/* 送信するフレームがパケットのバッファ(netbuf_t)である(NETDRV_CMD_SEND) */
+#define NETDRV_REQ_FLAG_NETBUF (1 << 1)
+
+/* 統計情報（起動時からの通算） */
+typedef struct {
+  uint32 rx_frames;    /* 受信して渡したフレームの数 */
+  uint32 rx_errors;    /* 受信エラーや長すぎるために捨てたフレームの数 */
+  uint32 rx_drops;     /* メッセージボックスに渡せずに捨てたフレームの数 */
+  uint32 rx_overflows; /* 受信リングが溢れた回数 */
+  uint32 rx_stops;     /* バッファの空き待ちで受信を止めた回数 */
+  uint32 tx_frames;    /* 送信したフレームの数 */
+  uint32 tx_errors;    /* 送信エラーの数 */
+} netdrv_stat_t;
+
+#endif
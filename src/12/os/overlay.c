@@ -0,0 +1,54 @@
+#include "defines.h"
+#include "kozos.h"
+#include "lib.h"
+#include "overlay.h"
+
+/*
+ * オーバーレイの管理（overlay.h を参照）
+ * ウィンドウには最後に読み込んだオーバーレイが残っているので、同じ
+ * オーバーレイが続けて呼ばれる場合はコピーしない。ウィンドウは mutex で
+ * 占有するので、別のオーバーレイを使うスレッドは leave まで待たされる
+ * （優先度継承により、占有しているスレッドの優先度が上がる）。
+ */
+
+/* リンカスクリプトで定義される（ウィンドウと、各オーバーレイのロード位置） */
+extern char ovl_window;
+extern char _load_start_ovl0, _load_stop_ovl0;
+
+static const struct {
+  char *start;
+  char *stop;
+} overlays[OVERLAY_ID_NUM] = {
+  { &_load_start_ovl0, &_load_stop_ovl0 }, /* OVERLAY_ID_BENCH */
+};
+
+static kz_mutex_id_t ovl_mutex;
+static int ovl_loaded = -1; /* ウィンドウにあるオーバーレイ */
+
+/* 初期化（オーバーレイを使うスレッドを作成する前に呼ぶ） */
+KZ_COLD int kz_overlay_init(void)
+{
+  ovl_mutex = kz_mutex_create();
+  return (ovl_mutex < 0) ? -1 : 0;
+}
+
+/* ウィンドウを占有して、オーバーレイ id を読み込む */
+int kz_overlay_enter(kz_overlay_id_t id)
+{
+  if ((unsigned int)id >= OVERLAY_ID_NUM)
+    return KZ_ERR_PARAM;
+
+  kz_mutex_lock(ovl_mutex);
+  if (ovl_loaded != id) {
+    memcpy(&ovl_window, overlays[id].start,
+           overlays[id].stop - overlays[id].start);
+    ovl_loaded = id;
+  }
+  return 0;
+}
+
+/* ウィンドウの占有の解除 */
+void kz_overlay_leave(void)
+{
+  kz_mutex_unlock(ovl_mutex);
+}
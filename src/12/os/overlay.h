@@ -0,0 +1,49 @@
+#ifndef _KOZOS_OVERLAY_H_INCLUDED_
+#define _KOZOS_OVERLAY_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * オーバーレイ（overlay.c）
+ * 実行頻度は低いが内蔵RAMの速度で実行したいコード(ベンチマークなど)を、
+ * オーバーレイとして外部DRAM（XIPではフラッシュROM）にロードしておき、
+ * 呼び出すときに内蔵RAMの共通のウィンドウにコピーして実行する。
+ * ウィンドウの大きさは最大のオーバーレイの大きさになる(ld.scr)。
+ *
+ * ・オーバーレイに置くオブジェクトは ld.scr の .ovl* で指定する
+ *   （オーバーレイ間の参照はリンク時のエラーになる: NOCROSSREFS）
+ * ・呼び出す側は kz_overlay_enter() でウィンドウを占有してから呼び、
+ *   戻ったら kz_overlay_leave() する。KZ_OVERLAY_CALL() はその組のスタブ。
+ *   占有中に作成したスレッドがオーバーレイのコードを実行する場合は、
+ *   leave の前に終了させること。
+ * ・スレッドの入口などの常駐させる関数には KZ_RESIDENT を指定する
+ * ・ホスト環境では常に常駐で、enter/leave は何もしない
+ */
+
+typedef enum {
+  OVERLAY_ID_BENCH = 0, /* マイクロベンチマーク(bench.o) */
+  OVERLAY_ID_NUM
+} kz_overlay_id_t;
+
+#ifdef KZ_HOST
+#define KZ_RESIDENT
+static inline int kz_overlay_init(void) { return 0; }
+static inline int kz_overlay_enter(kz_overlay_id_t id) { return 0; }
+static inline void kz_overlay_leave(void) {}
+#else
+/* オーバーレイにするオブジェクトの中で、常駐させる関数(ld.scr) */
+#define KZ_RESIDENT __attribute__((section(".text.resident")))
+int kz_overlay_init(void);
+int kz_overlay_enter(kz_overlay_id_t id);
+void kz_overlay_leave(void);
+#endif
+
+/* オーバーレイ id の関数の呼び出し（call は関数呼び出しの式） */
+#define KZ_OVERLAY_CALL(id, call) ({   \
+  __typeof__(call) _ovl_ret;           \
+  kz_overlay_enter(id);                \
+  _ovl_ret = (call);                   \
+  kz_overlay_leave();                  \
+  _ovl_ret; })
+
+#endif
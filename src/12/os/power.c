@@ -0,0 +1,140 @@
+#include "defines.h"
+#include "serial.h"
+#include "power.h"
+
+/*
+ * 省電力の制御（モジュールストップとソフトウェアスタンバイ）
+ *
+ * 起動時に、使わない内蔵モジュール(φの出力、8ビットタイマ、組み込んで
+ * いないA/D・DMAC・コンソールのSCI)を停止する。
+ *
+ * ソフトウェアスタンバイはクロックの発振も止めるので、タイマでは起床
+ * できない（NMIかIRQ0～IRQ2のみ）。そのため、カーネルはタイマ待ちが何も
+ * ないときだけ kz_idle() から使う(KZ_STANDBY, kz_standby() を参照)。
+ * スタンバイ中はSCIとITUが初期化されるので、起床の割り込みの入口で
+ * power_resume() とタイマの再設定を行う。DRAMはセルフリフレッシュにして
+ * 内容を保持する。
+ */
+
+#define H8_3069F_SYSCR  ((volatile uint8 *)0xfee012)
+#define H8_3069F_IER    ((volatile uint8 *)0xfee015)
+#define H8_3069F_MSTCRH ((volatile uint8 *)0xfee01c)
+#define H8_3069F_MSTCRL ((volatile uint8 *)0xfee01d)
+#define H8_3069F_DRCRA  ((volatile uint8 *)0xfee026)
+
+#define H8_3069F_SYSCR_SSBY      (1<<7)
+#define H8_3069F_SYSCR_STS_MASK  (7<<4)
+#define H8_3069F_DRCRA_SRFMD     (1<<1) /* スタンバイ中のセルフリフレッシュ */
+
+/*
+ * 起床後の発振安定待ち(STS2～0)
+ * 5: 262144ステート（φ=20MHzで約13ミリ秒, 水晶発振子の推奨値以上）
+ */
+#define POWER_STANDBY_STS (5<<4)
+
+/* スタンバイから起床できる割り込み(IRQ0～IRQ2) */
+#define POWER_WAKEUP_IRQS 0x07
+
+static uint16 power_mstcr(void)
+{
+  return (*H8_3069F_MSTCRH << 8) | *H8_3069F_MSTCRL;
+}
+
+static void power_set_mstcr(uint16 mstcr)
+{
+  *H8_3069F_MSTCRH = mstcr >> 8;
+  *H8_3069F_MSTCRL = mstcr & 0xff;
+}
+
+/* 使わないモジュールの停止（起動時に呼ぶ） */
+KZ_COLD int power_init(void)
+{
+  uint16 modules;
+
+  modules = POWER_MODULE_PHI | POWER_MODULE_TMR01 | POWER_MODULE_TMR23;
+#ifndef KZ_ADC
+  modules |= POWER_MODULE_ADC;
+#endif
+#ifndef CONSDRV_DMA
+  modules |= POWER_MODULE_DMAC;
+#endif
+#ifndef KZ_CONSOLE_SCI0
+  modules |= POWER_MODULE_SCI(0);
+#endif
+#ifndef KZ_CONSOLE_SCI2
+  modules |= POWER_MODULE_SCI(2);
+#endif
+  power_module_stop(modules);
+
+  return 0;
+}
+
+/*
+ * モジュールの動作開始・停止
+ * MSTCR は全モジュールで共用なので、割り込み禁止か初期化時に呼ぶこと。
+ */
+void power_module_start(uint16 modules)
+{
+  power_set_mstcr(power_mstcr() & ~modules);
+}
+
+void power_module_stop(uint16 modules)
+{
+  power_set_mstcr(power_mstcr() | modules);
+}
+
+/*
+ * ソフトウェアスタンバイにできるか
+ * 起床の要因(IRQ0～IRQ2)が許可されていて、動作中のSCIが全て送信を
+ * 終えていること（送信の割り込みではスタンバイから起床できない）。
+ */
+int power_standby_ready(void)
+{
+  uint16 mstcr = power_mstcr();
+  int i;
+
+  if (!(*H8_3069F_IER & POWER_WAKEUP_IRQS))
+    return 0;
+  for (i = 0; i < SERIAL_DEVICE_NUM; i++) {
+    if (!(mstcr & POWER_MODULE_SCI(i)) && !serial_is_send_done(i))
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * ソフトウェアスタンバイへの移行（割り込み禁止で呼ぶ）
+ * 割り込みを有効にしてスタンバイする。起床すると割り込みの処理に入るので、
+ * そこで power_resume() を呼ぶこと。
+ */
+void power_standby(void)
+{
+  uint16 mstcr = power_mstcr();
+  int i;
+
+  for (i = 0; i < SERIAL_DEVICE_NUM; i++) {
+    if (!(mstcr & POWER_MODULE_SCI(i)))
+      serial_save(i);
+  }
+
+  *H8_3069F_DRCRA |= H8_3069F_DRCRA_SRFMD;
+  *H8_3069F_SYSCR = (*H8_3069F_SYSCR & ~H8_3069F_SYSCR_STS_MASK)
+    | H8_3069F_SYSCR_SSBY | POWER_STANDBY_STS;
+
+  asm volatile ("andc.b #0x3f,ccr\n\tsleep");
+}
+
+/* スタンバイからの復帰（SCIの設定を戻す。タイマは呼び出し側で再設定する） */
+void power_resume(void)
+{
+  uint16 mstcr = power_mstcr();
+  int i;
+
+  *H8_3069F_SYSCR &= ~H8_3069F_SYSCR_SSBY;
+  *H8_3069F_DRCRA &= ~H8_3069F_DRCRA_SRFMD;
+
+  for (i = 0; i < SERIAL_DEVICE_NUM; i++) {
+    if (!(mstcr & POWER_MODULE_SCI(i)))
+      serial_restore(i);
+  }
+}
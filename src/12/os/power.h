@@ -0,0 +1,25 @@
+#ifndef _POWER_H_INCLUDED_
+#define _POWER_H_INCLUDED_
+
+/*
+ * 省電力の制御（power.c）
+ * モジュールストップは MSTCRH:MSTCRL を16ビットにしたビットで指定する
+ * (1を書くと停止。PHI は φクロックの出力の停止)。
+ */
+#define POWER_MODULE_PHI     (1 << 15) /* MSTCRH: PSTOP */
+#define POWER_MODULE_SCI(n)  (1 << (8 + (n))) /* MSTCRH: SCI0～2 */
+#define POWER_MODULE_DMAC    (1 << 7)
+#define POWER_MODULE_DRAM    (1 << 5)  /* DRAMインタフェース */
+#define POWER_MODULE_ITU     (1 << 4)  /* 16ビットタイマ */
+#define POWER_MODULE_TMR01   (1 << 3)  /* 8ビットタイマ0,1 */
+#define POWER_MODULE_TMR23   (1 << 2)  /* 8ビットタイマ2,3 */
+#define POWER_MODULE_ADC     (1 << 0)  /* A/D変換器 */
+
+int power_init(void);
+void power_module_start(uint16 modules);
+void power_module_stop(uint16 modules);
+int power_standby_ready(void);
+void power_standby(void);
+void power_resume(void);
+
+#endif
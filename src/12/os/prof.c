@@ -0,0 +1,83 @@
+#include "defines.h"
+#include "kozos.h"
+#include "prof.h"
+
+/*
+ * プロファイラの状態
+ * buf が NULL ならば停止中。interval ティックごとに1つ記録する。
+ */
+static struct {
+  kz_prof_sample_t *volatile buf;
+  int num;      /* バッファの記録数 */
+  int pos;      /* 記録した数 */
+  int lost;     /* バッファが一杯で記録できなかった数 */
+  int interval;
+  int countdown;
+} prof;
+
+/*
+ * サンプルの記録（tick_intr() から割り込み禁止状態で呼ばれる）
+ */
+void kz_prof_tick(uint32 pc, kz_thread_id_t thread)
+{
+  kz_prof_sample_t *sp;
+
+  if (!prof.buf || (--prof.countdown > 0))
+    return;
+  prof.countdown = prof.interval;
+
+  if (prof.pos >= prof.num) {
+    prof.lost++;
+    return;
+  }
+  sp = &prof.buf[prof.pos++];
+  sp->pc = pc;
+  sp->thread = thread;
+  sp->dummy = 0;
+}
+
+/*
+ * プロファイルの開始（スレッドから呼ぶ）
+ * buf に num 個まで、interval ティックごとに記録する。
+ * 以前の記録は捨てる。既に開始していれば KZ_ERR_STATE を返す。
+ */
+int kz_prof_start(kz_prof_sample_t *buf, int num, int interval)
+{
+  int ret = 0;
+
+  if (!buf || (num <= 0) || (interval <= 0))
+    return KZ_ERR_PARAM;
+
+  INTR_DISABLE;
+  if (prof.buf) {
+    ret = KZ_ERR_STATE;
+  } else {
+    prof.num = num;
+    prof.pos = 0;
+    prof.lost = 0;
+    prof.interval = interval;
+    prof.countdown = interval;
+    prof.buf = buf;
+  }
+  INTR_ENABLE;
+
+  return ret;
+}
+
+/* プロファイルの停止（記録した数を返す。バッファは呼び出し側で解放する） */
+int kz_prof_stop(void)
+{
+  INTR_DISABLE;
+  prof.buf = NULL;
+  INTR_ENABLE;
+
+  return prof.pos;
+}
+
+/* 記録した数と、バッファが一杯で記録できなかった数の取得 */
+int kz_prof_count(int *lostp)
+{
+  if (lostp)
+    *lostp = prof.lost;
+  return prof.pos;
+}
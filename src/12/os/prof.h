@@ -0,0 +1,25 @@
+#ifndef _KOZOS_PROF_H_INCLUDED_
+#define _KOZOS_PROF_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * PCサンプリングによるプロファイラ
+ * タイマ割り込み（ティック）ごとに、割り込まれたスレッドのPCとスレッドIDを
+ * 呼び出し側で用意したバッファに記録する。記録はバッファが一杯になるまでで、
+ * ホストの tools/kzprof でシンボルに対応づけて集計する。
+ */
+
+/* サンプルの記録（8バイト） */
+typedef struct {
+  uint32 pc;     /* 割り込まれたPC（割り込み処理中ならば0） */
+  uint16 thread; /* スレッドIDの下位16ビット */
+  uint16 dummy;
+} kz_prof_sample_t;
+
+int kz_prof_start(kz_prof_sample_t *buf, int num, int interval);
+int kz_prof_stop(void);
+int kz_prof_count(int *lostp);
+void kz_prof_tick(uint32 pc, kz_thread_id_t thread); /* カーネルから呼ぶ */
+
+#endif
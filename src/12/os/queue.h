@@ -0,0 +1,90 @@
+#ifndef _KOZOS_QUEUE_H_INCLUDED_
+#define _KOZOS_QUEUE_H_INCLUDED_
+
+/*
+ * 片方向の侵入型リスト・キューのマクロ
+ * 要素の構造体が持つポインタ(field, "timer.next" のような入れ子でもよい)で
+ * つなぐので、獲得は不要で、どの要素の型にも使える。全てマクロで展開され、
+ * 関数呼び出しにならない。要素・キューの引数は複数回評価されることがある。
+ *
+ * KZ_LIST_*: 先頭のポインタだけのリスト（解放済みリスト・タイマ待ちなど）
+ *   linkp は、つなぎ目のポインタ（先頭のポインタか、前の要素の field）の
+ *   アドレス。KZ_LIST_FIND() や for 文で探した位置に挿入・削除する。
+ * KZ_QUEUE_*: head と tail をメンバに持つ構造体のキュー（レディキュー・
+ *   メッセージボックスなど）。末尾への接続が定数時間になる。
+ */
+
+/* 先頭への接続と、先頭の取り外し（head が空でないこと） */
+#define KZ_LIST_PUSH(head, p, field) do { \
+    (p)->field = (head);                  \
+    (head) = (p);                         \
+  } while (0)
+#define KZ_LIST_POP(head, field) ((head) = (head)->field)
+
+/* *linkp の前への挿入と、*linkp の取り外し */
+#define KZ_LIST_INSERT(linkp, p, field) do { \
+    (p)->field = *(linkp);                   \
+    *(linkp) = (p);                          \
+  } while (0)
+#define KZ_LIST_UNLINK(linkp, field) (*(linkp) = (*(linkp))->field)
+
+/* p を指しているつなぎ目を linkp に求める（なければ *linkp が NULL になる） */
+#define KZ_LIST_FIND(linkp, p, field) \
+  for (; *(linkp) && (*(linkp) != (p)); (linkp) = &(*(linkp))->field)
+
+/* p を外す（つながっていなければ何もしない） */
+#define KZ_LIST_REMOVE(head, p, field) do { \
+    __typeof__(&(head)) _lp = &(head);      \
+    KZ_LIST_FIND(_lp, p, field);            \
+    if (*_lp)                               \
+      KZ_LIST_UNLINK(_lp, field);           \
+  } while (0)
+
+#define KZ_QUEUE_INIT(q)  ((q)->head = (q)->tail = NULL)
+#define KZ_QUEUE_EMPTY(q) ((q)->head == NULL)
+
+/* 末尾への接続 */
+#define KZ_QUEUE_PUT(q, p, field) do { \
+    (p)->field = NULL;                 \
+    if ((q)->tail)                     \
+      (q)->tail->field = (p);          \
+    else                               \
+      (q)->head = (p);                 \
+    (q)->tail = (p);                   \
+  } while (0)
+
+/* 先頭への接続 */
+#define KZ_QUEUE_PUSH(q, p, field) do { \
+    (p)->field = (q)->head;             \
+    (q)->head = (p);                    \
+    if ((q)->tail == NULL)              \
+      (q)->tail = (p);                  \
+  } while (0)
+
+/* 先頭の取り外し（空でないこと。外した要素の field は NULL にしない） */
+#define KZ_QUEUE_GET(q, field) do { \
+    (q)->head = (q)->head->field;   \
+    if ((q)->head == NULL)          \
+      (q)->tail = NULL;             \
+  } while (0)
+
+/* キューの途中の *linkp の前への挿入（linkp は &(q)->head から探す） */
+#define KZ_QUEUE_INSERT(q, linkp, p, field) do { \
+    KZ_LIST_INSERT(linkp, p, field);             \
+    if ((p)->field == NULL)                      \
+      (q)->tail = (p);                           \
+  } while (0)
+
+/* p を外す（つながっていなければ何もしない。末尾なら tail を前に戻す） */
+#define KZ_QUEUE_REMOVE(q, p, field) do {                  \
+    __typeof__((q)->head) *_lp = &(q)->head, _prev = NULL; \
+    for (; *_lp && (*_lp != (p)); _lp = &(*_lp)->field)    \
+      _prev = *_lp;                                        \
+    if (*_lp) {                                            \
+      KZ_LIST_UNLINK(_lp, field);                          \
+      if ((q)->tail == (p))                                \
+        (q)->tail = _prev;                                 \
+    }                                                      \
+  } while (0)
+
+#endif
@@ -0,0 +1,125 @@
+#include "defines.h"
+#include "serial.h"
+#include "lib.h"
+#include "cksum.h"
+#include "service.h"
+
+/*
+ * ブートローダがROMに持つライブラリ関数を使う(make ROMLIB=1 で lib.c, cksum.c の代わり)
+ * service.h のテーブルを経由して呼び出すので、OSのイメージには関数の本体を持たない。
+ * getc(), gets() は受信にブートローダのRAM上の変数を使うので、OS側に持つ。
+ */
+
+/* ブートローダがテーブルを持っているか（起動時に最初に確認する） */
+int romlib_check(void)
+{
+  const kzload_service_t *srv = KZLOAD_SERVICE;
+  char *p;
+
+  if ((srv->magic == KZLOAD_SERVICE_MAGIC)
+      && (srv->version >= KZLOAD_SERVICE_VERSION))
+    return 0;
+
+  /* puts()は使えないので、直接送信する */
+  for (p = "kzload has no service table.\r\n"; *p; p++)
+    serial_send_byte(SERIAL_DEFAULT_DEVICE, *p);
+  return -1;
+}
+
+void *memset(void *b, int c, long len)
+{
+  return KZLOAD_SERVICE->memset(b, c, len);
+}
+
+void *memcpy(void *dst, const void *src, long len)
+{
+  return KZLOAD_SERVICE->memcpy(dst, src, len);
+}
+
+int memcmp(const void *b1, const void *b2, long len)
+{
+  return KZLOAD_SERVICE->memcmp(b1, b2, len);
+}
+
+int strlen(const char *s)
+{
+  return KZLOAD_SERVICE->strlen(s);
+}
+
+char *strcpy(char *dst, const char *src)
+{
+  return KZLOAD_SERVICE->strcpy(dst, src);
+}
+
+int strcmp(const char *s1, const char *s2)
+{
+  return KZLOAD_SERVICE->strcmp(s1, s2);
+}
+
+int strncmp(const char *s1, const char *s2, int len)
+{
+  return KZLOAD_SERVICE->strncmp(s1, s2, len);
+}
+
+int putc(unsigned char c)
+{
+  return KZLOAD_SERVICE->putc(c);
+}
+
+unsigned char getc(void)
+{
+  unsigned char c = serial_recv_byte(SERIAL_DEFAULT_DEVICE);
+  c = (c == '\r') ? '\n' : c;
+  putc(c);
+  return c;
+}
+
+int puts(unsigned char *str)
+{
+  return KZLOAD_SERVICE->puts(str);
+}
+
+int gets(unsigned char *buf)
+{
+  int i = 0;
+  unsigned char c;
+
+  do {
+    c = getc();
+    if (c == '\n')
+      c = '\0';
+    buf[i++] = c;
+  } while (c);
+
+  return i - 1;
+}
+
+int putxval(unsigned long value, int column)
+{
+  return KZLOAD_SERVICE->putxval(value, column);
+}
+
+uint8 cksum_sum8(uint8 sum, const void *buf, long size)
+{
+  return KZLOAD_SERVICE->cksum_sum8(sum, buf, size);
+}
+
+uint16 cksum_crc16(uint16 crc, const void *buf, long size)
+{
+  return KZLOAD_SERVICE->cksum_crc16(crc, buf, size);
+}
+
+uint32 cksum_crc32(uint32 crc, const void *buf, long size)
+{
+  return KZLOAD_SERVICE->cksum_crc32(crc, buf, size);
+}
+
+uint32 cksum_inet(uint32 sum, const void *buf, long size)
+{
+  return KZLOAD_SERVICE->cksum_inet(sum, buf, size);
+}
+
+uint16 cksum_inet_fold(uint32 sum)
+{
+  return KZLOAD_SERVICE->cksum_inet_fold(sum);
+}
@@ -0,0 +1,339 @@
+#include "defines.h"
+#include "rtl8019.h"
+#include "interrupt.h"
+
+/*
+ * イーサネットコントローラ RTL8019AS(NE2000互換)の制御
+ * AKI-H8/3069F のLANボードでは、外部バスのエリア1(0x200000～)に8ビットバスで
+ * 接続され、レジスタは先頭から1バイトずつ並ぶ。割り込み(INT)は IRQ5 に
+ * 接続されている（Lレベルで要求する）。ボードの配線が異なる場合は、
+ * RTL8019_ADDR と RTL8019_IRQ を変更すること。
+ *
+ * 8ビットモードでは内蔵のバッファRAMのうちページ 0x40～0x5f(8KB)を使える。
+ * 先頭の6ページ(1536バイト)を送信バッファ、残りを受信リングにする。
+ * 受信したフレームの読み出しと送信するフレームの書き込みは、どちらも
+ * リモートDMA（データポートを読み書きする）で行うので、割り込み処理と
+ * スレッドから呼ぶ場合は、呼び出し側で排他すること。
+ */
+
+#define RTL8019_ADDR 0x200000
+#define RTL8019_IRQ  5
+
+#define RTL8019_REG(offset) ((volatile uint8 *)(RTL8019_ADDR + (offset)))
+
+/* ページ0（RTL8019_CR_PS の選択による） */
+#define RTL8019_CR     RTL8019_REG(0x00)
+#define RTL8019_PSTART RTL8019_REG(0x01)
+#define RTL8019_PSTOP  RTL8019_REG(0x02)
+#define RTL8019_BNRY   RTL8019_REG(0x03)
+#define RTL8019_TPSR   RTL8019_REG(0x04)
+#define RTL8019_TBCR0  RTL8019_REG(0x05)
+#define RTL8019_TBCR1  RTL8019_REG(0x06)
+#define RTL8019_ISR    RTL8019_REG(0x07)
+#define RTL8019_RSAR0  RTL8019_REG(0x08)
+#define RTL8019_RSAR1  RTL8019_REG(0x09)
+#define RTL8019_RBCR0  RTL8019_REG(0x0a)
+#define RTL8019_RBCR1  RTL8019_REG(0x0b)
+#define RTL8019_RCR    RTL8019_REG(0x0c)
+#define RTL8019_TCR    RTL8019_REG(0x0d)
+#define RTL8019_DCR    RTL8019_REG(0x0e)
+#define RTL8019_IMR    RTL8019_REG(0x0f)
+#define RTL8019_DATA   RTL8019_REG(0x10)
+#define RTL8019_RESET  RTL8019_REG(0x18)
+/* ページ1 */
+#define RTL8019_PAR(i) RTL8019_REG(0x01 + (i))
+#define RTL8019_CURR   RTL8019_REG(0x07)
+#define RTL8019_MAR(i) RTL8019_REG(0x08 + (i))
+
+#define RTL8019_CR_STP  (1<<0)
+#define RTL8019_CR_STA  (1<<1)
+#define RTL8019_CR_TXP  (1<<2)
+#define RTL8019_CR_RD_READ  (1<<3)
+#define RTL8019_CR_RD_WRITE (2<<3)
+#define RTL8019_CR_RD_ABORT (4<<3)
+#define RTL8019_CR_PS0  (0<<6)
+#define RTL8019_CR_PS1  (1<<6)
+
+#define RTL8019_ISR_RST (1<<7)
+
+#define RTL8019_DCR_LS  (1<<3) /* ループバックなし（通常動作） */
+#define RTL8019_DCR_FT1 (2<<5) /* FIFOのしきい値8バイト（8ビットバス） */
+
+#define RTL8019_RCR_AB  (1<<2) /* ブロードキャストを受信する */
+#define RTL8019_RCR_MON (1<<5) /* モニタモード（バッファに格納しない） */
+
+#define RTL8019_TCR_LB_INTERNAL (1<<1) /* 内部ループバック */
+
+/* バッファRAMのページ割り当て */
+#define RTL8019_TX_START 0x40
+#define RTL8019_RX_START 0x46
+#define RTL8019_RX_STOP  0x60
+
+/* 受信リング中のフレームのヘッダ */
+#define RTL8019_RXHDR_SIZE 4
+
+/* 外部バスと割り込み端子の設定 */
+#define H8_3069F_ABWCR ((volatile uint8 *)0xfee020)
+#define H8_3069F_ASTCR ((volatile uint8 *)0xfee021)
+#define H8_3069F_ISCR  ((volatile uint8 *)0xfee014)
+#define H8_3069F_IER   ((volatile uint8 *)0xfee015)
+#define H8_3069F_ISR   ((volatile uint8 *)0xfee016)
+
+#define H8_3069F_AREA1 (1<<1)
+
+/* リセットやリモートDMAの完了を待つ回数（応答がなければ諦める） */
+#define RTL8019_WAIT_COUNT 10000
+
+/* IMR はページ0では読み出せない(ページ2)ので、値を覚えておく */
+static uint8 intr_mask;
+
+static int rtl8019_wait(int bits)
+{
+  int i;
+
+  for (i = 0; i < RTL8019_WAIT_COUNT; i++) {
+    if (*RTL8019_ISR & bits)
+      return 0;
+  }
+  return -1;
+}
+
+/* リモートDMAの開始（command は RTL8019_CR_RD_READ か RTL8019_CR_RD_WRITE） */
+static void remote_dma_start(uint16 addr, uint16 size, uint8 command)
+{
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STA | RTL8019_CR_PS0;
+  *RTL8019_RSAR0 = addr & 0xff;
+  *RTL8019_RSAR1 = addr >> 8;
+  *RTL8019_RBCR0 = size & 0xff;
+  *RTL8019_RBCR1 = size >> 8;
+  *RTL8019_CR = command | RTL8019_CR_STA | RTL8019_CR_PS0;
+}
+
+static void remote_dma_end(void)
+{
+  rtl8019_wait(RTL8019_INTR_RDC);
+  *RTL8019_ISR = RTL8019_INTR_RDC;
+}
+
+static void remote_read(uint16 addr, char *buf, int size)
+{
+  remote_dma_start(addr, size, RTL8019_CR_RD_READ);
+  while (size-- > 0)
+    *(buf++) = *RTL8019_DATA;
+  remote_dma_end();
+}
+
+/* 受信リングの読み出し位置を、受信の書き込み位置の直前に戻す（全て捨てる） */
+static void ring_reset(void)
+{
+  *RTL8019_BNRY = RTL8019_RX_START;
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STA | RTL8019_CR_PS1;
+  *RTL8019_CURR = RTL8019_RX_START + 1;
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STA | RTL8019_CR_PS0;
+}
+
+/*
+ * 初期化（割り込みは全て禁止の状態になる。rtl8019_intr_enable() で許可する）
+ * MACアドレスを macaddr に返す。コントローラが応答しなければ -1 を返す。
+ */
+KZ_COLD int rtl8019_init(unsigned char *macaddr)
+{
+  char prom[RTL8019_MACADDR_SIZE * 2];
+  int i;
+
+  /*
+   * CS1(P83) を出力にして、エリア1を8ビットバス・3ステートアクセスにする
+   * (P8DDR は書き込み専用なので port8_ddr() で設定する)
+   */
+  port8_ddr(PORT8_CS1, 0);
+  *H8_3069F_ABWCR |= H8_3069F_AREA1;
+  *H8_3069F_ASTCR |= H8_3069F_AREA1;
+
+  /* リセットポートを読み書きするとリセットされる */
+  *RTL8019_RESET = *RTL8019_RESET;
+  if (rtl8019_wait(RTL8019_ISR_RST) < 0)
+    return -1;
+
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STP | RTL8019_CR_PS0;
+  *RTL8019_DCR = RTL8019_DCR_FT1 | RTL8019_DCR_LS;
+  *RTL8019_RBCR0 = 0;
+  *RTL8019_RBCR1 = 0;
+  *RTL8019_RCR = RTL8019_RCR_MON;
+  *RTL8019_TCR = RTL8019_TCR_LB_INTERNAL;
+  *RTL8019_TPSR = RTL8019_TX_START;
+  *RTL8019_PSTART = RTL8019_RX_START;
+  *RTL8019_BNRY = RTL8019_RX_START;
+  *RTL8019_PSTOP = RTL8019_RX_STOP;
+  *RTL8019_ISR = 0xff;
+  *RTL8019_IMR = 0;
+  intr_mask = 0;
+
+  /* MACアドレスをPROMから読む（8ビットモードでは各バイトが2回ずつ並ぶ） */
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STA | RTL8019_CR_PS0;
+  remote_read(0, prom, sizeof(prom));
+  for (i = 0; i < RTL8019_MACADDR_SIZE; i++)
+    macaddr[i] = prom[i * 2];
+
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STP | RTL8019_CR_PS1;
+  for (i = 0; i < RTL8019_MACADDR_SIZE; i++)
+    *RTL8019_PAR(i) = macaddr[i];
+  for (i = 0; i < 8; i++)
+    *RTL8019_MAR(i) = 0;
+  *RTL8019_CURR = RTL8019_RX_START + 1;
+
+  /* 受信開始（ユニキャストとブロードキャストのみ受信する） */
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STA | RTL8019_CR_PS0;
+  *RTL8019_ISR = 0xff;
+  *RTL8019_TCR = 0;
+  *RTL8019_RCR = RTL8019_RCR_AB;
+
+  /* IRQ はLレベルで要求とし、許可しておく（要因は IMR で選ぶ） */
+  *H8_3069F_ISCR &= ~(1 << RTL8019_IRQ);
+  *H8_3069F_ISR &= ~(1 << RTL8019_IRQ);
+  *H8_3069F_IER |= (1 << RTL8019_IRQ);
+
+  return 0;
+}
+
+/* 発生している割り込み要因のうち、許可しているもの(RTL8019_INTR_*) */
+int rtl8019_intr_status(void)
+{
+  return *RTL8019_ISR & intr_mask;
+}
+
+/* 割り込み要因のクリア（1を書いたビットがクリアされる） */
+void rtl8019_intr_clear(int bits)
+{
+  *RTL8019_ISR = bits;
+}
+
+void rtl8019_intr_enable(int bits)
+{
+  intr_mask |= bits;
+  *RTL8019_IMR = intr_mask;
+}
+
+void rtl8019_intr_disable(int bits)
+{
+  intr_mask &= ~bits;
+  *RTL8019_IMR = intr_mask;
+}
+
+/* IRQ の割り込み要求フラグのクリア（コントローラの要因をクリアしてから呼ぶ） */
+void rtl8019_irq_clear(void)
+{
+  *H8_3069F_ISR &= ~(1 << RTL8019_IRQ);
+}
+
+/*
+ * 受信リングから次のフレームを buf に読み出し、フレーム長を返す
+ * 受信済みのフレームがなければ0を返す。size より長いフレームや受信エラーの
+ * フレームは捨てて -1 を返す（次のフレームは続けて読める）。
+ * リングの内容が壊れていれば、リングを空にして -2 を返す。
+ */
+int rtl8019_recv(char *buf, int size)
+{
+  unsigned char hdr[RTL8019_RXHDR_SIZE];
+  uint8 page, curr, next;
+  int len, ret;
+
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STA | RTL8019_CR_PS1;
+  curr = *RTL8019_CURR;
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STA | RTL8019_CR_PS0;
+
+  /* 読み出し位置は BNRY の次のページ */
+  page = *RTL8019_BNRY + 1;
+  if (page >= RTL8019_RX_STOP)
+    page = RTL8019_RX_START;
+  if (page == curr)
+    return 0;
+
+  /* ヘッダ: 受信状態, 次のフレームのページ, 長さ（ヘッダとCRCを含む） */
+  remote_read((uint16)page << 8, (char *)hdr, sizeof(hdr));
+  next = hdr[1];
+  len = (hdr[2] | ((int)hdr[3] << 8)) - RTL8019_RXHDR_SIZE;
+  if ((next < RTL8019_RX_START) || (next >= RTL8019_RX_STOP)
+      || (len < RTL8019_FRAME_MIN) || (len > RTL8019_FRAME_MAX + 4)) {
+    ring_reset();
+    return -2;
+  }
+  len -= 4; /* CRC */
+
+  if (!(hdr[0] & 1) || (len > size)) { /* bit0: 正常に受信した(PRX) */
+    ret = -1;
+  } else {
+    /* リモートDMAはリングの終端で先頭に折り返して読み出される */
+    remote_read(((uint16)page << 8) + RTL8019_RXHDR_SIZE, buf, len);
+    ret = len;
+  }
+
+  /* 読み出したページを解放する（BNRY は次のフレームの直前のページ） */
+  *RTL8019_BNRY = (next == RTL8019_RX_START) ? RTL8019_RX_STOP - 1 : next - 1;
+  return ret;
+}
+
+/*
+ * 受信リングのオーバーフローからの復帰
+ * 受信を止めて、リング中のフレームを全て捨ててから再開する。
+ */
+void rtl8019_recover(void)
+{
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STP | RTL8019_CR_PS0;
+  *RTL8019_RBCR0 = 0;
+  *RTL8019_RBCR1 = 0;
+  rtl8019_wait(RTL8019_ISR_RST);
+  *RTL8019_TCR = RTL8019_TCR_LB_INTERNAL;
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_STA | RTL8019_CR_PS0;
+  ring_reset();
+  *RTL8019_ISR = RTL8019_INTR_OVW | RTL8019_INTR_PRX | RTL8019_INTR_RXE;
+  *RTL8019_TCR = 0;
+}
+
+/*
+ * フレームの送信（送信中(前の送信の完了の割り込みの前)に呼んではいけない）
+ * rtl8019_send_begin() でフレーム長を指定し、rtl8019_send_data() で
+ * 先頭から順に書き込み（分けて書き込んでよい）、rtl8019_send_end() で
+ * 送信を開始する。最小長に満たない分は0で埋める。
+ */
+static int send_len;  /* 書き込む残りのバイト数 */
+static int send_size; /* 送信するフレーム長（最小長以上） */
+
+int rtl8019_send_begin(int size)
+{
+  if ((size <= 0) || (size > RTL8019_FRAME_MAX))
+    return -1;
+  send_size = (size < RTL8019_FRAME_MIN) ? RTL8019_FRAME_MIN : size;
+  send_len = send_size;
+  remote_dma_start((uint16)RTL8019_TX_START << 8, send_size,
+                   RTL8019_CR_RD_WRITE);
+  return 0;
+}
+
+void rtl8019_send_data(char *buf, int size)
+{
+  for (; (size > 0) && (send_len > 0); size--, send_len--)
+    *RTL8019_DATA = *(buf++);
+}
+
+void rtl8019_send_end(void)
+{
+  for (; send_len > 0; send_len--)
+    *RTL8019_DATA = 0;
+  remote_dma_end();
+
+  *RTL8019_TPSR = RTL8019_TX_START;
+  *RTL8019_TBCR0 = send_size & 0xff;
+  *RTL8019_TBCR1 = send_size >> 8;
+  *RTL8019_CR = RTL8019_CR_RD_ABORT | RTL8019_CR_TXP | RTL8019_CR_STA
+    | RTL8019_CR_PS0;
+}
+
+/* 1つのバッファのフレームの送信 */
+int rtl8019_send(char *buf, int size)
+{
+  if (rtl8019_send_begin(size) < 0)
+    return -1;
+  rtl8019_send_data(buf, size);
+  rtl8019_send_end();
+  return 0;
+}
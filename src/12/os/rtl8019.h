@@ -0,0 +1,29 @@
+#ifndef _RTL8019_H_INCLUDED_
+#define _RTL8019_H_INCLUDED_
+
+#define RTL8019_MACADDR_SIZE 6
+#define RTL8019_FRAME_MIN    60   /* CRCを除く最小のフレーム長（短ければ0で埋める） */
+#define RTL8019_FRAME_MAX    1514 /* CRCを除く最大のフレーム長 */
+
+/* 割り込み要因(ISR/IMR のビット、rtl8019_intr_status() の戻り値) */
+#define RTL8019_INTR_PRX (1<<0) /* 受信完了 */
+#define RTL8019_INTR_PTX (1<<1) /* 送信完了 */
+#define RTL8019_INTR_RXE (1<<2) /* 受信エラー */
+#define RTL8019_INTR_TXE (1<<3) /* 送信エラー（衝突の回数超過など） */
+#define RTL8019_INTR_OVW (1<<4) /* 受信リングのオーバーフロー */
+#define RTL8019_INTR_RDC (1<<6) /* リモートDMAの完了（ドライバ内部で使う） */
+
+int rtl8019_init(unsigned char *macaddr);
+int rtl8019_intr_status(void);
+void rtl8019_intr_clear(int bits);
+void rtl8019_intr_enable(int bits);
+void rtl8019_intr_disable(int bits);
+void rtl8019_irq_clear(void);
+int rtl8019_recv(char *buf, int size);
+void rtl8019_recover(void);
+int rtl8019_send_begin(int size);
+void rtl8019_send_data(char *buf, int size);
+void rtl8019_send_end(void);
+int rtl8019_send(char *buf, int size);
+
+#endif
@@ -1,8 +1,6 @@
 #include "defines.h"
 #include "serial.h"
 
-#define SERIAL_SCI_NUM 3
-
 #define H8_3069F_SCI0 ((volatile struct h8_3069f_sci *)0xffffb0)
 #define H8_3069F_SCI1 ((volatile struct h8_3069f_sci *)0xffffb8)
 #define H8_3069F_SCI2 ((volatile struct h8_3069f_sci *)0xffffc0)
@@ -46,15 +44,37 @@ struct h8_3069f_sci {
 #define H8_3069F_SCI_SSR_RDRF   (1<<6)
 #define H8_3069F_SCI_SSR_TDRE   (1<<7)
 
+/*
+ * DMAC(ショートアドレスモード)のチャネルのレジスタ
+ * 起動要因に使えるSCIの割り込みはSCI0のTXI/RXIのみなので、
+ * SCI0の送信にチャネル0Aを使う。
+ */
+#define H8_3069F_DMAC0A ((volatile struct h8_3069f_dmac *)0xffff20)
+
+struct h8_3069f_dmac {
+    volatile uint32 mar;  /* メモリアドレス(下位24ビット) */
+    volatile uint16 etcr; /* 転送回数 */
+    volatile uint8 ioar;  /* I/Oアドレス(0xffffXX の下位8ビット) */
+    volatile uint8 dtcr;
+};
+
+#define H8_3069F_DMAC_DTCR_DTS_TXI0 (4<<0) /* 起動要因: SCI0のTXI */
+#define H8_3069F_DMAC_DTCR_DTIE     (1<<3)
+#define H8_3069F_DMAC_DTCR_RPE      (1<<4)
+#define H8_3069F_DMAC_DTCR_DTID     (1<<5)
+#define H8_3069F_DMAC_DTCR_DTSZ     (1<<6)
+#define H8_3069F_DMAC_DTCR_DTE      (1<<7)
+
 static struct {
     volatile struct h8_3069f_sci *sci;
-} regs[SERIAL_SCI_NUM] = {
-    { H8_3069F_SCI0 },
-    { H8_3069F_SCI1 },
-    { H8_3069F_SCI2 },
+    volatile struct h8_3069f_dmac *dmac; /* 送信に使うDMAC(なければNULL) */
+} regs[SERIAL_DEVICE_NUM] = {
+    { H8_3069F_SCI0, H8_3069F_DMAC0A },
+    { H8_3069F_SCI1, NULL },
+    { H8_3069F_SCI2, NULL },
 };
 
-int serial_init(int index)
+KZ_COLD int serial_init(int index)
 {
     volatile struct h8_3069f_sci *sci = regs[index].sci;
 
@@ -67,6 +87,73 @@ int serial_init(int index)
     return 0;
 }
 
+/*
+ * ボーレートの設定値(φ=20MHz)
+ * BRR = φ / (64 * 2^(2n-1) * B) - 1 (n は SMR の CKS の値)
+ * 115200bps は誤差が8%を超えるので使えない（近い値は125000bpsになる）
+ */
+static const struct {
+    long rate;
+    uint8 cks;
+    uint8 brr;
+} baud_table[] = {
+    {   2400, H8_3069F_SCI_SMR_CKS_PER4, 64  }, /* 誤差 0.16% */
+    {   4800, H8_3069F_SCI_SMR_CKS_PER1, 129 }, /* 誤差 0.16% */
+    {   9600, H8_3069F_SCI_SMR_CKS_PER1, 64  }, /* 誤差 0.16% */
+    {  19200, H8_3069F_SCI_SMR_CKS_PER1, 32  }, /* 誤差-1.36% */
+    {  31250, H8_3069F_SCI_SMR_CKS_PER1, 19  }, /* 誤差 0% */
+    {  38400, H8_3069F_SCI_SMR_CKS_PER1, 15  }, /* 誤差 1.73% */
+    {  57600, H8_3069F_SCI_SMR_CKS_PER1, 10  }, /* 誤差-1.36% */
+    { 125000, H8_3069F_SCI_SMR_CKS_PER1, 4   }, /* 誤差 0% */
+};
+
+/*
+ * ボーレートの変更
+ * 送信中のデータの送信完了を待ってから、送受信を一旦止めて設定する。
+ * 表にないボーレートならば -1 を返す。
+ */
+KZ_COLD int serial_set_baud(int index, long rate)
+{
+    volatile struct h8_3069f_sci *sci = regs[index].sci;
+    volatile int i;
+    uint8 scr;
+    int n;
+
+    for (n = 0; n < sizeof(baud_table) / sizeof(baud_table[0]); n++) {
+        if (baud_table[n].rate == rate)
+            break;
+    }
+    if (n == sizeof(baud_table) / sizeof(baud_table[0]))
+        return -1;
+
+    while (!(sci->ssr & H8_3069F_SCI_SSR_TEND))
+        ;
+
+    scr = sci->scr;
+    sci->scr = 0;
+    sci->smr = (sci->smr & ~H8_3069F_SCI_SMR_CKS_PER64) | baud_table[n].cks;
+    sci->brr = baud_table[n].brr;
+
+    /* 1ビット期間以上待ってから送受信を再開する */
+    for (i = 0; i < 1000; i++)
+        ;
+    sci->scr = scr;
+
+    return 0;
+}
+
+/*
+ * 現在のボーレートでの1文字(スタート+8ビット+ストップの10ビット)の時間
+ * kz_gettime() のカウント数(φ/8)で返す。1ビットは φ の 32*4^n*(BRR+1) 倍
+ * なので、10ビットでは 40*4^n*(BRR+1) カウントになる（除算を使わない）
+ */
+uint32 serial_char_time(int index)
+{
+    volatile struct h8_3069f_sci *sci = regs[index].sci;
+
+    return (uint32)40 * (sci->brr + 1) << ((sci->smr & H8_3069F_SCI_SMR_CKS_PER64) * 2);
+}
+
 int serial_is_send_enable(int index)
 {
     volatile struct h8_3069f_sci *sci = regs[index].sci;
@@ -85,6 +172,31 @@ int serial_send_byte(int index, unsigned char c)
     return 0;
 }
 
+/*
+ * DMACによるブロック送信の開始
+ * 送信データエンプティ(TXI)ごとにDMACが1バイトずつ送信データレジスタに
+ * 転送する(DMACが書き込むとTDREはクリアされる)。起動要因のTXIは
+ * CPUへは通知されず、転送が終わってDTEがクリアされた後のTXIが
+ * CPUへの割り込みになるので、送信割り込みは有効にしておくこと。
+ * DMACを使えないチャネルならば -1 を返す。
+ */
+int serial_dma_send(int index, unsigned char *buf, int len)
+{
+    volatile struct h8_3069f_sci *sci = regs[index].sci;
+    volatile struct h8_3069f_dmac *dmac = regs[index].dmac;
+
+    if (!dmac || (dmac->dtcr & H8_3069F_DMAC_DTCR_DTE))
+        return -1;
+
+    dmac->mar = (uint32)buf;
+    dmac->etcr = len;
+    dmac->ioar = (uint8)(uint32)&sci->tdr;
+    /* バイト転送・アドレス増加・リピートなし・転送終了割り込みなし */
+    dmac->dtcr = H8_3069F_DMAC_DTCR_DTE | H8_3069F_DMAC_DTCR_DTS_TXI0;
+
+    return 0;
+}
+
 int serial_is_recv_enable(int index)
 {
   volatile struct h8_3069f_sci *sci = regs[index].sci;
@@ -123,6 +235,23 @@ void serial_intr_send_disable(int index)
   sci->scr &= ~H8_3069F_SCI_SCR_TIE;
 }
 
+/*
+ * 送信終了割り込み(TEI)の有効化・無効化
+ * TENDは送信データレジスタに書き込むまで1のままなので、割り込みハンドラで
+ * 無効にすること
+ */
+void serial_intr_send_end_enable(int index)
+{
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+  sci->scr |= H8_3069F_SCI_SCR_TEIE;
+}
+
+void serial_intr_send_end_disable(int index)
+{
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+  sci->scr &= ~H8_3069F_SCI_SCR_TEIE;
+}
+
 int serial_intr_is_recv_enable(int index)
 {
   volatile struct h8_3069f_sci *sci = regs[index].sci;
@@ -140,3 +269,110 @@ void serial_intr_recv_disable(int index)
   volatile struct h8_3069f_sci *sci = regs[index].sci;
   sci->scr &= ~H8_3069F_SCI_SCR_RIE;
 }
+
+/*
+ * RTS/CTSのフロー制御に使う端子(ポートB, 負論理)
+ * チャネル n の RTS は PB(2n)(出力), CTS は PB(2n+1)(入力)とする。
+ * PBDDRは書き込み専用なので、設定値を pbddr に覚えておく。
+ */
+#define H8_3069F_PBDDR ((volatile uint8 *)0xfee00a)
+#define H8_3069F_PBDR  ((volatile uint8 *)0xffffda)
+
+#define SERIAL_RTS_BIT(index) (1 << ((index) << 1))
+#define SERIAL_CTS_BIT(index) (1 << (((index) << 1) + 1))
+
+static uint8 pbddr;
+
+/* フロー制御の端子の初期化（RTSを出力にして、受信可能にする） */
+int serial_flow_init(int index)
+{
+  *H8_3069F_PBDR &= ~SERIAL_RTS_BIT(index);
+  pbddr |= SERIAL_RTS_BIT(index);
+  pbddr &= ~SERIAL_CTS_BIT(index);
+  *H8_3069F_PBDDR = pbddr;
+  return 0;
+}
+
+/*
+ * RTSの設定（ready が0ならば相手に送信を止めさせる）
+ * ポートBの他のビットと共用しているので、割り込み禁止で呼ぶこと
+ */
+void serial_rts_set(int index, int ready)
+{
+  if (ready)
+    *H8_3069F_PBDR &= ~SERIAL_RTS_BIT(index);
+  else
+    *H8_3069F_PBDR |= SERIAL_RTS_BIT(index);
+}
+
+/* CTSの状態（相手が受信可能ならば1） */
+int serial_cts_is_ready(int index)
+{
+  return (*H8_3069F_PBDR & SERIAL_CTS_BIT(index)) ? 0 : 1;
+}
+
+/* チャネルごとの受信エラーの回数 */
+static serial_errstat_t errstat[SERIAL_DEVICE_NUM];
+
+/*
+ * 受信エラー（オーバーラン・フレーミング・パリティ）のクリア
+ * エラーフラグが立っている間は受信が止まるので、受信エラー割り込みで呼ぶこと。
+ * 要因ごとに回数を数えておく。
+ */
+void serial_recv_error_clear(int index)
+{
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+  uint8 ssr = sci->ssr;
+
+  if (ssr & H8_3069F_SCI_SSR_ORER)
+    errstat[index].overrun++;
+  if (ssr & H8_3069F_SCI_SSR_FERERS)
+    errstat[index].framing++;
+  if (ssr & H8_3069F_SCI_SSR_PER)
+    errstat[index].parity++;
+  sci->ssr &= ~(H8_3069F_SCI_SSR_ORER | H8_3069F_SCI_SSR_FERERS
+                | H8_3069F_SCI_SSR_PER);
+}
+
+/* 受信エラーの回数の取得（読み出すだけなので、スレッドから直接呼んでよい） */
+int serial_get_errstat(int index, serial_errstat_t *statp)
+{
+  *statp = errstat[index];
+  return 0;
+}
+
+/* 送信が完了しているか（送信データレジスタ・シフトレジスタとも空） */
+int serial_is_send_done(int index)
+{
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+  return (sci->ssr & H8_3069F_SCI_SSR_TEND);
+}
+
+/*
+ * ソフトウェアスタンバイの前後の設定の保存と復帰（power.c から呼ぶ）
+ * スタンバイ中はSCIが初期化されるので、SMR/BRR/SCR を書き戻す。
+ */
+static struct {
+  uint8 smr;
+  uint8 brr;
+  uint8 scr;
+} saved[SERIAL_DEVICE_NUM];
+
+void serial_save(int index)
+{
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+
+  saved[index].smr = sci->smr;
+  saved[index].brr = sci->brr;
+  saved[index].scr = sci->scr;
+}
+
+void serial_restore(int index)
+{
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+
+  sci->scr = 0;
+  sci->smr = saved[index].smr;
+  sci->brr = saved[index].brr;
+  sci->scr = saved[index].scr;
+}
@@ -1,16 +1,38 @@
 #ifndef _SERIAL_H_INCLUDED_
 #define _SERIAL_H_INCLUDED_
 
+#define SERIAL_DEVICE_NUM 3 /* SCIのチャネル数 */
+
+/* 受信エラーの回数（serial_get_errstat()で取得する） */
+typedef struct {
+  uint16 overrun; /* オーバーランエラー */
+  uint16 framing; /* フレーミングエラー */
+  uint16 parity;  /* パリティエラー */
+} serial_errstat_t;
+
 int serial_init(int index);
+int serial_set_baud(int index, long rate);
+uint32 serial_char_time(int index);
 int serial_is_send_enable(int index);
 int serial_send_byte(int index, unsigned char b);
+int serial_dma_send(int index, unsigned char *buf, int len);
 int serial_is_recv_enable(int index);
 unsigned char serial_recv_byte(int index);
 int serial_intr_is_send_enable(int index);
 void serial_intr_send_enable(int index);
 void serial_intr_send_disable(int index);
+void serial_intr_send_end_enable(int index);
+void serial_intr_send_end_disable(int index);
 int serial_intr_is_recv_enable(int index);
 void serial_intr_recv_enable(int index);
 void serial_intr_recv_disable(int index);
+void serial_recv_error_clear(int index);
+int serial_get_errstat(int index, serial_errstat_t *statp);
+int serial_flow_init(int index);
+void serial_rts_set(int index, int ready);
+int serial_cts_is_ready(int index);
+int serial_is_send_done(int index);
+void serial_save(int index);
+void serial_restore(int index);
 
 #endif
@@ -0,0 +1,213 @@
+#include "defines.h"
+#include "kozos.h"
+#include "interrupt.h"
+#include "lib.h"
+#include "shbuf.h"
+
+/*
+ * スレッド間の共有バッファ（shbuf.h を参照）
+ * バッファは固定数の表で管理し、トークンは表の位置と世代番号から作る。
+ * 世代番号は削除のたびに進めるので、削除済みのトークンは一致しなくなる。
+ * 所有者の変更は割り込みをマスクして行い、give と take が重なっても
+ * 所有者が2つになることはない。
+ */
+
+#define SHBUF_INDEX_BITS 8
+#define SHBUF_GEN_MASK   0x7f /* トークンが16ビットの int でも正になるように */
+
+#define SHBUF_TOKEN(i, gen) (((gen) << SHBUF_INDEX_BITS) | (i))
+#define SHBUF_TOKEN_INDEX(buf) ((buf) & ((1 << SHBUF_INDEX_BITS) - 1))
+#define SHBUF_TOKEN_GEN(buf)   (((buf) >> SHBUF_INDEX_BITS) & SHBUF_GEN_MASK)
+
+static struct shbuf {
+  char name[SHBUF_NAME_SIZE]; /* 空ならば未使用 */
+  char *p;
+  int size;
+  int gen;
+  kz_thread_id_t owner; /* 所有者（受け渡し中は0） */
+  kz_thread_id_t to;    /* 受け渡し先（0ならば誰でもよい） */
+  int pending;          /* kz_buf_give() されて、まだ受け取られていない */
+} shbufs[SHBUF_NUM];
+
+/* トークンに対応するバッファ（不正なトークンならば NULL） */
+static struct shbuf *shbuf_get(kz_buf_t buf)
+{
+  struct shbuf *sb;
+
+  if ((buf < 0) || (SHBUF_TOKEN_INDEX(buf) >= SHBUF_NUM))
+    return NULL;
+  sb = &shbufs[SHBUF_TOKEN_INDEX(buf)];
+  if (!sb->name[0] || (sb->gen != SHBUF_TOKEN_GEN(buf)))
+    return NULL;
+  return sb;
+}
+
+/*
+ * バッファの作成（トークンを返す）
+ * 外部DRAMに size バイトを確保し、呼び出したスレッドを所有者にする。
+ * 同じ名前のバッファがあれば KZ_ERR_STATE、表か領域が足りなければ
+ * KZ_ERR_NORES を返す。
+ */
+kz_buf_t kz_buf_create(char *name, int size)
+{
+  kz_thread_id_t self = kz_getid();
+  struct shbuf *sb = NULL;
+  char *p;
+  int i, ceiling;
+
+  if (!name || !name[0] || (strlen(name) >= SHBUF_NAME_SIZE) || (size <= 0))
+    return KZ_ERR_PARAM;
+
+  p = kz_dmalloc(size);
+  if (!p)
+    return KZ_ERR_NORES;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  for (i = 0; i < SHBUF_NUM; i++) {
+    if (!shbufs[i].name[0]) {
+      if (!sb)
+        sb = &shbufs[i];
+    } else if (!strcmp(shbufs[i].name, name)) {
+      kz_unlock_ceiling(ceiling);
+      kz_dmfree(p);
+      return KZ_ERR_STATE;
+    }
+  }
+  if (!sb) {
+    kz_unlock_ceiling(ceiling);
+    kz_dmfree(p);
+    return KZ_ERR_NORES;
+  }
+  strcpy(sb->name, name);
+  sb->p       = p;
+  sb->size    = size;
+  sb->owner   = self;
+  sb->to      = 0;
+  sb->pending = 0;
+  kz_unlock_ceiling(ceiling);
+
+  return SHBUF_TOKEN(sb - shbufs, sb->gen);
+}
+
+/* 名前からトークンを得る（なければ KZ_ERR_PARAM） */
+kz_buf_t kz_buf_find(char *name)
+{
+  kz_buf_t buf = KZ_ERR_PARAM;
+  int i, ceiling;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  for (i = 0; i < SHBUF_NUM; i++) {
+    if (shbufs[i].name[0] && !strcmp(shbufs[i].name, name)) {
+      buf = SHBUF_TOKEN(i, shbufs[i].gen);
+      break;
+    }
+  }
+  kz_unlock_ceiling(ceiling);
+
+  return buf;
+}
+
+/* バッファの削除（所有者のみ。所有者でなければ KZ_ERR_STATE） */
+int kz_buf_delete(kz_buf_t buf)
+{
+  kz_thread_id_t self = kz_getid();
+  struct shbuf *sb;
+  char *p;
+  int ceiling;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  sb = shbuf_get(buf);
+  if (!sb) {
+    kz_unlock_ceiling(ceiling);
+    return KZ_ERR_PARAM;
+  }
+  if (sb->owner != self) {
+    kz_unlock_ceiling(ceiling);
+    return KZ_ERR_STATE;
+  }
+  p = sb->p;
+  sb->name[0] = '\0';
+  sb->p = NULL;
+  sb->owner = 0;
+  sb->gen = (sb->gen + 1) & SHBUF_GEN_MASK;
+  kz_unlock_ceiling(ceiling);
+
+  kz_dmfree(p);
+
+  return 0;
+}
+
+/* 所有しているバッファの領域（所有者でなければ NULL） */
+char *kz_buf_ptr(kz_buf_t buf, int *sizep)
+{
+  kz_thread_id_t self = kz_getid();
+  struct shbuf *sb;
+  char *p = NULL;
+  int ceiling;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  sb = shbuf_get(buf);
+  if (sb && (sb->owner == self)) {
+    p = sb->p;
+    if (sizep)
+      *sizep = sb->size;
+  }
+  kz_unlock_ceiling(ceiling);
+
+  return p;
+}
+
+/*
+ * 所有権の受け渡し（所有者のみ）
+ * to のスレッド（0ならば任意のスレッド）が kz_buf_take() するまで、
+ * 所有者はいなくなる。トークンは呼び出し側でメッセージなどで渡す。
+ */
+int kz_buf_give(kz_buf_t buf, kz_thread_id_t to)
+{
+  kz_thread_id_t self = kz_getid();
+  struct shbuf *sb;
+  int ceiling;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  sb = shbuf_get(buf);
+  if (!sb) {
+    kz_unlock_ceiling(ceiling);
+    return KZ_ERR_PARAM;
+  }
+  if (sb->owner != self) {
+    kz_unlock_ceiling(ceiling);
+    return KZ_ERR_STATE;
+  }
+  sb->owner   = 0;
+  sb->to      = to;
+  sb->pending = 1;
+  kz_unlock_ceiling(ceiling);
+
+  return 0;
+}
+
+/*
+ * 所有権の受け取り（領域を返す）
+ * kz_buf_give() で自分宛て（または宛先なし）に渡されていなければ NULL。
+ */
+char *kz_buf_take(kz_buf_t buf, int *sizep)
+{
+  kz_thread_id_t self = kz_getid();
+  struct shbuf *sb;
+  char *p = NULL;
+  int ceiling;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  sb = shbuf_get(buf);
+  if (sb && sb->pending && (!sb->to || (sb->to == self))) {
+    sb->owner   = self;
+    sb->to      = 0;
+    sb->pending = 0;
+    p = sb->p;
+    if (sizep)
+      *sizep = sb->size;
+  }
+  kz_unlock_ceiling(ceiling);
+
+  return p;
+}
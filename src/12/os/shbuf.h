@@ -0,0 +1,31 @@
+#ifndef _KOZOS_SHBUF_H_INCLUDED_
+#define _KOZOS_SHBUF_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * スレッド間の共有バッファ（所有権つき）
+ * 名前つきのバッファを kz_buf_create() で一度だけ外部DRAMに獲得し、
+ * 以後はトークン(kz_buf_t)をメッセージで渡してスレッド間で受け渡す。
+ * バッファには常に所有者が1つだけあり、所有者以外は内容を参照できない
+ * （kz_buf_ptr() が NULL を返す）。受け渡しは次の手順で行う。
+ *   送る側:   kz_buf_give(buf, to); kz_send(mbox, buf, NULL);
+ *   受ける側: kz_recv(mbox, &buf, NULL); p = kz_buf_take(buf, &size);
+ * kz_buf_give() した時点で送る側は所有権を失うので、送った後に書き換える
+ * ことはできない。このため受ける側は、防御的にコピーしなくてよい。
+ * to を0にすると、どのスレッドでも受け取れる。
+ * トークンには世代を含むので、削除した後のトークンは全ての操作で失敗する。
+ * 所有したまま終了したスレッドのバッファは、kz_buf_delete() できなくなる。
+ * スレッドから呼ぶこと（割り込みハンドラからは使えない）。
+ */
+
+typedef int kz_buf_t; /* トークン（負の値はエラー） */
+
+kz_buf_t kz_buf_create(char *name, int size);
+kz_buf_t kz_buf_find(char *name);
+int kz_buf_delete(kz_buf_t buf);
+char *kz_buf_ptr(kz_buf_t buf, int *sizep);
+int kz_buf_give(kz_buf_t buf, kz_thread_id_t to);
+char *kz_buf_take(kz_buf_t buf, int *sizep);
+
+#endif
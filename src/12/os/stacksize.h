@@ -0,0 +1,42 @@
+#ifndef _KOZOS_STACKSIZE_H_INCLUDED_
+#define _KOZOS_STACKSIZE_H_INCLUDED_
+
+/*
+ * main.c で起動するスレッドのスタックサイズ
+ * make stacksize WATERMARK=<ファイル> で、実機の stack コマンドの出力と
+ * スタック使用量の解析(make stack)から推奨値を求めて作り直す。
+ * 作り直す前の値は、推奨値が求まらなかったスレッドにそのまま残る。
+ */
+
+#ifndef STACKSIZE_DEFER
+#define STACKSIZE_DEFER 0x100
+#endif
+#ifndef STACKSIZE_CONSDRV
+#define STACKSIZE_CONSDRV 0x200
+#endif
+#ifndef STACKSIZE_NETDRV
+#define STACKSIZE_NETDRV 0x200
+#endif
+#ifndef STACKSIZE_NET
+#define STACKSIZE_NET 0x200
+#endif
+#ifndef STACKSIZE_ADCDRV
+#define STACKSIZE_ADCDRV 0x100
+#endif
+#ifndef STACKSIZE_BUSDRV
+#define STACKSIZE_BUSDRV 0x100
+#endif
+#ifndef STACKSIZE_COMMAND
+#define STACKSIZE_COMMAND 0x200
+#endif
+#ifndef STACKSIZE_LOG
+#define STACKSIZE_LOG 0x200
+#endif
+#ifndef STACKSIZE_GDBSTUB
+#define STACKSIZE_GDBSTUB 0x200
+#endif
+#ifndef STACKSIZE_BENCH
+#define STACKSIZE_BENCH 0x200
+#endif
+
+#endif
@@ -22,3 +22,18 @@ _dispatch:
     mov.l    @er7+,er5
     mov.l    @er7+,er6
     rte
+
+    .global _fiber_switch
+#   .type   _fiber_switch,@function
+
+# ファイバの切り替え(fiber.c) er0: スタックポインタの保存先, er1: 切り替え先
+_fiber_switch:
+    mov.l    er6,@-er7
+    mov.l    er5,@-er7
+    mov.l    er4,@-er7
+    mov.l    er7,@er0
+    mov.l    er1,er7
+    mov.l    @er7+,er4
+    mov.l    @er7+,er5
+    mov.l    @er7+,er6
+    rts
@@ -0,0 +1,44 @@
+#include "defines.h"
+#include "symtab.h"
+
+/*
+ * 組み込みのシンボル表の検索（symtab.h を参照）
+ * 表はアドレス順なので、addr 以下で最大のアドレスの関数を二分探索する。
+ * 最後の関数より後ろのアドレスも最後の関数とみなすので、
+ * コード以外のアドレスを渡さないこと。
+ */
+
+/* addr を含む関数の表の位置（表が空か、最初の関数より前ならば -1） */
+int kz_symbol_index(uint32 addr)
+{
+  int lo = 0, hi = kz_symtab_num - 1, mid;
+
+  if (!kz_symtab_num || (addr < kz_symtab[0].addr))
+    return -1;
+  while (lo < hi) {
+    mid = (lo + hi + 1) >> 1;
+    if (kz_symtab[mid].addr <= addr)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+/* 表の位置の関数の名前 */
+char *kz_symbol_name(int index)
+{
+  return (char *)kz_symnames + kz_symtab[index].name;
+}
+
+/* addr を含む関数の名前と、先頭からのオフセット（なければ NULL） */
+char *kz_symbol(uint32 addr, uint32 *offsetp)
+{
+  int index = kz_symbol_index(addr);
+
+  if (index < 0)
+    return NULL;
+  if (offsetp)
+    *offsetp = addr - kz_symtab[index].addr;
+  return kz_symbol_name(index);
+}
@@ -0,0 +1,31 @@
+#ifndef _KOZOS_SYMTAB_H_INCLUDED_
+#define _KOZOS_SYMTAB_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * 組み込みのシンボル表（make SYMTAB=1 で組み込む, KZ_SYMTAB）
+ * 関数のアドレスと名前の表をイメージに含めて、クラッシュ時のPCや
+ * プロファイラのサンプルを、ホストに kozos.elf がなくても関数名で表示する。
+ *
+ * 表(syms.c)はリンク後のシンボルから tools/kzsymtab で作成し、
+ * もう一度リンクし直して組み込む。表は .kzsyms セクションとして
+ * 外部DRAMのコードの後ろに置くので(ld.scr)、組み込んでも関数の配置は
+ * 変わらない。要素はアドレス順で、1要素6バイト。
+ */
+typedef struct {
+  uint32 addr; /* 関数の先頭アドレス */
+  uint16 name; /* kz_symnames の中の名前の位置 */
+} kz_symbol_t;
+
+#define KZ_SYMTAB_SECTION __attribute__((section(".kzsyms")))
+
+extern const int kz_symtab_num;
+extern const kz_symbol_t kz_symtab[];
+extern const char kz_symnames[];
+
+int kz_symbol_index(uint32 addr);
+char *kz_symbol_name(int index);
+char *kz_symbol(uint32 addr, uint32 *offsetp);
+
+#endif
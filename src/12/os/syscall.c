@@ -31,9 +31,10 @@ int kz_wait(void)
   return param.un.wait.ret;
 }
 
-int kz_sleep(void)
+int kz_sleep(int ticks)
 {
   kz_syscall_param_t param;
+  param.un.sleep.ticks = ticks;
   kz_syscall(KZ_SYSCALL_TYPE_SLEEP, &param);
   return param.un.sleep.ret;
 }
@@ -46,11 +47,20 @@ int kz_wakeup(kz_thread_id_t id)
   return param.un.wakeup.ret;
 }
 
-kz_thread_id_t kz_getid(void)
+int kz_suspend(kz_thread_id_t id)
 {
   kz_syscall_param_t param;
-  kz_syscall(KZ_SYSCALL_TYPE_GETID, &param);
-  return param.un.getid.ret;
+  param.un.suspend.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_SUSPEND, &param);
+  return param.un.suspend.ret;
+}
+
+int kz_resume(kz_thread_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.suspend.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_RESUME, &param);
+  return param.un.suspend.ret;
 }
 
 int kz_chpri(int priority)
@@ -61,6 +71,56 @@ int kz_chpri(int priority)
   return param.un.chpri.ret;
 }
 
+/*
+ * 他のスレッドの優先度の変更（変更前の優先度を返す）
+ * flags に KZ_CHPRI_HEAD を指定すると、レディキューの先頭に繋ぐ
+ */
+int kz_chpri_thread(kz_thread_id_t id, int priority, int flags)
+{
+  kz_syscall_param_t param;
+  param.un.chpri_thread.id = id;
+  param.un.chpri_thread.priority = priority;
+  param.un.chpri_thread.flags = flags;
+  kz_syscall(KZ_SYSCALL_TYPE_CHPRI_THREAD, &param);
+  return param.un.chpri_thread.ret;
+}
+
+int kz_setslice(int priority, int ticks)
+{
+  kz_syscall_param_t param;
+  param.un.setslice.priority = priority;
+  param.un.setslice.ticks = ticks;
+  kz_syscall(KZ_SYSCALL_TYPE_SETSLICE, &param);
+  return param.un.setslice.ret;
+}
+
+int kz_stackinfo(kz_thread_id_t id, int *sizep, int *usedp)
+{
+  kz_syscall_param_t param;
+  param.un.stackinfo.id = id;
+  param.un.stackinfo.sizep = sizep;
+  param.un.stackinfo.usedp = usedp;
+  kz_syscall(KZ_SYSCALL_TYPE_STACKINFO, &param);
+  return param.un.stackinfo.ret;
+}
+
+int kz_getstat(kz_thread_id_t id, kz_threadstat_t *statp)
+{
+  kz_syscall_param_t param;
+  param.un.getstat.id = id;
+  param.un.getstat.statp = statp;
+  kz_syscall(KZ_SYSCALL_TYPE_GETSTAT, &param);
+  return param.un.getstat.ret;
+}
+
+int kz_getload(int samples)
+{
+  kz_syscall_param_t param;
+  param.un.getload.samples = samples;
+  kz_syscall(KZ_SYSCALL_TYPE_GETLOAD, &param);
+  return param.un.getload.ret;
+}
+
 void *kz_kmalloc(int size)
 {
   kz_syscall_param_t param;
@@ -77,12 +137,162 @@ int kz_kmfree(void *p)
   return param.un.kmfree.ret;
 }
 
+int kz_memstat(int index, kz_memstat_t *statp)
+{
+  kz_syscall_param_t param;
+  param.un.memstat.index = index;
+  param.un.memstat.statp = statp;
+  kz_syscall(KZ_SYSCALL_TYPE_MEMSTAT, &param);
+  return param.un.memstat.ret;
+}
+
+int kz_regionstat(kz_regionstat_t *statp)
+{
+  kz_syscall_param_t param;
+  param.un.regionstat.statp = statp;
+  kz_syscall(KZ_SYSCALL_TYPE_REGIONSTAT, &param);
+  return param.un.regionstat.ret;
+}
+
+int kz_perfstat(kz_perfstat_t *statp, uint32 *syscalls, int num)
+{
+  kz_syscall_param_t param;
+  param.un.perfstat.statp = statp;
+  param.un.perfstat.syscalls = syscalls;
+  param.un.perfstat.num = num;
+  kz_syscall(KZ_SYSCALL_TYPE_PERFSTAT, &param);
+  return param.un.perfstat.ret;
+}
+
+void *kz_dmalloc(uint32 size)
+{
+  kz_syscall_param_t param;
+  param.un.dmalloc.size = size;
+  kz_syscall(KZ_SYSCALL_TYPE_DMALLOC, &param);
+  return param.un.dmalloc.ret;
+}
+
+int kz_dmfree(void *p)
+{
+  kz_syscall_param_t param;
+  param.un.dmfree.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_DMFREE, &param);
+  return param.un.dmfree.ret;
+}
+
 int kz_send(kz_msgbox_id_t id, int size, char *p)
 {
   kz_syscall_param_t param;
   param.un.send.id = id;
   param.un.send.size = size;
   param.un.send.p = p;
+  param.un.send.nowait = 0;
+  param.un.send.priority = KZ_MSG_PRIORITY_DEFAULT;
+  param.un.send.copy = 0;
+  kz_syscall(KZ_SYSCALL_TYPE_SEND, &param);
+  return param.un.send.ret;
+}
+
+/* メッセージボックスが満杯の場合にブロックしないメッセージ送信 */
+int kz_psend(kz_msgbox_id_t id, int size, char *p)
+{
+  kz_syscall_param_t param;
+  param.un.send.id = id;
+  param.un.send.size = size;
+  param.un.send.p = p;
+  param.un.send.nowait = 1;
+  param.un.send.priority = KZ_MSG_PRIORITY_DEFAULT;
+  param.un.send.copy = 0;
+  kz_syscall(KZ_SYSCALL_TYPE_SEND, &param);
+  return param.un.send.ret;
+}
+
+/*
+ * 複数のシステムコールを1回のトラップで順に実行する（実行した数を返す）
+ * 途中でブロックするとそこでやめる。各 params[i] には、個々のシステムコールの
+ * ラッパー関数と同じようにパラメータを設定しておき、戻り値もそこから取り出す。
+ */
+int kz_syscall_batch(kz_syscall_type_t *types, kz_syscall_param_t *params, int count)
+{
+  kz_syscall_param_t param;
+  param.un.batch.types = types;
+  param.un.batch.params = params;
+  param.un.batch.count = count;
+  kz_syscall(KZ_SYSCALL_TYPE_BATCH, &param);
+  return param.un.batch.ret;
+}
+
+/*
+ * リングバッファの作成
+ * threshold バイトたまるか、他に動作するスレッドがなくなったときに、
+ * kz_ring_wait() で待っているスレッドを起こす
+ */
+kz_ring_id_t kz_ring_create(char *buf, int size, int threshold)
+{
+  kz_syscall_param_t param;
+  param.un.ring_create.buf = buf;
+  param.un.ring_create.size = size;
+  param.un.ring_create.threshold = threshold;
+  kz_syscall(KZ_SYSCALL_TYPE_RING_CREATE, &param);
+  return param.un.ring_create.ret;
+}
+
+int kz_ring_delete(kz_ring_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.ring_delete.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_RING_DELETE, &param);
+  return param.un.ring_delete.ret;
+}
+
+int kz_ring_wait(kz_ring_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.ring_wait.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_RING_WAIT, &param);
+  return param.un.ring_wait.ret;
+}
+
+/* 複数のメッセージを1回のシステムコールで送信する（送信できた数を返す） */
+int kz_sendv(kz_msgbox_id_t id, kz_msgvec_t *vec, int count)
+{
+  kz_syscall_param_t param;
+  param.un.sendv.id = id;
+  param.un.sendv.vec = vec;
+  param.un.sendv.count = count;
+  kz_syscall(KZ_SYSCALL_TYPE_SENDV, &param);
+  return param.un.sendv.ret;
+}
+
+/* 優先度付きのメッセージ送信（優先度の低い受信前のメッセージを追い越す） */
+int kz_send_pri(kz_msgbox_id_t id, int size, char *p, int priority)
+{
+  kz_syscall_param_t param;
+  param.un.send.id = id;
+  param.un.send.size = size;
+  param.un.send.p = p;
+  param.un.send.nowait = 0;
+  param.un.send.priority = priority;
+  param.un.send.copy = 0;
+  kz_syscall(KZ_SYSCALL_TYPE_SEND, &param);
+  return param.un.send.ret;
+}
+
+/*
+ * 小さいメッセージ（KZ_MSG_INLINE_SIZE バイトまで）をコピーして送信する
+ * p は送信後すぐに再利用してよい（動的メモリを獲得する必要がない）
+ * kz_recv_inline() 以外で受信した場合は、受信側にはカーネルが獲得した
+ * 領域にコピーして渡すので、通常のメッセージと同じく kz_kmfree() で解放する
+ */
+int kz_send_inline(kz_msgbox_id_t id, int size, char *p)
+{
+  kz_syscall_param_t param;
+  param.un.send.id = id;
+  param.un.send.size = size;
+  param.un.send.p = p;
+  param.un.send.nowait = 0;
+  param.un.send.priority = KZ_MSG_PRIORITY_DEFAULT;
+  param.un.send.copy = 1;
   kz_syscall(KZ_SYSCALL_TYPE_SEND, &param);
   return param.un.send.ret;
 }
@@ -93,10 +303,298 @@ kz_thread_id_t kz_recv(kz_msgbox_id_t id, int *sizep, char **pp)
   param.un.recv.id = id;
   param.un.recv.sizep = sizep;
   param.un.recv.pp = pp;
+  param.un.recv.timeout = 0;
+  param.un.recv.idp = NULL;
+  param.un.recv.buf = NULL;
+  param.un.recv.release = NULL;
+  kz_syscall(KZ_SYSCALL_TYPE_RECV, &param);
+  return param.un.recv.ret;
+}
+
+/* タイムアウト付きのメッセージ受信 */
+kz_thread_id_t kz_trecv(kz_msgbox_id_t id, int *sizep, char **pp, int timeout)
+{
+  kz_syscall_param_t param;
+  param.un.recv.id = id;
+  param.un.recv.sizep = sizep;
+  param.un.recv.pp = pp;
+  param.un.recv.timeout = timeout;
+  param.un.recv.idp = NULL;
+  param.un.recv.buf = NULL;
+  param.un.recv.release = NULL;
+  kz_syscall(KZ_SYSCALL_TYPE_RECV, &param);
+  return param.un.recv.ret;
+}
+
+/* ポーリングによるメッセージ受信（ブロックしない） */
+kz_thread_id_t kz_precv(kz_msgbox_id_t id, int *sizep, char **pp)
+{
+  kz_syscall_param_t param;
+  param.un.recv.id = id;
+  param.un.recv.sizep = sizep;
+  param.un.recv.pp = pp;
+  param.un.recv.timeout = -1;
+  param.un.recv.idp = NULL;
+  param.un.recv.buf = NULL;
+  param.un.recv.release = NULL;
+  kz_syscall(KZ_SYSCALL_TYPE_RECV, &param);
+  return param.un.recv.ret;
+}
+
+/*
+ * kz_send_inline() のメッセージも受け取れるメッセージ受信
+ * コピーされたメッセージならば buf（KZ_MSG_INLINE_SIZE バイト以上）に
+ * コピーして *pp を buf にする。それ以外は kz_recv() と同じ。
+ */
+kz_thread_id_t kz_recv_inline(kz_msgbox_id_t id, int *sizep, char **pp, char *buf)
+{
+  kz_syscall_param_t param;
+  param.un.recv.id = id;
+  param.un.recv.sizep = sizep;
+  param.un.recv.pp = pp;
+  param.un.recv.timeout = 0;
+  param.un.recv.idp = NULL;
+  param.un.recv.buf = buf;
+  param.un.recv.release = NULL;
   kz_syscall(KZ_SYSCALL_TYPE_RECV, &param);
   return param.un.recv.ret;
 }
 
+/*
+ * 前に受信したメッセージの領域を解放してからのメッセージ受信
+ * kz_kmfree(release) と受信を1回のトラップで行う（release が NULL ならば
+ * 解放しない）。要求を受けて処理するドライバの受信ループで使う。
+ * timeout は0で無期限に待ち、-1で待たない(kz_precv())、正ならその
+ * ティック数まで待つ(kz_trecv())。
+ */
+kz_thread_id_t kz_recv_free(kz_msgbox_id_t id, int *sizep, char **pp,
+                            int timeout, void *release)
+{
+  kz_syscall_param_t param;
+  param.un.recv.id = id;
+  param.un.recv.sizep = sizep;
+  param.un.recv.pp = pp;
+  param.un.recv.timeout = timeout;
+  param.un.recv.idp = NULL;
+  param.un.recv.buf = NULL;
+  param.un.recv.release = release;
+  kz_syscall(KZ_SYSCALL_TYPE_RECV, &param);
+  return param.un.recv.ret;
+}
+
+/* mask のいずれかのメッセージボックスから受信する（受信したIDを *idp に返す） */
+kz_thread_id_t kz_recv_any(uint16 mask, kz_msgbox_id_t *idp, int *sizep, char **pp)
+{
+  kz_syscall_param_t param;
+  param.un.recv.mask = mask;
+  param.un.recv.idp = idp;
+  param.un.recv.buf = NULL;
+  param.un.recv.sizep = sizep;
+  param.un.recv.pp = pp;
+  kz_syscall(KZ_SYSCALL_TYPE_RECV_ANY, &param);
+  return param.un.recv.ret;
+}
+
+/* メッセージを送信し、返信を待つ（返信のサイズを返す） */
+int kz_call(kz_msgbox_id_t id, int size, char *p, char **replyp)
+{
+  kz_syscall_param_t param;
+  param.un.call.id = id;
+  param.un.call.size = size;
+  param.un.call.p = p;
+  param.un.call.replyp = replyp;
+  kz_syscall(KZ_SYSCALL_TYPE_CALL, &param);
+  return param.un.call.ret;
+}
+
+/* kz_call() で返信待ちしているスレッドに返信する */
+int kz_reply(kz_thread_id_t id, int size, char *p)
+{
+  kz_syscall_param_t param;
+  param.un.reply.id = id;
+  param.un.reply.size = size;
+  param.un.reply.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_REPLY, &param);
+  return param.un.reply.ret;
+}
+
+kz_msgbox_id_t kz_mbox_create(int attr)
+{
+  kz_syscall_param_t param;
+  param.un.mbox_create.attr = attr;
+  kz_syscall(KZ_SYSCALL_TYPE_MBOX_CREATE, &param);
+  return param.un.mbox_create.ret;
+}
+
+int kz_mbox_delete(kz_msgbox_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.mbox_delete.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_MBOX_DELETE, &param);
+  return param.un.mbox_delete.ret;
+}
+
+int kz_mbox_setattr(kz_msgbox_id_t id, int attr)
+{
+  kz_syscall_param_t param;
+  param.un.mbox_setattr.id = id;
+  param.un.mbox_setattr.attr = attr;
+  kz_syscall(KZ_SYSCALL_TYPE_MBOX_SETATTR, &param);
+  return param.un.mbox_setattr.ret;
+}
+
+int kz_mbox_setcap(kz_msgbox_id_t id, int capacity)
+{
+  kz_syscall_param_t param;
+  param.un.mbox_setcap.id = id;
+  param.un.mbox_setcap.capacity = capacity;
+  kz_syscall(KZ_SYSCALL_TYPE_MBOX_SETCAP, &param);
+  return param.un.mbox_setcap.ret;
+}
+
+/*
+ * メッセージボックスごとの取り置き
+ * 共有のプールが他の送信で尽きても、このボックスへの送信は nodes 個までの
+ * メッセージバッファと、kz_mbox_alloc() で獲得する size バイトの領域
+ * blocks 個までは必ず使える
+ */
+int kz_mbox_reserve(kz_msgbox_id_t id, int nodes, int blocks, int size)
+{
+  kz_syscall_param_t param;
+  param.un.mbox_reserve.id = id;
+  param.un.mbox_reserve.nodes = nodes;
+  param.un.mbox_reserve.blocks = blocks;
+  param.un.mbox_reserve.size = size;
+  kz_syscall(KZ_SYSCALL_TYPE_MBOX_RESERVE, &param);
+  return param.un.mbox_reserve.ret;
+}
+
+/* 取り置きからの領域の獲得（kz_mbox_free() で解放すること） */
+void *kz_mbox_alloc(kz_msgbox_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.mbox_alloc.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_MBOX_ALLOC, &param);
+  return param.un.mbox_alloc.ret;
+}
+
+int kz_mbox_free(kz_msgbox_id_t id, void *p)
+{
+  kz_syscall_param_t param;
+  param.un.mbox_free.id = id;
+  param.un.mbox_free.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_MBOX_FREE, &param);
+  return param.un.mbox_free.ret;
+}
+
+kz_sem_id_t kz_sem_create(int count)
+{
+  kz_syscall_param_t param;
+  param.un.sem_create.count = count;
+  kz_syscall(KZ_SYSCALL_TYPE_SEM_CREATE, &param);
+  return param.un.sem_create.ret;
+}
+
+int kz_sem_delete(kz_sem_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.sem_delete.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_SEM_DELETE, &param);
+  return param.un.sem_delete.ret;
+}
+
+int kz_sem_wait(kz_sem_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.sem_wait.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_SEM_WAIT, &param);
+  return param.un.sem_wait.ret;
+}
+
+int kz_sem_post(kz_sem_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.sem_post.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_SEM_POST, &param);
+  return param.un.sem_post.ret;
+}
+
+kz_mutex_id_t kz_mutex_create(void)
+{
+  kz_syscall_param_t param;
+  kz_syscall(KZ_SYSCALL_TYPE_MUTEX_CREATE, &param);
+  return param.un.mutex_create.ret;
+}
+
+int kz_mutex_delete(kz_mutex_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.mutex_delete.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_MUTEX_DELETE, &param);
+  return param.un.mutex_delete.ret;
+}
+
+int kz_mutex_lock(kz_mutex_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.mutex_lock.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_MUTEX_LOCK, &param);
+  return param.un.mutex_lock.ret;
+}
+
+int kz_mutex_unlock(kz_mutex_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.mutex_unlock.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_MUTEX_UNLOCK, &param);
+  return param.un.mutex_unlock.ret;
+}
+
+kz_flag_id_t kz_flag_create(uint16 pattern)
+{
+  kz_syscall_param_t param;
+  param.un.flag_create.pattern = pattern;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_CREATE, &param);
+  return param.un.flag_create.ret;
+}
+
+int kz_flag_delete(kz_flag_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.flag_delete.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_DELETE, &param);
+  return param.un.flag_delete.ret;
+}
+
+int kz_flag_wait(kz_flag_id_t id, uint16 pattern, int mode, uint16 *flagsp)
+{
+  kz_syscall_param_t param;
+  param.un.flag_wait.id = id;
+  param.un.flag_wait.pattern = pattern;
+  param.un.flag_wait.mode = mode;
+  param.un.flag_wait.flagsp = flagsp;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_WAIT, &param);
+  return param.un.flag_wait.ret;
+}
+
+int kz_flag_set(kz_flag_id_t id, uint16 pattern)
+{
+  kz_syscall_param_t param;
+  param.un.flag_set.id = id;
+  param.un.flag_set.pattern = pattern;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_SET, &param);
+  return param.un.flag_set.ret;
+}
+
+int kz_flag_clear(kz_flag_id_t id, uint16 pattern)
+{
+  kz_syscall_param_t param;
+  param.un.flag_set.id = id;
+  param.un.flag_set.pattern = pattern;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_CLEAR, &param);
+  return param.un.flag_set.ret;
+}
+
 int kz_setintr(softvec_type_t type, kz_handler_t handler)
 {
   kz_syscall_param_t param;
@@ -106,6 +604,184 @@ int kz_setintr(softvec_type_t type, kz_handler_t handler)
   return param.un.setintr.ret;
 }
 
+int kz_setintrlevel(softvec_type_t type, int level)
+{
+  kz_syscall_param_t param;
+  param.un.setintrlevel.type = type;
+  param.un.setintrlevel.level = level;
+  kz_syscall(KZ_SYSCALL_TYPE_SETINTRLEVEL, &param);
+  return param.un.setintrlevel.ret;
+}
+
+int kz_heartbeat(int ticks)
+{
+  kz_syscall_param_t param;
+  param.un.heartbeat.ticks = ticks;
+  kz_syscall(KZ_SYSCALL_TYPE_HEARTBEAT, &param);
+  return param.un.heartbeat.ret;
+}
+
+int kz_join(kz_thread_id_t id, int *statusp)
+{
+  kz_syscall_param_t param;
+  param.un.join.id = id;
+  param.un.join.statusp = statusp;
+  kz_syscall(KZ_SYSCALL_TYPE_JOIN, &param);
+  return param.un.join.ret;
+}
+
+int kz_wait_for(kz_thread_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.wait_for.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_WAIT_FOR, &param);
+  return param.un.wait_for.ret;
+}
+
+int kz_setperiod(int ticks, int phase)
+{
+  kz_syscall_param_t param;
+  param.un.setperiod.ticks = ticks;
+  param.un.setperiod.phase = phase;
+  kz_syscall(KZ_SYSCALL_TYPE_SETPERIOD, &param);
+  return param.un.setperiod.ret;
+}
+
+int kz_wait_period(void)
+{
+  kz_syscall_param_t param;
+  kz_syscall(KZ_SYSCALL_TYPE_WAIT_PERIOD, &param);
+  return param.un.wait_period.ret;
+}
+
+#if KZ_CONFIG_SWTIMER
+kz_timer_id_t kz_timer_create(int ticks, int periodic, kz_msgbox_id_t id, char *p)
+{
+  kz_syscall_param_t param;
+  param.un.timer_create.ticks = ticks;
+  param.un.timer_create.periodic = periodic;
+  param.un.timer_create.box = id;
+  param.un.timer_create.func = NULL;
+  param.un.timer_create.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_TIMER_CREATE, &param);
+  return param.un.timer_create.ret;
+}
+
+kz_timer_id_t kz_timer_create_func(int ticks, int periodic, kz_defer_func_t func, void *p)
+{
+  kz_syscall_param_t param;
+  param.un.timer_create.ticks = ticks;
+  param.un.timer_create.periodic = periodic;
+  param.un.timer_create.box = 0;
+  param.un.timer_create.func = func;
+  param.un.timer_create.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_TIMER_CREATE, &param);
+  return param.un.timer_create.ret;
+}
+
+int kz_timer_delete(kz_timer_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.timer_delete.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_TIMER_DELETE, &param);
+  return param.un.timer_delete.ret;
+}
+#endif
+
+int kz_setdeadline(int ticks)
+{
+  kz_syscall_param_t param;
+  param.un.setdeadline.ticks = ticks;
+  kz_syscall(KZ_SYSCALL_TYPE_SETDEADLINE, &param);
+  return param.un.setdeadline.ret;
+}
+
+#ifdef KZ_BUDGET
+int kz_setbudget(kz_thread_id_t id, int ticks, int period)
+{
+  kz_syscall_param_t param;
+  param.un.setbudget.id = id;
+  param.un.setbudget.ticks = ticks;
+  param.un.setbudget.period = period;
+  kz_syscall(KZ_SYSCALL_TYPE_SETBUDGET, &param);
+  return param.un.setbudget.ret;
+}
+#endif
+
+#ifdef KZ_TRACE
+int kz_strace(kz_thread_id_t id, int on)
+{
+  kz_syscall_param_t param;
+  param.un.strace.id = id;
+  param.un.strace.on = on;
+  kz_syscall(KZ_SYSCALL_TYPE_STRACE, &param);
+  return param.un.strace.ret;
+}
+#endif
+
+#if KZ_CONFIG_TOPIC
+kz_topic_id_t kz_topic_create(void)
+{
+  kz_syscall_param_t param;
+  kz_syscall(KZ_SYSCALL_TYPE_TOPIC_CREATE, &param);
+  return param.un.topic_create.ret;
+}
+
+int kz_topic_delete(kz_topic_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.topic_delete.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_TOPIC_DELETE, &param);
+  return param.un.topic_delete.ret;
+}
+
+int kz_topic_subscribe(kz_topic_id_t id, kz_msgbox_id_t box)
+{
+  kz_syscall_param_t param;
+  param.un.topic_subscribe.id = id;
+  param.un.topic_subscribe.box = box;
+  param.un.topic_subscribe.on = 1;
+  kz_syscall(KZ_SYSCALL_TYPE_TOPIC_SUBSCRIBE, &param);
+  return param.un.topic_subscribe.ret;
+}
+
+int kz_topic_unsubscribe(kz_topic_id_t id, kz_msgbox_id_t box)
+{
+  kz_syscall_param_t param;
+  param.un.topic_subscribe.id = id;
+  param.un.topic_subscribe.box = box;
+  param.un.topic_subscribe.on = 0;
+  kz_syscall(KZ_SYSCALL_TYPE_TOPIC_SUBSCRIBE, &param);
+  return param.un.topic_subscribe.ret;
+}
+
+void *kz_topic_alloc(int size)
+{
+  kz_syscall_param_t param;
+  param.un.topic_alloc.size = size;
+  kz_syscall(KZ_SYSCALL_TYPE_TOPIC_ALLOC, &param);
+  return param.un.topic_alloc.ret;
+}
+
+int kz_topic_publish(kz_topic_id_t id, int size, char *p)
+{
+  kz_syscall_param_t param;
+  param.un.topic_publish.id = id;
+  param.un.topic_publish.size = size;
+  param.un.topic_publish.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_TOPIC_PUBLISH, &param);
+  return param.un.topic_publish.ret;
+}
+
+int kz_topic_release(char *p)
+{
+  kz_syscall_param_t param;
+  param.un.topic_release.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_TOPIC_RELEASE, &param);
+  return param.un.topic_release.ret;
+}
+#endif
+
 /* サービスコール */
 
 int kx_wakeup(kz_thread_id_t id)
@@ -138,6 +814,26 @@ int kx_send(kz_msgbox_id_t id, int size, char *p)
   param.un.send.id = id;
   param.un.send.size = size;
   param.un.send.p = p;
+  param.un.send.nowait = 1;
+  param.un.send.priority = KZ_MSG_PRIORITY_DEFAULT;
+  param.un.send.copy = 0;
   kz_srvcall(KZ_SYSCALL_TYPE_SEND, &param);
   return param.un.send.ret;
 }
+
+int kx_sem_post(kz_sem_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.sem_post.id = id;
+  kz_srvcall(KZ_SYSCALL_TYPE_SEM_POST, &param);
+  return param.un.sem_post.ret;
+}
+
+int kx_flag_set(kz_flag_id_t id, uint16 pattern)
+{
+  kz_syscall_param_t param;
+  param.un.flag_set.id = id;
+  param.un.flag_set.pattern = pattern;
+  kz_srvcall(KZ_SYSCALL_TYPE_FLAG_SET, &param);
+  return param.un.flag_set.ret;
+}
@@ -12,14 +12,73 @@ typedef enum {
   KZ_SYSCALL_TYPE_WAKEUP,
   KZ_SYSCALL_TYPE_GETID,
   KZ_SYSCALL_TYPE_CHPRI,
+  KZ_SYSCALL_TYPE_SETSLICE,
+  KZ_SYSCALL_TYPE_STACKINFO,
+  KZ_SYSCALL_TYPE_GETSTAT,
+  KZ_SYSCALL_TYPE_GETLOAD,
   KZ_SYSCALL_TYPE_KMALLOC,
   KZ_SYSCALL_TYPE_KMFREE,
+  KZ_SYSCALL_TYPE_MEMSTAT,
+  KZ_SYSCALL_TYPE_DMALLOC,
+  KZ_SYSCALL_TYPE_DMFREE,
   KZ_SYSCALL_TYPE_SEND,
   KZ_SYSCALL_TYPE_RECV,
+  KZ_SYSCALL_TYPE_CALL,
+  KZ_SYSCALL_TYPE_REPLY,
+  KZ_SYSCALL_TYPE_MBOX_CREATE,
+  KZ_SYSCALL_TYPE_MBOX_DELETE,
+  KZ_SYSCALL_TYPE_MBOX_SETATTR,
+  KZ_SYSCALL_TYPE_MBOX_SETCAP,
+  KZ_SYSCALL_TYPE_SEM_CREATE,
+  KZ_SYSCALL_TYPE_SEM_DELETE,
+  KZ_SYSCALL_TYPE_SEM_WAIT,
+  KZ_SYSCALL_TYPE_SEM_POST,
+  KZ_SYSCALL_TYPE_MUTEX_CREATE,
+  KZ_SYSCALL_TYPE_MUTEX_DELETE,
+  KZ_SYSCALL_TYPE_MUTEX_LOCK,
+  KZ_SYSCALL_TYPE_MUTEX_UNLOCK,
+  KZ_SYSCALL_TYPE_FLAG_CREATE,
+  KZ_SYSCALL_TYPE_FLAG_DELETE,
+  KZ_SYSCALL_TYPE_FLAG_WAIT,
+  KZ_SYSCALL_TYPE_FLAG_SET,
+  KZ_SYSCALL_TYPE_FLAG_CLEAR,
   KZ_SYSCALL_TYPE_SETINTR,
+  KZ_SYSCALL_TYPE_SETINTRLEVEL,
+  KZ_SYSCALL_TYPE_HEARTBEAT,
+  KZ_SYSCALL_TYPE_JOIN,
+  KZ_SYSCALL_TYPE_WAIT_FOR,
+  KZ_SYSCALL_TYPE_SETPERIOD,
+  KZ_SYSCALL_TYPE_WAIT_PERIOD,
+  KZ_SYSCALL_TYPE_TIMER_CREATE,
+  KZ_SYSCALL_TYPE_TIMER_DELETE,
+  KZ_SYSCALL_TYPE_SETDEADLINE,
+  KZ_SYSCALL_TYPE_TOPIC_CREATE,
+  KZ_SYSCALL_TYPE_TOPIC_DELETE,
+  KZ_SYSCALL_TYPE_TOPIC_SUBSCRIBE,
+  KZ_SYSCALL_TYPE_TOPIC_ALLOC,
+  KZ_SYSCALL_TYPE_TOPIC_PUBLISH,
+  KZ_SYSCALL_TYPE_TOPIC_RELEASE,
+  KZ_SYSCALL_TYPE_RECV_ANY,
+  KZ_SYSCALL_TYPE_SENDV,
+  KZ_SYSCALL_TYPE_BATCH,
+  KZ_SYSCALL_TYPE_RING_CREATE,
+  KZ_SYSCALL_TYPE_RING_DELETE,
+  KZ_SYSCALL_TYPE_RING_WAIT,
+  KZ_SYSCALL_TYPE_RING_FLUSH, /* kz_idle() から使う */
+  KZ_SYSCALL_TYPE_MBOX_RESERVE,
+  KZ_SYSCALL_TYPE_MBOX_ALLOC,
+  KZ_SYSCALL_TYPE_MBOX_FREE,
+  KZ_SYSCALL_TYPE_CHPRI_THREAD,
+  KZ_SYSCALL_TYPE_REGIONSTAT,
+  KZ_SYSCALL_TYPE_PERFSTAT,
+  KZ_SYSCALL_TYPE_SUSPEND,
+  KZ_SYSCALL_TYPE_RESUME,
+  KZ_SYSCALL_TYPE_SETBUDGET,
+  KZ_SYSCALL_TYPE_STRACE,
+  KZ_SYSCALL_TYPE_NUM, /* システムコールの数（関数テーブルの大きさ） */
 } kz_syscall_type_t;
 
-typedef struct {
+typedef struct _kz_syscall_param {
   union {
     struct {
       kz_func_t func;
@@ -37,12 +96,17 @@ typedef struct {
       int ret;
     } wait;
     struct {
+      int ticks;
       int ret;
     } sleep;
     struct {
       kz_thread_id_t id;
       int ret;
     } wakeup;
+    struct {
+      kz_thread_id_t id;
+      int ret;
+    } suspend; /* kz_resume() と共用 */
     struct {
       kz_thread_id_t ret;
     } getid;
@@ -50,6 +114,32 @@ typedef struct {
       int priority;
       int ret;
     } chpri;
+    struct {
+      kz_thread_id_t id;
+      int priority;
+      int flags;
+      int ret;
+    } chpri_thread;
+    struct {
+      int priority;
+      int ticks;
+      int ret;
+    } setslice;
+    struct {
+      kz_thread_id_t id;
+      int *sizep;
+      int *usedp;
+      int ret;
+    } stackinfo;
+    struct {
+      kz_thread_id_t id;
+      kz_threadstat_t *statp;
+      int ret;
+    } getstat;
+    struct {
+      int samples;
+      int ret;
+    } getload;
     struct {
       int size;
       void *ret;
@@ -58,23 +148,258 @@ typedef struct {
       char *p;
       int ret;
     } kmfree;
+    struct {
+      int index;
+      kz_memstat_t *statp;
+      int ret;
+    } memstat;
+    struct {
+      kz_regionstat_t *statp;
+      int ret;
+    } regionstat;
+    struct {
+      kz_perfstat_t *statp;
+      uint32 *syscalls;
+      int num;
+      int ret;
+    } perfstat;
+    struct {
+      uint32 size;
+      void *ret;
+    } dmalloc;
+    struct {
+      void *p;
+      int ret;
+    } dmfree;
     struct {
       kz_msgbox_id_t id;
       int size;
       char *p;
+      int nowait;
+      int priority;
+      int copy; /* kz_send_inline() */
       int ret;
     } send;
+    struct {
+      kz_msgbox_id_t id;
+      kz_msgvec_t *vec;
+      int count;
+      int ret;
+    } sendv;
     struct {
       kz_msgbox_id_t id;
       int *sizep;
       char **pp;
+      int timeout;
+      uint16 mask;          /* kz_recv_any() で待つメッセージボックス */
+      kz_msgbox_id_t *idp;  /* 受信したメッセージボックス(kz_recv_any()) */
+      char *buf;            /* kz_send_inline() のメッセージのコピー先 */
+      char *release;        /* 受信の前に解放する領域(kz_recv_free()) */
       kz_thread_id_t ret;
-    } recv;
+    } recv; /* kz_recv_any() と共用 */
+    struct {
+      kz_msgbox_id_t id;
+      int size;
+      char *p;
+      char **replyp;
+      int ret;
+    } call;
+    struct {
+      kz_thread_id_t id;
+      int size;
+      char *p;
+      int ret;
+    } reply;
+    struct {
+      int attr;
+      kz_msgbox_id_t ret;
+    } mbox_create;
+    struct {
+      kz_msgbox_id_t id;
+      int ret;
+    } mbox_delete;
+    struct {
+      kz_msgbox_id_t id;
+      int attr;
+      int ret;
+    } mbox_setattr;
+    struct {
+      kz_msgbox_id_t id;
+      int capacity;
+      int ret;
+    } mbox_setcap;
+    struct {
+      kz_msgbox_id_t id;
+      int nodes;
+      int blocks;
+      int size;
+      int ret;
+    } mbox_reserve;
+    struct {
+      kz_msgbox_id_t id;
+      void *ret;
+    } mbox_alloc;
+    struct {
+      kz_msgbox_id_t id;
+      void *p;
+      int ret;
+    } mbox_free;
+    struct {
+      int count;
+      kz_sem_id_t ret;
+    } sem_create;
+    struct {
+      kz_sem_id_t id;
+      int ret;
+    } sem_delete;
+    struct {
+      kz_sem_id_t id;
+      int ret;
+    } sem_wait;
+    struct {
+      kz_sem_id_t id;
+      int ret;
+    } sem_post;
+    struct {
+      kz_mutex_id_t ret;
+    } mutex_create;
+    struct {
+      kz_mutex_id_t id;
+      int ret;
+    } mutex_delete;
+    struct {
+      kz_mutex_id_t id;
+      int ret;
+    } mutex_lock;
+    struct {
+      kz_mutex_id_t id;
+      int ret;
+    } mutex_unlock;
+    struct {
+      uint16 pattern;
+      kz_flag_id_t ret;
+    } flag_create;
+    struct {
+      kz_flag_id_t id;
+      int ret;
+    } flag_delete;
+    struct {
+      kz_flag_id_t id;
+      uint16 pattern;
+      int mode;
+      uint16 *flagsp;
+      int ret;
+    } flag_wait;
+    struct {
+      kz_flag_id_t id;
+      uint16 pattern;
+      int ret;
+    } flag_set; /* kz_flag_clear() と共用 */
     struct {
       softvec_type_t type;
       kz_handler_t handler;
       int ret;
     } setintr;
+    struct {
+      softvec_type_t type;
+      int level;
+      int ret;
+    } setintrlevel;
+    struct {
+      int ticks;
+      int ret;
+    } heartbeat;
+    struct {
+      kz_thread_id_t id;
+      int *statusp;
+      int ret;
+    } join;
+    struct {
+      kz_thread_id_t id;
+      int ret;
+    } wait_for;
+    struct {
+      int ticks;
+      int phase;
+      int ret;
+    } setperiod;
+    struct {
+      int ret;
+    } wait_period;
+    struct {
+      int ticks;
+      int periodic;
+      kz_msgbox_id_t box;
+      kz_defer_func_t func;
+      char *p;
+      kz_timer_id_t ret;
+    } timer_create;
+    struct {
+      kz_timer_id_t id;
+      int ret;
+    } timer_delete;
+    struct {
+      int ticks;
+      int ret;
+    } setdeadline;
+    struct {
+      kz_thread_id_t id;
+      int ticks;
+      int period;
+      int ret;
+    } setbudget;
+    struct {
+      kz_thread_id_t id;
+      int on;
+      int ret;
+    } strace;
+    struct {
+      kz_topic_id_t ret;
+    } topic_create;
+    struct {
+      kz_topic_id_t id;
+      int ret;
+    } topic_delete;
+    struct {
+      kz_topic_id_t id;
+      kz_msgbox_id_t box;
+      int on;
+      int ret;
+    } topic_subscribe;
+    struct {
+      int size;
+      void *ret;
+    } topic_alloc;
+    struct {
+      kz_topic_id_t id;
+      int size;
+      char *p;
+      int ret;
+    } topic_publish;
+    struct {
+      char *p;
+      int ret;
+    } topic_release;
+    struct {
+      char *buf;
+      int size;
+      int threshold;
+      kz_ring_id_t ret;
+    } ring_create;
+    struct {
+      kz_ring_id_t id;
+      int ret;
+    } ring_delete;
+    struct {
+      kz_ring_id_t id;
+      int ret;
+    } ring_wait; /* リングバッファの受け渡し(kz_idle())と共用 */
+    struct {
+      kz_syscall_type_t *types;
+      struct _kz_syscall_param *params;
+      int count;
+      int ret;
+    } batch;
   } un;
 } kz_syscall_param_t;
 
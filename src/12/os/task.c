@@ -0,0 +1,209 @@
+#include "defines.h"
+#include "kozos.h"
+#include "interrupt.h"
+#include "queue.h"
+#include "task.h"
+
+/*
+ * ランツーコンプリーションのタスク（task.h を参照）
+ * イベントは固定数のプールから確保してレベルごとのキューにつなぎ、
+ * ディスパッチスレッドが1つずつ取り出してハンドラを呼ぶ。
+ * キューが空になるとディスパッチスレッドは kz_sleep() し、kz_task_post() が
+ * kz_wakeup() で起こす（保留されるので、眠る直前に送られても失われない）。
+ * 割り込みハンドラからも送れるように、キューの操作は割り込みを
+ * マスクして行う。
+ */
+
+struct task_event {
+  struct task_event *next;
+  kz_task_t *task;
+  int size;
+  char *p;
+};
+
+static struct task_event task_events[TASK_EVENT_NUM];
+static struct task_event *task_free; /* 空きのイベントのリスト */
+
+static struct task_level {
+  kz_thread_id_t id; /* ディスパッチスレッド（0ならば未使用） */
+  int priority;
+  int sleeping; /* キューが空で kz_sleep() している（する直前を含む） */
+  int stop;     /* kz_task_level_stop() で、キューが空になったら終了する */
+  struct {
+    struct task_event *head;
+    struct task_event *tail;
+  } que;
+} task_levels[TASK_LEVEL_NUM];
+
+static int task_initialized = 0;
+
+/* ディスパッチスレッド（レベルの番号を argc で渡す） */
+static int task_main(int argc, char *argv[])
+{
+  struct task_level *lv = &task_levels[argc];
+  struct task_event *ev;
+  kz_task_t *task;
+  int ceiling, size;
+  char *p;
+
+  while (1) {
+    ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+    ev = lv->que.head;
+    if (ev)
+      KZ_QUEUE_GET(&lv->que, next);
+    else
+      lv->sleeping = 1;
+    kz_unlock_ceiling(ceiling);
+
+    if (!ev) {
+      if (lv->stop)
+        break;
+      kz_sleep(0);
+      continue;
+    }
+
+    /* イベントを取り出してから空きに戻し、ハンドラの中で送れるようにする */
+    task = ev->task;
+    size = ev->size;
+    p    = ev->p;
+    ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+    KZ_LIST_PUSH(task_free, ev, next);
+    kz_unlock_ceiling(ceiling);
+
+    task->runs++;
+    task->func(task, size, p);
+  }
+
+  return 0;
+}
+
+static void task_init(void)
+{
+  int i;
+
+  task_free = NULL;
+  for (i = 0; i < TASK_EVENT_NUM; i++)
+    KZ_LIST_PUSH(task_free, &task_events[i], next);
+  task_initialized = 1;
+}
+
+/*
+ * レベルの起動（レベルの番号を返す）
+ * priority の優先度でディスパッチスレッドを起動する。同じ優先度のレベルが
+ * すでにあれば、それを返す（優先度ごとにスタックは1つ）。
+ * stacksize は、そのレベルの最も深いハンドラに合わせる。
+ */
+int kz_task_level_start(int priority, int stacksize)
+{
+  struct task_level *lv = NULL;
+  int i;
+
+  if (!task_initialized)
+    task_init();
+
+  for (i = 0; i < TASK_LEVEL_NUM; i++) {
+    if (task_levels[i].id && (task_levels[i].priority == priority))
+      return i;
+    if (!task_levels[i].id && !lv)
+      lv = &task_levels[i];
+  }
+  if (!lv)
+    return KZ_ERR_NORES;
+
+  lv->priority = priority;
+  lv->sleeping = 0;
+  lv->stop = 0;
+  KZ_QUEUE_INIT(&lv->que);
+  lv->id = kz_run(task_main, "task", priority, stacksize,
+                  lv - task_levels, NULL);
+  if (lv->id == (kz_thread_id_t)-1) {
+    lv->id = 0;
+    return KZ_ERR_NORES;
+  }
+
+  return lv - task_levels;
+}
+
+/*
+ * レベルの停止（スレッドから呼ぶ）
+ * 送られているイベントを全て処理してからディスパッチスレッドを終了させ、
+ * 終了を待つ。停止後に送ったイベントは KZ_ERR_STATE になる。
+ */
+int kz_task_level_stop(int level)
+{
+  struct task_level *lv;
+  kz_thread_id_t id;
+  int ceiling, wake;
+
+  if ((level < 0) || (level >= TASK_LEVEL_NUM) || !task_levels[level].id)
+    return KZ_ERR_PARAM;
+  lv = &task_levels[level];
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  lv->stop = 1;
+  wake = lv->sleeping;
+  lv->sleeping = 0;
+  kz_unlock_ceiling(ceiling);
+  if (wake)
+    kz_wakeup(lv->id);
+
+  id = lv->id;
+  kz_join(id, NULL);
+  lv->id = 0;
+
+  return 0;
+}
+
+/* タスクの初期化（level は kz_task_level_start() の戻り値） */
+int kz_task_init(kz_task_t *task, int level, kz_task_func_t func, void *arg)
+{
+  if ((level < 0) || (level >= TASK_LEVEL_NUM) || !func)
+    return KZ_ERR_PARAM;
+
+  task->func  = func;
+  task->arg   = arg;
+  task->level = level;
+  task->runs  = 0;
+
+  return 0;
+}
+
+/*
+ * イベントの送信（スレッド・割り込みハンドラのどちらからでもよい）
+ * size と p はそのままハンドラに渡す（領域の管理は呼び出し側で行う）。
+ * 未処理のイベントが TASK_EVENT_NUM 個あれば KZ_ERR_FULL を返す。
+ */
+int kz_task_post(kz_task_t *task, int size, char *p)
+{
+  struct task_level *lv = &task_levels[task->level];
+  struct task_event *ev;
+  int ceiling, wake;
+
+  ceiling = kz_lock_ceiling(INTR_LEVEL_HIGH);
+  if (!lv->id || lv->stop) {
+    kz_unlock_ceiling(ceiling);
+    return KZ_ERR_STATE;
+  }
+  ev = task_free;
+  if (!ev) {
+    kz_unlock_ceiling(ceiling);
+    return KZ_ERR_FULL;
+  }
+  KZ_LIST_POP(task_free, next);
+  ev->task = task;
+  ev->size = size;
+  ev->p    = p;
+  KZ_QUEUE_PUT(&lv->que, ev, next);
+  wake = lv->sleeping;
+  lv->sleeping = 0;
+  kz_unlock_ceiling(ceiling);
+
+  if (wake) {
+    if (kz_intr_context())
+      kx_wakeup(lv->id);
+    else
+      kz_wakeup(lv->id);
+  }
+
+  return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef _KOZOS_TASK_H_INCLUDED_
+#define _KOZOS_TASK_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * ランツーコンプリーションのタスク（途中で待たないイベントハンドラ）
+ * kz_task_level_start() で優先度ごとに1つのディスパッチスレッドを起動し、
+ * その優先度のタスクは全てこのスレッドのスタック上で関数として実行する。
+ * タスクごとのTCBもスタックも使わないので、多数のハンドラを1スレッド分の
+ * スタックで動かせる。同じ優先度のタスクの間の切り替えは関数の呼び出しと
+ * 戻りだけで、レジスタの退避・復帰もディスパッチも行わない。
+ * 優先度の高いレベルのタスクは、低いレベルのタスクの実行中にも
+ * 通常のスレッドの切り替えで割り込んで実行される。
+ *
+ * タスクは kz_task_post() で送ったイベントごとに、送った順に1回ずつ
+ * 呼ばれる（同じレベルの中ではFIFO）。ハンドラは以下を守ること。
+ *   ・待ちになるシステムコール（kz_recv(), kz_sleep(), kz_sem_wait() など）を
+ *     呼ばない。待つとその優先度の他の全てのタスクが止まる
+ *   ・最後まで実行して戻る。続きはイベントを自分に送って行う
+ * 待ちにならないシステムコール（kz_send(), kz_task_post() など）は使える。
+ */
+
+struct _kz_task;
+typedef void (*kz_task_func_t)(struct _kz_task *task, int size, char *p);
+
+/* タスクの管理情報（呼び出し側で確保し、kz_task_init() で初期化する） */
+typedef struct _kz_task {
+  kz_task_func_t func;
+  void *arg;   /* ハンドラが使う任意の値 */
+  int level;   /* 実行するレベル(kz_task_level_start() の戻り値) */
+  uint32 runs; /* 実行した回数 */
+} kz_task_t;
+
+int kz_task_level_start(int priority, int stacksize);
+int kz_task_level_stop(int level);
+int kz_task_init(kz_task_t *task, int level, kz_task_func_t func, void *arg);
+int kz_task_post(kz_task_t *task, int size, char *p);
+
+#endif
@@ -0,0 +1,129 @@
+#include "defines.h"
+#include "timer.h"
+
+/*
+ * 16ビットタイマ(ITU)の制御
+ * チャネル0～2をコンペアマッチAによる周期タイマとして利用する
+ */
+
+#define TIMER_NUM 3
+
+#define H8_3069F_TMR16 ((volatile struct h8_3069f_timer16 *)0xffff60)
+#define H8_3069F_TMR16_CH0 ((volatile struct h8_3069f_timer16_ch *)0xffff68)
+#define H8_3069F_TMR16_CH1 ((volatile struct h8_3069f_timer16_ch *)0xffff70)
+#define H8_3069F_TMR16_CH2 ((volatile struct h8_3069f_timer16_ch *)0xffff78)
+
+/* 全チャネル共通のレジスタ */
+struct h8_3069f_timer16 {
+    volatile uint8 tstr;
+    volatile uint8 tsnc;
+    volatile uint8 tmdr;
+    volatile uint8 tolr;
+    volatile uint8 tisra;
+    volatile uint8 tisrb;
+    volatile uint8 tisrc;
+};
+
+/* チャネルごとのレジスタ */
+struct h8_3069f_timer16_ch {
+    volatile uint8 tcr;
+    volatile uint8 tior;
+    volatile uint16 tcnt;
+    volatile uint16 gra;
+    volatile uint16 grb;
+};
+
+#define H8_3069F_TMR16_TCR_PER1     (0<<0)
+#define H8_3069F_TMR16_TCR_PER2     (1<<0)
+#define H8_3069F_TMR16_TCR_PER4     (2<<0)
+#define H8_3069F_TMR16_TCR_PER8     (3<<0)
+#define H8_3069F_TMR16_TCR_CKEG_UP  (0<<3)
+#define H8_3069F_TMR16_TCR_CCLR_GRA (1<<5)
+#define H8_3069F_TMR16_TCR_CCLR_GRB (2<<5)
+
+#define H8_3069F_TMR16_TISRA_IMFA(ch)  (1<<(ch))
+#define H8_3069F_TMR16_TISRA_IMIEA(ch) (1<<((ch) + 4))
+
+#define H8_3069F_TMR16_TSTR_STR(ch) (1<<(ch))
+
+/* φ/8 (20MHz / 8 = 2.5MHz) でカウントした場合の1ミリ秒あたりのカウント数 */
+#define TIMER_COUNT_PER_MSEC 2500
+
+static struct {
+    volatile struct h8_3069f_timer16_ch *ch;
+} regs[TIMER_NUM] = {
+    { H8_3069F_TMR16_CH0 },
+    { H8_3069F_TMR16_CH1 },
+    { H8_3069F_TMR16_CH2 },
+};
+
+/*
+ * 周期タイマの設定
+ * msec ミリ秒ごとにコンペアマッチ割り込みが発生するように設定する
+ * (φ/8 で16ビットのため、最大26ミリ秒まで)
+ */
+KZ_COLD int timer_init(int index, int msec)
+{
+    volatile struct h8_3069f_timer16_ch *ch = regs[index].ch;
+
+    timer_stop(index);
+
+    ch->tcr  = H8_3069F_TMR16_TCR_CCLR_GRA | H8_3069F_TMR16_TCR_CKEG_UP
+      | H8_3069F_TMR16_TCR_PER8;
+    ch->tior = 0;
+    ch->tcnt = 0;
+    ch->gra  = msec * TIMER_COUNT_PER_MSEC - 1;
+
+    H8_3069F_TMR16->tisra &= ~H8_3069F_TMR16_TISRA_IMFA(index);
+    H8_3069F_TMR16->tisra |= H8_3069F_TMR16_TISRA_IMIEA(index);
+
+    return 0;
+}
+
+/* タイマのカウント開始 */
+void timer_start(int index)
+{
+    H8_3069F_TMR16->tstr |= H8_3069F_TMR16_TSTR_STR(index);
+}
+
+/* タイマのカウント停止 */
+void timer_stop(int index)
+{
+    H8_3069F_TMR16->tstr &= ~H8_3069F_TMR16_TSTR_STR(index);
+}
+
+/* コンペアマッチが発生しているか */
+int timer_is_expired(int index)
+{
+    return (H8_3069F_TMR16->tisra & H8_3069F_TMR16_TISRA_IMFA(index)) ? 1 : 0;
+}
+
+/* コンペアマッチのフラグをクリアする（割り込みの解除） */
+void timer_clear(int index)
+{
+    H8_3069F_TMR16->tisra &= ~H8_3069F_TMR16_TISRA_IMFA(index);
+}
+
+/* カウンタの現在値の取得 */
+uint16 timer_get_count(int index)
+{
+    return regs[index].ch->tcnt;
+}
+
+/* 周期（カウンタがクリアされるまでのカウント数）の取得 */
+uint16 timer_get_period(int index)
+{
+    return regs[index].ch->gra + 1;
+}
+
+/* 周期の再設定（count カウントごとにコンペアマッチが発生する、最大0x10000） */
+void timer_set_period(int index, uint32 count)
+{
+    regs[index].ch->gra = count - 1;
+}
+
+/* カウンタの値の設定 */
+void timer_set_count(int index, uint16 count)
+{
+    regs[index].ch->tcnt = count;
+}
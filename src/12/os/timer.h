@@ -0,0 +1,14 @@
+#ifndef _TIMER_H_INCLUDED_
+#define _TIMER_H_INCLUDED_
+
+int timer_init(int index, int msec);
+void timer_start(int index);
+void timer_stop(int index);
+int timer_is_expired(int index);
+void timer_clear(int index);
+uint16 timer_get_count(int index);
+uint16 timer_get_period(int index);
+void timer_set_period(int index, uint32 count);
+void timer_set_count(int index, uint16 count);
+
+#endif
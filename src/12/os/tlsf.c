@@ -0,0 +1,358 @@
+#include "defines.h"
+#include "kozos.h"
+#include "lib.h"
+#include "memory.h"
+#include "trace.h"
+
+/*
+ * TLSF(Two-Level Segregated Fit)による可変長の動的メモリ
+ * memory.c(固定長のメモリプール)の代わりに、make TLSF=1 でリンクする。
+ *
+ * 空きブロックをサイズの2段階の区分（第1段階は2のべき乗、第2段階はそれを
+ * TLSF_SL_NUM 等分したもの）ごとのリストで管理し、各区分に空きブロックが
+ * あるかをビットマップで持つ。獲得・解放ともにリストの走査を行わないので、
+ * 処理時間がサイズや断片化の状態に依存しない。
+ */
+
+/* ヒープのサイズ（_end から userstack までに収まらない場合はリンク時にエラー） */
+#ifndef TLSF_HEAP_SIZE
+#define TLSF_HEAP_SIZE 0x800
+#endif
+
+/* ブロックサイズの単位（ホスト環境ではポインタに合わせて8バイト） */
+#ifdef KZ_HOST
+#define TLSF_ALIGN_LOG2 3
+#else
+#define TLSF_ALIGN_LOG2 2
+#endif
+#define TLSF_ALIGN (1 << TLSF_ALIGN_LOG2)
+
+#define TLSF_SL_LOG2 2 /* 第2段階の分割数(2のべき乗) */
+#define TLSF_SL_NUM  (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_SMALL_BLOCK (1 << TLSF_FL_SHIFT) /* これ未満は第1段階の0番目 */
+#define TLSF_FL_NUM (16 - TLSF_FL_SHIFT + 1) /* 16ビットのサイズを扱える数 */
+
+/*
+ * ブロックのヘッダ
+ * 獲得された領域は size の直後から始まり、next_free 以降はブロックが
+ * 空きのときのみ使う。ブロックサイズは TLSF_ALIGN の倍数なので、
+ * 下位ビットをフラグに使う。
+ */
+typedef struct _tlsf_block {
+  struct _tlsf_block *prev_phys; /* 直前のブロック（直前が空きのときのみ有効） */
+  uint16 size;                   /* 領域のサイズ（ヘッダを含まない）とフラグ */
+  struct _tlsf_block *next_free; /* 同じ区分の空きブロックのリスト */
+  struct _tlsf_block *prev_free;
+} tlsf_block;
+
+#define TLSF_BLOCK_FREE      (1 << 0) /* このブロックは空き */
+#define TLSF_BLOCK_PREV_FREE (1 << 1) /* 直前のブロックは空き */
+#define TLSF_SIZE_MASK       ((uint16)~(TLSF_ALIGN - 1))
+
+#define TLSF_HEADER_SIZE ((int)__builtin_offsetof(tlsf_block, next_free))
+/*
+ * ヘッダの直後の領域とその次のブロックのヘッダが TLSF_ALIGN に揃うこと
+ * (H8/300H では -malign-300 を付けると long が2バイト境界になり、崩れる)
+ */
+KZ_STATIC_ASSERT(!(TLSF_HEADER_SIZE & (TLSF_ALIGN - 1)), tlsf_header_align);
+/* 空きリストのポインタを格納できる最小の領域サイズ */
+#define TLSF_BLOCK_MIN \
+  ((sizeof(tlsf_block) - TLSF_HEADER_SIZE + TLSF_ALIGN - 1) & TLSF_SIZE_MASK)
+
+/*
+ * 獲得できる最大のサイズ（ヒープ全体から先頭のヘッダと番兵を除いたもの）
+ * 番兵はヘッダのみ使うが、構造体の全体が収まる分を空けておく
+ */
+#define TLSF_ALLOC_MAX \
+  ((TLSF_HEAP_SIZE - TLSF_HEADER_SIZE - (int)sizeof(tlsf_block)) \
+   & TLSF_SIZE_MASK)
+
+/*
+ * ヒープの領域
+ * memory.c と同様に .freearea に配置され、userstack にはみ出る場合は
+ * リンク時にエラーとなる
+ */
+static char kzmem_area[TLSF_HEAP_SIZE]
+  __attribute__((section(".bss.freearea"), aligned(8)));
+
+static struct {
+  uint16 fl_bitmap;                        /* 空きのある第1段階の区分 */
+  uint8 sl_bitmap[TLSF_FL_NUM];            /* 空きのある第2段階の区分 */
+  tlsf_block *blocks[TLSF_FL_NUM][TLSF_SL_NUM]; /* 区分ごとの空きリスト */
+
+  /* 使用状況（kz_memstat()で取得する、ヘッダを含むバイト数） */
+  int used;
+  int peak;
+  int fails;
+} tlsf;
+
+/* 最上位の1のビットの位置(x は0以外) */
+static int tlsf_fls(uint16 x)
+{
+  int n = 0;
+  if (x & 0xff00) { n += 8; x >>= 8; }
+  if (x & 0xf0)   { n += 4; x >>= 4; }
+  if (x & 0xc)    { n += 2; x >>= 2; }
+  if (x & 0x2)    { n += 1; }
+  return n;
+}
+
+/* 最下位の1のビットの位置(x は0以外) */
+static int tlsf_ffs(uint16 x)
+{
+  return tlsf_fls(x & -x);
+}
+
+static uint16 block_size(tlsf_block *b)
+{
+  return b->size & TLSF_SIZE_MASK;
+}
+
+/* 物理的に直後のブロック */
+static tlsf_block *block_next(tlsf_block *b)
+{
+  return (tlsf_block *)((char *)b + TLSF_HEADER_SIZE + block_size(b));
+}
+
+/* サイズから区分を求める */
+static void mapping(uint16 size, int *flp, int *slp)
+{
+  int fl;
+
+  if (size < TLSF_SMALL_BLOCK) {
+    *flp = 0;
+    *slp = size >> TLSF_ALIGN_LOG2;
+  } else {
+    fl = tlsf_fls(size);
+    *slp = (size >> (fl - TLSF_SL_LOG2)) ^ TLSF_SL_NUM;
+    *flp = fl - TLSF_FL_SHIFT + 1;
+  }
+}
+
+/* 空きブロックを区分のリストに接続する */
+static void block_insert(tlsf_block *b)
+{
+  int fl, sl;
+
+  mapping(block_size(b), &fl, &sl);
+  b->prev_free = NULL;
+  b->next_free = tlsf.blocks[fl][sl];
+  if (b->next_free)
+    b->next_free->prev_free = b;
+  tlsf.blocks[fl][sl] = b;
+  tlsf.fl_bitmap |= (1 << fl);
+  tlsf.sl_bitmap[fl] |= (1 << sl);
+}
+
+/* 空きブロックを区分のリストから外す */
+static void block_remove(tlsf_block *b)
+{
+  int fl, sl;
+
+  mapping(block_size(b), &fl, &sl);
+  if (b->next_free)
+    b->next_free->prev_free = b->prev_free;
+  if (b->prev_free) {
+    b->prev_free->next_free = b->next_free;
+  } else {
+    tlsf.blocks[fl][sl] = b->next_free;
+    if (!tlsf.blocks[fl][sl]) {
+      tlsf.sl_bitmap[fl] &= ~(1 << sl);
+      if (!tlsf.sl_bitmap[fl])
+        tlsf.fl_bitmap &= ~(1 << fl);
+    }
+  }
+}
+
+/*
+ * size 以上の空きブロックを探す
+ * 区分内の先頭のブロックで必ず足りるように、1つ上の区分から探す
+ */
+static tlsf_block *block_find(uint16 size)
+{
+  int fl, sl;
+  uint16 map, search = size;
+  tlsf_block *b;
+
+  if (search >= TLSF_SMALL_BLOCK)
+    search += (1 << (tlsf_fls(search) - TLSF_SL_LOG2)) - 1;
+  mapping(search, &fl, &sl);
+
+  map = (fl < TLSF_FL_NUM) ? (tlsf.sl_bitmap[fl] & (0xff << sl)) : 0;
+  if (!map && (fl < TLSF_FL_NUM - 1)) {
+    /* 同じ第1段階の区分になければ、より大きい区分から探す */
+    map = tlsf.fl_bitmap & (0xffff << (fl + 1));
+    if (map) {
+      fl = tlsf_ffs(map);
+      map = tlsf.sl_bitmap[fl];
+    }
+  }
+  if (map)
+    return tlsf.blocks[fl][tlsf_ffs(map)];
+
+  /*
+   * 上の区分に空きがなくても、要求サイズと同じ区分の先頭のブロックが
+   * 足りていれば使う（ヒープのほぼ全体を獲得する場合など）
+   */
+  mapping(size, &fl, &sl);
+  b = tlsf.blocks[fl][sl];
+  if (b && (block_size(b) >= size))
+    return b;
+
+  return NULL;
+}
+
+/* 動的メモリの初期化 */
+KZ_COLD int kzmem_init(void)
+{
+  tlsf_block *b, *sentinel;
+
+  memset(&tlsf, 0, sizeof(tlsf));
+
+  /* ヒープ全体を1つの空きブロックとし、末尾に使用中の番兵を置く */
+  b = (tlsf_block *)kzmem_area;
+  b->prev_phys = NULL;
+  b->size = TLSF_ALLOC_MAX | TLSF_BLOCK_FREE;
+
+  sentinel = block_next(b);
+  sentinel->prev_phys = b;
+  sentinel->size = TLSF_BLOCK_PREV_FREE;
+
+  block_insert(b);
+
+  return 0;
+}
+
+/* 獲得できない場合の処理(memory.c と同様) */
+static void *kzmem_fail(void)
+{
+  tlsf.fails++;
+#ifndef KZ_KMALLOC_NULL
+  kz_sysdown();
+#endif
+  return NULL;
+}
+
+/* 動的メモリの獲得 */
+void *kzmem_alloc(int size)
+{
+  tlsf_block *b, *rest;
+  uint16 bsize;
+
+  if ((unsigned int)size > TLSF_ALLOC_MAX)
+    return kzmem_fail();
+
+  /* ブロックサイズの単位に切り上げる */
+  bsize = (size + TLSF_ALIGN - 1) & TLSF_SIZE_MASK;
+  if (bsize < TLSF_BLOCK_MIN)
+    bsize = TLSF_BLOCK_MIN;
+
+  b = block_find(bsize);
+  if (b == NULL)
+    return kzmem_fail();
+  block_remove(b);
+
+  /* 余りが十分に大きければ、分割して空きブロックとして戻す */
+  if (block_size(b) >= bsize + TLSF_HEADER_SIZE + TLSF_BLOCK_MIN) {
+    rest = (tlsf_block *)((char *)b + TLSF_HEADER_SIZE + bsize);
+    rest->prev_phys = b;
+    rest->size = (block_size(b) - bsize - TLSF_HEADER_SIZE)
+      | TLSF_BLOCK_FREE;
+    block_next(rest)->prev_phys = rest;
+    block_insert(rest);
+    b->size = bsize | (b->size & TLSF_BLOCK_PREV_FREE);
+  } else {
+    b->size &= ~TLSF_BLOCK_FREE;
+    block_next(b)->size &= ~TLSF_BLOCK_PREV_FREE;
+  }
+
+  tlsf.used += TLSF_HEADER_SIZE + block_size(b);
+  if (tlsf.used > tlsf.peak)
+    tlsf.peak = tlsf.used;
+
+  KZ_TRACE_EVENT(KZ_TRACE_KMALLOC, 0, size);
+
+  return (char *)b + TLSF_HEADER_SIZE;
+}
+
+/*
+ * 動的メモリの獲得（割り込み処理から）
+ * TLSFは処理時間が一定で、全ての割り込みを禁止した状態で呼ばれるので、
+ * スレッドからの獲得と同じ処理とする
+ */
+void *kzmem_alloc_isr(int size)
+{
+  return kzmem_alloc(size);
+}
+
+/* メモリの解放 */
+void kzmem_free(void *mem)
+{
+  tlsf_block *b, *next;
+
+  b = (tlsf_block *)((char *)mem - TLSF_HEADER_SIZE);
+
+  /* 獲得した領域ではない（または二重解放） */
+  if (((char *)b < kzmem_area) || ((char *)b >= kzmem_area + TLSF_HEAP_SIZE)
+      || (b->size & TLSF_BLOCK_FREE)) {
+    kz_sysdown();
+    return;
+  }
+
+  KZ_TRACE_EVENT(KZ_TRACE_KMFREE, 0, block_size(b));
+  tlsf.used -= TLSF_HEADER_SIZE + block_size(b);
+
+  /* 直前のブロックが空きならば結合する */
+  if (b->size & TLSF_BLOCK_PREV_FREE) {
+    block_remove(b->prev_phys);
+    b->prev_phys->size += TLSF_HEADER_SIZE + block_size(b);
+    b = b->prev_phys;
+  }
+
+  /* 直後のブロックが空きならば結合する */
+  next = block_next(b);
+  if (next->size & TLSF_BLOCK_FREE) {
+    block_remove(next);
+    b->size += TLSF_HEADER_SIZE + block_size(next);
+    next = block_next(b);
+  }
+
+  b->size |= TLSF_BLOCK_FREE;
+  next->prev_phys = b;
+  next->size |= TLSF_BLOCK_PREV_FREE;
+  block_insert(b);
+}
+
+/*
+ * 獲得したブロックの先頭かの確認（正しければ0）
+ * kzmem_free() と同じく、ヒープの範囲内で使用中のブロックであることを調べる
+ */
+int kzmem_check(void *mem)
+{
+  tlsf_block *b = (tlsf_block *)((char *)mem - TLSF_HEADER_SIZE);
+
+  if (((char *)b < kzmem_area) || ((char *)b >= kzmem_area + TLSF_HEAP_SIZE)
+      || (b->size & TLSF_BLOCK_FREE))
+    return KZ_ERR_PARAM;
+
+  return 0;
+}
+
+/*
+ * 使用状況の取得
+ * ヒープ全体を1バイト単位のメモリプール1つとして返す
+ */
+int kzmem_stat(int index, kz_memstat_t *statp)
+{
+  if (index != 0)
+    return KZ_ERR_PARAM;
+
+  statp->size  = 1;
+  statp->num   = TLSF_HEAP_SIZE;
+  statp->used  = tlsf.used;
+  statp->peak  = tlsf.peak;
+  statp->fails = tlsf.fails;
+
+  return 0;
+}
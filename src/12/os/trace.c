@@ -0,0 +1,98 @@
+#include "defines.h"
+#include "kozos.h"
+#include "timer.h"
+#include "trace.h"
+
+#ifdef KZ_TRACE
+
+/* トレースのリングバッファ（古いものから上書きする） */
+static kz_trace_t trace_buf[TRACE_NUM];
+static int trace_pos; /* 次に書き込む位置 */
+static int trace_num; /* 記録されている数（TRACE_NUM で頭打ち） */
+static volatile int trace_enabled = 1;
+
+/*
+ * トレースの記録
+ * カーネル内部（割り込み禁止状態）から呼ぶこと
+ */
+void kz_trace_put(int event, kz_thread_id_t thread, int arg)
+{
+  kz_trace_t *tp = &trace_buf[trace_pos];
+
+  if (!trace_enabled)
+    return;
+
+  tp->tick   = kz_gettick();
+  tp->count  = timer_get_count(TIMER_DEFAULT_DEVICE);
+  tp->thread = thread;
+  tp->event  = event;
+  tp->arg    = arg;
+
+  trace_pos = (trace_pos + 1) & (TRACE_NUM - 1);
+  if (trace_num < TRACE_NUM)
+    trace_num++;
+}
+
+/* 時刻の代わりに値を持つ記録(KZ_TRACE_SYSARG など) */
+void kz_trace_put_value(int event, kz_thread_id_t thread, int arg, uint32 value)
+{
+  kz_trace_t *tp = &trace_buf[trace_pos];
+
+  if (!trace_enabled)
+    return;
+
+  tp->tick   = value >> 16;
+  tp->count  = value;
+  tp->thread = thread;
+  tp->event  = event;
+  tp->arg    = arg;
+
+  trace_pos = (trace_pos + 1) & (TRACE_NUM - 1);
+  if (trace_num < TRACE_NUM)
+    trace_num++;
+}
+
+/* 記録の停止(on = 0)・再開(on = 1)。以前の状態を返す */
+int kz_trace_enable(int on)
+{
+  int old = trace_enabled;
+  trace_enabled = on;
+  return old;
+}
+
+/* 記録の消去 */
+void kz_trace_clear(void)
+{
+  INTR_DISABLE;
+  trace_pos = 0;
+  trace_num = 0;
+  INTR_ENABLE;
+}
+
+/*
+ * 記録の読み出し（スレッドから呼ぶ）
+ * 記録されている分を古い順に buf(TRACE_NUM 個分) にコピーし、その数を返す。
+ * 割り込み処理からも記録されるので、割り込み禁止にしてまとめてコピーする。
+ */
+int kz_trace_read(kz_trace_t *buf)
+{
+  int i, num;
+
+  INTR_DISABLE;
+  num = trace_num;
+  for (i = 0; i < num; i++)
+    buf[i] = trace_buf[(trace_pos - num + i) & (TRACE_NUM - 1)];
+  INTR_ENABLE;
+
+  return num;
+}
+
+/* トレースのリングバッファと、次に書き込む位置（＝最も古い記録）の取得 */
+kz_trace_t *kz_trace_buffer(int *posp)
+{
+  if (posp)
+    *posp = trace_pos;
+  return trace_buf;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef _KOZOS_TRACE_H_INCLUDED_
+#define _KOZOS_TRACE_H_INCLUDED_
+
+#include "defines.h"
+
+/*
+ * カーネルのイベントトレース
+ * -DKZ_TRACE を指定してビルドした場合のみ記録する。
+ * 指定しない場合は KZ_TRACE_EVENT() は空になり、オーバーヘッドはない。
+ * 記録は起動時から有効で、kz_trace_enable() で停止・再開できる
+ * (コマンドスレッドの trace コマンドで操作・表示する)。
+ */
+
+/* リングバッファの記録数 TRACE_NUM は kozos_config.h で設定する（2の累乗） */
+
+/* イベントの種類 */
+#define KZ_TRACE_SYSCALL  1 /* システムコール（arg: 種類） */
+#define KZ_TRACE_SRVCALL  2 /* サービスコール（arg: 種類） */
+#define KZ_TRACE_INTR     3 /* 割り込み（arg: ソフトウェア割り込みベクタの種類） */
+#define KZ_TRACE_DISPATCH 4 /* ディスパッチ（arg: 優先度） */
+#define KZ_TRACE_SEND     5 /* メッセージ送信（arg: メッセージボックスID） */
+#define KZ_TRACE_RECV     6 /* メッセージ受信（arg: メッセージボックスID） */
+#define KZ_TRACE_KMALLOC  7 /* 動的メモリの獲得（arg: サイズ） */
+#define KZ_TRACE_KMFREE   8 /* 動的メモリの解放（arg: ブロックサイズ） */
+/*
+ * kz_strace() を指定したスレッドのシステムコール
+ * KZ_TRACE_SYSCALL の後に引数、処理の終了時に SYSEXIT と戻り値を記録する。
+ * 処理時間は KZ_TRACE_SYSCALL から SYSEXIT までの時刻の差になる。
+ * SYSARG と SYSRET は時刻の代わりに tick と count に値(KZ_TRACE_VALUE())を持つ。
+ */
+#define KZ_TRACE_SYSARG   9 /* 引数（arg: 番号。パラメータの先頭から4バイトずつ） */
+#define KZ_TRACE_SYSEXIT 10 /* 処理の終了（arg: 種類。待ちになった・終了したら0x80を加える） */
+#define KZ_TRACE_SYSRET  11 /* 戻り値（待ちにならず、戻り値のある場合のみ） */
+#define KZ_TRACE_SYSEXIT_BLOCKED 0x80
+
+/* トレースの記録（8バイト） */
+typedef struct {
+  uint16 tick;   /* システムティックの下位16ビット */
+  uint16 count;  /* タイマのカウンタ値（ティック内の経過時間） */
+  uint16 thread; /* スレッドIDの下位16ビット（割り込み処理などでは0） */
+  uint8 event;   /* イベントの種類 */
+  uint8 arg;     /* イベントごとの引数 */
+} kz_trace_t;
+
+/* SYSARG・SYSRET の値 */
+#define KZ_TRACE_VALUE(tp) (((uint32)(tp)->tick << 16) | (tp)->count)
+
+#ifdef KZ_TRACE
+void kz_trace_put(int event, kz_thread_id_t thread, int arg);
+void kz_trace_put_value(int event, kz_thread_id_t thread, int arg, uint32 value);
+kz_trace_t *kz_trace_buffer(int *posp);
+int kz_trace_enable(int on);
+void kz_trace_clear(void);
+int kz_trace_read(kz_trace_t *buf);
+#define KZ_TRACE_EVENT(event, thread, arg) kz_trace_put(event, thread, arg)
+#else
+#define KZ_TRACE_EVENT(event, thread, arg)
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+#include "defines.h"
+#include "wdt.h"
+
+/*
+ * ウォッチドッグタイマ(WDT)の制御
+ * ウォッチドッグタイマモードで使い、カウンタがオーバーフローすると
+ * 内部リセットが発生する（リセット後はブートローダから起動し直す）。
+ * φ/4096 (20MHz / 4096 = 約4.9kHz) でカウントするので、
+ * 約52ミリ秒以内に wdt_kick() でカウンタをクリアし続けること。
+ */
+
+/*
+ * TCSR/TCNT と RSTCSR は誤って書き換えられないように、上位バイトに
+ * キーを付けたワードで書き込む（読み出しはバイト単位）
+ */
+#define H8_3069F_WDT_TCSR_W   ((volatile uint16 *)0xffff8c)
+#define H8_3069F_WDT_TCSR_R   ((volatile uint8 *)0xffff8c)
+#define H8_3069F_WDT_RSTCSR_W ((volatile uint16 *)0xffff8e)
+#define H8_3069F_WDT_RSTCSR_R ((volatile uint8 *)0xffff8f)
+
+#define H8_3069F_WDT_KEY_TCSR   0xa500
+#define H8_3069F_WDT_KEY_TCNT   0x5a00
+#define H8_3069F_WDT_KEY_WRST   0xa500 /* RSTCSR の WRST のクリア */
+
+#define H8_3069F_WDT_TCSR_CKS4096 (7<<0)
+#define H8_3069F_WDT_TCSR_RESERVE (3<<3) /* 読み出すと1 */
+#define H8_3069F_WDT_TCSR_TME     (1<<5)
+#define H8_3069F_WDT_TCSR_WT      (1<<6) /* ウォッチドッグタイマモード */
+#define H8_3069F_WDT_TCSR_OVF     (1<<7)
+
+#define H8_3069F_WDT_RSTCSR_WRST  (1<<7) /* WDTによるリセットが発生した */
+
+static int wdt_reset; /* 起動前のリセットがWDTによるものだったか */
+
+/* 初期化（停止した状態にする） */
+KZ_COLD int wdt_init(void)
+{
+    wdt_stop();
+    wdt_reset = (*H8_3069F_WDT_RSTCSR_R & H8_3069F_WDT_RSTCSR_WRST) ? 1 : 0;
+    if (wdt_reset)
+        *H8_3069F_WDT_RSTCSR_W = H8_3069F_WDT_KEY_WRST;
+    return 0;
+}
+
+/* カウント開始 */
+void wdt_start(void)
+{
+    *H8_3069F_WDT_TCSR_W = H8_3069F_WDT_KEY_TCNT | 0;
+    *H8_3069F_WDT_TCSR_W = H8_3069F_WDT_KEY_TCSR | H8_3069F_WDT_TCSR_WT
+      | H8_3069F_WDT_TCSR_TME | H8_3069F_WDT_TCSR_RESERVE
+      | H8_3069F_WDT_TCSR_CKS4096;
+}
+
+/* カウント停止 */
+void wdt_stop(void)
+{
+    *H8_3069F_WDT_TCSR_W = H8_3069F_WDT_KEY_TCSR | H8_3069F_WDT_TCSR_RESERVE
+      | H8_3069F_WDT_TCSR_CKS4096;
+}
+
+/* カウンタのクリア（オーバーフローまでの時間を延ばす） */
+void wdt_kick(void)
+{
+    *H8_3069F_WDT_TCSR_W = H8_3069F_WDT_KEY_TCNT | 0;
+}
+
+/* 起動前のリセットがWDTによるものだったか */
+int wdt_is_reset(void)
+{
+    return wdt_reset;
+}
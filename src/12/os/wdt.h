@@ -0,0 +1,10 @@
+#ifndef _WDT_H_INCLUDED_
+#define _WDT_H_INCLUDED_
+
+int wdt_init(void);
+void wdt_start(void);
+void wdt_stop(void);
+void wdt_kick(void);
+int wdt_is_reset(void);
+
+#endif
@@ -0,0 +1,112 @@
+#include "defines.h"
+#include "kozos.h"
+#include "interrupt.h"
+#include "lib.h"
+#include "queue.h"
+
+/*
+ * ワークキュー
+ * kz_workq_start() で起動しておいたワーカスレッドが共有のメッセージボックスで
+ * 受信待ちし、kz_workq_submit() で登録された処理を空いたものから実行する。
+ * 処理ごとにスレッドを起動しないので、thread_run() のTCBの検索やスタックの
+ * 初期化のコストがかからない。
+ * 登録情報は固定数のプールから確保するので、登録側の終了や動的メモリの
+ * 状態に影響されない。
+ */
+
+/* 同時に登録できる処理の数 WORKQ_JOB_NUM は kozos_config.h で設定する */
+
+static struct workq_job {
+  struct workq_job *next;
+  kz_work_func_t func;
+  void *arg;
+} workq_jobs[WORKQ_JOB_NUM];
+
+static struct workq_job *workq_free; /* 空きの登録情報のリスト */
+static kz_msgbox_id_t workq_box;
+static int workq_started = 0;
+
+/* ワーカスレッド */
+static int workq_main(int argc, char *argv[])
+{
+  struct workq_job *jp;
+  kz_work_func_t func;
+  void *arg;
+
+  while (1) {
+    kz_recv(workq_box, NULL, (char **)&jp);
+
+    /* 処理を取り出してから、登録情報を空きに戻す */
+    func = jp->func;
+    arg  = jp->arg;
+    INTR_DISABLE;
+    KZ_LIST_PUSH(workq_free, jp, next);
+    INTR_ENABLE;
+
+    func(arg);
+  }
+
+  return 0;
+}
+
+/*
+ * ワーカスレッドの起動（起動したスレッドの数を返す）
+ * 処理関数はワーカスレッドで実行されるので、システムコールも利用できる。
+ */
+int kz_workq_start(int num, int priority, int stacksize)
+{
+  int i;
+
+  if (workq_started)
+    return KZ_ERR_STATE;
+  if (num <= 0)
+    return KZ_ERR_PARAM;
+
+  workq_box = kz_mbox_create(KZ_MSGBOX_ATTR_FIFO);
+  if ((int)workq_box < 0)
+    return KZ_ERR_NORES;
+
+  workq_free = NULL;
+  for (i = 0; i < WORKQ_JOB_NUM; i++)
+    KZ_LIST_PUSH(workq_free, &workq_jobs[i], next);
+  workq_started = 1;
+
+  for (i = 0; i < num; i++) {
+    if (kz_run(workq_main, "workq", priority, stacksize, 0, NULL)
+        == (kz_thread_id_t)-1)
+      break;
+  }
+
+  return i;
+}
+
+/* 処理の登録（空いているワーカスレッドが登録順に実行する） */
+int kz_workq_submit(kz_work_func_t func, void *arg)
+{
+  struct workq_job *jp;
+  int ret;
+
+  if (!workq_started)
+    return KZ_ERR_STATE;
+
+  INTR_DISABLE;
+  jp = workq_free;
+  if (jp)
+    KZ_LIST_POP(workq_free, next);
+  INTR_ENABLE;
+  if (jp == NULL)
+    return KZ_ERR_FULL;
+
+  jp->func = func;
+  jp->arg  = arg;
+  ret = kz_send(workq_box, sizeof(*jp), (char *)jp);
+  if (ret < 0) {
+    /* 送信できなかった（メッセージバッファ不足）ので空きに戻す */
+    INTR_DISABLE;
+    KZ_LIST_PUSH(workq_free, jp, next);
+    INTR_ENABLE;
+    return ret;
+  }
+
+  return 0;
+}
@@ -0,0 +1,287 @@
+/*
+ * kzpack: OSのイメージ(ELF)のロード対象のセグメントをLZSSで圧縮する
+ * (ホストで実行するツール。展開は bootload/lzss.c)
+ *
+ *   kzpack [-n] [-d <前回のELF>] <入力ELF> <出力ELF>
+ *
+ * 出力はELFヘッダ・プログラムヘッダ・セグメントのデータの順に並べ直し、
+ * セクションヘッダは削除する。圧縮したセグメントはプログラムヘッダの
+ * flags に ELF_PF_KZ_LZSS を立て、file_size を圧縮後のサイズにする
+ * (圧縮しても小さくならないセグメントはそのまま格納する)。
+ * -n を指定すると圧縮せずに並べ直すだけにする。
+ * -d を指定すると差分イメージにする。前回転送したELFと内容が同じ読み出し専用の
+ * セグメントはデータを格納せず、flags に ELF_PF_KZ_KEEP を立てて
+ * align にロード済みの内容のCRC32を入れる（kzload がロード済みの内容を確認する）。
+ * 末尾には、イメージ全体のCRC32のフッタ(bootload/crc32.c)を付ける。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ELF_PF_KZ_LZSS 0x00100000 /* bootload/elf.c と合わせること */
+#define ELF_PF_KZ_KEEP 0x00200000
+#define ELF_PF_W       0x2
+
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (15 + LZSS_MIN_MATCH)
+#define LZSS_WINDOW    4096
+
+#define CRC32_FOOTER_MAGIC "KZCR" /* bootload/crc32.c と合わせること */
+
+#define EHDR_SIZE 52
+#define PHDR_SIZE 32
+
+/* ビッグエンディアンの読み書き */
+static unsigned long get32(unsigned char *p)
+{
+  return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16)
+    | ((unsigned long)p[2] << 8) | p[3];
+}
+
+static unsigned int get16(unsigned char *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void put16(unsigned char *p, unsigned int v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+/*
+ * LZSSで圧縮する（貪欲法で最長一致を探す）
+ * out には最悪で size + size / 8 + 1 バイト書き込む。圧縮後のサイズを返す。
+ */
+static long lzss_encode(unsigned char *in, long size, unsigned char *out)
+{
+  long pos = 0, len = 0, flagpos = 0, i, j, start, best, bestdist;
+  int bits = 8;
+
+  while (pos < size) {
+    if (bits == 8) {
+      flagpos = len++;
+      out[flagpos] = 0;
+      bits = 0;
+    }
+
+    best = 0;
+    bestdist = 0;
+    start = (pos > LZSS_WINDOW) ? pos - LZSS_WINDOW : 0;
+    for (i = start; i < pos; i++) {
+      for (j = 0; (j < LZSS_MAX_MATCH) && (pos + j < size); j++) {
+        if (in[i + j] != in[pos + j])
+          break;
+      }
+      if (j > best) {
+        best = j;
+        bestdist = pos - i;
+        if (best == LZSS_MAX_MATCH)
+          break;
+      }
+    }
+
+    if (best >= LZSS_MIN_MATCH) {
+      out[len++] = (bestdist - 1) >> 4;
+      out[len++] = (((bestdist - 1) & 0xf) << 4) | (best - LZSS_MIN_MATCH);
+      pos += best;
+    } else {
+      out[flagpos] |= 1 << bits;
+      out[len++] = in[pos++];
+    }
+    bits++;
+  }
+
+  return len;
+}
+
+/* CRC32(多項式 0xedb88320)。ホストで1回計算するだけなのでテーブルは使わない */
+static unsigned long crc32(unsigned char *p, long size)
+{
+  unsigned long crc = 0xffffffff;
+  int i;
+
+  for (; size > 0; size--) {
+    crc ^= *(p++);
+    for (i = 0; i < 8; i++)
+      crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320) : (crc >> 1);
+  }
+  return crc ^ 0xffffffff;
+}
+
+static unsigned char *read_file(char *name, long *sizep)
+{
+  FILE *fp;
+  unsigned char *buf;
+  long size;
+
+  fp = fopen(name, "rb");
+  if (!fp)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  buf = malloc(size);
+  if (buf && (fread(buf, 1, size, fp) != size)) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+  *sizep = size;
+  return buf;
+}
+
+/*
+ * 前回のELFに、同じアドレス・同じ内容のセグメントがあるか
+ * （書き込み可能なセグメントは、実行中に内容が変わるので対象外）
+ */
+static int is_unchanged(unsigned char *base, long basesize,
+                        unsigned char *in, unsigned char *ph)
+{
+  unsigned char *bph;
+  unsigned int phoff, phsize, phnum, i;
+  unsigned long filesz = get32(ph + 16);
+
+  if ((get32(ph + 24) & ELF_PF_W) || !filesz || (filesz != get32(ph + 20)))
+    return 0;
+
+  phoff  = get32(base + 28);
+  phsize = get16(base + 42);
+  phnum  = get16(base + 44);
+  if ((phsize < PHDR_SIZE) || (phoff + phsize * phnum > basesize))
+    return 0;
+  for (i = 0; i < phnum; i++) {
+    bph = base + phoff + phsize * i;
+    if ((get32(bph) == 1) && (get32(bph + 12) == get32(ph + 12))
+        && (get32(bph + 16) == filesz) && (get32(bph + 20) == filesz)
+        && (get32(bph + 4) + filesz <= basesize)
+        && !memcmp(base + get32(bph + 4), in + get32(ph + 4), filesz))
+      return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned char *in, *out, *ph, *oph, *base = NULL;
+  long insize, outsize, offset, filesz, packed, basesize = 0;
+  unsigned int phoff, phsize, phnum, i;
+  int nopack = 0;
+  FILE *fp;
+
+  while ((argc > 1) && (argv[1][0] == '-')) {
+    if (!strcmp(argv[1], "-n")) {
+      nopack = 1;
+    } else if (!strcmp(argv[1], "-d") && (argc > 2)) {
+      base = read_file(argv[2], &basesize);
+      if (!base || (basesize < EHDR_SIZE)
+          || memcmp(base, "\x7f" "ELF\1\2", 6)) {
+        fprintf(stderr, "%s: not an ELF32 big endian file\n", argv[2]);
+        return 1;
+      }
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s [-n] [-d <previous elf>] <input elf> <output elf>\n",
+            argv[0]);
+    return 1;
+  }
+
+  in = read_file(argv[1], &insize);
+  if (!in || (insize < EHDR_SIZE) || memcmp(in, "\x7f" "ELF\1\2", 6)) {
+    fprintf(stderr, "%s: not an ELF32 big endian file\n", argv[1]);
+    return 1;
+  }
+  phoff  = get32(in + 28);
+  phsize = get16(in + 42);
+  phnum  = get16(in + 44);
+  if ((phsize < PHDR_SIZE) || (phoff + phsize * phnum > insize)) {
+    fprintf(stderr, "%s: bad program header\n", argv[1]);
+    return 1;
+  }
+
+  out = malloc(EHDR_SIZE + PHDR_SIZE * phnum + insize + insize / 8 + 1
+               + 8);
+  if (!out)
+    return 1;
+
+  /* ELFヘッダ（プログラムヘッダは直後に置き、セクションヘッダは削除する） */
+  memcpy(out, in, EHDR_SIZE);
+  put32(out + 28, EHDR_SIZE);
+  put32(out + 32, 0);
+  put16(out + 42, PHDR_SIZE);
+  put16(out + 46, 0);
+  put16(out + 48, 0);
+  put16(out + 50, 0);
+  outsize = EHDR_SIZE + PHDR_SIZE * phnum;
+
+  for (i = 0; i < phnum; i++) {
+    ph = in + phoff + phsize * i;
+    oph = out + EHDR_SIZE + PHDR_SIZE * i;
+    memcpy(oph, ph, PHDR_SIZE);
+    offset = get32(ph + 4);
+    filesz = get32(ph + 16);
+    if (get32(ph) != 1) { /* PT_LOAD 以外はデータを持たせない */
+      put32(oph + 4, 0);
+      put32(oph + 16, 0);
+      continue;
+    }
+    if (offset + filesz > insize) {
+      fprintf(stderr, "%s: bad segment\n", argv[1]);
+      return 1;
+    }
+
+    if (base && is_unchanged(base, basesize, in, ph)) {
+      put32(oph + 4, 0);
+      put32(oph + 16, 0);
+      put32(oph + 24, get32(ph + 24) | ELF_PF_KZ_KEEP);
+      put32(oph + 28, crc32(in + offset, filesz));
+      fprintf(stderr, "segment %u: 0x%08lx %ld bytes unchanged\n",
+              i, get32(ph + 12), filesz);
+      continue;
+    }
+
+    put32(oph + 4, outsize);
+    packed = (filesz && !nopack)
+      ? lzss_encode(in + offset, filesz, out + outsize) : 0;
+    if (packed && (packed < filesz)) {
+      put32(oph + 16, packed);
+      put32(oph + 24, get32(ph + 24) | ELF_PF_KZ_LZSS);
+      outsize += packed;
+    } else {
+      memcpy(out + outsize, in + offset, filesz);
+      outsize += filesz;
+    }
+    fprintf(stderr, "segment %u: 0x%08lx %ld -> %ld bytes\n",
+            i, get32(ph + 12), filesz, get32(oph + 16));
+  }
+
+  /* CRC32のフッタ（ビッグエンディアンのCRC32 + マジック） */
+  put32(out + outsize, crc32(out, outsize));
+  memcpy(out + outsize + 4, CRC32_FOOTER_MAGIC, 4);
+  outsize += 8;
+
+  fp = fopen(argv[2], "wb");
+  if (!fp || (fwrite(out, 1, outsize, fp) != outsize)) {
+    fprintf(stderr, "%s: cannot write\n", argv[2]);
+    return 1;
+  }
+  fclose(fp);
+  fprintf(stderr, "%s: %ld -> %ld bytes\n", argv[2], insize, outsize);
+
+  return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * kzprof: PCサンプリングのプロファイル(prof dump の出力)を関数ごとに集計する
+ * (ホストで実行するツール。出力の形式は os/command.c の prof_dump())
+ *
+ *   kzprof [-t] <シンボル表> [<コンソールのログ>]
+ *
+ * シンボル表は h8300-elf-nm -n kozos の出力（make kozos.sym で作成する）で、
+ * テキストのシンボル(t, T)のみを使う。各サンプルのPCを、それ以下で最も近い
+ * シンボルの関数に対応づけ、サンプル数の多い順に表示する。
+ * PCが0のサンプルは割り込み処理中のもので、(interrupt) として数える。
+ * -t を指定すると、スレッドごとに分けて集計する。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMBOL_MAX 4096
+#define THREAD_MAX 64
+#define LINE_SIZE  256
+
+typedef struct {
+  unsigned long addr;
+  char *name;
+} symbol;
+
+static symbol symbols[SYMBOL_MAX];
+static int symbol_num;
+
+static struct {
+  unsigned int id;
+  char name[32];
+} threads[THREAD_MAX];
+static int thread_num;
+
+/* 集計（関数とスレッドの組ごと。スレッドごとに分けなければスレッドは0） */
+typedef struct {
+  const char *func;
+  unsigned int thread;
+  int count;
+} entry;
+
+static entry *entries;
+static int entry_num, entry_max;
+
+/* シンボル表の読み込み（アドレス順に並んでいること） */
+static int read_symbols(const char *filename)
+{
+  char line[LINE_SIZE], name[LINE_SIZE], type;
+  unsigned long addr;
+  FILE *fp;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    perror(filename);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp) && (symbol_num < SYMBOL_MAX)) {
+    if (sscanf(line, "%lx %c %255s", &addr, &type, name) != 3)
+      continue;
+    if ((type != 't') && (type != 'T'))
+      continue;
+    symbols[symbol_num].addr = addr;
+    /* H8のGCCはシンボルの先頭に _ を付ける */
+    symbols[symbol_num].name = strdup((name[0] == '_') ? name + 1 : name);
+    symbol_num++;
+  }
+  fclose(fp);
+  return 0;
+}
+
+static const char *symbol_find(unsigned long pc)
+{
+  int lo = 0, hi = symbol_num - 1, mid;
+
+  if (!pc)
+    return "(interrupt)";
+  if (!symbol_num || (pc < symbols[0].addr))
+    return "(unknown)";
+  /* pc 以下で最大のアドレスのシンボルを二分探索する */
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (symbols[mid].addr <= pc)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return symbols[lo].name;
+}
+
+static const char *thread_name(unsigned int id)
+{
+  int i;
+
+  for (i = 0; i < thread_num; i++) {
+    if (threads[i].id == id)
+      return threads[i].name;
+  }
+  return "?";
+}
+
+static void entry_add(const char *func, unsigned int thread)
+{
+  int i;
+
+  for (i = 0; i < entry_num; i++) {
+    if ((entries[i].func == func) && (entries[i].thread == thread)) {
+      entries[i].count++;
+      return;
+    }
+  }
+  if (entry_num == entry_max) {
+    entry_max = entry_max ? entry_max * 2 : 64;
+    entries = realloc(entries, sizeof(*entries) * entry_max);
+    if (entries == NULL) {
+      fprintf(stderr, "out of memory.\n");
+      exit(1);
+    }
+  }
+  entries[entry_num].func = func;
+  entries[entry_num].thread = thread;
+  entries[entry_num].count = 1;
+  entry_num++;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+  return ((const entry *)b)->count - ((const entry *)a)->count;
+}
+
+/*
+ * ログを読み、最後の正しい枠のサンプルを集計する
+ * (枠ごとに集計し直し、合計が合わない枠は捨てる)
+ */
+static int read_log(FILE *fp, int per_thread, int *totalp, int *lostp)
+{
+  char line[LINE_SIZE];
+  unsigned int num = 0, lost = 0, interval, tick_msec, sum = 0, check;
+  unsigned long pc;
+  unsigned int thread;
+  int in_frame = 0, found = 0, count = 0;
+  char *p;
+
+  while (fgets(line, sizeof(line), fp)) {
+    if ((p = strchr(line, '\r')) != NULL)
+      *p = '\0';
+    if ((p = strstr(line, "#kzprof ")) != NULL) {
+      if (sscanf(p, "#kzprof %x %x %x %x", &num, &lost, &interval,
+                 &tick_msec) != 4)
+        continue;
+      in_frame = 1;
+      entry_num = 0;
+      thread_num = 0;
+      count = 0;
+      sum = 0;
+      found = 0;
+      continue;
+    }
+    if (!in_frame)
+      continue;
+
+    if (!strncmp(line, "#end ", 5)) {
+      in_frame = 0;
+      if ((sscanf(line, "#end %x", &check) != 1)
+          || (check != (sum & 0xffff)) || (count != (int)num)) {
+        fprintf(stderr, "broken frame (%d/%u samples)\n", count, num);
+        entry_num = 0;
+        continue;
+      }
+      found = 1;
+      *totalp = count;
+      *lostp = lost;
+    } else if (line[0] == 'N') {
+      if (thread_num < THREAD_MAX) {
+        if (sscanf(line, "N %x %31s", &threads[thread_num].id,
+                   threads[thread_num].name) == 2)
+          thread_num++;
+      }
+    } else if (line[0] == 'S') {
+      if (sscanf(line, "S %lx %x", &pc, &thread) != 2)
+        continue;
+      sum += pc + thread;
+      entry_add(symbol_find(pc), per_thread ? thread : 0);
+      count++;
+    }
+  }
+
+  return found ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *fp = stdin;
+  int i, per_thread = 0, total = 0, lost = 0;
+
+  if ((argc > 1) && !strcmp(argv[1], "-t")) {
+    per_thread = 1;
+    argc--;
+    argv++;
+  }
+  if ((argc < 2) || (argc > 3)) {
+    fprintf(stderr, "usage: kzprof [-t] <nm -n output> [<console log>]\n");
+    return 1;
+  }
+  if (read_symbols(argv[1]) < 0)
+    return 1;
+  if (argc == 3) {
+    fp = fopen(argv[2], "r");
+    if (fp == NULL) {
+      perror(argv[2]);
+      return 1;
+    }
+  }
+  if (read_log(fp, per_thread, &total, &lost) < 0) {
+    fprintf(stderr, "no profile frame found.\n");
+    return 1;
+  }
+
+  qsort(entries, entry_num, sizeof(*entries), entry_cmp);
+  printf("samples: %d (lost %d)\n", total, lost);
+  printf("%7s %6s  %s%s\n", "count", "%", per_thread ? "thread          " : "",
+         "function");
+  for (i = 0; i < entry_num; i++) {
+    printf("%7d %6.2f  ", entries[i].count,
+           total ? entries[i].count * 100.0 / total : 0.0);
+    if (per_thread)
+      printf("%-16s", thread_name(entries[i].thread));
+    printf("%s\n", entries[i].func);
+  }
+
+  return 0;
+}
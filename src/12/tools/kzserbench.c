@@ -0,0 +1,525 @@
+/*
+ * kzserbench: ホストとボードの間のシリアルのスループットと往復時間を測る
+ * (ホストで実行するツール。ボードでは make SERBENCH=1 で作ったOSを動かし、
+ *  コマンドスレッドの serbench コマンド(os/command.c)を相手にする)
+ *
+ *   kzserbench [-i <ボーレート>] [-b <ボーレート>[,<ボーレート>]...]
+ *              [-n <バイト数>] [-e <回数>] [-k <バイト数>] [-t <しきい値>]
+ *              <シリアルデバイス>
+ *
+ * -i は現在のボードのボーレート（既定は 9600）。-b で並べたボーレートごとに
+ * serbench baud で切り替えて（ホストも合わせる）、以下を測る。
+ *   rx raw / rx line  ホスト→ボードに -n バイトの試験データを送る。rawモードは
+ *                     -t バイトごとに、行モードは1行ごとにボードが受け取る
+ *   tx send / tx bulk ボード→ホストに -n バイトの試験データを送る（対話用と
+ *                     大量出力用の送信バッファ）
+ *   echo              -k バイトを送ってボードが送り返すまでの時間を -e 回測る
+ * スループットは受け取った側の時間で求める（rx はボードのティック、tx は
+ * ホストの時刻）。line% は回線の速度（ボーレート/10 バイト毎秒）に対する割合。
+ * drops は届かなかったバイト数、errors は内容の誤り（行の数）、overrun と
+ * framing はボードの受信エラーの増分。最後に -i のボーレートに戻す。
+ * バッファのサイズとDMAの有無はボードのビルドで決まるので、serbench conf の
+ * 結果を最初に表示する（比べるには、それぞれの構成で作ったOSで実行する）。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#define BAUD_MAX   16
+#define LINE_SIZE  256
+#define WAIT_MSEC  3000 /* 結果の行を待つ時間（ボードの SERBENCH_TIMEOUT より長く） */
+#define QUIET_MSEC 300  /* 受信が途切れたら送信の終わりとみなす時間 */
+#define PROMPT     "command> "
+
+static int fd = -1;
+static int line_len = 16; /* 試験データの行の長さ（serbench conf の line） */
+static int tick_msec = 10;
+
+/* 受信したデータ（終端に '\0' を置く） */
+static char *inbuf;
+static long inlen, insize;
+
+static const struct {
+  long rate;
+  speed_t speed;
+} speeds[] = {
+  { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 }, { 19200, B19200 },
+  { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 },
+#ifdef B125000
+  { 125000, B125000 },
+#endif
+};
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ホストで使えるボーレートの表の位置（なければ -1） */
+static int speed_index(long rate)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(speeds) / sizeof(*speeds)); i++) {
+    if (speeds[i].rate == rate)
+      return i;
+  }
+  fprintf(stderr, "baud %ld is not supported by the host.\n", rate);
+  return -1;
+}
+
+static int set_baud(long rate)
+{
+  struct termios tio;
+  int i;
+
+  if ((i = speed_index(rate)) < 0)
+    return -1;
+  if (tcgetattr(fd, &tio) < 0) {
+    perror("tcgetattr");
+    return -1;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~CRTSCTS;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  cfsetispeed(&tio, speeds[i].speed);
+  cfsetospeed(&tio, speeds[i].speed);
+  if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+    perror("tcsetattr");
+    return -1;
+  }
+  return 0;
+}
+
+/* msec ミリ秒まで待って受信したものを inbuf に加える（受信したバイト数） */
+static long receive(int msec)
+{
+  struct timeval tv;
+  fd_set fds;
+  long n;
+
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+  tv.tv_sec = msec / 1000;
+  tv.tv_usec = (msec % 1000) * 1000;
+  if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0)
+    return 0;
+  if (insize - inlen < LINE_SIZE) {
+    insize = insize ? insize * 2 : 0x10000;
+    inbuf = realloc(inbuf, insize);
+    if (inbuf == NULL) {
+      fprintf(stderr, "out of memory.\n");
+      exit(1);
+    }
+  }
+  n = read(fd, inbuf + inlen, insize - inlen - 1);
+  if (n <= 0)
+    return 0;
+  inlen += n;
+  inbuf[inlen] = '\0';
+  return n;
+}
+
+/* 受信したデータを捨てる */
+static void discard(void)
+{
+  inlen = 0;
+  if (inbuf)
+    inbuf[0] = '\0';
+}
+
+/* str を受信するまで待つ（受信が msec ミリ秒途切れたら NULL） */
+static char *wait_for(const char *str, int msec)
+{
+  char *p;
+
+  while (1) {
+    if (inbuf && (p = memmem(inbuf, inlen, str, strlen(str))) != NULL)
+      return p;
+    if (!receive(msec))
+      return NULL;
+  }
+}
+
+/* prefix で始まる行を受信して line に入れる（改行は除く） */
+static int wait_line(const char *prefix, char *line, int size)
+{
+  char *p, *end;
+  int len;
+
+  if ((p = wait_for(prefix, WAIT_MSEC)) == NULL)
+    return -1;
+  while ((end = memchr(p, '\n', inbuf + inlen - p)) == NULL) {
+    if (!receive(WAIT_MSEC))
+      return -1;
+    p = memmem(inbuf, inlen, prefix, strlen(prefix));
+  }
+  len = end - p;
+  if ((len > 0) && (p[len - 1] == '\r'))
+    len--;
+  if (len >= size)
+    len = size - 1;
+  memcpy(line, p, len);
+  line[len] = '\0';
+  return 0;
+}
+
+/* 全てを送信する（送信中の受信も inbuf に加える） */
+static int send_all(const char *p, long len)
+{
+  fd_set rfds, wfds;
+  long n;
+
+  while (len > 0) {
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_SET(fd, &rfds);
+    FD_SET(fd, &wfds);
+    if (select(fd + 1, &rfds, &wfds, NULL, NULL) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("select");
+      return -1;
+    }
+    if (FD_ISSET(fd, &rfds))
+      receive(0);
+    if (!FD_ISSET(fd, &wfds))
+      continue;
+    n = write(fd, p, len);
+    if (n < 0) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+        continue;
+      perror("write");
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * コマンドを送る（受信済みのものは捨てる）
+ * 結果の行はコマンド名で始まるので、エコーバックの行を読み捨てておく。
+ */
+static int command(const char *fmt, ...)
+{
+  char buf[LINE_SIZE], *p;
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf) - 2, fmt, ap);
+  va_end(ap);
+  len = strlen(buf);
+  strcpy(buf + len, "\n");
+  discard();
+  if (send_all(buf, len + 1) < 0)
+    return -1;
+  strcpy(buf + len, "\r\n");
+  if ((p = wait_for(buf, WAIT_MSEC)) == NULL)
+    return -1;
+  len = p + len + 2 - inbuf;
+  memmove(inbuf, inbuf + len, inlen - len + 1);
+  inlen -= len;
+  return 0;
+}
+
+/* プロンプトが出るまで空行を送る */
+static int sync_prompt(void)
+{
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    discard();
+    if (send_all("\n", 1) < 0)
+      return -1;
+    if (wait_for(PROMPT, 1000)) {
+      /* 続けて出るものを読み切る */
+      while (receive(100))
+        ;
+      discard();
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* 試験データ（行の中の位置 i のバイトは '0' + i、行の最後は改行） */
+static char *pattern(long len)
+{
+  char *p = malloc(len);
+  long i;
+
+  if (p == NULL) {
+    fprintf(stderr, "out of memory.\n");
+    exit(1);
+  }
+  for (i = 0; i < len; i++)
+    p[i] = ((i % line_len) == line_len - 1) ? '\n' : '0' + (i % line_len);
+  return p;
+}
+
+static void report(long baud, const char *name, long bytes, double sec,
+                   long drops, long errors, int overrun, int framing)
+{
+  double rate = (sec > 0) ? (bytes - drops) / sec : 0;
+
+  printf("%7ld %-9s %8ld %8.3f %9.0f %6.1f %6ld %6ld %7d %7d\n",
+         baud, name, bytes, sec, rate, rate * 1000 / baud, drops, errors,
+         overrun, framing);
+}
+
+/* ホスト→ボード（raw が0ならば行モード） */
+static void bench_rx(long baud, long bytes, int raw, int threshold)
+{
+  char line[LINE_SIZE], mode[16], *data = pattern(bytes);
+  long req, got, ticks;
+  int errors, overrun, framing;
+
+  if (raw)
+    command("serbench rx %ld raw %d", bytes, threshold);
+  else
+    command("serbench rx %ld line", bytes);
+  if (!wait_for("ready.\r\n", WAIT_MSEC))
+    goto fail;
+  send_all(data, bytes);
+  tcdrain(fd);
+  if ((wait_line("serbench rx", line, sizeof(line)) < 0)
+      || (sscanf(line, "serbench rx %15s bytes %ld got %ld ticks %ld "
+                 "errors %d overrun %d framing %d", mode, &req, &got, &ticks,
+                 &errors, &overrun, &framing) != 7))
+    goto fail;
+  report(baud, raw ? "rx raw" : "rx line", bytes,
+         ticks * tick_msec / 1000.0, bytes - got, errors, overrun, framing);
+  free(data);
+  sync_prompt();
+  return;
+fail:
+  printf("%7ld %-9s failed.\n", baud, raw ? "rx raw" : "rx line");
+  free(data);
+  sync_prompt();
+}
+
+/* ボード→ホスト（bulk ならば大量出力用の送信バッファ） */
+static void bench_tx(long baud, long bytes, int bulk)
+{
+  char *p, *start, *end, *q;
+  long wire = bytes + bytes / line_len; /* 行モードなので改行は CR LF */
+  long good = 0, bad = 0;
+  double t0, t1 = 0;
+
+  command("serbench tx %ld%s", bytes, bulk ? " bulk" : "");
+  if ((p = wait_for("ready.\r\n", WAIT_MSEC)) == NULL) {
+    printf("%7ld %-9s failed.\n", baud, bulk ? "tx bulk" : "tx send");
+    sync_prompt();
+    return;
+  }
+  /*
+   * 全て受信した時刻を終わりとする（結果の行の分は誤差として無視する）。
+   * 大量出力用の送信バッファでは結果の行とプロンプトが先に届くことがある
+   * ので、全て受信するか途切れるまで待つ。
+   */
+  t0 = now();
+  while (receive(QUIET_MSEC)) {
+    p = memmem(inbuf, inlen, "ready.\r\n", 8) + 8;
+    if (!t1 && (inbuf + inlen - p >= wire))
+      t1 = now();
+    if (t1 && memmem(p, inbuf + inlen - p, PROMPT, strlen(PROMPT)))
+      break;
+  }
+  if (!t1)
+    t1 = now() - QUIET_MSEC / 1000.0;
+
+  /* 行ごとに調べる（CR、プロンプト、結果の行は除く） */
+  p = memmem(inbuf, inlen, "ready.\r\n", 8) + 8;
+  end = inbuf + inlen;
+  while (p < end) {
+    start = p;
+    while ((p < end) && (*p != '\n'))
+      p++;
+    if (p == end)
+      break;
+    *p++ = '\0';
+    if ((q = strchr(start, '\r')) != NULL)
+      *q = '\0';
+    while (!strncmp(start, PROMPT, strlen(PROMPT)))
+      start += strlen(PROMPT);
+    if (!*start || !strncmp(start, "serbench tx", 11))
+      continue;
+    for (q = start; (q - start < line_len - 1) && (*q == '0' + (q - start)); q++)
+      ;
+    if ((q - start == line_len - 1) && !*q)
+      good++;
+    else
+      bad++;
+  }
+  report(baud, bulk ? "tx bulk" : "tx send", bytes, t1 - t0,
+         bytes - good * line_len, bad, 0, 0);
+  sync_prompt();
+}
+
+/* 往復時間（block バイトを送って、同じバイト数が返るまで） */
+static void bench_echo(long baud, int count, int block)
+{
+  char line[LINE_SIZE], *data = pattern(block);
+  double t, min = 0, max = 0, total = 0;
+  int i, lost = 0, done = 0;
+
+  command("serbench echo %ld %d", (long)count * block, block);
+  if (!wait_for("ready.\r\n", WAIT_MSEC)) {
+    printf("%7ld %-9s failed.\n", baud, "echo");
+    free(data);
+    sync_prompt();
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    discard();
+    t = now();
+    send_all(data, block);
+    while ((inlen < block) && receive(1000))
+      ;
+    if (inlen < block) {
+      lost++;
+      continue;
+    }
+    t = now() - t;
+    if (!done || (t < min))
+      min = t;
+    if (t > max)
+      max = t;
+    total += t;
+    done++;
+  }
+  if (wait_line("serbench echo", line, sizeof(line)) < 0)
+    lost = count;
+  printf("%7ld %-9s %8d  n %d min %.2fms avg %.2fms max %.2fms lost %d\n",
+         baud, "echo", block, done, min * 1000,
+         done ? total * 1000 / done : 0, max * 1000, lost);
+  free(data);
+  sync_prompt();
+}
+
+/* ボードとホストのボーレートを変更する（戻れなければ -1） */
+static int change_baud(long *current, long rate)
+{
+  char line[LINE_SIZE];
+
+  if (rate == *current)
+    return 0;
+  if (speed_index(rate) < 0) /* ボードだけ変わると通じなくなる */
+    return 0;
+  command("serbench baud %ld", rate);
+  if (wait_line("serbench baud", line, sizeof(line)) < 0)
+    return -1;
+  /* ボードが変えなければ（表にない）、元の速度でエラーが表示される */
+  if (wait_for("bad baud rate.", QUIET_MSEC)) {
+    fprintf(stderr, "baud %ld is not supported by the board.\n", rate);
+    return sync_prompt();
+  }
+  if ((set_baud(rate) == 0) && (sync_prompt() == 0)) {
+    *current = rate;
+    return 0;
+  }
+  /* 新しい速度で通じなければ、元の速度に戻して試す */
+  fprintf(stderr, "baud %ld failed.\n", rate);
+  set_baud(*current);
+  return sync_prompt();
+}
+
+int main(int argc, char *argv[])
+{
+  long bauds[BAUD_MAX], initial = 9600, current, bytes = 4096;
+  int baud_num = 0, count = 100, block = 1, threshold = 16, i;
+  char line[LINE_SIZE], *p;
+
+  for (argc--, argv++; (argc > 1) && (argv[0][0] == '-'); argc -= 2, argv += 2) {
+    if (!strcmp(argv[0], "-i")) {
+      initial = atol(argv[1]);
+    } else if (!strcmp(argv[0], "-b")) {
+      for (p = strtok(argv[1], ","); p && (baud_num < BAUD_MAX);
+           p = strtok(NULL, ","))
+        bauds[baud_num++] = atol(p);
+    } else if (!strcmp(argv[0], "-n")) {
+      bytes = atol(argv[1]);
+    } else if (!strcmp(argv[0], "-e")) {
+      count = atoi(argv[1]);
+    } else if (!strcmp(argv[0], "-k")) {
+      block = atoi(argv[1]);
+    } else if (!strcmp(argv[0], "-t")) {
+      threshold = atoi(argv[1]);
+    } else {
+      argc = 0;
+      break;
+    }
+  }
+  if ((argc != 1) || (bytes <= 0) || (count <= 0) || (block <= 0)) {
+    fprintf(stderr, "usage: kzserbench [-i <baud>] [-b <baud>[,<baud>...]] "
+            "[-n <bytes>] [-e <count>] [-k <block>] [-t <threshold>] "
+            "<device>\n");
+    return 1;
+  }
+  if (!baud_num)
+    bauds[baud_num++] = initial;
+
+  fd = open(argv[0], O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) {
+    perror(argv[0]);
+    return 1;
+  }
+  if ((set_baud(initial) < 0) || (sync_prompt() < 0)) {
+    fprintf(stderr, "no response from the board.\n");
+    return 1;
+  }
+  current = initial;
+
+  command("serbench conf");
+  if (wait_line("serbench conf", line, sizeof(line)) < 0) {
+    fprintf(stderr, "serbench is not supported. (build with SERBENCH=1)\n");
+    return 1;
+  }
+  printf("%s\n", line);
+  if ((p = strstr(line, " line ")) != NULL)
+    line_len = atoi(p + 6);
+  if ((p = strstr(line, " tick ")) != NULL)
+    tick_msec = atoi(p + 6);
+  sync_prompt();
+  bytes -= bytes % line_len; /* 行の単位で数える */
+  if (bytes <= 0)
+    bytes = line_len;
+
+  printf("%7s %-9s %8s %8s %9s %6s %6s %6s %7s %7s\n", "baud", "test",
+         "bytes", "sec", "bytes/s", "line%", "drops", "errors", "overrun",
+         "framing");
+  for (i = 0; i < baud_num; i++) {
+    if (change_baud(&current, bauds[i]) < 0) {
+      fprintf(stderr, "lost the board.\n");
+      return 1;
+    }
+    if (current != bauds[i])
+      continue;
+    bench_rx(current, bytes, 1, threshold);
+    bench_rx(current, bytes, 0, 0);
+    bench_tx(current, bytes, 0);
+    bench_tx(current, bytes, 1);
+    bench_echo(current, count, block);
+  }
+  if (change_baud(&current, initial) < 0)
+    fprintf(stderr, "could not restore baud %ld.\n", initial);
+
+  close(fd);
+  return 0;
+}
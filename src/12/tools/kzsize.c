@@ -0,0 +1,404 @@
+/*
+ * kzsize: OSのイメージのメモリ配置とサイズを、リンカスクリプトの領域と比べて表示する
+ * (ホストで実行するツール。make sizes で使う)
+ *
+ *   kzsize [-b <受信バッファのサイズ>] [-i <転送するイメージ>]
+ *          <リンカスクリプト> <ELF> [<オブジェクト>...]
+ *
+ * リンカスクリプトの MEMORY の領域(name(attr) : o = 0x..., l = 0x...)を読み、
+ * ELF（シンボルの残っている kozos.elf）の各セクションを、それを含む最も小さい
+ * 領域に割り当てて、領域ごとの使用量と残りを表示する。
+ * オブジェクトを指定すると、オブジェクトごとのセクションの種類別のサイズも表示する
+ * (種類はセクションの名前と属性で分けるだけで、リンカスクリプトでの配置
+ *  (command.o を外部DRAMに置くなど)は反映しない)。
+ *
+ * 以下の場合はエラーを表示して、終了コードを1にする。
+ * ・セクションがどの領域にも収まらない
+ * ・セクションが userstack の領域に重なる（スレッドのスタックを壊す）
+ * ・-i のイメージが -b のサイズ(kzload の load の受信バッファ)より大きい
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGION_MAX  16
+#define SECTION_MAX 64
+#define LINE_SIZE   256
+
+#define EHDR_SIZE 52
+#define SHDR_SIZE 40
+
+#define SHT_NOBITS    8
+#define SHF_WRITE     0x1
+#define SHF_ALLOC     0x2
+#define SHF_EXECINSTR 0x4
+
+/* オブジェクトごとに集計するセクションの種類 */
+enum {
+  KIND_TEXT, KIND_RODATA, KIND_DATA, KIND_BSS, KIND_POOL, KIND_DRAM, KIND_NUM
+};
+static const char *kind_names[] = {
+  "text", "rodata", "data", "bss", "pool", "dram",
+};
+
+static struct {
+  char name[32];
+  unsigned long origin, length;
+  unsigned long used;
+  int sections;
+} regions[REGION_MAX];
+static int region_num;
+
+typedef struct {
+  const char *name;
+  unsigned long addr, size;
+  int region;
+} section;
+
+static section sections[SECTION_MAX];
+static int section_num;
+
+/* ビッグエンディアンの読み出し */
+static unsigned long get32(unsigned char *p)
+{
+  return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16)
+    | ((unsigned long)p[2] << 8) | p[3];
+}
+
+static unsigned int get16(unsigned char *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static unsigned char *read_file(const char *name, long *sizep)
+{
+  FILE *fp;
+  unsigned char *buf;
+  long size;
+
+  fp = fopen(name, "rb");
+  if (!fp)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  buf = malloc(size);
+  if (buf && (fread(buf, 1, size, fp) != (size_t)size)) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+  *sizep = size;
+  return buf;
+}
+
+/* リンカスクリプトの MEMORY の領域の読み込み */
+static int read_regions(const char *filename)
+{
+  char line[LINE_SIZE];
+  int in_memory = 0;
+  FILE *fp;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    perror(filename);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    if (!strncmp(line, "MEMORY", 6)) {
+      in_memory = 1;
+      continue;
+    }
+    if (!in_memory)
+      continue;
+    if (strchr(line, '}'))
+      break;
+    if (region_num >= REGION_MAX)
+      continue;
+    if (sscanf(line, " %31[A-Za-z0-9_](%*[a-z]) : o = %lx, l = %lx",
+               regions[region_num].name, &regions[region_num].origin,
+               &regions[region_num].length) == 3)
+      region_num++;
+  }
+  fclose(fp);
+  if (!region_num) {
+    fprintf(stderr, "%s: no MEMORY regions found\n", filename);
+    return -1;
+  }
+  return 0;
+}
+
+static int region_find(const char *name)
+{
+  int i;
+
+  for (i = 0; i < region_num; i++) {
+    if (!strcmp(regions[i].name, name))
+      return i;
+  }
+  return -1;
+}
+
+/* セクションを含む最も小さい領域（なければ -1） */
+static int region_of(unsigned long addr, unsigned long size)
+{
+  int i, found = -1;
+
+  for (i = 0; i < region_num; i++) {
+    if ((addr < regions[i].origin)
+        || (addr + size > regions[i].origin + regions[i].length))
+      continue;
+    if ((found < 0) || (regions[i].length < regions[found].length))
+      found = i;
+  }
+  return found;
+}
+
+/* ELFのセクションヘッダの検査（セクションヘッダの先頭と数を返す） */
+static unsigned char *elf_sections(const char *name, unsigned char *elf,
+                                   long size, unsigned int *nump,
+                                   unsigned char **strp)
+{
+  unsigned long shoff;
+  unsigned int shsize, shnum, shstrndx;
+  unsigned char *sh;
+
+  if ((size < EHDR_SIZE) || memcmp(elf, "\x7f" "ELF\1\2", 6)) {
+    fprintf(stderr, "%s: not an ELF32 big endian file\n", name);
+    return NULL;
+  }
+  shoff    = get32(elf + 32);
+  shsize   = get16(elf + 46);
+  shnum    = get16(elf + 48);
+  shstrndx = get16(elf + 50);
+  if (!shoff || (shsize < SHDR_SIZE)
+      || (shoff + shsize * shnum > (unsigned long)size) || (shstrndx >= shnum)) {
+    fprintf(stderr, "%s: no section headers\n", name);
+    return NULL;
+  }
+  sh = elf + shoff + shsize * shstrndx;
+  if (get32(sh + 16) + get32(sh + 20) > (unsigned long)size) {
+    fprintf(stderr, "%s: broken section name table\n", name);
+    return NULL;
+  }
+  *strp = elf + get32(sh + 16);
+  *nump = shnum;
+  return elf + shoff;
+}
+
+/* 実行イメージの、メモリを占めるセクションの読み込み */
+static int read_image(const char *name)
+{
+  unsigned char *elf, *shdrs, *sh, *strtab;
+  unsigned int shnum, shsize, i;
+  long size;
+
+  elf = read_file(name, &size);
+  if (elf == NULL) {
+    perror(name);
+    return -1;
+  }
+  if ((shdrs = elf_sections(name, elf, size, &shnum, &strtab)) == NULL)
+    return -1;
+  shsize = get16(elf + 46);
+  for (i = 0; (i < shnum) && (section_num < SECTION_MAX); i++) {
+    sh = shdrs + shsize * i;
+    if (!(get32(sh + 8) & SHF_ALLOC) || !get32(sh + 20))
+      continue;
+    sections[section_num].name = (const char *)strtab + get32(sh);
+    sections[section_num].addr = get32(sh + 12);
+    sections[section_num].size = get32(sh + 20);
+    section_num++;
+  }
+  return 0;
+}
+
+static int section_cmp(const void *a, const void *b)
+{
+  unsigned long x = ((const section *)a)->addr, y = ((const section *)b)->addr;
+
+  return (x < y) ? -1 : (x > y);
+}
+
+/* セクションの一覧と、領域ごとの使用量の表示 */
+static int print_map(void)
+{
+  section *sp;
+  unsigned long end, limit;
+  int i, j, err = 0, us;
+
+  qsort(sections, section_num, sizeof(*sections), section_cmp);
+  us = region_find("userstack");
+
+  printf("%-12s %8s %8s %6s  %s\n", "section", "start", "end", "size",
+         "region");
+  for (i = 0; i < section_num; i++) {
+    sp = &sections[i];
+    sp->region = region_of(sp->addr, sp->size);
+    end = sp->addr + sp->size;
+    printf("%-12s %08lx %08lx %6lu  %s\n", sp->name, sp->addr, end, sp->size,
+           (sp->region < 0) ? "(none)" : regions[sp->region].name);
+    if (sp->region < 0) {
+      fprintf(stderr, "error: %s does not fit in any region\n", sp->name);
+      err = 1;
+      continue;
+    }
+    regions[sp->region].used += sp->size;
+    regions[sp->region].sections++;
+    if ((us >= 0) && (sp->addr < regions[us].origin + regions[us].length)
+        && (end > regions[us].origin)) {
+      fprintf(stderr, "error: %s overlaps userstack (%08lx-%08lx)\n",
+              sp->name, regions[us].origin,
+              regions[us].origin + regions[us].length);
+      err = 1;
+    }
+  }
+
+  /*
+   * 領域ごとの使用量（セクションのある領域のみ）
+   * userstack が途中から始まる領域(ram)は、その手前までを使える大きさとする
+   */
+  printf("\n%-12s %8s %7s %7s %7s\n", "region", "origin", "size", "used",
+         "free");
+  for (i = 0; i < region_num; i++) {
+    if (!regions[i].sections)
+      continue;
+    limit = regions[i].origin + regions[i].length;
+    if ((us >= 0) && (i != us) && (regions[us].origin > regions[i].origin)
+        && (regions[us].origin < limit))
+      limit = regions[us].origin;
+    /* 領域内の最後のセクションの終端から残りを求める（隙間は使用量に含めない） */
+    end = regions[i].origin;
+    for (j = 0; j < section_num; j++) {
+      if ((sections[j].region == i)
+          && (sections[j].addr + sections[j].size > end))
+        end = sections[j].addr + sections[j].size;
+    }
+    printf("%-12s %08lx %7lu %7lu %7ld\n", regions[i].name, regions[i].origin,
+           limit - regions[i].origin, regions[i].used, (long)(limit - end));
+  }
+
+  return err ? -1 : 0;
+}
+
+/* セクションの名前と属性から種類を決める（bootload/elf.c のロードとは無関係） */
+static int section_kind(const char *name, unsigned long type,
+                        unsigned long flags)
+{
+  if (!strcmp(name, ".text.dram") || !strcmp(name, ".dram"))
+    return KIND_DRAM;
+  if (!strcmp(name, ".bss.freearea"))
+    return KIND_POOL;
+  if (flags & SHF_EXECINSTR)
+    return KIND_TEXT;
+  if (type == SHT_NOBITS)
+    return KIND_BSS;
+  if (flags & SHF_WRITE)
+    return KIND_DATA;
+  return KIND_RODATA;
+}
+
+/* オブジェクトごとの種類別のサイズの表示 */
+static int print_objects(int num, char *names[])
+{
+  unsigned long sizes[KIND_NUM], totals[KIND_NUM], flags;
+  unsigned char *elf, *shdrs, *sh, *strtab;
+  unsigned int shnum, shsize, i;
+  long size;
+  int n, k;
+
+  memset(totals, 0, sizeof(totals));
+  printf("\n%-14s", "object");
+  for (k = 0; k < KIND_NUM; k++)
+    printf(" %6s", kind_names[k]);
+  printf(" %6s\n", "total");
+
+  for (n = 0; n <= num; n++) {
+    if (n == num) {
+      memcpy(sizes, totals, sizeof(sizes));
+      printf("%-14s", "(total)");
+    } else {
+      elf = read_file(names[n], &size);
+      if (elf == NULL) {
+        perror(names[n]);
+        return -1;
+      }
+      if ((shdrs = elf_sections(names[n], elf, size, &shnum, &strtab)) == NULL)
+        return -1;
+      shsize = get16(elf + 46);
+      memset(sizes, 0, sizeof(sizes));
+      for (i = 0; i < shnum; i++) {
+        sh = shdrs + shsize * i;
+        flags = get32(sh + 8);
+        if (!(flags & SHF_ALLOC))
+          continue;
+        k = section_kind((const char *)strtab + get32(sh), get32(sh + 4), flags);
+        sizes[k] += get32(sh + 20);
+        totals[k] += get32(sh + 20);
+      }
+      free(elf);
+      printf("%-14s", names[n]);
+    }
+    size = 0;
+    for (k = 0; k < KIND_NUM; k++) {
+      printf(" %6lu", sizes[k]);
+      size += sizes[k];
+    }
+    printf(" %6ld\n", size);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *image = NULL;
+  unsigned long buffer_size = 0;
+  unsigned char *p;
+  long size;
+  int err = 0;
+
+  for (argc--, argv++; (argc > 0) && (argv[0][0] == '-'); argc--, argv++) {
+    if (!strcmp(argv[0], "-b") && (argc > 1)) {
+      buffer_size = strtoul(argv[1], NULL, 0);
+    } else if (!strcmp(argv[0], "-i") && (argc > 1)) {
+      image = argv[1];
+    } else {
+      argc = 0; /* 使い方を表示する */
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if (argc < 2) {
+    fprintf(stderr, "usage: kzsize [-b <buffer size>] [-i <image>] "
+            "<linker script> <elf> [<object>...]\n");
+    return 1;
+  }
+  if ((read_regions(argv[0]) < 0) || (read_image(argv[1]) < 0))
+    return 1;
+
+  if (print_map() < 0)
+    err = 1;
+  if ((argc > 2) && (print_objects(argc - 2, argv + 2) < 0))
+    err = 1;
+
+  if (image) {
+    if ((p = read_file(image, &size)) == NULL) {
+      perror(image);
+      return 1;
+    }
+    free(p);
+    printf("\nimage %s: %ld bytes", image, size);
+    if (buffer_size) {
+      printf(" (buffer %lu, free %ld)", buffer_size, (long)buffer_size - size);
+      if ((unsigned long)size > buffer_size) {
+        fprintf(stderr, "error: %s exceeds the load buffer (%ld > %lu bytes)\n",
+                image, size, buffer_size);
+        err = 1;
+      }
+    }
+    printf("\n");
+  }
+
+  return err;
+}
@@ -0,0 +1,574 @@
+/*
+ * kzstack: 関数ごとのスタック使用量から、スレッドの最悪のスタック使用量を求める
+ * (ホストで実行するツール。make stack で使う)
+ *
+ *   kzstack [-m <マージン>] [-I <呼び出し元>=<パターン>]...
+ *           [-w <使用量のファイル> -o <ヘッダファイル>]
+ *           [-s <ヘッダファイル>] -r <関数>[=<上限>]... <.ci ファイル>...
+ *
+ * GCC の -fcallgraph-info=su で作られる .ci ファイル(VCG形式)を読み、
+ * 関数のフレームの大きさ(node の label の "N bytes")と呼び出し関係(edge)から、
+ * -r で指定した関数を起点とする最も深い呼び出しの経路とその合計を表示する。
+ * 再帰（呼び出しの環）は1回分のみ数え、"recursive" と表示する。
+ *
+ * 関数ポインタ経由の呼び出し(__indirect_call)はたどれないので、-I で
+ * 呼び出し先を指定する（パターンは関数名の完全一致か、先頭・末尾の * のみ）。
+ *   例: -I 'interrupt=thread_intr' -I 'thread_intr=*_intr'
+ * 指定のない間接呼び出しは、その関数名を警告として表示する。
+ *
+ * -m はスレッドの起点に加える大きさで、割り込み時にスレッドのスタックに
+ * 保存されるレジスタの分などを指定する（割り込みスタックの起点には加えない
+ * よう、上限の後ろに ! を付けた起点は除く）。
+ * 上限を指定した起点が上限を超えた場合は、終了コードを1にする。
+ *
+ * -s はスタックサイズのヘッダ(stacksize.h)を読み、STACKSIZE_<名前> ごとに
+ * "<名前>_main"（小文字）を起点として、その値を上限に加える（-r と同じ扱い）。
+ *
+ * -w と -o はスタックサイズの推奨値の作成で、make stacksize で使う。
+ * -w には実機の stack コマンドの出力（スレッド名と使用量の最大値）を渡す。
+ * "<名前>_main" の起点をスレッド <名前>（後ろに数字の付いた同名のスレッドを
+ * 含む）とみなし、使用量の最大値に -m を加えたものと解析の結果の大きい方を
+ * 16バイト単位に切り上げて、-o のヘッダの STACKSIZE_<名前> に書き込む。
+ * どちらも求まらないスレッドは、ヘッダの元の値を残す。
+ * この場合は上限を超えても失敗にしない（推奨値で上限を置き換えるため）。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROOT_MAX     32
+#define INDIRECT_MAX 32
+#define LINE_SIZE    1024
+#define NAME_SIZE    64
+
+#define ROOT_SUFFIX      "_main"
+#define STACKSIZE_PREFIX "STACKSIZE_"
+
+#define INDIRECT_NAME "__indirect_call"
+
+typedef struct {
+  char *title;   /* .ci のノード名（static 関数は "ファイル:関数名"） */
+  const char *name;
+  long size;     /* フレームの大きさ（定義が読めていなければ -1） */
+  int dynamic;   /* alloca などで大きさが変わる */
+  int *callees;
+  int callee_num, callee_max;
+  int indirect;  /* 関数ポインタ経由の呼び出しがある */
+  /* 探索の状態 */
+  int state;     /* 0:未探索 1:探索中 2:済み */
+  long depth;    /* この関数から始まる最大の使用量 */
+  int next;      /* 最大となる経路の次の関数(-1 で末端) */
+  int recursive;
+} func;
+
+static func *funcs;
+static int func_num, func_max;
+
+static struct {
+  const char *name;
+  long limit;    /* 0 なら上限なし */
+  int nomargin;
+  long total;    /* 解析の結果（見つからなければ0） */
+  long used;     /* -w の使用量の最大値（なければ0） */
+} roots[ROOT_MAX];
+static int root_num;
+
+static struct {
+  const char *caller;
+  const char *pattern;
+} indirects[INDIRECT_MAX];
+static int indirect_num;
+
+static int func_find(const char *title)
+{
+  int i;
+
+  for (i = 0; i < func_num; i++) {
+    if (!strcmp(funcs[i].title, title))
+      return i;
+  }
+  return -1;
+}
+
+/* 関数名での検索（同じ名前の static 関数が複数あれば最初のもの） */
+static int func_find_name(const char *name)
+{
+  int i;
+
+  for (i = 0; i < func_num; i++) {
+    if (!strcmp(funcs[i].name, name))
+      return i;
+  }
+  return -1;
+}
+
+static int func_get(const char *title)
+{
+  const char *p;
+  int i;
+
+  if ((i = func_find(title)) >= 0)
+    return i;
+  if (func_num == func_max) {
+    func_max = func_max ? func_max * 2 : 256;
+    funcs = realloc(funcs, sizeof(*funcs) * func_max);
+    if (funcs == NULL) {
+      fprintf(stderr, "out of memory.\n");
+      exit(1);
+    }
+  }
+  memset(&funcs[func_num], 0, sizeof(*funcs));
+  funcs[func_num].title = strdup(title);
+  p = strrchr(funcs[func_num].title, ':');
+  funcs[func_num].name = p ? p + 1 : funcs[func_num].title;
+  funcs[func_num].size = -1;
+  return func_num++;
+}
+
+static void callee_add(int caller, int callee)
+{
+  func *fp = &funcs[caller];
+  int i;
+
+  for (i = 0; i < fp->callee_num; i++) {
+    if (fp->callees[i] == callee)
+      return;
+  }
+  if (fp->callee_num == fp->callee_max) {
+    fp->callee_max = fp->callee_max ? fp->callee_max * 2 : 8;
+    fp->callees = realloc(fp->callees, sizeof(int) * fp->callee_max);
+    if (fp->callees == NULL) {
+      fprintf(stderr, "out of memory.\n");
+      exit(1);
+    }
+  }
+  fp->callees[fp->callee_num++] = callee;
+}
+
+/* 行の中の key: "..." の文字列を取り出す */
+static int get_string(const char *line, const char *key, char *buf, int size)
+{
+  const char *p;
+  int n = 0;
+
+  if ((p = strstr(line, key)) == NULL)
+    return -1;
+  p += strlen(key);
+  while (*p == ' ')
+    p++;
+  if (*p++ != '"')
+    return -1;
+  while (*p && (*p != '"') && (n < size - 1)) {
+    if ((*p == '\\') && p[1])
+      p++;
+    buf[n++] = *p++;
+  }
+  buf[n] = '\0';
+  return 0;
+}
+
+/*
+ * .ci ファイルの読み込み
+ *   node: { title: "関数名" label: "関数名\nファイル:行:桁\nN bytes (static)" }
+ *   edge: { sourcename: "呼び出し元" targetname: "呼び出し先" ... }
+ * 他のファイルで定義される関数は大きさのないノードになるので、
+ * 同じノード名のものは1つにまとめて、大きさのあるものを使う。
+ */
+static int read_ci(const char *filename)
+{
+  char line[LINE_SIZE], name[LINE_SIZE], label[LINE_SIZE], target[LINE_SIZE];
+  const char *p;
+  long size;
+  FILE *fp;
+  int i;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    perror(filename);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    if (!strncmp(line, "node:", 5)) {
+      if (get_string(line, "title:", name, sizeof(name)) < 0)
+        continue;
+      if (get_string(line, "label:", label, sizeof(label)) < 0)
+        continue;
+      /* ラベルの改行は \n のまま(エスケープを外すと n)なので、bytes の前の数を探す */
+      if ((p = strstr(label, " bytes")) == NULL)
+        continue;
+      while ((p > label) && (p[-1] >= '0') && (p[-1] <= '9'))
+        p--;
+      size = atol(p);
+      i = func_get(name);
+      if (size > funcs[i].size)
+        funcs[i].size = size;
+      if (strstr(label, "dynamic"))
+        funcs[i].dynamic = 1;
+    } else if (!strncmp(line, "edge:", 5)) {
+      if (get_string(line, "sourcename:", name, sizeof(name)) < 0)
+        continue;
+      if (get_string(line, "targetname:", target, sizeof(target)) < 0)
+        continue;
+      i = func_get(name);
+      if (!strcmp(target, INDIRECT_NAME))
+        funcs[i].indirect = 1;
+      else
+        callee_add(i, func_get(target));
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+/* 関数名とパターン（完全一致か、先頭・末尾の * のみ）の照合 */
+static int match(const char *pattern, const char *name)
+{
+  int plen = strlen(pattern), nlen = strlen(name);
+
+  if (plen && (pattern[0] == '*')) {
+    plen--;
+    return (nlen >= plen) && !strcmp(name + nlen - plen, pattern + 1);
+  }
+  if (plen && (pattern[plen - 1] == '*'))
+    return !strncmp(pattern, name, plen - 1);
+  return !strcmp(pattern, name);
+}
+
+/* -I の指定から関数ポインタ経由の呼び出し先を加える */
+static void resolve_indirects(void)
+{
+  int i, j, caller;
+
+  for (i = 0; i < indirect_num; i++) {
+    if ((caller = func_find_name(indirects[i].caller)) < 0) {
+      fprintf(stderr, "warning: %s is not found.\n", indirects[i].caller);
+      continue;
+    }
+    for (j = 0; j < func_num; j++) {
+      if ((j != caller) && (funcs[j].size >= 0)
+          && match(indirects[i].pattern, funcs[j].name))
+        callee_add(caller, j);
+    }
+    funcs[caller].indirect = 0;
+  }
+}
+
+/* 起点の関数名からスレッド名を得る（"<名前>_main" でなければ -1） */
+static int root_thread(const char *root, char *name)
+{
+  int len = strlen(root) - strlen(ROOT_SUFFIX);
+
+  if ((len <= 0) || (len >= NAME_SIZE) || strcmp(root + len, ROOT_SUFFIX))
+    return -1;
+  memcpy(name, root, len);
+  name[len] = '\0';
+  return 0;
+}
+
+/*
+ * stack コマンドの出力の読み込み
+ *   <スレッド名> <使用量> <サイズ> <推奨値>（数値は16進数）
+ * 数値で始まらない行（見出しやプロンプト）は読み飛ばす。
+ */
+static int read_watermark(const char *filename)
+{
+  char line[LINE_SIZE], name[LINE_SIZE], thread[NAME_SIZE];
+  unsigned long used, size;
+  FILE *fp;
+  int r, len;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    perror(filename);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "%s %lx %lx", name, &used, &size) != 3)
+      continue;
+    for (r = 0; r < root_num; r++) {
+      if (root_thread(roots[r].name, thread) < 0)
+        continue;
+      len = strlen(thread);
+      if (strncmp(name, thread, len)
+          || (name[len + strspn(name + len, "0123456789")] != '\0'))
+        continue;
+      if ((long)used > roots[r].used)
+        roots[r].used = used;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+/*
+ * スタックサイズのヘッダの作成
+ * 元のヘッダの STACKSIZE_* の値を読んでおき、推奨値の求まったものだけを
+ * 置き換えて書き直す。
+ */
+static int write_stacksize(const char *filename, long margin)
+{
+  static struct {
+    char name[NAME_SIZE];
+    long size;
+    int updated;
+  } entries[ROOT_MAX];
+  char line[LINE_SIZE], name[LINE_SIZE], thread[NAME_SIZE];
+  int entry_num = 0, i, r;
+  long size;
+  FILE *fp;
+
+  if ((fp = fopen(filename, "r")) != NULL) {
+    while (fgets(line, sizeof(line), fp) && (entry_num < ROOT_MAX)) {
+      if ((sscanf(line, "#define " STACKSIZE_PREFIX "%s %li", name, &size) != 2)
+          || (strlen(name) >= NAME_SIZE))
+        continue;
+      strcpy(entries[entry_num].name, name);
+      entries[entry_num].size = size;
+      entry_num++;
+    }
+    fclose(fp);
+  }
+
+  for (r = 0; r < root_num; r++) {
+    if (root_thread(roots[r].name, thread) < 0)
+      continue;
+    for (i = 0; thread[i]; i++) {
+      if ((thread[i] >= 'a') && (thread[i] <= 'z'))
+        thread[i] -= 'a' - 'A';
+    }
+    for (i = 0; i < entry_num; i++) {
+      if (!strcmp(entries[i].name, thread))
+        break;
+    }
+    if (i == entry_num) {
+      if (entry_num == ROOT_MAX)
+        continue;
+      strcpy(entries[entry_num].name, thread);
+      entries[entry_num].size = roots[r].limit;
+      entry_num++;
+    }
+    size = roots[r].used ? (roots[r].used + margin) : 0;
+    if (roots[r].total > size)
+      size = roots[r].total;
+    if (size) {
+      entries[i].size = (size + 15) & ~15L;
+      entries[i].updated = 1;
+    }
+  }
+
+  fp = fopen(filename, "w");
+  if (fp == NULL) {
+    perror(filename);
+    return -1;
+  }
+  fprintf(fp, "#ifndef _KOZOS_STACKSIZE_H_INCLUDED_\n"
+          "#define _KOZOS_STACKSIZE_H_INCLUDED_\n\n"
+          "/*\n"
+          " * main.c で起動するスレッドのスタックサイズ\n"
+          " * make stacksize WATERMARK=<ファイル> で、実機の stack コマンドの出力と\n"
+          " * スタック使用量の解析(make stack)から推奨値を求めて作り直す。\n"
+          " * 作り直す前の値は、推奨値が求まらなかったスレッドにそのまま残る。\n"
+          " */\n\n");
+  for (i = 0; i < entry_num; i++) {
+    if (!entries[i].size)
+      continue;
+    fprintf(fp, "#ifndef " STACKSIZE_PREFIX "%s\n"
+            "#define " STACKSIZE_PREFIX "%s 0x%lx\n#endif\n",
+            entries[i].name, entries[i].name, entries[i].size);
+    printf("%s%-12s 0x%lx%s\n", STACKSIZE_PREFIX, entries[i].name,
+           entries[i].size, entries[i].updated ? "" : " (unchanged)");
+  }
+  fprintf(fp, "\n#endif\n");
+  fclose(fp);
+  return 0;
+}
+
+/*
+ * スタックサイズのヘッダ(-s)の読み込み
+ * STACKSIZE_<名前> ごとに "<名前>_main" の起点を加える
+ */
+static int read_stacksize(const char *filename)
+{
+  char line[LINE_SIZE], name[LINE_SIZE], *root;
+  long size;
+  FILE *fp;
+  int i;
+
+  if ((fp = fopen(filename, "r")) == NULL) {
+    perror(filename);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp) && (root_num < ROOT_MAX)) {
+    if ((sscanf(line, "#define " STACKSIZE_PREFIX "%s %li", name, &size) != 2)
+        || (strlen(name) >= NAME_SIZE))
+      continue;
+    root = malloc(strlen(name) + strlen(ROOT_SUFFIX) + 1);
+    if (root == NULL) {
+      fprintf(stderr, "out of memory.\n");
+      fclose(fp);
+      return -1;
+    }
+    for (i = 0; name[i]; i++) {
+      root[i] = name[i];
+      if ((root[i] >= 'A') && (root[i] <= 'Z'))
+        root[i] += 'a' - 'A';
+    }
+    strcpy(root + i, ROOT_SUFFIX);
+    roots[root_num].name = root;
+    roots[root_num].limit = size;
+    root_num++;
+  }
+  fclose(fp);
+  return 0;
+}
+
+/* 関数から始まる最大の使用量（探索中の関数への呼び出しは再帰として数えない） */
+static long depth(int index)
+{
+  func *fp = &funcs[index];
+  long d, max = 0;
+  int i, c;
+
+  if (fp->state == 2)
+    return fp->depth;
+  fp->state = 1;
+  fp->next = -1;
+  for (i = 0; i < fp->callee_num; i++) {
+    c = fp->callees[i];
+    if (funcs[c].state == 1) {
+      fp->recursive = 1;
+      continue;
+    }
+    d = depth(c);
+    if (d > max) {
+      max = d;
+      fp->next = c;
+    }
+  }
+  fp->depth = ((fp->size > 0) ? fp->size : 0) + max;
+  fp->state = 2;
+  return fp->depth;
+}
+
+/* 最大となる経路の表示（フレームの大きさと、間接呼び出し・再帰などの印） */
+static void print_path(int index)
+{
+  func *fp;
+  int i;
+
+  for (i = index; i >= 0; i = funcs[i].next) {
+    fp = &funcs[i];
+    if (fp->size < 0)
+      printf("    %6s  %s (no stack info)\n", "?", fp->name);
+    else
+      printf("    %6ld  %s%s%s%s\n", fp->size, fp->name,
+             fp->dynamic ? " (dynamic)" : "",
+             fp->recursive ? " (recursive)" : "",
+             fp->indirect ? " (indirect call)" : "");
+  }
+}
+
+/* 起点から到達できる関数のうち、たどれない間接呼び出しのあるものを表示する */
+static void print_unresolved(int index, char *mark)
+{
+  func *fp = &funcs[index];
+  int i;
+
+  if (mark[index])
+    return;
+  mark[index] = 1;
+  if (fp->indirect)
+    printf("    warning: indirect call in %s is not followed\n", fp->name);
+  if (fp->size < 0)
+    printf("    warning: no stack info for %s\n", fp->name);
+  for (i = 0; i < fp->callee_num; i++)
+    print_unresolved(fp->callees[i], mark);
+}
+
+int main(int argc, char *argv[])
+{
+  long margin = 0, total;
+  char *p, *mark, *watermark = NULL, *output = NULL;
+  int i, r, over = 0;
+
+  for (argc--, argv++; (argc > 0) && (argv[0][0] == '-'); argc--, argv++) {
+    if (argc < 2) {
+      argc = 0; /* 使い方を表示する */
+      break;
+    }
+    if (!strcmp(argv[0], "-m")) {
+      margin = strtol(argv[1], NULL, 0);
+    } else if (!strcmp(argv[0], "-r") && (root_num < ROOT_MAX)) {
+      roots[root_num].name = argv[1];
+      if ((p = strchr(argv[1], '=')) != NULL) {
+        *p++ = '\0';
+        roots[root_num].limit = strtol(p, &p, 0);
+        roots[root_num].nomargin = (*p == '!');
+      }
+      root_num++;
+    } else if (!strcmp(argv[0], "-s")) {
+      if (read_stacksize(argv[1]) < 0)
+        return 1;
+    } else if (!strcmp(argv[0], "-w")) {
+      watermark = argv[1];
+    } else if (!strcmp(argv[0], "-o")) {
+      output = argv[1];
+    } else if (!strcmp(argv[0], "-I") && (indirect_num < INDIRECT_MAX)
+               && ((p = strchr(argv[1], '=')) != NULL)) {
+      *p++ = '\0';
+      indirects[indirect_num].caller = argv[1];
+      indirects[indirect_num].pattern = p;
+      indirect_num++;
+    } else {
+      argc = 0;
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if ((argc < 1) || !root_num || (!watermark != !output)) {
+    fprintf(stderr, "usage: kzstack [-m <margin>] [-I <caller>=<pattern>]... "
+            "[-w <watermark file> -o <header>] [-s <header>] "
+            "-r <func>[=<limit>[!]]... <.ci file>...\n");
+    return 1;
+  }
+  for (i = 0; i < argc; i++) {
+    if (read_ci(argv[i]) < 0)
+      return 1;
+  }
+  resolve_indirects();
+  if (watermark && (read_watermark(watermark) < 0))
+    return 1;
+
+  mark = malloc(func_num);
+  if (mark == NULL) {
+    fprintf(stderr, "out of memory.\n");
+    return 1;
+  }
+  printf("%-20s %6s %6s  %s\n", "root", "depth", "limit", "result");
+  for (r = 0; r < root_num; r++) {
+    if ((i = func_find_name(roots[r].name)) < 0) {
+      printf("%-20s %6s %6s  not found\n", roots[r].name, "-", "-");
+      continue;
+    }
+    total = depth(i) + (roots[r].nomargin ? 0 : margin);
+    roots[r].total = total;
+    if (roots[r].limit)
+      printf("%-20s %6ld %6ld  %s\n", roots[r].name, total, roots[r].limit,
+             (total > roots[r].limit) ? "OVER" : "ok");
+    else
+      printf("%-20s %6ld %6s\n", roots[r].name, total, "-");
+    if (roots[r].limit && (total > roots[r].limit))
+      over = 1;
+    print_path(i);
+    memset(mark, 0, func_num);
+    print_unresolved(i, mark);
+  }
+
+  if (output) {
+    if (write_stacksize(output, margin) < 0)
+      return 1;
+    return 0;
+  }
+  return over;
+}
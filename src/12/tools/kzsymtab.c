@@ -0,0 +1,83 @@
+/*
+ * kzsymtab: OSに組み込むシンボル表(os/symtab.h)のソースを作る
+ * (ホストで実行するツール。os の make SYMTAB=1 で使う)
+ *
+ *   h8300-elf-nm -n kozos | kzsymtab > syms.c
+ *
+ * 入力は nm -n の出力（アドレス順）で、kzprof と同じくテキストのシンボル
+ * (t, T)のみを使う。同じアドレスのシンボルは最初のものだけにし、
+ * GCCのローカルラベル(.L で始まるもの)は除く。
+ * 表と名前の文字列はどちらも .kzsyms セクション(ld.scr で外部DRAMの
+ * コードの後ろに置く)に入れるので、表の大きさが変わっても関数の配置は
+ * 変わらない。入力が空ならば空の表を出力する（1回目のリンクで使い、
+ * そのシンボルで作った表で2回目のリンクを行う）。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMBOL_MAX 4096
+#define LINE_SIZE  256
+#define NAMES_MAX  0x10000 /* 名前の位置は16ビット */
+
+static struct {
+  unsigned long addr;
+  char *name;
+  unsigned long offset; /* 名前の文字列の中の位置 */
+} symbols[SYMBOL_MAX];
+static int symbol_num;
+
+int main(int argc, char *argv[])
+{
+  char line[LINE_SIZE], name[LINE_SIZE], type, *p;
+  unsigned long addr, names = 0;
+  int i;
+
+  while (fgets(line, sizeof(line), stdin)) {
+    if (sscanf(line, "%lx %c %255s", &addr, &type, name) != 3)
+      continue;
+    if ((type != 't') && (type != 'T'))
+      continue;
+    /* H8のGCCはシンボルの先頭に _ を付ける */
+    p = (name[0] == '_') ? name + 1 : name;
+    if (!strncmp(p, ".L", 2))
+      continue;
+    if (symbol_num && (symbols[symbol_num - 1].addr == addr))
+      continue;
+    if (symbol_num == SYMBOL_MAX) {
+      fprintf(stderr, "kzsymtab: too many symbols.\n");
+      return 1;
+    }
+    symbols[symbol_num].addr = addr;
+    symbols[symbol_num].name = strdup(p);
+    symbols[symbol_num].offset = names;
+    names += strlen(p) + 1;
+    if (names > NAMES_MAX) {
+      fprintf(stderr, "kzsymtab: names too large.\n");
+      return 1;
+    }
+    symbol_num++;
+  }
+
+  printf("/* tools/kzsymtab で作成したシンボル表(symtab.h) */\n");
+  printf("#include \"defines.h\"\n");
+  printf("#include \"symtab.h\"\n\n");
+
+  printf("const int kz_symtab_num = %d;\n\n", symbol_num);
+
+  printf("const kz_symbol_t kz_symtab[%d] KZ_SYMTAB_SECTION = {\n",
+         symbol_num ? symbol_num : 1);
+  for (i = 0; i < symbol_num; i++)
+    printf("  { 0x%06lx, 0x%04lx }, /* %s */\n",
+           symbols[i].addr, symbols[i].offset, symbols[i].name);
+  if (!symbol_num)
+    printf("  { 0, 0 },\n");
+  printf("};\n\n");
+
+  printf("const char kz_symnames[] KZ_SYMTAB_SECTION =\n");
+  for (i = 0; i < symbol_num; i++)
+    printf("  \"%s\\0\"\n", symbols[i].name);
+  printf("  \"\";\n");
+
+  return 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * kztrace: カーネルのイベントトレース(trace dump raw の出力)を解析する
+ * (ホストで実行するツール。出力の形式は os/command.c の trace_dump_raw())
+ *
+ *   kztrace [-j] [-s <syscall.h>] [<コンソールのログ>]
+ *
+ * ログの中の最後の #kztrace ～ #end の枠を読み、合計を確かめてから
+ * 記録を時刻・スレッド名つきの時系列で表示する。
+ * 時刻は最初の記録からのマイクロ秒で、ティックの下位16ビットの桁あふれは
+ * 記録が古い順に並んでいることを使って補正する。
+ *
+ * -j を指定すると Chrome trace(chrome://tracing, Perfetto で開ける)の JSON を
+ * 出力する。スレッドごとのトラックに、ディスパッチから次のディスパッチまでの
+ * 実行区間と、システムコールなどのイベントを置く。割り込みとサービスコールは
+ * 「intr」のトラックに置く。
+ * -s で os/syscall.h を指定すると、システムコールの種類を名前で表示する
+ * (enum の KZ_SYSCALL_TYPE_ の並び順から番号を求める)。
+ * kz_strace() したスレッドの引数・戻り値(sysarg, sysret)は時刻を持たないので
+ * 直前の記録の時刻とし、値を表示する。終了(sysexit)には同じスレッドの
+ * 直前の syscall からの処理時間を付ける。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAX  1024 /* 読み込める記録の最大数 */
+#define THREAD_MAX 64   /* 読み込めるスレッド名の最大数 */
+#define LINE_SIZE  256
+#define SYSCALL_MAX 128 /* 読み込めるシステムコールの名前の最大数 */
+
+/* os/trace.h のイベントの種類と合わせること */
+static const char *event_names[] = {
+  "?", "syscall", "srvcall", "intr", "dispatch",
+  "send", "recv", "kmalloc", "kmfree",
+  "sysarg", "sysexit", "sysret",
+};
+
+#define EVENT_SYSARG  9
+#define EVENT_SYSEXIT 10
+#define EVENT_SYSRET  11
+#define SYSEXIT_BLOCKED 0x80
+
+/* 時刻の代わりに値を持つ記録か */
+#define IS_VALUE(rp) (((rp)->event == EVENT_SYSARG) || ((rp)->event == EVENT_SYSRET))
+
+#define EVENT_NUM ((int)(sizeof(event_names) / sizeof(*event_names)))
+
+typedef struct {
+  unsigned int tick;
+  unsigned int count;
+  unsigned int thread;
+  unsigned int event;
+  unsigned int arg;
+} trace_rec;
+
+static trace_rec recs[TRACE_MAX];
+static int rec_num;
+
+static struct {
+  unsigned int id;
+  char name[32];
+} threads[THREAD_MAX];
+static int thread_num;
+
+static unsigned int period, tick_msec;
+
+static char *syscall_names[SYSCALL_MAX];
+static int syscall_num;
+
+/* syscall.h の enum からシステムコールの名前を読み込む */
+static int read_syscalls(const char *filename)
+{
+  char line[LINE_SIZE], name[64];
+  FILE *fp;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    perror(filename);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp) && (syscall_num < SYSCALL_MAX)) {
+    if (sscanf(line, " KZ_SYSCALL_TYPE_%63[A-Z0-9_]", name) != 1)
+      continue;
+    if (!strcmp(name, "NUM"))
+      break;
+    syscall_names[syscall_num++] = strdup(name);
+  }
+  fclose(fp);
+  return 0;
+}
+
+/* イベントの引数の表示（システムコールは名前がわかれば名前にする） */
+static const char *event_arg(trace_rec *rp)
+{
+  static char buf[64];
+  unsigned int type = rp->arg & ~SYSEXIT_BLOCKED;
+
+  if (IS_VALUE(rp)) {
+    sprintf(buf, "%x = %x", rp->arg, (rp->tick << 16) | rp->count);
+    return buf;
+  }
+  if (rp->event == EVENT_SYSEXIT) {
+    if ((int)type < syscall_num)
+      sprintf(buf, "%s", syscall_names[type]);
+    else
+      sprintf(buf, "%x", type);
+    if (rp->arg & SYSEXIT_BLOCKED)
+      strcat(buf, " (blocked)");
+    return buf;
+  }
+  if (((rp->event == 1) || (rp->event == 2)) && ((int)rp->arg < syscall_num))
+    return syscall_names[rp->arg];
+  sprintf(buf, "%x", rp->arg);
+  return buf;
+}
+
+static const char *thread_name(unsigned int id)
+{
+  int i;
+
+  if (!id)
+    return "-";
+  for (i = 0; i < thread_num; i++) {
+    if (threads[i].id == id)
+      return threads[i].name;
+  }
+  return "?";
+}
+
+/* ログを読み、最後の枠の内容を取り込む（正しい枠がなければ -1） */
+static int read_log(FILE *fp)
+{
+  char line[LINE_SIZE];
+  unsigned int num = 0, sum = 0, check;
+  int in_frame = 0, found = 0;
+  trace_rec *rp;
+  char *p;
+
+  while (fgets(line, sizeof(line), fp)) {
+    /* 改行コード(\r\n)とプロンプトの付いた行を考慮して、行中の枠も探す */
+    if ((p = strchr(line, '\r')) != NULL)
+      *p = '\0';
+    if ((p = strstr(line, "#kztrace ")) != NULL) {
+      /*
+       * 新しい枠の先頭では、前の枠の結果を捨てる（途中で切れた枠の記録が
+       * 前の完全な枠の結果として表示されないように、最後の枠だけを使う）
+       */
+      found = 0;
+      rec_num = 0;
+      thread_num = 0;
+      sum = 0;
+      in_frame = (sscanf(p, "#kztrace %x %x %x", &num, &period,
+                         &tick_msec) == 3);
+      continue;
+    }
+    if (!in_frame)
+      continue;
+
+    if (!strncmp(line, "#end ", 5)) {
+      in_frame = 0;
+      if ((sscanf(line, "#end %x", &check) != 1)
+          || (check != (sum & 0xffff)) || (rec_num != (int)num)) {
+        fprintf(stderr, "broken frame (%d/%u records)\n", rec_num, num);
+        continue;
+      }
+      found = 1;
+    } else if (line[0] == 'N') {
+      if (thread_num < THREAD_MAX) {
+        if (sscanf(line, "N %x %31s", &threads[thread_num].id,
+                   threads[thread_num].name) == 2)
+          thread_num++;
+      }
+    } else if (line[0] == 'R') {
+      if (rec_num >= TRACE_MAX)
+        continue;
+      rp = &recs[rec_num];
+      if (sscanf(line, "R %x %x %x %x %x", &rp->tick, &rp->count,
+                 &rp->thread, &rp->event, &rp->arg) != 5)
+        continue;
+      sum += rp->tick + rp->count + rp->thread + rp->event + rp->arg;
+      rec_num++;
+    }
+  }
+
+  return found ? 0 : -1;
+}
+
+/*
+ * 記録の時刻（最初の記録からのマイクロ秒）を求める
+ * 記録の順に呼ぶこと。値を持つ記録は、直前の記録の時刻とする。
+ */
+static double rec_times[TRACE_MAX];
+
+static double rec_time(int index)
+{
+  static unsigned long ticks;
+  static unsigned int last;
+  static int started;
+  static double t;
+  trace_rec *rp = &recs[index];
+
+  if (index == 0) {
+    ticks = 0;
+    started = 0;
+    t = 0;
+  }
+  if (!IS_VALUE(rp)) {
+    if (started)
+      ticks += (rp->tick - last) & 0xffff;
+    started = 1;
+    last = rp->tick;
+    t = ((double)ticks + (double)rp->count / period) * tick_msec * 1000.0;
+  }
+  rec_times[index] = t;
+  return t;
+}
+
+/*
+ * sysexit の処理時間（同じスレッドの直前の syscall からのマイクロ秒）
+ * 対応する syscall がなければ負の値
+ */
+static double syscall_duration(int index)
+{
+  int i;
+
+  for (i = index - 1; i >= 0; i--) {
+    if ((recs[i].thread == recs[index].thread) && (recs[i].event == 1))
+      return rec_times[index] - rec_times[i];
+  }
+  return -1;
+}
+
+/* 記録の表示（テキストの時系列） */
+static void print_text(void)
+{
+  double t, t0 = 0, dur;
+  trace_rec *rp;
+  int i;
+
+  printf("%12s %6s  %-16s%-9s%s\n", "time(us)", "delta", "thread", "event", "arg");
+  for (i = 0; i < rec_num; i++) {
+    rp = &recs[i];
+    t = rec_time(i);
+    printf("%12.1f %6.1f  %-16s%-9s%s", t, i ? t - t0 : 0.0,
+           thread_name(rp->thread),
+           (rp->event < EVENT_NUM) ? event_names[rp->event] : "?",
+           event_arg(rp));
+    if ((rp->event == EVENT_SYSEXIT) && ((dur = syscall_duration(i)) >= 0))
+      printf(" %.1fus", dur);
+    printf("\n");
+    t0 = t;
+  }
+}
+
+/* JSON の1つのイベントの出力（2つ目以降は区切りを付ける） */
+static void json_event(int *firstp, const char *name, const char *ph,
+                       double ts, double dur, unsigned int tid)
+{
+  printf("%s\n  {\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.1f, ",
+         *firstp ? "" : ",", name, ph, ts);
+  if (*ph == 'X')
+    printf("\"dur\": %.1f, ", dur);
+  else if (*ph == 'i')
+    printf("\"s\": \"t\", ");
+  printf("\"pid\": 1, \"tid\": %u}", tid);
+  *firstp = 0;
+}
+
+/*
+ * 記録の出力（Chrome trace の JSON）
+ * tid はスレッドIDの下位16ビットで、割り込みのトラックは0にする。
+ * 実行区間は、ディスパッチされたスレッドを次のディスパッチ（最後は最後の記録）
+ * まで実行中とする（割り込み処理の時間も含む）。
+ */
+static void print_json(void)
+{
+  char name[64];
+  double t, run_start = 0;
+  unsigned int running = 0, tid;
+  trace_rec *rp;
+  int i, first = 1;
+
+  printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  for (i = 0; i < thread_num; i++) {
+    printf("%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+           "\"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+           first ? "" : ",", threads[i].id, threads[i].name);
+    first = 0;
+  }
+  printf("%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+         "\"tid\": 0, \"args\": {\"name\": \"intr\"}}", first ? "" : ",");
+  first = 0;
+
+  for (i = 0; i < rec_num; i++) {
+    rp = &recs[i];
+    t = rec_time(i);
+    if (rp->event == 4) { /* dispatch */
+      if (running)
+        json_event(&first, "run", "X", run_start, t - run_start, running);
+      running = rp->thread;
+      run_start = t;
+      continue;
+    }
+    /* 割り込みとサービスコールは割り込みのトラック、他は記録のスレッドに置く */
+    tid = ((rp->event == 2) || (rp->event == 3)) ? 0 : rp->thread;
+    snprintf(name, sizeof(name), "%s %s",
+             (rp->event < EVENT_NUM) ? event_names[rp->event] : "?",
+             event_arg(rp));
+    json_event(&first, name, "i", t, 0, tid);
+  }
+  if (running && rec_num)
+    json_event(&first, "run", "X", run_start, t - run_start, running);
+  printf("\n]}\n");
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *fp = stdin;
+  int json = 0;
+
+  for (argc--, argv++; (argc > 0) && (argv[0][0] == '-'); argc--, argv++) {
+    if (!strcmp(argv[0], "-j")) {
+      json = 1;
+    } else if (!strcmp(argv[0], "-s") && (argc > 1)) {
+      if (read_syscalls(argv[1]) < 0)
+        return 1;
+      argc--;
+      argv++;
+    } else {
+      argc = 2; /* 使い方を表示する */
+      break;
+    }
+  }
+  if (argc > 1) {
+    fprintf(stderr, "usage: kztrace [-j] [-s <syscall.h>] [<console log>]\n");
+    return 1;
+  }
+  if (argc == 1) {
+    fp = fopen(argv[0], "r");
+    if (fp == NULL) {
+      perror(argv[0]);
+      return 1;
+    }
+  }
+  if (read_log(fp) < 0) {
+    fprintf(stderr, "no trace frame found.\n");
+    return 1;
+  }
+  if (!period || !tick_msec) {
+    fprintf(stderr, "bad timer parameters.\n");
+    return 1;
+  }
+
+  if (json)
+    print_json();
+  else
+    print_text();
+
+  return 0;
+}
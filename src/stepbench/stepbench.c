@@ -0,0 +1,288 @@
+#include "defines.h"
+#include "kozos.h"
+#include "interrupt.h"
+#include "lib.h"
+
+/*
+ * ステップ間の比較用マイクロベンチマーク
+ * src/10, src/11, src/12 のOSに共通のシステムコールだけを使い、同じ処理の
+ * 時間を測定する（make STEP=10 などで、そのステップの os のソースとリンクする）。
+ * main.c の代わりにリンクし、ベンチマークを1回実行して結果を表示する。
+ *
+ * 時間は16ビットタイマ(ITU)のチャネル2を φ/8 (0.4us単位) のフリーランで
+ * 使って測る。チャネル2はどのステップのOSも使っていない（src/12 のティックは
+ * チャネル0）。src/12 ではティックの割り込みが入るので、最小値で比べること。
+ *
+ * 結果は1つの処理ごとに
+ *   #stepbench <ステップ> <名前> <最小> <最大> <平均>
+ * の形式（数値は16進のカウント数）で表示する。ステップごとのログを集めて
+ * make table LOGS="..." で表にする(table.awk)。
+ */
+
+#ifndef STEPBENCH_STEP
+#error "STEPBENCH_STEP is not defined (build with make STEP=...)"
+#endif
+
+/* 繰り返し回数（平均を割り算なしで求めるので2のべき乗にする） */
+#define STEPBENCH_LOOP_SHIFT 6
+#define STEPBENCH_PRIORITY   2
+#define STEPBENCH_HELPER_PRIORITY 1
+
+/*
+ * src/11 以降はメッセージボックス0を使う
+ * (src/12 では固定IDの0はコンソール用だが、コンソールドライバを起動しないので空いている)
+ */
+#if STEPBENCH_STEP >= 11
+#define STEPBENCH_MSG
+#define STEPBENCH_MSGBOX ((kz_msgbox_id_t)0)
+#endif
+
+/* src/12 の kz_sleep() は引数にティック数を取る（0で kz_wakeup() まで待つ） */
+#if STEPBENCH_STEP >= 12
+#define STEPBENCH_SLEEP() kz_sleep(0)
+#else
+#define STEPBENCH_SLEEP() kz_sleep()
+#endif
+
+/*
+ * src/12 では優先度0は割り込み禁止を意味しないので、idle は属性で
+ * 割り込み禁止にして起動する（src/12 の main.c と同じ）
+ */
+#if STEPBENCH_STEP >= 12
+#define STEPBENCH_IDLE_ATTR (0 | KZ_THREAD_ATTR_INTRMASK)
+#else
+#define STEPBENCH_IDLE_ATTR 0
+#endif
+
+/* 16ビットタイマのチャネル2 */
+#define H8_3069F_TMR16_TSTR     ((volatile uint8 *)0xffff60)
+#define H8_3069F_TMR16_CH2_TCR  ((volatile uint8 *)0xffff78)
+#define H8_3069F_TMR16_CH2_TIOR ((volatile uint8 *)0xffff79)
+#define H8_3069F_TMR16_CH2_TCNT ((volatile uint16 *)0xffff7a)
+
+#define H8_3069F_TMR16_TCR_PER8 (3<<0)
+#define H8_3069F_TMR16_TSTR_STR2 (1<<2)
+
+static struct {
+  uint16 min;
+  uint16 max;
+  uint32 total;
+} result;
+
+static kz_thread_id_t sleeper_id;
+
+static void stepbench_timer_init(void)
+{
+  *H8_3069F_TMR16_TSTR &= ~H8_3069F_TMR16_TSTR_STR2;
+  *H8_3069F_TMR16_CH2_TCR  = H8_3069F_TMR16_TCR_PER8; /* クリアしない */
+  *H8_3069F_TMR16_CH2_TIOR = 0;
+  *H8_3069F_TMR16_CH2_TCNT = 0;
+  *H8_3069F_TMR16_TSTR |= H8_3069F_TMR16_TSTR_STR2;
+}
+
+static uint16 stepbench_now(void)
+{
+  return *H8_3069F_TMR16_CH2_TCNT;
+}
+
+static void result_init(void)
+{
+  result.min = 0xffff;
+  result.max = 0;
+  result.total = 0;
+}
+
+/* 1回の測定の結果を加える（カウンタの1周分(26ms)より短い処理のみ） */
+static void result_add(uint16 start, uint16 end)
+{
+  uint16 elapsed = end - start;
+
+  if (elapsed < result.min)
+    result.min = elapsed;
+  if (elapsed > result.max)
+    result.max = elapsed;
+  result.total += elapsed;
+}
+
+static void result_print(char *name)
+{
+  puts("#stepbench ");
+  putxval(STEPBENCH_STEP, 0);
+  puts(" ");
+  puts(name);
+  puts(" ");
+  putxval(result.min, 0);
+  puts(" ");
+  putxval(result.max, 0);
+  puts(" ");
+  putxval(result.total >> STEPBENCH_LOOP_SHIFT, 0);
+  puts("\n");
+}
+
+/* kz_wakeup() されるたびに、すぐにスリープに戻る */
+static int stepbench_sleeper(int argc, char *argv[])
+{
+  while (1)
+    STEPBENCH_SLEEP();
+  return 0;
+}
+
+#ifdef STEPBENCH_MSG
+/* メッセージを受信するたびに、すぐに次の受信待ちに戻る */
+static int stepbench_receiver(int argc, char *argv[])
+{
+  int size;
+  char *p;
+
+  while (1)
+    kz_recv(STEPBENCH_MSGBOX, &size, &p);
+  return 0;
+}
+#endif
+
+/* 測定そのもののオーバーヘッド（他の結果から引いて比べる） */
+static void bench_null(void)
+{
+  uint16 start;
+  int i;
+
+  result_init();
+  for (i = 0; i < (1 << STEPBENCH_LOOP_SHIFT); i++) {
+    start = stepbench_now();
+    result_add(start, stepbench_now());
+  }
+  result_print("null");
+}
+
+/* ディスパッチを伴わないシステムコール（同じ優先度への kz_chpri()） */
+static void bench_chpri(void)
+{
+  uint16 start;
+  int i;
+
+  result_init();
+  for (i = 0; i < (1 << STEPBENCH_LOOP_SHIFT); i++) {
+    start = stepbench_now();
+    kz_chpri(STEPBENCH_PRIORITY);
+    result_add(start, stepbench_now());
+  }
+  result_print("chpri");
+}
+
+/* 同じ優先度に他のスレッドがない kz_wait()（レディキューの付け替えのみ） */
+static void bench_wait(void)
+{
+  uint16 start;
+  int i;
+
+  result_init();
+  for (i = 0; i < (1 << STEPBENCH_LOOP_SHIFT); i++) {
+    start = stepbench_now();
+    kz_wait();
+    result_add(start, stepbench_now());
+  }
+  result_print("wait");
+}
+
+/* 高優先度のスレッドの kz_wakeup() から、そのスレッドがスリープして戻るまで */
+static void bench_wakeup(void)
+{
+  uint16 start;
+  int i;
+
+  result_init();
+  for (i = 0; i < (1 << STEPBENCH_LOOP_SHIFT); i++) {
+    start = stepbench_now();
+    kz_wakeup(sleeper_id);
+    result_add(start, stepbench_now());
+  }
+  result_print("wakeup");
+}
+
+/* kz_kmalloc() と kz_kmfree() の組 */
+static void bench_kmalloc(void)
+{
+  uint16 start;
+  char *p;
+  int i;
+
+  result_init();
+  for (i = 0; i < (1 << STEPBENCH_LOOP_SHIFT); i++) {
+    start = stepbench_now();
+    p = kz_kmalloc(16);
+    kz_kmfree(p);
+    result_add(start, stepbench_now());
+  }
+  result_print("kmalloc");
+}
+
+#ifdef STEPBENCH_MSG
+/* 受信待ちの高優先度のスレッドへの kz_send() から、次の受信待ちで戻るまで */
+static void bench_send(void)
+{
+  uint16 start;
+  int i;
+
+  result_init();
+  for (i = 0; i < (1 << STEPBENCH_LOOP_SHIFT); i++) {
+    start = stepbench_now();
+    kz_send(STEPBENCH_MSGBOX, 0, NULL);
+    result_add(start, stepbench_now());
+  }
+  result_print("send");
+}
+#endif
+
+static int stepbench_main(int argc, char *argv[])
+{
+  stepbench_timer_init();
+
+  sleeper_id = kz_run(stepbench_sleeper, "sleeper",
+                      STEPBENCH_HELPER_PRIORITY, 0x100, 0, NULL);
+#ifdef STEPBENCH_MSG
+  kz_run(stepbench_receiver, "receiver",
+         STEPBENCH_HELPER_PRIORITY, 0x100, 0, NULL);
+#endif
+
+  bench_null();
+  bench_chpri();
+  bench_wait();
+  bench_wakeup();
+  bench_kmalloc();
+#ifdef STEPBENCH_MSG
+  bench_send();
+#endif
+  puts("#stepbench end\n");
+
+  return 0;
+}
+
+/* ベンチマークスレッドの起動 */
+static int start_threads(int argc, char *argv[])
+{
+  kz_run(stepbench_main, "stepbench", STEPBENCH_PRIORITY, 0x100, 0, NULL);
+
+  /* 優先順位を下げて、アイドルスレッドに移行する */
+  kz_chpri(15);
+  /* 割り込み有効にする */
+  INTR_ENABLE;
+  /* 省電力モードに移行 */
+  while (1) {
+    asm volatile ("sleep");
+  }
+
+  return 0;
+}
+
+int main(void)
+{
+  INTR_DISABLE;
+
+  puts("stepbench boot succeed!\n");
+
+  /* OS の動作開始 */
+  kz_start(start_threads, "idle", STEPBENCH_IDLE_ATTR, 0x100, 0, NULL);
+  /* ここには戻ってこない */
+
+  return 0;
+}
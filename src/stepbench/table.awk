@@ -0,0 +1,65 @@
+#
+# stepbench のログ（#stepbench <ステップ> <名前> <最小> <最大> <平均>）を
+# 処理ごと・ステップごとの表にする
+#   awk -f table.awk log10 log11 log12
+# 各欄は最小と平均のカウント数(10進)で、最後に最小値をマイクロ秒(0.4us単位)で示す。
+# 同じステップ・処理の記録が複数あれば、後のものを使う。
+#
+
+function hex(s,    i, c, v) {
+  v = 0;
+  s = tolower(s);
+  for (i = 1; i <= length(s); i++) {
+    c = index("0123456789abcdef", substr(s, i, 1));
+    if (c == 0)
+      break;
+    v = v * 16 + c - 1;
+  }
+  return v;
+}
+
+# 改行コード(\r\n)と、行の途中からの出力を考慮する
+{
+  sub(/\r$/, "");
+  p = index($0, "#stepbench ");
+  if (!p || (split(substr($0, p), f, " ") != 6))
+    next;
+  step = hex(f[2]);
+  name = f[3];
+  if (!(step in steps)) {
+    steps[step] = 1;
+    step_list[++step_num] = step;
+  }
+  if (!(name in names)) {
+    names[name] = 1;
+    name_list[++name_num] = name;
+  }
+  min[step, name] = hex(f[4]);
+  avg[step, name] = hex(f[6]);
+}
+
+END {
+  printf("%-10s", "bench");
+  for (i = 1; i <= step_num; i++)
+    printf(" %15s", "step" step_list[i] " min/avg");
+  for (i = 1; i <= step_num; i++)
+    printf(" %9s", "step" step_list[i] " us");
+  printf("\n");
+  for (j = 1; j <= name_num; j++) {
+    name = name_list[j];
+    printf("%-10s", name);
+    for (i = 1; i <= step_num; i++) {
+      if ((step_list[i], name) in min)
+        printf(" %15s", min[step_list[i], name] "/" avg[step_list[i], name]);
+      else
+        printf(" %15s", "-");
+    }
+    for (i = 1; i <= step_num; i++) {
+      if ((step_list[i], name) in min)
+        printf(" %9.1f", min[step_list[i], name] * 0.4);
+      else
+        printf(" %9s", "-");
+    }
+    printf("\n");
+  }
+}